@@ -44,6 +44,30 @@ typedef enum detail_entry_state_t {
 	STATE_REPLIED
 } detail_entry_state_t;
 
+/*
+ *	Binary detail file format.  See src/main/detail.c.
+ */
+#define DETAIL_BINARY_MAGIC		"FRdt"
+#define DETAIL_BINARY_MAGIC_LEN		4
+#define DETAIL_BINARY_VERSION		1
+#define DETAIL_BINARY_HDR_LEN		16
+#define DETAIL_BINARY_DONE_OFFSET	5	//!< Offset of the "done" flag in a record header.
+#define DETAIL_BINARY_MAX_DEPTH		8	//!< Maximum nesting of an encoded attribute.
+
+typedef struct detail_binary_hdr_t {
+	bool		done;			//!< Has the record been processed?
+	uint32_t	data_len;		//!< Length of the encoded attributes.
+	time_t		timestamp;		//!< When the packet was received.
+} detail_binary_hdr_t;
+
+void	detail_binary_encode_header(uint8_t *out, size_t data_len, time_t timestamp);
+ssize_t	detail_binary_encode_pair(uint8_t *out, size_t outlen, VALUE_PAIR const *vp);
+ssize_t	detail_binary_decode_header(detail_binary_hdr_t *hdr, uint8_t const *data, size_t data_len);
+ssize_t	detail_binary_decode_pair(TALLOC_CTX *ctx, VALUE_PAIR **out, uint8_t const *data, size_t data_len);
+int	detail_binary_decode_pairs(TALLOC_CTX *ctx, VALUE_PAIR **out, uint8_t const *data, size_t data_len);
+
+typedef struct detail_replay_t detail_replay_t;
+
 typedef struct listen_detail_t {
 	fr_event_timer_t	*ev;	/* has to be first entry (ugh) */
 	char const 	*name;			//!< Identifier used in log messages
@@ -58,6 +82,9 @@ typedef struct listen_detail_t {
 	pthread_t	pthread_id;
 
 	FILE		*fp;
+	bool		binary;			//!< File is in the binary detail format.
+	uint8_t		*map;			//!< Mapping of a binary detail file.
+	size_t		map_len;		//!< Length of the mapping.
 	off_t		offset;
 	detail_file_state_t 	file_state;
 	detail_entry_state_t 	entry_state;
@@ -85,6 +112,14 @@ typedef struct listen_detail_t {
 	uint32_t	counter;
 	struct timeval  last_packet;
 	RADCLIENT	detail_client;
+
+	uint32_t	max_outstanding;	//!< Maximum number of records in flight per reader.
+	uint32_t	num_readers;		//!< Number of readers each file is split between.
+	detail_replay_t	*replay;		//!< Parallel replay state.  NULL if records are
+						//!< sent one at a time.
+	off_t		range_end;		//!< Where this reader's part of the file ends,
+						//!< -1 for the end of the file.
+	bool		range_done;		//!< Reader has finished its part of the file.
 } listen_detail_t;
 
 #ifdef __cplusplus
@@ -30,6 +30,38 @@ RCSIDH(dhcp_h, "$Id$")
 extern "C" {
 #endif
 
+/*
+ *	Most instances of options a packet can contain.  Each one
+ *	takes at least two bytes.
+ */
+#define DHCP_OPTION_FRAGS_MAX	(1500 / 2)
+
+/** One instance of an option
+ *
+ */
+typedef struct {
+	uint16_t		offset;				//!< Of the value, from the start of the indexed data.
+	uint8_t			length;				//!< Of the value.
+	uint16_t		next;				//!< Next instance of the same option, 0 if none.
+} fr_dhcp_option_frag_t;
+
+/** Where each option is in a packet
+ *
+ * Built in one pass.  Options split into several instances (RFC 3396)
+ * have their instances chained together, in the order they appear.
+ */
+typedef struct {
+	uint8_t const		*data;				//!< What the offsets are relative to.
+	uint16_t		first[256];			//!< First instance of each option, 0 if absent.
+	uint16_t		last[256];			//!< Last instance of each option.
+	uint16_t		length[256];			//!< Length of each option, once concatenated.
+	uint8_t			order[256];			//!< Options, in the order they first appear.
+	int			num_options;			//!< Entries in order.
+	int			num_frags;			//!< Entries used in frag.
+	uint8_t			overload;			//!< Value of the overload option (52).
+	fr_dhcp_option_frag_t	frag[DHCP_OPTION_FRAGS_MAX];	//!< frag[0] isn't used.
+} fr_dhcp_option_index_t;
+
 /*
  *	Not for production use.
  */
@@ -56,15 +88,31 @@ ssize_t		fr_dhcp_decode_option(TALLOC_CTX *ctx, vp_cursor_t *cursor,
 				      fr_dict_attr_t const *parent, uint8_t const *data, size_t len,
 				      void *decoder_ctx);
 
+ssize_t		fr_dhcp_decode_options(TALLOC_CTX *ctx, vp_cursor_t *cursor, uint8_t const *data, size_t data_len);
+
 int		fr_dhcp_decode(RADIUS_PACKET *packet);
 
+int		fr_dhcp_packet_index(fr_dhcp_option_index_t *index, uint8_t const *data, size_t data_len);
+
+int		fr_dhcp_options_index(fr_dhcp_option_index_t *index, uint8_t const *data, size_t data_len);
+
+ssize_t		fr_dhcp_option_get(uint8_t const **out, fr_dhcp_option_index_t const *index, uint8_t option,
+				   uint8_t *buffer, size_t buffer_len);
+
 #ifdef HAVE_LINUX_IF_PACKET_H
 #include <linux/if_packet.h>
+#include <freeradius-devel/packet_ring.h>
 int		fr_socket_packet(int iface_index, struct sockaddr_ll *p_ll);
 
 int		fr_dhcp_send_raw_packet(int sockfd, struct sockaddr_ll *p_ll, RADIUS_PACKET *packet);
 
 RADIUS_PACKET	*fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *p_ll, RADIUS_PACKET *request);
+
+#  ifdef HAVE_PACKET_RING
+fr_packet_ring_t *fr_dhcp_packet_ring(TALLOC_CTX *ctx, int iface_index, struct sockaddr_ll *p_ll);
+
+RADIUS_PACKET	*fr_dhcp_recv_raw_ring(fr_packet_ring_t *ring, RADIUS_PACKET *request);
+#  endif
 #endif
 
 int		dhcp_init(void);
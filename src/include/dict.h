@@ -179,6 +179,8 @@ int			fr_dict_parse_str(fr_dict_t *dict, char *buf,
 
 fr_dict_attr_t const	*fr_dict_root(fr_dict_t const *dict);
 
+uint32_t		fr_dict_fingerprint(fr_dict_t *dict);
+
 /*
  *	Unknown ephemeral attributes
  */
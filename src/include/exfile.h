@@ -25,6 +25,8 @@
  */
 RCSIDH(exfile_h, "$Id$")
 
+#include <sys/uio.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -47,6 +49,15 @@ int		exfile_close(exfile_t *lf, REQUEST *request, int fd);
 
 int		exfile_unlock(exfile_t *lf, REQUEST *request, int fd);
 
+void		exfile_enable_buffering(exfile_t *ef, size_t buffer_size, struct timeval const *flush_interval);
+
+void		exfile_enable_sync(exfile_t *ef, bool sync);
+
+ssize_t		exfile_writev(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+			      struct iovec const *vector, int iovcnt);
+
+int		exfile_flush(exfile_t *ef, REQUEST *request, bool force);
+
 #ifdef __cplusplus
 }
 #endif
@@ -408,6 +408,7 @@ typedef struct fr_randctx {
 void		fr_isaac(fr_randctx *ctx);
 void		fr_randinit(fr_randctx *ctx, int flag);
 uint32_t	fr_rand(void);	/* like rand(), but better. */
+uint32_t	fr_rand_from_ctx(fr_randctx *ctx);
 void		fr_rand_seed(void const *, size_t ); /* seed the random pool */
 
 
@@ -136,6 +136,31 @@ typedef int (*module_thread_t)(CONF_SECTION const *mod_cs, void *instance, fr_ev
  */
 typedef int (*module_thread_detach_t)(void *thread);
 
+/** Run a radmin command provided by a module
+ *
+ * @param[in] ctx		to allocate the output in.
+ * @param[out] out		Where to write the output of the command, or an error message.
+ * @param[in] instance		data of the module.
+ * @param[in] argc		Number of arguments.
+ * @param[in] argv		Arguments, following the name of the command.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+typedef int (*module_command_func_t)(TALLOC_CTX *ctx, char **out, void *instance, int argc, char *argv[]);
+
+/** A radmin command provided by a module
+ *
+ * Commands are run with "show module command <module> <command>" if they're
+ * read only, or "set module command <module> <command>" otherwise.
+ */
+typedef struct {
+	char const		*command;		//!< Name of the command.
+	bool			write;			//!< Whether the command changes the state of the module.
+	char const		*help;			//!< Usage and description of the command.
+	module_command_func_t	func;			//!< Function to run the command.
+} module_command_t;
+
 /** Struct exported by a rlm_* module
  *
  * Determines the capabilities of the module, and maps internal functions
@@ -155,6 +180,9 @@ typedef struct rad_module_t {
 	size_t			thread_inst_size;	//!< Size of data to allocate to the thread instance.
 
 	module_method_t		methods[MOD_COUNT];	//!< Pointers to the various section callbacks.
+
+	module_command_t const	*commands;		//!< radmin commands, terminated by an entry with a
+							//!< NULL command.
 } rad_module_t;
 
 /*
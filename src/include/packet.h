@@ -38,6 +38,7 @@ int fr_socket(fr_ipaddr_t const *ipaddr, uint16_t port);
 typedef struct fr_packet_list_t fr_packet_list_t;
 
 fr_packet_list_t *fr_packet_list_create(int alloc_id);
+void fr_packet_list_rand_set(fr_packet_list_t *pl, fr_randctx *randctx);
 void fr_packet_list_free(fr_packet_list_t *pl);
 bool fr_packet_list_insert(fr_packet_list_t *pl,
 			    RADIUS_PACKET **request_p);
@@ -62,6 +63,7 @@ bool fr_packet_list_socket_thaw(fr_packet_list_t *pl, int sockfd);
 int fr_packet_list_walk(fr_packet_list_t *pl, void *ctx, rb_walker_t callback);
 int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set);
 RADIUS_PACKET *fr_packet_list_recv(fr_packet_list_t *pl, fd_set *set);
+int fr_packet_list_poll(fr_packet_list_t *pl, RADIUS_PACKET **out, struct timeval *timeout);
 
 uint32_t fr_packet_list_num_incoming(fr_packet_list_t *pl);
 uint32_t fr_packet_list_num_outgoing(fr_packet_list_t *pl);
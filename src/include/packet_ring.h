@@ -0,0 +1,76 @@
+/*
+ *  This program is free software; you can redistribute it and/or modify
+ *  it under the terms of the GNU General Public License as published by
+ *  the Free Software Foundation; either version 2 of the License, or
+ *  (at your option) any later version.
+ *
+ *  This program is distributed in the hope that it will be useful,
+ *  but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *  MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *  GNU General Public License for more details.
+ *
+ *  You should have received a copy of the GNU General Public License
+ *  along with this program; if not, write to the Free Software
+ *  Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _FR_PACKET_RING_H
+#define _FR_PACKET_RING_H
+/**
+ * $Id$
+ *
+ * @file include/packet_ring.h
+ * @brief Memory mapped AF_PACKET receive rings.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(packet_ring_h, "$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_LINUX_IF_PACKET_H
+#  include <linux/if_packet.h>
+#  include <linux/filter.h>
+#  ifdef TPACKET3_HDRLEN
+#    define HAVE_PACKET_RING 1
+#  endif
+#endif
+
+#ifdef HAVE_PACKET_RING
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define PACKET_RING_BLOCK_SIZE		(1 << 20)	//!< Size of each block in the ring.
+#define PACKET_RING_BLOCKS_MIN		(4)		//!< Smallest number of blocks we'll allocate.
+#define PACKET_RING_SIZE_DEFAULT	(PACKET_RING_BLOCK_SIZE * 16)
+#define PACKET_RING_TIMEOUT		(10)		//!< How long (ms) the kernel waits before handing
+							//!< us a block which isn't full.
+
+typedef struct fr_packet_ring fr_packet_ring_t;
+
+/** A frame read from a packet ring
+ *
+ * The frame points into the ring.  It's only valid until the next call
+ * to #fr_packet_ring_next.
+ */
+typedef struct fr_packet_ring_frame {
+	uint8_t const		*data;		//!< Start of the link layer header.
+	size_t			len;		//!< How much of the frame was captured.
+	size_t			wire_len;	//!< How long the frame was on the wire.
+	struct timeval		timestamp;	//!< When the kernel received the frame.
+	struct sockaddr_ll const *ll;		//!< Which interface the frame arrived on, and how.
+} fr_packet_ring_frame_t;
+
+fr_packet_ring_t	*fr_packet_ring_alloc(TALLOC_CTX *ctx, int if_index, uint16_t protocol,
+					      size_t size, bool promiscuous);
+int			fr_packet_ring_fd(fr_packet_ring_t const *ring);
+int			fr_packet_ring_hatype(fr_packet_ring_t const *ring);
+int			fr_packet_ring_filter(fr_packet_ring_t *ring, struct sock_filter const *filter, uint16_t len);
+int			fr_packet_ring_next(fr_packet_ring_t *ring, fr_packet_ring_frame_t *frame);
+int			fr_packet_ring_stats(fr_packet_ring_t *ring, uint64_t *received, uint64_t *dropped);
+
+#ifdef __cplusplus
+}
+#endif
+#endif
+#endif /* _FR_PACKET_RING_H */
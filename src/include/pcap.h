@@ -29,6 +29,7 @@ RCSIDH(pcap_h, "$Id$")
 
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/net.h>
+#include <freeradius-devel/packet_ring.h>
 
 #include <sys/types.h>
 #include <pcap.h>
@@ -86,6 +87,8 @@ struct fr_pcap {
 	int			buffer_pkts;			//!< How big to make the PCAP ring buffer.
 								//!< Actual buffer size is SNAPLEN * buffer.
 								//!< Only valid for live capture handles.
+	bool			use_ring;			//!< Capture with a memory mapped ring, instead of
+								//!< libpcap.  Only valid for PCAP_INTERFACE_IN.
 
 	pcap_t			*handle;			//!< libpcap handle.
 	pcap_dumper_t		*dumper;			//!< libpcap dumper handle.
@@ -95,6 +98,11 @@ struct fr_pcap {
 	int			fd;				//!< Selectable file descriptor we feed to select.
 	struct pcap_stat	pstats;				//!< The last set of pcap stats for this handle.
 
+#ifdef HAVE_PACKET_RING
+	fr_packet_ring_t	*ring;				//!< Memory mapped receive ring.
+	struct pcap_pkthdr	ring_header;			//!< Header for the last frame read from the ring.
+#endif
+
 	fr_pcap_t		*next;				//!< Next handle in collection.
 };
 
@@ -102,6 +110,8 @@ int		fr_pcap_if_link_layer(char *errbuff, pcap_if_t *dev);
 fr_pcap_t	*fr_pcap_init(TALLOC_CTX *ctx, char const *name, fr_pcap_type_t type);
 int		fr_pcap_open(fr_pcap_t *handle);
 int		fr_pcap_apply_filter(fr_pcap_t *handle, char const *expression);
+int		fr_pcap_next(fr_pcap_t *handle, struct pcap_pkthdr **header, uint8_t const **data);
+int		fr_pcap_stats(fr_pcap_t *handle, struct pcap_stat *stats);
 char		*fr_pcap_device_names(TALLOC_CTX *ctx, fr_pcap_t *handle, char c);
 int		fr_pcap_mac_addr(uint8_t *macaddr, char *ifname);
 #endif
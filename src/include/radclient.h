@@ -88,6 +88,27 @@ struct rc_request {
 	char const	*name;		//!< Test name (as specified in the request).
 };
 
+/*
+ *	Load generation mode.
+ */
+typedef struct rc_load_config {
+	uint32_t	rate;		//!< Target packets per second, across all threads.
+	uint32_t	duration;	//!< How long to send packets for (in seconds).
+	int		threads;	//!< Number of threads sending packets.
+	int		sockets;	//!< Number of sockets each thread sends from.
+
+	int		retries;	//!< Times to send each packet before giving up.
+	float		timeout;	//!< Seconds to wait before retransmitting.
+	char const	*secret;	//!< Shared secret.
+
+	fr_ipaddr_t	client_ipaddr;	//!< Where to send packets from.
+	rc_request_t	*templates;	//!< Requests to base the packets on.
+} rc_load_config_t;
+
+void rc_password_encode(RADIUS_PACKET *packet, VALUE_PAIR *password, fr_randctx *randctx);
+
+int rc_load_run(rc_load_config_t const *config);
+
 #ifdef __cplusplus
 }
 #endif
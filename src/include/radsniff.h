@@ -28,10 +28,18 @@
 RCSIDH(radsniff_h, "$Id$")
 
 #include <sys/types.h>
+#include <pthread.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
 
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/pcap.h>
 #include <freeradius-devel/event.h>
+#include <freeradius-devel/io/atomic_queue.h>
 
 #ifdef HAVE_COLLECTDC_H
 #  include <collectd/client.h>
@@ -44,6 +52,11 @@ RCSIDH(radsniff_h, "$Id$")
 #define RS_RETRANSMIT_MAX	5		//!< Maximum number of times we expect to see a packet retransmitted
 #define RS_MAX_ATTRS		50		//!< Maximum number of attributes we can filter on.
 #define RS_SOCKET_REOPEN_DELAY  5000		//!< How long we delay re-opening a collectd socket.
+#define RS_SHARD_MAX		64		//!< Maximum number of decode/link shards.
+#define RS_SHARD_QUEUE_SIZE	1024		//!< Packets in flight between the capture thread and a shard.
+#define RS_SHARD_CAPLEN		8192		//!< Longest capture passed to a shard, anything longer is
+						//!< truncated.
+#define RS_SHARD_SPIN		1000		//!< How many times a shard polls an empty queue before sleeping.
 
 /*
  *	Logging macros
@@ -218,6 +231,43 @@ typedef struct rs_event {
 	rs_stats_t		*stats;			//!< Where to write stats.
 } rs_event_t;
 
+/** A captured packet, or a stats tick, passed from the capture thread to a shard
+ *
+ */
+typedef struct rs_shard_msg {
+	uint64_t		count;			//!< Packet counter, as assigned by the capture thread.
+	uint64_t		tick;			//!< If non-zero, this is a request to publish interval
+							//!< stats, and header.ts is the time of the interval.
+	fr_pcap_t		*in;			//!< PCAP handle the packet was received on.
+	struct pcap_pkthdr	header;			//!< PCAP packet header.
+	uint8_t			data[RS_SHARD_CAPLEN];	//!< PCAP packet data.
+} rs_shard_msg_t;
+
+/** A decode and link thread
+ *
+ * Each shard owns the requests for the exchanges hashed to it, and its own request and link trees,
+ * event list and stats.  Nothing in a shard is touched by another thread, except via the queues,
+ * and the published snapshot of interval stats.
+ */
+typedef struct rs_shard {
+	int			number;			//!< Shard number.
+	pthread_t		pthread;		//!< The shard's thread.
+
+	TALLOC_CTX		*ctx;			//!< Requests are allocated here.
+	fr_event_list_t		*el;			//!< Request cleanup timers.
+	rbtree_t		*request_tree;		//!< Requests, by 5-tuple and ID.
+	rbtree_t		*link_tree;		//!< Requests, by link attributes.
+
+	fr_atomic_queue_t	*queue;			//!< Messages from the capture thread.
+	fr_atomic_queue_t	*free;			//!< Empty messages, returned to the capture thread.
+
+	rs_stats_t		*stats;			//!< Updated by the shard as it processes packets.
+	rs_stats_t		*snapshot;		//!< Interval stats published for the stats processor.
+
+	_Atomic(uint64_t)	published;		//!< Last stats tick published to snapshot.
+	_Atomic(bool)		stop;			//!< Exit once the queue is empty.
+} rs_shard_t;
+
 typedef struct rs_update rs_update_t;
 
 /** Callback for printing stats header.
@@ -256,6 +306,7 @@ struct rs {
 
 	bool			from_auto;		//!< From list was auto-generated.
 	bool			promiscuous;		//!< Capture in promiscuous mode.
+	bool			use_ring;		//!< Capture using memory mapped rings, instead of libpcap.
 	bool			print_packet;		//!< Print packet info, disabled with -W
 	bool			decode_attrs;		//!< Whether we should decode attributes in the request
 							//!< and response.
@@ -288,6 +339,9 @@ struct rs {
 	int			buffer_pkts;		//!< Size of the ring buffer to setup for live capture.
 	uint64_t		limit;			//!< Maximum number of packets to capture
 
+	int			num_shards;		//!< Number of decode/link threads.  If 0 packets are
+							//!< processed by the capture thread.
+
 	struct {
 		int			interval;		//!< Time between stats updates in seconds.
 		stats_out_t		out;			//!< Where to write stats.
@@ -100,6 +100,7 @@ typedef struct fr_channel_data_t {
 			fr_time_t		cpu_time;	//!<  total CPU time, including predicted work, (only worker -> network)
 			fr_time_t		processing_time;  //!< actual processing time for this packet (only worker -> network)
 			fr_time_t		request_time;	//!< timestamp of the request packet
+			uint32_t		num_queued;	//!< requests still queued in the worker (only worker -> network)
 	        } reply;
 	};
 
@@ -27,6 +27,7 @@ RCSID("$Id$")
 #include <talloc.h>
 
 #include <freeradius-devel/event.h>
+#include <freeradius-devel/hash.h>
 #include <freeradius-devel/io/queue.h>
 #include <freeradius-devel/io/channel.h>
 #include <freeradius-devel/io/control.h>
@@ -35,10 +36,21 @@ RCSID("$Id$")
 
 #include <freeradius-devel/rad_assert.h>
 
+#define FR_NETWORK_CLIENT_MAX	(32)			//!< maximum length of a client identifier
+#define FR_NETWORK_MAX_CLIENTS	(65536)			//!< maximum number of clients tracked for each socket
+#define FR_NETWORK_CLEANUP	((fr_time_t) 10 * NANOSEC) //!< how often we look for idle clients
+
+typedef struct fr_network_client_t {
+	fr_network_bucket_t	bucket;			//!< token bucket for this client
+	size_t			id_len;			//!< length of the client identifier
+	uint8_t			id[FR_NETWORK_CLIENT_MAX]; //!< client identifier, from the transport
+} fr_network_client_t;
+
 typedef struct fr_network_worker_t {
 	int			heap_id;		//!< workers are in a heap
 	fr_time_t		cpu_time;		//!< how much CPU time this worker has spent
 	fr_time_t		predicted;		//!< predicted processing time for one packet
+	uint32_t		num_queued;		//!< queue depth reported by the worker, plus requests sent since
 
 	fr_channel_t		*channel;		//!< channel to the worker
 	fr_worker_t		*worker;		//!< worker pointer
@@ -53,8 +65,25 @@ typedef struct fr_network_socket_t {
 
 	fr_message_set_t	*ms;			//!< message buffers for this socket.
 	fr_channel_data_t	*cd;			//!< cached in case of allocation & read error
+
+	fr_network_limit_t	limit;			//!< admission control for this socket
+	fr_network_bucket_t	bucket;			//!< token bucket for the socket
+	fr_hash_table_t		*clients;		//!< token buckets for each client
+	fr_time_t		client_refill;		//!< how long an idle client bucket takes to fill
+	fr_time_t		cleaned;		//!< when we last removed idle clients
 } fr_network_socket_t;
 
+/*
+ *	The control-plane message which adds a socket.  It has to fit
+ *	into FR_CONTROL_MAX_SIZE, which fr_network_socket_t doesn't.
+ */
+typedef struct fr_network_socket_msg_t {
+	int			fd;			//!< the file descriptor
+	void			*ctx;			//!< transport context
+	fr_transport_t		*transport;		//!< the transport
+	fr_network_limit_t	limit;			//!< admission control for this socket
+} fr_network_socket_msg_t;
+
 
 struct fr_network_t {
 	int			kq;			//!< our KQ
@@ -75,6 +104,8 @@ struct fr_network_t {
 
 	uint64_t		num_requests;		//!< number of requests we sent
 	uint64_t		num_replies;		//!< number of replies we received
+	uint64_t		num_limited;		//!< number of packets dropped by the token buckets
+	uint64_t		num_shed;		//!< number of packets shed because the workers are behind
 
 	fr_heap_t		*sockets;		//!< list of sockets we're managing
 
@@ -105,6 +136,24 @@ static int worker_cmp(void const *one, void const *two)
 	return 0;
 }
 
+static uint32_t client_hash(void const *data)
+{
+	fr_network_client_t const *client = data;
+
+	return fr_hash(client->id, client->id_len);
+}
+
+static int client_cmp(void const *one, void const *two)
+{
+	fr_network_client_t const *a = one;
+	fr_network_client_t const *b = two;
+
+	if (a->id_len < b->id_len) return -1;
+	if (a->id_len > b->id_len) return +1;
+
+	return memcmp(a->id, b->id, a->id_len);
+}
+
 static int reply_cmp(void const *one, void const *two)
 {
 	fr_channel_data_t const *a = one;
@@ -155,6 +204,7 @@ static void fr_network_drain_input(fr_network_t *nr, fr_channel_t *ch, fr_channe
 		} else {
 			w->predicted = RTT(w->predicted, cd->reply.processing_time);
 		}
+		w->num_queued = cd->reply.num_queued;
 
 		(void) fr_heap_insert(nr->replies, cd);
 	} while ((cd = fr_channel_recv_reply(ch)) != NULL);
@@ -304,6 +354,7 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 	 *	reply from this channel.
 	 */
 	worker->cpu_time += worker->predicted;
+	worker->num_queued++;
 
 	/*
 	 *	Insert the worker back into the heap of workers.
@@ -320,6 +371,184 @@ static int fr_network_send_request(fr_network_t *nr, fr_channel_data_t *cd)
 }
 
 
+/** Take a packet's worth of credit from a token bucket
+ *
+ *  The bucket gains one nanosecond of credit every nanosecond, up to
+ *  "burst" packets worth.  Dropped packets cost nothing, so a client
+ *  which retransmits in a loop still gets "rate" packets through.
+ *
+ * @param b the token bucket
+ * @param rate packets per second, or 0 for no limit
+ * @param burst the maximum number of packets at once, or 0 for "rate"
+ * @param now the current time
+ * @return
+ *	- true if the packet is allowed
+ *	- false if it should be dropped
+ */
+bool fr_network_bucket_take(fr_network_bucket_t *b, uint32_t rate, uint32_t burst, fr_time_t now)
+{
+	fr_time_t cost, max;
+
+	if (!rate) return true;
+
+	cost = NANOSEC / rate;
+	max = cost * (burst ? burst : rate);
+
+	if (!b->last) {
+		b->credit = max;
+	} else {
+		b->credit += now - b->last;
+		if (b->credit > max) b->credit = max;
+	}
+	b->last = now;
+
+	if (b->credit < cost) return false;
+
+	b->credit -= cost;
+	return true;
+}
+
+/** Decide if a packet should be shed, based on how far behind the workers are
+ *
+ *  Nothing is shed until the backlog reaches half of max_backlog.
+ *  From there, the cut-off falls linearly, so that the lowest
+ *  priority packets are shed first.  At max_backlog, everything
+ *  except priority 0 is shed.
+ *
+ * @param limit the limits for the socket
+ * @param backlog the queue depth of the worker which would get the packet
+ * @param priority of the packet, 0=high, 65535=low
+ * @return true if the packet should be dropped
+ */
+bool fr_network_shed(fr_network_limit_t const *limit, uint32_t backlog, uint32_t priority)
+{
+	uint32_t low, cutoff;
+
+	if (!limit->max_backlog || !priority) return false;
+
+	if (backlog >= limit->max_backlog) return true;
+
+	low = limit->max_backlog / 2;
+	if (backlog < low) return false;
+
+	cutoff = 65536 - (((uint64_t) (backlog - low) * 65536) / (limit->max_backlog - low));
+
+	return (priority >= cutoff);
+}
+
+/** Remove a client whose token bucket has filled back up
+ *
+ *  A full bucket holds no state worth keeping, so the client can be
+ *  re-created the next time it sends a packet.
+ */
+static int client_idle(void *ctx, void *data)
+{
+	fr_network_socket_t *s = ctx;
+	fr_network_client_t *client = data;
+
+	if ((s->cleaned - client->bucket.last) < s->client_refill) return 0;
+
+	(void) fr_hash_table_delete(s->clients, client);
+	talloc_free(client);
+
+	return 0;
+}
+
+/** Find the token bucket for a client, creating it if necessary
+ *
+ * @param s the network socket
+ * @param id the client identifier, from the transport
+ * @param id_len length of the client identifier
+ * @return
+ *	- NULL if we're already tracking too many clients
+ *	- fr_network_client_t on success
+ */
+static fr_network_client_t *fr_network_client_find(fr_network_socket_t *s, uint8_t const *id, size_t id_len)
+{
+	fr_network_client_t my_client, *client;
+
+	my_client.id_len = id_len;
+	memcpy(my_client.id, id, id_len);
+
+	client = fr_hash_table_finddata(s->clients, &my_client);
+	if (client) return client;
+
+	/*
+	 *	Spoofed source addresses shouldn't be able to use up
+	 *	all of our memory.  Untracked clients are still
+	 *	limited by the socket bucket.
+	 */
+	if (fr_hash_table_num_elements(s->clients) >= FR_NETWORK_MAX_CLIENTS) return NULL;
+
+	client = talloc_zero(s, fr_network_client_t);
+	if (!client) return NULL;
+
+	client->id_len = id_len;
+	memcpy(client->id, id, id_len);
+
+	if (!fr_hash_table_insert(s->clients, client)) {
+		talloc_free(client);
+		return NULL;
+	}
+
+	return client;
+}
+
+/** Decide if a packet should be sent to a worker
+ *
+ *  Packets are first shed by priority if the workers are behind.
+ *  They are then checked against the client bucket, and then the
+ *  socket bucket, so that one misbehaving client doesn't use up the
+ *  socket's tokens for everyone else.
+ *
+ * @param nr the network
+ * @param s the network socket
+ * @param id the client identifier, from the transport
+ * @param id_len length of the client identifier, or 0 for "unknown"
+ * @param priority of the packet
+ * @param now the current time
+ * @return
+ *	- true if the packet is allowed
+ *	- false if it should be dropped
+ */
+static bool fr_network_admit(fr_network_t *nr, fr_network_socket_t *s, uint8_t const *id, size_t id_len,
+			     uint32_t priority, fr_time_t now)
+{
+	fr_network_worker_t *w;
+	fr_network_client_t *client;
+
+	w = fr_heap_peek(nr->workers);
+	if (w && fr_network_shed(&s->limit, w->num_queued, priority)) {
+		nr->num_shed++;
+		fr_log(nr->log, L_DBG, "shedding packet with priority %u, worker backlog %u", priority, w->num_queued);
+		return false;
+	}
+
+	if (s->clients && id_len) {
+		if ((now - s->cleaned) > FR_NETWORK_CLEANUP) {
+			s->cleaned = now;
+			(void) fr_hash_table_walk(s->clients, client_idle, s);
+		}
+
+		client = fr_network_client_find(s, id, id_len);
+		if (client &&
+		    !fr_network_bucket_take(&client->bucket, s->limit.client_rate, s->limit.client_burst, now)) {
+			nr->num_limited++;
+			fr_log(nr->log, L_DBG, "client rate limit exceeded on socket %d", s->fd);
+			return false;
+		}
+	}
+
+	if (!fr_network_bucket_take(&s->bucket, s->limit.listener_rate, s->limit.listener_burst, now)) {
+		nr->num_limited++;
+		fr_log(nr->log, L_DBG, "rate limit exceeded on socket %d", s->fd);
+		return false;
+	}
+
+	return true;
+}
+
+
 static fr_time_t start_time = 0;
 
 
@@ -335,6 +564,10 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, void *ctx)
 	fr_network_t *nr = talloc_parent(s);
 	ssize_t data_size;
 	fr_channel_data_t *cd;
+	fr_time_t now;
+	uint32_t priority = 0;
+	size_t id_len = 0;
+	uint8_t id[FR_NETWORK_CLIENT_MAX];
 
 	rad_assert(s->fd == sockfd);
 
@@ -379,18 +612,34 @@ static void fr_network_read(UNUSED fr_event_list_t *el, int sockfd, void *ctx)
 		 */
 		_exit(1);
 	}
-	s->cd = NULL;
 
 	fr_log(nr->log, L_DBG, "got packet size %zd", data_size);
 
+	now = fr_time();
+
+	if (s->transport->classify) {
+		id_len = s->transport->classify(s->ctx, cd->m.data, data_size, id, sizeof(id), &priority);
+		if (id_len > sizeof(id)) id_len = 0;
+	}
+
+	/*
+	 *	Drop the packet before it's copied to a worker.  The
+	 *	reserved message is re-used for the next read.
+	 */
+	if (!fr_network_admit(nr, s, id, id_len, priority, now)) {
+		s->cd = cd;
+		return;
+	}
+	s->cd = NULL;
+
 	/*
 	 *	Initialize the rest of the fields of the channel data.
 	 */
-	cd->m.when = fr_time();
+	cd->m.when = now;
 	cd->packet_ctx = s->ctx;
 	cd->io_ctx = s;
 	cd->transport = 0;	/* @todo - set transport number from the transport */
-	cd->priority = 0;	/* @todo - set priority based on information from the transport layer  */
+	cd->priority = priority;
 	cd->request.start_time = &start_time; /* @todo - set by transport */
 
 	start_time = cd->m.when;
@@ -414,14 +663,21 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 {
 	fr_network_t *nr = ctx;
 	fr_network_socket_t *s;
+	fr_network_socket_msg_t m;
+
+	rad_assert(data_size == sizeof(m));
 
-	rad_assert(data_size == sizeof(*s));
+	if (data_size != sizeof(m)) return;
 
-	if (data_size != sizeof(*s)) return;
+	memcpy(&m, data, sizeof(m));
 
-	s = talloc(nr, fr_network_socket_t);
+	s = talloc_zero(nr, fr_network_socket_t);
 	rad_assert(s != NULL);
-	memcpy(s, data, sizeof(*s));
+
+	s->fd = m.fd;
+	s->ctx = m.ctx;
+	s->transport = m.transport;
+	s->limit = m.limit;
 
 #define MIN_MESSAGES (8)
 
@@ -440,6 +696,19 @@ static void fr_network_socket_callback(void *ctx, void const *data, size_t data_
 		_exit(1);
 	}
 
+	if (s->limit.client_rate && s->transport->classify) {
+		s->clients = fr_hash_table_create(s, client_hash, client_cmp, NULL);
+		if (!s->clients) {
+			fr_log(nr->log, L_ERR, "Failed creating client table for network IO.");
+			close(s->fd);
+			talloc_free(s);
+			return;
+		}
+
+		s->client_refill = (NANOSEC / s->limit.client_rate) *
+			(s->limit.client_burst ? s->limit.client_burst : s->limit.client_rate);
+	}
+
 	if (fr_event_fd_insert(nr->el, s->fd, fr_network_read, NULL, NULL, s) < 0) {
 		fr_log(nr->log, L_ERR, "Failed adding new socket to event loop: %s", fr_strerror());
 		close(s->fd);
@@ -738,15 +1007,18 @@ void fr_network_exit(fr_network_t *nr)
  * @param fd the file descriptor for the socket
  * @param ctx the context for the transport
  * @param transport the transport
+ * @param limit the admission control for the socket, or NULL for no limits
  */
-int fr_network_socket_add(fr_network_t *nr, int fd, void *ctx, fr_transport_t *transport)
+int fr_network_socket_add(fr_network_t *nr, int fd, void *ctx, fr_transport_t *transport,
+			  fr_network_limit_t const *limit)
 {
-	fr_network_socket_t m;
+	fr_network_socket_msg_t m;
 
 	memset(&m, 0, sizeof(m));
 	m.fd = fd;
 	m.ctx = ctx;
 	m.transport = transport;
+	if (limit) m.limit = *limit;
 
 	return fr_control_message_send(nr->control, nr->rb, FR_CONTROL_ID_SOCKET, &m, sizeof(m));
 }
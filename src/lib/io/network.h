@@ -26,6 +26,7 @@
 RCSIDH(network_h, "$Id$")
 
 #include <freeradius-devel/fr_log.h>
+#include <freeradius-devel/io/time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,14 +34,40 @@ extern "C" {
 
 typedef struct fr_network_t fr_network_t;
 
+/**
+ *  Admission control for one socket.  The limits are applied in the
+ *  network thread, before a packet is sent to a worker.  Rates are in
+ *  packets per second, and zero means "no limit".
+ */
+typedef struct fr_network_limit_t {
+	uint32_t		listener_rate;		//!< packets per second accepted on the socket
+	uint32_t		listener_burst;		//!< packets accepted at once after an idle period, 0 for "rate"
+	uint32_t		client_rate;		//!< packets per second accepted from each client
+	uint32_t		client_burst;		//!< packets accepted at once from an idle client, 0 for "rate"
+	uint32_t		max_backlog;		//!< worker queue depth at which we shed all but priority 0
+} fr_network_limit_t;
+
+/**
+ *  A token bucket.  It holds time credit rather than tokens, and
+ *  each packet costs NANOSEC / rate of credit.
+ */
+typedef struct fr_network_bucket_t {
+	fr_time_t		credit;			//!< time credit, capped at "burst" packets
+	fr_time_t		last;			//!< when the credit was last updated
+} fr_network_bucket_t;
+
 fr_network_t *fr_network_create(TALLOC_CTX *ctx, fr_log_t *logger, uint32_t num_transports, fr_transport_t **transports);
 void fr_network_exit(fr_network_t *nr);
 int fr_network_destroy(fr_network_t *nr) CC_HINT(nonnull);
 void fr_network(fr_network_t *nr) CC_HINT(nonnull);
 
-int fr_network_socket_add(fr_network_t *nr, int fd, void *ctx, fr_transport_t *transport) CC_HINT(nonnull);
+int fr_network_socket_add(fr_network_t *nr, int fd, void *ctx, fr_transport_t *transport,
+			  fr_network_limit_t const *limit) CC_HINT(nonnull(1,3,4));
 int fr_network_worker_add(fr_network_t *nr, fr_worker_t *worker) CC_HINT(nonnull);
 
+bool fr_network_bucket_take(fr_network_bucket_t *b, uint32_t rate, uint32_t burst, fr_time_t now) CC_HINT(nonnull);
+bool fr_network_shed(fr_network_limit_t const *limit, uint32_t backlog, uint32_t priority) CC_HINT(nonnull);
+
 #ifdef __cplusplus
 }
 #endif
@@ -646,10 +646,12 @@ int fr_schedule_destroy(fr_schedule_t *sc)
  * @param fd the file descriptor for the socket
  * @param ctx the context for the transport
  * @param transport the transport
+ * @param limit the admission control for the socket, or NULL for no limits
  */
-int fr_schedule_socket_add(fr_schedule_t *sc, int fd, void *ctx, fr_transport_t *transport)
+int fr_schedule_socket_add(fr_schedule_t *sc, int fd, void *ctx, fr_transport_t *transport,
+			   fr_network_limit_t const *limit)
 {
-	return fr_network_socket_add(sc->sn->rc, fd, ctx, transport);
+	return fr_network_socket_add(sc->sn->rc, fd, ctx, transport, limit);
 }
 
 
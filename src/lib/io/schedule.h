@@ -26,6 +26,7 @@
 RCSIDH(schedule_h, "$Id$")
 
 #include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/io/network.h>
 #include <freeradius-devel/fr_log.h>
 
 #ifdef __cplusplus
@@ -43,7 +44,8 @@ fr_schedule_t *fr_schedule_create(TALLOC_CTX *ctx, fr_log_t *log, int max_inputs
 int fr_schedule_destroy(fr_schedule_t *sc);
 int fr_schedule_get_worker_kq(fr_schedule_t *sc);
 
-int fr_schedule_socket_add(fr_schedule_t *sc, int fd, void *ctx, fr_transport_t *transport) CC_HINT(nonnull);
+int fr_schedule_socket_add(fr_schedule_t *sc, int fd, void *ctx, fr_transport_t *transport,
+			   fr_network_limit_t const *limit) CC_HINT(nonnull(1,3,4));
 
 #ifdef __cplusplus
 }
@@ -98,6 +98,19 @@ typedef int *(*fr_transport_recv_request_t)(REQUEST *);
  */
 typedef ssize_t (*fr_transport_io_t)(int sockfd, void *packet_ctx, uint8_t *buffer, size_t buffer_len);
 
+/**
+ *  Classify a packet in the master thread, after it has been read,
+ *  and before it is sent to a worker.
+ *
+ *  Writes an identifier for the client which sent the packet
+ *  (e.g. its source IP address) to the client buffer, and sets the
+ *  priority of the packet, 0=high, 65535=low.
+ *
+ *  @return the length of the client identifier, or 0 if the client is unknown.
+ */
+typedef size_t (*fr_transport_classify_t)(void const *packet_ctx, uint8_t const *data, size_t data_len,
+					  uint8_t *client, size_t client_len, uint32_t *priority);
+
 /**
  *  Receive a reply in the master thread.
  */
@@ -130,6 +143,7 @@ typedef struct fr_transport_t {
 	fr_transport_nak_t		nak;		//!< function to send a NAK
 	fr_transport_send_reply_t	send_reply;	//!< function to send a reply (worker -> master)
 	fr_transport_process_t		process;	//!< process a request
+	fr_transport_classify_t		classify;	//!< identify the client and priority of a packet (master)
 } fr_transport_t;
 
 typedef enum fr_transport_status_t {
@@ -314,6 +314,22 @@ static void fr_worker_evfilt_user(UNUSED int kq, struct kevent const *kev, void
 }
 
 
+/** Count the requests which are still waiting for this worker
+ *
+ *  The count is sent back to the network thread with every reply,
+ *  so that it can shed low priority packets when we fall behind.
+ *
+ * @param[in] worker the worker
+ * @return the number of queued and runnable requests
+ */
+static uint32_t fr_worker_num_queued(fr_worker_t *worker)
+{
+	return fr_heap_num_elements(worker->to_decode.heap) +
+		fr_heap_num_elements(worker->localized.heap) +
+		fr_heap_num_elements(worker->runnable);
+}
+
+
 /** Send a NAK to the network thread
  *
  *  The network thread believes that a worker is running a request until that request has been NAK'd.
@@ -359,6 +375,7 @@ static void fr_worker_nak(fr_worker_t *worker, fr_channel_data_t *cd, fr_time_t
 	reply->reply.cpu_time = worker->tracking.running;
 	reply->reply.processing_time = 10; /* @todo - set to something better? */
 	reply->reply.request_time = cd->m.when;
+	reply->reply.num_queued = fr_worker_num_queued(worker);
 
 	reply->packet_ctx = cd->packet_ctx;
 	reply->io_ctx = cd->io_ctx;
@@ -443,6 +460,7 @@ static void fr_worker_send_reply(fr_worker_t *worker, REQUEST *request, size_t s
 	reply->reply.cpu_time = worker->tracking.running;
 	reply->reply.processing_time = request->tracking.running;
 	reply->reply.request_time = request->recv_time;
+	reply->reply.num_queued = fr_worker_num_queued(worker);
 
 	reply->packet_ctx = request->packet_ctx;
 	reply->io_ctx = request->io_ctx;
@@ -0,0 +1,458 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/ldap/async.c
+ * @brief Multiplex searches over a single connection, using an event list.
+ *
+ * Searches are sent with ldap_search_ext(), and the socket of the connection
+ * is inserted into the event list of the thread which owns it.  When the
+ * socket becomes readable, results are retrieved for each outstanding msgid
+ * without blocking, and the callback for the query is run.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#define LOG_PREFIX "%s - "
+#define LOG_PREFIX_ARGS async->name
+
+#include <freeradius-devel/rad_assert.h>
+
+#include "libfreeradius-ldap.h"
+
+/** How long to wait after a failed connection attempt, before trying again
+ *
+ */
+#define LDAP_ASYNC_RETRY_DELAY	1
+
+/** A connection shared by all requests in one thread
+ *
+ */
+struct fr_ldap_async {
+	char const		*name;		//!< For log messages.
+
+	fr_event_list_t		*el;		//!< Event list the socket is inserted into.
+
+	fr_connection_create_t	create;		//!< Used to (re)open the connection.
+	void			*opaque;	//!< Passed to create.
+	struct timeval		timeout;	//!< Passed to create.
+
+	fr_ldap_conn_t		*conn;		//!< NULL if we're not connected.
+	int			fd;		//!< Socket of the connection, or -1.
+	time_t			retry;		//!< Don't try to connect again until this time.
+
+	fr_ldap_query_t		*head;		//!< Queries waiting for results.
+	fr_ldap_query_t		*tail;
+	uint32_t		outstanding;	//!< Number of queries waiting for results.
+};
+
+static void ldap_async_unlink(fr_ldap_query_t *query)
+{
+	fr_ldap_async_t *async = query->async;
+
+	if (!async) return;
+
+	if (query->prev) {
+		query->prev->next = query->next;
+	} else {
+		async->head = query->next;
+	}
+
+	if (query->next) {
+		query->next->prev = query->prev;
+	} else {
+		async->tail = query->prev;
+	}
+
+	query->prev = query->next = NULL;
+	query->async = NULL;
+	async->outstanding--;
+}
+
+static void ldap_async_link(fr_ldap_async_t *async, fr_ldap_query_t *query)
+{
+	query->async = async;
+	query->next = NULL;
+	query->prev = async->tail;
+
+	if (async->tail) {
+		async->tail->next = query;
+	} else {
+		async->head = query;
+	}
+	async->tail = query;
+	async->outstanding++;
+}
+
+/** Tell the owner of the query that we're done with it
+ *
+ */
+static void ldap_async_finish(fr_ldap_query_t *query, fr_ldap_rcode_t status, LDAPMessage *result)
+{
+	ldap_async_unlink(query);
+
+	query->status = status;
+	query->result = result;
+
+	if (query->callback) query->callback(query, query->uctx);
+}
+
+/** Close the connection, failing any queries which were waiting for it
+ *
+ */
+static void ldap_async_disconnect(fr_ldap_async_t *async, fr_ldap_rcode_t status)
+{
+	fr_ldap_query_t *query;
+
+	if (async->fd >= 0) {
+		fr_event_fd_delete(async->el, async->fd);
+		async->fd = -1;
+	}
+	TALLOC_FREE(async->conn);
+
+	while ((query = async->head)) ldap_async_finish(query, status, NULL);
+}
+
+/** Whether libldap has already read data for us, which it has not yet parsed
+ *
+ * If so, the socket won't become readable again, and we need to call
+ * ldap_result() without waiting for it.
+ */
+static bool ldap_async_data_ready(fr_ldap_async_t *async)
+{
+#ifdef LDAP_OPT_SOCKBUF
+	Sockbuf *sb = NULL;
+
+	if ((ldap_get_option(async->conn->handle, LDAP_OPT_SOCKBUF, &sb) != LDAP_OPT_SUCCESS) || !sb) return false;
+
+	return (ber_sockbuf_ctrl(sb, LBER_SB_OPT_DATA_READY, NULL) > 0);
+#else
+	return false;
+#endif
+}
+
+/** Retrieve the result for a single query, without blocking
+ *
+ * @return
+ *	- 1 if the query is complete.
+ *	- 0 if we're still waiting for (more of) the result.
+ *	- -1 if the connection failed.
+ */
+static int ldap_async_result(fr_ldap_async_t *async, fr_ldap_query_t *query)
+{
+	REQUEST			*request = query->request;
+	fr_ldap_rcode_t		status = LDAP_PROC_SUCCESS;
+	LDAPMessage		*result = NULL, *msg;
+	struct timeval		poll = { 0, 0 };
+	int			count;
+
+	switch (ldap_result(async->conn->handle, query->msgid, LDAP_MSG_ALL, &poll, &result)) {
+	case 0:
+		return 0;
+
+	case -1:
+		status = fr_ldap_error_check(NULL, async->conn, NULL, query->dn);
+		if (status == LDAP_PROC_BAD_CONN) return -1;
+
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed performing search");
+		ldap_async_finish(query, status, NULL);
+		return 1;
+
+	default:
+		break;
+	}
+
+	for (msg = ldap_first_message(async->conn->handle, result);
+	     msg;
+	     msg = ldap_next_message(async->conn->handle, msg)) {
+		status = fr_ldap_error_check(NULL, async->conn, msg, query->dn);
+		if (status != LDAP_PROC_SUCCESS) break;
+	}
+
+	if (status == LDAP_PROC_BAD_CONN) {
+		ldap_msgfree(result);
+		return -1;
+	}
+
+	if (status != LDAP_PROC_SUCCESS) {
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed performing search");
+		goto error;
+	}
+
+	count = ldap_count_entries(async->conn->handle, result);
+	if (count < 0) {
+		ROPTIONAL(REDEBUG, ERROR, "Error counting results: %s", fr_ldap_error_str(async->conn));
+		status = LDAP_PROC_ERROR;
+		goto error;
+	}
+
+	if (count == 0) {
+		ROPTIONAL(RDEBUG, DEBUG, "Search returned no results");
+		status = LDAP_PROC_NO_RESULT;
+	error:
+		ldap_msgfree(result);
+		result = NULL;
+	}
+
+	ldap_async_finish(query, status, result);
+
+	return 1;
+}
+
+/** Retrieve results for all outstanding queries, when the socket becomes readable
+ *
+ * The callbacks run for completed queries must not free any other query.
+ */
+static void _ldap_async_read(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_ldap_async_t	*async = talloc_get_type_abort(ctx, fr_ldap_async_t);
+	fr_ldap_query_t	*query, *next;
+	bool		progress;
+
+	/*
+	 *	Nothing is waiting, so this is either the server
+	 *	closing the connection, or a notice of disconnection.
+	 */
+	if (!async->head) {
+		LDAPMessage	*result = NULL;
+		struct timeval	poll = { 0, 0 };
+
+		if (ldap_result(async->conn->handle, LDAP_RES_ANY, LDAP_MSG_ALL, &poll, &result) < 0) {
+			DEBUG2("Connection closed by server");
+			ldap_async_disconnect(async, LDAP_PROC_BAD_CONN);
+			return;
+		}
+		if (result) ldap_msgfree(result);
+		return;
+	}
+
+	/*
+	 *	Each call to ldap_result() reads at most one message
+	 *	from the socket, so keep going until everything
+	 *	libldap has buffered has been dealt with.
+	 */
+	do {
+		progress = false;
+
+		for (query = async->head; query; query = next) {
+			next = query->next;
+
+			switch (ldap_async_result(async, query)) {
+			case 1:
+				progress = true;
+				break;
+
+			case 0:
+				break;
+
+			default:
+				ERROR("Lost connection: %s", fr_strerror());
+				ldap_async_disconnect(async, LDAP_PROC_BAD_CONN);
+				return;
+			}
+		}
+	} while (async->head && (progress || ldap_async_data_ready(async)));
+}
+
+static void _ldap_async_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	fr_ldap_async_t	*async = talloc_get_type_abort(ctx, fr_ldap_async_t);
+
+	ERROR("Connection failed");
+	ldap_async_disconnect(async, LDAP_PROC_BAD_CONN);
+}
+
+/** Open the connection, and insert its socket into the event list
+ *
+ */
+static int ldap_async_connect(fr_ldap_async_t *async)
+{
+	time_t now = time(NULL);
+
+	if (now < async->retry) {
+		fr_strerror_printf("Not connecting, last attempt failed less than %i seconds ago",
+				   LDAP_ASYNC_RETRY_DELAY);
+		return -1;
+	}
+
+	async->conn = async->create(async, async->opaque, &async->timeout);
+	if (!async->conn) goto error;
+
+	if ((ldap_get_option(async->conn->handle, LDAP_OPT_DESC, &async->fd) != LDAP_OPT_SUCCESS) ||
+	    (async->fd < 0)) {
+		ERROR("Failed retrieving socket from connection");
+		goto error;
+	}
+
+	if (fr_event_fd_insert(async->el, async->fd, _ldap_async_read, NULL, _ldap_async_error, async) < 0) {
+		PERROR("Failed inserting socket into event list");
+		goto error;
+	}
+
+	return 0;
+
+error:
+	async->fd = -1;
+	TALLOC_FREE(async->conn);
+	async->retry = now + LDAP_ASYNC_RETRY_DELAY;
+
+	fr_strerror_printf("Failed connecting to LDAP server");
+	return -1;
+}
+
+static int _ldap_async_free(fr_ldap_async_t *async)
+{
+	fr_ldap_query_t *query;
+
+	/*
+	 *	The requests which own the queries are being
+	 *	torn down, so don't call their callbacks.
+	 */
+	while ((query = async->head)) ldap_async_unlink(query);
+
+	if (async->fd >= 0) fr_event_fd_delete(async->el, async->fd);
+
+	return 0;
+}
+
+/** Allocate a connection for multiplexing searches
+ *
+ * The connection is opened when the first search is sent.
+ *
+ * @param[in] ctx	to allocate in.  Must only be used by the thread servicing el.
+ * @param[in] name	to use in log messages.
+ * @param[in] el	to insert the socket of the connection into.
+ * @param[in] create	callback to open and bind a new connection.  Must return a #fr_ldap_conn_t.
+ * @param[in] opaque	passed to create.
+ * @param[in] timeout	passed to create.
+ * @return
+ *	- A new #fr_ldap_async_t.
+ *	- NULL on error.
+ */
+fr_ldap_async_t *fr_ldap_async_alloc(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el,
+				     fr_connection_create_t create, void *opaque, struct timeval const *timeout)
+{
+	fr_ldap_async_t *async;
+
+	async = talloc_zero(ctx, fr_ldap_async_t);
+	if (!async) return NULL;
+
+	async->name = talloc_typed_strdup(async, name);
+	async->el = el;
+	async->create = create;
+	async->opaque = opaque;
+	async->timeout = *timeout;
+	async->fd = -1;
+	talloc_set_destructor(async, _ldap_async_free);
+
+	return async;
+}
+
+/** Return the number of queries waiting for results
+ *
+ */
+uint32_t fr_ldap_async_outstanding(fr_ldap_async_t const *async)
+{
+	return async->outstanding;
+}
+
+/** Abandon the search if we're still waiting for its result
+ *
+ */
+static int _ldap_query_free(fr_ldap_query_t *query)
+{
+	fr_ldap_async_t *async = query->async;
+
+	if (async) {
+		if (async->conn) (void) ldap_abandon_ext(async->conn->handle, query->msgid, NULL, NULL);
+		ldap_async_unlink(query);
+	}
+
+	if (query->result) ldap_msgfree(query->result);
+
+	return 0;
+}
+
+/** Send a search, and call a function when its result arrives
+ *
+ * The result is available in query->result when the callback runs, and
+ * query->status holds one of the LDAP_PROC_* values.  If query->status is not
+ * LDAP_PROC_SUCCESS then query->result will be NULL.
+ *
+ * Freeing the query before the callback runs abandons the search.
+ *
+ * @param[out] out		Where to write the new query.
+ * @param[in] ctx		to allocate the query in.
+ * @param[in] request		Current request.
+ * @param[in] async		connection to send the search on.
+ * @param[in] dn		to use as base for the search.
+ * @param[in] scope		to use (LDAP_SCOPE_BASE, LDAP_SCOPE_ONE, LDAP_SCOPE_SUB).
+ * @param[in] filter		to use, should be pre-escaped.
+ * @param[in] attrs		to retrieve.
+ * @param[in] serverctrls	Search controls to pass to the server.  May be NULL.
+ * @param[in] clientctrls	Search controls for ldap_search.  May be NULL.
+ * @param[in] callback		to run when the result arrives, or the search fails.
+ * @param[in] uctx		passed to callback.
+ * @return
+ *	- LDAP_PROC_SUCCESS if the search was sent.
+ *	- Another LDAP_PROC_* (#fr_ldap_rcode_t) value on error.
+ */
+fr_ldap_rcode_t fr_ldap_async_search(fr_ldap_query_t **out, TALLOC_CTX *ctx, REQUEST *request,
+				     fr_ldap_async_t *async,
+				     char const *dn, int scope, char const *filter, char const * const *attrs,
+				     LDAPControl **serverctrls, LDAPControl **clientctrls,
+				     fr_ldap_query_cb_t callback, void *uctx)
+{
+	fr_ldap_rcode_t	status;
+	fr_ldap_query_t	*query;
+	int		msgid;
+
+	*out = NULL;
+
+	if (!async->conn && (ldap_async_connect(async) < 0)) {
+		ROPTIONAL(RPEDEBUG, PERROR, "Failed sending search");
+		return LDAP_PROC_BAD_CONN;
+	}
+
+	status = fr_ldap_search_async(&msgid, request, &async->conn, dn, scope, filter, attrs,
+				      serverctrls, clientctrls);
+	if (status != LDAP_PROC_SUCCESS) {
+		int ldap_errno;
+
+		ldap_get_option(async->conn->handle, LDAP_OPT_ERROR_NUMBER, &ldap_errno);
+		if (ldap_errno == LDAP_SERVER_DOWN) {
+			ldap_async_disconnect(async, LDAP_PROC_BAD_CONN);
+			return LDAP_PROC_BAD_CONN;
+		}
+
+		return status;
+	}
+
+	MEM(query = talloc_zero(ctx, fr_ldap_query_t));
+	query->request = request;
+	query->dn = talloc_typed_strdup(query, dn);
+	query->msgid = msgid;
+	query->status = LDAP_PROC_CONTINUE;
+	query->callback = callback;
+	query->uctx = uctx;
+	talloc_set_destructor(query, _ldap_query_free);
+
+	ldap_async_link(async, query);
+
+	*out = query;
+
+	return LDAP_PROC_SUCCESS;
+}
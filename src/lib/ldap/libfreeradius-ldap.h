@@ -16,6 +16,7 @@
 #define	LIBFREERADIUS_LDAP_H
 
 #include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/connection.h>
 #include <lber.h>
 #include <ldap.h>
 #include "config.h"
@@ -329,6 +330,35 @@ typedef enum {
 							//!< exit, and retry the operation with a NULL cookie.
 } fr_ldap_rcode_t;
 
+typedef struct fr_ldap_async fr_ldap_async_t;
+typedef struct fr_ldap_query fr_ldap_query_t;
+
+/** Called when the result of an asynchronous search arrives
+ *
+ * @param[in] query	which has completed.  query->status and query->result are set.
+ * @param[in] uctx	passed to #fr_ldap_async_search.
+ */
+typedef void (*fr_ldap_query_cb_t)(fr_ldap_query_t *query, void *uctx);
+
+/** An asynchronous search, sent on a #fr_ldap_async_t connection
+ *
+ */
+struct fr_ldap_query {
+	REQUEST			*request;	//!< The request the search was sent for.
+	char const		*dn;		//!< Base DN of the search.
+	int			msgid;		//!< Returned by ldap_search_ext.
+
+	fr_ldap_rcode_t		status;		//!< LDAP_PROC_CONTINUE until the search completes.
+	LDAPMessage		*result;	//!< Entries returned by the server.  Freed with the query.
+
+	fr_ldap_query_cb_t	callback;	//!< Called when the search completes.
+	void			*uctx;		//!< Passed to callback.
+
+	fr_ldap_async_t		*async;		//!< Connection we're waiting on, NULL once complete.
+	fr_ldap_query_t		*prev;		//!< Other searches on the same connection.
+	fr_ldap_query_t		*next;
+};
+
 /*
  *	Tables for resolving strings to LDAP constants
  */
@@ -411,6 +441,20 @@ int		fr_ldap_global_init(void);
 
 void		fr_ldap_global_free(void);
 
+/*
+ *	async.c - Searches multiplexed over a connection serviced by an event list
+ */
+fr_ldap_async_t	*fr_ldap_async_alloc(TALLOC_CTX *ctx, char const *name, fr_event_list_t *el,
+				     fr_connection_create_t create, void *opaque, struct timeval const *timeout);
+
+uint32_t	fr_ldap_async_outstanding(fr_ldap_async_t const *async);
+
+fr_ldap_rcode_t	fr_ldap_async_search(fr_ldap_query_t **out, TALLOC_CTX *ctx, REQUEST *request,
+				     fr_ldap_async_t *async,
+				     char const *dn, int scope, char const *filter, char const * const *attrs,
+				     LDAPControl **serverctrls, LDAPControl **clientctrls,
+				     fr_ldap_query_cb_t callback, void *uctx);
+
 /*
  *	control.c - Connection based client/server controls
  */
@@ -28,6 +28,7 @@ SOURCES		:= base64.c \
 		   net.c \
 		   pair.c \
 		   pair_cursor.c \
+		   packet_ring.c \
 		   pcap.c \
 		   print.c \
 		   proto.c \
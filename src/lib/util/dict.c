@@ -2891,6 +2891,52 @@ fr_dict_attr_t const *fr_dict_root(fr_dict_t const *dict)
 	return dict->root;
 }
 
+static int _dict_fingerprint_walk(void *ctx, void *data)
+{
+	uint32_t		*fingerprint = ctx;
+	fr_dict_attr_t const	*da = data;
+	uint32_t		hash, num[4];
+
+	/*
+	 *	Network byte order, so servers on different
+	 *	architectures produce the same fingerprint.
+	 */
+	num[0] = htonl(da->vendor);
+	num[1] = htonl(da->attr);
+	num[2] = htonl(da->type);
+	num[3] = htonl(da->parent ? da->parent->attr : 0);
+
+	hash = fr_hash_string(da->name);
+	hash = fr_hash_update(num, sizeof(num), hash);
+
+	/*
+	 *	Combine with addition, so the result doesn't
+	 *	depend on the order the attributes are walked in.
+	 */
+	*fingerprint += hash;
+
+	return 0;
+}
+
+/** Produce a value which changes if any attribute's name, number or type changes
+ *
+ * Used to detect whether data encoded using attribute numbers (instead of names)
+ * was encoded with the same dictionaries as are currently loaded.
+ *
+ * @note Not thread safe.  Should be called during instantiation.
+ *
+ * @param[in] dict to fingerprint.
+ * @return the dictionary fingerprint.
+ */
+uint32_t fr_dict_fingerprint(fr_dict_t *dict)
+{
+	uint32_t fingerprint = 0;
+
+	fr_hash_table_walk(dict->attributes_by_name, _dict_fingerprint_walk, &fingerprint);
+
+	return fingerprint;
+}
+
 /** Copy a known or unknown attribute to produce an unknown attribute
  *
  * Will copy the complete hierarchy down to the first known attribute.
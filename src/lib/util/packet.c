@@ -26,6 +26,7 @@ RCSID("$Id$")
 #include	<freeradius-devel/udp.h>
 
 #include <fcntl.h>
+#include <sys/event.h>
 
 /*
  *	See if two packets are identical.
@@ -235,7 +236,8 @@ int fr_socket(fr_ipaddr_t const *ipaddr, uint16_t port)
 /*
  *	We need to keep track of the socket & it's IP/port.
  */
-typedef struct fr_packet_socket_t {
+typedef struct fr_packet_socket_t fr_packet_socket_t;
+struct fr_packet_socket_t {
 	int		sockfd;
 	void		*ctx;
 
@@ -255,14 +257,17 @@ typedef struct fr_packet_socket_t {
 	int		proto;
 #endif
 
-	uint8_t		id[32];
-} fr_packet_socket_t;
+	bool		usable;		//!< Whether we're in the list of sockets id_alloc() checks.
+	fr_packet_socket_t *prev;
+	fr_packet_socket_t *next;
 
+	uint64_t	free_ids[4];	//!< Bit set == ID is free.
+};
+
+#define MAX_IDS (256)
+#define ID_WORDS (MAX_IDS / 64)
 
-#define FNV_MAGIC_PRIME (0x01000193)
-#define MAX_SOCKETS (256)
-#define SOCKOFFSET_MASK (MAX_SOCKETS - 1)
-#define SOCK2OFFSET(sockfd) ((sockfd * FNV_MAGIC_PRIME) & SOCKOFFSET_MASK)
+#define PACKET_LIST_EVENTS (64)
 
 /*
  *	Structure defining a list of packets (incoming or outgoing)
@@ -276,27 +281,91 @@ struct fr_packet_list_t {
 	int		last_recv;
 	int		num_sockets;
 
-	fr_packet_socket_t sockets[MAX_SOCKETS];
+	fr_packet_socket_t **sockets;	//!< Indexed by file descriptor.
+	int		max_sockets;	//!< Number of entries in the sockets array.
+
+	fr_packet_socket_t *usable;	//!< Sockets which aren't frozen, and have free IDs.
+
+	fr_randctx	*randctx;	//!< Where to get random IDs from, or NULL for fr_rand().
+
+	int		kq;		//!< For fr_packet_list_poll(), -1 until first used.
+	struct kevent	events[PACKET_LIST_EVENTS];
+	int		num_events;	//!< Returned by the last call to kevent().
+	int		next_event;	//!< Next of those to service.
 };
 
 
 /*
- *	Ugh.  Doing this on every sent/received packet is not nice.
+ *	File descriptors are small integers, so we just index the
+ *	sockets by them.
  */
-static fr_packet_socket_t *fr_socket_find(fr_packet_list_t *pl,
-					  int sockfd)
+static inline fr_packet_socket_t *fr_socket_find(fr_packet_list_t *pl,
+						  int sockfd)
 {
-	int i, start;
+	if ((sockfd < 0) || (sockfd >= pl->max_sockets)) return NULL;
 
-	i = start = SOCK2OFFSET(sockfd);
+	return pl->sockets[sockfd];
+}
 
-	do {			/* make this hack slightly more efficient */
-		if (pl->sockets[i].sockfd == sockfd) return &pl->sockets[i];
+/*
+ *	Add or remove the socket from the list id_alloc() walks, so
+ *	that it never has to look at sockets it can't use.
+ */
+static void socket_usable_update(fr_packet_list_t *pl, fr_packet_socket_t *ps)
+{
+	bool usable = !ps->dont_use && (ps->num_outgoing < MAX_IDS);
 
-		i = (i + 1) & SOCKOFFSET_MASK;
-	} while (i != start);
+	if (usable == ps->usable) return;
+	ps->usable = usable;
 
-	return NULL;
+	if (usable) {
+		ps->prev = NULL;
+		ps->next = pl->usable;
+		if (pl->usable) pl->usable->prev = ps;
+		pl->usable = ps;
+		return;
+	}
+
+	if (ps->prev) {
+		ps->prev->next = ps->next;
+	} else {
+		pl->usable = ps->next;
+	}
+	if (ps->next) ps->next->prev = ps->prev;
+	ps->prev = ps->next = NULL;
+}
+
+/*
+ *	Find a free ID, starting from a random one.  At most one find
+ *	first set per word, instead of probing bit by bit.
+ */
+static int socket_id_alloc(fr_packet_list_t *pl, fr_packet_socket_t *ps)
+{
+	int		i, start, word;
+	uint64_t	bits;
+
+	start = (pl->randctx ? fr_rand_from_ctx(pl->randctx) : fr_rand()) & (MAX_IDS - 1);
+	word = start >> 6;
+
+	/*
+	 *	The IDs at or after the start, in the start word.
+	 */
+	bits = ps->free_ids[word] & (~((uint64_t) 0) << (start & 0x3f));
+
+	for (i = 0; !bits && (i < ID_WORDS); i++) {
+		word = (word + 1) & (ID_WORDS - 1);
+		bits = ps->free_ids[word];
+	}
+	if (!bits) return -1;
+
+	ps->free_ids[word] &= ~(bits & -bits);
+
+	return (word << 6) + __builtin_ctzll(bits);
+}
+
+static inline void socket_id_free(fr_packet_socket_t *ps, int id)
+{
+	ps->free_ids[(id >> 6) & (ID_WORDS - 1)] |= ((uint64_t) 1) << (id & 0x3f);
 }
 
 bool fr_packet_list_socket_freeze(fr_packet_list_t *pl, int sockfd)
@@ -315,6 +384,7 @@ bool fr_packet_list_socket_freeze(fr_packet_list_t *pl, int sockfd)
 	}
 
 	ps->dont_use = true;
+	socket_usable_update(pl, ps);
 	return true;
 }
 
@@ -328,6 +398,7 @@ bool fr_packet_list_socket_thaw(fr_packet_list_t *pl, int sockfd)
 	if (!ps) return false;
 
 	ps->dont_use = false;
+	socket_usable_update(pl, ps);
 	return true;
 }
 
@@ -343,7 +414,23 @@ bool fr_packet_list_socket_del(fr_packet_list_t *pl, int sockfd)
 
 	if (ps->num_outgoing != 0) return false;
 
-	ps->sockfd = -1;
+	ps->dont_use = true;
+	socket_usable_update(pl, ps);
+
+	/*
+	 *	The caller may close the socket as soon as we return,
+	 *	so forget about any events we haven't serviced yet.
+	 */
+	if (pl->kq >= 0) {
+		struct kevent evset;
+
+		EV_SET(&evset, sockfd, EVFILT_READ, EV_DELETE, 0, 0, 0);
+		(void) kevent(pl->kq, &evset, 1, NULL, 0, NULL);
+		pl->num_events = pl->next_event = 0;
+	}
+
+	pl->sockets[sockfd] = NULL;
+	talloc_free(ps);
 	pl->num_sockets--;
 
 	return true;
@@ -354,21 +441,15 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 			      fr_ipaddr_t *dst_ipaddr, uint16_t dst_port,
 			      void *ctx)
 {
-	int i, start;
 	struct sockaddr_storage	src;
 	socklen_t		sizeof_src;
 	fr_packet_socket_t	*ps;
 
-	if (!pl || !dst_ipaddr || (dst_ipaddr->af == AF_UNSPEC)) {
+	if (!pl || !dst_ipaddr || (dst_ipaddr->af == AF_UNSPEC) || (sockfd < 0)) {
 		fr_strerror_printf("Invalid argument");
 		return false;
 	}
 
-	if (pl->num_sockets >= MAX_SOCKETS) {
-		fr_strerror_printf("Too many open sockets");
-		return false;
-	}
-
 #ifndef WITH_TCP
 	if (proto != IPPROTO_UDP) {
 		fr_strerror_printf("only UDP is supported");
@@ -376,28 +457,41 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 	}
 #endif
 
-	ps = NULL;
-	i = start = SOCK2OFFSET(sockfd);
+	if (fr_socket_find(pl, sockfd)) {
+		fr_strerror_printf("Socket is already in the list");
+		return false;
+	}
 
-	do {
-		if (pl->sockets[i].sockfd == -1) {
-			ps =  &pl->sockets[i];
-			break;
+	/*
+	 *	Grow the table, so that it can be indexed by sockfd.
+	 */
+	if (sockfd >= pl->max_sockets) {
+		fr_packet_socket_t	**sockets;
+		int			max_sockets = pl->max_sockets ? pl->max_sockets : 64;
+
+		while (max_sockets <= sockfd) max_sockets *= 2;
+
+		sockets = talloc_realloc(pl, pl->sockets, fr_packet_socket_t *, max_sockets);
+		if (!sockets) {
+			fr_strerror_printf("Out of memory");
+			return false;
 		}
+		memset(sockets + pl->max_sockets, 0, (max_sockets - pl->max_sockets) * sizeof(*sockets));
 
-		i = (i + 1) & SOCKOFFSET_MASK;
-	} while (i != start);
+		pl->sockets = sockets;
+		pl->max_sockets = max_sockets;
+	}
 
+	ps = talloc_zero(pl, fr_packet_socket_t);
 	if (!ps) {
-		fr_strerror_printf("All socket entries are full");
+		fr_strerror_printf("Out of memory");
 		return false;
 	}
-
-	memset(ps, 0, sizeof(*ps));
 	ps->ctx = ctx;
 #ifdef WITH_TCP
 	ps->proto = proto;
 #endif
+	memset(ps->free_ids, 0xff, sizeof(ps->free_ids));
 
 	/*
 	 *	Get address family, etc. first, so we know if we
@@ -411,29 +505,43 @@ bool fr_packet_list_socket_add(fr_packet_list_t *pl, int sockfd, int proto,
 	if (getsockname(sockfd, (struct sockaddr *) &src,
 			&sizeof_src) < 0) {
 		fr_strerror_printf("%s", fr_syserror(errno));
+	error:
+		talloc_free(ps);
 		return false;
 	}
 
 	if (!fr_ipaddr_from_sockaddr(&src, sizeof_src, &ps->src_ipaddr,
 				&ps->src_port)) {
 		fr_strerror_printf("Failed to get IP");
-		return false;
+		goto error;
 	}
 
 	ps->dst_ipaddr = *dst_ipaddr;
 	ps->dst_port = dst_port;
 
 	ps->src_any = fr_is_inaddr_any(&ps->src_ipaddr);
-	if (ps->src_any < 0) return false;
+	if (ps->src_any < 0) goto error;
 
 	ps->dst_any = fr_is_inaddr_any(&ps->dst_ipaddr);
-	if (ps->dst_any < 0) return false;
+	if (ps->dst_any < 0) goto error;
+
+	if (pl->kq >= 0) {
+		struct kevent evset;
+
+		EV_SET(&evset, sockfd, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, 0);
+		if (kevent(pl->kq, &evset, 1, NULL, 0, NULL) < 0) {
+			fr_strerror_printf("Failed adding socket to kqueue: %s", fr_syserror(errno));
+			goto error;
+		}
+	}
 
 	/*
 	 *	As the last step before returning.
 	 */
 	ps->sockfd = sockfd;
+	pl->sockets[sockfd] = ps;
 	pl->num_sockets++;
+	socket_usable_update(pl, ps);
 
 	return true;
 }
@@ -446,6 +554,13 @@ static int packet_entry_cmp(void const *one, void const *two)
 	return fr_packet_cmp(*a, *b);
 }
 
+static int _packet_list_free(fr_packet_list_t *pl)
+{
+	if (pl->kq >= 0) close(pl->kq);
+
+	return 0;
+}
+
 void fr_packet_list_free(fr_packet_list_t *pl)
 {
 	if (!pl) return;
@@ -460,26 +575,38 @@ void fr_packet_list_free(fr_packet_list_t *pl)
  */
 fr_packet_list_t *fr_packet_list_create(int alloc_id)
 {
-	int i;
 	fr_packet_list_t	*pl;
 
 	pl = talloc_zero(NULL, fr_packet_list_t);
 	if (!pl) return NULL;
+	pl->kq = -1;
+	talloc_set_destructor(pl, _packet_list_free);
+
 	pl->tree = rbtree_create(pl, packet_entry_cmp, NULL, 0);
 	if (!pl->tree) {
 		fr_packet_list_free(pl);
 		return NULL;
 	}
 
-	for (i = 0; i < MAX_SOCKETS; i++) {
-		pl->sockets[i].sockfd = -1;
-	}
-
 	pl->alloc_id = alloc_id;
 
 	return pl;
 }
 
+/** Allocate IDs using a private random pool
+ *
+ * For packet lists which are only used by one thread, and where that
+ * thread already has a pool of its own.
+ *
+ * @param[in] pl	to set the pool for.
+ * @param[in] randctx	Pool to use, or NULL to go back to fr_rand().
+ *			Must outlive the packet list.
+ */
+void fr_packet_list_rand_set(fr_packet_list_t *pl, fr_randctx *randctx)
+{
+	pl->randctx = randctx;
+}
+
 
 /*
  *	If pl->alloc_id is set, then fr_packet_list_id_alloc() MUST
@@ -606,7 +733,7 @@ uint32_t fr_packet_list_num_elements(fr_packet_list_t *pl)
 bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 			    RADIUS_PACKET **request_p, void **pctx)
 {
-	int i, j, k, fd, id, start_i, start_j, start_k;
+	int id;
 	int src_any = 0;
 	fr_packet_socket_t *ps= NULL;
 	RADIUS_PACKET *request = *request_p;
@@ -657,36 +784,16 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 	 *	Id's only when all responses have been received, OR after
 	 *	a timeout.
 	 *
-	 *	Right now, the random approach is almost OK... it's
-	 *	brute-force over all of the available ID's, BUT using
-	 *	random numbers for everything spreads the load a bit.
+	 *	Right now, the random approach is almost OK.  We only
+	 *	walk the sockets which have free IDs, and the ID is
+	 *	found with one bit scan per 64 IDs, starting from a
+	 *	random number.
 	 *
-	 *	The old method had a hash lookup on allocation AND
-	 *	on free.  The new method has brute-force on allocation,
-	 *	and near-zero cost on free.
+	 *	Allocation is O(sockets which don't match), and free
+	 *	is O(1).
 	 */
-
-	id = fd = -1;
-	start_i = fr_rand() & SOCKOFFSET_MASK;
-
-#define ID_i ((i + start_i) & SOCKOFFSET_MASK)
-	for (i = 0; i < MAX_SOCKETS; i++) {
-		if (pl->sockets[ID_i].sockfd == -1) continue; /* paranoia */
-
-		ps = &(pl->sockets[ID_i]);
-
-		/*
-		 *	This socket is marked as "don't use for new
-		 *	packets".  But we can still receive packets
-		 *	that are outstanding.
-		 */
-		if (ps->dont_use) continue;
-
-		/*
-		 *	All IDs are allocated: ignore it.
-		 */
-		if (ps->num_outgoing == 256) continue;
-
+	id = -1;
+	for (ps = pl->usable; ps != NULL; ps = ps->next) {
 #ifdef WITH_TCP
 		if (ps->proto != proto) continue;
 #endif
@@ -747,40 +854,17 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 				   &ps->dst_ipaddr) != 0)) continue;
 
 		/*
-		 *	Otherwise, this socket is OK to use.
+		 *	Otherwise, this socket is OK to use.  It's in
+		 *	the usable list, so it has a free ID.
 		 */
-
-		/*
-		 *	Look for a free Id, starting from a random number.
-		 */
-		start_j = fr_rand() & 0x1f;
-#define ID_j ((j + start_j) & 0x1f)
-		for (j = 0; j < 32; j++) {
-			if (ps->id[ID_j] == 0xff) continue;
-
-
-			start_k = fr_rand() & 0x07;
-#define ID_k ((k + start_k) & 0x07)
-			for (k = 0; k < 8; k++) {
-				if ((ps->id[ID_j] & (1 << ID_k)) != 0) continue;
-
-				ps->id[ID_j] |= (1 << ID_k);
-				id = (ID_j * 8) + ID_k;
-				fd = i;
-				break;
-			}
-			if (fd >= 0) break;
-		}
-#undef ID_i
-#undef ID_j
-#undef ID_k
+		id = socket_id_alloc(pl, ps);
 		break;
 	}
 
 	/*
 	 *	Ask the caller to allocate a new ID.
 	 */
-	if (fd < 0) {
+	if (id < 0) {
 		fr_strerror_printf("Failed finding socket, caller must allocate a new one");
 		return false;
 	}
@@ -801,6 +885,7 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 		if (pctx) *pctx = ps->ctx;
 		ps->num_outgoing++;
 		pl->num_outgoing++;
+		socket_usable_update(pl, ps);
 		return true;
 	}
 
@@ -808,7 +893,7 @@ bool fr_packet_list_id_alloc(fr_packet_list_t *pl, int proto,
 	 *	Mark the ID as free.  This is the one line from
 	 *	id_free() that we care about here.
 	 */
-	ps->id[(request->id >> 3) & 0x1f] &= ~(1 << (request->id & 0x07));
+	socket_id_free(ps, request->id);
 
 	request->id = -1;
 	request->sockfd = -1;
@@ -834,16 +919,11 @@ bool fr_packet_list_id_free(fr_packet_list_t *pl,
 	ps = fr_socket_find(pl, request->sockfd);
 	if (!ps) return false;
 
-#if 0
-	if (!ps->id[(request->id >> 3) & 0x1f] & (1 << (request->id & 0x07))) {
-		fr_exit(1);
-	}
-#endif
-
-	ps->id[(request->id >> 3) & 0x1f] &= ~(1 << (request->id & 0x07));
+	socket_id_free(ps, request->id);
 
 	ps->num_outgoing--;
 	pl->num_outgoing--;
+	socket_usable_update(pl, ps);
 
 	request->id = -1;
 	request->src_ipaddr.af = AF_UNSPEC; /* id_alloc checks this */
@@ -866,6 +946,10 @@ int fr_packet_list_walk(fr_packet_list_t *pl, void *ctx, rb_walker_t callback)
 	return rbtree_walk(pl->tree, RBTREE_DELETE_ORDER, callback, ctx);
 }
 
+/*
+ *	Sockets with descriptors >= FD_SETSIZE can't go into an fd_set.
+ *	Callers with that many sockets should use fr_packet_list_poll().
+ */
 int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set)
 {
 	int i, maxfd;
@@ -874,12 +958,10 @@ int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set)
 
 	maxfd = -1;
 
-	for (i = 0; i < MAX_SOCKETS; i++) {
-		if (pl->sockets[i].sockfd == -1) continue;
-		FD_SET(pl->sockets[i].sockfd, set);
-		if (pl->sockets[i].sockfd > maxfd) {
-			maxfd = pl->sockets[i].sockfd;
-		}
+	for (i = 0; (i < pl->max_sockets) && (i < FD_SETSIZE); i++) {
+		if (!pl->sockets[i]) continue;
+		FD_SET(i, set);
+		maxfd = i;
 	}
 
 	if (maxfd < 0) return -1;
@@ -887,6 +969,28 @@ int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set)
 	return maxfd + 1;
 }
 
+static RADIUS_PACKET *packet_list_read(fr_packet_socket_t *ps)
+{
+	RADIUS_PACKET *packet;
+
+#ifdef WITH_TCP
+	if (ps->proto == IPPROTO_TCP) {
+		packet = fr_tcp_recv(ps->sockfd, false);
+	} else
+#endif
+		packet = fr_radius_packet_recv(NULL, ps->sockfd, UDP_FLAGS_NONE, false);
+	if (!packet) return NULL;
+
+	/*
+	 *	Call fr_packet_list_find_byreply().  If it
+	 *	doesn't find anything, discard the reply.
+	 */
+#ifdef WITH_TCP
+	packet->proto = ps->proto;
+#endif
+	return packet;
+}
+
 /*
  *	Round-robins the receivers, without priority.
  *
@@ -895,43 +999,131 @@ int fr_packet_list_fd_set(fr_packet_list_t *pl, fd_set *set)
  */
 RADIUS_PACKET *fr_packet_list_recv(fr_packet_list_t *pl, fd_set *set)
 {
-	int start;
+	int i, start, max;
 	RADIUS_PACKET *packet;
 
 	if (!pl || !set) return NULL;
 
+	max = pl->max_sockets;
+	if (max > FD_SETSIZE) max = FD_SETSIZE;
+	if (max == 0) return NULL;
+
 	start = pl->last_recv;
-	do {
+	for (i = 0; i < max; i++) {
+		fr_packet_socket_t *ps;
+
 		start++;
-		start &= SOCKOFFSET_MASK;
+		if (start >= max) start = 0;
 
-		if (pl->sockets[start].sockfd == -1) continue;
+		ps = pl->sockets[start];
+		if (!ps) continue;
 
-		if (!FD_ISSET(pl->sockets[start].sockfd, set)) continue;
+		if (!FD_ISSET(start, set)) continue;
 
-#ifdef WITH_TCP
-		if (pl->sockets[start].proto == IPPROTO_TCP) {
-			packet = fr_tcp_recv(pl->sockets[start].sockfd, false);
-		} else
-#endif
-			packet = fr_radius_packet_recv(NULL, pl->sockets[start].sockfd, UDP_FLAGS_NONE, false);
+		packet = packet_list_read(ps);
 		if (!packet) continue;
 
-		/*
-		 *	Call fr_packet_list_find_byreply().  If it
-		 *	doesn't find anything, discard the reply.
-		 */
-
 		pl->last_recv = start;
-#ifdef WITH_TCP
-		packet->proto = pl->sockets[start].proto;
-#endif
 		return packet;
-	} while (start != pl->last_recv);
+	}
 
 	return NULL;
 }
 
+/** Wait for, and read, a packet from any socket in the list
+ *
+ * Unlike fr_packet_list_fd_set() and fr_packet_list_recv(), this has
+ * no limit on the number, or value, of the file descriptors, and
+ * doesn't have to look at every socket to find the ones which are
+ * readable.
+ *
+ * Readable sockets are fetched from the kernel in batches, and are
+ * serviced one per call, so that busy sockets can't starve others.
+ *
+ * @param[in] pl	to read from.
+ * @param[out] out	Where to write the packet.
+ * @param[in] timeout	How long to wait for a packet. NULL means wait forever.
+ * @return
+ *	- 1 if a packet was read.
+ *	- 0 if the timeout expired.
+ *	- -1 on error, or if a bad packet was received.
+ */
+int fr_packet_list_poll(fr_packet_list_t *pl, RADIUS_PACKET **out, struct timeval *timeout)
+{
+	fr_packet_socket_t	*ps;
+
+	*out = NULL;
+
+	if (!pl) {
+		fr_strerror_printf("Invalid argument");
+		return -1;
+	}
+
+	/*
+	 *	Create the kqueue the first time we're called, and
+	 *	register any sockets which were added before then.
+	 *	socket_add() and socket_del() keep it up to date
+	 *	after that.
+	 */
+	if (pl->kq < 0) {
+		int i;
+
+		pl->kq = kqueue();
+		if (pl->kq < 0) {
+			fr_strerror_printf("Failed creating kqueue: %s", fr_syserror(errno));
+			return -1;
+		}
+
+		for (i = 0; i < pl->max_sockets; i++) {
+			struct kevent evset;
+
+			if (!pl->sockets[i]) continue;
+
+			EV_SET(&evset, i, EVFILT_READ, EV_ADD | EV_ENABLE, 0, 0, 0);
+			if (kevent(pl->kq, &evset, 1, NULL, 0, NULL) < 0) {
+				fr_strerror_printf("Failed adding socket to kqueue: %s", fr_syserror(errno));
+				close(pl->kq);
+				pl->kq = -1;
+				return -1;
+			}
+		}
+	}
+
+	do {
+		if (pl->next_event >= pl->num_events) {
+			struct timespec ts, *ts_p = NULL;
+
+			if (timeout) {
+				ts.tv_sec = timeout->tv_sec;
+				ts.tv_nsec = timeout->tv_usec * 1000;
+				ts_p = &ts;
+			}
+
+			pl->next_event = 0;
+			pl->num_events = kevent(pl->kq, NULL, 0, pl->events, PACKET_LIST_EVENTS, ts_p);
+			if (pl->num_events < 0) {
+				pl->num_events = 0;
+				if (errno == EINTR) return 0;
+
+				fr_strerror_printf("Failed waiting for packets: %s", fr_syserror(errno));
+				return -1;
+			}
+			if (pl->num_events == 0) return 0;
+		}
+
+		/*
+		 *	The socket may have been deleted since
+		 *	kevent() returned.
+		 */
+		ps = fr_socket_find(pl, pl->events[pl->next_event++].ident);
+	} while (!ps);
+
+	*out = packet_list_read(ps);
+	if (!*out) return -1;
+
+	return 1;
+}
+
 uint32_t fr_packet_list_num_incoming(fr_packet_list_t *pl)
 {
 	uint32_t num_elements;
@@ -0,0 +1,310 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License, version 2 of the
+ *   License as published by the Free Software Foundation.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lib/util/packet_ring.c
+ * @brief Memory mapped AF_PACKET (TPACKET_V3) receive rings.
+ *
+ * The kernel copies frames into blocks in a ring shared with us, and
+ * hands over a whole block at a time, either when it's full, or when
+ * #PACKET_RING_TIMEOUT expires.  We walk the frames in place, and give
+ * the block back when we're done with it.  There's no system call per
+ * frame, and no copy into a user supplied buffer.
+ *
+ * Frames are sent with sendto() on the same socket.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/packet_ring.h>
+
+#ifdef HAVE_PACKET_RING
+#include <sys/mman.h>
+#include <net/if_arp.h>
+
+struct fr_packet_ring {
+	int			fd;		//!< AF_PACKET socket the ring is attached to.
+	int			hatype;		//!< ARPHRD_* type of the interface.
+
+	uint8_t			*map;		//!< Start of the ring.
+	size_t			map_len;	//!< Length of the ring.
+	struct tpacket_req3	req;		//!< Ring geometry.
+
+	unsigned int		block;		//!< Block we're reading, or will read next.
+	struct tpacket_block_desc *desc;	//!< Block we own, or NULL if we're waiting for the kernel.
+	struct tpacket3_hdr	*hdr;		//!< Next frame in the block.
+	uint32_t		left;		//!< Frames left in the block.
+
+	uint64_t		received;	//!< Frames seen by the kernel.  Includes drops.
+	uint64_t		dropped;	//!< Frames dropped because the ring was full.
+};
+
+static int _packet_ring_free(fr_packet_ring_t *ring)
+{
+	if (ring->map) munmap(ring->map, ring->map_len);
+	close(ring->fd);
+
+	return 0;
+}
+
+/** Open an AF_PACKET socket, and attach a memory mapped receive ring to it
+ *
+ * @param[in] ctx		to allocate the ring in.
+ * @param[in] if_index		of the interface to bind to.
+ * @param[in] protocol		ETH_P_* value, in host byte order, of the frames to receive.
+ * @param[in] size		of the ring.  Rounded up to a whole number of blocks.
+ *				0 means #PACKET_RING_SIZE_DEFAULT.
+ * @param[in] promiscuous	if true, put the interface into promiscuous mode.
+ * @return
+ *	- A new ring.
+ *	- NULL on error.
+ */
+fr_packet_ring_t *fr_packet_ring_alloc(TALLOC_CTX *ctx, int if_index, uint16_t protocol,
+				       size_t size, bool promiscuous)
+{
+	fr_packet_ring_t	*ring;
+	struct sockaddr_ll	ll;
+	socklen_t		ll_len = sizeof(ll);
+	int			version = TPACKET_V3;
+
+	if (!size) size = PACKET_RING_SIZE_DEFAULT;
+
+	ring = talloc_zero(ctx, fr_packet_ring_t);
+	if (!ring) {
+		fr_strerror_printf("Out of memory");
+		return NULL;
+	}
+
+	/*
+	 *	Don't bind to the protocol until the ring is set
+	 *	up, otherwise we'd get frames from every interface
+	 *	in the meantime.
+	 */
+	ring->fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (ring->fd < 0) {
+		fr_strerror_printf("Failed opening packet socket: %s", fr_syserror(errno));
+		talloc_free(ring);
+		return NULL;
+	}
+	talloc_set_destructor(ring, _packet_ring_free);
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_VERSION, &version, sizeof(version)) < 0) {
+		fr_strerror_printf("Failed setting TPACKET_V3: %s", fr_syserror(errno));
+	error:
+		talloc_free(ring);
+		return NULL;
+	}
+
+	/*
+	 *	Blocks must be a multiple of the page size, and frames
+	 *	can't span blocks.  Frames in V3 rings are variable
+	 *	length, tp_frame_size only matters for the sanity
+	 *	checks the kernel does on the geometry.
+	 */
+	ring->req.tp_block_size = PACKET_RING_BLOCK_SIZE;
+	ring->req.tp_block_nr = (size + PACKET_RING_BLOCK_SIZE - 1) / PACKET_RING_BLOCK_SIZE;
+	if (ring->req.tp_block_nr < PACKET_RING_BLOCKS_MIN) ring->req.tp_block_nr = PACKET_RING_BLOCKS_MIN;
+	ring->req.tp_frame_size = 2048;
+	ring->req.tp_frame_nr = (ring->req.tp_block_size / ring->req.tp_frame_size) * ring->req.tp_block_nr;
+	ring->req.tp_retire_blk_tov = PACKET_RING_TIMEOUT;
+
+	if (setsockopt(ring->fd, SOL_PACKET, PACKET_RX_RING, &ring->req, sizeof(ring->req)) < 0) {
+		fr_strerror_printf("Failed creating receive ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	ring->map_len = (size_t)ring->req.tp_block_size * ring->req.tp_block_nr;
+	ring->map = mmap(NULL, ring->map_len, PROT_READ | PROT_WRITE, MAP_SHARED, ring->fd, 0);
+	if (ring->map == MAP_FAILED) {
+		ring->map = NULL;
+		fr_strerror_printf("Failed mapping receive ring: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	memset(&ll, 0, sizeof(ll));
+	ll.sll_family = AF_PACKET;
+	ll.sll_protocol = htons(protocol);
+	ll.sll_ifindex = if_index;
+	if (bind(ring->fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+		fr_strerror_printf("Failed binding packet socket: %s", fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	The kernel fills in the hardware type of the
+	 *	interface we bound to.
+	 */
+	if (getsockname(ring->fd, (struct sockaddr *)&ll, &ll_len) < 0) {
+		fr_strerror_printf("Failed getting packet socket address: %s", fr_syserror(errno));
+		goto error;
+	}
+	ring->hatype = ll.sll_hatype;
+
+	if (promiscuous) {
+		struct packet_mreq mreq;
+
+		memset(&mreq, 0, sizeof(mreq));
+		mreq.mr_ifindex = if_index;
+		mreq.mr_type = PACKET_MR_PROMISC;
+		if (setsockopt(ring->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0) {
+			fr_strerror_printf("Failed enabling promiscuous mode: %s", fr_syserror(errno));
+			goto error;
+		}
+	}
+
+	return ring;
+}
+
+/** Return the file descriptor to wait on for frames
+ *
+ * The descriptor is readable when the kernel has handed us a block.
+ * Frames may also be sent with sendto() on it.
+ */
+int fr_packet_ring_fd(fr_packet_ring_t const *ring)
+{
+	return ring->fd;
+}
+
+/** Return the ARPHRD_* type of the interface the ring is bound to
+ *
+ */
+int fr_packet_ring_hatype(fr_packet_ring_t const *ring)
+{
+	return ring->hatype;
+}
+
+/** Attach a classic BPF filter to the ring's socket
+ *
+ * @param[in] ring	to filter.
+ * @param[in] filter	instructions.  Laid out the same as libpcap's struct bpf_insn.
+ * @param[in] len	number of instructions.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_packet_ring_filter(fr_packet_ring_t *ring, struct sock_filter const *filter, uint16_t len)
+{
+	struct sock_fprog prog;
+
+	prog.len = len;
+	memcpy(&prog.filter, &filter, sizeof(prog.filter));	/* const */
+
+	if (setsockopt(ring->fd, SOL_SOCKET, SO_ATTACH_FILTER, &prog, sizeof(prog)) < 0) {
+		fr_strerror_printf("Failed attaching filter: %s", fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Return the next frame from the ring
+ *
+ * Blocks are given back to the kernel lazily, on the call after the last
+ * frame in them is returned, so the frame data is valid until the next
+ * call.  Callers should keep calling this until it returns 0 before waiting
+ * on the file descriptor again, otherwise the descriptor stays readable.
+ *
+ * Frames we sent ourselves are skipped on loopback interfaces, otherwise
+ * everything would be seen twice.
+ *
+ * @param[in] ring	to read from.
+ * @param[out] frame	the next frame.
+ * @return
+ *	- 1 if a frame was returned.
+ *	- 0 if there are no more frames, for now.
+ */
+int fr_packet_ring_next(fr_packet_ring_t *ring, fr_packet_ring_frame_t *frame)
+{
+	for (;;) {
+		struct tpacket3_hdr	*hdr;
+		struct sockaddr_ll	*ll;
+
+		if (!ring->desc) {
+			struct tpacket_block_desc *desc;
+
+			desc = (struct tpacket_block_desc *)(ring->map + ((size_t)ring->block * ring->req.tp_block_size));
+			if (!(((volatile struct tpacket_block_desc *)desc)->hdr.bh1.block_status & TP_STATUS_USER)) {
+				return 0;
+			}
+			__sync_synchronize();
+
+			ring->desc = desc;
+			ring->hdr = (struct tpacket3_hdr *)((uint8_t *)desc + desc->hdr.bh1.offset_to_first_pkt);
+			ring->left = desc->hdr.bh1.num_pkts;
+		}
+
+		/*
+		 *	Done with this block, give it back to the
+		 *	kernel and move onto the next one.
+		 */
+		if (!ring->left) {
+			__sync_synchronize();
+			((volatile struct tpacket_block_desc *)ring->desc)->hdr.bh1.block_status = TP_STATUS_KERNEL;
+
+			ring->desc = NULL;
+			if (++ring->block == ring->req.tp_block_nr) ring->block = 0;
+			continue;
+		}
+
+		hdr = ring->hdr;
+		ring->hdr = (struct tpacket3_hdr *)((uint8_t *)hdr + hdr->tp_next_offset);
+		ring->left--;
+
+		ll = (struct sockaddr_ll *)((uint8_t *)hdr + TPACKET_ALIGN(sizeof(*hdr)));
+		if ((ring->hatype == ARPHRD_LOOPBACK) && (ll->sll_pkttype == PACKET_OUTGOING)) continue;
+
+		frame->data = (uint8_t *)hdr + hdr->tp_mac;
+		frame->len = hdr->tp_snaplen;
+		frame->wire_len = hdr->tp_len;
+		frame->timestamp.tv_sec = hdr->tp_sec;
+		frame->timestamp.tv_usec = hdr->tp_nsec / 1000;
+		frame->ll = ll;
+
+		return 1;
+	}
+}
+
+/** Get the number of frames received and dropped since the ring was opened
+ *
+ * @param[in] ring	to get statistics for.
+ * @param[out] received	frames seen by the kernel, including ones which were dropped.
+ * @param[out] dropped	frames dropped because the ring was full.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_packet_ring_stats(fr_packet_ring_t *ring, uint64_t *received, uint64_t *dropped)
+{
+	struct tpacket_stats_v3	stats;
+	socklen_t		len = sizeof(stats);
+
+	/*
+	 *	The kernel resets the counters every time they're read.
+	 */
+	if (getsockopt(ring->fd, SOL_PACKET, PACKET_STATISTICS, &stats, &len) < 0) {
+		fr_strerror_printf("Failed getting ring statistics: %s", fr_syserror(errno));
+		return -1;
+	}
+	ring->received += stats.tp_packets;
+	ring->dropped += stats.tp_drops;
+
+	*received = ring->received;
+	*dropped = ring->dropped;
+
+	return 0;
+}
+#endif
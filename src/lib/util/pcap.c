@@ -37,6 +37,11 @@
 #include <freeradius-devel/net.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef HAVE_PACKET_RING
+#  include <linux/if_ether.h>
+#  include <net/if_arp.h>
+#endif
+
 /** Talloc destructor to free pcap resources associated with a handle.
  *
  * @param pcap to free.
@@ -53,6 +58,12 @@ static int _free_pcap(fr_pcap_t *pcap)
 		if (pcap->handle) {
 			pcap_close(pcap->handle);
 
+#ifdef HAVE_PACKET_RING
+			/*
+			 *	The ring owns its descriptor.
+			 */
+			if (pcap->ring) break;
+#endif
 			if (pcap->fd > 0) {
 				close(pcap->fd);
 			}
@@ -178,6 +189,55 @@ int fr_pcap_mac_addr(uint8_t *macaddr, char *ifname)
 #endif
 }
 
+#ifdef HAVE_PACKET_RING
+/** Open a memory mapped receive ring on an interface
+ *
+ * libpcap is only used to compile filters, so the handle is a dead one.
+ *
+ * @param pcap to open the ring for.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int pcap_open_ring(fr_pcap_t *pcap)
+{
+	pcap->ring = fr_packet_ring_alloc(pcap, pcap->if_index, ETH_P_ALL,
+					  (size_t)SNAPLEN * (pcap->buffer_pkts ? pcap->buffer_pkts : PCAP_BUFFER_DEFAULT),
+					  pcap->promiscuous);
+	if (!pcap->ring) return -1;
+
+	/*
+	 *	Loopback frames have a (zeroed) Ethernet header too.
+	 */
+	switch (fr_packet_ring_hatype(pcap->ring)) {
+	case ARPHRD_ETHER:
+	case ARPHRD_LOOPBACK:
+		break;
+
+	default:
+		fr_strerror_printf("Memory mapped capture is only supported on Ethernet interfaces");
+	error:
+		TALLOC_FREE(pcap->ring);
+		return -1;
+	}
+
+	if (fr_pcap_mac_addr((uint8_t *)&pcap->ether_addr, pcap->name) != 0) {
+		fr_strerror_printf("Couldn't get MAC address for interface %s", pcap->name);
+		goto error;
+	}
+
+	pcap->link_layer = DLT_EN10MB;
+	pcap->handle = pcap_open_dead(pcap->link_layer, SNAPLEN);
+	if (!pcap->handle) {
+		fr_strerror_printf("Unknown error occurred opening dead PCAP handle");
+		goto error;
+	}
+	pcap->fd = fr_packet_ring_fd(pcap->ring);
+
+	return 0;
+}
+#endif
+
 /** Open a PCAP handle abstraction
  *
  * This opens interfaces for capture or injection, or files/streams for reading/writing.
@@ -205,6 +265,19 @@ int fr_pcap_open(fr_pcap_t *pcap)
 			return -1;
 		}
 
+		if (pcap->use_ring) {
+			if (pcap->type != PCAP_INTERFACE_IN) {
+				fr_strerror_printf("Memory mapped rings can only be used for capture");
+				return -1;
+			}
+#ifdef HAVE_PACKET_RING
+			return pcap_open_ring(pcap);
+#else
+			fr_strerror_printf("Memory mapped capture not supported on this system");
+			return -1;
+#endif
+		}
+
 #if defined(HAVE_PCAP_CREATE) && defined(HAVE_PCAP_ACTIVATE)
 		pcap->handle = pcap_create(pcap->name, pcap->errbuf);
 		if (!pcap->handle) {
@@ -395,6 +468,20 @@ int fr_pcap_apply_filter(fr_pcap_t *pcap, char const *expression)
 		return -1;
 	}
 
+#ifdef HAVE_PACKET_RING
+	/*
+	 *	The kernel runs the same BPF code libpcap generates.
+	 */
+	if (pcap->ring) {
+		int ret;
+
+		ret = fr_packet_ring_filter(pcap->ring, (struct sock_filter const *)fp.bf_insns, fp.bf_len);
+		pcap_freecode(&fp);
+
+		return ret;
+	}
+#endif
+
 	if (pcap_setfilter(pcap->handle, &fp) < 0) {
 		fr_strerror_printf("%s", pcap_geterr(pcap->handle));
 
@@ -404,6 +491,80 @@ int fr_pcap_apply_filter(fr_pcap_t *pcap, char const *expression)
 	return 0;
 }
 
+/** Read the next packet from a handle
+ *
+ * Works the same way as pcap_next_ex, for both libpcap handles and memory
+ * mapped rings.  The header and data are only valid until the next call.
+ *
+ * @param[in] pcap	handle to read from.
+ * @param[out] header	of the packet.
+ * @param[out] data	of the packet, starting with the link layer header.
+ * @return
+ *	- 1 if a packet was read.
+ *	- 0 if no packets are available.
+ *	- -1 on failure.
+ *	- -2 if there are no more packets in a file.
+ */
+int fr_pcap_next(fr_pcap_t *pcap, struct pcap_pkthdr **header, uint8_t const **data)
+{
+	int ret;
+
+#ifdef HAVE_PACKET_RING
+	if (pcap->ring) {
+		fr_packet_ring_frame_t frame;
+
+		if (fr_packet_ring_next(pcap->ring, &frame) == 0) return 0;
+
+		pcap->ring_header.ts = frame.timestamp;
+		pcap->ring_header.caplen = frame.len;
+		pcap->ring_header.len = frame.wire_len;
+
+		*header = &pcap->ring_header;
+		*data = frame.data;
+
+		return 1;
+	}
+#endif
+
+	ret = pcap_next_ex(pcap->handle, header, data);
+	if (ret == -1) fr_strerror_printf("%s", pcap_geterr(pcap->handle));
+
+	return ret;
+}
+
+/** Get capture statistics for a handle
+ *
+ * @param[in] pcap	handle to get statistics for.
+ * @param[out] stats	received and dropped counts.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int fr_pcap_stats(fr_pcap_t *pcap, struct pcap_stat *stats)
+{
+#ifdef HAVE_PACKET_RING
+	if (pcap->ring) {
+		uint64_t received, dropped;
+
+		if (fr_packet_ring_stats(pcap->ring, &received, &dropped) < 0) return -1;
+
+		memset(stats, 0, sizeof(*stats));
+		stats->ps_recv = received;
+		stats->ps_drop = dropped;
+
+		return 0;
+	}
+#endif
+
+	if (pcap_stats(pcap->handle, stats) < 0) {
+		fr_strerror_printf("%s", pcap_geterr(pcap->handle));
+
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Retrieve list of interface names that will be used for capture.
  * Only used for debugging.
  *
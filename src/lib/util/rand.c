@@ -108,3 +108,21 @@ uint32_t fr_rand(void)
 
 	return num;
 }
+
+/** Return a 32-bit random number from a caller provided pool
+ *
+ * @param[in] ctx	Pool, initialised with fr_randinit().
+ */
+uint32_t fr_rand_from_ctx(fr_randctx *ctx)
+{
+	uint32_t num;
+
+	if (ctx->randcnt >= 256) {
+		ctx->randcnt = 0;
+		fr_isaac(ctx);
+	}
+
+	num = ctx->randrsl[ctx->randcnt++];
+
+	return num;
+}
@@ -1,5 +1,6 @@
 SUBMAKEFILES := \
     radclient.mk \
+    raddetail.mk \
     radiusd.mk \
     radsniff.mk \
     radmin.mk \
@@ -1087,6 +1087,99 @@ static int command_show_module_flags(rad_listen_t *listener, int argc, char *arg
 	return CMD_OK;
 }
 
+/*
+ *	Run a command provided by a module.  Read only commands may be
+ *	run with "show", all commands may be run with "set".
+ */
+static int command_module_command(rad_listen_t *listener, int argc, char *argv[], bool write)
+{
+	CONF_SECTION *cs;
+	module_instance_t const *instance;
+	module_command_t const *cmd;
+	char *out = NULL, *p, *q;
+	int ret;
+
+	if (argc < 1) {
+		cprintf_error(listener, "No module name was given\n");
+		return CMD_FAIL;
+	}
+
+	cs = cf_subsection_find(main_config.config, "modules");
+	if (!cs) return CMD_FAIL;
+
+	instance = module_find(cs, argv[0]);
+	if (!instance) {
+		cprintf_error(listener, "No such module \"%s\"\n", argv[0]);
+		return CMD_FAIL;
+	}
+
+	/*
+	 *	No command, print the ones we can run.
+	 */
+	if (argc < 2) {
+		if (!instance->module->commands) {
+			cprintf_error(listener, "Module \"%s\" has no commands\n", argv[0]);
+			return CMD_FAIL;
+		}
+
+		for (cmd = instance->module->commands; cmd->command; cmd++) {
+			if (cmd->write && !write) continue;
+
+			cprintf(listener, "%s\n", cmd->help);
+		}
+		return CMD_OK;
+	}
+
+	for (cmd = instance->module->commands; cmd && cmd->command; cmd++) {
+		if (strcmp(cmd->command, argv[1]) == 0) break;
+	}
+	if (!cmd || !cmd->command) {
+		cprintf_error(listener, "No such command \"%s\" for module \"%s\"\n", argv[1], argv[0]);
+		return CMD_FAIL;
+	}
+
+	if (cmd->write && !write) {
+		cprintf_error(listener, "Command \"%s\" must be run with \"set module command\"\n", argv[1]);
+		return CMD_FAIL;
+	}
+
+	ret = cmd->func(NULL, &out, instance->data, argc - 2, argv + 2);
+
+	/*
+	 *	cprintf() has a small buffer, so write one line at a time.
+	 */
+	for (p = out; p && *p; p = q) {
+		int len;
+
+		q = strchr(p, '\n');
+		if (q) {
+			len = q++ - p;
+		} else {
+			len = strlen(p);
+			q = p + len;
+		}
+
+		if (ret < 0) {
+			cprintf_error(listener, "%.*s\n", len, p);
+		} else {
+			cprintf(listener, "%.*s\n", len, p);
+		}
+	}
+	talloc_free(out);
+
+	return (ret < 0) ? CMD_FAIL : CMD_OK;
+}
+
+static int command_show_module_command(rad_listen_t *listener, int argc, char *argv[])
+{
+	return command_module_command(listener, argc, argv, false);
+}
+
+static int command_set_module_command(rad_listen_t *listener, int argc, char *argv[])
+{
+	return command_module_command(listener, argc, argv, true);
+}
+
 static int command_show_module_status(rad_listen_t *listener, int argc, char *argv[])
 {
 	CONF_SECTION *cs;
@@ -2337,6 +2430,9 @@ static fr_command_table_t command_table_show_debug[] = {
 };
 
 static fr_command_table_t command_table_show_module[] = {
+	{ "command", FR_READ,
+	  "show module command <module> [command [args]] - run a read only command provided by <module>, or list them",
+	  command_show_module_command, NULL },
 	{ "config", FR_READ,
 	  "show module config <module> - show configuration for given module",
 	  command_show_module_config, NULL },
@@ -3028,6 +3124,10 @@ static fr_command_table_t command_table_set_home[] = {
 #endif
 
 static fr_command_table_t command_table_set_module[] = {
+	{ "command", FR_WRITE,
+	  "set module command <module> [command [args]] - run a command provided by <module>, or list them",
+	  command_set_module_command, NULL },
+
 	{ "config", FR_WRITE,
 	  "set module config <module> variable value - set configuration for <module>",
 	  command_set_module_config, NULL },
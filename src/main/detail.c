@@ -0,0 +1,379 @@
+/*
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/*
+ * $Id$
+ *
+ * @file detail.c
+ * @brief Encode and decode records in the binary detail file format.
+ *
+ * A binary detail file is a sequence of records, each of which is a
+ * fixed size header followed by the encoded attributes of one packet.
+ *
+ * @verbatim
+	0                   1                   2                   3
+	0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1 2 3 4 5 6 7 8 9 0 1
+	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	|                         Magic ("FRdt")                        |
+	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	|    Version    |     Done      |           Reserved            |
+	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	|                  Length of encoded attributes                 |
+	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+	|                           Timestamp                           |
+	+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+-+
+   @endverbatim
+ *
+ * The timestamp is an unsigned 32 bit number of seconds since the epoch,
+ * so it runs out in 2106.
+ *
+ * Each attribute is encoded as the number of components in its path
+ * from the dictionary root, the attribute number of each component,
+ * the data type, the tag, the value length, and the value.  All
+ * integers are in network byte order.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+/** Write a record header
+ *
+ * @param[out] out		Where to write the header.  Must be at least
+ *				#DETAIL_BINARY_HDR_LEN bytes.
+ * @param[in] data_len		Length of the encoded attributes which follow the header.
+ * @param[in] timestamp		When the packet was received.
+ */
+void detail_binary_encode_header(uint8_t *out, size_t data_len, time_t timestamp)
+{
+	uint32_t net;
+
+	memcpy(out, DETAIL_BINARY_MAGIC, DETAIL_BINARY_MAGIC_LEN);
+	out[4] = DETAIL_BINARY_VERSION;
+	out[DETAIL_BINARY_DONE_OFFSET] = 0;
+	out[6] = 0;
+	out[7] = 0;
+
+	net = htonl((uint32_t) data_len);
+	memcpy(out + 8, &net, sizeof(net));
+
+	net = htonl((uint32_t) timestamp);
+	memcpy(out + 12, &net, sizeof(net));
+}
+
+/** Encode a single attribute
+ *
+ * @param[out] out		Where to write the encoded attribute.
+ * @param[in] outlen		Length of the output buffer.
+ * @param[in] vp		to encode.
+ * @return
+ *	- >0 the number of bytes written.
+ *	- 0 if the output buffer was too small.
+ *	- <0 if the attribute can't be encoded.
+ */
+ssize_t detail_binary_encode_pair(uint8_t *out, size_t outlen, VALUE_PAIR const *vp)
+{
+	fr_dict_attr_t const	*da, *path[DETAIL_BINARY_MAX_DEPTH];
+	uint8_t const		*value;
+	value_box_t		net;
+	size_t			value_len, len;
+	uint8_t			*p = out;
+	int			depth = 0, i;
+	uint16_t		net16;
+
+	for (da = vp->da; da && !da->flags.is_root; da = da->parent) {
+		if (depth == DETAIL_BINARY_MAX_DEPTH) {
+			fr_strerror_printf("Attribute \"%s\" is nested too deeply", vp->da->name);
+			return -1;
+		}
+		path[depth++] = da;
+	}
+
+	switch (vp->vp_type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		value = vp->data.datum.octets;
+		value_len = vp->vp_length;
+		break;
+
+	case PW_TYPE_STRUCTURAL:
+	case PW_TYPE_BAD:
+		fr_strerror_printf("Attribute \"%s\" has no value which can be encoded", vp->da->name);
+		return -1;
+
+	default:
+		if (value_box_hton(&net, &vp->data) < 0) return -1;
+		value = (uint8_t const *) &net.datum;
+		value_len = vp->vp_length;
+		if (value_len > sizeof(net.datum)) value_len = sizeof(net.datum);
+		break;
+	}
+
+	if (value_len > UINT16_MAX) {
+		fr_strerror_printf("Value of \"%s\" is too long", vp->da->name);
+		return -1;
+	}
+
+	len = 1 + (depth * 4) + 1 + 1 + 2 + value_len;
+	if (len > outlen) return 0;
+
+	*p++ = depth;
+	for (i = depth - 1; i >= 0; i--) {
+		uint32_t attr = htonl(path[i]->attr);
+
+		memcpy(p, &attr, sizeof(attr));
+		p += sizeof(attr);
+	}
+
+	*p++ = vp->vp_type;
+	*p++ = (uint8_t) vp->tag;
+
+	net16 = htons((uint16_t) value_len);
+	memcpy(p, &net16, sizeof(net16));
+	p += sizeof(net16);
+
+	if (value_len) memcpy(p, value, value_len);
+	p += value_len;
+
+	return p - out;
+}
+
+/** Validate and parse a record header
+ *
+ * @param[out] hdr		Where to write the parsed header fields.
+ * @param[in] data		Start of the record.
+ * @param[in] data_len		Number of bytes available at data.
+ * @return
+ *	- >0 the total length of the record, including the header.
+ *	- 0 if data_len is too short to contain the whole record.
+ *	- -1 if the header is invalid.
+ */
+ssize_t detail_binary_decode_header(detail_binary_hdr_t *hdr, uint8_t const *data, size_t data_len)
+{
+	uint32_t net;
+
+	if (data_len < DETAIL_BINARY_HDR_LEN) return 0;
+
+	if (memcmp(data, DETAIL_BINARY_MAGIC, DETAIL_BINARY_MAGIC_LEN) != 0) {
+		fr_strerror_printf("Invalid magic in record header");
+		return -1;
+	}
+
+	if (data[4] != DETAIL_BINARY_VERSION) {
+		fr_strerror_printf("Unsupported record version %u", data[4]);
+		return -1;
+	}
+
+	hdr->done = (data[DETAIL_BINARY_DONE_OFFSET] != 0);
+
+	memcpy(&net, data + 8, sizeof(net));
+	hdr->data_len = ntohl(net);
+
+	memcpy(&net, data + 12, sizeof(net));
+	hdr->timestamp = ntohl(net);
+
+	if ((DETAIL_BINARY_HDR_LEN + (size_t) hdr->data_len) > data_len) return 0;
+
+	return DETAIL_BINARY_HDR_LEN + hdr->data_len;
+}
+
+/** Decode a single attribute
+ *
+ * Attributes which are no longer in the dictionary are decoded as unknown
+ * attributes of type octets, if their parent still exists.  Otherwise they
+ * are skipped.
+ *
+ * @param[in] ctx		to allocate the new attribute in.
+ * @param[out] out		The decoded attribute.  NULL if it was skipped.
+ * @param[in] data		Start of the encoded attribute.
+ * @param[in] data_len		Number of bytes available at data.
+ * @return
+ *	- >0 the number of bytes consumed.
+ *	- -1 on error.
+ */
+ssize_t detail_binary_decode_pair(TALLOC_CTX *ctx, VALUE_PAIR **out, uint8_t const *data, size_t data_len)
+{
+	uint8_t const		*p = data, *end = data + data_len;
+	fr_dict_attr_t const	*da, *parent;
+	VALUE_PAIR		*vp;
+	PW_TYPE			type;
+	int			depth, i;
+	int8_t			tag;
+	uint32_t		attr = 0;
+	uint16_t		value_len;
+
+	*out = NULL;
+
+	if (p >= end) goto truncated;
+
+	depth = *p++;
+	if ((depth == 0) || (depth > DETAIL_BINARY_MAX_DEPTH)) {
+		fr_strerror_printf("Invalid attribute depth %i", depth);
+		return -1;
+	}
+
+	if ((end - p) < ((depth * 4) + 4)) goto truncated;
+
+	da = parent = fr_dict_root(NULL);
+	for (i = 0; i < depth; i++) {
+		memcpy(&attr, p, sizeof(attr));
+		attr = ntohl(attr);
+		p += sizeof(attr);
+
+		if (!da) continue;	/* Missing intermediary attribute */
+
+		parent = da;
+		da = fr_dict_attr_child_by_num(parent, attr);
+		if (!da && (i < (depth - 1))) parent = NULL;
+	}
+
+	type = *p++;
+	tag = (int8_t) *p++;
+
+	memcpy(&value_len, p, sizeof(value_len));
+	value_len = ntohs(value_len);
+	p += sizeof(value_len);
+
+	if ((end - p) < value_len) goto truncated;
+
+	if (!da) {
+		unsigned int vendor;
+
+		if (!parent) {
+			fr_strerror_printf("Skipping attribute %u with unknown parent", attr);
+			return (p + value_len) - data;
+		}
+
+		vendor = (parent->type == PW_TYPE_VENDOR) ? parent->attr : parent->vendor;
+		da = fr_dict_unknown_afrom_fields(ctx, parent, vendor, attr);
+		if (!da) return -1;
+	}
+
+	vp = fr_pair_afrom_da(ctx, da);
+	if (!vp) return -1;
+
+	/*
+	 *	The dictionary may have changed since the record was
+	 *	written.  Keep the raw value rather than guessing.
+	 */
+	switch (da->type) {
+	case PW_TYPE_COMBO_IP_ADDR:
+		if ((type != PW_TYPE_IPV4_ADDR) && (type != PW_TYPE_IPV6_ADDR)) goto changed;
+		break;
+
+	case PW_TYPE_COMBO_IP_PREFIX:
+		if ((type != PW_TYPE_IPV4_PREFIX) && (type != PW_TYPE_IPV6_PREFIX)) goto changed;
+		break;
+
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		type = da->type;
+		break;
+
+	default:
+		if (type == da->type) break;
+
+	changed:
+		fr_strerror_printf("Type of \"%s\" has changed, skipping it", da->name);
+		talloc_free(vp);
+		return (p + value_len) - data;
+	}
+	vp->vp_type = type;
+
+	switch (type) {
+	case PW_TYPE_STRING:
+		fr_pair_value_bstrncpy(vp, p, value_len);
+		break;
+
+	case PW_TYPE_OCTETS:
+		fr_pair_value_memcpy(vp, p, value_len);
+		break;
+
+	default:
+		if (value_len > sizeof(vp->data.datum)) {
+			fr_strerror_printf("Value of \"%s\" is too long", da->name);
+			talloc_free(vp);
+			return -1;
+		}
+
+		memcpy(&vp->data.datum, p, value_len);
+		vp->vp_length = value_len;
+
+		switch (type) {
+		case PW_TYPE_INTEGER64:
+			vp->vp_integer64 = ntohll(vp->vp_integer64);
+			break;
+
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_DATE:
+		case PW_TYPE_SIGNED:
+			vp->vp_integer = ntohl(vp->vp_integer);
+			break;
+
+		case PW_TYPE_SHORT:
+			vp->vp_short = ntohs(vp->vp_short);
+			break;
+
+		default:
+			break;
+		}
+		break;
+	}
+
+	vp->tag = tag;
+	vp->type = VT_DATA;
+	*out = vp;
+
+	return (p + value_len) - data;
+
+truncated:
+	fr_strerror_printf("Attribute data is truncated");
+	return -1;
+}
+
+/** Decode all attributes in a record
+ *
+ * @param[in] ctx		to allocate attributes in.
+ * @param[out] out		Where to append the decoded attributes.
+ * @param[in] data		Start of the encoded attributes (after the header).
+ * @param[in] data_len		Length of the encoded attributes.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  Any attributes already decoded are left in out.
+ */
+int detail_binary_decode_pairs(TALLOC_CTX *ctx, VALUE_PAIR **out, uint8_t const *data, size_t data_len)
+{
+	uint8_t const	*p = data, *end = data + data_len;
+	vp_cursor_t	cursor;
+
+	fr_pair_cursor_init(&cursor, out);
+	fr_pair_cursor_last(&cursor);
+
+	while (p < end) {
+		VALUE_PAIR	*vp;
+		ssize_t		slen;
+
+		slen = detail_binary_decode_pair(ctx, &vp, p, end - p);
+		if (slen < 0) return -1;
+		p += slen;
+
+		if (vp) fr_pair_cursor_append(&cursor, vp);
+	}
+
+	return 0;
+}
@@ -36,16 +36,41 @@ typedef struct exfile_entry_t {
 	uint32_t		hash;			//!< Hash for cheap comparison.
 	time_t			last_used;		//!< Last time the entry was used.
 	char			*filename;		//!< Filename.
+	mode_t			permissions;		//!< Permissions the file was opened with.
+
+	uint8_t			*buffer;		//!< Records waiting to be written to the file.
+	size_t			buffer_len;		//!< How much of the buffer is in use.
+	struct timeval		buffer_first;		//!< When the oldest record in the buffer was added.
 } exfile_entry_t;
 
+/** A slice of the handle table, with its own mutex
+ *
+ * Filenames are mapped to shards by hash, so threads writing to different
+ * files rarely contend on the same mutex.
+ */
+typedef struct exfile_shard_t {
+	pthread_mutex_t		mutex;
+	exfile_entry_t		*entries;
+	uint32_t		num_entries;		//!< Number of entries in this shard.
+	time_t			last_cleaned;
+} exfile_shard_t;
 
 struct exfile_t {
 	uint32_t		max_entries;		//!< How many file descriptors we keep track of.
 	uint32_t		max_idle;		//!< Maximum idle time for a descriptor.
-	time_t			last_cleaned;
-	pthread_mutex_t		mutex;
-	exfile_entry_t		*entries;
+	exfile_shard_t		*shards;		//!< Handle table, split into separately locked shards.
+	uint32_t		num_shards;		//!< How many shards the handle table is split into.
 	bool			locking;
+
+	pthread_mutex_t		dup_mutex;		//!< Protects dup_shard.
+	uint32_t		*dup_shard;		//!< Shard (plus one) which handed out each descriptor,
+							//!< indexed by descriptor.  0 if not handed out.
+	uint32_t		dup_shard_len;		//!< Number of elements in dup_shard.
+
+	size_t			buffer_size;		//!< Size of the per-file write buffer.  0 disables buffering.
+	struct timeval		flush_interval;		//!< Maximum time a record may sit in a write buffer.
+	bool			sync;			//!< fsync() the file after every write.
+
 	CONF_SECTION		*conf;			//!< Conf section to search for triggers.
 	char const		*trigger_prefix;	//!< Trigger path in the global trigger section.
 	VALUE_PAIR		*trigger_args;		//!< Arguments to pass to trigger.
@@ -54,6 +79,8 @@ struct exfile_t {
 #define MAX_TRY_LOCK 4			//!< How many times we attempt to acquire a lock
 					//!< before giving up.
 
+#define EXFILE_SHARD_ENTRIES 16		//!< Target number of entries in each shard.
+
 /** Send an exfile trigger.
  *
  * @param[in] ef to send trigger for.
@@ -94,9 +121,148 @@ static inline void exfile_trigger_exec(exfile_t *ef, REQUEST *request, exfile_en
 }
 
 
+/** Seek to the start of the file, lock it, and check it's still the one we opened
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[in] entry to lock.
+ * @param[in] append If true seek to the end of the file after locking it.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The caller should cleanup the entry.
+ */
+static int exfile_entry_lock(exfile_t *ef, exfile_entry_t *entry, bool append)
+{
+	int		tries;
+	struct stat	st;
+
+	/*
+	 *	Lock from the start of the file.
+	 */
+	if (lseek(entry->fd, 0, SEEK_SET) < 0) {
+		fr_strerror_printf("Failed to seek in file %s: %s", entry->filename, strerror(errno));
+		return -1;
+	}
+
+	/*
+	 *	Try to lock it.  If we can't lock it, it's because
+	 *	some reader has re-named the file to "foo.work" and
+	 *	locked it.  So, we close the current file, re-open it,
+	 *	and try again/
+	 */
+	if (ef->locking) {
+		for (tries = 0; tries < MAX_TRY_LOCK; tries++) {
+			if (rad_lockfd_nonblock(entry->fd, 0) >= 0) break;
+
+			if (errno != EAGAIN) {
+				fr_strerror_printf("Failed to lock file %s: %s", entry->filename, strerror(errno));
+				return -1;
+			}
+
+			close(entry->fd);
+			entry->fd = open(entry->filename, O_WRONLY | O_CREAT, entry->permissions);
+			if (entry->fd < 0) {
+				fr_strerror_printf("Failed to open file %s: %s",
+						   entry->filename, strerror(errno));
+				return -1;
+			}
+		}
+
+		if (tries >= MAX_TRY_LOCK) {
+			fr_strerror_printf("Failed to lock file %s: too many tries", entry->filename);
+			return -1;
+		}
+	}
+
+	/*
+	 *	Maybe someone deleted the file while we were waiting
+	 *	for the lock.  If so, re-open it.
+	 */
+	if (fstat(entry->fd, &st) < 0) {
+		fr_strerror_printf("Failed to stat file %s: %s", entry->filename, strerror(errno));
+		return -1;
+	}
+
+	if (st.st_nlink == 0) {
+		close(entry->fd);
+		entry->fd = open(entry->filename, O_WRONLY | O_CREAT, entry->permissions);
+		if (entry->fd < 0) {
+			fr_strerror_printf("Failed to open file %s: %s",
+					   entry->filename, strerror(errno));
+			return -1;
+		}
+	}
+
+	/*
+	 *	Seek to the end of the file before returning the FD to
+	 *	the caller.
+	 */
+	if (append) lseek(entry->fd, 0, SEEK_END);
+
+	return 0;
+}
+
+/** Write out any records waiting in an entry's buffer
+ *
+ * Must be called with the mutex of the shard containing the entry held.
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[in] entry to flush.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.  The buffered records are discarded.
+ */
+static int exfile_entry_flush(exfile_t *ef, exfile_entry_t *entry)
+{
+	uint8_t		*p, *end;
+	ssize_t		slen;
+	int		ret = 0;
+
+	if (!entry->buffer_len) return 0;
+
+	if (exfile_entry_lock(ef, entry, true) < 0) {
+		entry->buffer_len = 0;
+		return -1;
+	}
+
+	p = entry->buffer;
+	end = p + entry->buffer_len;
+
+	while (p < end) {
+		slen = write(entry->fd, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+
+			fr_strerror_printf("Failed writing to file %s: %s", entry->filename, strerror(errno));
+			ret = -1;
+			break;
+		}
+		p += slen;
+	}
+
+	if ((ret == 0) && ef->sync && (fsync(entry->fd) < 0)) {
+		fr_strerror_printf("Failed syncing file %s: %s", entry->filename, strerror(errno));
+		ret = -1;
+	}
+
+	if (ef->locking) (void) rad_unlockfd(entry->fd, 0);
+
+	entry->buffer_len = 0;
+
+	return ret;
+}
+
 static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t *entry)
 {
+	/*
+	 *	Don't lose records which haven't been written yet.
+	 */
+	if ((entry->fd >= 0) && (exfile_entry_flush(ef, entry) < 0)) {
+		ROPTIONAL(RERROR, ERROR, "%s", fr_strerror());
+	}
+
 	TALLOC_FREE(entry->filename);
+	TALLOC_FREE(entry->buffer);
+	entry->buffer_len = 0;
 
 	close(entry->fd);
 
@@ -113,23 +279,32 @@ static void exfile_cleanup_entry(exfile_t *ef, REQUEST *request, exfile_entry_t
 
 static int _exfile_free(exfile_t *ef)
 {
-	uint32_t i;
+	uint32_t	i, j;
+
+	for (i = 0; i < ef->num_shards; i++) {
+		exfile_shard_t *shard = &ef->shards[i];
 
-	pthread_mutex_lock(&ef->mutex);
+		pthread_mutex_lock(&shard->mutex);
 
-	for (i = 0; i < ef->max_entries; i++) {
-		if (!ef->entries[i].filename) continue;
+		for (j = 0; j < shard->num_entries; j++) {
+			if (!shard->entries[j].filename) continue;
 
-		exfile_cleanup_entry(ef, NULL, &ef->entries[i]);
+			exfile_cleanup_entry(ef, NULL, &shard->entries[j]);
+		}
+
+		pthread_mutex_unlock(&shard->mutex);
+		pthread_mutex_destroy(&shard->mutex);
 	}
 
-	pthread_mutex_unlock(&ef->mutex);
-	pthread_mutex_destroy(&ef->mutex);
+	pthread_mutex_destroy(&ef->dup_mutex);
 
 	return 0;
 }
 
 /** Initialize a way for multiple threads to log to one or more files.
+ *
+ * The handle table is split into shards of around #EXFILE_SHARD_ENTRIES
+ * entries, each protected by its own mutex.
  *
  * @param ctx The talloc context
  * @param max_entries Max file descriptors to cache, and manage locks for.
@@ -141,25 +316,49 @@ static int _exfile_free(exfile_t *ef)
  */
 exfile_t *exfile_init(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t max_idle, bool locking)
 {
-	exfile_t *ef;
+	exfile_t	*ef;
+	uint32_t	i, per_shard;
+
+	if (!max_entries) max_entries = 1;
 
 	ef = talloc_zero(NULL, exfile_t);
 	if (!ef) return NULL;
 
 	fr_talloc_link_ctx(ctx, ef);
 
-	ef->entries = talloc_zero_array(ef, exfile_entry_t, max_entries);
-	if (!ef->entries) {
+	ef->num_shards = (max_entries + (EXFILE_SHARD_ENTRIES - 1)) / EXFILE_SHARD_ENTRIES;
+	per_shard = (max_entries + (ef->num_shards - 1)) / ef->num_shards;
+
+	ef->shards = talloc_zero_array(ef, exfile_shard_t, ef->num_shards);
+	if (!ef->shards) {
+	error:
 		talloc_free(ef);
 		return NULL;
 	}
 
-	if (pthread_mutex_init(&ef->mutex, NULL) != 0) {
-		talloc_free(ef);
-		return NULL;
+	for (i = 0; i < ef->num_shards; i++) {
+		exfile_shard_t *shard = &ef->shards[i];
+
+		shard->entries = talloc_zero_array(ef->shards, exfile_entry_t, per_shard);
+		if (!shard->entries) goto error;
+		shard->num_entries = per_shard;
+	}
+
+	/*
+	 *	Only initialise the mutexes once all the memory
+	 *	has been allocated, so the destructor never sees
+	 *	an uninitialised one.
+	 */
+	for (i = 0; i < ef->num_shards; i++) {
+		if (pthread_mutex_init(&ef->shards[i].mutex, NULL) != 0) {
+		error_mutex:
+			while (i-- > 0) pthread_mutex_destroy(&ef->shards[i].mutex);
+			goto error;
+		}
 	}
+	if (pthread_mutex_init(&ef->dup_mutex, NULL) != 0) goto error_mutex;
 
-	ef->max_entries = max_entries;
+	ef->max_entries = per_shard * ef->num_shards;
 	ef->max_idle = max_idle;
 	ef->locking = locking;
 
@@ -193,37 +392,57 @@ void exfile_enable_triggers(exfile_t *ef, CONF_SECTION *conf, char const *trigge
 	MEM(ef->trigger_args = fr_pair_list_copy(ef, trigger_args));
 }
 
-
-/** Open a new log file, or maybe an existing one.
+/** Buffer records written with exfile_writev()
  *
- * When multithreaded, the FD is locked via a mutex.  This way we're
- * sure that no other thread is writing to the file.
+ * Records are accumulated in a per-file buffer, and written out when the
+ * buffer fills, when the oldest record has been waiting for longer than
+ * flush_interval, or when exfile_flush() is called.
  *
- * @param ef The logfile context returned from exfile_init().
- * @param request The current request.
- * @param filename the file to open.
- * @param permissions to use.
- * @param append If true seek to the end of the file.
- * @return
- *	- FD used to write to the file.
- *	- -1 on failure.
+ * @param[in] ef		to enable buffering for.
+ * @param[in] buffer_size	Size of the per-file buffer.  0 disables buffering.
+ * @param[in] flush_interval	Maximum time a record may wait in the buffer.
  */
-int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions, bool append)
+void exfile_enable_buffering(exfile_t *ef, size_t buffer_size, struct timeval const *flush_interval)
 {
-	int i, tries, unused = -1, found = -1, oldest = -1;
-	bool do_cleanup = false;
-	uint32_t hash;
-	time_t now = time(NULL);
-	struct stat st;
-
-	if (!ef || !filename) return -1;
+	ef->buffer_size = buffer_size;
+	ef->flush_interval = *flush_interval;
+}
 
-	hash = fr_hash_string(filename);
-	unused = -1;
+/** fsync() files after every record written with exfile_writev()
+ *
+ * This disables write buffering, trading throughput for durability.
+ *
+ * @param[in] ef	to enable syncing for.
+ * @param[in] sync	whether writes should be synced.
+ */
+void exfile_enable_sync(exfile_t *ef, bool sync)
+{
+	ef->sync = sync;
+}
 
-	pthread_mutex_lock(&ef->mutex);
+/** Find the entry for a file, opening the file if it's not already open
+ *
+ * Must be called with the shard mutex held.
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[in] shard the filename hashes to.
+ * @param[in] request The current request.
+ * @param[in] filename the file to open.
+ * @param[in] hash of the filename.
+ * @param[in] permissions to use.
+ * @param[in] now The current time.
+ * @return
+ *	- The entry on success.
+ *	- NULL on failure.
+ */
+static exfile_entry_t *exfile_entry_find(exfile_t *ef, exfile_shard_t *shard, REQUEST *request,
+					 char const *filename, uint32_t hash, mode_t permissions, time_t now)
+{
+	int		i, unused = -1, found = -1, oldest = -1;
+	bool		do_cleanup = false;
+	exfile_entry_t	*entries = shard->entries;
 
-	if (now > (ef->last_cleaned + 1)) do_cleanup = true;
+	if (now > (shard->last_cleaned + 1)) do_cleanup = true;
 
 	/*
 	 *	Find the matching entry, or an unused one.
@@ -231,14 +450,14 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	 *	Also track which entry is the oldest, in case there
 	 *	are no unused entries.
 	 */
-	for (i = 0; i < (int) ef->max_entries; i++) {
-		if (!ef->entries[i].filename) {
+	for (i = 0; i < (int) shard->num_entries; i++) {
+		if (!entries[i].filename) {
 			if (unused < 0) unused = i;
 			continue;
 		}
 
 		if ((oldest < 0) ||
-		    (ef->entries[i].last_used < ef->entries[oldest].last_used)) {
+		    (entries[i].last_used < entries[oldest].last_used)) {
 			oldest = i;
 		}
 
@@ -252,8 +471,8 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		 *	ensure that it happens.
 		 */
 		if ((found < 0) &&
-		    (ef->entries[i].hash == hash) &&
-		    (strcmp(ef->entries[i].filename, filename) == 0)) {
+		    (entries[i].hash == hash) &&
+		    (strcmp(entries[i].filename, filename) == 0)) {
 			found = i;
 
 			/*
@@ -267,27 +486,26 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 			 *	do so now.
 			 */
 		} else if (do_cleanup) {
-			if ((ef->entries[i].last_used + ef->max_idle) >= now) continue;
+			if ((entries[i].last_used + ef->max_idle) >= now) continue;
 
-			exfile_cleanup_entry(ef, request, &ef->entries[i]);
+			exfile_cleanup_entry(ef, request, &entries[i]);
+			if (unused < 0) unused = i;
+			if (oldest == i) oldest = -1;
 		}
 	}
 
-	if (do_cleanup) ef->last_cleaned = now;
+	if (do_cleanup) shard->last_cleaned = now;
 
 	/*
 	 *	We found an existing entry, return that
 	 */
-	if (found >= 0) {
-		i = found;
-		goto do_return;
-	}
+	if (found >= 0) return &entries[found];
 
 	/*
 	 *	There are no unused entries, free the oldest one.
 	 */
 	if (unused < 0) {
-		exfile_cleanup_entry(ef, request, &ef->entries[oldest]);
+		exfile_cleanup_entry(ef, request, &entries[oldest]);
 		unused = oldest;
 	}
 
@@ -296,13 +514,15 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 	 */
 	i = unused;
 
-	ef->entries[i].hash = hash;
-	ef->entries[i].filename = talloc_strdup(ef->entries, filename);
-	ef->entries[i].fd = -1;
-	ef->entries[i].dup = -1;
+	entries[i].hash = hash;
+	entries[i].filename = talloc_strdup(entries, filename);
+	entries[i].permissions = permissions;
+	entries[i].last_used = now;
+	entries[i].fd = -1;
+	entries[i].dup = -1;
 
-	ef->entries[i].fd = open(filename, O_RDWR | O_APPEND | O_CREAT, permissions);
-	if (ef->entries[i].fd < 0) {
+	entries[i].fd = open(filename, O_RDWR | O_APPEND | O_CREAT, permissions);
+	if (entries[i].fd < 0) {
 		mode_t dirperm;
 		char *p, *dir;
 
@@ -315,6 +535,7 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		p = strrchr(dir, FR_DIR_SEP);
 		if (!p) {
 			fr_strerror_printf("No '/' in '%s'", filename);
+			talloc_free(dir);
 			goto error;
 		}
 		*p = '\0';
@@ -336,100 +557,174 @@ int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t per
 		}
 		talloc_free(dir);
 
-		ef->entries[i].fd = open(filename, O_WRONLY | O_CREAT, permissions);
-		if (ef->entries[i].fd < 0) {
+		entries[i].fd = open(filename, O_WRONLY | O_CREAT, permissions);
+		if (entries[i].fd < 0) {
 			fr_strerror_printf("Failed to open file %s: %s",
 					   filename, strerror(errno));
 			goto error;
 		} /* else fall through to creating the rest of the entry */
 
-		exfile_trigger_exec(ef, request, &ef->entries[i], "create");
+		exfile_trigger_exec(ef, request, &entries[i], "create");
 	} /* else the file was already opened */
 
-	exfile_trigger_exec(ef, request, &ef->entries[i], "open");
+	exfile_trigger_exec(ef, request, &entries[i], "open");
 
-do_return:
-	/*
-	 *	Lock from the start of the file.
-	 */
-	if (lseek(ef->entries[i].fd, 0, SEEK_SET) < 0) {
-		fr_strerror_printf("Failed to seek in file %s: %s", filename, strerror(errno));
+	return &entries[i];
 
-	error:
-		exfile_cleanup_entry(ef, request, &ef->entries[i]);
+error:
+	exfile_cleanup_entry(ef, request, &entries[i]);
+	return NULL;
+}
 
-		pthread_mutex_unlock(&(ef->mutex));
-		return -1;
-	}
+/** Record which shard handed out a file descriptor
+ *
+ * Called with the shard mutex held.  The shard mutex is always taken
+ * before dup_mutex, never the other way round.
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[in] shard the descriptor was handed out by.
+ * @param[in] fd returned by dup().
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int exfile_dup_add(exfile_t *ef, exfile_shard_t *shard, int fd)
+{
+	pthread_mutex_lock(&ef->dup_mutex);
 
-	/*
-	 *	Try to lock it.  If we can't lock it, it's because
-	 *	some reader has re-named the file to "foo.work" and
-	 *	locked it.  So, we close the current file, re-open it,
-	 *	and try again/
-	 */
-	if (ef->locking) {
-		for (tries = 0; tries < MAX_TRY_LOCK; tries++) {
-			if (rad_lockfd_nonblock(ef->entries[i].fd, 0) >= 0) break;
+	if ((uint32_t)fd >= ef->dup_shard_len) {
+		uint32_t	len = ef->dup_shard_len ? ef->dup_shard_len : 64;
+		uint32_t	*dup_shard;
 
-			if (errno != EAGAIN) {
-				fr_strerror_printf("Failed to lock file %s: %s", filename, strerror(errno));
-				goto error;
-			}
+		while (len <= (uint32_t)fd) len *= 2;
 
-			close(ef->entries[i].fd);
-			ef->entries[i].fd = open(filename, O_WRONLY | O_CREAT, permissions);
-			if (ef->entries[i].fd < 0) {
-				fr_strerror_printf("Failed to open file %s: %s",
-						   filename, strerror(errno));
-				goto error;
-			}
+		dup_shard = talloc_realloc(ef, ef->dup_shard, uint32_t, len);
+		if (!dup_shard) {
+			pthread_mutex_unlock(&ef->dup_mutex);
+			fr_strerror_printf("Out of memory");
+			return -1;
 		}
+		memset(dup_shard + ef->dup_shard_len, 0, (len - ef->dup_shard_len) * sizeof(*dup_shard));
 
-		if (tries >= MAX_TRY_LOCK) {
-			fr_strerror_printf("Failed to lock file %s: too many tries", filename);
-			goto error;
-		}
+		ef->dup_shard = dup_shard;
+		ef->dup_shard_len = len;
 	}
 
-	/*
-	 *	Maybe someone deleted the file while we were waiting
-	 *	for the lock.  If so, re-open it.
-	 */
-	if (fstat(ef->entries[i].fd, &st) < 0) {
-		fr_strerror_printf("Failed to stat file %s: %s", filename, strerror(errno));
-		goto error;
-	}
+	ef->dup_shard[fd] = (shard - ef->shards) + 1;
 
-	if (st.st_nlink == 0) {
-		close(ef->entries[i].fd);
-		ef->entries[i].fd = open(filename, O_WRONLY | O_CREAT, permissions);
-		if (ef->entries[i].fd < 0) {
-			fr_strerror_printf("Failed to open file %s: %s",
-					   filename, strerror(errno));
-			goto error;
-		}
+	pthread_mutex_unlock(&ef->dup_mutex);
+
+	return 0;
+}
+
+/** Open a new log file, or maybe an existing one.
+ *
+ * When multithreaded, the FD is locked via a mutex.  This way we're
+ * sure that no other thread is writing to the file.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param request The current request.
+ * @param filename the file to open.
+ * @param permissions to use.
+ * @param append If true seek to the end of the file.
+ * @return
+ *	- FD used to write to the file.
+ *	- -1 on failure.
+ */
+int exfile_open(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions, bool append)
+{
+	uint32_t	hash;
+	time_t		now = time(NULL);
+	exfile_shard_t	*shard;
+	exfile_entry_t	*entry;
+
+	if (!ef || !filename) return -1;
+
+	hash = fr_hash_string(filename);
+	shard = &ef->shards[hash % ef->num_shards];
+
+	pthread_mutex_lock(&shard->mutex);
+
+	entry = exfile_entry_find(ef, shard, request, filename, hash, permissions, now);
+	if (!entry) {
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
 	}
 
 	/*
-	 *	Seek to the end of the file before returning the FD to
-	 *	the caller.
+	 *	Anything written by the caller must come after
+	 *	the records we've already accepted.
 	 */
-	if (append) lseek(ef->entries[i].fd, 0, SEEK_END);
+	if (exfile_entry_flush(ef, entry) < 0) goto error;
+
+	if (exfile_entry_lock(ef, entry, append) < 0) {
+	error:
+		exfile_cleanup_entry(ef, request, entry);
+
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
+	}
 
 	/*
 	 *	Return holding the mutex for the entry.
 	 */
-	ef->entries[i].last_used = now;
-	ef->entries[i].dup = dup(ef->entries[i].fd);
-	if (ef->entries[i].dup < 0) {
+	entry->last_used = now;
+	entry->dup = dup(entry->fd);
+	if (entry->dup < 0) {
 		fr_strerror_printf("Failed calling dup(): %s", strerror(errno));
 		goto error;
 	}
 
-	exfile_trigger_exec(ef, request, &ef->entries[i], "reserve");
+	if (exfile_dup_add(ef, shard, entry->dup) < 0) {
+		close(entry->dup);
+		entry->dup = -1;
+		goto error;
+	}
+
+	exfile_trigger_exec(ef, request, entry, "reserve");
+
+	return entry->dup;
+}
+
+/** Find the entry which handed out a file descriptor, and forget the descriptor
+ *
+ * The shard is looked up in the descriptor map, so only the shard whose
+ * mutex the caller already holds is scanned.
+ *
+ * @param[in] ef The logfile context returned from exfile_init().
+ * @param[out] shard_out Where to write the shard containing the entry.
+ * @param[in] fd returned by exfile_open().
+ * @return
+ *	- The entry.
+ *	- NULL if the fd isn't tracked.
+ */
+static exfile_entry_t *exfile_entry_by_dup(exfile_t *ef, exfile_shard_t **shard_out, int fd)
+{
+	uint32_t	i, num = 0;
+	exfile_shard_t	*shard;
+
+	if (fd < 0) return NULL;
+
+	pthread_mutex_lock(&ef->dup_mutex);
+	if ((uint32_t)fd < ef->dup_shard_len) {
+		num = ef->dup_shard[fd];
+		ef->dup_shard[fd] = 0;
+	}
+	pthread_mutex_unlock(&ef->dup_mutex);
+
+	if (!num) return NULL;
+
+	shard = &ef->shards[num - 1];
+	for (i = 0; i < shard->num_entries; i++) {
+		if (!shard->entries[i].filename) continue;
+
+		if (shard->entries[i].dup == fd) {
+			*shard_out = shard;
+			return &shard->entries[i];
+		}
+	}
 
-	return ef->entries[i].dup;
+	return NULL;
 }
 
 /** Close the log file.  Really just return it to the pool.
@@ -447,56 +742,246 @@ do_return:
  */
 int exfile_close(exfile_t *ef, REQUEST *request, int fd)
 {
-	uint32_t i;
+	exfile_shard_t	*shard;
+	exfile_entry_t	*entry;
+
+	entry = exfile_entry_by_dup(ef, &shard, fd);
+	if (!entry) {
+		fr_strerror_printf("Attempt to unlock file which is not tracked");
+		return -1;
+	}
+
+	/*
+	 *	Forget the descriptor before closing it, so the
+	 *	number can't be matched if it's immediately re-used.
+	 */
+	entry->dup = -1;
 
-	for (i = 0; i < ef->max_entries; i++) {
-		if (!ef->entries[i].filename) continue;
+	/*
+	 *	Unlock the bytes that we had previously locked.
+	 */
+	if (ef->locking) (void) rad_unlockfd(fd, 0);
+	close(fd); /* releases the fcntl lock */
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	exfile_trigger_exec(ef, request, entry, "release");
+
+	return 0;
+}
+
+/** Unlock the file, but leave the dup'd file descriptor open
+ *
+ */
+int exfile_unlock(exfile_t *ef, REQUEST *request, int fd)
+{
+	exfile_shard_t	*shard;
+	exfile_entry_t	*entry;
+
+	entry = exfile_entry_by_dup(ef, &shard, fd);
+	if (!entry) {
+		fr_strerror_printf("Attempt to unlock file which does not exist");
+		return -1;
+	}
+
+	entry->dup = -1;
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	exfile_trigger_exec(ef, request, entry, "release");
+
+	return 0;
+}
+
+/** Write a record to a file, buffering it if buffering is enabled
+ *
+ * The record is either appended to the file's write buffer (see
+ * exfile_enable_buffering()), or written straight to the file under the
+ * same locking rules as exfile_open().  A record is always written in
+ * full, and is never interleaved with another record.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param request The current request.
+ * @param filename the file to write to.
+ * @param permissions to use if the file has to be created.
+ * @param vector of data to write.
+ * @param iovcnt Number of elements in vector.
+ * @return
+ *	- The number of bytes written or buffered.
+ *	- -1 on failure.
+ */
+ssize_t exfile_writev(exfile_t *ef, REQUEST *request, char const *filename, mode_t permissions,
+		      struct iovec const *vector, int iovcnt)
+{
+	uint32_t	hash;
+	int		i;
+	size_t		len = 0, off;
+	ssize_t		slen;
+	struct timeval	now, due;
+	exfile_shard_t	*shard;
+	exfile_entry_t	*entry;
+
+	if (!ef || !filename) return -1;
+
+	for (i = 0; i < iovcnt; i++) len += vector[i].iov_len;
+
+	gettimeofday(&now, NULL);
+
+	hash = fr_hash_string(filename);
+	shard = &ef->shards[hash % ef->num_shards];
+
+	pthread_mutex_lock(&shard->mutex);
+
+	entry = exfile_entry_find(ef, shard, request, filename, hash, permissions, now.tv_sec);
+	if (!entry) {
+		pthread_mutex_unlock(&shard->mutex);
+		return -1;
+	}
+	entry->last_used = now.tv_sec;
+
+	/*
+	 *	Write through if we're not buffering, or the record
+	 *	would never fit in the buffer.
+	 */
+	if (!ef->buffer_size || ef->sync || (len > ef->buffer_size)) {
+		if (exfile_entry_flush(ef, entry) < 0) goto error;
+
+		if (exfile_entry_lock(ef, entry, true) < 0) {
+		error:
+			exfile_cleanup_entry(ef, request, entry);
+			pthread_mutex_unlock(&shard->mutex);
+			return -1;
+		}
 
 		/*
-		 *	Unlock the bytes that we had previously locked.
+		 *	Keep going after short writes, so the record
+		 *	isn't split by another writer.  off is how much
+		 *	of vector[i] has already been written.
 		 */
-		if (ef->entries[i].dup == fd) {
-			if (ef->locking) (void) rad_unlockfd(ef->entries[i].dup, 0);
-			close(ef->entries[i].dup); /* releases the fcntl lock */
-			ef->entries[i].dup = -1;
+		slen = 0;
+		i = 0;
+		off = 0;
+		while (i < iovcnt) {
+			ssize_t wlen;
+
+			if (off) {
+				wlen = write(entry->fd, (uint8_t const *) vector[i].iov_base + off, vector[i].iov_len - off);
+			} else {
+				wlen = writev(entry->fd, vector + i, iovcnt - i);
+			}
+			if (wlen < 0) {
+				if (errno == EINTR) continue;
+
+				fr_strerror_printf("Failed writing to file %s: %s", filename, strerror(errno));
+				slen = -1;
+				break;
+			}
+			slen += wlen;
+
+			off += wlen;
+			while ((i < iovcnt) && (off >= vector[i].iov_len)) {
+				off -= vector[i].iov_len;
+				i++;
+			}
+		}
 
-			pthread_mutex_unlock(&(ef->mutex));
+		if ((slen >= 0) && ef->sync && (fsync(entry->fd) < 0)) {
+			fr_strerror_printf("Failed syncing file %s: %s", filename, strerror(errno));
+			slen = -1;
+		}
+
+		if (ef->locking) (void) rad_unlockfd(entry->fd, 0);
+
+		pthread_mutex_unlock(&shard->mutex);
+
+		return slen;
+	}
 
-			exfile_trigger_exec(ef, request, &ef->entries[i], "release");
+	/*
+	 *	Make room for the new record.
+	 */
+	if ((entry->buffer_len + len) > ef->buffer_size) {
+		if (exfile_entry_flush(ef, entry) < 0) goto error;
+	}
 
-			return 0;
+	if (!entry->buffer) {
+		entry->buffer = talloc_array(shard->entries, uint8_t, ef->buffer_size);
+		if (!entry->buffer) {
+			fr_strerror_printf("Out of memory");
+			pthread_mutex_unlock(&shard->mutex);
+			return -1;
 		}
 	}
 
-	pthread_mutex_unlock(&(ef->mutex));
+	if (!entry->buffer_len) entry->buffer_first = now;
+
+	for (i = 0; i < iovcnt; i++) {
+		memcpy(entry->buffer + entry->buffer_len, vector[i].iov_base, vector[i].iov_len);
+		entry->buffer_len += vector[i].iov_len;
+	}
 
-	fr_strerror_printf("Attempt to unlock file which is not tracked");
-	return -1;
+	/*
+	 *	The oldest record has waited long enough.
+	 */
+	fr_timeval_add(&due, &entry->buffer_first, &ef->flush_interval);
+	if ((fr_timeval_cmp(&now, &due) >= 0) && (exfile_entry_flush(ef, entry) < 0)) goto error;
+
+	pthread_mutex_unlock(&shard->mutex);
+
+	return len;
 }
 
-/** Unlock the file, but leave the dup'd file descriptor open
+/** Write out buffered records
  *
+ * Intended to be called periodically, so that records don't sit in a
+ * buffer indefinitely when a file stops receiving writes.
+ *
+ * @param ef The logfile context returned from exfile_init().
+ * @param request The current request.  May be NULL.
+ * @param force If true, flush all buffers, and wait for busy shards.
+ *	Otherwise only flush buffers older than the flush interval, and
+ *	skip shards which are in use (their next writer will flush them).
+ * @return
+ *	- 0 on success.
+ *	- -1 if one or more buffers could not be written.
  */
-int exfile_unlock(exfile_t *ef, REQUEST *request, int fd)
+int exfile_flush(exfile_t *ef, REQUEST *request, bool force)
 {
-	uint32_t i;
+	uint32_t	i, j;
+	int		ret = 0;
+	struct timeval	now, due;
 
-	for (i = 0; i < ef->max_entries; i++) {
-		if (!ef->entries[i].filename) continue;
+	if (!ef->buffer_size) return 0;
 
-		if (ef->entries[i].dup == fd) {
-			ef->entries[i].dup = -1;
+	gettimeofday(&now, NULL);
 
-			pthread_mutex_unlock(&(ef->mutex));
+	for (i = 0; i < ef->num_shards; i++) {
+		exfile_shard_t *shard = &ef->shards[i];
 
-			exfile_trigger_exec(ef, request, &ef->entries[i], "release");
+		if (force) {
+			pthread_mutex_lock(&shard->mutex);
+		} else if (pthread_mutex_trylock(&shard->mutex) != 0) {
+			continue;
+		}
+
+		for (j = 0; j < shard->num_entries; j++) {
+			exfile_entry_t *entry = &shard->entries[j];
 
-			return 0;
+			if (!entry->filename || !entry->buffer_len) continue;
+
+			if (!force) {
+				fr_timeval_add(&due, &entry->buffer_first, &ef->flush_interval);
+				if (fr_timeval_cmp(&now, &due) < 0) continue;
+			}
+
+			if (exfile_entry_flush(ef, entry) < 0) {
+				ROPTIONAL(RERROR, ERROR, "%s", fr_strerror());
+				ret = -1;
+			}
 		}
-	}
 
-	pthread_mutex_unlock(&(ef->mutex));
+		pthread_mutex_unlock(&shard->mutex);
+	}
 
-	fr_strerror_printf("Attempt to unlock file which does not exist");
-	return -1;
+	return ret;
 }
@@ -7,6 +7,7 @@ SOURCES	:=	cond_eval.c \
 		connection.c \
 		dl.c \
 		exec.c \
+		detail.c \
 		exfile.c \
 		log.c \
 		map_proc.c \
@@ -1003,7 +1003,15 @@ static int dual_tcp_accept(rad_listen_t *listener)
 #  endif
 	{
 
-		this->recv = dual_tcp_recv;
+		/*
+		 *	Protocols which only do TCP read their
+		 *	own connections.
+		 */
+		if (this->proto->transports == TRANSPORT_TCP) {
+			this->recv = this->proto->recv;
+		} else {
+			this->recv = dual_tcp_recv;
+		}
 
 #  ifdef WITH_TLS
 		if (this->tls) {
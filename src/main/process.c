@@ -2203,9 +2203,9 @@ static int insert_into_proxy_hash(REQUEST *request)
 
 			/*
 			 *	This is bad.  However, the
-			 *	packet list now supports 256
-			 *	open sockets, which should
-			 *	minimize this problem.
+			 *	packet list has no limit on
+			 *	the number of open sockets,
+			 *	so it shouldn't happen.
 			 */
 			ERROR("Failed adding proxy socket: %s",
 			      fr_strerror());
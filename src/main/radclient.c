@@ -89,13 +89,17 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "  -F                     Print the file name, packet number and reply code.\n");
 	fprintf(stderr, "  -h                     Print usage help information.\n");
 	fprintf(stderr, "  -i <id>                Set request id to 'id'.  Values may be 0..255\n");
+	fprintf(stderr, "  -l <seconds>           How long to generate load for (default 10).\n");
+	fprintf(stderr, "  -L <num>               Generate load, sending 'num' requests/s regardless of replies.\n");
 	fprintf(stderr, "  -n <num>               Send N requests/s\n");
+	fprintf(stderr, "  -N <num>               Number of sockets per thread when generating load (default 1).\n");
 	fprintf(stderr, "  -p <num>               Send 'num' packets from a file in parallel.\n");
 	fprintf(stderr, "  -q                     Do not print anything out.\n");
 	fprintf(stderr, "  -r <retries>           If timeout, retry sending the packet 'retries' times.\n");
 	fprintf(stderr, "  -s                     Print out summary information of auth results.\n");
 	fprintf(stderr, "  -S <file>              read secret from file, not command line.\n");
 	fprintf(stderr, "  -t <timeout>           Wait 'timeout' seconds before retrying (may be a floating point number).\n");
+	fprintf(stderr, "  -T <num>               Number of threads when generating load (default 1).\n");
 	fprintf(stderr, "  -v                     Show program version information.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -137,7 +141,7 @@ static int _rc_request_free(rc_request_t *request)
 }
 
 static int mschapv1_encode(RADIUS_PACKET *packet, VALUE_PAIR **request,
-			   char const *password)
+			   char const *password, fr_randctx *randctx)
 {
 	unsigned int		i;
 	uint8_t			*p;
@@ -156,7 +160,7 @@ static int mschapv1_encode(RADIUS_PACKET *packet, VALUE_PAIR **request,
 	challenge->vp_length = 8;
 	challenge->vp_octets = p = talloc_array(challenge, uint8_t, challenge->vp_length);
 	for (i = 0; i < challenge->vp_length; i++) {
-		p[i] = fr_rand();
+		p[i] = randctx ? fr_rand_from_ctx(randctx) : fr_rand();
 	}
 
 	reply = fr_pair_afrom_num(packet, VENDORPEC_MICROSOFT, PW_MSCHAP_RESPONSE);
@@ -180,6 +184,38 @@ static int mschapv1_encode(RADIUS_PACKET *packet, VALUE_PAIR **request,
 }
 
 
+/** Update the password attribute in a request, from the cleartext password
+ *
+ * Must be called after the packet's authentication vector is set, as
+ * the CHAP-Password depends on it.
+ *
+ * @param[in] packet	to update.
+ * @param[in] password	Cleartext-Password to use.
+ * @param[in] randctx	Pool to take the CHAP ID or MS-CHAP challenge from,
+ *			or NULL to use fr_rand().
+ */
+void rc_password_encode(RADIUS_PACKET *packet, VALUE_PAIR *password, fr_randctx *randctx)
+{
+	VALUE_PAIR *vp;
+
+	if ((vp = fr_pair_find_by_num(packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
+		fr_pair_value_strcpy(vp, password->vp_strvalue);
+
+	} else if ((vp = fr_pair_find_by_num(packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
+		uint8_t buffer[17];
+
+		fr_radius_encode_chap_password(buffer, packet,
+					       (randctx ? fr_rand_from_ctx(randctx) : fr_rand()) & 0xff, password);
+		fr_pair_value_memcpy(vp, buffer, 17);
+
+	} else if (fr_pair_find_by_num(packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
+		mschapv1_encode(packet, &packet->vps, password->vp_strvalue, randctx);
+
+	} else {
+		DEBUG("WARNING: No password in the request");
+	}
+}
+
 static int getport(char const *name)
 {
 	struct servent *svp;
@@ -874,25 +910,7 @@ static int send_one_packet(rc_request_t *request)
 		 *	Update the password, so it can be encrypted with the
 		 *	new authentication vector.
 		 */
-		if (request->password) {
-			VALUE_PAIR *vp;
-
-			if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY)) != NULL) {
-				fr_pair_value_strcpy(vp, request->password->vp_strvalue);
-
-			} else if ((vp = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD, TAG_ANY)) != NULL) {
-				uint8_t buffer[17];
-
-				fr_radius_encode_chap_password(buffer, request->packet, fr_rand() & 0xff, request->password);
-				fr_pair_value_memcpy(vp, buffer, 17);
-
-			} else if (fr_pair_find_by_num(request->packet->vps, 0, PW_MS_CHAP_PASSWORD, TAG_ANY) != NULL) {
-				mschapv1_encode(request->packet, &request->packet->vps, request->password->vp_strvalue);
-
-			} else {
-				DEBUG("WARNING: No password in the request");
-			}
-		}
+		if (request->password) rc_password_encode(request->packet, request->password, NULL);
 
 		request->timestamp = time(NULL);
 		request->tries = 1;
@@ -979,31 +997,27 @@ static int send_one_packet(rc_request_t *request)
  */
 static int recv_one_packet(int wait_time)
 {
-	fd_set		set;
 	struct timeval  tv;
 	rc_request_t	*request;
 	RADIUS_PACKET	*reply, **packet_p;
-	volatile int max_fd;
+	int		rcode;
 
 	/* And wait for reply, timing out as necessary */
-	FD_ZERO(&set);
-
-	max_fd = fr_packet_list_fd_set(pl, &set);
-	if (max_fd < 0) exit(1); /* no sockets to listen on! */
-
 	tv.tv_sec = (wait_time <= 0) ? 0 : wait_time;
 	tv.tv_usec = 0;
 
 	/*
-	 *	No packet was received.
+	 *	Look for the packet.  Unlike select(), this works with
+	 *	any number of sockets.
 	 */
-	if (select(max_fd, &set, NULL, NULL, &tv) <= 0) return 0;
+	rcode = fr_packet_list_poll(pl, &reply, &tv);
 
 	/*
-	 *	Look for the packet.
+	 *	No packet was received.
 	 */
-	reply = fr_packet_list_recv(pl, &set);
-	if (!reply) {
+	if (rcode == 0) return 0;
+
+	if (rcode < 0) {
 		ERROR("Received bad packet");
 #ifdef WITH_TCP
 		/*
@@ -1155,6 +1169,12 @@ int main(int argc, char **argv)
 	rc_request_t	*this;
 	int		force_af = AF_UNSPEC;
 	fr_dict_t	*dict = NULL;
+	rc_load_config_t load;
+
+	memset(&load, 0, sizeof(load));
+	load.duration = 10;
+	load.threads = 1;
+	load.sockets = 1;
 
 	/*
 	 *	It's easier having two sets of flags to set the
@@ -1180,7 +1200,7 @@ int main(int argc, char **argv)
 		exit(1);
 	}
 
-	while ((c = getopt(argc, argv, "46c:d:D:f:Fhi:n:p:qr:sS:t:vx"
+	while ((c = getopt(argc, argv, "46c:d:D:f:Fhi:l:L:n:N:p:qr:sS:t:T:vx"
 #ifdef WITH_TCP
 		"P:"
 #endif
@@ -1241,11 +1261,28 @@ int main(int argc, char **argv)
 			}
 			break;
 
+		case 'l':
+			if (!isdigit((int) *optarg)) usage();
+			load.duration = atoi(optarg);
+			if (load.duration == 0) usage();
+			break;
+
+		case 'L':
+			if (!isdigit((int) *optarg)) usage();
+			load.rate = atoi(optarg);
+			if (load.rate == 0) usage();
+			break;
+
 		case 'n':
 			persec = atoi(optarg);
 			if (persec <= 0) usage();
 			break;
 
+		case 'N':
+			load.sockets = atoi(optarg);
+			if (load.sockets <= 0) usage();
+			break;
+
 			/*
 			 *	Note that sending MANY requests in
 			 *	parallel can over-run the kernel
@@ -1325,6 +1362,11 @@ int main(int argc, char **argv)
 			timeout = atof(optarg);
 			break;
 
+		case 'T':
+			load.threads = atoi(optarg);
+			if (load.threads <= 0) usage();
+			break;
+
 		case 'v':
 			fr_debug_lvl = 1;
 			DEBUG("%s", radclient_version);
@@ -1475,6 +1517,31 @@ int main(int argc, char **argv)
 		}
 	}
 
+	/*
+	 *	Send packets at a fixed rate, using the requests we
+	 *	read as templates, instead of sending each one.
+	 */
+	if (load.rate) {
+		int rcode;
+
+#ifdef WITH_TCP
+		if (proto) {
+			ERROR("Load generation only supports UDP");
+			exit(1);
+		}
+#endif
+		load.retries = retries;
+		load.timeout = timeout;
+		load.secret = secret;
+		load.client_ipaddr = client_ipaddr;
+		load.templates = request_head;
+
+		rcode = rc_load_run(&load);
+		if (rcode < 0) ERROR("Load generation failed");
+
+		exit(rcode == 0 ? 0 : 1);
+	}
+
 	/*
 	 *	Walk over the packets to send, until
 	 *	we're all done.
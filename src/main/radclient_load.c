@@ -0,0 +1,694 @@
+/*
+ * radclient_load.c	Load generation mode for radclient.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	Packets are sent at a fixed rate, whether or not the server
+ *	keeps up.  A slow server shows up as higher latency, and more
+ *	retransmits and timeouts, not as a lower send rate.
+ *
+ *	Latency is measured from when a packet was due to be sent,
+ *	not from when it was sent.  That way any delay in radclient
+ *	itself is counted, rather than hidden.
+ *
+ *	Each thread has its own sockets, packet list, and statistics,
+ *	so the threads don't contend with each other.  The statistics
+ *	are merged once all of the threads are done.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radclient.h>
+
+#include <pthread.h>
+
+#define NSEC (1000000000)
+
+/*
+ *	Maximum number of packets a thread sends in one go, when it's
+ *	fallen behind, before it checks for replies.
+ */
+#define LOAD_BURST (64)
+
+/*
+ *	Latency histogram.  Values are bucketed by their most
+ *	significant bits, as with HdrHistogram.  The error is less
+ *	than 1% for any value, and the histogram is a fixed size.
+ */
+#define HIST_SUB_BITS	(7)
+#define HIST_SUB_HALF	(1 << (HIST_SUB_BITS - 1))
+#define HIST_SIZE	((64 - HIST_SUB_BITS + 2) * HIST_SUB_HALF)
+
+typedef struct rc_histogram {
+	uint64_t		count;
+	uint64_t		min;
+	uint64_t		max;
+	uint64_t		counts[HIST_SIZE];
+} rc_histogram_t;
+
+typedef struct rc_load_stats {
+	uint64_t		sent;		//!< Packets sent, not including retransmits.
+	uint64_t		retransmits;	//!< Packets sent again, because there was no reply.
+	uint64_t		received;	//!< Valid replies.
+	uint64_t		accepted;	//!< Replies which were Access-Accept, Accounting-Response etc.
+	uint64_t		rejected;	//!< Replies which were Access-Reject, CoA-NAK etc.
+	uint64_t		timeouts;	//!< Packets which were never answered.
+	uint64_t		no_id;		//!< Packets not sent, because all IDs were in use.
+	uint64_t		bad;		//!< Replies which were malformed, or didn't match a packet.
+	uint64_t		errors;		//!< Packets which couldn't be sent.
+} rc_load_stats_t;
+
+typedef struct rc_load_packet rc_load_packet_t;
+
+struct rc_load_packet {
+	RADIUS_PACKET		*packet;
+	uint64_t		due;		//!< When the packet should have been sent.
+	uint64_t		deadline;	//!< When to retransmit, or give up.
+	int			tries;
+
+	rc_load_packet_t	*prev;
+	rc_load_packet_t	*next;
+};
+
+typedef struct rc_load_thread {
+	int			id;
+	pthread_t		pthread;
+	rc_load_config_t const	*config;
+	TALLOC_CTX		*ctx;
+
+	fr_packet_list_t	*pl;
+	int			*fds;		//!< Sockets in the packet list.
+	int			num_fds;
+
+	rc_load_packet_t	*free;		//!< Packets which aren't in use.
+	rc_load_packet_t	*head;		//!< Outstanding packets, in deadline order.
+	rc_load_packet_t	*tail;
+
+	rc_request_t		*request;	//!< Next request to base a packet on.
+	uint64_t		seq;		//!< Number of packets built by this thread.
+	fr_randctx		rand;		//!< IDs, vectors, and CHAP challenges for this thread.
+
+	uint64_t		start;		//!< When all threads start sending.
+
+	rc_load_stats_t		stats;
+	rc_histogram_t		latency;
+} rc_load_thread_t;
+
+static uint64_t now_nsec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * NSEC) + ts.tv_nsec;
+}
+
+static inline int hist_index(uint64_t value)
+{
+	int shift;
+
+	if (value < (1 << HIST_SUB_BITS)) return value;
+
+	shift = (63 - __builtin_clzll(value)) - (HIST_SUB_BITS - 1);
+
+	return (shift << (HIST_SUB_BITS - 1)) + (int) (value >> shift);
+}
+
+/*
+ *	The highest value which maps to this index.
+ */
+static uint64_t hist_value(int index)
+{
+	int shift;
+
+	if (index < (1 << HIST_SUB_BITS)) return index;
+
+	shift = (index >> (HIST_SUB_BITS - 1)) - 1;
+
+	return (((uint64_t) (index - (shift << (HIST_SUB_BITS - 1))) + 1) << shift) - 1;
+}
+
+static void hist_add(rc_histogram_t *hist, uint64_t value)
+{
+	if (!hist->count || (value < hist->min)) hist->min = value;
+	if (value > hist->max) hist->max = value;
+
+	hist->counts[hist_index(value)]++;
+	hist->count++;
+}
+
+static void hist_merge(rc_histogram_t *out, rc_histogram_t const *in)
+{
+	int i;
+
+	if (!in->count) return;
+
+	if (!out->count || (in->min < out->min)) out->min = in->min;
+	if (in->max > out->max) out->max = in->max;
+
+	for (i = 0; i < HIST_SIZE; i++) out->counts[i] += in->counts[i];
+	out->count += in->count;
+}
+
+static uint64_t hist_percentile(rc_histogram_t const *hist, double percentile)
+{
+	uint64_t	target, total = 0;
+	int		i;
+
+	if (!hist->count) return 0;
+
+	target = (uint64_t) ((hist->count * percentile) / 100.0);
+	if (target < 1) target = 1;
+
+	for (i = 0; i < HIST_SIZE; i++) {
+		total += hist->counts[i];
+		if (total >= target) {
+			uint64_t value = hist_value(i);
+
+			return (value > hist->max) ? hist->max : value;
+		}
+	}
+
+	return hist->max;
+}
+
+static void load_append(rc_load_thread_t *t, rc_load_packet_t *lp)
+{
+	lp->next = NULL;
+	lp->prev = t->tail;
+	if (t->tail) {
+		t->tail->next = lp;
+	} else {
+		t->head = lp;
+	}
+	t->tail = lp;
+}
+
+static void load_unlink(rc_load_thread_t *t, rc_load_packet_t *lp)
+{
+	if (lp->prev) {
+		lp->prev->next = lp->next;
+	} else {
+		t->head = lp->next;
+	}
+
+	if (lp->next) {
+		lp->next->prev = lp->prev;
+	} else {
+		t->tail = lp->prev;
+	}
+	lp->prev = lp->next = NULL;
+}
+
+/*
+ *	Free the packet's ID and contents, so it can be used again.
+ */
+static void load_release(rc_load_thread_t *t, rc_load_packet_t *lp)
+{
+	RADIUS_PACKET *packet = lp->packet;
+
+	fr_packet_list_id_free(t->pl, packet, true);
+
+	fr_pair_list_free(&packet->vps);
+	TALLOC_FREE(packet->data);
+	packet->data_len = 0;
+
+	lp->next = t->free;
+	t->free = lp;
+}
+
+/** Expand the templates in a string attribute
+ *
+ *  - %n is the packet number, which is unique across all threads.
+ *  - %r is a random number.
+ *  - %t is the thread number.
+ *  - %% is a literal %.
+ */
+static void load_expand(rc_load_thread_t *t, VALUE_PAIR *vp, uint64_t num)
+{
+	char		buffer[FR_MAX_STRING_LEN + 1];
+	char const	*p;
+	char		*q = buffer, *end = buffer + sizeof(buffer) - 1;
+
+	for (p = vp->vp_strvalue; *p && (q < end); p++) {
+		if ((*p != '%') || !p[1]) {
+			*q++ = *p;
+			continue;
+		}
+
+		p++;
+		switch (*p) {
+		case 'n':
+			q += snprintf(q, end - q + 1, "%" PRIu64, num);
+			break;
+
+		case 'r':
+			q += snprintf(q, end - q + 1, "%u", fr_rand_from_ctx(&t->rand));
+			break;
+
+		case 't':
+			q += snprintf(q, end - q + 1, "%i", t->id);
+			break;
+
+		case '%':
+			*q++ = '%';
+			break;
+
+		default:
+			*q++ = '%';
+			if (q < end) *q++ = *p;
+			break;
+		}
+		if (q > end) q = end;
+	}
+	*q = '\0';
+
+	fr_pair_value_strcpy(vp, buffer);
+}
+
+/*
+ *	Build the next packet from the requests, and send it.
+ */
+static void load_send(rc_load_thread_t *t, uint64_t due)
+{
+	rc_load_config_t const	*config = t->config;
+	rc_request_t		*request = t->request;
+	rc_load_packet_t	*lp;
+	RADIUS_PACKET		*packet;
+	VALUE_PAIR		*vp;
+	vp_cursor_t		cursor;
+	uint64_t		now;
+	int			i;
+
+	t->request = request->next ? request->next : config->templates;
+
+	lp = t->free;
+	if (!lp) {
+		t->stats.no_id++;
+		return;
+	}
+
+	packet = lp->packet;
+	packet->code = request->packet->code;
+	packet->dst_ipaddr = request->packet->dst_ipaddr;
+	packet->dst_port = request->packet->dst_port;
+	packet->src_ipaddr.af = AF_UNSPEC;
+	packet->src_port = 0;
+
+	if (!fr_packet_list_id_alloc(t->pl, IPPROTO_UDP, &lp->packet, NULL)) {
+		t->stats.no_id++;
+		return;
+	}
+	t->free = lp->next;
+
+	packet->vps = fr_pair_list_copy(packet, request->packet->vps);
+	for (vp = fr_pair_cursor_init(&cursor, &packet->vps);
+	     vp;
+	     vp = fr_pair_cursor_next(&cursor)) {
+		if ((vp->vp_type == PW_TYPE_STRING) && strchr(vp->vp_strvalue, '%')) {
+			load_expand(t, vp, (t->seq * config->threads) + t->id);
+		}
+	}
+	t->seq++;
+
+	for (i = 0; i < 4; i++) {
+		((uint32_t *) packet->vector)[i] = fr_rand_from_ctx(&t->rand);
+	}
+
+	/*
+	 *	After the templates are expanded, as the password
+	 *	may be one of them.
+	 */
+	if (request->password) {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_CLEARTEXT_PASSWORD, TAG_ANY);
+		if (vp) rc_password_encode(packet, vp, &t->rand);
+	}
+
+	if (fr_radius_packet_send(packet, NULL, config->secret) < 0) {
+		t->stats.errors++;
+		load_release(t, lp);
+		return;
+	}
+
+	now = now_nsec();
+	lp->due = due;
+	lp->deadline = now + (uint64_t) (config->timeout * NSEC);
+	lp->tries = 1;
+	load_append(t, lp);
+
+	t->stats.sent++;
+}
+
+/*
+ *	Retransmit, or give up on, packets which haven't been answered.
+ */
+static void load_timeouts(rc_load_thread_t *t, uint64_t now)
+{
+	rc_load_config_t const *config = t->config;
+
+	while (t->head && (t->head->deadline <= now)) {
+		rc_load_packet_t *lp = t->head;
+
+		load_unlink(t, lp);
+
+		if (lp->tries < config->retries) {
+			if (fr_radius_packet_send(lp->packet, NULL, config->secret) < 0) t->stats.errors++;
+
+			lp->tries++;
+			lp->deadline = now + (uint64_t) (config->timeout * NSEC);
+			load_append(t, lp);
+
+			t->stats.retransmits++;
+			continue;
+		}
+
+		load_release(t, lp);
+		t->stats.timeouts++;
+	}
+}
+
+static void load_recv(rc_load_thread_t *t, RADIUS_PACKET *reply, uint64_t now)
+{
+	RADIUS_PACKET		**packet_p;
+	rc_load_packet_t	*lp;
+
+	/*
+	 *	We don't use udpfromto, so force the address the
+	 *	reply was sent to, to be the one we know about.
+	 */
+	reply->dst_ipaddr = t->config->client_ipaddr;
+
+	packet_p = fr_packet_list_find_byreply(t->pl, reply);
+	if (!packet_p) {
+		t->stats.bad++;
+		goto done;
+	}
+	lp = fr_packet2myptr(rc_load_packet_t, packet, packet_p);
+
+	if (fr_radius_packet_verify(reply, lp->packet, t->config->secret) < 0) {
+		t->stats.bad++;
+		goto done;
+	}
+
+	hist_add(&t->latency, now - lp->due);
+	t->stats.received++;
+
+	switch (reply->code) {
+	case PW_CODE_ACCESS_ACCEPT:
+	case PW_CODE_ACCOUNTING_RESPONSE:
+	case PW_CODE_COA_ACK:
+	case PW_CODE_DISCONNECT_ACK:
+		t->stats.accepted++;
+		break;
+
+	case PW_CODE_ACCESS_CHALLENGE:
+		break;
+
+	default:
+		t->stats.rejected++;
+	}
+
+	load_unlink(t, lp);
+	load_release(t, lp);
+
+done:
+	fr_radius_free(&reply);
+}
+
+static void *load_thread(void *arg)
+{
+	rc_load_thread_t	*t = arg;
+	rc_load_config_t const	*config = t->config;
+	uint64_t		interval, next_send, stop;
+
+	/*
+	 *	Each thread sends an equal share of the packets.  The
+	 *	threads are staggered, so the packets are evenly
+	 *	spaced overall.
+	 */
+	interval = ((uint64_t) NSEC * config->threads) / config->rate;
+	if (!interval) interval = 1;
+	next_send = t->start + ((interval * t->id) / config->threads);
+	stop = t->start + ((uint64_t) config->duration * NSEC);
+
+	for (;;) {
+		RADIUS_PACKET	*reply;
+		struct timeval	tv;
+		uint64_t	now, wake;
+		int		i;
+
+		now = now_nsec();
+
+		for (i = 0; (next_send < stop) && (next_send <= now) && (i < LOAD_BURST); i++) {
+			load_send(t, next_send);
+			next_send += interval;
+		}
+
+		load_timeouts(t, now);
+
+		/*
+		 *	Done sending, and everything has been answered,
+		 *	or has timed out.
+		 */
+		if ((next_send >= stop) && !t->head) break;
+
+		wake = (next_send < stop) ? next_send : UINT64_MAX;
+		if (t->head && (t->head->deadline < wake)) wake = t->head->deadline;
+
+		if (wake <= now) {
+			tv.tv_sec = 0;
+			tv.tv_usec = 0;
+		} else {
+			tv.tv_sec = (wake - now) / NSEC;
+			tv.tv_usec = ((wake - now) % NSEC) / 1000;
+		}
+
+		switch (fr_packet_list_poll(t->pl, &reply, &tv)) {
+		case 1:
+			load_recv(t, reply, now_nsec());
+			break;
+
+		case 0:
+			break;
+
+		default:
+			t->stats.bad++;
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+static int load_thread_init(rc_load_thread_t *t)
+{
+	rc_load_config_t const	*config = t->config;
+	fr_ipaddr_t		any;
+	int			i, bufsize = 4 * 1024 * 1024;
+
+	t->ctx = talloc_init("radclient load thread %i", t->id);
+	if (!t->ctx) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+
+	t->pl = fr_packet_list_create(1);
+	t->fds = talloc_array(t->ctx, int, config->sockets);
+	if (!t->pl || !t->fds) goto oom;
+
+	for (i = 0; i < (int) (sizeof(t->rand.randrsl) / sizeof(t->rand.randrsl[0])); i++) {
+		t->rand.randrsl[i] = fr_rand();
+	}
+	fr_randinit(&t->rand, 1);
+	t->rand.randcnt = 0;
+	fr_packet_list_rand_set(t->pl, &t->rand);
+
+	/*
+	 *	The sockets can send to any destination, as the
+	 *	requests may each have their own Packet-Dst-IP-Address.
+	 */
+	memset(&any, 0, sizeof(any));
+	any.af = config->client_ipaddr.af;
+
+	for (i = 0; i < config->sockets; i++) {
+		int fd;
+
+		fd = fr_socket(&config->client_ipaddr, 0);
+		if (fd < 0) return -1;
+
+		/*
+		 *	Big buffers, so that bursts of replies aren't
+		 *	dropped.  It's fine if we're not allowed.
+		 */
+		(void) setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+		(void) setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+		if (!fr_packet_list_socket_add(t->pl, fd, IPPROTO_UDP, &any, 0, NULL)) {
+			close(fd);
+			return -1;
+		}
+		t->fds[t->num_fds++] = fd;
+	}
+
+	/*
+	 *	One packet for every ID on every socket.
+	 */
+	for (i = 0; i < (config->sockets * 256); i++) {
+		rc_load_packet_t *lp;
+
+		lp = talloc_zero(t->ctx, rc_load_packet_t);
+		if (!lp) goto oom;
+
+		lp->packet = fr_radius_alloc(lp, false);
+		if (!lp->packet) goto oom;
+		lp->packet->id = -1;
+
+		lp->next = t->free;
+		t->free = lp;
+	}
+
+	t->request = config->templates;
+
+	return 0;
+}
+
+static void load_thread_free(rc_load_thread_t *t)
+{
+	int i;
+
+	for (i = 0; i < t->num_fds; i++) close(t->fds[i]);
+
+	fr_packet_list_free(t->pl);
+	talloc_free(t->ctx);
+}
+
+static void load_print(rc_load_config_t const *config, rc_load_stats_t const *stats,
+		       rc_histogram_t const *latency)
+{
+	static double const percentiles[] = { 50, 90, 99, 99.9, 99.99 };
+	size_t i;
+
+	printf("Load summary:\n");
+	printf("\tTarget rate   : %u/s for %us\n", config->rate, config->duration);
+	printf("\tSent          : %" PRIu64 " (%.1f/s)\n", stats->sent, (double) stats->sent / config->duration);
+	printf("\tReceived      : %" PRIu64 "\n", stats->received);
+	printf("\tAccepted      : %" PRIu64 "\n", stats->accepted);
+	printf("\tRejected      : %" PRIu64 "\n", stats->rejected);
+	printf("\tRetransmits   : %" PRIu64 "\n", stats->retransmits);
+	printf("\tTimeouts      : %" PRIu64 "\n", stats->timeouts);
+	printf("\tNo free ID    : %" PRIu64 "\n", stats->no_id);
+	printf("\tBad replies   : %" PRIu64 "\n", stats->bad);
+	printf("\tSend errors   : %" PRIu64 "\n", stats->errors);
+
+	if (!latency->count) return;
+
+	printf("Latency (usec):\n");
+	printf("\tmin           : %.1f\n", (double) latency->min / 1000);
+	for (i = 0; i < (sizeof(percentiles) / sizeof(percentiles[0])); i++) {
+		char name[16];
+
+		snprintf(name, sizeof(name), "p%g", percentiles[i]);
+		printf("\t%-14s: %.1f\n", name, (double) hist_percentile(latency, percentiles[i]) / 1000);
+	}
+	printf("\tmax           : %.1f\n", (double) latency->max / 1000);
+}
+
+/** Send packets at a fixed rate, and print statistics about the replies
+ *
+ * @param[in] config	for the load test.
+ * @return
+ *	- 0 if all packets were answered.
+ *	- 1 if some weren't.
+ *	- -1 on error.
+ */
+int rc_load_run(rc_load_config_t const *config)
+{
+	rc_load_thread_t	*threads;
+	rc_load_stats_t		stats;
+	rc_histogram_t		*latency;
+	uint64_t		start;
+	int			i, ret, num_started = 0, rcode = -1;
+
+	if (!config->rate || (config->threads < 1) || (config->sockets < 1) || !config->templates) {
+		fr_strerror_printf("Invalid load configuration");
+		return -1;
+	}
+
+	threads = talloc_zero_array(NULL, rc_load_thread_t, config->threads);
+	latency = talloc_zero(NULL, rc_histogram_t);
+	if (!threads || !latency) {
+		fr_strerror_printf("Out of memory");
+		goto finish;
+	}
+
+	for (i = 0; i < config->threads; i++) {
+		threads[i].id = i;
+		threads[i].config = config;
+		if (load_thread_init(&threads[i]) < 0) goto finish;
+	}
+
+	/*
+	 *	Give the threads a moment to start, so they all begin
+	 *	sending at the same time.
+	 */
+	start = now_nsec() + (NSEC / 100);
+	for (i = 0; i < config->threads; i++) {
+		threads[i].start = start;
+
+		ret = pthread_create(&threads[i].pthread, NULL, load_thread, &threads[i]);
+		if (ret != 0) {
+			fr_strerror_printf("Failed creating thread: %s", fr_syserror(ret));
+			break;
+		}
+		num_started++;
+	}
+
+	for (i = 0; i < num_started; i++) pthread_join(threads[i].pthread, NULL);
+	if (num_started < config->threads) goto finish;
+
+	memset(&stats, 0, sizeof(stats));
+	for (i = 0; i < config->threads; i++) {
+		rc_load_stats_t const *s = &threads[i].stats;
+
+		stats.sent += s->sent;
+		stats.retransmits += s->retransmits;
+		stats.received += s->received;
+		stats.accepted += s->accepted;
+		stats.rejected += s->rejected;
+		stats.timeouts += s->timeouts;
+		stats.no_id += s->no_id;
+		stats.bad += s->bad;
+		stats.errors += s->errors;
+
+		hist_merge(latency, &threads[i].latency);
+	}
+
+	load_print(config, &stats, latency);
+
+	rcode = ((stats.timeouts > 0) || (stats.errors > 0)) ? 1 : 0;
+
+finish:
+	if (threads) for (i = 0; i < config->threads; i++) load_thread_free(&threads[i]);
+	talloc_free(threads);
+	talloc_free(latency);
+
+	return rcode;
+}
@@ -0,0 +1,381 @@
+/*
+ * raddetail.c	Convert detail files between the text and binary formats.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/detail.h>
+
+#include <sys/stat.h>
+
+static char const *progname = "raddetail";
+char const *radlog_dir = NULL;
+char const *radacct_dir = NULL;
+
+bool log_stripped_names;
+
+/*
+ *	Global, for log.c to use.
+ */
+main_config_t main_config;
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: %s [options] [<input> [<output>]]\n", progname);
+	fprintf(output, "Convert detail files between the text and binary formats.\n");
+	fprintf(output, "Reads from stdin and writes to stdout if no files are given.\n");
+	fprintf(output, "  -b                     Convert a text detail file to binary (the default).\n");
+	fprintf(output, "  -d <raddb>             Set user dictionary directory (defaults to " RADDBDIR ").\n");
+	fprintf(output, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(output, "  -h                     Print usage help information.\n");
+	fprintf(output, "  -t                     Convert a binary detail file to text.\n");
+	fprintf(output, "  -x                     Debugging mode.\n");
+
+	exit(status);
+}
+
+/*
+ *	Write one binary record.
+ */
+static int write_record(FILE *out, uint8_t *record, size_t record_len, time_t timestamp, bool done)
+{
+	detail_binary_encode_header(record, record_len - DETAIL_BINARY_HDR_LEN, timestamp);
+	if (done) record[DETAIL_BINARY_DONE_OFFSET] = 1;
+
+	if (fwrite(record, 1, record_len, out) != record_len) {
+		fprintf(stderr, "%s: Failed writing record: %s\n", progname, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Read a text detail file, and write it out in the binary format.
+ */
+static int text_to_binary(FILE *in, FILE *out)
+{
+	char		buffer[2048], key[256], op[8], value[1024];
+	uint8_t		*record;
+	size_t		record_len = 0;
+	time_t		timestamp = 0;
+	bool		done = false, in_entry = false;
+	int		line = 0, entries = 0;
+
+	record = talloc_array(NULL, uint8_t, 4096);
+	if (!record) return -1;
+
+	while (fgets(buffer, sizeof(buffer), in)) {
+		VALUE_PAIR	*head = NULL, *vp;
+		vp_cursor_t	cursor;
+
+		line++;
+
+		if (!strchr(buffer, '\n')) {
+			fprintf(stderr, "%s: Line %i is too long\n", progname, line);
+			goto error;
+		}
+
+		/*
+		 *	A blank line ends the entry.
+		 */
+		if (buffer[0] == '\n') {
+			if (!in_entry) continue;
+
+			if (write_record(out, record, record_len, timestamp, done) < 0) goto error;
+			entries++;
+			in_entry = false;
+			continue;
+		}
+
+		/*
+		 *	Look for the date/time header.
+		 */
+		if (!in_entry) {
+			int y;
+
+			if (sscanf(buffer, "%*s %*s %*d %*d:%*d:%*d %d", &y) == 1) {
+				in_entry = true;
+				record_len = DETAIL_BINARY_HDR_LEN;
+				timestamp = 0;
+				done = false;
+			}
+			continue;
+		}
+
+		if (sscanf(buffer, "%255s %7s %1023s", key, op, value) != 3) {
+			fprintf(stderr, "%s: Skipping badly formatted line %i\n", progname, line);
+			continue;
+		}
+
+		if (!strcasecmp(key, "Timestamp")) {
+			timestamp = atoi(value);
+			continue;
+		}
+
+		if (!strcasecmp(key, "Donestamp")) {
+			timestamp = atoi(value);
+			done = true;
+			continue;
+		}
+
+		if ((fr_pair_list_afrom_str(NULL, buffer, &head) <= 0) || !head) {
+			fr_perror("%s: Failed reading attribute from line %i", progname, line);
+			continue;
+		}
+
+		for (vp = fr_pair_cursor_init(&cursor, &head);
+		     vp;
+		     vp = fr_pair_cursor_next(&cursor)) {
+			ssize_t slen;
+
+			for (;;) {
+				size_t len = talloc_array_length(record);
+
+				slen = detail_binary_encode_pair(record + record_len, len - record_len, vp);
+				if (slen != 0) break;
+
+				record = talloc_realloc(NULL, record, uint8_t, len * 2);
+				if (!record) {
+					fr_pair_list_free(&head);
+					return -1;
+				}
+			}
+
+			if (slen < 0) {
+				fr_perror("%s: Skipping attribute on line %i", progname, line);
+				continue;
+			}
+			record_len += slen;
+		}
+		fr_pair_list_free(&head);
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, "%s: Failed reading input: %s\n", progname, fr_syserror(errno));
+		goto error;
+	}
+
+	/*
+	 *	The last entry wasn't terminated with a blank line.
+	 */
+	if (in_entry) {
+		if (write_record(out, record, record_len, timestamp, done) < 0) goto error;
+		entries++;
+	}
+
+	talloc_free(record);
+	if (fr_debug_lvl > 0) fprintf(stderr, "%s: Converted %i entries\n", progname, entries);
+
+	return 0;
+
+error:
+	talloc_free(record);
+	return -1;
+}
+
+/*
+ *	Read a binary detail file, and write it out in the text format.
+ */
+static int binary_to_text(FILE *in, FILE *out)
+{
+	uint8_t		*data, *p, *end;
+	size_t		len = 0;
+	int		entries = 0;
+
+	data = talloc_array(NULL, uint8_t, 65536);
+	if (!data) return -1;
+
+	/*
+	 *	Slurp the whole file.  Binary detail files are
+	 *	consumed by the server, so they don't get very big.
+	 */
+	for (;;) {
+		size_t ret;
+
+		if (len == talloc_array_length(data)) {
+			data = talloc_realloc(NULL, data, uint8_t, len * 2);
+			if (!data) return -1;
+		}
+
+		ret = fread(data + len, 1, talloc_array_length(data) - len, in);
+		if (ret == 0) break;
+		len += ret;
+	}
+
+	if (ferror(in)) {
+		fprintf(stderr, "%s: Failed reading input: %s\n", progname, fr_syserror(errno));
+		goto error;
+	}
+
+	p = data;
+	end = data + len;
+	while (p < end) {
+		detail_binary_hdr_t	hdr;
+		VALUE_PAIR		*head = NULL, *vp;
+		vp_cursor_t		cursor;
+		ssize_t			slen;
+		char			timestamp[64];
+		struct tm		tm;
+
+		slen = detail_binary_decode_header(&hdr, p, end - p);
+		if (slen < 0) {
+			fr_perror("%s: Bad record at offset %zu", progname, (size_t) (p - data));
+			goto error;
+		}
+		if (slen == 0) {
+			fprintf(stderr, "%s: Truncated record at offset %zu\n", progname, (size_t) (p - data));
+			goto error;
+		}
+
+		if (detail_binary_decode_pairs(NULL, &head, p + DETAIL_BINARY_HDR_LEN, hdr.data_len) < 0) {
+			fr_perror("%s: Failed decoding record at offset %zu", progname, (size_t) (p - data));
+			fr_pair_list_free(&head);
+			goto error;
+		}
+		p += slen;
+
+		localtime_r(&hdr.timestamp, &tm);
+		strftime(timestamp, sizeof(timestamp), "%a %b %e %H:%M:%S %Y", &tm);
+		fprintf(out, "%s\n", timestamp);
+
+		for (vp = fr_pair_cursor_init(&cursor, &head);
+		     vp;
+		     vp = fr_pair_cursor_next(&cursor)) {
+			vp->op = T_OP_EQ;
+			fr_pair_fprint(out, vp);
+		}
+		fr_pair_list_free(&head);
+
+		fprintf(out, "\t%s = %ld\n\n", hdr.done ? "Donestamp" : "Timestamp", (long) hdr.timestamp);
+		entries++;
+	}
+
+	talloc_free(data);
+	if (fr_debug_lvl > 0) fprintf(stderr, "%s: Converted %i entries\n", progname, entries);
+
+	return 0;
+
+error:
+	talloc_free(data);
+	return -1;
+}
+
+int main(int argc, char **argv)
+{
+	int		c, ret;
+	bool		to_text = false;
+	char const	*radius_dir = RADDBDIR;
+	char const	*dict_dir = DICTDIR;
+	FILE		*in = stdin, *out = stdout;
+	fr_dict_t	*dict = NULL;
+
+#ifndef NDEBUG
+	if (fr_fault_setup(getenv("PANIC_ACTION"), argv[0]) < 0) {
+		fr_perror("raddetail");
+		exit(EXIT_FAILURE);
+	}
+#endif
+
+	talloc_set_log_stderr();
+
+	while ((c = getopt(argc, argv, "bd:D:htx")) != EOF) switch (c) {
+		case 'b':
+			to_text = false;
+			break;
+
+		case 'd':
+			radius_dir = optarg;
+			break;
+
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'h':
+			usage(0);	/* never returns */
+
+		case 't':
+			to_text = true;
+			break;
+
+		case 'x':
+			fr_debug_lvl++;
+			break;
+
+		default:
+			usage(1);
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc > 2) usage(1);
+
+	/*
+	 *	Mismatch between the binary and the libraries it depends on
+	 */
+	if (fr_check_lib_magic(RADIUSD_MAGIC_NUMBER) < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_from_file(NULL, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("raddetail");
+		return 1;
+	}
+
+	if (fr_dict_read(dict, radius_dir, FR_DICTIONARY_FILE) == -1) {
+		fr_perror("raddetail");
+		return 1;
+	}
+	fr_strerror();	/* Clear the error buffer */
+
+	if ((argc > 0) && (strcmp(argv[0], "-") != 0)) {
+		in = fopen(argv[0], "r");
+		if (!in) {
+			fprintf(stderr, "%s: Failed opening %s: %s\n", progname, argv[0], fr_syserror(errno));
+			return 1;
+		}
+	}
+
+	if ((argc > 1) && (strcmp(argv[1], "-") != 0)) {
+		out = fopen(argv[1], "w");
+		if (!out) {
+			fprintf(stderr, "%s: Failed opening %s: %s\n", progname, argv[1], fr_syserror(errno));
+			return 1;
+		}
+	}
+
+	ret = to_text ? binary_to_text(in, out) : text_to_binary(in, out);
+
+	if (in != stdin) fclose(in);
+	if ((fflush(out) != 0) || ((out != stdout) && (fclose(out) != 0))) {
+		fprintf(stderr, "%s: Failed writing output: %s\n", progname, fr_syserror(errno));
+		ret = -1;
+	}
+
+	talloc_free(dict);
+
+	return (ret < 0) ? 1 : 0;
+}
@@ -0,0 +1,5 @@
+TARGET		:= raddetail
+SOURCES		:= raddetail.c
+
+TGT_PREREQS	:= libfreeradius-server.a libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
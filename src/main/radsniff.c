@@ -29,8 +29,10 @@ RCSID("$Id$")
 #define _LIBRADIUS 1
 #include <time.h>
 #include <math.h>
+#include <sched.h>
 #include <freeradius-devel/libradius.h>
 #include <freeradius-devel/event.h>
+#include <freeradius-devel/threads.h>
 
 #include <freeradius-devel/radpaths.h>
 #include <freeradius-devel/conf.h>
@@ -45,13 +47,22 @@ RCSID("$Id$")
 
 static rs_t *conf;
 static struct timeval start_pcap = {0, 0};
-static char timestr[50];
+static _Thread_local char timestr[50];
 
-static rbtree_t *request_tree = NULL;
-static rbtree_t *link_tree = NULL;
-static fr_event_list_t *events;
+/*
+ *	When decoding and linking is done by shards, each shard
+ *	thread has its own trees, and event list for cleanup
+ *	timers.  The main thread uses these for everything else.
+ */
+static _Thread_local TALLOC_CTX *request_ctx = NULL;
+static _Thread_local rbtree_t *request_tree = NULL;
+static _Thread_local rbtree_t *link_tree = NULL;
+static _Thread_local fr_event_list_t *events;
 static bool cleanup;
 
+static rs_shard_t *shards = NULL;		//!< Decode/link threads.
+static int shards_started = 0;			//!< How many shard threads are running.
+
 static int self_pipe[2] = {-1, -1};		//!< Signals from sig handlers
 
 typedef int (*rbcmp)(void const *, void const *);
@@ -194,6 +205,24 @@ static void rs_time_print(char *out, size_t len, struct timeval const *t)
 	}
 }
 
+/** Stop the library writing to the log, while we decode a packet
+ *
+ * fr_log_fp is shared by all threads, so shards leave it alone.
+ */
+static inline FILE *rs_log_mute(void)
+{
+	FILE *log_fp = fr_log_fp;
+
+	if (!conf->num_shards) fr_log_fp = NULL;
+
+	return log_fp;
+}
+
+static inline void rs_log_unmute(FILE *log_fp)
+{
+	if (!conf->num_shards) fr_log_fp = log_fp;
+}
+
 static size_t rs_snprint_csv(char *out, size_t outlen, char const *in, size_t inlen)
 {
 	char const	*start = out;
@@ -499,8 +528,8 @@ static int rs_check_pcap_drop(fr_pcap_t *in)
 	int ret = 0;
 	struct pcap_stat pstats;
 
-	if (pcap_stats(in->handle, &pstats) != 0) {
-		ERROR("%s failed retrieving pcap stats: %s", in->name, pcap_geterr(in->handle));
+	if (fr_pcap_stats(in, &pstats) != 0) {
+		ERROR("%s failed retrieving pcap stats: %s", in->name, fr_strerror());
 		return -1;
 	}
 
@@ -647,8 +676,8 @@ static void rs_stats_print_fancy(rs_update_t *this, rs_stats_t *stats, struct ti
 	     in_p = in_p->next) {
 		struct pcap_stat pstats;
 
-		if (pcap_stats(in_p->handle, &pstats) != 0) {
-			ERROR("%s failed retrieving pcap stats: %s", in_p->name, pcap_geterr(in_p->handle));
+		if (fr_pcap_stats(in_p, &pstats) != 0) {
+			ERROR("%s failed retrieving pcap stats: %s", in_p->name, fr_strerror());
 			return;
 		}
 
@@ -760,8 +789,8 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	     in_p = in_p->next) {
 		struct pcap_stat pstats;
 
-		if (pcap_stats(in_p->handle, &pstats) != 0) {
-			ERROR("%s failed retrieving pcap stats: %s", in_p->name, pcap_geterr(in_p->handle));
+		if (fr_pcap_stats(in_p, &pstats) != 0) {
+			ERROR("%s failed retrieving pcap stats: %s", in_p->name, fr_strerror());
 			return;
 		}
 
@@ -783,6 +812,88 @@ static void rs_stats_print_csv(rs_update_t *this, rs_stats_t *stats, UNUSED stru
 	fprintf(stdout , "%s\n", buffer);
 }
 
+/** Add the interval stats from a shard to the totals
+ *
+ */
+static void rs_stats_merge_latency(rs_latency_t *out, rs_latency_t const *in)
+{
+	int i;
+
+	out->interval.received_total += in->interval.received_total;
+	out->interval.linked_total += in->interval.linked_total;
+	out->interval.unlinked_total += in->interval.unlinked_total;
+	out->interval.reused_total += in->interval.reused_total;
+	out->interval.lost_total += in->interval.lost_total;
+
+	for (i = 0; i <= RS_RETRANSMIT_MAX; i++) {
+		out->interval.rt_total[i] += in->interval.rt_total[i];
+	}
+
+	out->interval.latency_total += in->interval.latency_total;
+
+	if (in->interval.latency_high > out->interval.latency_high) {
+		out->interval.latency_high = in->interval.latency_high;
+	}
+	if (in->interval.latency_low &&
+	    (!out->interval.latency_low || (in->interval.latency_low < out->interval.latency_low))) {
+		out->interval.latency_low = in->interval.latency_low;
+	}
+}
+
+/** Get an empty message to send to a shard
+ *
+ * If they're all in flight, the shard is behind, so we wait for it to
+ * catch up.  Reading from a file that's what limits how fast we go,
+ * when capturing packets we rely on the capture buffer.
+ */
+static rs_shard_msg_t *rs_shard_msg_alloc(rs_shard_t *shard)
+{
+	void *msg;
+
+	while (!fr_atomic_queue_pop(shard->free, &msg)) sched_yield();
+
+	return msg;
+}
+
+/** Gather interval stats from the shards
+ *
+ * We queue a tick for each shard, and it publishes its interval stats when it
+ * gets to it, so the stats cover exactly the packets captured before the tick.
+ */
+static void rs_shards_collect(rs_stats_t *stats, struct timeval *now)
+{
+	static uint64_t	tick;
+	int		i;
+	size_t		j;
+	size_t		rs_codes_len = (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes));
+
+	tick++;
+
+	for (i = 0; i < conf->num_shards; i++) {
+		rs_shard_msg_t *msg;
+
+		msg = rs_shard_msg_alloc(&shards[i]);
+		msg->tick = tick;
+		msg->in = NULL;
+		msg->header.ts = *now;
+		msg->header.caplen = 0;
+		(void) fr_atomic_queue_push(shards[i].queue, msg);
+	}
+
+	for (i = 0; i < conf->num_shards; i++) {
+		rs_shard_t *shard = &shards[i];
+
+		while (atomic_load_explicit(&shard->published, memory_order_acquire) != tick) sched_yield();
+
+		for (j = 0; j < rs_codes_len; j++) {
+			rs_stats_merge_latency(&stats->exchange[rs_useful_codes[j]],
+					       &shard->snapshot->exchange[rs_useful_codes[j]]);
+		}
+
+		if (timercmp(&shard->snapshot->quiet, &stats->quiet, >)) stats->quiet = shard->snapshot->quiet;
+	}
+}
+
 /** Process stats for a single interval
  *
  */
@@ -801,6 +912,8 @@ static void rs_stats_process(fr_event_list_t *el, struct timeval *now, void *ctx
 
 	stats->intervals++;
 
+	if (conf->num_shards) rs_shards_collect(stats, now);
+
 	for (in_p = this->in;
 	     in_p;
 	     in_p = in_p->next) {
@@ -1297,7 +1410,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	 *	recover once some requests timeout, so make an effort to deal
 	 *	with allocation failures gracefully.
 	 */
-	current = fr_radius_alloc(conf, false);
+	current = fr_radius_alloc(request_ctx, false);
 	if (!current) {
 		REDEBUG("Failed allocating memory to hold decoded packet");
 		rs_tv_add_ms(&header->ts, conf->stats.timeout, &stats->quiet);
@@ -1372,11 +1485,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 
 		if (conf->verify_radius_authenticator && original) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_packet_verify(current, original->expect, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 			if (ret != 0) {
 				REDEBUG("Failed verifying packet ID %d", current->id);
 				fr_radius_free(&current);
@@ -1390,11 +1502,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 */
 		if (conf->decode_attrs) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_packet_decode(current, original ? original->expect : NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 			if (ret != 0) {
 				fr_radius_free(&current);
 				REDEBUG("Failed decoding");
@@ -1496,11 +1607,10 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 */
 		if (conf->decode_attrs) {
 			int ret;
-			FILE *log_fp = fr_log_fp;
+			FILE *log_fp = rs_log_mute();
 
-			fr_log_fp = NULL;
 			ret = fr_radius_packet_decode(current, NULL, conf->radius_secret);
-			fr_log_fp = log_fp;
+			rs_log_unmute(log_fp);
 
 			if (ret != 0) {
 				fr_radius_free(&current);
@@ -1613,7 +1723,7 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		 *	...nope it's a new request.
 		 */
 		} else {
-			original = talloc_zero(conf, rs_request_t);
+			original = talloc_zero(request_ctx, rs_request_t);
 			talloc_set_destructor(original, _request_free);
 
 			original->id = count;
@@ -1749,6 +1859,12 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 		fr_radius_free(&current);
 	}
 
+	/*
+	 *	Shards can't see what the others have captured, so the
+	 *	capture thread enforces the limit.
+	 */
+	if (conf->num_shards) return;
+
 	captured++;
 	/*
 	 *	We've hit our capture limit, break out of the event loop
@@ -1759,12 +1875,118 @@ static void rs_packet_process(uint64_t count, rs_event_t *event, struct pcap_pkt
 	}
 }
 
+/** Hash a packet so both halves of an exchange go to the same shard
+ *
+ * The endpoints are hashed separately and XORed, so we get the same value
+ * for a request and its response.  If we're linking retransmissions by
+ * attribute the ports and ID may change between retransmissions, so we only
+ * hash the addresses.
+ *
+ * Anything we can't parse goes to the first shard, which will complain
+ * about it.
+ */
+static uint32_t rs_shard_hash(fr_pcap_t *in, struct pcap_pkthdr const *header, uint8_t const *data)
+{
+	uint8_t const		*p = data, *end = data + header->caplen;
+	uint8_t const		*src, *dst;
+	size_t			addr_len;
+	ssize_t			len;
+	udp_header_t const	*udp;
+	uint32_t		src_hash, dst_hash;
+
+	len = fr_link_layer_offset(data, header->caplen, in->link_layer);
+	if (len < 0) return 0;
+	p += len;
+	if (p >= end) return 0;
+
+	switch ((p[0] & 0xf0) >> 4) {
+	case 4:
+	{
+		ip_header_t const *ip = (ip_header_t const *)p;
+
+		if ((p + sizeof(*ip)) > end) return 0;
+
+		src = (uint8_t const *)&ip->ip_src;
+		dst = (uint8_t const *)&ip->ip_dst;
+		addr_len = sizeof(ip->ip_src);
+		p += (0x0f & ip->ip_vhl) * 4;
+	}
+		break;
+
+	case 6:
+	{
+		ip_header6_t const *ip6 = (ip_header6_t const *)p;
+
+		if ((p + sizeof(*ip6)) > end) return 0;
+
+		src = (uint8_t const *)&ip6->ip_src;
+		dst = (uint8_t const *)&ip6->ip_dst;
+		addr_len = sizeof(ip6->ip_src);
+		p += sizeof(*ip6);
+	}
+		break;
+
+	default:
+		return 0;
+	}
+
+	/*
+	 *	UDP header, plus the RADIUS code and ID
+	 */
+	if ((p + sizeof(udp_header_t) + 2) > end) return 0;
+	udp = (udp_header_t const *)p;
+
+	src_hash = fr_hash(src, addr_len);
+	dst_hash = fr_hash(dst, addr_len);
+	if (conf->link_da_num > 0) return src_hash ^ dst_hash;
+
+	src_hash = fr_hash_update(&udp->src, sizeof(udp->src), src_hash);
+	dst_hash = fr_hash_update(&udp->dst, sizeof(udp->dst), dst_hash);
+
+	return fr_hash_update(p + sizeof(udp_header_t) + 1, 1, src_hash ^ dst_hash);
+}
+
+/** Copy a packet into a message, and queue it for the shard that owns its exchange
+ *
+ */
+static void rs_shard_dispatch(uint64_t count, rs_event_t *event, struct pcap_pkthdr const *header,
+			      uint8_t const *data)
+{
+	rs_shard_t	*shard = &shards[rs_shard_hash(event->in, header, data) % conf->num_shards];
+	rs_shard_msg_t	*msg;
+
+	/*
+	 *	Set here, so the shards all agree on when we started.
+	 */
+	if (!start_pcap.tv_sec) start_pcap = header->ts;
+
+	msg = rs_shard_msg_alloc(shard);
+	msg->count = count;
+	msg->tick = 0;
+	msg->in = event->in;
+	msg->header = *header;
+	if (msg->header.caplen > sizeof(msg->data)) msg->header.caplen = sizeof(msg->data);
+	memcpy(msg->data, data, msg->header.caplen);
+
+	/*
+	 *	Can't fail, there are as many messages as there are
+	 *	queue entries.
+	 */
+	(void) fr_atomic_queue_push(shard->queue, msg);
+
+	/*
+	 *	We've hit our capture limit, break out of the event loop
+	 */
+	if ((conf->limit > 0) && (count == conf->limit)) {
+		INFO("Captured %" PRIu64 " packets, exiting...", count);
+		fr_event_loop_exit(events, 1);
+	}
+}
+
 static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 {
 	static uint64_t	count = 0;	/* Packets seen */
 	rs_event_t	*event = ctx;
-	pcap_t		*handle = event->in->handle;
-
 	int i;
 	int ret;
 	int total = 0;
@@ -1780,7 +2002,7 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 		while ((total < 5) && !fr_event_loop_exiting(el)) {
 			struct timeval now;
 
-			ret = pcap_next_ex(handle, &header, &data);
+			ret = fr_pcap_next(event->in, &header, &data);
 			if (ret == 0) {
 				/* No more packets available at this time */
 				return;
@@ -1796,7 +2018,7 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 				return;
 			}
 			if (ret < 0) {
-				ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(handle));
+				ERROR("Error requesting next packet, got (%i): %s", ret, fr_strerror());
 				goto done_file;
 			}
 
@@ -1814,7 +2036,11 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 			} while (fr_event_timer_run(el, &now) == 1);
 			count++;
 
-			rs_packet_process(count, event, header, data);
+			if (conf->num_shards) {
+				rs_shard_dispatch(count, event, header, data);
+			} else {
+				rs_packet_process(count, event, header, data);
+			}
 			total++;
 		}
 		return;
@@ -1825,18 +2051,22 @@ static void rs_got_packet(fr_event_list_t *el, int fd, void *ctx)
 	 *	We occasionally need to yield to allow events to run.
 	 */
 	for (i = 0; i < RS_FORCE_YIELD; i++) {
-		ret = pcap_next_ex(handle, &header, &data);
+		ret = fr_pcap_next(event->in, &header, &data);
 		if (ret == 0) {
 			/* No more packets available at this time */
 			return;
 		}
 		if (ret < 0) {
-			ERROR("Error requesting next packet, got (%i): %s", ret, pcap_geterr(handle));
+			ERROR("Error requesting next packet, got (%i): %s", ret, fr_strerror());
 			return;
 		}
 
 		count++;
-		rs_packet_process(count, event, header, data);
+		if (conf->num_shards) {
+			rs_shard_dispatch(count, event, header, data);
+		} else {
+			rs_packet_process(count, event, header, data);
+		}
 	}
 }
 
@@ -1996,6 +2226,185 @@ static void _unmark_link(void *request)
 	this->in_link_tree = false;
 }
 
+/** Publish the stats for the interval which just ended
+ *
+ */
+static void rs_shard_publish(rs_shard_t *shard, uint64_t tick)
+{
+	size_t	i;
+	size_t	rs_codes_len = (sizeof(rs_useful_codes) / sizeof(*rs_useful_codes));
+
+	for (i = 0; i < rs_codes_len; i++) {
+		rs_latency_t *stats = &shard->stats->exchange[rs_useful_codes[i]];
+
+		shard->snapshot->exchange[rs_useful_codes[i]].interval = stats->interval;
+		memset(&stats->interval, 0, sizeof(stats->interval));
+	}
+	shard->snapshot->quiet = shard->stats->quiet;
+
+	atomic_store_explicit(&shard->published, tick, memory_order_release);
+}
+
+/** Decode and link packets passed to us by the capture thread
+ *
+ */
+static void *rs_shard_run(void *arg)
+{
+	rs_shard_t	*shard = arg;
+	int		idle = 0;
+
+	request_ctx = shard->ctx;
+	request_tree = shard->request_tree;
+	link_tree = shard->link_tree;
+	events = shard->el;
+
+	for (;;) {
+		void		*p;
+		rs_shard_msg_t	*msg;
+		struct timeval	now;
+
+		if (!fr_atomic_queue_pop(shard->queue, &p)) {
+			/*
+			 *	The capture thread sets stop after queueing
+			 *	its last message, so check the queue again.
+			 */
+			if (atomic_load_explicit(&shard->stop, memory_order_acquire)) {
+				if (!fr_atomic_queue_pop(shard->queue, &p)) break;
+			} else {
+				if (++idle < RS_SHARD_SPIN) continue;
+
+				/*
+				 *	Requests from live captures still need
+				 *	to expire if there's no more traffic.
+				 */
+				if (conf->from_dev) {
+					gettimeofday(&now, NULL);
+					while (fr_event_timer_run(events, &now) == 1) gettimeofday(&now, NULL);
+				}
+				usleep(100);
+				continue;
+			}
+		}
+		idle = 0;
+		msg = p;
+
+		/*
+		 *	Expire requests up until the time of this message.
+		 */
+		do {
+			now = msg->header.ts;
+		} while (fr_event_timer_run(events, &now) == 1);
+
+		if (msg->tick) {
+			rs_shard_publish(shard, msg->tick);
+		} else {
+			rs_event_t event;
+
+			memset(&event, 0, sizeof(event));
+			event.list = events;
+			event.in = msg->in;
+			event.stats = shard->stats;
+
+			rs_packet_process(msg->count, &event, &msg->header, msg->data);
+		}
+
+		(void) fr_atomic_queue_push(shard->free, msg);
+	}
+
+	/*
+	 *	The destructors for the requests use our trees and
+	 *	event list, so they have to be freed by this thread.
+	 */
+	talloc_free_children(shard->ctx);
+
+	return NULL;
+}
+
+/** Allocate the shards, and start their threads
+ *
+ */
+static int rs_shards_start(void)
+{
+	int i, j, ret;
+
+	shards = talloc_zero_array(conf, rs_shard_t, conf->num_shards);
+	if (!shards) {
+	oom:
+		ERROR("Failed allocating shards");
+		return -1;
+	}
+
+	for (i = 0; i < conf->num_shards; i++) {
+		rs_shard_t	*shard = &shards[i];
+		rs_shard_msg_t	*msgs;
+
+		shard->number = i;
+		atomic_init(&shard->published, 0);
+		atomic_init(&shard->stop, false);
+
+		/*
+		 *	Not parented by conf, as talloc isn't thread safe.
+		 */
+		shard->ctx = talloc_new(NULL);
+		if (!shard->ctx) goto oom;
+
+		shard->el = fr_event_list_alloc(shard->ctx, NULL, NULL);
+		if (!shard->el) goto oom;
+
+		shard->request_tree = rbtree_create(shard->ctx, (rbcmp) rs_packet_cmp, _unmark_request, 0);
+		if (!shard->request_tree) goto oom;
+
+		if (conf->link_da_num > 0) {
+			shard->link_tree = rbtree_create(shard->ctx, (rbcmp) rs_rtx_cmp, _unmark_link, 0);
+			if (!shard->link_tree) goto oom;
+		}
+
+		shard->stats = talloc_zero(conf, rs_stats_t);
+		shard->snapshot = talloc_zero(conf, rs_stats_t);
+		shard->queue = fr_atomic_queue_create(conf, RS_SHARD_QUEUE_SIZE);
+		shard->free = fr_atomic_queue_create(conf, RS_SHARD_QUEUE_SIZE);
+		msgs = talloc_array(conf, rs_shard_msg_t, RS_SHARD_QUEUE_SIZE);
+		if (!shard->stats || !shard->snapshot || !shard->queue || !shard->free || !msgs) goto oom;
+
+		for (j = 0; j < RS_SHARD_QUEUE_SIZE; j++) (void) fr_atomic_queue_push(shard->free, &msgs[j]);
+	}
+
+	for (i = 0; i < conf->num_shards; i++) {
+		/*
+		 *	pthread_create() returns the error, it doesn't set errno.
+		 */
+		ret = pthread_create(&shards[i].pthread, NULL, rs_shard_run, &shards[i]);
+		if (ret != 0) {
+			ERROR("Failed creating shard thread: %s", fr_syserror(ret));
+			return -1;
+		}
+		shards_started++;
+	}
+
+	DEBUG("Decoding and linking packets in %i shards", conf->num_shards);
+
+	return 0;
+}
+
+/** Wait for the shards to finish processing queued packets, and free them
+ *
+ */
+static void rs_shards_stop(void)
+{
+	int i;
+
+	for (i = 0; i < shards_started; i++) {
+		atomic_store_explicit(&shards[i].stop, true, memory_order_release);
+	}
+
+	for (i = 0; i < shards_started; i++) pthread_join(shards[i].pthread, NULL);
+
+	for (i = 0; i < conf->num_shards; i++) talloc_free(shards[i].ctx);
+
+	shards_started = 0;
+	shards = NULL;
+}
+
 #ifdef HAVE_COLLECTDC_H
 /** Re-open the collectd socket
  *
@@ -2108,6 +2517,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -l <attr>[,<attr>]    Output packet sig and a list of attributes.\n");
 	fprintf(output, "  -L <attr>[,<attr>]    Detect retransmissions using these attributes to link requests.\n");
 	fprintf(output, "  -m                    Don't put interface(s) into promiscuous mode.\n");
+	fprintf(output, "  -M                    Capture using memory mapped rings (Linux only).\n");
 	fprintf(output, "  -p <port>             Filter packets by port (default is 1812).\n");
 	fprintf(output, "  -P <pidfile>          Daemonize and write out <pidfile>.\n");
 	fprintf(output, "  -q                    Print less debugging information.\n");
@@ -2115,6 +2525,7 @@ static void NEVER_RETURNS usage(int status)
 	fprintf(output, "  -R <filter>           RADIUS attribute response filter.\n");
 	fprintf(output, "  -s <secret>           RADIUS secret.\n");
 	fprintf(output, "  -S                    Write PCAP data to stdout.\n");
+	fprintf(output, "  -t <shards>           Decode and link packets in <shards> threads.\n");
 	fprintf(output, "  -v                    Show program version information.\n");
 	fprintf(output, "  -w <file>             Write output packets to file.\n");
 	fprintf(output, "  -x                    Print more debugging information.\n");
@@ -2167,6 +2578,7 @@ int main(int argc, char *argv[])
 
 	conf = talloc_zero(NULL, rs_t);
 	RS_ASSERT(conf);
+	request_ctx = conf;
 
 	stats = talloc_zero(conf, rs_stats_t);
 
@@ -2199,7 +2611,7 @@ int main(int argc, char *argv[])
 	/*
 	 *  Get options
 	 */
-	while ((opt = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mp:P:qr:R:s:Svw:xXW:T:P:N:O:")) != EOF) {
+	while ((opt = getopt(argc, argv, "ab:c:C:d:D:e:Ef:hi:I:l:L:mMp:P:qr:R:s:St:vw:xXW:T:P:N:O:")) != EOF) {
 		switch (opt) {
 		case 'a':
 		{
@@ -2303,6 +2715,10 @@ int main(int argc, char *argv[])
 			conf->promiscuous = false;
 			break;
 
+		case 'M':
+			conf->use_ring = true;
+			break;
+
 		case 'p':
 			port = atoi(optarg);
 			break;
@@ -2335,6 +2751,14 @@ int main(int argc, char *argv[])
 			conf->to_stdout = true;
 			break;
 
+		case 't':
+			conf->num_shards = atoi(optarg);
+			if ((conf->num_shards < 1) || (conf->num_shards > RS_SHARD_MAX)) {
+				ERROR("Number of shards must be between 1 and %i", RS_SHARD_MAX);
+				usage(64);
+			}
+			break;
+
 		case 'v':
 #ifdef HAVE_COLLECTDC_H
 			INFO("%s, %s, collectdclient version %s", radsniff_version, pcap_lib_version(),
@@ -2439,6 +2863,12 @@ int main(int argc, char *argv[])
 		conf->to_stdout = false;
 	}
 
+	/* Shards would write packets out of order */
+	if (conf->num_shards && (conf->to_file || conf->to_stdout)) {
+		ERROR("Writing PCAP data is not supported with shards");
+		usage(64);
+	}
+
 	if (conf->to_stdout) {
 		out = fr_pcap_init(conf, "stdout", PCAP_STDIO_OUT);
 		if (!out) {
@@ -2713,6 +3143,7 @@ int main(int argc, char *argv[])
 		     in_p = in_p->next) {
 			in_p->promiscuous = conf->promiscuous;
 			in_p->buffer_pkts = conf->buffer_pkts;
+			in_p->use_ring = conf->use_ring && (in_p->type == PCAP_INTERFACE_IN);
 			if (fr_pcap_open(in_p) < 0) {
 				ERROR("Failed opening pcap handle (%s): %s", in_p->name, fr_strerror());
 				if (conf->from_auto || (in_p->type == PCAP_FILE_IN)) {
@@ -2829,6 +3260,8 @@ int main(int argc, char *argv[])
 		buff = fr_pcap_device_names(conf, in, ' ');
 		DEBUG("Sniffing on (%s)", buff);
 
+		if (conf->num_shards && (rs_shards_start() < 0)) goto finish;
+
 		/*
 		 *  Insert our stats processor
 		 */
@@ -2863,6 +3296,8 @@ int main(int argc, char *argv[])
 	DEBUG2("Done sniffing");
 
 finish:
+	if (shards) rs_shards_stop();
+
 	cleanup = true;
 
 	/*
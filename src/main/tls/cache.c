@@ -141,6 +141,230 @@ int tls_cache_process(REQUEST *request, char const *virtual_server, int autz_typ
 	return rcode;
 }
 
+/** Number of independently locked partitions of the in-memory session cache
+ *
+ * Must be a power of 2.
+ */
+#define TLS_CACHE_SHARDS	16
+
+/** A serialised session in the in-memory cache
+ *
+ */
+typedef struct tls_cache_entry {
+	uint8_t			*id;			//!< Session ID.
+	size_t			id_len;			//!< Length of the session ID.
+	uint8_t			*data;			//!< Output of i2d_SSL_SESSION.
+	time_t			expires;		//!< When the session can no longer be resumed.
+	int			heap_id;		//!< Position in the expiry heap.
+} tls_cache_entry_t;
+
+/** One partition of the in-memory session cache
+ *
+ */
+typedef struct tls_cache_shard {
+	pthread_mutex_t		mutex;			//!< Protects the tree and heap.
+	rbtree_t		*tree;			//!< Entries keyed by session ID.
+	fr_heap_t		*heap;			//!< Entries ordered by expiry time.
+} tls_cache_shard_t;
+
+/** In-memory session cache
+ *
+ * Shared by all workers.  Sessions are distributed over #TLS_CACHE_SHARDS
+ * partitions by a hash of their ID, so that workers resuming different
+ * sessions rarely contend for the same lock.
+ */
+struct tls_cache {
+	uint32_t		max_entries;		//!< Maximum number of entries per shard.
+	uint32_t		lifetime;		//!< How long entries remain valid for.
+	tls_cache_shard_t	shards[TLS_CACHE_SHARDS];
+};
+
+static int tls_cache_entry_cmp(void const *one, void const *two)
+{
+	tls_cache_entry_t const *a = one, *b = two;
+
+	if (a->id_len < b->id_len) return -1;
+	if (a->id_len > b->id_len) return +1;
+
+	return memcmp(a->id, b->id, a->id_len);
+}
+
+static int tls_cache_entry_expires_cmp(void const *one, void const *two)
+{
+	tls_cache_entry_t const *a = one, *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+static tls_cache_shard_t *tls_cache_shard(tls_cache_t *cache, uint8_t const *id, size_t id_len)
+{
+	return &cache->shards[fr_hash(id, id_len) & (TLS_CACHE_SHARDS - 1)];
+}
+
+/** Remove an entry from a shard and free it
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static void tls_cache_entry_free(tls_cache_shard_t *shard, tls_cache_entry_t *entry)
+{
+	fr_heap_extract(shard->heap, entry);
+	rbtree_deletebydata(shard->tree, entry);
+	talloc_free(entry);
+}
+
+/** Free any entries in a shard which have expired
+ *
+ * @note Must be called with the shard mutex held.
+ */
+static void tls_cache_shard_expire(tls_cache_shard_t *shard, time_t now)
+{
+	tls_cache_entry_t *entry;
+
+	while ((entry = fr_heap_peek(shard->heap)) && (entry->expires <= now)) tls_cache_entry_free(shard, entry);
+}
+
+/** Add a serialised session to the in-memory cache
+ *
+ * If the shard is full, the entry closest to expiry is evicted.
+ *
+ * @param[in] cache	to add the session to.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ * @param[in] data	Serialised session.
+ * @param[in] data_len	Length of the serialised session.
+ */
+static void tls_cache_mem_write(tls_cache_t *cache, uint8_t const *id, size_t id_len,
+				uint8_t const *data, size_t data_len)
+{
+	tls_cache_shard_t	*shard = tls_cache_shard(cache, id, id_len);
+	tls_cache_entry_t	find, *entry;
+	time_t			now = time(NULL);
+
+	memcpy(&find.id, &id, sizeof(find.id));
+	find.id_len = id_len;
+
+	pthread_mutex_lock(&shard->mutex);
+	tls_cache_shard_expire(shard, now);
+
+	entry = rbtree_finddata(shard->tree, &find);
+	if (entry) tls_cache_entry_free(shard, entry);
+
+	if (rbtree_num_elements(shard->tree) >= cache->max_entries) {
+		entry = fr_heap_peek(shard->heap);
+		if (entry) tls_cache_entry_free(shard, entry);
+	}
+
+	MEM(entry = talloc_zero(shard->tree, tls_cache_entry_t));
+	MEM(entry->id = talloc_memdup(entry, id, id_len));
+	entry->id_len = id_len;
+	MEM(entry->data = talloc_memdup(entry, data, data_len));
+	entry->expires = now + cache->lifetime;
+
+	rbtree_insert(shard->tree, entry);
+	fr_heap_insert(shard->heap, entry);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Retrieve a copy of a serialised session from the in-memory cache
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] cache	to search.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ * @return
+ *	- The serialised session.
+ *	- NULL if the session wasn't found, or has expired.
+ */
+static uint8_t *tls_cache_mem_read(TALLOC_CTX *ctx, tls_cache_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_shard_t	*shard = tls_cache_shard(cache, id, id_len);
+	tls_cache_entry_t	find, *entry;
+	uint8_t			*data = NULL;
+
+	memcpy(&find.id, &id, sizeof(find.id));
+	find.id_len = id_len;
+
+	pthread_mutex_lock(&shard->mutex);
+	tls_cache_shard_expire(shard, time(NULL));
+
+	entry = rbtree_finddata(shard->tree, &find);
+	if (entry) MEM(data = talloc_memdup(ctx, entry->data, talloc_array_length(entry->data)));
+	pthread_mutex_unlock(&shard->mutex);
+
+	return data;
+}
+
+/** Remove a session from the in-memory cache
+ *
+ * @param[in] cache	to remove the session from.
+ * @param[in] id	of the session.
+ * @param[in] id_len	Length of the session ID.
+ */
+static void tls_cache_mem_delete(tls_cache_t *cache, uint8_t const *id, size_t id_len)
+{
+	tls_cache_shard_t	*shard = tls_cache_shard(cache, id, id_len);
+	tls_cache_entry_t	find, *entry;
+
+	memcpy(&find.id, &id, sizeof(find.id));
+	find.id_len = id_len;
+
+	pthread_mutex_lock(&shard->mutex);
+	entry = rbtree_finddata(shard->tree, &find);
+	if (entry) tls_cache_entry_free(shard, entry);
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+static int _tls_cache_free(tls_cache_t *cache)
+{
+	int i;
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) {
+		if (cache->shards[i].heap) fr_heap_delete(cache->shards[i].heap);
+		pthread_mutex_destroy(&cache->shards[i].mutex);
+	}
+
+	return 0;
+}
+
+/** Allocate an in-memory session cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of sessions to cache.
+ * @param[in] lifetime		How long sessions may be resumed for.
+ * @return
+ *	- A new session cache.
+ *	- NULL on error.
+ */
+tls_cache_t *tls_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t lifetime)
+{
+	tls_cache_t	*cache;
+	int		i;
+
+	cache = talloc_zero(ctx, tls_cache_t);
+	if (!cache) return NULL;
+
+	cache->max_entries = (max_entries + (TLS_CACHE_SHARDS - 1)) / TLS_CACHE_SHARDS;
+	cache->lifetime = lifetime;
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) pthread_mutex_init(&cache->shards[i].mutex, NULL);
+	talloc_set_destructor(cache, _tls_cache_free);
+
+	for (i = 0; i < TLS_CACHE_SHARDS; i++) {
+		cache->shards[i].tree = rbtree_create(cache, tls_cache_entry_cmp, NULL, RBTREE_FLAG_NONE);
+		cache->shards[i].heap = fr_heap_create(tls_cache_entry_expires_cmp,
+						       offsetof(tls_cache_entry_t, heap_id));
+		if (!cache->shards[i].tree || !cache->shards[i].heap) {
+			talloc_free(cache);
+			return NULL;
+		}
+	}
+
+	return cache;
+}
+
 /** Retrieve session ID (in binary form) from the session
  *
  * @param[out] out Where to write the session ID pointer.
@@ -266,6 +490,15 @@ int tls_cache_write(REQUEST *request, tls_session_t *tls_session)
 		return 1;
 	}
 
+	if (conf->session_cache) {
+		RDEBUG2("Storing session in memory cache");
+		tls_cache_mem_write(conf->session_cache,
+				    tls_session->session_id, talloc_array_length(tls_session->session_id),
+				    tls_session->session_blob, talloc_array_length(tls_session->session_blob));
+	}
+
+	if (!conf->session_cache_server) return 0;
+
 	if (tls_cache_attrs(request, tls_session->session_id, talloc_array_length(tls_session->session_id),
 			    CACHE_ACTION_SESSION_WRITE) < 0) {
 		RWDEBUG("Failed adding session key to the request");
@@ -333,47 +566,67 @@ static SSL_SESSION *tls_cache_read(SSL *ssl,
 	REQUEST			*request;
 	unsigned char const	**p;
 	uint8_t const		*q;
+	uint8_t			*data = NULL;
+	size_t			len;
 	VALUE_PAIR		*vp;
 	SSL_SESSION		*sess;
 
 	request = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_REQUEST);
 	conf = SSL_get_ex_data(ssl, FR_TLS_EX_INDEX_CONF);
 
-	if (tls_cache_attrs(request, key, key_len, CACHE_ACTION_SESSION_READ) < 0) {
-		RWDEBUG("Failed adding session key to the request");
-		return NULL;
-	}
-
 	*copy = 0;
 
 	/*
-	 *	Call the virtual server to read the session
+	 *	Try the in-memory cache first, it's much
+	 *	cheaper than running the virtual server.
 	 */
-	switch (tls_cache_process(request, conf->session_cache_server, CACHE_ACTION_SESSION_READ)) {
-	case RLM_MODULE_OK:
-	case RLM_MODULE_UPDATED:
-		break;
+	if (conf->session_cache) data = tls_cache_mem_read(request, conf->session_cache, key, key_len);
+	if (data) {
+		RDEBUG2("Found session in memory cache");
+		q = data;
+		len = talloc_array_length(data);
+	} else {
+		if (!conf->session_cache_server) {
+			RWDEBUG("No cached session found");
+			return NULL;
+		}
 
-	default:
-		RWDEBUG("Failed acquiring session data");
-		return NULL;
-	}
+		if (tls_cache_attrs(request, key, key_len, CACHE_ACTION_SESSION_READ) < 0) {
+			RWDEBUG("Failed adding session key to the request");
+			return NULL;
+		}
 
-	vp = fr_pair_find_by_num(request->state, 0, PW_TLS_SESSION_DATA, TAG_ANY);
-	if (!vp) {
-		RWDEBUG("No cached session found");
-		return NULL;
-	}
+		/*
+		 *	Call the virtual server to read the session
+		 */
+		switch (tls_cache_process(request, conf->session_cache_server, CACHE_ACTION_SESSION_READ)) {
+		case RLM_MODULE_OK:
+		case RLM_MODULE_UPDATED:
+			break;
+
+		default:
+			RWDEBUG("Failed acquiring session data");
+			return NULL;
+		}
+
+		vp = fr_pair_find_by_num(request->state, 0, PW_TLS_SESSION_DATA, TAG_ANY);
+		if (!vp) {
+			RWDEBUG("No cached session found");
+			return NULL;
+		}
 
-	q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+		q = vp->vp_octets;	/* openssl will mutate q, so we can't use vp_octets directly */
+		len = vp->vp_length;
+	}
 	p = (unsigned char const **)&q;
 
-	sess = d2i_SSL_SESSION(NULL, p, vp->vp_length);
+	sess = d2i_SSL_SESSION(NULL, p, len);
+	talloc_free(data);
 	if (!sess) {
 		RWDEBUG("Failed loading persisted session: %s", ERR_error_string(ERR_get_error(), NULL));
 		return NULL;
 	}
-	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", vp->vp_length);
+	RDEBUG3("Read %zu bytes of session data.  Session deserialized successfully", len);
 
 	/*
 	 *	OpenSSL's API is very inconsistent.
@@ -441,6 +694,10 @@ static void tls_cache_delete(SSL_CTX *ctx, SSL_SESSION *sess)
 		return;
 	}
 
+	if (conf->session_cache) tls_cache_mem_delete(conf->session_cache, key, (size_t)key_len);
+
+	if (!conf->session_cache_server) return;
+
 	if (tls_cache_attrs(request, key, (size_t)key_len, CACHE_ACTION_SESSION_DELETE) < 0) {
 		RWDEBUG("Failed adding session key to the request");
 		goto error;
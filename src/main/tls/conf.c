@@ -43,6 +43,7 @@ static CONF_PARSER cache_config[] = {
 	{ FR_CONF_OFFSET("virtual_server", PW_TYPE_STRING, fr_tls_conf_t, session_cache_server) },
 	{ FR_CONF_OFFSET("name", PW_TYPE_STRING, fr_tls_conf_t, session_id_name) },
 	{ FR_CONF_OFFSET("lifetime", PW_TYPE_INTEGER, fr_tls_conf_t, session_cache_lifetime), .dflt = "86400" },
+	{ FR_CONF_OFFSET("size", PW_TYPE_INTEGER, fr_tls_conf_t, session_cache_size), .dflt = "0" },
 	{ FR_CONF_OFFSET("verify", PW_TYPE_BOOLEAN, fr_tls_conf_t, session_cache_verify), .dflt = "no" },
 
 #if OPENSSL_VERSION_NUMBER >= 0x10100000L
@@ -64,6 +65,14 @@ static CONF_PARSER verify_config[] = {
 };
 
 #ifdef HAVE_OPENSSL_OCSP_H
+static CONF_PARSER ocsp_cache_config[] = {
+	{ FR_CONF_OFFSET("size", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("refresh", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_refresh), .dflt = "60" },
+	{ FR_CONF_OFFSET("max_ttl", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, cache_max_ttl), .dflt = "0" },
+
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("enable", PW_TYPE_BOOLEAN, fr_tls_ocsp_conf_t, enable), .dflt = "no" },
 
@@ -75,6 +84,8 @@ static CONF_PARSER ocsp_config[] = {
 	{ FR_CONF_OFFSET("timeout", PW_TYPE_INTEGER, fr_tls_ocsp_conf_t, timeout), .dflt = "yes" },
 	{ FR_CONF_OFFSET("softfail", PW_TYPE_BOOLEAN, fr_tls_ocsp_conf_t, softfail), .dflt = "no" },
 
+	{ FR_CONF_POINTER("cache", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) ocsp_cache_config },
+
 	CONF_PARSER_TERMINATOR
 };
 #endif
@@ -274,6 +285,13 @@ static int _conf_server_free(fr_tls_conf_t *conf)
 	for (i = 0; i < conf->ctx_count; i++) SSL_CTX_free(conf->ctx[i]);
 
 #ifdef HAVE_OPENSSL_OCSP_H
+	/*
+	 *	The cache refresh threads verify responses
+	 *	using the stores, so stop them first.
+	 */
+	tls_ocsp_cache_free(&conf->ocsp);
+	tls_ocsp_cache_free(&conf->staple);
+
 	if (conf->ocsp.store) X509_STORE_free(conf->ocsp.store);
 	conf->ocsp.store = NULL;
 	if (conf->staple.store) X509_STORE_free(conf->staple.store);
@@ -332,7 +350,7 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	/*
 	 *	Setup session caching
 	 */
-	if (conf->session_cache_server) {
+	if (conf->session_cache_server || conf->session_cache_size) {
 		/*
 		 *	Create a unique context Id per EAP-TLS configuration.
 		 */
@@ -345,6 +363,14 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 		}
 	}
 
+	if (conf->session_cache_size) {
+		conf->session_cache = tls_cache_alloc(conf, conf->session_cache_size, conf->session_cache_lifetime);
+		if (!conf->session_cache) {
+			ERROR("Failed creating session cache");
+			goto error;
+		}
+	}
+
 #ifdef __APPLE__
 	if (conf_cert_admin_password(conf) < 0) goto error;
 #endif
@@ -379,11 +405,13 @@ fr_tls_conf_t *tls_conf_parse_server(CONF_SECTION *cs)
 	if (conf->ocsp.enable) {
 		conf->ocsp.store = conf_ocsp_revocation_store(conf);
 		if (conf->ocsp.store == NULL) goto error;
+		if (tls_ocsp_cache_init(conf, &conf->ocsp) < 0) goto error;
 	}
 
 	if (conf->staple.enable) {
 		conf->staple.store = conf_ocsp_revocation_store(conf);
 		if (conf->staple.store == NULL) goto error;
+		if (tls_ocsp_cache_init(conf, &conf->staple) < 0) goto error;
 	}
 #endif /*HAVE_OPENSSL_OCSP_H*/
 
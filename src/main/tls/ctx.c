@@ -465,7 +465,8 @@ post_ca:
 	/*
 	 *	Setup session caching
 	 */
-	tls_cache_init(ctx, (bool)conf->session_cache_server, conf->session_context_id, conf->session_cache_lifetime);
+	tls_cache_init(ctx, (conf->session_cache_server || conf->session_cache),
+		       conf->session_context_id, conf->session_cache_lifetime);
 
 	/*
 	 *	Load dh params
@@ -240,6 +240,561 @@ int tls_ocsp_staple_cb(SSL *ssl, void *data)
 	return ret;
 }
 
+/** Send an OCSP request to a responder and wait for the response
+ *
+ * @param[in] request	The current request.  NULL if called from the cache refresh thread.
+ * @param[in] conf	OCSP configuration.
+ * @param[in] req	to send.
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	to request from the responder.
+ * @param[in] ssl_log	BIO to write OpenSSL errors to.
+ * @return
+ *	- The OCSP response.
+ *	- NULL if no response could be retrieved.
+ */
+static OCSP_RESPONSE *ocsp_fetch(REQUEST *request, fr_tls_ocsp_conf_t const *conf, OCSP_REQUEST *req,
+				 char const *host, char const *port, char const *path, BIO *ssl_log)
+{
+	OCSP_RESPONSE	*resp = NULL;
+	BIO		*conn;
+	char		host_header[1024];
+#if OPENSSL_VERSION_NUMBER >= 0x1000003f
+	OCSP_REQ_CTX	*ctx;
+	int		rc;
+	struct timeval	when, now;
+#endif
+
+	/* Check host and port length are sane, then create Host: HTTP header */
+	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
+		ROPTIONAL(RWDEBUG, WARN, "Host and port too long");
+		return NULL;
+	}
+	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
+
+	/* Setup BIO socket to OCSP responder */
+	conn = BIO_new_connect(host);
+	if (!conn) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't create connection to OCSP responder");
+		return NULL;
+	}
+	BIO_set_conn_port(conn, port);
+
+#if OPENSSL_VERSION_NUMBER < 0x1000003f
+	BIO_do_connect(conn);
+
+	/* Send OCSP request and wait for response */
+	resp = OCSP_sendreq_bio(conn, path, req);
+	if (!resp) ROPTIONAL(REDEBUG, ERROR, "Couldn't get OCSP response");
+#else
+	if (conf->timeout) BIO_set_nbio(conn, 1);
+
+	rc = BIO_do_connect(conn);
+	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't connect to OCSP responder");
+		goto finish;
+	}
+
+	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
+	if (!ctx) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't create OCSP request");
+		goto finish;
+	}
+
+	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't set Host header");
+		goto free_ctx;
+	}
+
+	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't add data to OCSP request");
+		goto free_ctx;
+	}
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += conf->timeout;
+
+	do {
+		rc = OCSP_sendreq_nbio(&resp, ctx);
+		if (conf->timeout) {
+			gettimeofday(&now, NULL);
+			if (fr_timeval_cmp(&now, &when) >= 0) break;
+		}
+	} while ((rc == -1) && BIO_should_retry(conn));
+
+	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
+		ROPTIONAL(REDEBUG, ERROR, "Response timed out");
+		goto free_ctx;
+	}
+
+	if (rc == 0) {
+		ROPTIONAL(REDEBUG, ERROR, "Couldn't get OCSP response");
+		if (request) {
+			SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
+		} else {
+			SSL_DRAIN_ERROR_QUEUE(ERROR, "", ssl_log);
+		}
+	}
+
+free_ctx:
+	OCSP_REQ_CTX_free(ctx);
+
+finish:
+#endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
+	BIO_free_all(conn);
+
+	return resp;
+}
+
+/** Build an OCSP request for a certificate, send it, and check the nonce of the response
+ *
+ * @param[out] out	Where to write the response.  Must be freed with OCSP_RESPONSE_free().
+ * @param[in] request	The current request.  NULL if called from the cache refresh thread.
+ * @param[in] conf	OCSP configuration.
+ * @param[in] key	DER encoded CertID of the certificate to check.
+ * @param[in] key_len	Length of the CertID.
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	to request from the responder.
+ * @param[in] ssl_log	BIO to write OpenSSL errors to.
+ * @return
+ *	- OCSP_STATUS_OK if we got a response.
+ *	- OCSP_STATUS_SKIPPED if the responder couldn't be contacted.
+ *	- OCSP_STATUS_FAILED if the response had the wrong nonce.
+ */
+static ocsp_status_t ocsp_request(OCSP_RESPONSE **out, REQUEST *request, fr_tls_ocsp_conf_t const *conf,
+				  uint8_t const *key, size_t key_len,
+				  char const *host, char const *port, char const *path, BIO *ssl_log)
+{
+	OCSP_REQUEST		*req;
+	OCSP_CERTID		*certid;
+	OCSP_RESPONSE		*resp;
+	OCSP_BASICRESP		*bresp;
+	unsigned char const	*p = key;
+	ocsp_status_t		ret = OCSP_STATUS_SKIPPED;
+
+	*out = NULL;
+
+	certid = d2i_OCSP_CERTID(NULL, &p, key_len);
+	if (!certid) {
+		ROPTIONAL(REDEBUG, ERROR, "Failed decoding certificate ID");
+		return OCSP_STATUS_SKIPPED;
+	}
+
+	MEM(req = OCSP_REQUEST_new());
+	OCSP_request_add0_id(req, certid);	/* req now owns certid */
+	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+
+	resp = ocsp_fetch(request, conf, req, host, port, path, ssl_log);
+	if (!resp) goto finish;
+
+	/*
+	 *	The nonce can only be checked against the request
+	 *	it was sent with, so check it here, before the
+	 *	response is shared with anyone else.
+	 */
+	if (conf->use_nonce && (OCSP_response_status(resp) == OCSP_RESPONSE_STATUS_SUCCESSFUL)) {
+		bresp = OCSP_response_get1_basic(resp);
+		if (!bresp || (OCSP_check_nonce(req, bresp) != 1)) {
+			ROPTIONAL(REDEBUG, ERROR, "Response has wrong nonce value");
+			OCSP_BASICRESP_free(bresp);
+			OCSP_RESPONSE_free(resp);
+			ret = OCSP_STATUS_FAILED;
+			goto finish;
+		}
+		OCSP_BASICRESP_free(bresp);
+	}
+
+	*out = resp;
+	ret = OCSP_STATUS_OK;
+
+finish:
+	OCSP_REQUEST_free(req);
+
+	return ret;
+}
+
+/** A cached OCSP response
+ *
+ */
+typedef struct ocsp_cache_entry {
+	uint8_t			*key;			//!< DER encoded CertID of the certificate.
+	size_t			key_len;		//!< Length of the CertID.
+
+	char			*host;			//!< Responder to fetch new responses from.
+	char			*port;
+	char			*path;
+
+	uint8_t			*der;			//!< DER encoded response.  NULL until the first
+							//!< fetch completes.
+	size_t			der_len;		//!< Length of the response.
+
+	time_t			expires;		//!< When the response must no longer be used.
+	time_t			refresh;		//!< When to fetch a new response.
+	int			heap_id;		//!< Position in the refresh heap.  -1 whilst
+							//!< a fetch is in progress.
+
+	bool			used;			//!< Whether the response has been used since
+							//!< it was fetched.
+	bool			fetching;		//!< Whether a new response is being fetched.
+} ocsp_cache_entry_t;
+
+/** OCSP responses shared between all worker threads
+ *
+ */
+struct tls_ocsp_cache {
+	fr_tls_ocsp_conf_t	*conf;			//!< Configuration the cache was created for.
+
+	pthread_mutex_t		mutex;			//!< Protects everything below.
+	pthread_cond_t		fetched;		//!< Signalled whenever a fetch completes.
+	pthread_cond_t		wakeup;			//!< Signalled to wake the refresh thread.
+
+	rbtree_t		*tree;			//!< Entries keyed by CertID.
+	fr_heap_t		*heap;			//!< Entries not being fetched, ordered by refresh time.
+
+	pthread_t		refresher;		//!< Fetches new responses before the old ones expire.
+	bool			running;		//!< Whether the refresh thread was started.
+	bool			stop;			//!< Tell the refresh thread to exit.
+};
+
+static int ocsp_cache_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+static int ocsp_cache_heap_cmp(void const *one, void const *two)
+{
+	ocsp_cache_entry_t const *a = one, *b = two;
+
+	if (a->refresh < b->refresh) return -1;
+	if (a->refresh > b->refresh) return +1;
+
+	return 0;
+}
+
+/** Remove an entry from the cache and free it
+ *
+ * @note Must be called with the cache mutex held.
+ */
+static void ocsp_cache_entry_free(tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry)
+{
+	if (entry->heap_id >= 0) fr_heap_extract(cache->heap, entry);
+	rbtree_deletebydata(cache->tree, entry);
+	talloc_free(entry);
+}
+
+/** Add a new entry to the cache, evicting the entry due to be refreshed soonest if the cache is full
+ *
+ * @note Must be called with the cache mutex held.
+ *
+ * @return
+ *	- The new entry.
+ *	- NULL if the cache is full of entries being fetched.
+ */
+static ocsp_cache_entry_t *ocsp_cache_entry_alloc(tls_ocsp_cache_t *cache, uint8_t const *key, size_t key_len,
+						  char const *host, char const *port, char const *path)
+{
+	ocsp_cache_entry_t *entry;
+
+	if (rbtree_num_elements(cache->tree) >= cache->conf->cache_size) {
+		entry = fr_heap_peek(cache->heap);
+		if (!entry) return NULL;
+
+		ocsp_cache_entry_free(cache, entry);
+	}
+
+	MEM(entry = talloc_zero(cache, ocsp_cache_entry_t));
+	MEM(entry->key = talloc_memdup(entry, key, key_len));
+	entry->key_len = key_len;
+	MEM(entry->host = talloc_typed_strdup(entry, host));
+	MEM(entry->port = talloc_typed_strdup(entry, port));
+	MEM(entry->path = talloc_typed_strdup(entry, path));
+	entry->heap_id = -1;
+
+	if (!rbtree_insert(cache->tree, entry)) {
+		talloc_free(entry);
+		return NULL;
+	}
+
+	return entry;
+}
+
+/** Determine how long a response may be cached for
+ *
+ * Only responses which are signed by a trusted responder and contain a
+ * status for the certificate are cached.  The response is cached until
+ * its nextUpdate time, or for max_ttl seconds, whichever is sooner.
+ *
+ * @return
+ *	- The time the response expires.
+ *	- 0 if the response should not be cached.
+ */
+static time_t ocsp_cache_expires(fr_tls_ocsp_conf_t const *conf, OCSP_RESPONSE *resp,
+				 uint8_t const *key, size_t key_len, time_t now)
+{
+	OCSP_BASICRESP		*bresp;
+	OCSP_CERTID		*certid = NULL;
+	ASN1_GENERALIZEDTIME	*next_update = NULL;
+	unsigned char const	*p = key;
+	int			status;
+	time_t			expires = 0;
+
+	if (OCSP_response_status(resp) != OCSP_RESPONSE_STATUS_SUCCESSFUL) return 0;
+
+	bresp = OCSP_response_get1_basic(resp);
+	if (!bresp) return 0;
+
+	if (OCSP_basic_verify(bresp, NULL, conf->store, 0) != 1) goto finish;
+
+	certid = d2i_OCSP_CERTID(NULL, &p, key_len);
+	if (!certid || !OCSP_resp_find_status(bresp, certid, &status, NULL, NULL, NULL, &next_update)) goto finish;
+
+	if (next_update) {
+		if (tls_utils_asn1time_to_epoch(&expires, next_update) < 0) {
+			expires = 0;
+			goto finish;
+		}
+		if (conf->cache_max_ttl && (expires > (time_t)(now + conf->cache_max_ttl))) {
+			expires = now + conf->cache_max_ttl;
+		}
+	} else if (conf->cache_max_ttl) {
+		expires = now + conf->cache_max_ttl;
+	}
+
+	if (expires <= now) expires = 0;
+
+finish:
+	OCSP_CERTID_free(certid);
+	OCSP_BASICRESP_free(bresp);
+	ERR_clear_error();	/* Errors are reported when the response is verified */
+
+	return expires;
+}
+
+/** Store the result of a fetch, and wake up anyone waiting for it
+ *
+ * If no usable response was retrieved, the previous response is served
+ * until it expires.
+ *
+ * @param[in] cache	the entry belongs to.
+ * @param[in] entry	that was being fetched.
+ * @param[in] resp	that was retrieved, may be NULL.
+ */
+static void ocsp_cache_update(tls_ocsp_cache_t *cache, ocsp_cache_entry_t *entry, OCSP_RESPONSE *resp)
+{
+	fr_tls_ocsp_conf_t const	*conf = cache->conf;
+	time_t				now = time(NULL);
+	time_t				expires = 0;
+	int				len = 0;
+	uint8_t				*p;
+
+	/*
+	 *	Entries being fetched can't be evicted, and the
+	 *	key is never modified, so this is safe without
+	 *	the mutex.
+	 */
+	if (resp) expires = ocsp_cache_expires(conf, resp, entry->key, entry->key_len, now);
+	if (expires) {
+		len = i2d_OCSP_RESPONSE(resp, NULL);
+		if (len <= 0) expires = 0;
+	}
+
+	pthread_mutex_lock(&cache->mutex);
+	entry->fetching = false;
+
+	if (expires) {
+		talloc_free(entry->der);
+		MEM(p = entry->der = talloc_array(entry, uint8_t, len));
+		entry->der_len = i2d_OCSP_RESPONSE(resp, &p);
+		entry->expires = expires;
+		entry->refresh = expires - conf->cache_refresh;
+		if (entry->refresh <= now) entry->refresh = expires;
+		entry->used = false;
+
+		fr_heap_insert(cache->heap, entry);
+	} else if (entry->der && (entry->expires > now)) {
+		entry->refresh = entry->expires;
+		fr_heap_insert(cache->heap, entry);
+	} else {
+		rbtree_deletebydata(cache->tree, entry);
+		talloc_free(entry);
+	}
+
+	pthread_cond_broadcast(&cache->fetched);
+	pthread_cond_signal(&cache->wakeup);
+	pthread_mutex_unlock(&cache->mutex);
+}
+
+/** Fetch new responses for entries that are still in use, before they expire
+ *
+ * Entries that haven't been used since they were last fetched are evicted
+ * instead, so that the refresh thread doesn't keep querying the responder
+ * about certificates nobody is presenting.
+ */
+static void *ocsp_cache_refresh(void *arg)
+{
+	tls_ocsp_cache_t	*cache = arg;
+	ocsp_cache_entry_t	*entry;
+	OCSP_RESPONSE		*resp;
+	BIO			*ssl_log;
+	struct timespec		ts;
+
+	ssl_log = BIO_new(BIO_s_mem());
+
+	pthread_mutex_lock(&cache->mutex);
+	while (!cache->stop) {
+		entry = fr_heap_peek(cache->heap);
+		if (!entry) {
+			pthread_cond_wait(&cache->wakeup, &cache->mutex);
+			continue;
+		}
+
+		if (entry->refresh > time(NULL)) {
+			ts.tv_sec = entry->refresh;
+			ts.tv_nsec = 0;
+			pthread_cond_timedwait(&cache->wakeup, &cache->mutex, &ts);
+			continue;
+		}
+
+		if (!entry->used) {
+			DEBUG3("Evicting unused response from \"http://%s:%s%s\"", entry->host, entry->port, entry->path);
+			ocsp_cache_entry_free(cache, entry);
+			continue;
+		}
+
+		fr_heap_extract(cache->heap, entry);
+		entry->fetching = true;
+		pthread_mutex_unlock(&cache->mutex);
+
+		DEBUG2("Refreshing response from \"http://%s:%s%s\"", entry->host, entry->port, entry->path);
+		ocsp_request(&resp, NULL, cache->conf, entry->key, entry->key_len,
+			     entry->host, entry->port, entry->path, ssl_log);
+		ocsp_cache_update(cache, entry, resp);
+		OCSP_RESPONSE_free(resp);
+		ERR_clear_error();
+
+		pthread_mutex_lock(&cache->mutex);
+	}
+	pthread_mutex_unlock(&cache->mutex);
+
+	BIO_free(ssl_log);
+
+	return NULL;
+}
+
+/** Get a response for a certificate from the cache, or fetch one from the responder
+ *
+ * If another thread is already fetching a response for the same certificate
+ * we wait for it to complete, instead of sending a duplicate request.
+ *
+ * @param[out] out	Where to write the response.  Must be freed with OCSP_RESPONSE_free().
+ * @param[in] request	The current request.
+ * @param[in] cache	to search.
+ * @param[in] key	DER encoded CertID of the certificate to check.
+ * @param[in] key_len	Length of the CertID.
+ * @param[in] host	of the responder.
+ * @param[in] port	of the responder.
+ * @param[in] path	to request from the responder.
+ * @param[in] ssl_log	BIO to write OpenSSL errors to.
+ * @return
+ *	- OCSP_STATUS_OK if we got a response.
+ *	- OCSP_STATUS_SKIPPED if the responder couldn't be contacted.
+ *	- OCSP_STATUS_FAILED if the response had the wrong nonce.
+ */
+static ocsp_status_t ocsp_cache_find(OCSP_RESPONSE **out, REQUEST *request, tls_ocsp_cache_t *cache,
+				     uint8_t const *key, size_t key_len,
+				     char const *host, char const *port, char const *path, BIO *ssl_log)
+{
+	fr_tls_ocsp_conf_t const	*conf = cache->conf;
+	ocsp_cache_entry_t		find, *entry;
+	OCSP_RESPONSE			*resp;
+	ocsp_status_t			ret;
+	struct timespec			ts = { .tv_sec = time(NULL) + conf->timeout + 1 };
+	bool				waited = false;
+	time_t				now;
+
+	*out = NULL;
+
+	memcpy(&find.key, &key, sizeof(find.key));
+	find.key_len = key_len;
+
+	pthread_mutex_lock(&cache->mutex);
+	for (;;) {
+		now = time(NULL);
+
+		entry = rbtree_finddata(cache->tree, &find);
+		if (!entry) break;
+
+		if (entry->der && (entry->expires > now)) {
+			unsigned char const	*p = entry->der;
+			time_t			ttl = entry->expires - now;
+
+			resp = d2i_OCSP_RESPONSE(NULL, &p, entry->der_len);
+			entry->used = true;
+			pthread_mutex_unlock(&cache->mutex);
+
+			if (!resp) {
+				REDEBUG("Failed parsing cached OCSP response");
+				return OCSP_STATUS_SKIPPED;
+			}
+
+			RDEBUG2("Found cached OCSP response, expires in %" PRIu64 " seconds", (uint64_t)ttl);
+			*out = resp;
+
+			return OCSP_STATUS_OK;
+		}
+
+		if (!entry->fetching) break;
+
+		/*
+		 *	Someone else is already asking the responder
+		 *	about this certificate.  Wait for their answer.
+		 */
+		RDEBUG2("Waiting for in progress OCSP request");
+		if (conf->timeout) {
+			if (pthread_cond_timedwait(&cache->fetched, &cache->mutex, &ts) == ETIMEDOUT) {
+				pthread_mutex_unlock(&cache->mutex);
+				REDEBUG("Timed out waiting for in progress OCSP request");
+				return OCSP_STATUS_SKIPPED;
+			}
+		} else {
+			pthread_cond_wait(&cache->fetched, &cache->mutex);
+		}
+		waited = true;
+	}
+
+	/*
+	 *	The request we were waiting on failed.  Don't
+	 *	retry, or every thread would take its turn
+	 *	waiting for a responder that's down.
+	 */
+	if (waited) {
+		pthread_mutex_unlock(&cache->mutex);
+		REDEBUG("In progress OCSP request failed");
+		return OCSP_STATUS_SKIPPED;
+	}
+
+	if (!entry) {
+		entry = ocsp_cache_entry_alloc(cache, key, key_len, host, port, path);
+	} else if (entry->heap_id >= 0) {
+		fr_heap_extract(cache->heap, entry);
+	}
+	if (entry) entry->fetching = true;
+	pthread_mutex_unlock(&cache->mutex);
+
+	ret = ocsp_request(&resp, request, conf, key, key_len, host, port, path, ssl_log);
+	if (entry) ocsp_cache_update(cache, entry, resp);
+
+	*out = resp;
+
+	return ret;
+}
+
 /** Sends a OCSP request to a defined OCSP responder
  *
  */
@@ -247,27 +802,22 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		   X509_STORE *store, X509 *issuer_cert, X509 *client_cert,
 		   fr_tls_ocsp_conf_t *conf, bool staple_response)
 {
-	OCSP_CERTID	*certid;
-	OCSP_REQUEST	*req = NULL;
+	OCSP_CERTID	*certid = NULL;
 	OCSP_RESPONSE	*resp = NULL;
 	OCSP_BASICRESP	*bresp = NULL;
+	uint8_t		*key = NULL, *p;
+	int		key_len;
 	char		*host = NULL;
 	char		*port = NULL;
 	char		*path = NULL;
-	char		host_header[1024];
 	int		use_ssl = -1;
 	long		this_fudge = OCSP_MAX_VALIDITY_PERIOD, this_max_age = -1;
-	BIO		*conn = NULL, *ssl_log = NULL;
+	BIO		*ssl_log = NULL;
 	ocsp_status_t   ocsp_status = OCSP_STATUS_FAILED;
 	ocsp_status_t	status;
 	ASN1_GENERALIZEDTIME *rev, *this_update, *next_update;
 	int		reason;
-#if OPENSSL_VERSION_NUMBER >= 0x1000003f
-	OCSP_REQ_CTX	*ctx;
-	int		rc;
-	struct timeval	when;
-#endif
-	struct timeval	now = { 0, 0 };
+	struct timeval	now;
 	time_t		next;
 	VALUE_PAIR	*vp;
 
@@ -342,12 +892,22 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	}
 
 	/*
-	 *	Create OCSP Request
+	 *	Identify the certificate we're checking.  The DER
+	 *	encoded CertID is also the key for the response cache.
 	 */
 	certid = OCSP_cert_to_id(NULL, client_cert, issuer_cert);
-	req = OCSP_REQUEST_new();
-	OCSP_request_add0_id(req, certid);
-	if (conf->use_nonce) OCSP_request_add1_nonce(req, NULL, 8);
+	if (!certid) {
+		REDEBUG("Failed creating OCSP certificate ID");
+		goto skipped;
+	}
+
+	key_len = i2d_OCSP_CERTID(certid, NULL);
+	if (key_len <= 0) {
+		REDEBUG("Failed serialising OCSP certificate ID");
+		goto skipped;
+	}
+	MEM(p = key = talloc_array(request, uint8_t, key_len));
+	i2d_OCSP_CERTID(certid, &p);
 
 	/*
 	 *	Send OCSP Request and get OCSP Response
@@ -372,7 +932,7 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		switch (ret) {
 		case -1:
 			RWDEBUG("Invalid URL in certificate.  Not doing OCSP");
-			break;
+			goto skipped;
 
 		case 0:
 			if (conf->url) {
@@ -390,82 +950,14 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 
 	RDEBUG2("Using responder URL \"http://%s:%s%s\"", host, port, path);
 
-	/* Check host and port length are sane, then create Host: HTTP header */
-	if ((strlen(host) + strlen(port) + 2) > sizeof(host_header)) {
-		RWDEBUG("Host and port too long");
-		goto skipped;
-	}
-	snprintf(host_header, sizeof(host_header), "%s:%s", host, port);
-
-	/* Setup BIO socket to OCSP responder */
-	conn = BIO_new_connect(host);
-	BIO_set_conn_port(conn, port);
-
-#if OPENSSL_VERSION_NUMBER < 0x1000003f
-	BIO_do_connect(conn);
-
-	/* Send OCSP request and wait for response */
-	resp = OCSP_sendreq_bio(conn, path, req);
-	if (!resp) {
-		REDEBUG("Couldn't get OCSP response");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-#else
-	if (conf->timeout) BIO_set_nbio(conn, 1);
-
-	rc = BIO_do_connect(conn);
-	if ((rc <= 0) && ((!conf->timeout) || !BIO_should_retry(conn))) {
-		REDEBUG("Couldn't connect to OCSP responder");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	ctx = OCSP_sendreq_new(conn, path, NULL, -1);
-	if (!ctx) {
-		REDEBUG("Couldn't create OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_add1_header(ctx, "Host", host_header)) {
-		REDEBUG("Couldn't set Host header");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	if (!OCSP_REQ_CTX_set1_req(ctx, req)) {
-		REDEBUG("Couldn't add data to OCSP request");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-
-	gettimeofday(&when, NULL);
-	when.tv_sec += conf->timeout;
-
-	do {
-		rc = OCSP_sendreq_nbio(&resp, ctx);
-		if (conf->timeout) {
-			gettimeofday(&now, NULL);
-			if (fr_timeval_cmp(&now, &when) >= 0) break;
-		}
-	} while ((rc == -1) && BIO_should_retry(conn));
-
-	if (conf->timeout && (rc == -1) && BIO_should_retry(conn)) {
-		REDEBUG("Response timed out");
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
+	if (conf->cache) {
+		ocsp_status = ocsp_cache_find(&resp, request, conf->cache, key, key_len, host, port, path, ssl_log);
+	} else {
+		ocsp_status = ocsp_request(&resp, request, conf, key, key_len, host, port, path, ssl_log);
 	}
+	if (!resp) goto finish;
 
-	OCSP_REQ_CTX_free(ctx);
-
-	if (rc == 0) {
-		REDEBUG("Couldn't get OCSP response");
-		SSL_DRAIN_ERROR_QUEUE(REDEBUG, "", ssl_log);
-		ocsp_status = OCSP_STATUS_SKIPPED;
-		goto finish;
-	}
-#endif /* OPENSSL_VERSION_NUMBER < 0x1000003f */
+	ocsp_status = OCSP_STATUS_FAILED;
 
 	/* Verify OCSP response status */
 	status = OCSP_response_status(resp);
@@ -474,10 +966,6 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 		goto finish;
 	}
 	bresp = OCSP_response_get1_basic(resp);
-	if (conf->use_nonce && OCSP_check_nonce(req, bresp) != 1) {
-		REDEBUG("Response has wrong nonce value");
-		goto finish;
-	}
 	if (OCSP_basic_verify(bresp, NULL, store, 0) != 1){
 		REDEBUG("Couldn't verify OCSP basic response");
 		goto finish;
@@ -535,11 +1023,7 @@ int tls_ocsp_check(REQUEST *request, SSL *ssl,
 	 *	next_update is NULL.
 	 */
 	if (next_update) {
-		/*
-		 *	Sometimes we already know what 'now' is depending
-		 *	on the code path, other times we don't.
-		 */
-		if (now.tv_sec == 0) gettimeofday(&now, NULL);
+		gettimeofday(&now, NULL);
 		if (tls_utils_asn1time_to_epoch(&next, next_update) < 0) {
 			RPEDEBUG("Failed parsing next_update time");
 			ocsp_status = OCSP_STATUS_SKIPPED;
@@ -651,16 +1135,88 @@ finish:
 	}
 
 	/* Free OCSP Stuff */
-	OCSP_REQUEST_free(req);
+	OCSP_CERTID_free(certid);
+	talloc_free(key);
 	OCSP_BASICRESP_free(bresp);
 	OCSP_RESPONSE_free(resp);
 	OPENSSL_free(host);
 	OPENSSL_free(port);
 	OPENSSL_free(path);
-	BIO_free_all(conn);
 	BIO_free(ssl_log);
 
 	return ocsp_status;
 }
+
+static int _ocsp_cache_free(tls_ocsp_cache_t *cache)
+{
+	if (cache->running) {
+		pthread_mutex_lock(&cache->mutex);
+		cache->stop = true;
+		pthread_cond_signal(&cache->wakeup);
+		pthread_mutex_unlock(&cache->mutex);
+
+		pthread_join(cache->refresher, NULL);
+	}
+
+	if (cache->heap) fr_heap_delete(cache->heap);
+
+	pthread_cond_destroy(&cache->wakeup);
+	pthread_cond_destroy(&cache->fetched);
+	pthread_mutex_destroy(&cache->mutex);
+
+	return 0;
+}
+
+/** Create the OCSP response cache for an OCSP configuration, and start its refresh thread
+ *
+ * @param[in] ctx	to allocate the cache in.
+ * @param[in] conf	to create the cache for.  Nothing is done if the cache is disabled.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int tls_ocsp_cache_init(TALLOC_CTX *ctx, fr_tls_ocsp_conf_t *conf)
+{
+	tls_ocsp_cache_t	*cache;
+	int			ret;
+
+	if (!conf->cache_size) return 0;
+
+	MEM(cache = talloc_zero(ctx, tls_ocsp_cache_t));
+	cache->conf = conf;
+
+	pthread_mutex_init(&cache->mutex, NULL);
+	pthread_cond_init(&cache->fetched, NULL);
+	pthread_cond_init(&cache->wakeup, NULL);
+	talloc_set_destructor(cache, _ocsp_cache_free);
+
+	cache->tree = rbtree_create(cache, ocsp_cache_cmp, NULL, RBTREE_FLAG_NONE);
+	cache->heap = fr_heap_create(ocsp_cache_heap_cmp, offsetof(ocsp_cache_entry_t, heap_id));
+	if (!cache->tree || !cache->heap) {
+		ERROR("Failed creating OCSP response cache");
+	error:
+		talloc_free(cache);
+		return -1;
+	}
+
+	ret = pthread_create(&cache->refresher, NULL, ocsp_cache_refresh, cache);
+	if (ret != 0) {
+		ERROR("Failed starting OCSP cache refresh thread: %s", fr_syserror(ret));
+		goto error;
+	}
+	cache->running = true;
+	conf->cache = cache;
+
+	return 0;
+}
+
+/** Stop the refresh thread and free all cached responses
+ *
+ * Must be called before the OCSP store is freed.
+ */
+void tls_ocsp_cache_free(fr_tls_ocsp_conf_t *conf)
+{
+	TALLOC_FREE(conf->cache);
+}
 #endif /* HAVE_OPENSSL_OCSP_H */
 #endif /* WITH_TLS */
@@ -56,12 +56,87 @@ static char const *cert_attr_names[8][2] = {
 #define FR_TLS_SAN_DNS          (6)
 #define FR_TLS_SAN_UPN          (7)
 
+/** Smallest buffer we allocate for a record
+ *
+ * Most records in the tunnel (inner EAP packets, acks) are much smaller than
+ * FR_TLS_MAX_RECORD_SIZE, handshake messages are larger, so buffers grow in
+ * powers of two from here.
+ */
+#define FR_TLS_MIN_RECORD_SIZE	1024
+
+/** Scratch buffer to read decrypted data into, before it's copied into a record
+ *
+ * We don't know how much data SSL_read will return, so rather than sizing every
+ * clean_out record to the maximum, we read into a buffer shared by all sessions
+ * being processed by the thread.
+ */
+fr_thread_local_setup(uint8_t *, tls_record_scratch)	/* macro */
+
+static void _tls_record_scratch_free(void *arg)
+{
+	talloc_free(arg);
+}
+
+/** Return the thread's scratch buffer, allocating it if needed
+ *
+ * @return a buffer of FR_TLS_MAX_RECORD_SIZE bytes, or NULL on error.
+ */
+static uint8_t *record_scratch(void)
+{
+	uint8_t *scratch;
+
+	scratch = tls_record_scratch;
+	if (!scratch) {
+		scratch = talloc_array(NULL, uint8_t, FR_TLS_MAX_RECORD_SIZE);
+		if (!scratch) return NULL;
+
+		fr_thread_local_set_destructor(tls_record_scratch, _tls_record_scratch_free, scratch);
+	}
+
+	return scratch;
+}
+
+/** Ensure a record buffer can hold a given amount of data
+ *
+ * Callers which write into record->data directly (e.g. reading from a socket)
+ * must reserve the space first, and write at most the amount returned, starting
+ * at record->data + record->used.
+ *
+ * @param[in] record	buffer to grow.
+ * @param[in] len	Total amount of data the buffer must hold.  Capped at FR_TLS_MAX_RECORD_SIZE.
+ * @return the amount of space available in the buffer (which may be less than requested).
+ */
+size_t tls_session_record_reserve(tls_record_t *record, size_t len)
+{
+	size_t	size;
+	uint8_t	*data;
+
+	if (len > FR_TLS_MAX_RECORD_SIZE) len = FR_TLS_MAX_RECORD_SIZE;
+	if (len <= record->size) return record->size - record->used;
+
+	size = record->size ? record->size : FR_TLS_MIN_RECORD_SIZE;
+	while (size < len) size <<= 1;
+	if (size > FR_TLS_MAX_RECORD_SIZE) size = FR_TLS_MAX_RECORD_SIZE;
+
+	data = talloc_realloc(NULL, record->data, uint8_t, size);
+	if (!data) return record->size - record->used;
+
+	record->data = data;
+	record->size = size;
+
+	return record->size - record->used;
+}
+
 /** Clear a record buffer
+ *
+ * The buffer is released, and will be allocated again when data is next written.
  *
  * @param record buffer to clear.
  */
 inline static void record_init(tls_record_t *record)
 {
+	TALLOC_FREE(record->data);
+	record->size = 0;
 	record->used = 0;
 }
 
@@ -71,7 +146,7 @@ inline static void record_init(tls_record_t *record)
  */
 inline static void record_close(tls_record_t *record)
 {
-	record->used = 0;
+	record_init(record);
 }
 
 /** Copy data to the intermediate buffer, before we send it somewhere
@@ -83,8 +158,9 @@ inline static void record_close(tls_record_t *record)
  */
 inline static unsigned int record_from_buff(tls_record_t *record, void const *in, unsigned int inlen)
 {
-	unsigned int added = FR_TLS_MAX_RECORD_SIZE - record->used;
+	unsigned int added;
 
+	added = tls_session_record_reserve(record, record->used + inlen);
 	if (added > inlen) added = inlen;
 	if (added == 0) return 0;
 
@@ -95,6 +171,8 @@ inline static unsigned int record_from_buff(tls_record_t *record, void const *in
 }
 
 /** Take data from the buffer, and give it to the caller
+ *
+ * Once all the data has been taken, the buffer is released.
  *
  * @param[in] record	buffer to read from.
  * @param[out] out	where to write data from record buffer.
@@ -110,15 +188,96 @@ inline static unsigned int record_to_buff(tls_record_t *record, void *out, unsig
 	if (out) memcpy(out, record->data, taken);
 
 	record->used -= taken;
+	if (record->used == 0) {
+		record_init(record);
+		return taken;
+	}
 
 	/*
 	 *	This is pretty bad...
 	 */
-	if (record->used > 0) memmove(record->data, record->data + taken, record->used);
+	memmove(record->data, record->data + taken, record->used);
 
 	return taken;
 }
 
+/** Read (and decrypt) application data from OpenSSL into a record
+ *
+ * @param[in] request	The current request.
+ * @param[in] session	to read from.
+ * @param[in] record	to append the data to.
+ * @param[out] ret	the result of SSL_read.
+ * @return
+ *	- 0 if SSL_read was called, and any data it returned was added to the record.
+ *	- -1 if the data could not be stored.  Decrypted data may have been lost.
+ */
+static int record_from_ssl(REQUEST *request, tls_session_t *session, tls_record_t *record, int *ret)
+{
+	uint8_t	*scratch;
+	size_t	room;
+
+	scratch = record_scratch();
+	if (!scratch) {
+		REDEBUG("Failed allocating buffer for decrypted data");
+		return -1;
+	}
+
+	room = FR_TLS_MAX_RECORD_SIZE - record->used;
+	if (room == 0) {
+		REDEBUG("No room left for decrypted data");
+		return -1;
+	}
+
+	*ret = SSL_read(session->ssl, scratch, room);
+	if (*ret <= 0) return 0;
+
+	if (record_from_buff(record, scratch, *ret) != (unsigned int) *ret) {
+		REDEBUG("Failed allocating %i bytes for decrypted data", *ret);
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Read encrypted data from the BIO into a record
+ *
+ * The record is sized to the amount of data OpenSSL has pending.
+ *
+ * @param[in] session	to read from.
+ * @param[in] record	to write the data to.  Should be empty.
+ * @return the result of BIO_read.
+ */
+static int record_from_bio(tls_session_t *session, tls_record_t *record)
+{
+	size_t	pending;
+	int	ret;
+
+	pending = BIO_ctrl_pending(session->from_ssl);
+	if (pending == 0) pending = FR_TLS_MAX_RECORD_SIZE;
+
+	record->used = 0;
+	if (tls_session_record_reserve(record, pending) == 0) return -1;
+
+	ret = BIO_read(session->from_ssl, record->data, record->size);
+	if (ret > 0) {
+		record->used = ret;
+	} else {
+		record_init(record);
+	}
+
+	return ret;
+}
+
+/** Return the amount of memory used by a session's record buffers
+ *
+ * @param[in] session	to check.
+ * @return the number of bytes allocated to the clean_in, clean_out, dirty_in and dirty_out records.
+ */
+size_t tls_session_record_mem(tls_session_t const *session)
+{
+	return session->clean_in.size + session->clean_out.size + session->dirty_in.size + session->dirty_out.size;
+}
+
 /** Return the static private key password we have configured
  *
  * @param[out] buf	Where to write the password to.
@@ -1120,7 +1279,7 @@ int tls_session_recv(REQUEST *request, tls_session_t *session)
 	 *      SSL session, and put it into the decrypted
 	 *      data buffer.
 	 */
-	ret = SSL_read(session->ssl, session->clean_out.data, sizeof(session->clean_out.data));
+	if (record_from_ssl(request, session, &session->clean_out, &ret) < 0) return -1;
 	if (ret < 0) {
 		int code;
 
@@ -1145,11 +1304,6 @@ int tls_session_recv(REQUEST *request, tls_session_t *session)
 
 	if (ret == 0) RWDEBUG("No data inside of the tunnel");
 
-	/*
-	 *	Passed all checks, successfully decrypted data
-	 */
-	session->clean_out.used = ret;
-
 	RDEBUG2("Decrypted TLS application data (%zu bytes)", session->clean_out.used);
 	radlog_request_hex(L_DBG, L_DBG_LVL_3, request, session->clean_out.data, session->clean_out.used);
 
@@ -1195,11 +1349,8 @@ int tls_session_send(REQUEST *request, tls_session_t *session)
 		record_to_buff(&session->clean_in, NULL, ret);
 
 		/* Get the dirty data from Bio to send it */
-		ret = BIO_read(session->from_ssl, session->dirty_out.data,
-			       sizeof(session->dirty_out.data));
-		if (ret > 0) {
-			session->dirty_out.used = ret;
-		} else {
+		ret = record_from_bio(session, &session->dirty_out);
+		if (ret <= 0) {
 			if (!tls_log_io_error(request, session, ret, "Failed in SSL_write")) return 0;
 		}
 	}
@@ -1285,12 +1436,8 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 	 *	If acting as a server SSL_set_accept_state must have
 	 *	been called before this function.
 	 */
-	ret = SSL_read(session->ssl, session->clean_out.data + session->clean_out.used,
-		       sizeof(session->clean_out.data) - session->clean_out.used);
-	if (ret > 0) {
-		session->clean_out.used += ret;
-		return 1;
-	}
+	if (record_from_ssl(request, session, &session->clean_out, &ret) < 0) return 0;
+	if (ret > 0) return 1;
 	if (!tls_log_io_error(request, session, ret, "Failed in SSL_read")) return 0;
 
 	/*
@@ -1370,16 +1517,14 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 	 */
 	ret = BIO_ctrl_pending(session->from_ssl);
 	if (ret > 0) {
-		ret = BIO_read(session->from_ssl, session->dirty_out.data,
-			       sizeof(session->dirty_out.data));
-		if (ret > 0) {
-			session->dirty_out.used = ret;
-		} else if (BIO_should_retry(session->from_ssl)) {
-			record_init(&session->dirty_in);
-			RDEBUG2("Asking for more data in tunnel");
-			return 1;
+		ret = record_from_bio(session, &session->dirty_out);
+		if (ret <= 0) {
+			if (BIO_should_retry(session->from_ssl)) {
+				record_init(&session->dirty_in);
+				RDEBUG2("Asking for more data in tunnel");
+				return 1;
+			}
 
-		} else {
 			tls_log_error(NULL, NULL);
 			record_init(&session->dirty_in);
 			return 0;
@@ -1401,6 +1546,12 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 		 */
 		session->info.content_type = SSL3_RT_ALERT;
 
+		session->dirty_out.used = 0;
+		if (tls_session_record_reserve(&session->dirty_out, 7) < 7) {
+			REDEBUG("Failed allocating alert record");
+			return 0;
+		}
+
 		session->dirty_out.data[0] = session->info.content_type;
 		session->dirty_out.data[1] = 3;
 		session->dirty_out.data[2] = 1;
@@ -1416,6 +1567,9 @@ int tls_session_handshake(REQUEST *request, tls_session_t *session)
 
 	/* We are done with dirty_in, reinitialize it */
 	record_init(&session->dirty_in);
+
+	RDEBUG4("TLS record buffers using %zu bytes", tls_session_record_mem(session));
+
 	return 1;
 }
 
@@ -1434,6 +1588,11 @@ static int _tls_session_free(tls_session_t *session)
 		session->ssl = NULL;
 	}
 
+	record_close(&session->clean_in);
+	record_close(&session->clean_out);
+	record_close(&session->dirty_in);
+	record_close(&session->dirty_out);
+
 	return 0;
 }
 
@@ -1688,7 +1847,9 @@ tls_session_t *tls_session_init_server(TALLOC_CTX *ctx, fr_tls_conf_t *conf, REQ
 		session->mtu = vp->vp_integer;
 	}
 
-	if (conf->session_cache_server) session->allow_session_resumption = true; /* otherwise it's false */
+	if (conf->session_cache_server || conf->session_cache) {
+		session->allow_session_resumption = true; /* otherwise it's false */
+	}
 
 	return session;
 }
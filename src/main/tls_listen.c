@@ -79,7 +79,7 @@ static int CC_HINT(nonnull) tls_socket_write(rad_listen_t *listener, REQUEST *re
 		p += rcode;
 	}
 
-	sock->tls_session->dirty_out.used = 0;
+	sock->tls_session->record_init(&sock->tls_session->dirty_out);
 
 	return 1;
 }
@@ -88,6 +88,7 @@ static int tls_socket_recv(rad_listen_t *listener)
 {
 	bool doing_init = false;
 	ssize_t rcode;
+	size_t room;
 	RADIUS_PACKET *packet;
 	REQUEST *request;
 	listen_socket_t *sock = listener->data;
@@ -150,9 +151,19 @@ static int tls_socket_recv(rad_listen_t *listener)
 
 	RDEBUG3("Reading from socket %d", request->packet->sockfd);
 	pthread_mutex_lock(&sock->mutex);
+
+	/*
+	 *	The record buffer is allocated on demand, so make
+	 *	room for a full record before reading into it.
+	 */
+	room = tls_session_record_reserve(&sock->tls_session->dirty_in, FR_TLS_MAX_RECORD_SIZE);
+	if (room == 0) {
+		RDEBUG("Failed allocating TLS record buffer");
+		goto do_close;
+	}
+
 	rcode = read(request->packet->sockfd,
-		     sock->tls_session->dirty_in.data,
-		     sizeof(sock->tls_session->dirty_in.data));
+		     sock->tls_session->dirty_in.data + sock->tls_session->dirty_in.used, room);
 	if ((rcode < 0) && (errno == ECONNRESET)) {
 	do_close:
 		pthread_mutex_unlock(&sock->mutex);
@@ -172,7 +183,7 @@ static int tls_socket_recv(rad_listen_t *listener)
 	 */
 	if (rcode == 0) goto do_close;
 
-	sock->tls_session->dirty_in.used = rcode;
+	sock->tls_session->dirty_in.used += rcode;
 
 	RDEBUG2("Encrypted TLS data in (%zu bytes)", sock->tls_session->dirty_in.used);
 	radlog_request_hex(L_DBG, L_DBG_LVL_3,
@@ -839,29 +839,9 @@ static void process_file(fr_dict_t *dict, const char *root_dir, char const *file
 				}
 			}
 
-			{
-				uint8_t const *end, *option_p;
-
-				option_p = attr;
-				end = option_p + len;
-
-				fr_pair_cursor_init(&cursor, &head);
-
-				/*
-				 *	Loop over all the options data
-				 */
-				while (option_p < end) {
-					vp = NULL;
-					my_len = fr_dhcp_decode_option(NULL, &cursor,
-								       fr_dict_root(fr_dict_internal), option_p,
-								       end - option_p, NULL);
-					if (my_len <= 0) {
-						fr_pair_list_free(&head);
-						break;
-					}
-					option_p += my_len;
-				}
-			}
+			fr_pair_cursor_init(&cursor, &head);
+			my_len = fr_dhcp_decode_options(NULL, &cursor, attr, len);
+			if (my_len < 0) fr_pair_list_free(&head);
 
 			/*
 			 *	Output may be an error, and we ignore
@@ -890,6 +870,85 @@ static void process_file(fr_dict_t *dict, const char *root_dir, char const *file
 			continue;
 		}
 
+		/*
+		 *	Decode a whole packet, optionally many times, and
+		 *	say how long it took.
+		 */
+		if ((strncmp(p, "decode-dhcp-packet ", 19) == 0) ||
+		    (strncmp(p, "bench-decode-dhcp ", 18) == 0)) {
+			vp_cursor_t	cursor;
+			RADIUS_PACKET	*packet;
+			unsigned long	count = 1, j;
+			struct timeval	start, end;
+			uint64_t	usec;
+
+			if (*p == 'b') {
+				char *q;
+
+				count = strtoul(p + 18, &q, 10);
+				if (!count || (*q != ' ')) {
+					fprintf(stderr, "Invalid count at line %d of %s\n", lineno, directory);
+					exit(1);
+				}
+				p = q + 1;
+			} else {
+				p += 19;
+			}
+
+			if (strcmp(p, "-") == 0) {
+				attr = data;
+				len = data_len;
+			} else {
+				attr = data;
+				len = encode_hex(p, data, sizeof(data));
+				if (len == 0) {
+					fprintf(stderr, "Failed decoding hex string at line %d of %s\n", lineno, directory);
+					exit(1);
+				}
+				data_len = len;
+			}
+
+			packet = talloc_zero(NULL, RADIUS_PACKET);
+			packet->data = attr;
+			packet->data_len = len;
+
+			gettimeofday(&start, NULL);
+			for (j = 0; j < count; j++) {
+				fr_pair_list_free(&packet->vps);
+				if (fr_dhcp_decode(packet) < 0) break;
+			}
+			gettimeofday(&end, NULL);
+
+			if (j < count) {
+				strlcpy(output, fr_strerror(), sizeof(output));
+				talloc_free(packet);
+				continue;
+			}
+
+			if (count > 1) {
+				usec = ((end.tv_sec - start.tv_sec) * (uint64_t) 1000000) + (end.tv_usec - start.tv_usec);
+				if (!usec) usec = 1;
+				printf("%s[%d]: %lu decodes, %" PRIu64 " packets/s\n", filename, lineno,
+				       count, (count * (uint64_t) 1000000) / usec);
+			}
+
+			fr_pair_cursor_init(&cursor, &packet->vps);
+			p = output;
+			*output = '\0';
+			for (vp = fr_pair_cursor_first(&cursor); vp; vp = fr_pair_cursor_next(&cursor)) {
+				fr_pair_snprint(p, sizeof(output) - (p - output), vp);
+				p += strlen(p);
+
+				if (vp->next) {
+					strcpy(p, ", ");
+					p += 2;
+				}
+			}
+
+			talloc_free(packet);
+			continue;
+		}
+
 #ifdef WITH_TACACS
 		/*
 		 *	And some TACACS tests
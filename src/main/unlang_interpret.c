@@ -845,10 +845,10 @@ static unlang_action_t unlang_module_call(REQUEST *request, unlang_stack_t *stac
 		return UNLANG_ACTION_STOP_PROCESSING;
 	}
 
-	if (*presult == RLM_MODULE_YIELD) {
+	if (request->rcode == RLM_MODULE_YIELD) {
 		frame->modcall.thread->active_callers++;
 	} else {
-		*priority = instruction->actions[*presult];
+		*priority = instruction->actions[request->rcode];
 	}
 
 done:
@@ -977,7 +977,7 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 	request->module = sp->module_instance->name;
 
 	safe_lock(sp->module_instance);
-	*presult = mr->callback(request, mr->module.module_instance->data, mr->thread->data, mutable);
+	request->rcode = mr->callback(request, mr->module.module_instance->data, mr->thread->data, mutable);
 	safe_unlock(sp->module_instance);
 
 	request->module = NULL;
@@ -994,9 +994,13 @@ static unlang_action_t unlang_resumption(REQUEST *request, unlang_stack_t *stack
 		return UNLANG_ACTION_STOP_PROCESSING;
 	}
 
-	if (*presult != RLM_MODULE_YIELD) {
+	/*
+	 *	The module may yield again, in which case the
+	 *	same callback is called when it's next resumed.
+	 */
+	if (request->rcode != RLM_MODULE_YIELD) {
 		frame->modcall.thread->active_callers--;
-		*priority = instruction->actions[*presult];
+		*priority = instruction->actions[request->rcode];
 	}
 
 	*presult = request->rcode;
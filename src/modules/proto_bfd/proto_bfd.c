@@ -61,6 +61,52 @@ typedef enum bfd_auth_type_t {
 
 #define BFD_AUTH_INVALID (BFD_AUTH_MET_KEYED_SHA1 + 1)
 
+/*
+ *	When sessions are multiplexed onto a small number of event
+ *	loops, their timers are kept in a hashed timing wheel.  Every
+ *	session re-arms its timers once per interval, and wheel
+ *	insertions and deletions are O(1).  Timers are rounded up to
+ *	the next tick, so they never fire early.
+ */
+#define BFD_WHEEL_TICK		(5000)		/* usec */
+#define BFD_WHEEL_SLOTS		(2048)		/* ~10s worth of ticks, must be a power of 2 */
+#define BFD_WHEEL_MASK		(BFD_WHEEL_SLOTS - 1)
+
+#define BFD_MAX_THREADS		(256)
+
+typedef struct bfd_timer_t bfd_timer_t;
+
+struct bfd_timer_t {
+	bfd_timer_t		*prev;
+	bfd_timer_t		*next;		//!< NULL if the timer isn't armed.
+	uint64_t		when;		//!< Tick the timer fires on.
+	fr_event_callback_t	callback;
+	void			*ctx;
+};
+
+typedef enum bfd_timer_id_t {
+	BFD_TIMER_PACKET = 0,
+	BFD_TIMER_TIMEOUT,
+	BFD_TIMER_MAX
+} bfd_timer_id_t;
+
+/*
+ *	A thread, and event loop, shared by many sessions.
+ */
+typedef struct bfd_shard_t {
+	int			id;
+	fr_event_list_t		*el;
+	int			pipefd[2];
+	pthread_t		pthread_id;
+	bool			running;	//!< Thread has been created, and not yet joined.
+
+	struct timeval		start;		//!< Time of tick 0.
+	uint64_t		tick;		//!< Next tick to process.
+	uint32_t		num_timers;	//!< Armed timers in the wheel.
+	fr_event_timer_t	*ev_tick;
+	bfd_timer_t		slots[BFD_WHEEL_SLOTS];
+} bfd_shard_t;
+
 typedef struct bfd_state_t {
 	int		number;
 	int		sockfd;
@@ -73,6 +119,8 @@ typedef struct bfd_state_t {
 	int		pipefd[2];
 	pthread_t	pthread_id;
 
+	bfd_shard_t	*shard;		//!< NULL if the session has its own thread.
+
 	bfd_auth_type_t auth_type;
 	uint8_t		secret[BFD_MAX_SECRET_LENGTH];
 	size_t		secret_len;
@@ -88,8 +136,8 @@ typedef struct bfd_state_t {
 	struct sockaddr_storage remote_sockaddr;
 	socklen_t	salen;
 
-	fr_event_timer_t	*ev_timeout;
-	fr_event_timer_t	*ev_packet;
+	fr_event_timer_t	*ev[BFD_TIMER_MAX];		//!< Timers if the session has its own event list.
+	bfd_timer_t		timer[BFD_TIMER_MAX];	//!< Timers if the session is in a shard.
 	struct timeval	last_recv;
 	struct timeval	next_recv;
 	struct timeval	last_sent;
@@ -204,6 +252,16 @@ typedef struct bfd_packet_t {
 	bfd_auth_t	auth;
 } __attribute__ ((packed)) bfd_packet_t;
 
+/*
+ *	Sent from the listener to a shard.  Small enough that writes
+ *	to the pipe are atomic.  A NULL session tells the shard
+ *	thread to exit.
+ */
+typedef struct bfd_shard_msg_t {
+	bfd_state_t	*session;
+	bfd_packet_t	bfd;
+} bfd_shard_msg_t;
+
 
 typedef struct bfd_socket_t {
 	fr_ipaddr_t	my_ipaddr;
@@ -225,6 +283,9 @@ typedef struct bfd_socket_t {
 	size_t		secret_len;
 
 	rbtree_t	*session_tree;
+
+	uint32_t	num_shards;		//!< 0 for a thread per session.
+	bfd_shard_t	*shards;
 } bfd_socket_t;
 
 static int bfd_start_packets(bfd_state_t *session);
@@ -365,6 +426,357 @@ static int bfd_pthread_create(bfd_state_t *session)
 	return 1;
 }
 
+static int64_t bfd_wheel_usec(bfd_shard_t const *shard, struct timeval const *when)
+{
+	return ((int64_t) (when->tv_sec - shard->start.tv_sec) * USEC) + (when->tv_usec - shard->start.tv_usec);
+}
+
+static void bfd_wheel_link(bfd_shard_t *shard, bfd_timer_t *timer)
+{
+	bfd_timer_t *head = &shard->slots[timer->when & BFD_WHEEL_MASK];
+
+	timer->next = head;
+	timer->prev = head->prev;
+	head->prev->next = timer;
+	head->prev = timer;
+}
+
+static void bfd_wheel_unlink(bfd_shard_t *shard, bfd_timer_t *timer)
+{
+	timer->prev->next = timer->next;
+	timer->next->prev = timer->prev;
+	timer->next = timer->prev = NULL;
+
+	shard->num_timers--;
+}
+
+static void bfd_wheel_tick(UNUSED fr_event_list_t *xel, struct timeval *now, void *ctx);
+
+/*
+ *	The wheel only wakes up the event loop when it has timers.
+ */
+static void bfd_wheel_schedule(bfd_shard_t *shard)
+{
+	struct timeval when;
+	uint64_t usec;
+
+	if (shard->ev_tick || !shard->num_timers) return;
+
+	usec = shard->tick * BFD_WHEEL_TICK;
+	when.tv_sec = shard->start.tv_sec + (usec / USEC);
+	when.tv_usec = shard->start.tv_usec + (usec % USEC);
+	if (when.tv_usec >= USEC) {
+		when.tv_sec++;
+		when.tv_usec -= USEC;
+	}
+
+	if (fr_event_timer_insert(shard->el, bfd_wheel_tick, shard, &when, &shard->ev_tick) < 0) {
+		rad_assert("Failed to insert event" == NULL);
+	}
+}
+
+static void bfd_wheel_insert(bfd_shard_t *shard, bfd_timer_t *timer,
+			     fr_event_callback_t callback, void *ctx, struct timeval const *when)
+{
+	int64_t usec;
+
+	if (timer->next) bfd_wheel_unlink(shard, timer);
+
+	/*
+	 *	The wheel has been idle, skip the ticks we slept
+	 *	through.
+	 */
+	if (!shard->num_timers) {
+		struct timeval now;
+
+		gettimeofday(&now, NULL);
+		usec = bfd_wheel_usec(shard, &now);
+		if ((usec > 0) && ((uint64_t) (usec / BFD_WHEEL_TICK) > shard->tick)) {
+			shard->tick = usec / BFD_WHEEL_TICK;
+		}
+	}
+
+	usec = bfd_wheel_usec(shard, when);
+	timer->when = (usec > 0) ? (usec + BFD_WHEEL_TICK - 1) / BFD_WHEEL_TICK : 0;
+	if (timer->when < shard->tick) timer->when = shard->tick;
+
+	timer->callback = callback;
+	timer->ctx = ctx;
+
+	bfd_wheel_link(shard, timer);
+	shard->num_timers++;
+
+	bfd_wheel_schedule(shard);
+}
+
+/*
+ *	Run all of the timers which are due.
+ */
+static void bfd_wheel_tick(UNUSED fr_event_list_t *xel, struct timeval *now, void *ctx)
+{
+	bfd_shard_t *shard = ctx;
+	int64_t usec;
+	uint64_t current;
+
+	usec = bfd_wheel_usec(shard, now);
+	current = (usec > 0) ? usec / BFD_WHEEL_TICK : 0;
+
+	while (shard->tick <= current) {
+		bfd_timer_t *head = &shard->slots[shard->tick & BFD_WHEEL_MASK];
+		bfd_timer_t pending;
+		uint64_t tick;
+
+		/*
+		 *	Timers re-armed by the callbacks always go
+		 *	into a later tick.
+		 */
+		tick = shard->tick++;
+
+		if (head->next == head) continue;
+
+		/*
+		 *	Move the slot to a private list, so that the
+		 *	callbacks can add and remove timers whilst we
+		 *	walk it.
+		 */
+		pending.next = head->next;
+		pending.prev = head->prev;
+		pending.next->prev = &pending;
+		pending.prev->next = &pending;
+		head->next = head->prev = head;
+
+		while (pending.next != &pending) {
+			bfd_timer_t *timer = pending.next;
+
+			/*
+			 *	Not due until a later trip around the
+			 *	wheel.
+			 */
+			if (timer->when > tick) {
+				pending.next = timer->next;
+				timer->next->prev = &pending;
+				bfd_wheel_link(shard, timer);
+				continue;
+			}
+
+			bfd_wheel_unlink(shard, timer);
+			timer->callback(shard->el, now, timer->ctx);
+		}
+	}
+
+	bfd_wheel_schedule(shard);
+}
+
+/*
+ *	Read batches of packets for the sessions in this shard.
+ */
+static void bfd_shard_recv(UNUSED fr_event_list_t *xel, int fd, void *ctx)
+{
+	bfd_shard_t *shard = ctx;
+	bfd_shard_msg_t msg[64];
+	ssize_t num;
+	size_t i;
+
+	num = read(fd, msg, sizeof(msg));
+	if (num < 0) {
+		if ((errno == EAGAIN) || (errno == EINTR)) return;
+
+		ERROR("BFD shard %d failed reading from pipe: %s", shard->id, fr_syserror(errno));
+		return;
+	}
+
+	/*
+	 *	Each message was written atomically, so we only ever
+	 *	see whole ones.
+	 */
+	rad_assert((num % sizeof(msg[0])) == 0);
+
+	for (i = 0; i < (num / sizeof(msg[0])); i++) {
+		if (!msg[i].session) {
+			fr_event_loop_exit(shard->el, 1);
+			return;
+		}
+
+		bfd_process(msg[i].session, &msg[i].bfd);
+	}
+}
+
+static void *bfd_shard_thread(void *ctx)
+{
+	bfd_shard_t *shard = ctx;
+
+	DEBUG("BFD shard %d starting thread", shard->id);
+
+	fr_event_loop(shard->el);
+
+	return NULL;
+}
+
+static int bfd_shards_alloc(bfd_socket_t *sock)
+{
+	uint32_t i, j;
+
+	sock->shards = talloc_zero_array(sock, bfd_shard_t, sock->num_shards);
+	if (!sock->shards) return -1;
+
+	for (i = 0; i < sock->num_shards; i++) {
+		bfd_shard_t *shard = &sock->shards[i];
+
+		shard->id = i;
+		shard->pipefd[0] = shard->pipefd[1] = -1;
+		for (j = 0; j < BFD_WHEEL_SLOTS; j++) {
+			shard->slots[j].next = shard->slots[j].prev = &shard->slots[j];
+		}
+		gettimeofday(&shard->start, NULL);
+
+		if (pipe(shard->pipefd) < 0) {
+			ERROR("Failed opening pipe: %s", fr_syserror(errno));
+			return -1;
+		}
+
+#ifdef O_NONBLOCK
+		fcntl(shard->pipefd[0], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+		fcntl(shard->pipefd[1], F_SETFL, O_NONBLOCK | FD_CLOEXEC);
+#endif
+
+		shard->el = fr_event_list_alloc(sock->shards, NULL, NULL);
+		if (!shard->el) {
+			ERROR("Failed creating event list");
+			return -1;
+		}
+
+		if (fr_event_fd_insert(shard->el, shard->pipefd[0], bfd_shard_recv, NULL, NULL, shard) < 0) {
+			PERROR("Failed inserting file descriptor into event list");
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Start the shard threads, once their sessions have been
+ *	created.
+ */
+static int bfd_shards_start(bfd_socket_t *sock)
+{
+	int rcode;
+	uint32_t i;
+
+	for (i = 0; i < sock->num_shards; i++) {
+		rcode = pthread_create(&sock->shards[i].pthread_id, NULL,
+				       bfd_shard_thread, &sock->shards[i]);
+		if (rcode != 0) {
+			ERROR("Thread create failed: %s", fr_syserror(rcode));
+			return -1;
+		}
+		sock->shards[i].running = true;
+	}
+
+	return 0;
+}
+
+/*
+ *	Tell the shard threads to exit, and wait for them.  The
+ *	message goes through the same pipe as the packets, so it
+ *	can't be lost if a thread hasn't reached its event loop yet.
+ */
+static void bfd_shards_stop(bfd_socket_t *sock)
+{
+	uint32_t i;
+
+	for (i = 0; i < sock->num_shards; i++) {
+		bfd_shard_t *shard = &sock->shards[i];
+		bfd_shard_msg_t msg;
+		ssize_t rcode;
+
+		if (!shard->running) continue;
+
+		memset(&msg, 0, sizeof(msg));
+		for (;;) {
+			rcode = write(shard->pipefd[1], &msg, sizeof(msg));
+			if (rcode >= 0) break;
+
+			if (errno == EINTR) continue;
+
+			/*
+			 *	The pipe is full of packets, give
+			 *	the thread a chance to read them.
+			 */
+			if (errno == EAGAIN) {
+				usleep(1000);
+				continue;
+			}
+
+			ERROR("BFD shard %d failed writing to pipe: %s", shard->id, fr_syserror(errno));
+			break;
+		}
+
+		pthread_join(shard->pthread_id, NULL);
+		shard->running = false;
+	}
+}
+
+/*
+ *	Stop the shard threads before anything they use is freed.
+ *	The sessions unlink their timers from the shard wheels, so
+ *	they have to go before the shards.
+ */
+static int _bfd_socket_free(bfd_socket_t *sock)
+{
+	uint32_t i;
+
+	if (!sock->shards) return 0;
+
+	bfd_shards_stop(sock);
+
+	TALLOC_FREE(sock->session_tree);
+
+	for (i = 0; i < sock->num_shards; i++) {
+		bfd_shard_t *shard = &sock->shards[i];
+
+		if (shard->pipefd[0] >= 0) close(shard->pipefd[0]);
+		if (shard->pipefd[1] >= 0) close(shard->pipefd[1]);
+	}
+	TALLOC_FREE(sock->shards);
+
+	return 0;
+}
+
+/*
+ *	Session timers go into the shard's wheel, or the session's own
+ *	event list.
+ */
+static void bfd_timer_insert(bfd_state_t *session, bfd_timer_id_t id,
+			     fr_event_callback_t callback, struct timeval *when)
+{
+	if (session->shard) {
+		bfd_wheel_insert(session->shard, &session->timer[id], callback, session, when);
+		return;
+	}
+
+	if (fr_event_timer_insert(session->el, callback, session, when, &session->ev[id]) < 0) {
+		rad_assert("Failed to insert event" == NULL);
+	}
+}
+
+static void bfd_timer_delete(bfd_state_t *session, bfd_timer_id_t id)
+{
+	if (session->shard) {
+		if (session->timer[id].next) bfd_wheel_unlink(session->shard, &session->timer[id]);
+		return;
+	}
+
+	fr_event_timer_delete(session->el, &session->ev[id]);
+}
+
+static bool bfd_timer_active(bfd_state_t *session, bfd_timer_id_t id)
+{
+	if (session->shard) return (session->timer[id].next != NULL);
+
+	return (session->ev[id] != NULL);
+}
+
 static const char *bfd_state[] = {
 	"admin-down",
 	"down",
@@ -408,7 +820,16 @@ static void bfd_session_free(void *ctx)
 {
 	bfd_state_t *session = ctx;
 
-	if (el != session->el) {
+	/*
+	 *	The shard thread has been stopped, so nothing else
+	 *	is looking at the wheel.
+	 */
+	if (session->shard) {
+		int i;
+
+		for (i = 0; i < BFD_TIMER_MAX; i++) bfd_timer_delete(session, i);
+
+	} else if (el != session->el) {
 		/*
 		 *	FIXME: this isn't particularly safe.
 		 */
@@ -580,6 +1001,19 @@ static bfd_state_t *bfd_new_session(bfd_socket_t *sock, int sockfd,
 
 		session->pipefd[0] = session->pipefd[1] = -1;
 		session->pthread_id = pthread_self();
+
+	} else if (sock->shards) {
+		session->shard = &sock->shards[session->number % sock->num_shards];
+		session->el = session->shard->el;
+
+		session->pipefd[0] = session->pipefd[1] = -1;
+
+		/*
+		 *	The shard threads haven't been started yet,
+		 *	so it's safe to use their event lists.
+		 */
+		bfd_start_control(session);
+
 	} else {
 		if (!bfd_pthread_create(session)) {
 			rbtree_deletebydata(sock->session_tree, session);
@@ -889,7 +1323,7 @@ static int bfd_start_packets(bfd_state_t *session)
 	/*
 	 *	Reset the timers.
 	 */
-	fr_event_timer_delete(session->el, &session->ev_packet);
+	bfd_timer_delete(session, BFD_TIMER_PACKET);
 
 	gettimeofday(&session->last_sent, NULL);
 	now = session->last_sent;
@@ -924,10 +1358,7 @@ static int bfd_start_packets(bfd_state_t *session)
 		now.tv_usec -= USEC;
 	}
 
-	if (fr_event_timer_insert(session->el, bfd_send_packet, session, &now,
-			    &session->ev_packet) < 0) {
-		rad_assert("Failed to insert event" == NULL);
-	}
+	bfd_timer_insert(session, BFD_TIMER_PACKET, bfd_send_packet, &now);
 
 	return 0;
 }
@@ -937,7 +1368,7 @@ static void bfd_set_timeout(bfd_state_t *session, struct timeval *when)
 {
 	struct timeval now = *when;
 
-	fr_event_timer_delete(session->el, &session->ev_timeout);
+	bfd_timer_delete(session, BFD_TIMER_TIMEOUT);
 
 	if (session->detection_time >= USEC) {
 		now.tv_sec += session->detection_time / USEC;
@@ -965,10 +1396,7 @@ static void bfd_set_timeout(bfd_state_t *session, struct timeval *when)
 		}
 	}
 
-	if (fr_event_timer_insert(session->el, bfd_detection_timeout, session, &now,
-			     &session->ev_timeout) < 0) {
-		rad_assert("Failed to insert event" == NULL);
-	}
+	bfd_timer_insert(session, BFD_TIMER_TIMEOUT, bfd_detection_timeout, &now);
 }
 
 
@@ -991,15 +1419,15 @@ static int bfd_start_control(bfd_state_t *session)
 
 	bfd_set_timeout(session, &session->last_recv);
 
-	if (session->ev_packet) return 0;
+	if (bfd_timer_active(session, BFD_TIMER_PACKET)) return 0;
 
 	return bfd_start_packets(session);
 }
 
 static int bfd_stop_control(bfd_state_t *session)
 {
-	fr_event_timer_delete(session->el, &session->ev_timeout);
-	fr_event_timer_delete(session->el, &session->ev_packet);
+	bfd_timer_delete(session, BFD_TIMER_TIMEOUT);
+	bfd_timer_delete(session, BFD_TIMER_PACKET);
 	return 1;
 }
 
@@ -1044,8 +1472,8 @@ static int bfd_stop_poll(bfd_state_t *session)
 	 *	re-set the timers.
 	 */
 	if (!session->remote_demand_mode) {
-		rad_assert(session->ev_timeout != NULL);
-		rad_assert(session->ev_packet != NULL);
+		rad_assert(bfd_timer_active(session, BFD_TIMER_TIMEOUT));
+		rad_assert(bfd_timer_active(session, BFD_TIMER_PACKET));
 		session->doing_poll = 0;
 
 		bfd_stop_control(session);
@@ -1499,6 +1927,28 @@ static int bfd_socket_recv(rad_listen_t *listener)
 		return 0;
 	}
 
+	/*
+	 *	Hand the packet to the thread which owns the session.
+	 *	If it's too busy to keep up, drop the packet, as BFD
+	 *	does for any other congestion.
+	 */
+	if (session->shard) {
+		bfd_shard_msg_t msg;
+
+		msg.session = session;
+		msg.bfd = bfd;
+
+		do {
+			rcode = write(session->shard->pipefd[1], &msg, sizeof(msg));
+		} while ((rcode < 0) && (errno == EINTR));
+
+		if (rcode < 0) {
+			DEBUG("BFD %d - shard %d is busy, dropping packet",
+			      session->number, session->shard->id);
+		}
+		return 0;
+	}
+
 	if (!el) {
 		uint8_t *p = (uint8_t *) &bfd;
 		size_t total = bfd.length;
@@ -1673,6 +2123,7 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	cf_pair_parse(sock, cs, "max_timeouts", FR_ITEM_POINTER(PW_TYPE_INTEGER, &sock->max_timeouts), "3", T_BARE_WORD);
 	cf_pair_parse(sock, cs, "demand", FR_ITEM_POINTER(PW_TYPE_BOOLEAN, &sock->demand), "no", T_DOUBLE_QUOTED_STRING);
 	cf_pair_parse(NULL, cs, "auth_type", FR_ITEM_POINTER(PW_TYPE_STRING, &auth_type_str), NULL, T_INVALID);
+	cf_pair_parse(sock, cs, "threads", FR_ITEM_POINTER(PW_TYPE_INTEGER, &sock->num_shards), "0", T_BARE_WORD);
 
 	if (!this->server) {
 		cf_pair_parse(sock, cs, "server", FR_ITEM_POINTER(PW_TYPE_STRING, &sock->server), NULL, T_INVALID);
@@ -1689,6 +2140,8 @@ static int bfd_socket_parse(CONF_SECTION *cs, rad_listen_t *this)
 	if (sock->max_timeouts == 0) sock->max_timeouts = 1;
 	if (sock->max_timeouts > 10) sock->max_timeouts = 10;
 
+	if (sock->num_shards > BFD_MAX_THREADS) sock->num_shards = BFD_MAX_THREADS;
+
 	sock->auth_type = fr_str2int(auth_types, auth_type_str, BFD_AUTH_INVALID);
 	if (sock->auth_type == BFD_AUTH_INVALID) {
 		ERROR("Unknown auth_type '%s'", auth_type_str);
@@ -1763,6 +2216,18 @@ static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 		return -1;
 	}
 
+	/*
+	 *	Sessions are assigned to shards as they're created.
+	 */
+	if (!el && sock->num_shards) {
+		talloc_set_destructor(sock, _bfd_socket_free);
+
+		if (bfd_shards_alloc(sock) < 0) {
+			ERROR("Failed creating BFD threads");
+			exit(1);
+		}
+	}
+
 	/*
 	 *	Bootstrap the initial set of connections.
 	 */
@@ -1770,6 +2235,10 @@ static int bfd_socket_open(CONF_SECTION *cs, rad_listen_t *this)
 		exit(1);
 	}
 
+	if (sock->shards && (bfd_shards_start(sock) < 0)) {
+		exit(1);
+	}
+
 	return 0;
 }
 
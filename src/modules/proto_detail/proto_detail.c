@@ -40,7 +40,15 @@ RCSID("$Id$")
 
 #include <pthread.h>
 
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
 #include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
 
 #define USEC (1000000)
 
@@ -59,6 +67,111 @@ static FR_NAME_NUMBER state_names[] = {
 	{ NULL, 0 }
 };
 
+/** A record which has been sent to the server, and not yet completed
+ *
+ */
+typedef struct detail_slot_t {
+	bool			used;			//!< Slot holds a record.
+	detail_entry_state_t	state;			//!< STATE_RUNNING, STATE_NO_REPLY or STATE_REPLIED.
+	RADIUS_PACKET		*packet;		//!< Packet the server is processing.  Only used to
+							//!< match replies with the slot.
+	VALUE_PAIR		*vps;			//!< Attributes read from the file.
+	off_t			timestamp_offset;	//!< Where to mark the record as done.
+	time_t			timestamp;		//!< When the record was written.
+	fr_ipaddr_t		client_ip;		//!< Original client.
+	int			tries;			//!< How many times the record has been sent.
+	time_t			running;		//!< When it was last sent.
+} detail_slot_t;
+
+/** One of the threads replaying a part of the current detail file
+ *
+ */
+typedef struct detail_reader_t {
+	detail_replay_t		*replay;		//!< Shared replay state.
+	listen_detail_t		*cursor;		//!< This reader's position in the file.
+	uint32_t		index;			//!< Number of this reader.
+	pthread_t		pthread_id;
+	int			ack_pipe[2];		//!< Wakes up the reader when a record completes.
+
+	pthread_mutex_t		mutex;			//!< Protects the slot states.
+	detail_slot_t		*slots;			//!< Records in flight.
+	uint32_t		outstanding;		//!< Number of slots in use.
+} detail_reader_t;
+
+/** Parallel replay of detail files
+ *
+ * The first reader opens each detail file, and splits it into ranges
+ * which start on record boundaries.  Every reader then sends records
+ * from its own range, with up to max_outstanding records in flight.
+ * The file is only removed once every reader has finished its range
+ * and all of their records have completed.
+ */
+struct detail_replay_t {
+	listen_detail_t		*data;			//!< Listener configuration.
+	pthread_mutex_t		mutex;			//!< Protects generation and finished.
+	pthread_cond_t		cond;
+	uint32_t		generation;		//!< Incremented when a new file is split.
+	uint32_t		finished;		//!< Readers done with the current file.
+	atomic_bool		stop;			//!< Readers should exit.  Set with mutex held,
+							//!< so waiters on cond see it, but read without.
+
+	detail_reader_t		*readers;
+	uint32_t		num_readers;
+};
+
+static void detail_replay_stop(listen_detail_t *data);
+
+static inline bool detail_replay_stopping(detail_replay_t *replay)
+{
+	return atomic_load_explicit(&replay->stop, memory_order_acquire);
+}
+
+/*
+ *	Recover the counter used to generate the packet's ID, ports
+ *	and destination address.
+ */
+static uint32_t detail_packet_counter(RADIUS_PACKET const *packet)
+{
+	return packet->id |
+		(((packet->src_port - 1024) & 0xff) << 8) |
+		(((packet->dst_port - 1024) & 0xff) << 16) |
+		((ntohl(packet->dst_ipaddr.ipaddr.ip4addr.s_addr) & 0xff) << 24);
+}
+
+/*
+ *	Tell the reader which sent a packet what happened to it.
+ */
+static void detail_replay_ack(listen_detail_t *data, RADIUS_PACKET *packet, detail_entry_state_t state)
+{
+	detail_replay_t	*replay = data->replay;
+	detail_reader_t	*reader;
+	detail_slot_t	*slot;
+	uint32_t	counter;
+	char		c = 0;
+
+	counter = detail_packet_counter(packet);
+	if (counter >= (replay->num_readers * data->max_outstanding)) return;
+
+	reader = &replay->readers[counter / data->max_outstanding];
+	slot = &reader->slots[counter % data->max_outstanding];
+
+	/*
+	 *	A late reply to a packet which has since been
+	 *	re-sent.  Wait for the reply to the new one.
+	 */
+	pthread_mutex_lock(&reader->mutex);
+	if (!slot->used || (slot->packet != packet)) {
+		pthread_mutex_unlock(&reader->mutex);
+		return;
+	}
+	slot->state = state;
+	slot->packet = NULL;
+	pthread_mutex_unlock(&reader->mutex);
+
+	if (write(reader->ack_pipe[1], &c, 1) < 0) {
+		ERROR("detail (%s): Failed writing ack to reader thread: %s", data->name, fr_syserror(errno));
+	}
+}
 
 /*
  *	If we're limiting outstanding packets, then mark the response
@@ -72,6 +185,17 @@ static int detail_send(rad_listen_t *listener, REQUEST *request)
 	rad_assert(request->listener == listener);
 	rad_assert(listener->send == detail_send);
 
+	if (data->replay) {
+		if (request->reply->code == 0) {
+			RDEBUG("detail (%s): No response to request.  Will retry in %d seconds",
+			       data->name, data->retry_interval);
+			detail_replay_ack(data, request->packet, STATE_NO_REPLY);
+		} else {
+			detail_replay_ack(data, request->packet, STATE_REPLIED);
+		}
+		return 0;
+	}
+
 	/*
 	 *	This request timed out.  Remember that, and tell the
 	 *	caller it's OK to read more "detail" file stuff.
@@ -177,10 +301,9 @@ static int detail_send(rad_listen_t *listener, REQUEST *request)
  *	FIXME: create it, if it's not already there, so that the main
  *	server select() will wake us up if there's anything to read.
  */
-static int detail_open(rad_listen_t *this)
+static int detail_open(listen_detail_t *data)
 {
 	struct stat st;
-	listen_detail_t *data = this->data;
 
 	rad_assert(data->file_state == STATE_UNOPENED);
 	data->delay_time = USEC;
@@ -284,6 +407,7 @@ static int detail_open(rad_listen_t *this)
 
 	data->client_ip.af = AF_UNSPEC;
 	data->timestamp = 0;
+	data->binary = false;
 	data->offset = data->last_offset = data->timestamp_offset = 0;
 	data->packets = 0;
 	data->tries = 0;
@@ -335,11 +459,23 @@ static int detail_recv(rad_listen_t *listener)
 		break;
 
 	default:
+		if (data->replay) {
+			detail_replay_ack(data, packet, STATE_REPLIED);
+			fr_radius_free(&packet);
+			return 0;
+		}
+
 		data->entry_state = STATE_REPLIED;
 		goto signal_thread;
 	}
 
 	if (!request_receive(NULL, listener, packet, &data->detail_client, fun)) {
+		if (data->replay) {
+			detail_replay_ack(data, packet, STATE_NO_REPLY);
+			fr_radius_free(&packet);
+			return 0;
+		}
+
 		data->entry_state = STATE_NO_REPLY;	/* try again later */
 
 	signal_thread:
@@ -356,21 +492,282 @@ static int detail_recv(rad_listen_t *listener)
 	return 0;
 }
 
-static RADIUS_PACKET *detail_poll(rad_listen_t *listener)
+/*
+ *	Map a binary detail file, or extend the mapping if the file
+ *	has grown since it was last mapped.
+ */
+static int detail_binary_map(listen_detail_t *data)
+{
+	struct stat	buf;
+	void		*map;
+
+	if (fstat(data->work_fd, &buf) < 0) {
+		ERROR("detail (%s): Failed to stat detail file: %s",
+		      data->name, fr_syserror(errno));
+		return -1;
+	}
+
+	if ((size_t) buf.st_size <= data->map_len) return 0;
+
+	map = mmap(NULL, buf.st_size, PROT_READ, MAP_SHARED, data->work_fd, 0);
+	if (map == MAP_FAILED) {
+		ERROR("detail (%s): Failed mapping detail file: %s",
+		      data->name, fr_syserror(errno));
+		return -1;
+	}
+
+#ifdef MADV_SEQUENTIAL
+	(void) madvise(map, buf.st_size, MADV_SEQUENTIAL);
+#endif
+
+	if (data->map) munmap(data->map, data->map_len);
+	data->map = map;
+	data->map_len = buf.st_size;
+
+	return 0;
+}
+
+static void detail_binary_unmap(listen_detail_t *data)
+{
+	if (!data->map) return;
+
+	munmap(data->map, data->map_len);
+	data->map = NULL;
+	data->map_len = 0;
+}
+
+/*
+ *	Skip a record with a bad header, by looking for the magic
+ *	at the start of the next one.  If there isn't one, skip to
+ *	the end of the file.
+ */
+static void detail_binary_resync(listen_detail_t *data)
+{
+	off_t	start = data->offset;
+	off_t	offset;
+
+	for (offset = start + 1;
+	     (size_t) offset + DETAIL_BINARY_MAGIC_LEN <= data->map_len;
+	     offset++) {
+		if (memcmp(data->map + offset, DETAIL_BINARY_MAGIC, DETAIL_BINARY_MAGIC_LEN) == 0) break;
+	}
+	if ((size_t) offset + DETAIL_BINARY_MAGIC_LEN > data->map_len) offset = data->map_len;
+
+	ERROR("detail (%s): Skipped %zu bytes at offset %zu of %s", data->name,
+	      (size_t) (offset - start), (size_t) start, data->filename_work);
+
+	data->offset = offset;
+}
+
+/*
+ *	Read the next record from a binary detail file.
+ *
+ *	On success the entry state is STATE_QUEUED.  If the record
+ *	is incomplete, the entry state is left alone, and the caller
+ *	treats it the same as a truncated text record.
+ *
+ *	Returns 1 if the record was corrupt and has been skipped,
+ *	and -1 if the file couldn't be read at all.
+ */
+static int detail_binary_read(listen_detail_t *data)
+{
+	detail_binary_hdr_t	hdr;
+	ssize_t			slen;
+	VALUE_PAIR		*vp;
+
+	slen = detail_binary_decode_header(&hdr, data->map + data->offset, data->map_len - data->offset);
+	if (slen == 0) {
+		if (detail_binary_map(data) < 0) return -1;
+		slen = detail_binary_decode_header(&hdr, data->map + data->offset, data->map_len - data->offset);
+	}
+	if (slen < 0) {
+		PERROR("detail (%s): Bad record at offset %zu of %s", data->name,
+		       (size_t) data->offset, data->filename_work);
+		detail_binary_resync(data);
+		return 1;
+	}
+	if (slen == 0) return 0;
+
+	data->last_offset = data->timestamp_offset = data->offset;
+	data->offset += slen;
+	data->timestamp = hdr.timestamp;
+	data->done_entry = hdr.done;
+
+	if (detail_binary_decode_pairs(data, &data->vps, data->map + data->last_offset + DETAIL_BINARY_HDR_LEN,
+				       hdr.data_len) < 0) {
+		PERROR("detail (%s): Failed decoding record at offset %zu of %s, skipping it", data->name,
+		       (size_t) data->last_offset, data->filename_work);
+		fr_pair_list_free(&data->vps);
+		return 1;
+	}
+
+	/*
+	 *	Set the original client IP address, based on
+	 *	what's in the detail file.
+	 */
+	vp = fr_pair_find_by_num(data->vps, 0, PW_CLIENT_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		data->client_ip.af = AF_INET;
+		data->client_ip.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		data->client_ip.prefix = 32;
+		fr_pair_delete_by_num(&data->vps, 0, PW_CLIENT_IP_ADDRESS, TAG_ANY);
+	}
+
+	vp = fr_pair_afrom_num(data, 0, PW_PACKET_ORIGINAL_TIMESTAMP);
+	if (vp) {
+		vp->vp_date = (uint32_t) data->timestamp;
+		vp->type = VT_DATA;
+		fr_pair_add(&data->vps, vp);
+	}
+
+	data->entry_state = STATE_QUEUED;
+
+	return 0;
+}
+
+/*
+ *	Build a packet from the attributes of a detail file entry.
+ */
+static RADIUS_PACKET *detail_packet_alloc(listen_detail_t const *data, VALUE_PAIR *vps, fr_ipaddr_t const *client_ip,
+					  time_t timestamp, int tries, uint32_t counter)
+{
+	VALUE_PAIR	*vp;
+	RADIUS_PACKET	*packet;
+
+	/*
+	 *	Allocate the packet.  If we fail, it's a serious
+	 *	problem.
+	 */
+	packet = fr_radius_alloc(NULL, true);
+	if (!packet) {
+		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
+		fr_exit(1);
+	}
+
+	memset(packet, 0, sizeof(*packet));
+	packet->sockfd = -1;
+	packet->src_ipaddr.af = AF_INET;
+	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
+
+	/*
+	 *	If everything's OK, this is a waste of memory.
+	 *	Otherwise, it lets us re-send the original packet
+	 *	contents, unmolested.
+	 */
+	packet->vps = fr_pair_list_copy(packet, vps);
+
+	packet->code = PW_CODE_ACCOUNTING_REQUEST;
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
+	if (vp) packet->code = vp->vp_integer;
+
+	gettimeofday(&packet->timestamp, NULL);
+
+	/*
+	 *	Remember where it came from, so that we don't
+	 *	proxy it to the place it came from...
+	 */
+	if (client_ip->af != AF_UNSPEC) {
+		packet->src_ipaddr = *client_ip;
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->src_ipaddr.af = AF_INET;
+		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->src_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->src_ipaddr.af = AF_INET6;
+			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->src_ipaddr.prefix = 128;
+		}
+	}
+
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
+	if (vp) {
+		packet->dst_ipaddr.af = AF_INET;
+		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
+		packet->dst_ipaddr.prefix = 32;
+	} else {
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
+		if (vp) {
+			packet->dst_ipaddr.af = AF_INET6;
+			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
+			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
+			packet->dst_ipaddr.prefix = 128;
+		}
+	}
+
+	/*
+	 *	Generate packet ID, ports, IP via a counter.
+	 */
+	packet->id = counter & 0xff;
+	packet->src_port = 1024 + ((counter >> 8) & 0xff);
+	packet->dst_port = 1024 + ((counter >> 16) & 0xff);
+
+	packet->dst_ipaddr.af = AF_INET;
+	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((counter >> 24) & 0xff));
+
+	/*
+	 *	Create / update accounting attributes.
+	 */
+	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
+		/*
+		 *	Prefer the Event-Timestamp in the packet, if it
+		 *	exists.  That is when the event occurred, whereas the
+		 *	"Timestamp" field is when we wrote the packet to the
+		 *	detail file, which could have been much later.
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
+		if (vp) {
+			timestamp = vp->vp_integer;
+		}
+
+		/*
+		 *	Look for Acct-Delay-Time, and update
+		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
+		 */
+		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
+		if (!vp) {
+			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
+			rad_assert(vp != NULL);
+			fr_pair_add(&packet->vps, vp);
+		}
+		if (timestamp != 0) {
+			vp->vp_integer += time(NULL) - timestamp;
+		}
+	}
+
+	/*
+	 *	Set the transmission count.
+	 */
+	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
+	if (!vp) {
+		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
+		rad_assert(vp != NULL);
+		fr_pair_add(&packet->vps, vp);
+	}
+	vp->vp_integer = tries;
+
+	return packet;
+}
+
+static RADIUS_PACKET *detail_poll(listen_detail_t *data)
 {
 	char		key[256], op[8], value[1024];
 	vp_cursor_t	cursor;
 	VALUE_PAIR	*vp;
 	RADIUS_PACKET	*packet;
 	char		buffer[2048];
-	listen_detail_t *data = listener->data;
 
 	switch (data->file_state) {
 	case STATE_UNOPENED:
 open_file:
 		rad_assert(data->work_fd < 0);
 
-		if (!detail_open(listener)) return NULL;
+		if (!detail_open(data)) return NULL;
 
 		rad_assert(data->file_state == STATE_UNLOCKED);
 		rad_assert(data->work_fd >= 0);
@@ -419,6 +816,27 @@ open_file:
 			fr_exit(1);
 		}
 
+		/*
+		 *	Binary detail files start with the magic of
+		 *	the first record.  Those are mapped into
+		 *	memory, rather than being read line by line.
+		 */
+		{
+			uint8_t magic[DETAIL_BINARY_MAGIC_LEN];
+
+			if ((pread(data->work_fd, magic, sizeof(magic), 0) == sizeof(magic)) &&
+			    (memcmp(magic, DETAIL_BINARY_MAGIC, sizeof(magic)) == 0)) {
+				data->binary = true;
+				if (detail_binary_map(data) < 0) {
+					fclose(data->fp);
+					data->fp = NULL;
+					data->work_fd = -1;
+					data->file_state = STATE_UNOPENED;
+					return NULL;
+				}
+			}
+		}
+
 		/*
 		 *	Look for the header
 		 */
@@ -426,6 +844,12 @@ open_file:
 		data->entry_state = STATE_HEADER;
 		data->delay_time = USEC;
 		data->vps = NULL;
+
+		/*
+		 *	Parallel replay splits the file between the
+		 *	readers before anything is read from it.
+		 */
+		if (data->replay) return NULL;
 		break;
 
 		/*
@@ -448,6 +872,15 @@ open_file:
 			goto open_file;
 		}
 
+		/*
+		 *	Stop at the start of the next reader's part of
+		 *	the file.
+		 */
+		if (data->replay && (data->range_end >= 0) && (data->offset >= data->range_end)) {
+			data->range_done = true;
+			return NULL;
+		}
+
 		{
 			struct stat buf;
 
@@ -457,7 +890,7 @@ open_file:
 
 				goto cleanup;
 			}
-			if (((off_t) ftell(data->fp)) == buf.st_size) {
+			if ((data->binary ? data->offset : (off_t) ftell(data->fp)) == buf.st_size) {
 				goto cleanup;
 			}
 		}
@@ -468,8 +901,18 @@ open_file:
 		 */
 		if (feof(data->fp)) {
 		cleanup:
+			/*
+			 *	The replay threads decide when the
+			 *	file is finished with.
+			 */
+			if (data->replay) {
+				data->range_done = true;
+				return NULL;
+			}
+
 			DEBUG("detail (%s): Unlinking %s", data->name, data->filename_work);
 			unlink(data->filename_work);
+			detail_binary_unmap(data);
 			if (data->fp) fclose(data->fp);
 			data->fp = NULL;
 			data->work_fd = -1;
@@ -530,7 +973,16 @@ open_file:
 	 *	request, and go read another one.
 	 */
 	case STATE_REPLIED:
-		if (data->track) {
+		if (data->track && data->binary) {
+			uint8_t done = 1;
+
+			if (pwrite(data->work_fd, &done, sizeof(done),
+				   data->timestamp_offset + DETAIL_BINARY_DONE_OFFSET) < (ssize_t) sizeof(done)) {
+				WARN("detail (%s): Failed marking request as done: %s",
+				     data->name, fr_syserror(errno));
+			}
+
+		} else if (data->track) {
 			rad_assert(data->fp != NULL);
 
 			if (fseek(data->fp, data->timestamp_offset, SEEK_SET) < 0) {
@@ -555,6 +1007,26 @@ open_file:
 		goto do_header;
 	}
 
+	if (data->binary) {
+		int rcode;
+
+		/*
+		 *	Don't throw away the rest of the file because
+		 *	of one bad record.  If the file can't be read,
+		 *	leave it, and try again on the next poll.
+		 */
+		rcode = detail_binary_read(data);
+		if (rcode < 0) {
+			fr_pair_list_free(&data->vps);
+			return NULL;
+		}
+		if (rcode > 0) {
+			data->entry_state = STATE_HEADER;
+			goto do_header;
+		}
+		goto read_done;
+	}
+
 	fr_pair_cursor_init(&cursor, &data->vps);
 
 	/*
@@ -689,6 +1161,7 @@ open_file:
 	 */
 	if (ferror(data->fp)) goto cleanup;
 
+read_done:
 	data->tries = 0;
 	data->packets++;
 
@@ -730,122 +1203,7 @@ open_file:
 		return NULL;
 	}
 
-	/*
-	 *	Allocate the packet.  If we fail, it's a serious
-	 *	problem.
-	 */
-	packet = fr_radius_alloc(NULL, true);
-	if (!packet) {
-		ERROR("detail (%s): FATAL: Failed allocating memory for detail", data->name);
-		fr_exit(1);
-	}
-
-	memset(packet, 0, sizeof(*packet));
-	packet->sockfd = -1;
-	packet->src_ipaddr.af = AF_INET;
-	packet->src_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_NONE);
-
-	/*
-	 *	If everything's OK, this is a waste of memory.
-	 *	Otherwise, it lets us re-send the original packet
-	 *	contents, unmolested.
-	 */
-	packet->vps = fr_pair_list_copy(packet, data->vps);
-
-	packet->code = PW_CODE_ACCOUNTING_REQUEST;
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TYPE, TAG_ANY);
-	if (vp) packet->code = vp->vp_integer;
-
-	gettimeofday(&packet->timestamp, NULL);
-
-	/*
-	 *	Remember where it came from, so that we don't
-	 *	proxy it to the place it came from...
-	 */
-	if (data->client_ip.af != AF_UNSPEC) {
-		packet->src_ipaddr = data->client_ip;
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->src_ipaddr.af = AF_INET;
-		packet->src_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->src_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_SRC_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->src_ipaddr.af = AF_INET6;
-			memcpy(&packet->src_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->src_ipaddr.prefix = 128;
-		}
-	}
-
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IP_ADDRESS, TAG_ANY);
-	if (vp) {
-		packet->dst_ipaddr.af = AF_INET;
-		packet->dst_ipaddr.ipaddr.ip4addr.s_addr = vp->vp_ipaddr;
-		packet->dst_ipaddr.prefix = 32;
-	} else {
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_DST_IPV6_ADDRESS, TAG_ANY);
-		if (vp) {
-			packet->dst_ipaddr.af = AF_INET6;
-			memcpy(&packet->dst_ipaddr.ipaddr.ip6addr,
-			       &vp->vp_ipv6addr, sizeof(vp->vp_ipv6addr));
-			packet->dst_ipaddr.prefix = 128;
-		}
-	}
-
-	/*
-	 *	Generate packet ID, ports, IP via a counter.
-	 */
-	packet->id = data->counter & 0xff;
-	packet->src_port = 1024 + ((data->counter >> 8) & 0xff);
-	packet->dst_port = 1024 + ((data->counter >> 16) & 0xff);
-
-	packet->dst_ipaddr.af = AF_INET;
-	packet->dst_ipaddr.ipaddr.ip4addr.s_addr = htonl((INADDR_LOOPBACK & ~0xffffff) | ((data->counter >> 24) & 0xff));
-
-	/*
-	 *	Create / update accounting attributes.
-	 */
-	if (packet->code == PW_CODE_ACCOUNTING_REQUEST) {
-		/*
-		 *	Prefer the Event-Timestamp in the packet, if it
-		 *	exists.  That is when the event occurred, whereas the
-		 *	"Timestamp" field is when we wrote the packet to the
-		 *	detail file, which could have been much later.
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_EVENT_TIMESTAMP, TAG_ANY);
-		if (vp) {
-			data->timestamp = vp->vp_integer;
-		}
-
-		/*
-		 *	Look for Acct-Delay-Time, and update
-		 *	based on Acct-Delay-Time += (time(NULL) - timestamp)
-		 */
-		vp = fr_pair_find_by_num(packet->vps, 0, PW_ACCT_DELAY_TIME, TAG_ANY);
-		if (!vp) {
-			vp = fr_pair_afrom_num(packet, 0, PW_ACCT_DELAY_TIME);
-			rad_assert(vp != NULL);
-			fr_pair_add(&packet->vps, vp);
-		}
-		if (data->timestamp != 0) {
-			vp->vp_integer += time(NULL) - data->timestamp;
-		}
-	}
-
-	/*
-	 *	Set the transmission count.
-	 */
-	vp = fr_pair_find_by_num(packet->vps, 0, PW_PACKET_TRANSMIT_COUNTER, TAG_ANY);
-	if (!vp) {
-		vp = fr_pair_afrom_num(packet, 0, PW_PACKET_TRANSMIT_COUNTER);
-		rad_assert(vp != NULL);
-		fr_pair_add(&packet->vps, vp);
-	}
-	vp->vp_integer = data->tries;
+	packet = detail_packet_alloc(data, data->vps, &data->client_ip, data->timestamp, data->tries, data->counter);
 
 	data->entry_state = STATE_RUNNING;
 	data->running = packet->timestamp.tv_sec;
@@ -858,7 +1216,10 @@ open_file:
  */
 static int _detail_free(listen_detail_t *data)
 {
-	if (!check_config) {
+	if (data->replay) {
+		detail_replay_stop(data);
+
+	} else if (!check_config) {
 		ssize_t ret;
 		void *arg = NULL;
 
@@ -893,6 +1254,8 @@ static int _detail_free(listen_detail_t *data)
 		if (arg) pthread_join(data->pthread_id, &arg);
 	}
 
+	detail_binary_unmap(data);
+
 	if (data->fp != NULL) {
 		fclose(data->fp);
 		data->fp = NULL;
@@ -969,7 +1332,7 @@ static void *detail_handler_thread(void *arg)
 	while (true) {
 		RADIUS_PACKET *packet;
 
-		while ((packet = detail_poll(this)) == NULL) {
+		while ((packet = detail_poll(data)) == NULL) {
 			usleep(detail_delay(data));
 
 			/*
@@ -1005,7 +1368,7 @@ static void *detail_handler_thread(void *arg)
 
 			if (data->delay_time > 0) usleep(data->delay_time);
 
-			packet = detail_poll(this);
+			packet = detail_poll(data);
 			if (!packet) break;
 		} while (data->entry_state != STATE_REPLIED);
 	}
@@ -1014,6 +1377,518 @@ static void *detail_handler_thread(void *arg)
 }
 
 
+/*
+ *	Close a reader's part of the file.
+ */
+static void detail_replay_cursor_close(listen_detail_t *cursor)
+{
+	detail_binary_unmap(cursor);
+
+	if (cursor->fp) {
+		fclose(cursor->fp);
+	} else if (cursor->work_fd >= 0) {
+		close(cursor->work_fd);
+	}
+
+	cursor->fp = NULL;
+	cursor->work_fd = -1;
+	cursor->binary = false;
+	cursor->file_state = STATE_UNOPENED;
+	cursor->entry_state = STATE_HEADER;
+}
+
+/*
+ *	Open a reader's part of a file which the first reader has
+ *	already opened and locked.  Each reader has its own file
+ *	descriptor, so that they don't share a file offset.
+ */
+static int detail_replay_cursor_open(listen_detail_t *cursor, bool binary, off_t start, off_t end)
+{
+	cursor->work_fd = open(cursor->filename_work, O_RDWR);
+	if (cursor->work_fd < 0) {
+		ERROR("detail (%s): Failed opening %s: %s",
+		      cursor->name, cursor->filename_work, fr_syserror(errno));
+		return -1;
+	}
+
+	cursor->fp = fdopen(cursor->work_fd, cursor->track ? "r+" : "r");
+	if (!cursor->fp) {
+		ERROR("detail (%s): Failed to re-open detail file: %s",
+		      cursor->name, fr_syserror(errno));
+	error:
+		detail_replay_cursor_close(cursor);
+		return -1;
+	}
+
+	cursor->binary = binary;
+	if (binary) {
+		if (detail_binary_map(cursor) < 0) goto error;
+
+	} else if (fseek(cursor->fp, start, SEEK_SET) < 0) {
+		ERROR("detail (%s): Failed seeking to offset %zu: %s",
+		      cursor->name, (size_t) start, fr_syserror(errno));
+		goto error;
+	}
+
+	cursor->file_state = STATE_PROCESSING;
+	cursor->entry_state = STATE_HEADER;
+	cursor->client_ip.af = AF_UNSPEC;
+	cursor->timestamp = 0;
+	cursor->offset = cursor->last_offset = cursor->timestamp_offset = start;
+	cursor->packets = 0;
+	cursor->tries = 0;
+	cursor->done_entry = false;
+	cursor->range_end = end;
+	cursor->range_done = false;
+
+	return 0;
+}
+
+/*
+ *	Find the first record which starts at or after "target".
+ *
+ *	Text entries end with a blank line, and binary records are
+ *	walked from the previous boundary.
+ */
+static off_t detail_replay_boundary(listen_detail_t *first, off_t from, off_t target, off_t size)
+{
+	off_t	offset;
+
+	if (first->binary) {
+		detail_binary_hdr_t	hdr;
+		ssize_t			slen;
+
+		if ((size_t) size > first->map_len) size = first->map_len;
+
+		for (offset = from; offset < target; offset += slen) {
+			slen = detail_binary_decode_header(&hdr, first->map + offset, size - offset);
+			if (slen <= 0) return size;
+		}
+
+		return offset;
+	}
+
+	offset = (target > from) ? target - 1 : from;
+	{
+		char	buffer[4096];
+		bool	newline = false;
+		ssize_t	len, i;
+
+		while (offset < size) {
+			len = pread(first->work_fd, buffer, sizeof(buffer), offset);
+			if (len <= 0) break;
+
+			for (i = 0; i < len; i++) {
+				if (buffer[i] != '\n') {
+					newline = false;
+					continue;
+				}
+				if (newline) return offset + i + 1;
+				newline = true;
+			}
+			offset += len;
+		}
+	}
+
+	return size;
+}
+
+/*
+ *	Split the file the first reader has just opened between all
+ *	of the readers, and wake them up.
+ */
+static void detail_replay_split(detail_replay_t *replay)
+{
+	listen_detail_t	*first = replay->readers[0].cursor;
+	off_t		start, end, size = 0;
+	struct stat	buf;
+	uint32_t	i;
+
+	if (fstat(first->work_fd, &buf) == 0) size = buf.st_size;
+
+	start = 0;
+	end = (replay->num_readers > 1) ? detail_replay_boundary(first, 0, size / replay->num_readers, size) : -1;
+	first->range_end = end;
+	first->range_done = false;
+
+	for (i = 1; i < replay->num_readers; i++) {
+		listen_detail_t *cursor = replay->readers[i].cursor;
+
+		start = end;
+		end = -1;
+		if (i < (replay->num_readers - 1)) {
+			end = detail_replay_boundary(first, start, (size / replay->num_readers) * (i + 1), size);
+		}
+
+		/*
+		 *	If a reader can't open the file, the first
+		 *	reader gets the whole of it, so that nothing is
+		 *	skipped.
+		 */
+		if (detail_replay_cursor_open(cursor, first->binary, start, end) < 0) {
+			uint32_t j;
+
+			for (j = 1; j < i; j++) detail_replay_cursor_close(replay->readers[j].cursor);
+			for (j = 1; j < replay->num_readers; j++) replay->readers[j].cursor->range_done = true;
+			first->range_end = -1;
+			break;
+		}
+
+		DEBUG2("detail (%s): Reader %u replaying %s from offset %zu", first->name, i,
+		       first->filename_work, (size_t) start);
+	}
+
+	pthread_mutex_lock(&replay->mutex);
+	replay->generation++;
+	replay->finished = 0;
+	pthread_cond_broadcast(&replay->cond);
+	pthread_mutex_unlock(&replay->mutex);
+}
+
+/*
+ *	Hand a packet to the server.
+ */
+static void detail_replay_send(detail_reader_t *reader, RADIUS_PACKET *packet)
+{
+	listen_detail_t *data = reader->replay->data;
+
+	if (write(data->master_pipe[1], &packet, sizeof(packet)) < 0) {
+		ERROR("detail (%s): Failed passing detail packet pointer to master: %s",
+		      data->name, fr_syserror(errno));
+	}
+}
+
+/*
+ *	A record has been processed.  Mark it as done, and free the slot.
+ *
+ *	Records complete in any order.  Each one is marked using the
+ *	offset saved when it was read, so the file position doesn't
+ *	matter.
+ */
+static void detail_replay_done(detail_reader_t *reader, detail_slot_t *slot)
+{
+	listen_detail_t *cursor = reader->cursor;
+
+	if (cursor->track && cursor->binary) {
+		uint8_t done = 1;
+
+		if (pwrite(cursor->work_fd, &done, sizeof(done),
+			   slot->timestamp_offset + DETAIL_BINARY_DONE_OFFSET) < (ssize_t) sizeof(done)) {
+			WARN("detail (%s): Failed marking request as done: %s",
+			     cursor->name, fr_syserror(errno));
+		}
+
+	} else if (cursor->track) {
+		if (fseek(cursor->fp, slot->timestamp_offset, SEEK_SET) < 0) {
+			WARN("detail (%s): Failed seeking to timestamp offset: %s",
+			     cursor->name, fr_syserror(errno));
+		} else if (fwrite("\tDone", 1, 5, cursor->fp) < 5) {
+			WARN("detail (%s): Failed marking request as done: %s",
+			     cursor->name, fr_syserror(errno));
+		} else if (fflush(cursor->fp) != 0) {
+			WARN("detail (%s): Failed flushing marked detail file to disk: %s",
+			     cursor->name, fr_syserror(errno));
+		}
+
+		if (fseek(cursor->fp, cursor->offset, SEEK_SET) < 0) {
+			WARN("detail (%s): Failed seeking to next detail request: %s",
+			     cursor->name, fr_syserror(errno));
+		}
+	}
+
+	fr_pair_list_free(&slot->vps);
+
+	pthread_mutex_lock(&reader->mutex);
+	slot->used = false;
+	pthread_mutex_unlock(&reader->mutex);
+
+	reader->outstanding--;
+}
+
+/*
+ *	Send records from the reader's part of the file, keeping up
+ *	to max_outstanding of them in flight.
+ */
+static void detail_replay_run(detail_reader_t *reader)
+{
+	detail_replay_t	*replay = reader->replay;
+	listen_detail_t	*data = replay->data;
+	listen_detail_t	*cursor = reader->cursor;
+	struct pollfd	fds;
+	uint32_t	i;
+
+	fds.fd = reader->ack_pipe[0];
+	fds.events = POLLIN;
+
+	while (!detail_replay_stopping(replay)) {
+		char	buffer[64];
+		time_t	now;
+
+		/*
+		 *	Fill the window.
+		 */
+		while (!cursor->range_done && (reader->outstanding < data->max_outstanding)) {
+			RADIUS_PACKET	*packet;
+			detail_slot_t	*slot;
+
+			for (i = 0; i < data->max_outstanding; i++) {
+				if (!reader->slots[i].used) break;
+			}
+			rad_assert(i < data->max_outstanding);
+			slot = &reader->slots[i];
+
+			cursor->counter = (reader->index * data->max_outstanding) + i;
+			packet = detail_poll(cursor);
+			if (!packet) continue;
+
+			pthread_mutex_lock(&reader->mutex);
+			slot->used = true;
+			slot->state = STATE_RUNNING;
+			slot->packet = packet;
+			pthread_mutex_unlock(&reader->mutex);
+
+			slot->vps = cursor->vps;
+			slot->timestamp_offset = cursor->timestamp_offset;
+			slot->timestamp = cursor->timestamp;
+			slot->client_ip = cursor->client_ip;
+			slot->tries = cursor->tries;
+			slot->running = cursor->running;
+
+			/*
+			 *	The slot owns the record now.  Go read
+			 *	the next one.
+			 */
+			cursor->vps = NULL;
+			cursor->entry_state = STATE_HEADER;
+			reader->outstanding++;
+
+			detail_replay_send(reader, packet);
+		}
+
+		if (cursor->range_done && !reader->outstanding) break;
+
+		/*
+		 *	Wait for records to complete.  Wake up every
+		 *	second to check for timeouts and exit requests.
+		 */
+		if (poll(&fds, 1, 1000) > 0) {
+			while (read(reader->ack_pipe[0], buffer, sizeof(buffer)) > 0);
+		}
+
+		now = time(NULL);
+		for (i = 0; i < data->max_outstanding; i++) {
+			detail_slot_t		*slot = &reader->slots[i];
+			detail_entry_state_t	state;
+			RADIUS_PACKET		*packet;
+
+			if (!slot->used) continue;
+
+			/*
+			 *	Nothing is processing the record.  Send
+			 *	it again after retry_interval.
+			 */
+			pthread_mutex_lock(&reader->mutex);
+			state = slot->state;
+			if (state == STATE_NO_REPLY) {
+				slot->state = STATE_RUNNING;
+				slot->running = now;
+			}
+			pthread_mutex_unlock(&reader->mutex);
+
+			switch (state) {
+			case STATE_REPLIED:
+				detail_replay_done(reader, slot);
+				break;
+
+			case STATE_RUNNING:
+				if (now < (slot->running + (int)data->retry_interval)) break;
+
+				DEBUG("detail (%s): No response to detail request.  Retrying", data->name);
+
+				slot->tries++;
+				packet = detail_packet_alloc(cursor, slot->vps, &slot->client_ip, slot->timestamp,
+							     slot->tries, (reader->index * data->max_outstanding) + i);
+
+				pthread_mutex_lock(&reader->mutex);
+				slot->packet = packet;
+				slot->running = now;
+				pthread_mutex_unlock(&reader->mutex);
+
+				detail_replay_send(reader, packet);
+				break;
+
+			default:
+				break;
+			}
+		}
+	}
+}
+
+static void *detail_replay_thread(void *arg)
+{
+	detail_reader_t	*reader = arg;
+	detail_replay_t	*replay = reader->replay;
+	listen_detail_t	*cursor = reader->cursor;
+	uint32_t	generation = 0;
+
+	while (!detail_replay_stopping(replay)) {
+		/*
+		 *	The first reader finds the next file, and
+		 *	splits it.  The others wait for it to do so.
+		 */
+		if (reader->index == 0) {
+			(void) detail_poll(cursor);
+			if (cursor->file_state != STATE_PROCESSING) {
+				usleep(detail_delay(cursor));
+				continue;
+			}
+
+			detail_replay_split(replay);
+		} else {
+			pthread_mutex_lock(&replay->mutex);
+			while (!detail_replay_stopping(replay) && (replay->generation == generation)) {
+				pthread_cond_wait(&replay->cond, &replay->mutex);
+			}
+			generation = replay->generation;
+			pthread_mutex_unlock(&replay->mutex);
+
+			if (detail_replay_stopping(replay)) break;
+		}
+
+		detail_replay_run(reader);
+		if (detail_replay_stopping(replay)) break;
+
+		/*
+		 *	Close our part of the file before saying we're
+		 *	done, as the first reader may re-open the cursor
+		 *	on the next file.
+		 */
+		if (reader->index != 0) detail_replay_cursor_close(cursor);
+
+		pthread_mutex_lock(&replay->mutex);
+		replay->finished++;
+		pthread_cond_broadcast(&replay->cond);
+		if (reader->index == 0) {
+			while (!detail_replay_stopping(replay) && (replay->finished < replay->num_readers)) {
+				pthread_cond_wait(&replay->cond, &replay->mutex);
+			}
+		}
+		pthread_mutex_unlock(&replay->mutex);
+
+		if ((reader->index != 0) || detail_replay_stopping(replay)) continue;
+
+		/*
+		 *	Every record in the file has completed.
+		 */
+		DEBUG("detail (%s): Unlinking %s", cursor->name, cursor->filename_work);
+		unlink(cursor->filename_work);
+		detail_replay_cursor_close(cursor);
+
+		if (cursor->one_shot) {
+			INFO("detail (%s): Finished reading \"one shot\" detail file - Exiting", cursor->name);
+			radius_signal_self(RADIUS_SIGNAL_SELF_EXIT);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ *	Start the replay threads.
+ */
+static int detail_replay_start(listen_detail_t *data)
+{
+	detail_replay_t	*replay;
+	uint32_t	i;
+	int		ret;
+
+	MEM(replay = talloc_zero(data, detail_replay_t));
+	atomic_init(&replay->stop, false);
+	replay->data = data;
+	replay->num_readers = data->num_readers;
+	pthread_mutex_init(&replay->mutex, NULL);
+	pthread_cond_init(&replay->cond, NULL);
+	MEM(replay->readers = talloc_zero_array(replay, detail_reader_t, replay->num_readers));
+	data->replay = replay;
+
+	for (i = 0; i < replay->num_readers; i++) {
+		detail_reader_t	*reader = &replay->readers[i];
+		listen_detail_t	*cursor;
+
+		reader->replay = replay;
+		reader->index = i;
+		pthread_mutex_init(&reader->mutex, NULL);
+		MEM(reader->slots = talloc_zero_array(replay, detail_slot_t, data->max_outstanding));
+
+		MEM(cursor = talloc_memdup(replay, data, sizeof(*data)));
+		talloc_set_type(cursor, listen_detail_t);
+		cursor->ev = NULL;
+		cursor->fp = NULL;
+		cursor->work_fd = -1;
+		cursor->vps = NULL;
+		cursor->map = NULL;
+		cursor->map_len = 0;
+		cursor->binary = false;
+		cursor->file_state = STATE_UNOPENED;
+		cursor->entry_state = STATE_HEADER;
+		cursor->range_end = -1;
+		cursor->range_done = (i != 0);
+		reader->cursor = cursor;
+
+		if (pipe(reader->ack_pipe) < 0) {
+			ERROR("detail (%s): Error opening internal pipe: %s", data->name, fr_syserror(errno));
+			return -1;
+		}
+		fr_nonblock(reader->ack_pipe[0]);
+	}
+
+	for (i = 0; i < replay->num_readers; i++) {
+		ret = pthread_create(&replay->readers[i].pthread_id, NULL, detail_replay_thread, &replay->readers[i]);
+		if (ret != 0) {
+			ERROR("detail (%s): Error creating detail reader thread: %s", data->name, fr_syserror(ret));
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *	Stop the replay threads, and release everything they hold.
+ */
+static void detail_replay_stop(listen_detail_t *data)
+{
+	detail_replay_t	*replay = data->replay;
+	uint32_t	i;
+
+	pthread_mutex_lock(&replay->mutex);
+	atomic_store_explicit(&replay->stop, true, memory_order_release);
+	pthread_cond_broadcast(&replay->cond);
+	pthread_mutex_unlock(&replay->mutex);
+
+	for (i = 0; i < replay->num_readers; i++) {
+		detail_reader_t *reader = &replay->readers[i];
+
+		pthread_join(reader->pthread_id, NULL);
+
+		detail_replay_cursor_close(reader->cursor);
+		close(reader->ack_pipe[0]);
+		close(reader->ack_pipe[1]);
+		pthread_mutex_destroy(&reader->mutex);
+	}
+
+	close(data->master_pipe[0]);
+	close(data->master_pipe[1]);
+	close(data->child_pipe[0]);
+	close(data->child_pipe[1]);
+
+	pthread_cond_destroy(&replay->cond);
+	pthread_mutex_destroy(&replay->mutex);
+
+	data->replay = NULL;
+	talloc_free(replay);
+}
+
 static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("detail", PW_TYPE_FILE_OUTPUT | PW_TYPE_DEPRECATED, listen_detail_t, filename) },
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED, listen_detail_t, filename) },
@@ -1022,6 +1897,8 @@ static const CONF_PARSER detail_config[] = {
 	{ FR_CONF_OFFSET("retry_interval", PW_TYPE_INTEGER, listen_detail_t, retry_interval), .dflt = STRINGIFY(30) },
 	{ FR_CONF_OFFSET("one_shot", PW_TYPE_BOOLEAN, listen_detail_t, one_shot), .dflt = "no" },
 	{ FR_CONF_OFFSET("track", PW_TYPE_BOOLEAN, listen_detail_t, track), .dflt = "no" },
+	{ FR_CONF_OFFSET("max_outstanding", PW_TYPE_INTEGER, listen_detail_t, max_outstanding), .dflt = STRINGIFY(1) },
+	{ FR_CONF_OFFSET("readers", PW_TYPE_INTEGER, listen_detail_t, num_readers), .dflt = STRINGIFY(1) },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -1065,6 +1942,12 @@ static int detail_parse(CONF_SECTION *cs, rad_listen_t *this)
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, >=, 4);
 	FR_INTEGER_BOUND_CHECK("retry_interval", data->retry_interval, <=, 3600);
 
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_outstanding", data->max_outstanding, <=, 1024);
+
+	FR_INTEGER_BOUND_CHECK("readers", data->num_readers, >=, 1);
+	FR_INTEGER_BOUND_CHECK("readers", data->num_readers, <=, 32);
+
 	/*
 	 *	Only checking the config.  Don't start threads or anything else.
 	 */
@@ -1157,13 +2040,21 @@ static int detail_socket_open(UNUSED CONF_SECTION *cs, rad_listen_t *this)
 		fr_exit(1);
 	}
 
+	this->fd = data->master_pipe[0];
+
+	/*
+	 *	Send more than one record at a time.
+	 */
+	if ((data->max_outstanding > 1) || (data->num_readers > 1)) {
+		if (detail_replay_start(data) < 0) fr_exit(1);
+		return 0;
+	}
+
 	if (pthread_create(&data->pthread_id, NULL, detail_handler_thread, this) != 0) {
 		ERROR("detail (%s): Error creating detail reader thread: %s", data->name, fr_syserror(errno));
 		fr_exit(1);
 	}
 
-	this->fd = data->master_pipe[0];
-
 	return 0;
 }
 
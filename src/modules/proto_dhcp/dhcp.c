@@ -60,6 +60,8 @@ RCSID("$Id$")
 #endif
 
 static fr_dict_attr_t const *dhcp_option_82;
+static fr_dict_attr_t const *dhcp_vendor_da;		//!< Parent of all the DHCP options.
+static fr_dict_attr_t const *dhcp_option_da[256];	//!< DHCP options, by option number.
 
 /* @todo: this is a hack */
 #  define DEBUG			if (fr_debug_lvl && fr_log_fp) fr_printf_log
@@ -181,70 +183,229 @@ static int dhcp_header_sizes[] = {
 #define DHCP_FILE_FIELD	  	(1)
 #define DHCP_SNAME_FIELD  	(2)
 
-static uint8_t const *dhcp_get_option(dhcp_packet_t const *packet, size_t packet_size, unsigned int option)
+/** Index the options in one field of a packet
+ *
+ * @param[in,out] index	to add the options to.
+ * @param[in] start	of the field, relative to index->data.
+ * @param[in] end	of the field, relative to index->data.
+ * @param[in] field	one of DHCP_OPTION_FIELD, DHCP_FILE_FIELD or DHCP_SNAME_FIELD.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the field is malformed.
+ */
+static int dhcp_option_index_field(fr_dhcp_option_index_t *index, size_t start, size_t end, int field)
 {
-	int overload = 0;
-	int field = DHCP_OPTION_FIELD;
-	size_t where, size;
-	uint8_t const *data;
+	uint8_t const *data = index->data;
+	size_t where = start;
 
-	where = 0;
-	size = packet_size - offsetof(dhcp_packet_t, options);
-	data = &packet->options[where];
+	while (where < end) {
+		fr_dhcp_option_frag_t	*frag;
+		uint8_t			option = data[where];
 
-	while (where < size) {
-		if (data[0] == 0) { /* padding */
+		if (option == 0) { /* padding */
 			where++;
 			continue;
 		}
 
-		if (data[0] == 255) { /* end of options */
-			if ((field == DHCP_OPTION_FIELD) &&
-			    (overload & DHCP_FILE_FIELD)) {
-				data = packet->file;
-				where = 0;
-				size = sizeof(packet->file);
-				field = DHCP_FILE_FIELD;
-				continue;
+		if (option == 255) break; /* end of options */
 
-			} else if ((field == DHCP_FILE_FIELD) &&
-				   (overload & DHCP_SNAME_FIELD)) {
-				data = packet->sname;
-				where = 0;
-				size = sizeof(packet->sname);
-				field = DHCP_SNAME_FIELD;
-				continue;
-			}
+		/*
+		 *	We MUST have a real option here.
+		 */
+		if ((where + 2) > end) {
+			fr_strerror_printf("Options overflow field at %u", (unsigned int) where);
+			return -1;
+		}
+
+		if ((where + 2 + data[where + 1]) > end) {
+			fr_strerror_printf("Option length overflows field at %u", (unsigned int) where);
+			return -1;
+		}
 
-			return NULL;
+		if (index->num_frags == DHCP_OPTION_FRAGS_MAX) {
+			fr_strerror_printf("Too many options");
+			return -1;
 		}
 
 		/*
-		 *	We MUST have a real option here.
+		 *	RFC 3396 - Each instance of an option is a
+		 *	fragment of one long option.
 		 */
-		if ((where + 2) > size) {
-			fr_strerror_printf("Options overflow field at %u",
-					   (unsigned int) (data - (uint8_t const *) packet));
-			return NULL;
+		frag = &index->frag[index->num_frags];
+		frag->offset = where + 2;
+		frag->length = data[where + 1];
+		frag->next = 0;
+
+		if (!index->first[option]) {
+			index->first[option] = index->num_frags;
+			index->order[index->num_options++] = option;
+		} else {
+			index->frag[index->last[option]].next = index->num_frags;
 		}
+		index->last[option] = index->num_frags++;
+		index->length[option] += frag->length;
 
-		if ((where + 2 + data[1]) > size) {
-			fr_strerror_printf("Option length overflows field at %u",
-					   (unsigned int) (data - (uint8_t const *) packet));
-			return NULL;
+		/*
+		 *	Overload sname and/or file.  Only valid in the
+		 *	options field.
+		 */
+		if ((option == 52) && (field == DHCP_OPTION_FIELD) && (frag->length == 1)) {
+			index->overload = data[where + 2];
 		}
 
-		if (data[0] == option) return data;
+		where += data[where + 1] + 2;
+	}
+
+	return 0;
+}
 
-		if (data[0] == 52) { /* overload sname and/or file */
-			overload = data[3];
-		}
+static void dhcp_option_index_init(fr_dhcp_option_index_t *index, uint8_t const *data)
+{
+	memset(index->first, 0, sizeof(index->first));
+	memset(index->length, 0, sizeof(index->length));
+	index->data = data;
+	index->num_options = 0;
+	index->num_frags = 1;	/* frag[0] means "no fragment" */
+	index->overload = 0;
+}
+
+/** Index all the options in a packet, in one pass
+ *
+ * Options in the sname and file fields are included if the packet
+ * has an overload option.
+ *
+ * @param[out] index	to write.
+ * @param[in] data	of the packet.
+ * @param[in] data_len	of the packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the options are malformed.
+ */
+int fr_dhcp_packet_index(fr_dhcp_option_index_t *index, uint8_t const *data, size_t data_len)
+{
+	dhcp_option_index_init(index, data);
 
-		where += data[1] + 2;
-		data += data[1] + 2;
+	if (data_len < offsetof(dhcp_packet_t, options)) {
+		fr_strerror_printf("DHCP packet is too small (%zu < %zu)", data_len, offsetof(dhcp_packet_t, options));
+		return -1;
 	}
 
-	return NULL;
+	if (dhcp_option_index_field(index, offsetof(dhcp_packet_t, options), data_len, DHCP_OPTION_FIELD) < 0) {
+		return -1;
+	}
+
+	if ((index->overload & DHCP_FILE_FIELD) &&
+	    (dhcp_option_index_field(index, offsetof(dhcp_packet_t, file),
+				     offsetof(dhcp_packet_t, file) + DHCP_FILE_LEN, DHCP_FILE_FIELD) < 0)) {
+		return -1;
+	}
+
+	if ((index->overload & DHCP_SNAME_FIELD) &&
+	    (dhcp_option_index_field(index, offsetof(dhcp_packet_t, sname),
+				     offsetof(dhcp_packet_t, sname) + DHCP_SNAME_LEN, DHCP_SNAME_FIELD) < 0)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Index a buffer of options, without a DHCP header, in one pass
+ *
+ * @param[out] index	to write.
+ * @param[in] data	options to index.
+ * @param[in] data_len	of the options.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the options are malformed.
+ */
+int fr_dhcp_options_index(fr_dhcp_option_index_t *index, uint8_t const *data, size_t data_len)
+{
+	dhcp_option_index_init(index, data);
+
+	if (data_len > UINT16_MAX) {
+		fr_strerror_printf("Options are too long (%zu > %u)", data_len, UINT16_MAX);
+		return -1;
+	}
+
+	return dhcp_option_index_field(index, 0, data_len, DHCP_OPTION_FIELD);
+}
+
+/** Get the value of an option from an index
+ *
+ * If the option was split into several instances, they're concatenated
+ * into the buffer.  Otherwise the value points into the indexed data.
+ *
+ * @param[out] out		Where to write a pointer to the value.  NULL if
+ *				the option isn't present.
+ * @param[in] index		to look the option up in.
+ * @param[in] option		to look up.
+ * @param[in] buffer		to concatenate fragments in.
+ * @param[in] buffer_len	size of the buffer.
+ * @return
+ *	- The length of the value.
+ *	- -1 if the buffer is too small.
+ */
+ssize_t fr_dhcp_option_get(uint8_t const **out, fr_dhcp_option_index_t const *index, uint8_t option,
+			   uint8_t *buffer, size_t buffer_len)
+{
+	fr_dhcp_option_frag_t const	*frag;
+	uint8_t				*p;
+
+	if (!index->first[option]) {
+		*out = NULL;
+		return 0;
+	}
+
+	frag = &index->frag[index->first[option]];
+	if (!frag->next) {
+		*out = index->data + frag->offset;
+		return frag->length;
+	}
+
+	if (index->length[option] > buffer_len) {
+		fr_strerror_printf("Option %u is too long (%u > %zu)", option, index->length[option], buffer_len);
+		*out = NULL;
+		return -1;
+	}
+
+	for (p = buffer; frag != index->frag; frag = &index->frag[frag->next]) {
+		memcpy(p, index->data + frag->offset, frag->length);
+		p += frag->length;
+	}
+
+	*out = buffer;
+	return p - buffer;
+}
+
+/** Check the message type of a packet
+ *
+ * @param[out] out	message type.
+ * @param[in] index	of the packet.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the message type is missing or invalid.
+ */
+static int dhcp_message_type(uint8_t *out, fr_dhcp_option_index_t const *index)
+{
+	uint8_t const	*code;
+	uint8_t		buffer[MAX_PACKET_SIZE];
+	ssize_t		len;
+
+	len = fr_dhcp_option_get(&code, index, PW_DHCP_MESSAGE_TYPE, buffer, sizeof(buffer));
+	if (len < 0) return -1;
+
+	if (!code) {
+		fr_strerror_printf("No message-type option was found in the packet");
+		return -1;
+	}
+
+	if ((len < 1) || (code[0] == 0) || (code[0] >= DHCP_MAX_MESSAGE_TYPE)) {
+		fr_strerror_printf("Unknown value %d for message-type option", (len < 1) ? 0 : code[0]);
+		return -1;
+	}
+
+	*out = code[0];
+	return 0;
 }
 
 /** Receive DHCP packet using socket
@@ -340,10 +501,11 @@ RADIUS_PACKET *fr_dhcp_recv_socket(int sockfd)
 RADIUS_PACKET *fr_dhcp_packet_ok(uint8_t const *data, ssize_t data_len, fr_ipaddr_t src_ipaddr,
 				 uint16_t src_port, fr_ipaddr_t dst_ipaddr, uint16_t dst_port)
 {
-	uint32_t	magic;
-	uint8_t const	*code;
-	int		pkt_id;
-	RADIUS_PACKET	*packet;
+	uint32_t		magic;
+	uint8_t			code;
+	int			pkt_id;
+	RADIUS_PACKET		*packet;
+	fr_dhcp_option_index_t	index;
 
 	if (data_len < MIN_PACKET_SIZE) {
 		fr_strerror_printf("DHCP packet is too small (%zu < %d)", data_len, MIN_PACKET_SIZE);
@@ -378,16 +540,8 @@ RADIUS_PACKET *fr_dhcp_packet_ok(uint8_t const *data, ssize_t data_len, fr_ipadd
 	memcpy(&magic, data + 4, 4);
 	pkt_id = ntohl(magic);
 
-	code = dhcp_get_option((dhcp_packet_t const *) data, data_len, PW_DHCP_MESSAGE_TYPE);
-	if (!code) {
-		fr_strerror_printf("No message-type option was found in the packet");
-		return NULL;
-	}
-
-	if ((code[1] < 1) || (code[2] == 0) || (code[2] >= DHCP_MAX_MESSAGE_TYPE)) {
-		fr_strerror_printf("Unknown value %d for message-type option", code[2]);
-		return NULL;
-	}
+	if (fr_dhcp_packet_index(&index, data, data_len) < 0) return NULL;
+	if (dhcp_message_type(&code, &index) < 0) return NULL;
 
 	/* Now that checks are done, allocate packet */
 	packet = fr_radius_alloc(NULL, false);
@@ -397,7 +551,7 @@ RADIUS_PACKET *fr_dhcp_packet_ok(uint8_t const *data, ssize_t data_len, fr_ipadd
 	}
 
 	packet->data_len = data_len;
-	packet->code = code[2] | PW_DHCP_OFFSET;
+	packet->code = code | PW_DHCP_OFFSET;
 	packet->id = pkt_id;
 
 	packet->dst_port = dst_port;
@@ -843,7 +997,6 @@ static ssize_t decode_value_internal(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_di
 		if (fr_pair_to_unknown(vp) < 0) return -1;
 
 	case PW_TYPE_OCTETS:
-		if (data_len > UINT8_MAX) return -1;
 		fr_pair_value_memcpy(vp, data, data_len);
 		p += data_len;
 		break;
@@ -1024,6 +1177,41 @@ static ssize_t decode_value(TALLOC_CTX *ctx, vp_cursor_t *cursor,
 	return p - data;
 }
 
+/** Build the table of DHCP options, by option number
+ *
+ * Saves walking the dictionary twice, and looking up the option, for
+ * every option we decode.  Called from #dhcp_init, and on the first
+ * decode by tools which don't call it.
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the dictionaries don't define the DHCP vendor.
+ */
+static int dhcp_option_table_init(void)
+{
+	fr_dict_attr_t const	*vendor;
+	unsigned int		i;
+
+	if (dhcp_vendor_da) return 0;
+
+	vendor = fr_dict_attr_child_by_num(fr_dict_root(fr_dict_internal), PW_VENDOR_SPECIFIC);
+	if (!vendor) {
+		fr_strerror_printf("Can't find Vendor-Specific (26)");
+		return -1;
+	}
+
+	vendor = fr_dict_attr_child_by_num(vendor, DHCP_MAGIC_VENDOR);
+	if (!vendor) {
+		fr_strerror_printf("Can't find DHCP vendor");
+		return -1;
+	}
+
+	for (i = 1; i < 255; i++) dhcp_option_da[i] = fr_dict_attr_child_by_num(vendor, i);
+	dhcp_vendor_da = vendor;
+
+	return 0;
+}
+
 /** Decode DHCP option
  *
  * @param[in] ctx context to alloc new attributes in.
@@ -1050,16 +1238,21 @@ ssize_t fr_dhcp_decode_option(TALLOC_CTX *ctx, vp_cursor_t *cursor,
 	/*
 	 *	Stupid hacks until we have protocol specific dictionaries
 	 */
-	parent = fr_dict_attr_child_by_num(parent, PW_VENDOR_SPECIFIC);
-	if (!parent) {
-		fr_strerror_printf("Can't find Vendor-Specific (26)");
-		return -1;
-	}
+	if (parent == fr_dict_root(fr_dict_internal)) {
+		if (dhcp_option_table_init() < 0) return -1;
+		parent = dhcp_vendor_da;
+	} else {
+		parent = fr_dict_attr_child_by_num(parent, PW_VENDOR_SPECIFIC);
+		if (!parent) {
+			fr_strerror_printf("Can't find Vendor-Specific (26)");
+			return -1;
+		}
 
-	parent = fr_dict_attr_child_by_num(parent, DHCP_MAGIC_VENDOR);
-	if (!parent) {
-		fr_strerror_printf("Can't find DHCP vendor");
-		return -1;
+		parent = fr_dict_attr_child_by_num(parent, DHCP_MAGIC_VENDOR);
+		if (!parent) {
+			fr_strerror_printf("Can't find DHCP vendor");
+			return -1;
+		}
 	}
 
 	/*
@@ -1086,7 +1279,7 @@ ssize_t fr_dhcp_decode_option(TALLOC_CTX *ctx, vp_cursor_t *cursor,
 		return -1;
 	}
 
-	child = fr_dict_attr_child_by_num(parent, p[0]);
+	child = (parent == dhcp_vendor_da) ? dhcp_option_da[p[0]] : fr_dict_attr_child_by_num(parent, p[0]);
 	if (!child) {
 		/*
 		 *	Unknown attribute, create an octets type
@@ -1109,6 +1302,70 @@ ssize_t fr_dhcp_decode_option(TALLOC_CTX *ctx, vp_cursor_t *cursor,
 	return ret;
 }
 
+/** Decode all the options in an index
+ *
+ * Options are decoded in the order they first appear.  Options split
+ * into several instances are concatenated first (RFC 3396).
+ *
+ * @param[in] ctx context to alloc new attributes in.
+ * @param[in,out] cursor Where to write the decoded options.
+ * @param[in] index of the options.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int dhcp_decode_index(TALLOC_CTX *ctx, vp_cursor_t *cursor, fr_dhcp_option_index_t const *index)
+{
+	int		i;
+	uint8_t		buffer[MAX_PACKET_SIZE];
+
+	if (dhcp_option_table_init() < 0) return -1;
+
+	for (i = 0; i < index->num_options; i++) {
+		uint8_t			option = index->order[i];
+		uint8_t const		*value;
+		ssize_t			len;
+		fr_dict_attr_t const	*da;
+
+		len = fr_dhcp_option_get(&value, index, option, buffer, sizeof(buffer));
+		if (len < 0) return -1;
+
+		da = dhcp_option_da[option];
+		if (!da) {
+			da = fr_dict_unknown_afrom_fields(ctx, dhcp_vendor_da, DHCP_MAGIC_VENDOR, option);
+			if (!da) return -1;
+		}
+
+		if (decode_value(ctx, cursor, da, value, len) < 0) {
+			fr_dict_unknown_free(&da);
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+/** Decode a buffer of DHCP options, without a DHCP header
+ *
+ * @param[in] ctx context to alloc new attributes in.
+ * @param[in,out] cursor Where to write the decoded options.
+ * @param[in] data to parse.
+ * @param[in] data_len of data to parse.
+ * @return
+ *	- The number of bytes parsed.
+ *	- -1 on failure.
+ */
+ssize_t fr_dhcp_decode_options(TALLOC_CTX *ctx, vp_cursor_t *cursor, uint8_t const *data, size_t data_len)
+{
+	fr_dhcp_option_index_t	index;
+
+	if (fr_dhcp_options_index(&index, data, data_len) < 0) return -1;
+
+	if (dhcp_decode_index(ctx, cursor, &index) < 0) return -1;
+
+	return data_len;
+}
+
 int fr_dhcp_decode(RADIUS_PACKET *packet)
 {
 	size_t i;
@@ -1117,6 +1374,7 @@ int fr_dhcp_decode(RADIUS_PACKET *packet)
 	vp_cursor_t cursor;
 	VALUE_PAIR *head = NULL, *vp;
 	VALUE_PAIR *maxms, *mtu;
+	fr_dhcp_option_index_t index;
 
 	fr_pair_cursor_init(&cursor, &head);
 	p = packet->data;
@@ -1127,10 +1385,20 @@ int fr_dhcp_decode(RADIUS_PACKET *packet)
 		return -1;
 	}
 
+	if (fr_dhcp_packet_index(&index, packet->data, packet->data_len) < 0) return -1;
+
 	/*
 	 *	Decode the header.
 	 */
 	for (i = 0; i < 14; i++) {
+		/*
+		 *	sname and file hold options, not names.
+		 */
+		if (((i == 12) && (index.overload & DHCP_SNAME_FIELD)) ||
+		    ((i == 13) && (index.overload & DHCP_FILE_FIELD))) {
+			p += dhcp_header_sizes[i];
+			continue;
+		}
 
 		vp = fr_pair_make(packet, NULL, dhcp_header_names[i], NULL, T_OP_EQ);
 		if (!vp) {
@@ -1224,32 +1492,11 @@ int fr_dhcp_decode(RADIUS_PACKET *packet)
 	}
 
 	/*
-	 *	Loop over the options.
-	 */
-
-	/*
-	 * 	Nothing uses tail after this call, if it does in the future
-	 *	it'll need to find the new tail...
+	 *	Decode the options, including any in sname and file.
 	 */
-	{
-		uint8_t const *end;
-		ssize_t len;
-
-		p = packet->data + 240;
-		end = p + (packet->data_len - 240);
-
-		/*
-		 *	Loop over all the options data
-		 */
-		while (p < end) {
-			len = fr_dhcp_decode_option(packet, &cursor, fr_dict_root(fr_dict_internal),
-						    p, ((end - p) > UINT8_MAX) ? UINT8_MAX : (end - p), NULL);
-			if (len <= 0) {
-				fr_pair_list_free(&head);
-				return len;
-			}
-			p += len;
-		}
+	if (dhcp_decode_index(packet, &cursor, &index) < 0) {
+		fr_pair_list_free(&head);
+		return -1;
 	}
 
 	/*
@@ -1947,6 +2194,22 @@ int fr_dhcp_add_arp_entry(UNUSED int fd, UNUSED char const *interface,
 
 
 #ifdef HAVE_LINUX_IF_PACKET_H
+/*
+ *	Set up a device independent physical layer address, for
+ *	sending through a packet socket.
+ */
+static void dhcp_link_layer_init(struct sockaddr_ll *link_layer, int if_index)
+{
+	memset(link_layer, 0, sizeof(struct sockaddr_ll));
+
+	link_layer->sll_family = AF_PACKET;
+	link_layer->sll_protocol = htons(ETH_P_ALL);
+	link_layer->sll_ifindex = if_index;
+	link_layer->sll_hatype = ARPHRD_ETHER;
+	link_layer->sll_pkttype = PACKET_OTHERHOST;
+	link_layer->sll_halen = 6;
+}
+
 /*
  *	Open a packet interface raw socket.
  *	Bind it to the specified interface using a device independent physical layer address.
@@ -1966,14 +2229,7 @@ int fr_socket_packet(int if_index, struct sockaddr_ll *link_layer)
 	}
 
 	/* Set link layer parameters */
-	memset(link_layer, 0, sizeof(struct sockaddr_ll));
-
-	link_layer->sll_family = AF_PACKET;
-	link_layer->sll_protocol = htons(ETH_P_ALL);
-	link_layer->sll_ifindex = if_index;
-	link_layer->sll_hatype = ARPHRD_ETHER;
-	link_layer->sll_pkttype = PACKET_OTHERHOST;
-	link_layer->sll_halen = 6;
+	dhcp_link_layer_init(link_layer, if_index);
 
 	if (bind(lsock_fd, (struct sockaddr *)link_layer, sizeof(struct sockaddr_ll)) < 0) {
 		close(lsock_fd);
@@ -2058,28 +2314,26 @@ static char *ether_addr_print(const uint8_t *addr, char *buf)
 }
 
 /*
- *	For a client, receive a DHCP packet from a raw packet
- *	socket. Make sure it matches the ongoing request.
- *
- *	FIXME: split this into two, recv_raw_packet, and verify(packet, original)
+ *	Check a frame received on a raw packet socket is a DHCP
+ *	reply, which matches the ongoing request, and turn it into
+ *	a packet.
  */
-RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_layer, RADIUS_PACKET *request)
+static RADIUS_PACKET *dhcp_raw_packet_check(int sockfd, uint8_t const *raw_packet, ssize_t data_len,
+					    RADIUS_PACKET *request)
 {
 	VALUE_PAIR		*vp;
 	RADIUS_PACKET		*packet;
-	uint8_t const		*code;
+	uint8_t			code;
 	uint32_t		magic, xid;
-	ssize_t			data_len;
+	fr_dhcp_option_index_t	index;
 
-	uint8_t			*raw_packet;
-	ethernet_header_t	*eth_hdr;
-	ip_header_t		*ip_hdr;
-	udp_header_t		*udp_hdr;
-	dhcp_packet_t		*dhcp_hdr;
+	ethernet_header_t const	*eth_hdr;
+	ip_header_t const	*ip_hdr;
+	udp_header_t const	*udp_hdr;
+	dhcp_packet_t const	*dhcp_hdr;
 	uint16_t		udp_src_port;
 	uint16_t		udp_dst_port;
 	size_t			dhcp_data_len;
-	socklen_t		sock_len;
 
 	packet = fr_radius_alloc(NULL, false);
 	if (!packet) {
@@ -2087,25 +2341,14 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 		return NULL;
 	}
 
-	raw_packet = talloc_zero_array(packet, uint8_t, MAX_PACKET_SIZE);
-	if (!raw_packet) {
-		fr_strerror_printf("Out of memory");
-		fr_radius_free(&packet);
-		return NULL;
-	}
-
 	packet->sockfd = sockfd;
 
-	/* a packet was received (but maybe it is not for us) */
-	sock_len = sizeof(struct sockaddr_ll);
-	data_len = recvfrom(sockfd, raw_packet, MAX_PACKET_SIZE, 0, (struct sockaddr *)link_layer, &sock_len);
-
 	uint8_t data_offset = ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE; /* DHCP data datas after Ethernet, IP, UDP */
 
 	if (data_len <= data_offset) DISCARD_RP("Payload (%d) smaller than required for layers 2+3+4", (int)data_len);
 
 	/* map raw packet to packet header of the different layers (Ethernet, IP, UDP) */
-	eth_hdr = (ethernet_header_t *)raw_packet;
+	eth_hdr = (ethernet_header_t const *)raw_packet;
 
 	/*
 	 *	Check Ethernet layer data (L2)
@@ -2132,7 +2375,7 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 	/*
 	 *	Ethernet is OK.  Now look at IP.
 	 */
-	ip_hdr = (ip_header_t *)(raw_packet + ETH_HDR_SIZE);
+	ip_hdr = (ip_header_t const *)(raw_packet + ETH_HDR_SIZE);
 
 	/*
 	 *	Check IPv4 layer data (L3)
@@ -2148,7 +2391,7 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 	/*
 	 *	Now check UDP.
 	 */
-	udp_hdr = (udp_header_t *)(raw_packet + ETH_HDR_SIZE + IP_HDR_SIZE);
+	udp_hdr = (udp_header_t const *)(raw_packet + ETH_HDR_SIZE + IP_HDR_SIZE);
 
 	/*
 	 *	Check UDP layer data (L4)
@@ -2166,7 +2409,7 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 	if (dhcp_data_len > MAX_PACKET_SIZE) DISCARD_RP("DHCP packet is too large (%zu > %i)",
 							dhcp_data_len, MAX_PACKET_SIZE);
 
-	dhcp_hdr = (dhcp_packet_t *)(raw_packet + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE);
+	dhcp_hdr = (dhcp_packet_t const *)(raw_packet + ETH_HDR_SIZE + IP_HDR_SIZE + UDP_HDR_SIZE);
 
 	if (dhcp_hdr->htype != 1) DISCARD_RP("DHCP hardware type (%d) != Ethernet (1)", dhcp_hdr->htype);
 	if (dhcp_hdr->hlen != 6) DISCARD_RP("DHCP hardware address length (%d) != 6", dhcp_hdr->hlen);
@@ -2186,23 +2429,21 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 	/* all checks ok! this is a DHCP reply we're interested in. */
 	packet->data_len = dhcp_data_len;
 	packet->data = talloc_memdup(packet, raw_packet + data_offset, dhcp_data_len);
-	TALLOC_FREE(raw_packet);
 	packet->id = xid;
 
-	code = dhcp_get_option((dhcp_packet_t const *) packet->data, packet->data_len, PW_DHCP_MESSAGE_TYPE);
-	if (!code) {
-		fr_strerror_printf("No message-type option was found in the packet");
+	if ((fr_dhcp_packet_index(&index, packet->data, packet->data_len) < 0) ||
+	    (dhcp_message_type(&code, &index) < 0)) {
 		fr_radius_free(&packet);
 		return NULL;
 	}
 
-	if ((code[1] < 1) || (code[2] == 0) || (code[2] > 8)) {
+	if (code > 8) {
 		fr_strerror_printf("Unknown value for message-type option");
 		fr_radius_free(&packet);
 		return NULL;
 	}
 
-	packet->code = code[2] | PW_DHCP_OFFSET;
+	packet->code = code | PW_DHCP_OFFSET;
 
 	/*
 	 *	Create a unique vector from the MAC address and the
@@ -2229,6 +2470,61 @@ RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_laye
 
 	return packet;
 }
+
+/*
+ *	For a client, receive a DHCP packet from a raw packet
+ *	socket. Make sure it matches the ongoing request.
+ */
+RADIUS_PACKET *fr_dhcp_recv_raw_packet(int sockfd, struct sockaddr_ll *link_layer, RADIUS_PACKET *request)
+{
+	uint8_t			raw_packet[MAX_PACKET_SIZE];
+	ssize_t			data_len;
+	socklen_t		sock_len;
+
+	/* a packet was received (but maybe it is not for us) */
+	sock_len = sizeof(struct sockaddr_ll);
+	data_len = recvfrom(sockfd, raw_packet, sizeof(raw_packet), 0, (struct sockaddr *)link_layer, &sock_len);
+
+	return dhcp_raw_packet_check(sockfd, raw_packet, data_len, request);
+}
+
+#ifdef HAVE_PACKET_RING
+/*
+ *	Open a memory mapped receive ring on an interface, and
+ *	set up the link layer address used to send through it.
+ */
+fr_packet_ring_t *fr_dhcp_packet_ring(TALLOC_CTX *ctx, int if_index, struct sockaddr_ll *link_layer)
+{
+	fr_packet_ring_t *ring;
+
+	ring = fr_packet_ring_alloc(ctx, if_index, ETH_P_ALL, 0, false);
+	if (!ring) return NULL;
+
+	dhcp_link_layer_init(link_layer, if_index);
+
+	return ring;
+}
+
+/*
+ *	For a client, receive a DHCP packet from a memory mapped
+ *	ring.  Frames which don't match the ongoing request are
+ *	skipped, and we return NULL when the ring is empty.
+ */
+RADIUS_PACKET *fr_dhcp_recv_raw_ring(fr_packet_ring_t *ring, RADIUS_PACKET *request)
+{
+	fr_packet_ring_frame_t	frame;
+	RADIUS_PACKET		*packet;
+
+	while (fr_packet_ring_next(ring, &frame) == 1) {
+		if (frame.ll->sll_pkttype == PACKET_OUTGOING) continue;
+
+		packet = dhcp_raw_packet_check(fr_packet_ring_fd(ring), frame.data, frame.len, request);
+		if (packet) return packet;
+	}
+
+	return NULL;
+}
+#endif
 #endif
 
 /** Resolve/cache attributes in the DHCP dictionary
@@ -2245,5 +2541,7 @@ int dhcp_init(void)
 		return -1;
 	}
 
+	if (dhcp_option_table_init() < 0) return -1;
+
 	return 0;
 }
@@ -68,6 +68,10 @@ static int iface_ind = -1;
 static struct sockaddr_ll ll;	/* Socket address structure */
 #endif
 
+#ifdef HAVE_PACKET_RING
+static fr_packet_ring_t *ring;	/* Memory mapped receive ring, if we could open one */
+#endif
+
 static bool raw_mode = false;
 
 static bool reply_expected = true;
@@ -326,6 +330,11 @@ static RADIUS_PACKET *fr_dhcp_recv_raw_loop(int lsockfd,
 			/* There is something to read on our socket */
 
 #ifdef HAVE_LINUX_IF_PACKET_H
+#  ifdef HAVE_PACKET_RING
+			if (ring) {
+				cur_reply_p = fr_dhcp_recv_raw_ring(ring, request_p);
+			} else
+#  endif
 			cur_reply_p = fr_dhcp_recv_raw_packet(lsockfd, p_ll, request_p);
 #else
 #  ifdef HAVE_LIBPCAP
@@ -397,7 +406,22 @@ static int send_with_socket(RADIUS_PACKET **reply, RADIUS_PACKET *request)
 
 #ifdef HAVE_LINUX_IF_PACKET_H
 	if (raw_mode) {
+#  ifdef HAVE_PACKET_RING
+		/*
+		 *	Replies are read from the ring without a copy
+		 *	or system call per frame.  Fall back to reading
+		 *	the socket if the kernel doesn't support it.
+		 */
+		ring = fr_dhcp_packet_ring(NULL, iface_ind, &ll);
+		if (ring) {
+			sockfd = fr_packet_ring_fd(ring);
+		} else {
+			DEBUG("Can't use memory mapped ring, falling back to socket reads: %s", fr_strerror());
+			sockfd = fr_socket_packet(iface_ind, &ll);
+		}
+#  else
 		sockfd = fr_socket_packet(iface_ind, &ll);
+#  endif
 	} else
 #endif
 	{
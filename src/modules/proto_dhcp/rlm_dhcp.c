@@ -84,24 +84,15 @@ static ssize_t dhcp_options_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outl
 	for (vp = tmpl_cursor_init(NULL, &src_cursor, request, src);
 	     vp;
 	     vp = tmpl_cursor_next(&src_cursor, src)) {
-		uint8_t const	*p = vp->vp_octets, *end = p + vp->vp_length;
-		ssize_t		len;
 		VALUE_PAIR	*vps = NULL;
 		vp_cursor_t	options_cursor;
 
 		fr_pair_cursor_init(&options_cursor, &vps);
-		/*
-		 *	Loop over all the options data
-		 */
-		while (p < end) {
-			len = fr_dhcp_decode_option(request->packet, &options_cursor,
-						    fr_dict_root(fr_dict_internal), p, end - p, NULL);
-			if (len <= 0) {
-				RWDEBUG("DHCP option decoding failed: %s", fr_strerror());
-				fr_pair_list_free(&head);
-				goto error;
-			}
-			p += len;
+		if (fr_dhcp_decode_options(request->packet, &options_cursor, vp->vp_octets, vp->vp_length) < 0) {
+			RWDEBUG("DHCP option decoding failed: %s", fr_strerror());
+			fr_pair_list_free(&vps);
+			fr_pair_list_free(&head);
+			goto error;
 		}
 		fr_pair_cursor_merge(&cursor, vps);
 	}
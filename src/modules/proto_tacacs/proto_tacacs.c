@@ -29,6 +29,14 @@
 
 #include "tacacs.h"
 
+/*
+ *	Per-connection data.
+ */
+typedef struct tacacs_listen_socket_t {
+	listen_socket_t		sock;		//!< Must be first, the common socket functions use it.
+	tacacs_reader_t		*reader;	//!< Buffers data read from the connection.
+} tacacs_listen_socket_t;
+
 /*
  *	Debug the packet if requested - cribbed from common_packet_debug
  */
@@ -442,77 +450,95 @@ static void tacacs_queued(REQUEST *request, fr_state_action_t action)
 }
 
 /*
- *	Check if an incoming request is "ok"
+ *	Read packets from a connection.
  *
- *	It takes packets, not requests.  It sees if the packet looks
- *	OK.  If so, it does a number of sanity checks on it.
+ *	Clients using single-connection mode may send several packets
+ *	at once, so each read may give us part of a packet, or many
+ *	of them.
  */
 static int tacacs_socket_recv(rad_listen_t *listener)
 {
-	int		rcode;
+	ssize_t		rcode;
+	int		num = 0;
 	RADIUS_PACKET	*packet;
 	TALLOC_CTX	*ctx;
 	REQUEST		*request;
-	listen_socket_t *sock = listener->data;
+	tacacs_listen_socket_t *tsock = listener->data;
+	listen_socket_t *sock = &tsock->sock;
 	RADCLIENT	*client = sock->client;
 
 	if (!rad_cond_assert(client != NULL)) return 0;
 
 	if (listener->status != RAD_LISTEN_STATUS_KNOWN) return 0;
 
-	ctx = talloc_pool(listener, main_config.talloc_pool_size);
-	if (!ctx) return 0;
-	talloc_set_name_const(ctx, "tacacs_listener_pool");
-
-	/*
-	 *	Allocate a packet for partial reads.
-	 */
-	if (!sock->packet) {
-		sock->packet = fr_radius_alloc(ctx, false);
-		if (!sock->packet) return 0;
-
-		sock->packet->sockfd = listener->fd;
-		sock->packet->src_ipaddr = sock->other_ipaddr;
-		sock->packet->src_port = sock->other_port;
-		sock->packet->dst_ipaddr = sock->my_ipaddr;
-		sock->packet->dst_port = sock->my_port;
-		sock->packet->proto = sock->proto;
+	if (!tsock->reader) {
+		tsock->reader = tacacs_reader_alloc(tsock);
+		if (!tsock->reader) return 0;
 	}
 
-	/*
-	 *	Grab the packet currently being processed.
-	 */
-	packet = sock->packet;
-
-	rcode = tacacs_read_packet(packet, client->secret);
-	if (rcode == 0) return 0;	/* partial packet */
-	if (rcode == -1) {		/* error reading packet */
+	rcode = tacacs_reader_fill(tsock->reader, listener->fd);
+	if (rcode == -1) {
 		char buffer[256];
 
-		ERROR("Invalid packet from %s port %d, closing socket: %s",
-		       fr_inet_ntoh(&packet->src_ipaddr, buffer, sizeof(buffer)),
-		       packet->src_port, fr_strerror());
+		ERROR("Failed reading from %s port %d, closing socket: %s",
+		      fr_inet_ntoh(&sock->other_ipaddr, buffer, sizeof(buffer)),
+		      sock->other_port, fr_strerror());
 	}
-	if (rcode < 0) {		/* error or connection reset */
-		DEBUG("Client has closed connection");
+	if (rcode < 0) goto eol;
 
-		listener->status = RAD_LISTEN_STATUS_EOL;
-		radius_update_listener(listener);
+	for (;;) {
+		ctx = talloc_pool(listener, main_config.talloc_pool_size);
+		if (!ctx) break;
+		talloc_set_name_const(ctx, "tacacs_listener_pool");
 
-		return 0;
-	}
+		packet = fr_radius_alloc(ctx, false);
+		if (!packet) {
+			talloc_free(ctx);
+			break;
+		}
+
+		packet->sockfd = listener->fd;
+		packet->src_ipaddr = sock->other_ipaddr;
+		packet->src_port = sock->other_port;
+		packet->dst_ipaddr = sock->my_ipaddr;
+		packet->dst_port = sock->my_port;
+		packet->proto = sock->proto;
+
+		rcode = tacacs_reader_next(packet, tsock->reader, client->secret);
+		if (rcode == 0) {		/* no more complete packets */
+			talloc_free(ctx);
+			break;
+		}
+		if (rcode < 0) {		/* invalid packet */
+			char buffer[256];
+
+			ERROR("Invalid packet from %s port %d, closing socket: %s",
+			       fr_inet_ntoh(&packet->src_ipaddr, buffer, sizeof(buffer)),
+			       packet->src_port, fr_strerror());
+			talloc_free(ctx);
+			goto eol;
+		}
 
-	request = request_setup(ctx, listener, packet, client, NULL);
-	if (!request) {
-		talloc_free(ctx);
-		return 0;
+		request = request_setup(ctx, listener, packet, client, NULL);
+		if (!request) {
+			talloc_free(ctx);
+			continue;
+		}
+
+		request->process = tacacs_queued;
+		request_enqueue(request);
+		num++;
 	}
 
-	request->process = tacacs_queued;
-	request_enqueue(request);
+	return num;
 
-	sock->packet = NULL;	/* we have no need for more partial reads */
-	return 1;
+eol:
+	DEBUG("Client has closed connection");
+
+	listener->status = RAD_LISTEN_STATUS_EOL;
+	radius_update_listener(listener);
+
+	return 0;
 }
 
 static int tacacs_socket_error(rad_listen_t *listener, UNUSED int fd)
@@ -597,7 +623,7 @@ rad_protocol_t proto_tacacs = {
 	.name		= "tacacs",
 	.magic		= RLM_MODULE_INIT,
 	.load		= tacacs_load,
-	.inst_size	= sizeof(listen_socket_t),
+	.inst_size	= sizeof(tacacs_listen_socket_t),
 	.transports	= TRANSPORT_TCP,
 	.tls		= false,
 	.compile	= tacacs_listen_compile,
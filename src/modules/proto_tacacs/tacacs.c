@@ -184,10 +184,10 @@ bad_seqno:
 static int tacacs_xor(RADIUS_PACKET * const packet, char const *secret)
 {
 	tacacs_packet_t *pkt = (tacacs_packet_t *)packet->data;
+	FR_MD5_CTX base, ctx;
 	uint8_t pad[MD5_DIGEST_LENGTH];
-	uint8_t *buf;
-	int secret_len;
-	int pad_offset;
+	uint8_t *p, *end;
+	size_t i;
 
 	if (!secret) {
 		if (pkt->hdr.flags & TAC_PLUS_UNENCRYPTED_FLAG)
@@ -203,32 +203,48 @@ static int tacacs_xor(RADIUS_PACKET * const packet, char const *secret)
 		return -1;
 	}
 
-	secret_len = strlen(secret);
-	pad_offset = sizeof(pkt->hdr.session_id) + secret_len + sizeof(pkt->hdr.version) + sizeof(pkt->hdr.seq_no);
-
 	/* MD5_1 = MD5{session_id, key, version, seq_no} */
 	/* MD5_n = MD5{session_id, key, version, seq_no, MD5_n-1} */
-	buf = talloc_array(NULL, uint8_t, pad_offset + MD5_DIGEST_LENGTH);
 
-	memcpy(&buf[0], &pkt->hdr.session_id, sizeof(pkt->hdr.session_id));
-	memcpy(&buf[sizeof(pkt->hdr.session_id)], secret, secret_len);
-	memcpy(&buf[sizeof(pkt->hdr.session_id) + secret_len], &pkt->hdr.version, sizeof(pkt->hdr.version));
-	memcpy(&buf[sizeof(pkt->hdr.session_id) + secret_len + sizeof(pkt->hdr.version)], &pkt->hdr.seq_no, sizeof(pkt->hdr.seq_no));
-	fr_md5_calc(pad, buf, pad_offset);
+	/*
+	 *	Every block starts with the same prefix, so hash it
+	 *	once, and start each block from a copy of that state.
+	 */
+	fr_md5_init(&base);
+	fr_md5_update(&base, (uint8_t const *)&pkt->hdr.session_id, sizeof(pkt->hdr.session_id));
+	fr_md5_update(&base, (uint8_t const *)secret, strlen(secret));
+	fr_md5_update(&base, (uint8_t const *)&pkt->hdr.version, sizeof(pkt->hdr.version));
+	fr_md5_update(&base, (uint8_t const *)&pkt->hdr.seq_no, sizeof(pkt->hdr.seq_no));
 
-	size_t pos = sizeof(tacacs_packet_hdr_t);
-	do {
-		for (size_t i = 0; i < MD5_DIGEST_LENGTH && pos < packet->data_len; i++, pos++)
-			packet->data[pos] ^= pad[i];
+	fr_md5_copy(&ctx, &base);
+	fr_md5_final(pad, &ctx);
 
-		if (pos == packet->data_len)
-			break;
+	p = packet->data + sizeof(tacacs_packet_hdr_t);
+	end = packet->data + packet->data_len;
+
+	/*
+	 *	XOR whole blocks a word at a time.  The body isn't
+	 *	aligned, so go via memcpy, which the compiler turns
+	 *	into plain (or vector) loads and stores.
+	 */
+	while ((end - p) >= MD5_DIGEST_LENGTH) {
+		uint64_t body[MD5_DIGEST_LENGTH / sizeof(uint64_t)];
+		uint64_t key[MD5_DIGEST_LENGTH / sizeof(uint64_t)];
+
+		memcpy(body, p, sizeof(body));
+		memcpy(key, pad, sizeof(key));
+		for (i = 0; i < (sizeof(body) / sizeof(body[0])); i++) body[i] ^= key[i];
+		memcpy(p, body, sizeof(body));
 
-		memcpy(&buf[pad_offset], pad, MD5_DIGEST_LENGTH);
-		fr_md5_calc(pad, buf, pad_offset + MD5_DIGEST_LENGTH);
-	} while (1);
+		p += MD5_DIGEST_LENGTH;
+		if (p == end) break;
 
-	talloc_free(buf);
+		fr_md5_copy(&ctx, &base);
+		fr_md5_update(&ctx, pad, sizeof(pad));
+		fr_md5_final(pad, &ctx);
+	}
+
+	for (i = 0; p < end; i++, p++) *p ^= pad[i];
 
 	return 0;
 }
@@ -654,6 +670,53 @@ int tacacs_decode(RADIUS_PACKET * const packet)
 	return 0;
 }
 
+/*
+ *	Decrypt and check a packet which has been read in full.
+ */
+static int tacacs_recv_done(RADIUS_PACKET * const packet, char const * const secret)
+{
+	if (tacacs_xor(packet, secret) < 0) {
+		fr_strerror_printf("Failed decryption of TACACS request: %s", fr_syserror(errno));
+		return -1;
+	}
+
+#ifndef NDEBUG
+	if ((fr_debug_lvl > 3) && fr_log_fp) fr_radius_print_hex(packet);
+#endif
+
+	/*
+	 *	See if it's a well-formed TACACS packet.
+	 */
+	if (!tacacs_ok(packet, true)) {
+		return -1;
+	}
+
+	/*
+	 *	Explicitly set the VP list to empty.
+	 */
+	packet->vps = NULL;
+
+	if (fr_debug_lvl) {
+		char ip_buf[INET6_ADDRSTRLEN], buffer[256];
+
+		if (packet->src_ipaddr.af != AF_UNSPEC) {
+			inet_ntop(packet->src_ipaddr.af,
+				  &packet->src_ipaddr.ipaddr,
+				  ip_buf, sizeof(ip_buf));
+			snprintf(buffer, sizeof(buffer), "host %s port %d",
+				 ip_buf, packet->src_port);
+		} else {
+			snprintf(buffer, sizeof(buffer), "socket %d",
+				 packet->sockfd);
+		}
+
+	}
+
+	gettimeofday(&packet->timestamp, NULL);
+
+	return 1;	/* done reading the packet */
+}
+
 /*
  *	Receives a packet, assuming that the RADIUS_PACKET structure
  *	has been filled out already.
@@ -749,46 +812,124 @@ int tacacs_read_packet(RADIUS_PACKET * const packet, char const * const secret)
 		return 0;
 	}
 
-	if (tacacs_xor(packet, secret) < 0) {
-		fr_strerror_printf("Failed decryption of TACACS request: %s", fr_syserror(errno));
-		return -1;
+	return tacacs_recv_done(packet, secret);
+}
+
+/** Allocate a buffered reader for a TACACS+ connection
+ *
+ * Clients using single-connection mode may send several packets back to
+ * back.  The reader pulls in as much data as the socket has with one read,
+ * and hands out the packets one at a time.
+ *
+ * @param[in] ctx	to allocate the reader in.
+ * @return
+ *	- A new reader.
+ *	- NULL on error.
+ */
+tacacs_reader_t *tacacs_reader_alloc(TALLOC_CTX *ctx)
+{
+	tacacs_reader_t *reader;
+
+	reader = talloc_zero(ctx, tacacs_reader_t);
+	if (!reader) return NULL;
+
+	reader->size = TACACS_READ_BUFFER_SIZE;
+	reader->buffer = talloc_array(reader, uint8_t, reader->size);
+	if (!reader->buffer) {
+		talloc_free(reader);
+		return NULL;
 	}
 
-#ifndef NDEBUG
-	if ((fr_debug_lvl > 3) && fr_log_fp) fr_radius_print_hex(packet);
-#endif
+	return reader;
+}
+
+/** Read whatever is available on the socket into the reader's buffer
+ *
+ * @param[in] reader	to fill.
+ * @param[in] sockfd	to read from.
+ * @return
+ *	- The number of bytes read.
+ *	- -1 on error.
+ *	- -2 if the connection was closed.
+ */
+ssize_t tacacs_reader_fill(tacacs_reader_t *reader, int sockfd)
+{
+	ssize_t len;
 
 	/*
-	 *	See if it's a well-formed TACACS packet.
+	 *	Move any partial packet to the start of the buffer.
+	 *	There's always room for at least one whole packet
+	 *	after it.
 	 */
-	if (!tacacs_ok(packet, true)) {
+	if (reader->start > 0) {
+		memmove(reader->buffer, reader->buffer + reader->start, reader->end - reader->start);
+		reader->end -= reader->start;
+		reader->start = 0;
+	}
+
+	len = recv(sockfd, reader->buffer + reader->end, reader->size - reader->end, 0);
+	if (len == 0) return -2; /* clean close */
+
+#ifdef ECONNRESET
+	if ((len < 0) && (errno == ECONNRESET)) { /* forced */
+		return -2;
+	}
+#endif
+
+	if (len < 0) {
+		fr_strerror_printf("Error receiving packet: %s", fr_syserror(errno));
 		return -1;
 	}
 
+	reader->end += len;
+
+	return len;
+}
+
+/** Get the next complete packet from a reader
+ *
+ * @param[in] packet	to fill in.  packet->data must be NULL.
+ * @param[in] reader	to take the packet from.
+ * @param[in] secret	shared with the client.
+ * @return
+ *	- 1 if a packet was read, decrypted and checked.
+ *	- 0 if there's no complete packet in the buffer.
+ *	- -1 on error, in which case the connection should be closed.
+ */
+int tacacs_reader_next(RADIUS_PACKET * const packet, tacacs_reader_t *reader, char const * const secret)
+{
+	tacacs_packet_hdr_t const *hdr;
+	size_t available, packet_len;
+
+	rad_assert(packet->data == NULL);
+
+	available = reader->end - reader->start;
+	if (available < sizeof(tacacs_packet_hdr_t)) return 0;
+
+	hdr = (tacacs_packet_hdr_t const *)(reader->buffer + reader->start);
+	packet_len = sizeof(tacacs_packet_hdr_t) + ntohl(hdr->length);
+
 	/*
-	 *	Explicitly set the VP list to empty.
+	 *	If the packet is too big, then the socket is bad.
 	 */
-	packet->vps = NULL;
-
-	if (fr_debug_lvl) {
-		char ip_buf[INET6_ADDRSTRLEN], buffer[256];
+	if (packet_len > TACACS_MAX_PACKET_SIZE) {
+		fr_strerror_printf("Discarding packet: Larger than limitation of " STRINGIFY(TACACS_MAX_PACKET_SIZE) " bytes");
+		return -1;
+	}
 
-		if (packet->src_ipaddr.af != AF_UNSPEC) {
-			inet_ntop(packet->src_ipaddr.af,
-				  &packet->src_ipaddr.ipaddr,
-				  ip_buf, sizeof(ip_buf));
-			snprintf(buffer, sizeof(buffer), "host %s port %d",
-				 ip_buf, packet->src_port);
-		} else {
-			snprintf(buffer, sizeof(buffer), "socket %d",
-				 packet->sockfd);
-		}
+	if (available < packet_len) return 0;
 
+	packet->data = talloc_memdup(packet, reader->buffer + reader->start, packet_len);
+	if (!packet->data) {
+		fr_strerror_printf("Out of memory");
+		return -1;
 	}
+	packet->data_len = packet_len;
 
-	gettimeofday(&packet->timestamp, NULL);
+	reader->start += packet_len;
+	if (reader->start == reader->end) reader->start = reader->end = 0;
 
-	return 1;	/* done reading the packet */
+	return tacacs_recv_done(packet, secret);
 }
 
 int tacacs_send(RADIUS_PACKET * const packet, RADIUS_PACKET const * const original, char const * const secret)
@@ -20,6 +20,7 @@
 #define _FR_TACACS_H
 
 #define TACACS_MAX_PACKET_SIZE		4096
+#define TACACS_READ_BUFFER_SIZE		(4 * TACACS_MAX_PACKET_SIZE)
 
 #define TAC_PLUS_MAJOR_VER		12
 #define TAC_PLUS_MINOR_VER_DEFAULT	0
@@ -233,10 +234,23 @@ typedef struct CC_HINT(__packed__) tacacs_packet {
 	};
 } tacacs_packet_t;
 
+/** Buffered reader for a TACACS+ connection
+ *
+ */
+typedef struct tacacs_reader {
+	uint8_t				*buffer;
+	size_t				size;		//!< Of the buffer.
+	size_t				start;		//!< Of the first packet not yet returned.
+	size_t				end;		//!< Of the data read from the socket.
+} tacacs_reader_t;
+
 tacacs_type_t tacacs_type(RADIUS_PACKET const * const packet);
 char const * tacacs_lookup_packet_code(RADIUS_PACKET const * const packet);
 uint32_t tacacs_session_id(RADIUS_PACKET const * const packet);
 int tacacs_read_packet(RADIUS_PACKET * const packet, char const * const secret);
+tacacs_reader_t *tacacs_reader_alloc(TALLOC_CTX *ctx);
+ssize_t tacacs_reader_fill(tacacs_reader_t *reader, int sockfd);
+int tacacs_reader_next(RADIUS_PACKET * const packet, tacacs_reader_t *reader, char const * const secret);
 int tacacs_decode(RADIUS_PACKET * const packet);
 int tacacs_encode(RADIUS_PACKET * const packet, char const * const secret);
 int tacacs_send(RADIUS_PACKET * const packet, RADIUS_PACKET const * const original, char const * const secret);
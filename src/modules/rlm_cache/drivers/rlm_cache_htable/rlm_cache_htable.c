@@ -0,0 +1,645 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_cache_htable.c
+ * @brief Lock striped, hash table based cache.
+ *
+ * The cache is split into a number of stripes, selected by the hash of the
+ * entry key.  Each stripe has its own mutex, hash table, expiry heap, and
+ * memory budget, so workers only contend when they're accessing keys in the
+ * same stripe.
+ *
+ * When a stripe's memory budget would be exceeded by a new entry, older
+ * entries are evicted using the CLOCK algorithm.  Entries are kept in a
+ * ring, and have a reference bit which is set whenever they're retrieved.
+ * The hand sweeps around the ring, clearing reference bits, and evicting
+ * the first entry it finds which hasn't been referenced since the last sweep.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/heap.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_STDATOMIC_H
+#  include <stdatomic.h>
+#else
+#  include <freeradius-devel/stdatomic.h>
+#endif
+
+#include "../../rlm_cache.h"
+
+#define MAX_STRIPES	1024
+
+#define STAT_INC(_stat) atomic_fetch_add_explicit(&(_stat), 1, memory_order_relaxed)
+#define STAT_LOAD(_stat) atomic_load_explicit(&(_stat), memory_order_relaxed)
+
+typedef struct rlm_cache_htable_entry rlm_cache_htable_entry_t;
+
+struct rlm_cache_htable_entry {
+	rlm_cache_entry_t		fields;		//!< Entry data.
+	uint32_t			hash;		//!< Of the key.
+	size_t				offset;		//!< Offset used for heap.
+	size_t				size;		//!< Memory used by the entry, when it was inserted.
+
+	bool				referenced;	//!< Entry has been retrieved since the hand
+							//!< last passed it.
+	rlm_cache_htable_entry_t	*prev;		//!< Previous entry in the CLOCK ring.
+	rlm_cache_htable_entry_t	*next;		//!< Next entry in the CLOCK ring.
+};
+
+typedef struct rlm_cache_htable_stripe {
+	pthread_mutex_t			mutex;		//!< Protects everything else in the stripe.
+
+	fr_hash_table_t			*cache;		//!< For looking up cache keys.
+	fr_heap_t			*heap;		//!< For managing entry expiry.
+	rlm_cache_htable_entry_t	*hand;		//!< Next entry to consider for eviction.
+
+	size_t				size;		//!< Memory used by entries in this stripe.
+	size_t				max_size;	//!< Entries are evicted to stay below this.
+
+	/*
+	 *	Statistics.  Only written with the mutex held, but
+	 *	read without it, so they can be used whilst a
+	 *	stripe is locked.
+	 */
+	atomic_uint_fast32_t		num;		//!< Entries in this stripe.
+	atomic_uint_fast64_t		used;		//!< Copy of size.
+	atomic_uint_fast64_t		hits;		//!< Entries retrieved.
+	atomic_uint_fast64_t		misses;		//!< Lookups which didn't find an entry.
+	atomic_uint_fast64_t		evictions;	//!< Entries evicted to stay within max_size.
+	atomic_uint_fast64_t		expirations;	//!< Entries removed because they expired.
+} rlm_cache_htable_stripe_t;
+
+typedef struct rlm_cache_htable {
+	uint32_t			num_stripes;	//!< Number of stripes, a power of 2.
+	size_t				max_size;	//!< Memory budget for the whole cache.
+
+	rlm_cache_htable_stripe_t	*stripes;	//!< Array of stripes.
+} rlm_cache_htable_t;
+
+/** Tracks which stripe a request has locked
+ *
+ * The acquire callback doesn't know the key, so the stripe is locked on first
+ * use, and stays locked until the handle is released.  All the operations for
+ * a single call to rlm_cache use the same key, so only one stripe is ever held.
+ */
+typedef struct rlm_cache_htable_handle {
+	rlm_cache_htable_t		*driver;
+	rlm_cache_htable_stripe_t	*stripe;	//!< The stripe we hold the mutex for, or NULL.
+} rlm_cache_htable_handle_t;
+
+static const CONF_PARSER driver_config[] = {
+	{ FR_CONF_OFFSET("stripes", PW_TYPE_INTEGER, rlm_cache_htable_t, num_stripes), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_size", PW_TYPE_SIZE, rlm_cache_htable_t, max_size), .dflt = "0" },
+	CONF_PARSER_TERMINATOR
+};
+
+static uint32_t cache_entry_hash(void const *data)
+{
+	rlm_cache_htable_entry_t const *c = data;
+
+	return c->hash;
+}
+
+/** Compare two entries by key
+ *
+ * There may only be one entry with the same key.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one;
+	rlm_cache_entry_t const *b = two;
+
+	if (a->key_len < b->key_len) return -1;
+	if (a->key_len > b->key_len) return +1;
+
+	return memcmp(a->key, b->key, a->key_len);
+}
+
+/** Compare two entries by expiry time
+ *
+ * There may be multiple entries with the same expiry time.
+ */
+static int cache_heap_cmp(void const *one, void const *two)
+{
+	rlm_cache_entry_t const *a = one;
+	rlm_cache_entry_t const *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+/** Lock the stripe a key belongs to
+ *
+ * The hash table uses the low bits of the hash to select a bucket, so use
+ * the high bits to select the stripe.
+ */
+static rlm_cache_htable_stripe_t *cache_stripe_lock(rlm_cache_htable_handle_t *handle, uint32_t hash)
+{
+	rlm_cache_htable_t		*driver = handle->driver;
+	rlm_cache_htable_stripe_t	*stripe;
+
+	stripe = &driver->stripes[(hash >> 16) & (driver->num_stripes - 1)];
+	if (handle->stripe) {
+		rad_assert(handle->stripe == stripe);
+		return stripe;
+	}
+
+	pthread_mutex_lock(&stripe->mutex);
+	handle->stripe = stripe;
+
+	return stripe;
+}
+
+/** Remove an entry from a stripe and free it
+ *
+ * @note stripe mutex must be held.
+ */
+static void cache_stripe_remove(rlm_cache_htable_stripe_t *stripe, rlm_cache_htable_entry_t *c)
+{
+	fr_hash_table_yank(stripe->cache, c);
+	fr_heap_extract(stripe->heap, c);
+
+	if (c->next == c) {
+		stripe->hand = NULL;
+	} else {
+		c->prev->next = c->next;
+		c->next->prev = c->prev;
+		if (stripe->hand == c) stripe->hand = c->next;
+	}
+
+	stripe->size -= c->size;
+	atomic_store_explicit(&stripe->used, stripe->size, memory_order_relaxed);
+	atomic_store_explicit(&stripe->num, fr_hash_table_num_elements(stripe->cache), memory_order_relaxed);
+
+	talloc_free(c);
+}
+
+/** Remove expired entries from a stripe
+ *
+ * @note stripe mutex must be held.
+ */
+static void cache_stripe_reap(rlm_cache_htable_stripe_t *stripe, time_t now)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while ((c = fr_heap_peek(stripe->heap)) && (c->fields.expires < now)) {
+		cache_stripe_remove(stripe, c);
+		STAT_INC(stripe->expirations);
+	}
+}
+
+/** Evict entries until there's space for a new entry
+ *
+ * @note stripe mutex must be held.
+ *
+ * @param[in] stripe	to evict entries from.
+ * @param[in] size	of the entry being inserted.
+ */
+static void cache_stripe_evict(rlm_cache_htable_stripe_t *stripe, size_t size)
+{
+	rlm_cache_htable_entry_t *c;
+
+	while (stripe->hand && ((stripe->size + size) > stripe->max_size)) {
+		c = stripe->hand;
+
+		/*
+		 *	Give it a second chance.
+		 */
+		if (c->referenced) {
+			c->referenced = false;
+			stripe->hand = c->next;
+			continue;
+		}
+
+		cache_stripe_remove(stripe, c);
+		STAT_INC(stripe->evictions);
+	}
+}
+
+static int _cache_entry_free(UNUSED void *ctx, void *data)
+{
+	talloc_free(data);
+
+	return 0;
+}
+
+/** Cleanup a cache_htable instance
+ *
+ */
+static int mod_detach(void *instance)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i;
+
+	if (!driver->stripes) return 0;
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		rlm_cache_htable_stripe_t *stripe = &driver->stripes[i];
+
+		if (stripe->heap) fr_heap_delete(stripe->heap);
+		if (stripe->cache) {
+			fr_hash_table_walk(stripe->cache, _cache_entry_free, NULL);
+			fr_hash_table_free(stripe->cache);
+		}
+
+		pthread_mutex_destroy(&stripe->mutex);
+	}
+
+	return 0;
+}
+
+/** Return statistics for the cache
+ *
+ * The xlat may be expanded whilst this request, or another one, holds a
+ * stripe mutex (e.g. in the cache's own update section), so the counters
+ * are read without locking.  The totals may be slightly out of date.
+ *
+ * Usage: %{<cache>_stats:hits|misses|evictions|expirations|entries|size}
+ */
+static ssize_t cache_stats_xlat(TALLOC_CTX *ctx, char **out, UNUSED size_t outlen,
+				void const *mod_inst, UNUSED void const *xlat_inst,
+				REQUEST *request, char const *fmt)
+{
+	rlm_cache_htable_t const	*driver = mod_inst;
+	uint64_t			hits = 0, misses = 0, evictions = 0, expirations = 0, entries = 0, size = 0;
+	uint64_t			value;
+	uint32_t			i;
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		rlm_cache_htable_stripe_t *stripe = &driver->stripes[i];
+
+		hits += STAT_LOAD(stripe->hits);
+		misses += STAT_LOAD(stripe->misses);
+		evictions += STAT_LOAD(stripe->evictions);
+		expirations += STAT_LOAD(stripe->expirations);
+		entries += STAT_LOAD(stripe->num);
+		size += STAT_LOAD(stripe->used);
+	}
+
+	if (strcmp(fmt, "hits") == 0) {
+		value = hits;
+	} else if (strcmp(fmt, "misses") == 0) {
+		value = misses;
+	} else if (strcmp(fmt, "evictions") == 0) {
+		value = evictions;
+	} else if (strcmp(fmt, "expirations") == 0) {
+		value = expirations;
+	} else if (strcmp(fmt, "entries") == 0) {
+		value = entries;
+	} else if (strcmp(fmt, "size") == 0) {
+		value = size;
+	} else {
+		REDEBUG("Unknown statistic \"%s\"", fmt);
+		return -1;
+	}
+
+	*out = talloc_typed_asprintf(ctx, "%" PRIu64, value);
+
+	return talloc_array_length(*out) - 1;
+}
+
+/** Create a new cache_htable instance
+ *
+ * @copydetails cache_instantiate_t
+ */
+static int mod_instantiate(rlm_cache_config_t const *config, void *instance, CONF_SECTION *conf)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i, num_stripes;
+	char			*name;
+
+	FR_INTEGER_BOUND_CHECK("stripes", driver->num_stripes, >=, 1);
+	FR_INTEGER_BOUND_CHECK("stripes", driver->num_stripes, <=, MAX_STRIPES);
+
+	/*
+	 *	Round up to a power of 2, so the stripe
+	 *	can be selected with a mask.
+	 */
+	for (num_stripes = 1; num_stripes < driver->num_stripes; num_stripes <<= 1);
+	driver->num_stripes = num_stripes;
+
+	if (driver->max_size && ((driver->max_size / driver->num_stripes) < 1024)) {
+		cf_log_err_cs(conf, "'max_size' must be at least 1k per stripe (%zu)",
+			      (size_t)driver->num_stripes * 1024);
+		return -1;
+	}
+
+	driver->stripes = talloc_zero_array(driver, rlm_cache_htable_stripe_t, driver->num_stripes);
+	if (!driver->stripes) return -1;
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		rlm_cache_htable_stripe_t *stripe = &driver->stripes[i];
+
+		/*
+		 *	Not parented by the driver, the instance
+		 *	data has a memory limit after instantiation.
+		 */
+		stripe->cache = fr_hash_table_create(NULL, cache_entry_hash, cache_entry_cmp, NULL);
+		if (!stripe->cache) {
+			ERROR("Failed to create cache");
+			return -1;
+		}
+
+		stripe->heap = fr_heap_create(cache_heap_cmp, offsetof(rlm_cache_htable_entry_t, offset));
+		if (!stripe->heap) {
+			ERROR("Failed to create heap for the cache");
+			return -1;
+		}
+
+		stripe->max_size = driver->max_size ? driver->max_size / driver->num_stripes : SIZE_MAX;
+		atomic_init(&stripe->num, 0);
+		atomic_init(&stripe->used, 0);
+		atomic_init(&stripe->hits, 0);
+		atomic_init(&stripe->misses, 0);
+		atomic_init(&stripe->evictions, 0);
+		atomic_init(&stripe->expirations, 0);
+
+		if (pthread_mutex_init(&stripe->mutex, NULL) < 0) {
+			ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+			return -1;
+		}
+	}
+
+	name = talloc_typed_asprintf(NULL, "%s_stats", config->name);
+	xlat_register(driver, name, cache_stats_xlat, NULL, NULL, 0, 0);
+	talloc_free(name);
+
+	return 0;
+}
+
+/** Custom allocation function for the driver
+ *
+ * Allows allocation of cache entry structures with additional fields.
+ *
+ * @copydetails cache_entry_alloc_t
+ */
+static rlm_cache_entry_t *cache_entry_alloc(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					    REQUEST *request)
+{
+	rlm_cache_htable_entry_t *c;
+
+	c = talloc_zero(NULL, rlm_cache_htable_entry_t);
+	if (!c) {
+		RERROR("Failed allocating cache entry");
+		return NULL;
+	}
+
+	return (rlm_cache_entry_t *)c;
+}
+
+/** Locate a cache entry
+ *
+ * @copydetails cache_entry_find_t
+ */
+static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
+				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_stripe_t	*stripe;
+	rlm_cache_htable_entry_t	*c, my_c;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	stripe = cache_stripe_lock(handle, my_c.hash);
+
+	/*
+	 *	Clear out old entries
+	 */
+	cache_stripe_reap(stripe, request->packet->timestamp.tv_sec);
+
+	/*
+	 *	Is there an entry for this key?
+	 */
+	c = fr_hash_table_finddata(stripe->cache, &my_c);
+	if (!c) {
+		STAT_INC(stripe->misses);
+		*out = NULL;
+		return CACHE_MISS;
+	}
+
+	c->referenced = true;
+	STAT_INC(stripe->hits);
+	*out = &c->fields;
+
+	return CACHE_OK;
+}
+
+/** Free an entry and remove it from the data store
+ *
+ * @copydetails cache_entry_expire_t
+ */
+static cache_status_t cache_entry_expire(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					 REQUEST *request, void *handle,
+					 uint8_t const *key, size_t key_len)
+{
+	rlm_cache_htable_stripe_t	*stripe;
+	rlm_cache_htable_entry_t	*c, my_c;
+
+	if (!request) return CACHE_ERROR;
+
+	my_c.fields.key = key;
+	my_c.fields.key_len = key_len;
+	my_c.hash = fr_hash(key, key_len);
+
+	stripe = cache_stripe_lock(handle, my_c.hash);
+
+	c = fr_hash_table_finddata(stripe->cache, &my_c);
+	if (!c) return CACHE_MISS;
+
+	cache_stripe_remove(stripe, c);
+
+	return CACHE_OK;
+}
+
+/** Insert a new entry into the data store
+ *
+ * @copydetails cache_entry_insert_t
+ */
+static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					 REQUEST *request, void *handle,
+					 rlm_cache_entry_t const *entry)
+{
+	rlm_cache_htable_stripe_t	*stripe;
+	rlm_cache_htable_entry_t	*c, *old;
+
+	if (!request) return CACHE_ERROR;
+
+	memcpy(&c, &entry, sizeof(c));
+
+	c->hash = fr_hash(c->fields.key, c->fields.key_len);
+	c->size = talloc_total_size(c);
+
+	stripe = cache_stripe_lock(handle, c->hash);
+
+	if (c->size > stripe->max_size) {
+		RWDEBUG("Entry is larger than the maximum stripe size (%zu > %zu bytes)", c->size, stripe->max_size);
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	Allow overwriting
+	 */
+	old = fr_hash_table_finddata(stripe->cache, c);
+	if (old) cache_stripe_remove(stripe, old);
+
+	cache_stripe_reap(stripe, request->packet->timestamp.tv_sec);
+	cache_stripe_evict(stripe, c->size);
+
+	if (!fr_hash_table_insert(stripe->cache, c)) {
+		RERROR("Failed adding entry");
+		return CACHE_ERROR;
+	}
+
+	if (!fr_heap_insert(stripe->heap, c)) {
+		fr_hash_table_yank(stripe->cache, c);
+		RERROR("Failed adding entry to expiry heap");
+		return CACHE_ERROR;
+	}
+
+	/*
+	 *	Add it behind the hand, so it's the last
+	 *	entry to be considered for eviction.
+	 */
+	c->referenced = false;
+	if (!stripe->hand) {
+		c->prev = c->next = c;
+		stripe->hand = c;
+	} else {
+		c->next = stripe->hand;
+		c->prev = stripe->hand->prev;
+		c->prev->next = c;
+		stripe->hand->prev = c;
+	}
+
+	stripe->size += c->size;
+	atomic_store_explicit(&stripe->used, stripe->size, memory_order_relaxed);
+	atomic_store_explicit(&stripe->num, fr_hash_table_num_elements(stripe->cache), memory_order_relaxed);
+
+	return CACHE_OK;
+}
+
+/** Update the TTL of an entry
+ *
+ * @copydetails cache_entry_set_ttl_t
+ */
+static cache_status_t cache_entry_set_ttl(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+					  REQUEST *request, void *handle,
+					  rlm_cache_entry_t *entry)
+{
+	rlm_cache_htable_stripe_t	*stripe;
+	rlm_cache_htable_entry_t	*c = (rlm_cache_htable_entry_t *)entry;
+	int				ret;
+
+	stripe = cache_stripe_lock(handle, c->hash);
+
+	ret = fr_heap_extract(stripe->heap, c);
+	rad_assert(ret == 1);
+	if (ret != 1) {					/* Need this check if we're not building with asserts */
+		RERROR("Entry not in heap");
+		return CACHE_ERROR;
+	}
+
+	if (!fr_heap_insert(stripe->heap, c)) {
+		cache_stripe_remove(stripe, c);		/* make sure we don't leak entries... */
+		RERROR("Failed updating entry TTL.  Entry was forcefully expired");
+		return CACHE_ERROR;
+	}
+
+	return CACHE_OK;
+}
+
+/** Return the number of entries in the cache
+ *
+ * This may be called whilst a stripe is locked, so the counts are read
+ * without locking, and the total may be slightly out of date.
+ *
+ * @copydetails cache_entry_count_t
+ */
+static uint32_t cache_entry_count(UNUSED rlm_cache_config_t const *config, void *instance,
+				  UNUSED REQUEST *request, UNUSED void *handle)
+{
+	rlm_cache_htable_t	*driver = instance;
+	uint32_t		i, count = 0;
+
+	for (i = 0; i < driver->num_stripes; i++) {
+		count += STAT_LOAD(driver->stripes[i].num);
+	}
+
+	return count;
+}
+
+/** Allocate a handle to track which stripe is locked
+ *
+ * @copydetails cache_acquire_t
+ */
+static int cache_acquire(void **handle, UNUSED rlm_cache_config_t const *config, void *instance,
+			 REQUEST *request)
+{
+	rlm_cache_htable_handle_t *h;
+
+	h = talloc_zero(request, rlm_cache_htable_handle_t);
+	if (!h) return -1;
+
+	h->driver = instance;
+	*handle = h;
+
+	return 0;
+}
+
+/** Release the stripe mutex (if held), and free the handle
+ *
+ * @copydetails cache_release_t
+ */
+static void cache_release(UNUSED rlm_cache_config_t const *config, UNUSED void *instance, REQUEST *request,
+			  rlm_cache_handle_t *handle)
+{
+	rlm_cache_htable_handle_t *h = handle;
+
+	if (h->stripe) {
+		pthread_mutex_unlock(&h->stripe->mutex);
+		RDEBUG3("Mutex released");
+	}
+
+	talloc_free(h);
+}
+
+extern cache_driver_t rlm_cache_htable;
+cache_driver_t rlm_cache_htable = {
+	.name		= "rlm_cache_htable",
+	.magic		= RLM_MODULE_INIT,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.inst_size	= sizeof(rlm_cache_htable_t),
+	.config		= driver_config,
+	.alloc		= cache_entry_alloc,
+
+	.find		= cache_entry_find,
+	.insert		= cache_entry_insert,
+	.expire		= cache_entry_expire,
+	.set_ttl	= cache_entry_set_ttl,
+	.count		= cache_entry_count,
+
+	.acquire	= cache_acquire,
+	.release	= cache_release,
+};
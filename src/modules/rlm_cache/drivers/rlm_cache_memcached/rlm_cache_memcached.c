@@ -150,7 +150,7 @@ static void cache_entry_free(rlm_cache_entry_t *c)
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+				       rlm_cache_config_t const *config, UNUSED void *instance,
 				       REQUEST *request, void *handle, uint8_t const *key, size_t key_len)
 {
 	rlm_cache_memcached_handle_t *mandle = handle;
@@ -174,17 +174,32 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_ERROR;
 	}
 	RDEBUG2("Retrieved %zu bytes from memcached", len);
-	RDEBUG2("%s", from_store);
 
 	c = talloc_zero(NULL,  rlm_cache_entry_t);
-	ret = cache_deserialize(c, from_store, len);
+	if (cache_serialized_is_binary(from_store, len)) {
+		ret = cache_deserialize_binary(c, (uint8_t const *)from_store, len, config->dict_fingerprint);
+	} else {
+		RDEBUG2("%s", from_store);
+		ret = cache_deserialize(c, from_store, len);
+	}
 	free(from_store);
 	if (ret < 0) {
 		RERROR("%s", fr_strerror());
 		talloc_free(c);
 		return CACHE_ERROR;
 	}
+
+	/*
+	 *	Written with different dictionaries, it'll be
+	 *	replaced when the new entry is inserted.
+	 */
+	if (ret > 0) {
+		RDEBUG2("%s, ignoring", fr_strerror());
+		talloc_free(c);
+		return CACHE_MISS;
+	}
 	c->key = talloc_memdup(c, key, key_len);
+	c->key_len = key_len;
 	*out = c;
 
 	return CACHE_OK;
@@ -194,7 +209,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, UNUSED void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, UNUSED void *instance,
 					 REQUEST *request, void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_memcached_handle_t *mandle = handle;
@@ -202,20 +217,46 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	memcached_return_t ret;
 
 	TALLOC_CTX *pool;
-	char *to_store;
+	char *to_store = NULL;
+	size_t to_store_len = 0;
 
 	pool = talloc_pool(NULL, 1024);
 	if (!pool) return CACHE_ERROR;
 
-	if (cache_serialize(pool, &to_store, c) < 0) {
-		talloc_free(pool);
+	/*
+	 *	Fall back to the text format if the entry
+	 *	can't be represented in the binary format.
+	 */
+	if (config->binary) {
+		uint8_t *bin;
+
+		switch (cache_serialize_binary(pool, &bin, c, config->dict_fingerprint)) {
+		case 0:
+			to_store = (char *)bin;
+			to_store_len = talloc_array_length(bin);
+			break;
+
+		case 1:
+			RDEBUG3("Entry can't be represented in binary format, using text");
+			break;
+
+		default:
+			talloc_free(pool);
+			return CACHE_ERROR;
+		}
+	}
+
+	if (!to_store) {
+		if (cache_serialize(pool, &to_store, c) < 0) {
+			talloc_free(pool);
 
-		return CACHE_ERROR;
+			return CACHE_ERROR;
+		}
+		if (to_store) to_store_len = talloc_array_length(to_store) - 1;
 	}
 
 	ret = memcached_set(mandle->handle, (char const *)c->key, c->key_len,
-		            to_store ? to_store : "",
-		            to_store ? talloc_array_length(to_store) - 1 : 0, c->expires, 0);
+		            to_store ? to_store : "", to_store_len, c->expires, 0);
 	talloc_free(pool);
 	if (ret != MEMCACHED_SUCCESS) {
 		RERROR("Failed storing entry: %s: %s", memcached_strerror(mandle->handle, ret),
@@ -27,6 +27,7 @@
 #include <freeradius-devel/rad_assert.h>
 
 #include "../../rlm_cache.h"
+#include "../../serialize.h"
 #include "../../../rlm_redis/redis.h"
 #include "../../../rlm_redis/cluster.h"
 
@@ -101,7 +102,7 @@ static void cache_entry_free(rlm_cache_entry_t *c)
  * @copydetails cache_entry_find_t
  */
 static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
-				       UNUSED rlm_cache_config_t const *config, void *instance,
+				       rlm_cache_config_t const *config, void *instance,
 				       REQUEST *request, UNUSED void *handle, uint8_t const *key, size_t key_len)
 {
 	rlm_cache_redis_t		*driver = instance;
@@ -163,6 +164,41 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
 		return CACHE_MISS;
 	}
 
+	/*
+	 *	Entries in the binary format are stored as a
+	 *	single element list.
+	 */
+	if ((reply->elements == 1) && (reply->element[0]->type == REDIS_REPLY_STRING) &&
+	    cache_serialized_is_binary(reply->element[0]->str, reply->element[0]->len)) {
+		int ret;
+
+		c = talloc_zero(NULL, rlm_cache_entry_t);
+		ret = cache_deserialize_binary(c, (uint8_t const *)reply->element[0]->str,
+					       reply->element[0]->len, config->dict_fingerprint);
+		fr_redis_reply_free(reply);
+		if (ret < 0) {
+			RERROR("%s", fr_strerror());
+			talloc_free(c);
+			return CACHE_ERROR;
+		}
+
+		/*
+		 *	Written with different dictionaries, it'll be
+		 *	replaced when the new entry is inserted.
+		 */
+		if (ret > 0) {
+			RDEBUG2("%s, ignoring", fr_strerror());
+			talloc_free(c);
+			return CACHE_MISS;
+		}
+
+		c->key = talloc_memdup(c, key, key_len);
+		c->key_len = key_len;
+		*out = c;
+
+		return CACHE_OK;
+	}
+
 	if (reply->elements % 3) {
 		REDEBUG("Invalid number of reply elements (%zu).  "
 			"Reply must contain triplets of keys operators and values",
@@ -242,7 +278,7 @@ static cache_status_t cache_entry_find(rlm_cache_entry_t **out,
  *
  * @copydetails cache_entry_insert_t
  */
-static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config, void *instance,
+static cache_status_t cache_entry_insert(rlm_cache_config_t const *config, void *instance,
 					 REQUEST *request, UNUSED void *handle, const rlm_cache_entry_t *c)
 {
 	rlm_cache_redis_t	*driver = instance;
@@ -314,6 +350,37 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 	pool = talloc_pool(request, 1024);
 	if (!pool) return CACHE_ERROR;
 
+	/*
+	 *	The binary format is pushed as a single element,
+	 *	falling back to the text format if the entry
+	 *	can't be represented.
+	 */
+	if (config->binary) {
+		uint8_t *bin;
+
+		switch (cache_serialize_binary(pool, &bin, c, config->dict_fingerprint)) {
+		case 0:
+			argv = talloc_array(pool, char const *, 3);
+			argv_len = talloc_array(pool, size_t, 3);
+
+			argv[0] = command;
+			argv_len[0] = sizeof(command) - 1;
+			argv[1] = (char const *)c->key;
+			argv_len[1] = c->key_len;
+			argv[2] = (char const *)bin;
+			argv_len[2] = talloc_array_length(bin);
+			goto pipeline;
+
+		case 1:
+			RDEBUG3("Entry can't be represented in binary format, using text");
+			break;
+
+		default:
+			talloc_free(pool);
+			return CACHE_ERROR;
+		}
+	}
+
 	argv_p = argv = talloc_array(pool, char const *, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 	argv_len_p = argv_len = talloc_array(pool, size_t, (cnt * 3) + 2);	/* pair = 3 + cmd + key */
 
@@ -336,6 +403,7 @@ static cache_status_t cache_entry_insert(UNUSED rlm_cache_config_t const *config
 		argv_len_p += 3;
 	}
 
+pipeline:
 	RDEBUG3("Pipelining commands");
 
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, driver->cluster, request, c->key, c->key_len, false);
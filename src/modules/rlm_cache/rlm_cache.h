@@ -53,6 +53,10 @@ typedef struct rlm_cache_config_t {
 	uint32_t		max_entries;		//!< Maximum entries allowed.
 	int32_t			epoch;			//!< Time after which entries are considered valid.
 	bool			stats;			//!< Generate statistics.
+	bool			binary;			//!< Drivers which serialize entries should use
+							//!< the binary format.
+	uint32_t		dict_fingerprint;	//!< Of the dictionaries in use when the module
+							//!< was instantiated.  Written to binary entries.
 } rlm_cache_config_t;
 
 /*
@@ -25,6 +25,8 @@
  */
 RCSID("$Id$")
 
+#include <freeradius-devel/rad_assert.h>
+
 #include "rlm_cache.h"
 #include "serialize.h"
 
@@ -172,3 +174,407 @@ int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen)
 
 	return 0;
 }
+
+/*
+ *	Binary format.  All integers are in network byte order.
+ *
+ *	Header:
+ *	  uint8_t	CACHE_BINARY_MAGIC
+ *	  uint8_t	CACHE_BINARY_VERSION
+ *	  uint32_t	Dictionary fingerprint.
+ *	  uint64_t	Created.
+ *	  uint64_t	Expires.
+ *
+ *	Then for each map:
+ *	  uint32_t	Vendor.
+ *	  uint32_t	Attribute number.
+ *	  uint8_t	Data type.
+ *	  uint8_t	Operator.
+ *	  uint8_t	Request qualifier.
+ *	  uint8_t	List qualifier.
+ *	  int8_t	Tag.
+ *	  uint32_t	Value length.
+ *	  uint8_t	Value.
+ */
+#define CACHE_BINARY_HDR_LEN	(1 + 1 + 4 + 8 + 8)
+#define CACHE_BINARY_MAP_LEN	(4 + 4 + 1 + 1 + 1 + 1 + 1 + 4)
+
+/** Return the length of a value in the binary format
+ *
+ * @param[in] type	of the value.
+ * @param[in] length	of the value, only used for variable length types.
+ * @return
+ *	- Length of the encoded value.
+ *	- -1 if the type can't be represented.
+ */
+static ssize_t cache_binary_value_len(PW_TYPE type, size_t length)
+{
+	switch (type) {
+	case PW_TYPE_STRING:
+	case PW_TYPE_OCTETS:
+		return length;
+
+	case PW_TYPE_BOOLEAN:
+	case PW_TYPE_BYTE:
+		return 1;
+
+	case PW_TYPE_SHORT:
+		return 2;
+
+	case PW_TYPE_INTEGER:
+	case PW_TYPE_SIGNED:
+	case PW_TYPE_DATE:
+	case PW_TYPE_IPV4_ADDR:
+		return 4;
+
+	case PW_TYPE_INTEGER64:
+	case PW_TYPE_IFID:
+		return 8;
+
+	case PW_TYPE_IPV4_PREFIX:
+	case PW_TYPE_ETHERNET:
+		return 6;
+
+	case PW_TYPE_IPV6_ADDR:
+		return 16;
+
+	case PW_TYPE_IPV6_PREFIX:
+		return 18;
+
+	default:
+		return -1;
+	}
+}
+
+/** Check whether a map can be represented in the binary format
+ *
+ * Attributes are identified by vendor and number, so only attributes which
+ * can be found again that way can be encoded.
+ */
+static ssize_t cache_binary_map_len(vp_map_t const *map)
+{
+	fr_dict_attr_t const	*da;
+
+	if ((map->lhs->type != TMPL_TYPE_ATTR) || (map->rhs->type != TMPL_TYPE_DATA)) return -1;
+
+	da = map->lhs->tmpl_da;
+	if (da->flags.is_unknown || (map->rhs->tmpl_value_box_type != da->type)) return -1;
+	if (fr_dict_attr_by_num(fr_dict_internal, da->vendor, da->attr) != da) return -1;
+
+	return cache_binary_value_len(da->type, map->rhs->tmpl_value_box_length);
+}
+
+/** Serialize a cache entry in the binary format
+ *
+ * Attributes are written as dictionary numbers with their values in network
+ * byte order, so the entry can be decoded without parsing strings.
+ *
+ * @param[in] ctx		to allocate the buffer in.
+ * @param[out] out		Where to write the serialized entry.
+ * @param[in] c			Cache entry to serialize.
+ * @param[in] fingerprint	of the dictionaries in use.
+ * @return
+ *	- 0 on success.
+ *	- 1 if the entry contains maps which can't be represented in the binary
+ *	  format.  The caller should use #cache_serialize instead.
+ *	- -1 on failure.
+ */
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c, uint32_t fingerprint)
+{
+	vp_map_t	*map;
+	size_t		len = CACHE_BINARY_HDR_LEN;
+	ssize_t		value_len;
+	uint8_t		*buff, *p;
+	uint32_t	u32;
+	uint64_t	u64;
+
+	for (map = c->maps; map; map = map->next) {
+		value_len = cache_binary_map_len(map);
+		if (value_len < 0) return 1;
+
+		len += CACHE_BINARY_MAP_LEN + value_len;
+	}
+
+	buff = talloc_array(ctx, uint8_t, len);
+	if (!buff) return -1;
+	p = buff;
+
+	*p++ = CACHE_BINARY_MAGIC;
+	*p++ = CACHE_BINARY_VERSION;
+
+	u32 = htonl(fingerprint);
+	memcpy(p, &u32, sizeof(u32));
+	p += sizeof(u32);
+
+	u64 = htonll((uint64_t)c->created);
+	memcpy(p, &u64, sizeof(u64));
+	p += sizeof(u64);
+
+	u64 = htonll((uint64_t)c->expires);
+	memcpy(p, &u64, sizeof(u64));
+	p += sizeof(u64);
+
+	for (map = c->maps; map; map = map->next) {
+		fr_dict_attr_t const	*da = map->lhs->tmpl_da;
+		value_box_t const	*box = &map->rhs->tmpl_value_box;
+
+		value_len = cache_binary_value_len(box->type, box->length);
+
+		u32 = htonl(da->vendor);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		u32 = htonl(da->attr);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		*p++ = da->type;
+		*p++ = map->op;
+		*p++ = map->lhs->tmpl_request;
+		*p++ = map->lhs->tmpl_list;
+		*p++ = (uint8_t)map->lhs->tmpl_tag;
+
+		u32 = htonl(value_len);
+		memcpy(p, &u32, sizeof(u32));
+		p += sizeof(u32);
+
+		switch (box->type) {
+		case PW_TYPE_STRING:
+		case PW_TYPE_OCTETS:
+			if (value_len) memcpy(p, box->datum.ptr, value_len);
+			break;
+
+		case PW_TYPE_BOOLEAN:
+			*p = box->datum.boolean;
+			break;
+
+		case PW_TYPE_BYTE:
+			*p = box->datum.byte;
+			break;
+
+		case PW_TYPE_SHORT:
+		{
+			uint16_t u16 = htons(box->datum.ushort);
+
+			memcpy(p, &u16, sizeof(u16));
+		}
+			break;
+
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_SIGNED:
+			u32 = htonl(box->datum.integer);
+			memcpy(p, &u32, sizeof(u32));
+			break;
+
+		case PW_TYPE_DATE:
+			u32 = htonl(box->datum.date);
+			memcpy(p, &u32, sizeof(u32));
+			break;
+
+		case PW_TYPE_INTEGER64:
+			u64 = htonll(box->datum.integer64);
+			memcpy(p, &u64, sizeof(u64));
+			break;
+
+		/*
+		 *	Already in network byte order
+		 */
+		default:
+			memcpy(p, &box->datum, value_len);
+			break;
+		}
+		p += value_len;
+	}
+
+	rad_assert((size_t)(p - buff) == len);
+	*out = buff;
+
+	return 0;
+}
+
+/** Converts a binary serialized cache entry back into a structure
+ *
+ * @param[in] c			Cache entry to populate (should already be allocated).
+ * @param[in] in		Binary representation of the cache entry.
+ * @param[in] inlen		Length of the binary representation.
+ * @param[in] fingerprint	of the dictionaries in use.
+ * @return
+ *	- 0 on success.
+ *	- 1 if the entry was written with different dictionaries, and should
+ *	  be treated as a cache miss.
+ *	- -1 on failure.
+ */
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen, uint32_t fingerprint)
+{
+	static char const	rhs_name[] = "<binary>";
+	vp_map_t		**last = &c->maps;
+	uint8_t const		*p = in, *end = in + inlen;
+	uint32_t		u32;
+	uint64_t		u64;
+
+	if ((inlen < CACHE_BINARY_HDR_LEN) || (p[0] != CACHE_BINARY_MAGIC)) {
+		fr_strerror_printf("Invalid binary cache entry header");
+		return -1;
+	}
+
+	if (p[1] != CACHE_BINARY_VERSION) {
+		fr_strerror_printf("Binary cache entry has unsupported version %u", p[1]);
+		return 1;
+	}
+	p += 2;
+
+	memcpy(&u32, p, sizeof(u32));
+	if (ntohl(u32) != fingerprint) {
+		fr_strerror_printf("Binary cache entry was written with different dictionaries");
+		return 1;
+	}
+	p += sizeof(u32);
+
+	memcpy(&u64, p, sizeof(u64));
+	c->created = (time_t)ntohll(u64);
+	p += sizeof(u64);
+
+	memcpy(&u64, p, sizeof(u64));
+	c->expires = (time_t)ntohll(u64);
+	p += sizeof(u64);
+
+	while (p < end) {
+		fr_dict_attr_t const	*da;
+		vp_map_t		*map;
+		value_box_t		*box;
+		uint32_t		vendor, attr;
+		size_t			value_len;
+
+		if ((size_t)(end - p) < CACHE_BINARY_MAP_LEN) {
+		truncated:
+			fr_strerror_printf("Binary cache entry is truncated");
+			return -1;
+		}
+
+		memcpy(&u32, p, sizeof(u32));
+		vendor = ntohl(u32);
+		p += sizeof(u32);
+
+		memcpy(&u32, p, sizeof(u32));
+		attr = ntohl(u32);
+		p += sizeof(u32);
+
+		da = fr_dict_attr_by_num(fr_dict_internal, vendor, attr);
+		if (!da || (da->type != p[0])) {
+			fr_strerror_printf("Binary cache entry contains unknown attribute %u.%u", vendor, attr);
+			return -1;
+		}
+
+		/*
+		 *	These end up in a map, which is applied to
+		 *	the request, so don't trust them.
+		 */
+		if ((p[1] < T_EQSTART) || (p[1] >= T_EQEND)) {
+			fr_strerror_printf("Binary cache entry contains invalid operator %u", p[1]);
+			return -1;
+		}
+
+		if ((p[2] < REQUEST_OUTER) || (p[2] > REQUEST_PROXY)) {
+			fr_strerror_printf("Binary cache entry contains invalid request qualifier %u", p[2]);
+			return -1;
+		}
+
+		if ((p[3] == PAIR_LIST_UNKNOWN) || !fr_int2str(pair_lists, p[3], NULL)) {
+			fr_strerror_printf("Binary cache entry contains invalid list qualifier %u", p[3]);
+			return -1;
+		}
+
+		memcpy(&u32, p + 5, sizeof(u32));
+		value_len = ntohl(u32);
+		if ((size_t)(end - (p + 9)) < value_len) goto truncated;
+
+		MEM(map = talloc_zero(c, vp_map_t));
+		MEM(map->lhs = tmpl_init(talloc(map, vp_tmpl_t), TMPL_TYPE_ATTR, da->name, -1, T_BARE_WORD));
+		map->lhs->tmpl_da = da;
+		map->op = p[1];
+		map->lhs->tmpl_request = p[2];
+		map->lhs->tmpl_list = p[3];
+		map->lhs->tmpl_tag = (int8_t)p[4];
+		map->lhs->tmpl_num = NUM_ANY;
+		p += 9;
+
+		MEM(map->rhs = tmpl_init(talloc(map, vp_tmpl_t), TMPL_TYPE_DATA,
+					 rhs_name, sizeof(rhs_name) - 1, T_BARE_WORD));
+		box = &map->rhs->tmpl_value_box;
+
+		/*
+		 *	Fixed length types must be exactly the right size
+		 */
+		if ((ssize_t)value_len != cache_binary_value_len(da->type, value_len)) {
+			fr_strerror_printf("Binary cache entry has invalid length %zu for %s", value_len, da->name);
+			talloc_free(map);
+			return -1;
+		}
+
+		switch (da->type) {
+		case PW_TYPE_STRING:
+		{
+			char *str;
+
+			MEM(str = talloc_bstrndup(map->rhs, (char const *)p, value_len));
+			box->datum.strvalue = str;
+			map->rhs->quote = T_SINGLE_QUOTED_STRING;
+		}
+			break;
+
+		case PW_TYPE_OCTETS:
+			MEM(box->datum.octets = talloc_memdup(map->rhs, p, value_len));
+			talloc_set_type(box->datum.octets, uint8_t);
+			break;
+
+		case PW_TYPE_BOOLEAN:
+			box->datum.boolean = (p[0] != 0);
+			break;
+
+		case PW_TYPE_BYTE:
+			box->datum.byte = p[0];
+			box->datum.enumv = da;
+			break;
+
+		case PW_TYPE_SHORT:
+		{
+			uint16_t u16;
+
+			memcpy(&u16, p, sizeof(u16));
+			box->datum.ushort = ntohs(u16);
+			box->datum.enumv = da;
+		}
+			break;
+
+		case PW_TYPE_INTEGER:
+		case PW_TYPE_SIGNED:
+			memcpy(&u32, p, sizeof(u32));
+			box->datum.integer = ntohl(u32);
+			box->datum.enumv = da;
+			break;
+
+		case PW_TYPE_DATE:
+			memcpy(&u32, p, sizeof(u32));
+			box->datum.date = ntohl(u32);
+			break;
+
+		case PW_TYPE_INTEGER64:
+			memcpy(&u64, p, sizeof(u64));
+			box->datum.integer64 = ntohll(u64);
+			box->datum.enumv = da;
+			break;
+
+		default:
+			memcpy(&box->datum, p, value_len);
+			break;
+		}
+		box->type = da->type;
+		box->length = value_len;
+		p += value_len;
+
+		*last = map;
+		last = &(*last)->next;
+	}
+
+	return 0;
+}
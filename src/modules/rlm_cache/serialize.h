@@ -25,5 +25,20 @@
  */
 RCSIDH(serialize_h, "$Id$")
 
+/*
+ *	First byte of a binary serialized entry.  Text entries
+ *	always start with '&', so the formats can't be confused.
+ */
+#define CACHE_BINARY_MAGIC	0xfc
+#define CACHE_BINARY_VERSION	1
+
+/** Whether a serialized entry uses the binary format
+ *
+ */
+#define cache_serialized_is_binary(_in, _inlen) (((_inlen) > 0) && (((uint8_t const *)(_in))[0] == CACHE_BINARY_MAGIC))
+
 int cache_serialize(TALLOC_CTX *ctx, char **out, rlm_cache_entry_t const *c);
 int cache_deserialize(rlm_cache_entry_t *c, char *in, ssize_t inlen);
+
+int cache_serialize_binary(TALLOC_CTX *ctx, uint8_t **out, rlm_cache_entry_t const *c, uint32_t fingerprint);
+int cache_deserialize_binary(rlm_cache_entry_t *c, uint8_t const *in, size_t inlen, uint32_t fingerprint);
@@ -17,7 +17,7 @@
 /**
  * $Id$
  * @file rlm_detail.c
- * @brief Write plaintext versions of packets to flatfiles.
+ * @brief Write plaintext or binary versions of packets to flatfiles.
  *
  * @copyright 2000,2006  The FreeRADIUS server project
  */
@@ -61,6 +61,8 @@ typedef struct detail_instance {
 	char const	*group;		//!< Group to use for new files.
 
 	char const	*header;	//!< Header format.
+	char const	*format_str;	//!< Format of entries, "text" or "binary".
+	bool		binary;		//!< Write entries in the binary detail format.
 	bool		locking;	//!< Whether the file should be locked.
 
 	bool		log_srcdst;	//!< Add IP src/dst attributes to entries.
@@ -71,21 +73,47 @@ typedef struct detail_instance {
 
 	exfile_t    	*ef;		//!< Log file handler
 
+	size_t		buffer_size;	//!< Size of the per-file write buffer.
+	struct timeval	flush_interval;	//!< Maximum time an entry may sit in the buffer.
+	bool		fsync;		//!< Sync the file after every entry.
+
 	fr_hash_table_t *ht;		//!< Holds suppressed attributes.
 } rlm_detail_t;
 
+/** Thread specific data for rlm_detail
+ *
+ */
+typedef struct detail_thread {
+	rlm_detail_t const *inst;	//!< Instance of rlm_detail.
+	fr_event_list_t	*el;		//!< The event list serviced by this thread.
+	fr_event_timer_t *flush_ev;	//!< Timer for flushing buffered entries.
+} rlm_detail_thread_t;
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_REQUIRED | PW_TYPE_XLAT, rlm_detail_t, filename), .dflt = "%A/%{Client-IP-Address}/detail" },
 	{ FR_CONF_OFFSET("header", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_detail_t, header), .dflt = "%t" },
+	{ FR_CONF_OFFSET("format", PW_TYPE_STRING, rlm_detail_t, format_str), .dflt = "text" },
 	{ FR_CONF_OFFSET("permissions", PW_TYPE_INTEGER, rlm_detail_t, perm), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", PW_TYPE_STRING, rlm_detail_t, group) },
 	{ FR_CONF_OFFSET("locking", PW_TYPE_BOOLEAN, rlm_detail_t, locking), .dflt = "no" },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, rlm_detail_t, escape), .dflt = "no" },
 	{ FR_CONF_OFFSET("log_packet_header", PW_TYPE_BOOLEAN, rlm_detail_t, log_srcdst), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer_size", PW_TYPE_SIZE, rlm_detail_t, buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("flush_interval", PW_TYPE_TIMEVAL, rlm_detail_t, flush_interval), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_BOOLEAN, rlm_detail_t, fsync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
 
+/** Holds a single entry while it's being built
+ *
+ */
+typedef struct detail_record {
+	char		*text;		//!< Entry in the text format.
+	uint8_t		*data;		//!< Entry in the binary format, starting with the record header.
+	size_t		data_len;	//!< How much of data has been filled in.
+} detail_record_t;
+
 /*
  *	Clean up.
  */
@@ -123,6 +151,14 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	inst->name = cf_section_name2(conf);
 	if (!inst->name) inst->name = cf_section_name1(conf);
 
+	if (strcmp(inst->format_str, "binary") == 0) {
+		inst->binary = true;
+	} else if (strcmp(inst->format_str, "text") != 0) {
+		cf_log_err_cs(conf, "Invalid value \"%s\" for 'format', must be \"text\" or \"binary\"",
+			      inst->format_str);
+		return -1;
+	}
+
 	/*
 	 *	Escape filenames only if asked.
 	 */
@@ -138,6 +174,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->buffer_size) {
+		if (!fr_timeval_isset(&inst->flush_interval)) {
+			cf_log_err_cs(conf, "'flush_interval' must be greater than zero when buffering");
+			return -1;
+		}
+		exfile_enable_buffering(inst->ef, inst->buffer_size, &inst->flush_interval);
+	}
+	exfile_enable_sync(inst->ef, inst->fsync);
+
 	/*
 	 *	Suppress certain attributes.
 	 */
@@ -193,37 +238,144 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/*
+ *	Write out entries which have been sitting in the file buffers
+ *	for too long.
+ */
+static void detail_flush_timer(fr_event_list_t *el, struct timeval *now, void *ctx)
+{
+	rlm_detail_thread_t	*t = ctx;
+	rlm_detail_t const	*inst = t->inst;
+	struct timeval		when;
+
+	t->flush_ev = NULL;
+
+	(void) exfile_flush(inst->ef, NULL, false);
+
+	fr_timeval_add(&when, now, &inst->flush_interval);
+	if (fr_event_timer_insert(el, detail_flush_timer, t, &when, &t->flush_ev) < 0) {
+		PERROR("Failed inserting flush timer");
+	}
+}
+
+/*
+ *	Start flushing buffered entries from this thread's event loop.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	rlm_detail_t const	*inst = instance;
+	rlm_detail_thread_t	*t = thread;
+	struct timeval		when;
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->buffer_size || inst->fsync) return 0;
+
+	gettimeofday(&when, NULL);
+	fr_timeval_add(&when, &when, &inst->flush_interval);
+
+	if (fr_event_timer_insert(el, detail_flush_timer, t, &when, &t->flush_ev) < 0) {
+		PERROR("Failed inserting flush timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_detail_thread_t	*t = thread;
+
+	if (t->flush_ev) (void) fr_event_timer_delete(t->el, &t->flush_ev);
+
+	return 0;
+}
+
+/*
+ *	Append one attribute to a detail record.
+ */
+static void detail_vp_append(rlm_detail_t const *inst, REQUEST *request, detail_record_t *out, VALUE_PAIR const *vp)
+{
+	char buffer[1024];
+
+	if (inst->binary) {
+		for (;;) {
+			size_t	len = talloc_array_length(out->data);
+			ssize_t	slen;
+
+			slen = detail_binary_encode_pair(out->data + out->data_len, len - out->data_len, vp);
+			if (slen < 0) {
+				RWDEBUG("Not writing attribute: %s", fr_strerror());
+				return;
+			}
+
+			if (slen > 0) {
+				out->data_len += slen;
+				return;
+			}
+
+			MEM(out->data = talloc_realloc(request, out->data, uint8_t, len * 2));
+		}
+	}
+
+	/*
+	 *	Truncated values are written out as-is, the same
+	 *	as fr_pair_fprint() does.
+	 */
+	if (!fr_pair_snprint(buffer, sizeof(buffer), vp)) return;
+
+	MEM(out->text = talloc_asprintf_append_buffer(out->text, "\t%s\n", buffer));
+}
+
 /*
  *	Wrapper for VPs allocated on the stack.
  */
-static void detail_fr_pair_fprint(TALLOC_CTX *ctx, FILE *out, VALUE_PAIR const *stacked)
+static void detail_vp_append_stacked(rlm_detail_t const *inst, REQUEST *request, detail_record_t *out,
+				     VALUE_PAIR const *stacked)
 {
 	VALUE_PAIR *vp;
 
-	vp = talloc(ctx, VALUE_PAIR);
+	if (!stacked->da) return;
+
+	vp = talloc(request, VALUE_PAIR);
 	if (!vp) return;
 
 	memcpy(vp, stacked, sizeof(*vp));
 	vp->op = T_OP_EQ;
-	fr_pair_fprint(out, vp);
+	if (vp->vp_type == PW_TYPE_INVALID) {
+		vp->vp_type = vp->da->type;
+		vp->vp_length = vp->da->flags.length;
+	}
+	detail_vp_append(inst, request, out, vp);
 	talloc_free(vp);
 }
 
 
-/** Write a single detail entry to file pointer
+/** Render a single detail entry
  *
- * @param[in] out Where to write entry.
+ * The whole entry is built in memory, so that it can be handed to the
+ * exfile API as a single record.
+ *
+ * In the binary format the header line and the Timestamp attribute are
+ * replaced by the record header.  Everything else is written as
+ * attributes, so that the detail reader sees the same data in either format.
+ *
+ * @param[out] out Where to write the entry.  Both fields will be NULL if there's nothing to write.
  * @param[in] inst Instance of rlm_detail.
  * @param[in] request The current request.
  * @param[in] packet associated with the request (request, reply, proxy-request, proxy-reply...).
  * @param[in] compat Write out entry in compatibility mode.
  */
-static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, RADIUS_PACKET *packet, bool compat)
+static int detail_write(detail_record_t *out, rlm_detail_t const *inst, REQUEST *request,
+			RADIUS_PACKET *packet, bool compat)
 {
 	VALUE_PAIR *vp;
 	char timestamp[256];
 
-	if (xlat_eval(timestamp, sizeof(timestamp), request, inst->header, NULL, NULL) < 0) {
+	memset(out, 0, sizeof(*out));
+
+	if (!inst->binary && (xlat_eval(timestamp, sizeof(timestamp), request, inst->header, NULL, NULL) < 0)) {
 		return -1;
 	}
 
@@ -232,19 +384,27 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 		return 0;
 	}
 
-#define WRITE(fmt, ...) do {\
-	if (fprintf(out, fmt, ## __VA_ARGS__) < 0) {\
-		RERROR("Failed writing to detail file: %s", fr_syserror(errno));\
-		return -1;\
-	}\
-} while(0)
+#define WRITE(fmt, ...) MEM(out->text = talloc_asprintf_append_buffer(out->text, fmt, ## __VA_ARGS__))
 
-	WRITE("%s\n", timestamp);
+	if (inst->binary) {
+		MEM(out->data = talloc_array(request, uint8_t, 1024));
+		out->data_len = DETAIL_BINARY_HDR_LEN;
+	} else {
+		MEM(out->text = talloc_typed_asprintf(request, "%s\n", timestamp));
+	}
 
 	/*
 	 *	Write the information to the file.
 	 */
-	if (!compat) {
+	if (inst->binary && !compat) {
+		VALUE_PAIR type_vp;
+
+		memset(&type_vp, 0, sizeof(type_vp));
+		type_vp.da = fr_dict_attr_by_num(NULL, 0, PW_PACKET_TYPE);
+		type_vp.vp_integer = packet->code;
+		detail_vp_append_stacked(inst, request, out, &type_vp);
+
+	} else if (!compat) {
 		/*
 		 *	Print out names, if they're OK.
 		 *	Numbers, if not.
@@ -284,16 +444,16 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 			break;
 		}
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		detail_vp_append_stacked(inst, request, out, &src_vp);
+		detail_vp_append_stacked(inst, request, out, &dst_vp);
 
 		src_vp.da = fr_dict_attr_by_num(NULL, 0, PW_PACKET_SRC_PORT);
 		src_vp.vp_integer = packet->src_port;
 		dst_vp.da = fr_dict_attr_by_num(NULL, 0, PW_PACKET_DST_PORT);
 		dst_vp.vp_integer = packet->dst_port;
 
-		detail_fr_pair_fprint(request, out, &src_vp);
-		detail_fr_pair_fprint(request, out, &dst_vp);
+		detail_vp_append_stacked(inst, request, out, &src_vp);
+		detail_vp_append_stacked(inst, request, out, &dst_vp);
 	}
 
 	{
@@ -316,7 +476,7 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 			 */
 			op = vp->op;
 			vp->op = T_OP_EQ;
-			fr_pair_fprint(out, vp);
+			detail_vp_append(inst, request, out, vp);
 			vp->op = op;
 		}
 	}
@@ -326,7 +486,21 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 	 */
 	if (compat) {
 #ifdef WITH_PROXY
-		if (request->proxy) {
+		if (request->proxy && inst->binary) {
+			VALUE_PAIR proxy_vp;
+
+			/*
+			 *	FreeRADIUS-Proxied-To is an IPv4 address,
+			 *	so there's nothing to write for IPv6 home
+			 *	servers.
+			 */
+			memset(&proxy_vp, 0, sizeof(proxy_vp));
+			proxy_vp.da = fr_dict_attr_by_num(NULL, VENDORPEC_FREERADIUS, PW_FREERADIUS_PROXIED_TO);
+			if (request->proxy->packet->dst_ipaddr.af == AF_INET) {
+				proxy_vp.vp_ipaddr = request->proxy->packet->dst_ipaddr.ipaddr.ip4addr.s_addr;
+				detail_vp_append_stacked(inst, request, out, &proxy_vp);
+			}
+		} else if (request->proxy) {
 			char proxy_buffer[INET6_ADDRSTRLEN];
 
 			inet_ntop(request->proxy->packet->dst_ipaddr.af, &request->proxy->packet->dst_ipaddr.ipaddr,
@@ -335,6 +509,13 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 		}
 #endif
 	}
+
+	if (inst->binary) {
+		detail_binary_encode_header(out->data, out->data_len - DETAIL_BINARY_HDR_LEN,
+					    request->packet->timestamp.tv_sec);
+		return 0;
+	}
+
 	WRITE("\tTimestamp = %ld\n", (unsigned long) request->packet->timestamp.tv_sec);
 
 	WRITE("\n");
@@ -348,10 +529,9 @@ static int detail_write(FILE *out, rlm_detail_t const *inst, REQUEST *request, R
 static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *request,
 					      RADIUS_PACKET *packet, bool compat)
 {
-	int		outfd;
 	char		buffer[DIRLEN];
-
-	FILE		*outfp;
+	detail_record_t	record;
+	struct iovec	vector;
 
 #ifdef HAVE_GRP_H
 	gid_t		gid;
@@ -388,18 +568,43 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 #endif
 #endif
 
-	outfd = exfile_open(inst->ef, request, buffer, inst->perm, true);
-	if (outfd < 0) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_strerror());
+	if (detail_write(&record, inst, request, packet, compat) < 0) {
+		talloc_free(record.text);
+		talloc_free(record.data);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Hand the entry to exfile as a single record.  It's
+	 *	either written immediately, or buffered and written
+	 *	along with other entries for the same file.
+	 */
+	if (record.data) {
+		vector.iov_base = record.data;
+		vector.iov_len = record.data_len;
+	} else if (record.text) {
+		vector.iov_base = record.text;
+		vector.iov_len = talloc_array_length(record.text) - 1;
+	} else {
+		return RLM_MODULE_OK;
+	}
+
+	if (exfile_writev(inst->ef, request, buffer, inst->perm, &vector, 1) < 0) {
+		RERROR("Failed writing to detail file %s: %s", buffer, fr_strerror());
+		talloc_free(record.text);
+		talloc_free(record.data);
 		return RLM_MODULE_FAIL;
 	}
+	talloc_free(record.text);
+	talloc_free(record.data);
 
+#ifdef HAVE_GRP_H
 	if (inst->group != NULL) {
 		gid = strtol(inst->group, &endptr, 10);
 		if (*endptr != '\0') {
 			if (rad_getgid(request, &gid, inst->group) < 0) {
 				RDEBUG2("Unable to find system group '%s'", inst->group);
-				goto skip_group;
+				return RLM_MODULE_OK;
 			}
 		}
 
@@ -407,26 +612,7 @@ static rlm_rcode_t CC_HINT(nonnull) detail_do(void const *instance, REQUEST *req
 			RDEBUG2("Unable to change system group of '%s'", buffer);
 		}
 	}
-
-skip_group:
-	/*
-	 *	Open the output fp for buffering.
-	 */
-	if ((outfp = fdopen(outfd, "a")) == NULL) {
-		RERROR("Couldn't open file %s: %s", buffer, fr_syserror(errno));
-	fail:
-		if (outfp) fclose(outfp);
-		exfile_unlock(inst->ef, request, outfd);
-		return RLM_MODULE_FAIL;
-	}
-
-	if (detail_write(outfp, inst, request, packet, compat) < 0) goto fail;
-
-	/*
-	 *	Flush everything
-	 */
-	fclose(outfp);
-	exfile_unlock(inst->ef, request, outfd); /* do NOT close outfp */
+#endif
 
 	/*
 	 *	And everything is fine.
@@ -529,6 +715,9 @@ rad_module_t rlm_detail = {
 	.inst_size	= sizeof(rlm_detail_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_detail_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHORIZE]		= mod_authorize,
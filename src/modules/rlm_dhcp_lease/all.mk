@@ -0,0 +1,2 @@
+TARGET		:= rlm_dhcp_lease.a
+SOURCES		:= rlm_dhcp_lease.c lease.c
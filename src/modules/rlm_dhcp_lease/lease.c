@@ -0,0 +1,1125 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file lease.c
+ * @brief In memory IPv4 lease pools.
+ *
+ * Every address in a pool has a slot in one array.  Free slots are kept
+ * on a FIFO list, so addresses which were released are reused last, and
+ * their previous owners are likely to get them back.  Slots which are
+ * offered, bound or declined are kept on a timing wheel, bucketed by the
+ * second they expire, and are moved back to the free list as time passes.
+ * Slots are found by device through two open addressing hash tables, one
+ * for devices which send a client identifier, and one for those which
+ * don't.  Nothing is allocated after the pool is created.
+ *
+ * Changes can be appended to a log.  Each operation writes its records
+ * before it returns, and can sync them to disk, so a lease is never
+ * acknowledged before it's in the log.  The log is periodically replaced
+ * by a snapshot of the whole pool.  Taking a snapshot copies the records
+ * and starts a new log, which is quick, and the snapshot is then written
+ * by the caller without holding up other operations on the pool.  On
+ * startup the snapshot is loaded, and the old and current logs replayed
+ * over it.  Records hold the whole state of a slot, so replaying them is
+ * idempotent.  Expiry isn't logged, it's recalculated from the expiry
+ * times when the pool is loaded.
+ *
+ * Addresses are in host byte order.  The files are in host byte order too,
+ * and can't be moved between machines with different endianness.
+ *
+ * None of these functions are thread safe, except lease_snapshot_write(),
+ * which doesn't touch the pool.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <fcntl.h>
+
+#include "lease.h"
+
+#define LEASE_FILE_MAGIC	(0x4c454153)	/* "LEAS" */
+#define LEASE_FILE_VERSION	(1)
+#define LEASE_LOG_BUFFER	(64 * 1024)	//!< Changes made by one operation.
+
+typedef struct {
+	uint32_t		address;	//!< Of the slot.
+	uint32_t		prev;		//!< In the free list, or wheel bucket.
+	uint32_t		next;		//!< In the free list, or wheel bucket.
+	uint32_t		expires;	//!< When the lease expires.
+	uint32_t		hash;		//!< Of the device.
+	uint8_t			state;		//!< One of the LEASE_STATE_* values.
+	bool			has_device;	//!< Whether device is set, and indexed.
+	lease_device_t		device;		//!< Current, or last, owner.
+} lease_t;
+
+/** Header of the snapshot and log files
+ *
+ */
+typedef struct {
+	uint32_t		magic;		//!< LEASE_FILE_MAGIC.
+	uint32_t		version;	//!< LEASE_FILE_VERSION.
+	uint32_t		fingerprint;	//!< Of the ranges in the pool.
+	uint32_t		num_slots;	//!< In the pool.
+} lease_file_header_t;
+
+/** State of one slot, as written to the snapshot and log files
+ *
+ */
+typedef struct {
+	uint32_t		slot;
+	uint32_t		expires;
+	uint8_t			state;
+	uint8_t			has_device;
+	lease_device_t		device;
+	uint32_t		check;		//!< Hash of the fields above, catches torn writes.
+} lease_record_t;
+
+struct lease_pool {
+	uint32_t		num_slots;	//!< Addresses in the pool.
+	lease_t			*leases;	//!< One per address.
+
+	int			num_ranges;
+	uint32_t		*start;		//!< First address in each range, sorted.
+	uint32_t		*end;		//!< Last address in each range.
+	uint32_t		*first;		//!< Slot of the first address in each range.
+	uint32_t		fingerprint;	//!< Of the ranges.
+
+	uint32_t		free_head;	//!< Next slot to allocate.
+	uint32_t		free_tail;	//!< Last slot to allocate.
+	uint32_t		num_free;
+
+	uint32_t		wheel[LEASE_WHEEL_SIZE];	//!< First slot expiring in each second.
+	time_t			wheel_time;	//!< Latest second we've expired leases for.
+
+	uint32_t		index_mask;	//!< Size of the indexes, minus one.
+	uint32_t		*mac_index;	//!< Slots of devices without client identifiers.
+	uint32_t		*client_id_index;	//!< Slots of devices with client identifiers.
+
+	time_t			now;		//!< Time of the current operation.
+
+	char const		*snapshot_file;	//!< Whole pool.
+	char const		*log_file;	//!< Changes since the snapshot was copied.
+	char const		*old_log_file;	//!< Changes before that, until the snapshot is written.
+	int			log_fd;		//!< -1 if we're not persisting the pool.
+	uint8_t			*log_buffer;	//!< Changes which haven't been written yet.
+	size_t			log_used;	//!< Bytes in log_buffer.
+	bool			log_sync;	//!< Sync the log before returning.
+};
+
+/** A copy of the pool, to be written to the snapshot file
+ *
+ */
+struct lease_snapshot {
+	char const		*snapshot_file;	//!< To write.
+	char const		*old_log_file;	//!< To remove once the snapshot is written.
+	lease_file_header_t	header;
+	uint32_t		num_records;
+	lease_record_t		*records;	//!< Slots which have been used.
+};
+
+/*
+ *	List manipulation.  A slot is either on the free list, or
+ *	in a wheel bucket, depending on its state.
+ */
+static inline uint32_t *lease_bucket(lease_pool_t *pool, uint32_t expires)
+{
+	return &pool->wheel[expires & (LEASE_WHEEL_SIZE - 1)];
+}
+
+static void lease_link(lease_pool_t *pool, uint32_t slot)
+{
+	lease_t		*l = &pool->leases[slot];
+	uint32_t	*head;
+
+	if (l->state == LEASE_STATE_FREE) {
+		l->prev = pool->free_tail;
+		l->next = LEASE_NONE;
+		if (pool->free_tail != LEASE_NONE) {
+			pool->leases[pool->free_tail].next = slot;
+		} else {
+			pool->free_head = slot;
+		}
+		pool->free_tail = slot;
+		pool->num_free++;
+		return;
+	}
+
+	head = lease_bucket(pool, l->expires);
+	l->prev = LEASE_NONE;
+	l->next = *head;
+	if (*head != LEASE_NONE) pool->leases[*head].prev = slot;
+	*head = slot;
+}
+
+static void lease_unlink(lease_pool_t *pool, uint32_t slot)
+{
+	lease_t		*l = &pool->leases[slot];
+
+	if (l->next != LEASE_NONE) pool->leases[l->next].prev = l->prev;
+
+	if (l->state == LEASE_STATE_FREE) {
+		if (l->prev != LEASE_NONE) {
+			pool->leases[l->prev].next = l->next;
+		} else {
+			pool->free_head = l->next;
+		}
+		if (l->next == LEASE_NONE) pool->free_tail = l->prev;
+		pool->num_free--;
+		return;
+	}
+
+	if (l->prev != LEASE_NONE) {
+		pool->leases[l->prev].next = l->next;
+	} else {
+		*lease_bucket(pool, l->expires) = l->next;
+	}
+}
+
+/*
+ *	Device indexes.  Linear probing, with backward shift
+ *	deletion, so there are no tombstones.
+ */
+static inline uint32_t lease_device_hash(lease_device_t const *device)
+{
+	if (device->client_id_len) return fr_hash(device->client_id, device->client_id_len);
+
+	return fr_hash(device->mac, sizeof(device->mac));
+}
+
+static inline bool lease_device_cmp(lease_device_t const *a, lease_device_t const *b)
+{
+	if (a->client_id_len != b->client_id_len) return false;
+
+	if (a->client_id_len) return (memcmp(a->client_id, b->client_id, a->client_id_len) == 0);
+
+	return (memcmp(a->mac, b->mac, sizeof(a->mac)) == 0);
+}
+
+static inline uint32_t *lease_index(lease_pool_t *pool, lease_device_t const *device)
+{
+	return device->client_id_len ? pool->client_id_index : pool->mac_index;
+}
+
+/** Find the index entry for a device, or the empty entry where it would go
+ *
+ */
+static uint32_t *lease_index_find(lease_pool_t *pool, lease_device_t const *device, uint32_t hash)
+{
+	uint32_t	*index = lease_index(pool, device);
+	uint32_t	i = hash & pool->index_mask;
+
+	while (index[i] != LEASE_NONE) {
+		lease_t *l = &pool->leases[index[i]];
+
+		if ((l->hash == hash) && lease_device_cmp(&l->device, device)) break;
+
+		i = (i + 1) & pool->index_mask;
+	}
+
+	return &index[i];
+}
+
+static void lease_index_remove(lease_pool_t *pool, uint32_t slot)
+{
+	lease_t		*l = &pool->leases[slot];
+	uint32_t	*index = lease_index(pool, &l->device);
+	uint32_t	i, j;
+
+	i = lease_index_find(pool, &l->device, l->hash) - index;
+	if (!fr_cond_assert(index[i] == slot)) return;
+
+	/*
+	 *	Move entries after this one back, unless that would
+	 *	put them before the entry they hash to.
+	 */
+	for (j = (i + 1) & pool->index_mask;
+	     index[j] != LEASE_NONE;
+	     j = (j + 1) & pool->index_mask) {
+		uint32_t home = pool->leases[index[j]].hash & pool->index_mask;
+
+		if ((i <= j) ? ((i < home) && (home <= j)) : ((i < home) || (home <= j))) continue;
+
+		index[i] = index[j];
+		i = j;
+	}
+	index[i] = LEASE_NONE;
+
+	l->has_device = false;
+}
+
+/** Make a device the owner of a slot
+ *
+ */
+static void lease_index_insert(lease_pool_t *pool, uint32_t slot, lease_device_t const *device, uint32_t hash)
+{
+	lease_t *l = &pool->leases[slot];
+
+	if (l->has_device) lease_index_remove(pool, slot);
+
+	l->device = *device;
+	l->hash = hash;
+	l->has_device = true;
+	*lease_index_find(pool, &l->device, hash) = slot;
+}
+
+/** Find which slot an address is in
+ *
+ * @return the slot, or LEASE_NONE if the address isn't in the pool.
+ */
+static uint32_t lease_slot(lease_pool_t const *pool, uint32_t address)
+{
+	int lo = 0, hi = pool->num_ranges - 1;
+
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+
+		if (address < pool->start[mid]) {
+			hi = mid - 1;
+		} else if (address > pool->end[mid]) {
+			lo = mid + 1;
+		} else {
+			return pool->first[mid] + (address - pool->start[mid]);
+		}
+	}
+
+	return LEASE_NONE;
+}
+
+/*
+ *	Logging
+ */
+static int lease_log_write(lease_pool_t *pool)
+{
+	uint8_t const	*p = pool->log_buffer;
+	uint8_t const	*end = p + pool->log_used;
+
+	while (p < end) {
+		ssize_t slen;
+
+		slen = write(pool->log_fd, p, end - p);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			fr_strerror_printf("Failed writing %s: %s", pool->log_file, fr_syserror(errno));
+			return -1;
+		}
+		p += slen;
+	}
+
+	pool->log_used = 0;
+
+	if (pool->log_sync && (fsync(pool->log_fd) < 0)) {
+		fr_strerror_printf("Failed syncing %s: %s", pool->log_file, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+static void lease_record(lease_record_t *record, lease_pool_t const *pool, uint32_t slot)
+{
+	lease_t const *l = &pool->leases[slot];
+
+	memset(record, 0, sizeof(*record));
+	record->slot = slot;
+	record->expires = l->expires;
+	record->state = l->state;
+	record->has_device = l->has_device;
+	if (l->has_device) record->device = l->device;
+	record->check = fr_hash(record, offsetof(lease_record_t, check));
+}
+
+/** Add the current state of a slot to the log
+ *
+ */
+static int lease_log(lease_pool_t *pool, uint32_t slot)
+{
+	if (pool->log_fd < 0) return 0;
+
+	if (((pool->log_used + sizeof(lease_record_t)) > LEASE_LOG_BUFFER) && (lease_log_write(pool) < 0)) return -1;
+
+	lease_record((lease_record_t *)(pool->log_buffer + pool->log_used), pool, slot);
+	pool->log_used += sizeof(lease_record_t);
+
+	return 0;
+}
+
+/** Write the changes made by an operation, before it returns
+ *
+ */
+static lease_rcode_t lease_persist_check(lease_pool_t *pool, lease_rcode_t rcode)
+{
+	if ((pool->log_fd < 0) || !pool->log_used) return rcode;
+
+	if (lease_log_write(pool) < 0) return LEASE_RCODE_FAIL;
+
+	return rcode;
+}
+
+/** Move leases which have expired to the free list
+ *
+ * Walks one wheel bucket for every second which has passed since the
+ * last call.  Leases in a bucket which expire on a later turn of the
+ * wheel are left where they are.
+ */
+static void lease_pool_expire(lease_pool_t *pool, time_t now)
+{
+	time_t t;
+
+	pool->now = now;
+	if (now <= pool->wheel_time) return;
+
+	t = pool->wheel_time + 1;
+	if ((now - pool->wheel_time) > LEASE_WHEEL_SIZE) t = now - LEASE_WHEEL_SIZE + 1;
+
+	for (; t <= now; t++) {
+		uint32_t slot = *lease_bucket(pool, t);
+
+		while (slot != LEASE_NONE) {
+			lease_t		*l = &pool->leases[slot];
+			uint32_t	next = l->next;
+
+			if (l->expires <= now) {
+				lease_unlink(pool, slot);
+				l->state = LEASE_STATE_FREE;
+				lease_link(pool, slot);
+			}
+			slot = next;
+		}
+	}
+
+	pool->wheel_time = now;
+}
+
+/** Put every slot on the right list, and rebuild the indexes
+ *
+ * Free slots which have never been used go first, so that addresses
+ * which devices may come back for are used last.
+ */
+static void lease_pool_rebuild(lease_pool_t *pool, time_t now)
+{
+	uint32_t	i;
+	int		pass;
+
+	pool->free_head = pool->free_tail = LEASE_NONE;
+	pool->num_free = 0;
+	for (i = 0; i < LEASE_WHEEL_SIZE; i++) pool->wheel[i] = LEASE_NONE;
+	for (i = 0; i <= pool->index_mask; i++) pool->mac_index[i] = pool->client_id_index[i] = LEASE_NONE;
+
+	for (pass = 0; pass < 2; pass++) for (i = 0; i < pool->num_slots; i++) {
+		lease_t *l = &pool->leases[i];
+
+		if (l->has_device != (pass == 1)) continue;
+
+		if ((l->state != LEASE_STATE_FREE) && (l->expires <= now)) l->state = LEASE_STATE_FREE;
+
+		if (l->has_device) {
+			uint32_t *entry;
+
+			l->hash = lease_device_hash(&l->device);
+			entry = lease_index_find(pool, &l->device, l->hash);
+
+			/*
+			 *	Two slots for one device.  Can only happen
+			 *	if the files were edited, keep the first.
+			 */
+			if (*entry != LEASE_NONE) {
+				l->has_device = false;
+				if (l->state != LEASE_STATE_FREE) l->state = LEASE_STATE_FREE;
+			} else {
+				*entry = i;
+			}
+		}
+
+		lease_link(pool, i);
+	}
+
+	pool->wheel_time = now;
+}
+
+static int _lease_pool_free(lease_pool_t *pool)
+{
+	if (pool->log_fd >= 0) {
+		if (pool->log_used) (void) lease_log_write(pool);
+		close(pool->log_fd);
+	}
+
+	return 0;
+}
+
+/** Create a pool of addresses
+ *
+ * @param[in] ctx		to allocate the pool in.
+ * @param[in] start		first address of each range.
+ * @param[in] end		last address of each range.
+ * @param[in] num_ranges	in start and end.
+ * @return
+ *	- A new pool, with every address free.
+ *	- NULL if the ranges are invalid, or overlap.
+ */
+lease_pool_t *lease_pool_alloc(TALLOC_CTX *ctx, uint32_t const *start, uint32_t const *end, int num_ranges)
+{
+	lease_pool_t	*pool;
+	uint64_t	num_slots = 0;
+	uint32_t	i, size;
+	int		j, k;
+
+	if (num_ranges < 1) {
+		fr_strerror_printf("Pool must have at least one range");
+		return NULL;
+	}
+
+	pool = talloc_zero(ctx, lease_pool_t);
+	if (!pool) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		talloc_free(pool);
+		return NULL;
+	}
+	pool->log_fd = -1;
+
+	pool->num_ranges = num_ranges;
+	pool->start = talloc_array(pool, uint32_t, num_ranges);
+	pool->end = talloc_array(pool, uint32_t, num_ranges);
+	pool->first = talloc_array(pool, uint32_t, num_ranges);
+	if (!pool->start || !pool->end || !pool->first) goto oom;
+
+	/*
+	 *	Sort the ranges, so we can binary search them.
+	 */
+	for (j = 0; j < num_ranges; j++) {
+		if (start[j] > end[j]) {
+			fr_strerror_printf("Range %i starts after it ends", j);
+		error:
+			talloc_free(pool);
+			return NULL;
+		}
+
+		for (k = j; (k > 0) && (pool->start[k - 1] > start[j]); k--) {
+			pool->start[k] = pool->start[k - 1];
+			pool->end[k] = pool->end[k - 1];
+		}
+		pool->start[k] = start[j];
+		pool->end[k] = end[j];
+	}
+
+	for (j = 0; j < num_ranges; j++) {
+		if ((j > 0) && (pool->start[j] <= pool->end[j - 1])) {
+			fr_strerror_printf("Ranges overlap");
+			goto error;
+		}
+
+		pool->first[j] = num_slots;
+		num_slots += (uint64_t)pool->end[j] - pool->start[j] + 1;
+		if (num_slots > LEASE_SLOTS_MAX) {
+			fr_strerror_printf("Pool is too large, it can have at most %u addresses", LEASE_SLOTS_MAX);
+			goto error;
+		}
+	}
+	pool->num_slots = num_slots;
+
+	pool->fingerprint = fr_hash_update(pool->start, num_ranges * sizeof(pool->start[0]),
+					   fr_hash(pool->end, num_ranges * sizeof(pool->end[0])));
+
+	pool->leases = talloc_zero_array(pool, lease_t, pool->num_slots);
+	if (!pool->leases) goto oom;
+
+	for (j = 0; j < num_ranges; j++) {
+		for (i = 0; i <= pool->end[j] - pool->start[j]; i++) {
+			pool->leases[pool->first[j] + i].address = pool->start[j] + i;
+		}
+	}
+
+	/*
+	 *	Keep the indexes at most half full.
+	 */
+	for (size = 16; size < (pool->num_slots * 2); size <<= 1);
+	pool->index_mask = size - 1;
+	pool->mac_index = talloc_array(pool, uint32_t, size);
+	pool->client_id_index = talloc_array(pool, uint32_t, size);
+	if (!pool->mac_index || !pool->client_id_index) goto oom;
+
+	lease_pool_rebuild(pool, 0);
+	talloc_set_destructor(pool, _lease_pool_free);
+
+	return pool;
+}
+
+/** Read a snapshot or log file, and apply the records in it
+ *
+ * Reading stops at the first record which is incomplete, or corrupt.
+ *
+ * @return
+ *	- 0 on success, or if the file doesn't exist.
+ *	- -1 on error.
+ */
+static int lease_pool_load(lease_pool_t *pool, char const *filename)
+{
+	FILE			*fp;
+	lease_file_header_t	header;
+	lease_record_t		record;
+
+	fp = fopen(filename, "r");
+	if (!fp) {
+		if (errno == ENOENT) return 0;
+		fr_strerror_printf("Failed opening %s: %s", filename, fr_syserror(errno));
+		return -1;
+	}
+
+	if (fread(&header, sizeof(header), 1, fp) != 1) {
+		fclose(fp);
+		return 0;
+	}
+
+	if ((header.magic != LEASE_FILE_MAGIC) || (header.version != LEASE_FILE_VERSION)) {
+		fr_strerror_printf("%s isn't a lease file, or was written by a different version", filename);
+	error:
+		fclose(fp);
+		return -1;
+	}
+
+	if ((header.fingerprint != pool->fingerprint) || (header.num_slots != pool->num_slots)) {
+		fr_strerror_printf("%s was written for different ranges.  Remove it to start with an empty pool",
+				   filename);
+		goto error;
+	}
+
+	while (fread(&record, sizeof(record), 1, fp) == 1) {
+		lease_t *l;
+
+		/*
+		 *	Partially written, we've seen all the
+		 *	changes which made it to disk.
+		 */
+		if ((record.check != fr_hash(&record, offsetof(lease_record_t, check))) ||
+		    (record.slot >= pool->num_slots) || (record.state > LEASE_STATE_DECLINED) ||
+		    (record.device.client_id_len > LEASE_CLIENT_ID_MAX)) break;
+
+		l = &pool->leases[record.slot];
+		l->state = record.state;
+		l->expires = record.expires;
+		l->has_device = record.has_device;
+		if (l->has_device) l->device = record.device;
+	}
+	fclose(fp);
+
+	return 0;
+}
+
+/** Open a new, empty, log
+ *
+ * @return
+ *	- The file descriptor.
+ *	- -1 on failure.
+ */
+static int lease_log_open(lease_pool_t *pool)
+{
+	lease_file_header_t	header;
+	int			fd;
+
+	fd = open(pool->log_file, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND, 0600);
+	if (fd < 0) {
+		fr_strerror_printf("Failed opening %s: %s", pool->log_file, fr_syserror(errno));
+		return -1;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = LEASE_FILE_MAGIC;
+	header.version = LEASE_FILE_VERSION;
+	header.fingerprint = pool->fingerprint;
+	header.num_slots = pool->num_slots;
+
+	if ((write(fd, &header, sizeof(header)) != sizeof(header)) || (fsync(fd) < 0)) {
+		fr_strerror_printf("Failed writing %s: %s", pool->log_file, fr_syserror(errno));
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+/** Load a pool from disk, and log changes to it from now on
+ *
+ * The snapshot is loaded, the old and current logs are replayed over it,
+ * and then a new snapshot is written, and the logs emptied.
+ *
+ * @param[in] pool		to persist.
+ * @param[in] filename		prefix of the snapshot (.snapshot) and log (.log and .log.old) files.
+ * @param[in] sync		whether every change is synced to disk before the operation returns.
+ * @param[in] now		current time.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int lease_pool_persist(lease_pool_t *pool, char const *filename, bool sync, time_t now)
+{
+	lease_snapshot_t	*snap;
+	int			ret;
+
+	pool->snapshot_file = talloc_typed_asprintf(pool, "%s.snapshot", filename);
+	pool->log_file = talloc_typed_asprintf(pool, "%s.log", filename);
+	pool->old_log_file = talloc_typed_asprintf(pool, "%s.log.old", filename);
+	pool->log_buffer = talloc_array(pool, uint8_t, LEASE_LOG_BUFFER);
+	if (!pool->snapshot_file || !pool->log_file || !pool->old_log_file || !pool->log_buffer) {
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	pool->log_sync = sync;
+	pool->now = now;
+
+	if ((lease_pool_load(pool, pool->snapshot_file) < 0) ||
+	    (lease_pool_load(pool, pool->old_log_file) < 0) ||
+	    (lease_pool_load(pool, pool->log_file) < 0)) return -1;
+
+	lease_pool_rebuild(pool, now);
+
+	/*
+	 *	Write everything we loaded to the snapshot.  The
+	 *	old log has to go before the current one is emptied,
+	 *	or replaying it would undo later changes.
+	 */
+	snap = lease_pool_snapshot_copy(NULL, pool);
+	if (!snap) return -1;
+
+	ret = lease_snapshot_write(snap);
+	talloc_free(snap);
+	if (ret < 0) return -1;
+
+	/*
+	 *	Also drops anything after the last complete record.
+	 */
+	pool->log_fd = lease_log_open(pool);
+	if (pool->log_fd < 0) return -1;
+
+	return 0;
+}
+
+/** Copy the pool, so that it can be written to the snapshot file
+ *
+ * A new log is started, so that changes made while the snapshot is being
+ * written aren't lost.  The previous log is kept until the snapshot has
+ * been written.  If a previous snapshot failed, and its log is still
+ * there, the current log is kept instead.  Replaying changes which are
+ * already in the snapshot gives the same result, so it does no harm.
+ *
+ * @param[in] ctx	to allocate the copy in.
+ * @param[in] pool	to copy.
+ * @return
+ *	- The copy, to pass to lease_snapshot_write().
+ *	- NULL on failure.
+ */
+lease_snapshot_t *lease_pool_snapshot_copy(TALLOC_CTX *ctx, lease_pool_t *pool)
+{
+	lease_snapshot_t	*snap;
+	uint32_t		i, num_records = 0;
+	int			fd;
+
+	if (!pool->snapshot_file) {
+		fr_strerror_printf("Pool isn't persisted");
+		return NULL;
+	}
+
+	for (i = 0; i < pool->num_slots; i++) {
+		lease_t const *l = &pool->leases[i];
+
+		if (l->has_device || (l->state != LEASE_STATE_FREE)) num_records++;
+	}
+
+	snap = talloc_zero(ctx, lease_snapshot_t);
+	if (!snap) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		talloc_free(snap);
+		return NULL;
+	}
+	snap->snapshot_file = talloc_typed_strdup(snap, pool->snapshot_file);
+	snap->old_log_file = talloc_typed_strdup(snap, pool->old_log_file);
+	snap->records = talloc_array(snap, lease_record_t, num_records ? num_records : 1);
+	if (!snap->snapshot_file || !snap->old_log_file || !snap->records) goto oom;
+
+	snap->header.magic = LEASE_FILE_MAGIC;
+	snap->header.version = LEASE_FILE_VERSION;
+	snap->header.fingerprint = pool->fingerprint;
+	snap->header.num_slots = pool->num_slots;
+
+	/*
+	 *	Slots which have never been used are left out.
+	 */
+	for (i = 0; i < pool->num_slots; i++) {
+		lease_t const *l = &pool->leases[i];
+
+		if (!l->has_device && (l->state == LEASE_STATE_FREE)) continue;
+
+		lease_record(&snap->records[snap->num_records++], pool, i);
+	}
+
+	if ((pool->log_fd < 0) || (access(pool->old_log_file, F_OK) == 0)) return snap;
+
+	/*
+	 *	Everything which is buffered is in the copy, but has
+	 *	to be in one of the logs too, in case the snapshot
+	 *	isn't written.
+	 */
+	if (pool->log_used && (lease_log_write(pool) < 0)) {
+		talloc_free(snap);
+		return NULL;
+	}
+
+	if (rename(pool->log_file, pool->old_log_file) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", pool->log_file, pool->old_log_file,
+				   fr_syserror(errno));
+		talloc_free(snap);
+		return NULL;
+	}
+
+	fd = lease_log_open(pool);
+	if (fd < 0) {
+		/*
+		 *	Keep using the log we have.
+		 */
+		(void) rename(pool->old_log_file, pool->log_file);
+		talloc_free(snap);
+		return NULL;
+	}
+	close(pool->log_fd);
+	pool->log_fd = fd;
+
+	return snap;
+}
+
+/** Write a copy of the pool to the snapshot file
+ *
+ * The snapshot is written to a temporary file, synced, and renamed over
+ * the old one.  The old log is then removed.  If we crash before it's
+ * removed, replaying it over the new snapshot gives the same result.
+ *
+ * This doesn't touch the pool, so it can be called without holding
+ * whatever lock protects it.
+ *
+ * @param[in] snap	from lease_pool_snapshot_copy().
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int lease_snapshot_write(lease_snapshot_t *snap)
+{
+	FILE			*fp;
+	char			*tmp;
+
+	tmp = talloc_typed_asprintf(NULL, "%s.tmp", snap->snapshot_file);
+	fp = fopen(tmp, "w");
+	if (!fp) {
+		fr_strerror_printf("Failed opening %s: %s", tmp, fr_syserror(errno));
+		talloc_free(tmp);
+		return -1;
+	}
+
+	if ((fwrite(&snap->header, sizeof(snap->header), 1, fp) != 1) ||
+	    (snap->num_records &&
+	     (fwrite(snap->records, sizeof(snap->records[0]), snap->num_records, fp) != snap->num_records)) ||
+	    (fflush(fp) != 0) || (fsync(fileno(fp)) < 0)) {
+		fr_strerror_printf("Failed writing %s: %s", tmp, fr_syserror(errno));
+		fclose(fp);
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	fclose(fp);
+
+	if (rename(tmp, snap->snapshot_file) < 0) {
+		fr_strerror_printf("Failed renaming %s to %s: %s", tmp, snap->snapshot_file, fr_syserror(errno));
+		unlink(tmp);
+		talloc_free(tmp);
+		return -1;
+	}
+	talloc_free(tmp);
+
+	/*
+	 *	Everything in the old log is in the snapshot.
+	 */
+	if ((unlink(snap->old_log_file) < 0) && (errno != ENOENT)) {
+		fr_strerror_printf("Failed removing %s: %s", snap->old_log_file, fr_syserror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Write the whole pool to the snapshot file
+ *
+ * For callers which don't share the pool with other threads.  The pool
+ * can't be changed while the snapshot is written.
+ *
+ * @param[in] pool	to write.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+int lease_pool_snapshot(lease_pool_t *pool)
+{
+	lease_snapshot_t	*snap;
+	int			ret;
+
+	if (pool->log_fd < 0) return 0;
+
+	snap = lease_pool_snapshot_copy(NULL, pool);
+	if (!snap) return -1;
+
+	ret = lease_snapshot_write(snap);
+	talloc_free(snap);
+
+	return ret;
+}
+
+/** Write any buffered changes to the log
+ *
+ */
+int lease_pool_flush(lease_pool_t *pool)
+{
+	if ((pool->log_fd < 0) || !pool->log_used) return 0;
+
+	return lease_log_write(pool);
+}
+
+/** Offer an address to a device
+ *
+ * The device gets, in order of preference:
+ * - the address it already has, or last had, if nobody else has taken it since.
+ * - the address it asked for, if that's free.
+ * - the address which has been free the longest.
+ *
+ * @param[out] out		address offered.
+ * @param[out] expires		seconds until the offer, or existing lease, expires.
+ * @param[in] pool		to allocate from.
+ * @param[in] now		current time.
+ * @param[in] device		the address is for.
+ * @param[in] requested		address, or 0 if the device didn't ask for one.
+ * @param[in] expires_in	how long to reserve the address for.
+ * @return
+ *	- LEASE_RCODE_SUCCESS.
+ *	- LEASE_RCODE_POOL_EMPTY if there are no free addresses.
+ *	- LEASE_RCODE_FAIL if the change couldn't be logged.
+ */
+lease_rcode_t lease_allocate(uint32_t *out, uint32_t *expires, lease_pool_t *pool, time_t now,
+			     lease_device_t const *device, uint32_t requested, uint32_t expires_in)
+{
+	uint32_t	hash = lease_device_hash(device);
+	uint32_t	slot;
+	lease_t		*l;
+
+	lease_pool_expire(pool, now);
+
+	slot = *lease_index_find(pool, device, hash);
+	if (slot != LEASE_NONE) {
+		l = &pool->leases[slot];
+		lease_unlink(pool, slot);
+
+		/*
+		 *	Don't shorten an existing lease.
+		 */
+		if ((l->state != LEASE_STATE_BOUND) || (l->expires < (now + expires_in))) l->expires = now + expires_in;
+		if (l->state == LEASE_STATE_FREE) l->state = LEASE_STATE_OFFERED;
+	} else {
+		slot = requested ? lease_slot(pool, requested) : LEASE_NONE;
+		if ((slot == LEASE_NONE) || (pool->leases[slot].state != LEASE_STATE_FREE)) {
+			if (pool->free_head == LEASE_NONE) return LEASE_RCODE_POOL_EMPTY;
+			slot = pool->free_head;
+		}
+
+		l = &pool->leases[slot];
+		lease_unlink(pool, slot);
+		lease_index_insert(pool, slot, device, hash);
+		l->state = LEASE_STATE_OFFERED;
+		l->expires = now + expires_in;
+	}
+	lease_link(pool, slot);
+
+	*out = l->address;
+	*expires = l->expires - now;
+
+	if (lease_log(pool, slot) < 0) return LEASE_RCODE_FAIL;
+
+	return lease_persist_check(pool, LEASE_RCODE_SUCCESS);
+}
+
+/** Bind, or renew, a device's lease on an address
+ *
+ * A device may take a free address, even if it wasn't offered to it.
+ * If it had a different lease, that lease is released.
+ *
+ * @param[out] expires		seconds until the lease expires.
+ * @param[in] pool		the address is in.
+ * @param[in] now		current time.
+ * @param[in] device		binding the address.
+ * @param[in] address		to bind.
+ * @param[in] expires_in	how long the lease is for.
+ * @return
+ *	- LEASE_RCODE_SUCCESS.
+ *	- LEASE_RCODE_NOT_FOUND if the address isn't in the pool.
+ *	- LEASE_RCODE_DEVICE_MISMATCH if another device has the address.
+ *	- LEASE_RCODE_FAIL if the change couldn't be logged.
+ */
+lease_rcode_t lease_update(uint32_t *expires, lease_pool_t *pool, time_t now,
+			   lease_device_t const *device, uint32_t address, uint32_t expires_in)
+{
+	uint32_t	hash = lease_device_hash(device);
+	uint32_t	slot, other;
+	lease_t		*l;
+
+	lease_pool_expire(pool, now);
+
+	slot = lease_slot(pool, address);
+	if (slot == LEASE_NONE) return LEASE_RCODE_NOT_FOUND;
+	l = &pool->leases[slot];
+
+	if (!l->has_device || (l->hash != hash) || !lease_device_cmp(&l->device, device)) {
+		if (l->state != LEASE_STATE_FREE) return LEASE_RCODE_DEVICE_MISMATCH;
+
+		other = *lease_index_find(pool, device, hash);
+		if (other != LEASE_NONE) {
+			lease_t *o = &pool->leases[other];
+
+			lease_unlink(pool, other);
+			lease_index_remove(pool, other);
+			o->state = LEASE_STATE_FREE;
+			lease_link(pool, other);
+			if (lease_log(pool, other) < 0) return LEASE_RCODE_FAIL;
+		}
+
+		lease_unlink(pool, slot);
+		lease_index_insert(pool, slot, device, hash);
+	} else {
+		lease_unlink(pool, slot);
+	}
+
+	l->state = LEASE_STATE_BOUND;
+	l->expires = now + expires_in;
+	lease_link(pool, slot);
+
+	*expires = expires_in;
+
+	if (lease_log(pool, slot) < 0) return LEASE_RCODE_FAIL;
+
+	return lease_persist_check(pool, LEASE_RCODE_SUCCESS);
+}
+
+/** Release a device's lease on an address
+ *
+ * The address remembers the device, which will get it back if it asks
+ * again before the address is given to anyone else.
+ *
+ * @param[in] pool		the address is in.
+ * @param[in] now		current time.
+ * @param[in] device		releasing the address.
+ * @param[in] address		to release.
+ * @return
+ *	- LEASE_RCODE_SUCCESS.
+ *	- LEASE_RCODE_NOT_FOUND if the address isn't in the pool.
+ *	- LEASE_RCODE_DEVICE_MISMATCH if the address belongs to another device.
+ *	- LEASE_RCODE_FAIL if the change couldn't be logged.
+ */
+lease_rcode_t lease_release(lease_pool_t *pool, time_t now, lease_device_t const *device, uint32_t address)
+{
+	uint32_t	slot;
+	lease_t		*l;
+
+	lease_pool_expire(pool, now);
+
+	slot = lease_slot(pool, address);
+	if (slot == LEASE_NONE) return LEASE_RCODE_NOT_FOUND;
+	l = &pool->leases[slot];
+
+	if (!l->has_device || !lease_device_cmp(&l->device, device)) return LEASE_RCODE_DEVICE_MISMATCH;
+
+	if (l->state == LEASE_STATE_FREE) return LEASE_RCODE_SUCCESS;
+
+	lease_unlink(pool, slot);
+	l->state = LEASE_STATE_FREE;
+	lease_link(pool, slot);
+
+	if (lease_log(pool, slot) < 0) return LEASE_RCODE_FAIL;
+
+	return lease_persist_check(pool, LEASE_RCODE_SUCCESS);
+}
+
+/** Take an address out of use, because something else is using it
+ *
+ * Only the device the address was offered or leased to may decline it.
+ *
+ * @param[in] pool		the address is in.
+ * @param[in] now		current time.
+ * @param[in] device		declining the address.
+ * @param[in] address		which was declined.
+ * @param[in] expires_in	how long to keep the address out of use for.
+ * @return
+ *	- LEASE_RCODE_SUCCESS.
+ *	- LEASE_RCODE_NOT_FOUND if the address isn't in the pool.
+ *	- LEASE_RCODE_DEVICE_MISMATCH if the address belongs to another device.
+ *	- LEASE_RCODE_FAIL if the change couldn't be logged.
+ */
+lease_rcode_t lease_decline(lease_pool_t *pool, time_t now, lease_device_t const *device,
+			    uint32_t address, uint32_t expires_in)
+{
+	uint32_t	slot;
+	lease_t		*l;
+
+	lease_pool_expire(pool, now);
+
+	slot = lease_slot(pool, address);
+	if (slot == LEASE_NONE) return LEASE_RCODE_NOT_FOUND;
+	l = &pool->leases[slot];
+
+	if (!l->has_device || !lease_device_cmp(&l->device, device)) return LEASE_RCODE_DEVICE_MISMATCH;
+
+	lease_unlink(pool, slot);
+	lease_index_remove(pool, slot);
+	l->state = LEASE_STATE_DECLINED;
+	l->expires = now + expires_in;
+	lease_link(pool, slot);
+
+	if (lease_log(pool, slot) < 0) return LEASE_RCODE_FAIL;
+
+	return lease_persist_check(pool, LEASE_RCODE_SUCCESS);
+}
+
+/** Return the state of an address
+ *
+ * @return the state, or LEASE_STATE_FREE if the address isn't in the pool.
+ */
+lease_state_t lease_state(lease_pool_t *pool, time_t now, uint32_t address)
+{
+	uint32_t slot;
+
+	lease_pool_expire(pool, now);
+
+	slot = lease_slot(pool, address);
+	if (slot == LEASE_NONE) return LEASE_STATE_FREE;
+
+	return pool->leases[slot].state;
+}
+
+uint32_t lease_pool_num_free(lease_pool_t const *pool)
+{
+	return pool->num_free;
+}
+
+uint32_t lease_pool_num_slots(lease_pool_t const *pool)
+{
+	return pool->num_slots;
+}
@@ -0,0 +1,92 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+#ifndef _LEASE_H
+#define _LEASE_H
+/*
+ * $Id$
+ * @file lease.h
+ * @brief In memory IPv4 lease pools.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+RCSIDH(lease_h, "$Id$")
+
+#include <freeradius-devel/libradius.h>
+
+#define LEASE_CLIENT_ID_MAX	(32)		//!< Longest client identifier we index.
+#define LEASE_WHEEL_SIZE	(1024)		//!< Seconds covered by one turn of the expiry wheel.
+#define LEASE_SLOTS_MAX		(1 << 24)	//!< Most addresses a pool can hold.
+#define LEASE_NONE		UINT32_MAX	//!< Not a lease.
+
+typedef enum {
+	LEASE_RCODE_SUCCESS = 0,		//!< Lease allocated, updated or released.
+	LEASE_RCODE_NOT_FOUND = -1,		//!< Address isn't in the pool.
+	LEASE_RCODE_DEVICE_MISMATCH = -2,	//!< Address is leased to another device.
+	LEASE_RCODE_POOL_EMPTY = -3,		//!< No free addresses.
+	LEASE_RCODE_FAIL = -4			//!< Couldn't write the change to the log.
+} lease_rcode_t;
+
+typedef enum {
+	LEASE_STATE_FREE = 0,			//!< Available.  May still remember its last device.
+	LEASE_STATE_OFFERED,			//!< Reserved for a device, until it requests it.
+	LEASE_STATE_BOUND,			//!< Leased to a device.
+	LEASE_STATE_DECLINED			//!< In use by something we don't know about.
+} lease_state_t;
+
+/** Identifies the device a lease belongs to
+ *
+ * Devices which send a client identifier are known by it, others by
+ * their hardware address (RFC 2131 section 4.2).
+ */
+typedef struct {
+	uint8_t			mac[6];				//!< Hardware address.
+	uint8_t			client_id_len;			//!< 0 if there's no client identifier.
+	uint8_t			client_id[LEASE_CLIENT_ID_MAX];	//!< Client identifier.
+} lease_device_t;
+
+typedef struct lease_pool lease_pool_t;
+
+typedef struct lease_snapshot lease_snapshot_t;
+
+lease_pool_t	*lease_pool_alloc(TALLOC_CTX *ctx, uint32_t const *start, uint32_t const *end, int num_ranges);
+
+int		lease_pool_persist(lease_pool_t *pool, char const *filename, bool sync, time_t now);
+
+lease_snapshot_t *lease_pool_snapshot_copy(TALLOC_CTX *ctx, lease_pool_t *pool);
+
+int		lease_snapshot_write(lease_snapshot_t *snap);
+
+int		lease_pool_snapshot(lease_pool_t *pool);
+
+int		lease_pool_flush(lease_pool_t *pool);
+
+lease_rcode_t	lease_allocate(uint32_t *out, uint32_t *expires, lease_pool_t *pool, time_t now,
+			       lease_device_t const *device, uint32_t requested, uint32_t expires_in);
+
+lease_rcode_t	lease_update(uint32_t *expires, lease_pool_t *pool, time_t now,
+			     lease_device_t const *device, uint32_t address, uint32_t expires_in);
+
+lease_rcode_t	lease_release(lease_pool_t *pool, time_t now, lease_device_t const *device, uint32_t address);
+
+lease_rcode_t	lease_decline(lease_pool_t *pool, time_t now, lease_device_t const *device,
+			      uint32_t address, uint32_t expires_in);
+
+lease_state_t	lease_state(lease_pool_t *pool, time_t now, uint32_t address);
+
+uint32_t	lease_pool_num_free(lease_pool_t const *pool);
+
+uint32_t	lease_pool_num_slots(lease_pool_t const *pool);
+#endif	/* _LEASE_H */
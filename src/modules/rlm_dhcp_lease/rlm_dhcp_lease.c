@@ -0,0 +1,468 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file rlm_dhcp_lease.c
+ * @brief DHCP lease management, with the lease state held in memory.
+ *
+ * An alternative to rlm_redis_ippool and rlm_sqlippool for servers which
+ * are the only ones allocating from their pools.  Leases are allocated,
+ * renewed and released without leaving the server, or allocating memory.
+ * Changes are logged to disk, and the pool is reloaded on startup.
+ * Snapshots of the pool are written by a separate thread, so that
+ * requests don't wait for them.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/dhcp.h>
+
+#include "lease.h"
+
+/*
+ *	Values of Pool-Action, plus one for DHCP-Decline.
+ */
+typedef enum {
+	LEASE_ACTION_ALLOCATE = 1,
+	LEASE_ACTION_UPDATE = 2,
+	LEASE_ACTION_RELEASE = 3,
+	LEASE_ACTION_BULK_RELEASE = 4,
+	LEASE_ACTION_DECLINE
+} lease_action_t;
+
+/** rlm_dhcp_lease module instance
+ *
+ */
+typedef struct rlm_dhcp_lease {
+	char const		*name;		//!< Instance name.
+
+	char const		**range;	//!< Ranges of addresses in the pool, as "<first>-<last>".
+
+	uint32_t		offer_time;	//!< How long we reserve an address for after an offer.
+	uint32_t		lease_time;	//!< How long an address is leased for.
+	uint32_t		decline_time;	//!< How long declined addresses are left unused.
+
+	vp_tmpl_t		*mac;		//!< Hardware address of the device.
+	vp_tmpl_t		*client_id;	//!< Client identifier of the device.  Used in preference
+						//!< to the hardware address, if present.
+	vp_tmpl_t		*requested_address;	//!< Address the device asked for.
+	vp_tmpl_t		*client_address;	//!< Address the device is renewing or releasing, if
+							//!< it didn't ask for one.
+
+	vp_tmpl_t		*allocated_address_attr;	//!< Where to write the address.
+	vp_tmpl_t		*expiry_attr;	//!< Where to write the time left on the lease.
+
+	char const		*filename;	//!< Prefix of the snapshot and log files.
+	bool			sync;		//!< Sync the log before replying.
+	uint32_t		snapshot_interval;	//!< How often to write a snapshot.
+
+	pthread_mutex_t		mutex;		//!< Protects everything below.
+	lease_pool_t		*pool;		//!< Addresses, and their leases.
+
+	pthread_cond_t		wakeup;		//!< Signalled to stop the snapshot thread.
+	pthread_t		snapshotter;	//!< Writes snapshots of the pool.
+	bool			running;	//!< Whether the snapshot thread was started.
+	bool			stop;		//!< Tell the snapshot thread to exit.
+} rlm_dhcp_lease_t;
+
+static CONF_PARSER module_config[] = {
+	{ FR_CONF_OFFSET("range", PW_TYPE_STRING | PW_TYPE_MULTI | PW_TYPE_REQUIRED, rlm_dhcp_lease_t, range) },
+
+	{ FR_CONF_OFFSET("offer_time", PW_TYPE_INTEGER, rlm_dhcp_lease_t, offer_time), .dflt = "30" },
+	{ FR_CONF_OFFSET("lease_time", PW_TYPE_INTEGER, rlm_dhcp_lease_t, lease_time), .dflt = "3600" },
+	{ FR_CONF_OFFSET("decline_time", PW_TYPE_INTEGER, rlm_dhcp_lease_t, decline_time), .dflt = "3600" },
+
+	{ FR_CONF_OFFSET("mac", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_dhcp_lease_t, mac), .dflt = "&DHCP-Client-Hardware-Address", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("client_id", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_dhcp_lease_t, client_id), .dflt = "&DHCP-Client-Identifier", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("requested_address", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_dhcp_lease_t, requested_address), .dflt = "&DHCP-Requested-IP-Address", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("client_address", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_dhcp_lease_t, client_address), .dflt = "&DHCP-Client-IP-Address", .quote = T_BARE_WORD },
+
+	{ FR_CONF_OFFSET("allocated_address_attr", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE | PW_TYPE_REQUIRED, rlm_dhcp_lease_t, allocated_address_attr), .dflt = "&reply:DHCP-Your-IP-Address", .quote = T_BARE_WORD },
+	{ FR_CONF_OFFSET("expiry_attr", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_dhcp_lease_t, expiry_attr) },
+
+	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT, rlm_dhcp_lease_t, filename) },
+	{ FR_CONF_OFFSET("sync", PW_TYPE_BOOLEAN, rlm_dhcp_lease_t, sync), .dflt = "no" },
+	{ FR_CONF_OFFSET("snapshot_interval", PW_TYPE_INTEGER, rlm_dhcp_lease_t, snapshot_interval), .dflt = "300" },
+	CONF_PARSER_TERMINATOR
+};
+
+/** Find the first IPv4 address in the attributes referenced by a list of templates
+ *
+ * @return the address in host byte order, or 0 if none of the attributes exist.
+ */
+static uint32_t lease_address(REQUEST *request, vp_tmpl_t const *a, vp_tmpl_t const *b)
+{
+	VALUE_PAIR *vp;
+
+	if (a && (tmpl_find_vp(&vp, request, a) == 0) && (vp->vp_type == PW_TYPE_IPV4_ADDR) && vp->vp_ipaddr) {
+		return ntohl(vp->vp_ipaddr);
+	}
+
+	if (b && (tmpl_find_vp(&vp, request, b) == 0) && (vp->vp_type == PW_TYPE_IPV4_ADDR) && vp->vp_ipaddr) {
+		return ntohl(vp->vp_ipaddr);
+	}
+
+	return 0;
+}
+
+/** Write a value to the attribute referenced by a template
+ *
+ */
+static int lease_map(REQUEST *request, vp_tmpl_t *lhs, PW_TYPE type, uint32_t value)
+{
+	vp_tmpl_t rhs = {
+		.name = "",
+		.type = TMPL_TYPE_DATA,
+		.quote = T_BARE_WORD
+	};
+	vp_map_t map = {
+		.lhs = lhs,
+		.op = T_OP_SET,
+		.rhs = &rhs
+	};
+
+	if (type == PW_TYPE_IPV4_ADDR) {
+		rhs.tmpl_value_box_datum.ipaddr.s_addr = htonl(value);
+	} else {
+		rhs.tmpl_value_box_datum.integer = value;
+	}
+	rhs.tmpl_value_box_length = 4;
+	rhs.tmpl_value_box_type = type;
+
+	return map_to_request(request, &map, map_to_vp, NULL);
+}
+
+static rlm_rcode_t mod_action(rlm_dhcp_lease_t *inst, REQUEST *request, lease_action_t action)
+{
+	lease_device_t	device;
+	VALUE_PAIR	*vp;
+	uint32_t	address, requested, expires = 0;
+	time_t		now = request->packet->timestamp.tv_sec;
+	lease_rcode_t	rcode;
+	char		buffer[INET_ADDRSTRLEN];
+
+	memset(&device, 0, sizeof(device));
+
+	if (!inst->mac || (tmpl_find_vp(&vp, request, inst->mac) < 0) || (vp->vp_type != PW_TYPE_ETHERNET)) {
+		RDEBUG2("No hardware address, doing nothing");
+		return RLM_MODULE_NOOP;
+	}
+	memcpy(device.mac, vp->vp_ether, sizeof(device.mac));
+
+	if (inst->client_id && (tmpl_find_vp(&vp, request, inst->client_id) == 0) && (vp->vp_length > 0)) {
+		if (vp->vp_length > LEASE_CLIENT_ID_MAX) {
+			RWDEBUG("Ignoring client identifier longer than %u bytes", LEASE_CLIENT_ID_MAX);
+		} else {
+			device.client_id_len = vp->vp_length;
+			memcpy(device.client_id, vp->vp_octets, vp->vp_length);
+		}
+	}
+
+	requested = lease_address(request, inst->requested_address, NULL);
+	address = lease_address(request, inst->requested_address, inst->client_address);
+
+	switch (action) {
+	case LEASE_ACTION_ALLOCATE:
+		pthread_mutex_lock(&inst->mutex);
+		rcode = lease_allocate(&address, &expires, inst->pool, now, &device, requested, inst->offer_time);
+		pthread_mutex_unlock(&inst->mutex);
+		break;
+
+	case LEASE_ACTION_UPDATE:
+		if (!address) {
+			RDEBUG2("No requested or client address, doing nothing");
+			return RLM_MODULE_NOOP;
+		}
+
+		pthread_mutex_lock(&inst->mutex);
+		rcode = lease_update(&expires, inst->pool, now, &device, address, inst->lease_time);
+		pthread_mutex_unlock(&inst->mutex);
+		break;
+
+	case LEASE_ACTION_RELEASE:
+		if (!address) {
+			RDEBUG2("No client address, doing nothing");
+			return RLM_MODULE_NOOP;
+		}
+
+		pthread_mutex_lock(&inst->mutex);
+		rcode = lease_release(inst->pool, now, &device, address);
+		pthread_mutex_unlock(&inst->mutex);
+		break;
+
+	case LEASE_ACTION_DECLINE:
+		if (!requested) {
+			RDEBUG2("No requested address, doing nothing");
+			return RLM_MODULE_NOOP;
+		}
+		address = requested;
+
+		pthread_mutex_lock(&inst->mutex);
+		rcode = lease_decline(inst->pool, now, &device, address, inst->decline_time);
+		pthread_mutex_unlock(&inst->mutex);
+		break;
+
+	case LEASE_ACTION_BULK_RELEASE:
+		RDEBUG2("Bulk release not supported");
+		return RLM_MODULE_NOOP;
+
+	default:
+		REDEBUG("Unknown Pool-Action %u", action);
+		return RLM_MODULE_FAIL;
+	}
+
+	{
+		struct in_addr in = { .s_addr = htonl(address) };
+
+		inet_ntop(AF_INET, &in, buffer, sizeof(buffer));
+	}
+
+	switch (rcode) {
+	case LEASE_RCODE_SUCCESS:
+		break;
+
+	case LEASE_RCODE_NOT_FOUND:
+		REDEBUG("IP address \"%s\" is not a member of the pool", buffer);
+		return RLM_MODULE_NOTFOUND;
+
+	case LEASE_RCODE_DEVICE_MISMATCH:
+		REDEBUG("IP address \"%s\" is leased to another device", buffer);
+		return RLM_MODULE_INVALID;
+
+	case LEASE_RCODE_POOL_EMPTY:
+		RWDEBUG("Pool contains no free addresses");
+		return RLM_MODULE_NOTFOUND;
+
+	case LEASE_RCODE_FAIL:
+	default:
+		REDEBUG("Failed persisting lease: %s", fr_strerror());
+		return RLM_MODULE_FAIL;
+	}
+
+	switch (action) {
+	case LEASE_ACTION_ALLOCATE:
+		RDEBUG2("IP address \"%s\" offered for %u seconds", buffer, expires);
+		break;
+
+	case LEASE_ACTION_UPDATE:
+		RDEBUG2("IP address \"%s\" leased for %u seconds", buffer, expires);
+		break;
+
+	case LEASE_ACTION_RELEASE:
+		RDEBUG2("IP address \"%s\" released", buffer);
+		return RLM_MODULE_UPDATED;
+
+	default:
+		RDEBUG2("IP address \"%s\" declined", buffer);
+		return RLM_MODULE_UPDATED;
+	}
+
+	if (lease_map(request, inst->allocated_address_attr, PW_TYPE_IPV4_ADDR, address) < 0) return RLM_MODULE_FAIL;
+
+	if (inst->expiry_attr && (lease_map(request, inst->expiry_attr, PW_TYPE_INTEGER, expires) < 0)) {
+		return RLM_MODULE_FAIL;
+	}
+
+	return RLM_MODULE_UPDATED;
+}
+
+/*
+ *	Pool-Action overrides the action, otherwise it's decided by
+ *	the type of DHCP message.
+ */
+static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_dhcp_lease_t	*inst = instance;
+	VALUE_PAIR		*vp;
+
+	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
+	if (vp) return mod_action(inst, request, vp->vp_integer);
+
+	vp = fr_pair_find_by_num(request->packet->vps, DHCP_MAGIC_VENDOR, PW_DHCP_MESSAGE_TYPE, TAG_ANY);
+	if (!vp) {
+		RDEBUG2("Couldn't find &request:DHCP-Message-Type or &control:Pool-Action, doing nothing...");
+		return RLM_MODULE_NOOP;
+	}
+
+	switch (vp->vp_byte) {
+	case PW_DHCP_DISCOVER - PW_DHCP_OFFSET:
+		return mod_action(inst, request, LEASE_ACTION_ALLOCATE);
+
+	case PW_DHCP_REQUEST - PW_DHCP_OFFSET:
+		return mod_action(inst, request, LEASE_ACTION_UPDATE);
+
+	case PW_DHCP_DECLINE - PW_DHCP_OFFSET:
+		return mod_action(inst, request, LEASE_ACTION_DECLINE);
+
+	case PW_DHCP_RELEASE - PW_DHCP_OFFSET:
+		return mod_action(inst, request, LEASE_ACTION_RELEASE);
+
+	default:
+		return RLM_MODULE_NOOP;
+	}
+}
+
+/** Write a snapshot of the pool every snapshot_interval
+ *
+ * The pool is copied with the mutex held, and written without it, so
+ * requests only wait for the copy.
+ */
+static void *mod_snapshot(void *arg)
+{
+	rlm_dhcp_lease_t	*inst = arg;
+	lease_snapshot_t	*snap;
+	struct timespec		ts;
+
+	pthread_mutex_lock(&inst->mutex);
+	while (!inst->stop) {
+		ts.tv_sec = time(NULL) + inst->snapshot_interval;
+		ts.tv_nsec = 0;
+		pthread_cond_timedwait(&inst->wakeup, &inst->mutex, &ts);
+		if (inst->stop) break;
+
+		snap = lease_pool_snapshot_copy(NULL, inst->pool);
+		pthread_mutex_unlock(&inst->mutex);
+
+		if (!snap || (lease_snapshot_write(snap) < 0)) {
+			ERROR("rlm_dhcp_lease (%s): Failed writing snapshot: %s", inst->name, fr_strerror());
+		}
+		talloc_free(snap);
+
+		pthread_mutex_lock(&inst->mutex);
+	}
+	pthread_mutex_unlock(&inst->mutex);
+
+	return NULL;
+}
+
+static int mod_instantiate(CONF_SECTION *conf, void *instance)
+{
+	rlm_dhcp_lease_t	*inst = instance;
+	uint32_t		*start, *end;
+	int			i, num_ranges;
+
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	rad_assert(inst->allocated_address_attr->type == TMPL_TYPE_ATTR);
+
+	FR_INTEGER_BOUND_CHECK("offer_time", inst->offer_time, >=, 1);
+	FR_INTEGER_BOUND_CHECK("lease_time", inst->lease_time, >=, 1);
+
+	num_ranges = talloc_array_length(inst->range);
+	start = talloc_array(inst, uint32_t, num_ranges);
+	end = talloc_array(inst, uint32_t, num_ranges);
+
+	for (i = 0; i < num_ranges; i++) {
+		char const	*p = inst->range[i], *q;
+		fr_ipaddr_t	ipaddr;
+
+		q = strchr(p, '-');
+		if (fr_inet_pton4(&ipaddr, p, q ? (q - p) : -1, false, false, false) < 0) {
+		invalid:
+			cf_log_err_cs(conf, "Invalid range \"%s\": %s", inst->range[i], fr_strerror());
+			return -1;
+		}
+		start[i] = end[i] = ntohl(ipaddr.ipaddr.ip4addr.s_addr);
+
+		if (q) {
+			if (fr_inet_pton4(&ipaddr, q + 1, -1, false, false, false) < 0) goto invalid;
+			end[i] = ntohl(ipaddr.ipaddr.ip4addr.s_addr);
+		}
+	}
+
+	inst->pool = lease_pool_alloc(inst, start, end, num_ranges);
+	talloc_free(start);
+	talloc_free(end);
+	if (!inst->pool) {
+		cf_log_err_cs(conf, "Failed creating pool: %s", fr_strerror());
+		return -1;
+	}
+
+	if (inst->filename && (lease_pool_persist(inst->pool, inst->filename, inst->sync, time(NULL)) < 0)) {
+		cf_log_err_cs(conf, "Failed loading pool: %s", fr_strerror());
+		return -1;
+	}
+
+	if (pthread_mutex_init(&inst->mutex, NULL) < 0) {
+		ERROR("Failed initializing mutex: %s", fr_syserror(errno));
+		return -1;
+	}
+	pthread_cond_init(&inst->wakeup, NULL);
+
+	if (inst->filename && inst->snapshot_interval) {
+		int ret;
+
+		ret = pthread_create(&inst->snapshotter, NULL, mod_snapshot, inst);
+		if (ret != 0) {
+			ERROR("Failed starting snapshot thread: %s", fr_syserror(ret));
+			return -1;
+		}
+		inst->running = true;
+	}
+
+	INFO("rlm_dhcp_lease (%s): %u addresses, %u free", inst->name,
+	     lease_pool_num_slots(inst->pool), lease_pool_num_free(inst->pool));
+
+	return 0;
+}
+
+static int mod_detach(void *instance)
+{
+	rlm_dhcp_lease_t *inst = instance;
+
+	if (!inst->pool) return 0;
+
+	if (inst->running) {
+		pthread_mutex_lock(&inst->mutex);
+		inst->stop = true;
+		pthread_cond_signal(&inst->wakeup);
+		pthread_mutex_unlock(&inst->mutex);
+
+		pthread_join(inst->snapshotter, NULL);
+		inst->running = false;
+	}
+
+	/*
+	 *	Writes anything which is buffered.
+	 */
+	TALLOC_FREE(inst->pool);
+	pthread_cond_destroy(&inst->wakeup);
+	pthread_mutex_destroy(&inst->mutex);
+
+	return 0;
+}
+
+extern rad_module_t rlm_dhcp_lease;
+rad_module_t rlm_dhcp_lease = {
+	.magic		= RLM_MODULE_INIT,
+	.name		= "dhcp_lease",
+	.type		= RLM_TYPE_THREAD_SAFE,
+	.inst_size	= sizeof(rlm_dhcp_lease_t),
+	.config		= module_config,
+	.instantiate	= mod_instantiate,
+	.detach		= mod_detach,
+	.methods = {
+		[MOD_AUTHORIZE]		= mod_post_auth,
+		[MOD_POST_AUTH]		= mod_post_auth,
+	},
+};
@@ -31,6 +31,7 @@ RCSIDH(eap_h, "$Id$")
 #include <freeradius-devel/rad_assert.h>
 
 #include "eap_types.h"
+#include "eap_offload.h"
 
 /* TLS configuration name */
 #define TLS_CONFIG_SECTION "tls-config"
@@ -79,6 +80,12 @@ struct _eap_session {
 
 	eap_process_t	process;			//!< Callback that should be used to process the next round.
 							//!< Usually set to the process functino of an EAP submodule.
+
+	eap_offload_t	*offload;			//!< Pool the EAP method can hand CPU heavy operations to.
+							//!< NULL if offloading is disabled.
+	eap_offload_job_t *job;				//!< Outstanding offload job.  If set when process returns
+							//!< #RLM_MODULE_YIELD, process is called again once the job
+							//!< completes.
 	int		rounds;				//!< How many roundtrips have occurred this session.
 
 	time_t		updated;			//!< The last time we received a packet for this EAP session.
@@ -97,6 +104,11 @@ typedef struct rlm_eap_config {
 
 	bool			ignore_unknown_types;		//!< Ignore unknown types (for later proxying).
 	bool			cisco_accounting_username_bug;
+
+	uint32_t		offload_threads;		//!< Number of threads to offload CPU heavy
+								//!< operations to.  0 disables offloading.
+	uint32_t		offload_max_queued;		//!< Operations are run inline once this many
+								//!< are waiting for a thread.
 } rlm_eap_config_t;
 
 /** Instantiate an EAP submodule
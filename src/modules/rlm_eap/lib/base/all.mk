@@ -2,7 +2,8 @@ TARGET := libfreeradius-eap.a
 
 SOURCES	:= \
 	eapcommon.c\
-	eap_chbind.c
+	eap_chbind.c\
+	eap_offload.c
 
 ifneq (${OPENSSL_LIBS},)
 SOURCES		+= eap_tls.c mppe_keys.c
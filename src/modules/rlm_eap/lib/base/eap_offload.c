@@ -0,0 +1,377 @@
+/*
+ * eap_offload.c
+ *
+ * Version:     $Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/**
+ * $Id$
+ * @file eap_offload.c
+ * @brief Run CPU heavy EAP operations outside of the worker threads.
+ *
+ * Operations like the EAP-pwd hunting and pecking loop can take tens of
+ * milliseconds.  Whilst they run inline, every other request on the same
+ * worker thread waits.
+ *
+ * Instead, an EAP method can submit the operation to a pool of offload
+ * threads, and yield the request.  Each job has a pipe, the read end of
+ * which is added to the request's event list.  When the job completes,
+ * the offload thread writes to the pipe, the worker's event loop wakes
+ * up, and the request is marked resumable.
+ *
+ * Because the completion is signalled through the request's own event
+ * list, this works for requests being run synchronously (i.e. in tunnels)
+ * as well as ones being run by a worker.
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/modules.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "eap_offload.h"
+
+typedef enum {
+	EAP_OFFLOAD_QUEUED = 0,				//!< Waiting for an offload thread.
+	EAP_OFFLOAD_RUNNING,				//!< Being run by an offload thread.
+	EAP_OFFLOAD_DONE,				//!< Complete, the worker has been signalled.
+	EAP_OFFLOAD_CANCELLED				//!< Cancelled whilst running, the offload thread
+							//!< will free it.
+} eap_offload_state_t;
+
+struct eap_offload_job {
+	eap_offload_t		*offload;		//!< Pool the job was submitted to.
+	eap_offload_job_t	*next;			//!< Next job in the queue.
+
+	eap_offload_func_t	func;			//!< Function to run.
+	void			*uctx;			//!< Data for the function, owned by the job.
+	int			ret;			//!< What the function returned.
+
+	int			fd[2];			//!< Signals the worker when the job completes.
+	eap_offload_state_t	state;			//!< Protected by the pool mutex.
+};
+
+struct eap_offload {
+	pthread_mutex_t		mutex;			//!< Protects the queue, and job states.
+	pthread_cond_t		cond;			//!< Signalled when a job is queued.
+
+	eap_offload_job_t	*head;			//!< Next job to run.
+	eap_offload_job_t	*tail;			//!< Last job to run.
+	uint32_t		num_queued;		//!< Number of jobs in the queue.
+	uint32_t		max_queued;		//!< Jobs are run inline once the queue is this long.
+
+	pthread_t		*threads;		//!< Offload threads.
+	uint32_t		num_threads;		//!< How many offload threads were started.
+	bool			stop;			//!< Tell the offload threads to exit.
+};
+
+static int _eap_offload_job_free(eap_offload_job_t *job)
+{
+	if (job->fd[0] >= 0) close(job->fd[0]);
+	if (job->fd[1] >= 0) close(job->fd[1]);
+
+	return 0;
+}
+
+static void *eap_offload_thread(void *arg)
+{
+	eap_offload_t		*offload = arg;
+	eap_offload_job_t	*job;
+	int			ret;
+
+	pthread_mutex_lock(&offload->mutex);
+	while (!offload->stop) {
+		job = offload->head;
+		if (!job) {
+			pthread_cond_wait(&offload->cond, &offload->mutex);
+			continue;
+		}
+
+		offload->head = job->next;
+		if (!offload->head) offload->tail = NULL;
+		offload->num_queued--;
+
+		job->next = NULL;
+		job->state = EAP_OFFLOAD_RUNNING;
+		pthread_mutex_unlock(&offload->mutex);
+
+		ret = job->func(job->uctx);
+
+		pthread_mutex_lock(&offload->mutex);
+
+		/*
+		 *	The request went away whilst we were
+		 *	running, nobody wants the result.
+		 */
+		if (job->state == EAP_OFFLOAD_CANCELLED) {
+			talloc_free(job);
+			continue;
+		}
+
+		/*
+		 *	Write with the mutex held, so the worker
+		 *	can't free the job (and close the pipe)
+		 *	underneath us.  The pipe is empty, so this
+		 *	never blocks.
+		 */
+		job->ret = ret;
+		job->state = EAP_OFFLOAD_DONE;
+		if (write(job->fd[1], "", 1) < 0) {
+			ERROR("Failed signalling EAP offload job completion: %s", fr_syserror(errno));
+		}
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	return NULL;
+}
+
+/** Called by the worker's event loop when a job completes
+ *
+ */
+static void _eap_offload_job_done(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx, int fd)
+{
+	eap_offload_job_t	*job = talloc_get_type_abort(ctx, eap_offload_job_t);
+	uint8_t			buff[1];
+
+	rad_assert(fd == job->fd[0]);
+
+	if ((read(fd, buff, sizeof(buff)) < 0) && (errno != EAGAIN) && (errno != EINTR)) {
+		RERROR("Failed reading EAP offload job completion: %s", fr_syserror(errno));
+	}
+
+	unlang_resumable(request);
+}
+
+/** Submit an operation to the offload threads
+ *
+ * On success the caller should return #RLM_MODULE_YIELD.  The request will
+ * be resumed when the job completes, at which point the caller must retrieve
+ * the result with #eap_offload_result.  If the request is abandoned whilst the
+ * job is outstanding, the caller must call #eap_offload_cancel.
+ *
+ * Must be called from the module's own method, not from a resume callback,
+ * as the pipe is added with unlang_event_fd_readable_add().  rlm_eap clears
+ * eap_session_t.offload for rounds which are resumed.
+ *
+ * @param[in] offload	pool to submit the job to.
+ * @param[in] request	to resume when the job completes.
+ * @param[in] func	to run.
+ * @param[in] uctx	to pass to func.  Must be a talloc chunk.  Ownership passes
+ *			to the job, and is given back by #eap_offload_result.
+ * @return
+ *	- A new job.
+ *	- NULL if the operation should be run inline, because the queue is full,
+ *	  or the job couldn't be created.  uctx is still owned by the caller.
+ */
+eap_offload_job_t *eap_offload_submit(eap_offload_t *offload, REQUEST *request,
+				      eap_offload_func_t func, void *uctx)
+{
+	eap_offload_job_t	*job;
+	TALLOC_CTX		*parent;
+
+	if (!offload || (offload->num_queued >= offload->max_queued)) return NULL;
+
+	/*
+	 *	Not parented, the offload thread may
+	 *	need to free it.
+	 */
+	MEM(job = talloc_zero(NULL, eap_offload_job_t));
+	job->fd[0] = job->fd[1] = -1;
+	talloc_set_destructor(job, _eap_offload_job_free);
+
+	if (pipe(job->fd) < 0) {
+		RERROR("Failed creating EAP offload pipe: %s", fr_syserror(errno));
+	error:
+		talloc_free(job);
+		return NULL;
+	}
+	fr_nonblock(job->fd[0]);
+
+	if (unlang_event_fd_readable_add(request, _eap_offload_job_done, job, job->fd[0]) < 0) {
+		RERROR("Failed adding EAP offload pipe to event loop");
+		goto error;
+	}
+
+	job->offload = offload;
+	job->func = func;
+	parent = talloc_parent(uctx);
+	job->uctx = talloc_steal(job, uctx);
+
+	pthread_mutex_lock(&offload->mutex);
+	if (offload->num_queued >= offload->max_queued) {
+		pthread_mutex_unlock(&offload->mutex);
+		unlang_event_fd_delete(request, job, job->fd[0]);
+		talloc_steal(parent, uctx);
+		goto error;
+	}
+
+	if (offload->tail) {
+		offload->tail->next = job;
+	} else {
+		offload->head = job;
+	}
+	offload->tail = job;
+	offload->num_queued++;
+	pthread_cond_signal(&offload->cond);
+	pthread_mutex_unlock(&offload->mutex);
+
+	return job;
+}
+
+/** Get the result of a completed job, and free it
+ *
+ * @param[in] ctx	to move the job's uctx into.
+ * @param[out] ret	What the job's function returned.
+ * @param[in] request	the job was submitted for.
+ * @param[in] job	to free.
+ * @return The uctx passed to #eap_offload_submit.
+ */
+void *eap_offload_result(TALLOC_CTX *ctx, int *ret, REQUEST *request, eap_offload_job_t *job)
+{
+	eap_offload_t	*offload = job->offload;
+	void		*uctx;
+
+	/*
+	 *	The state and return code were set by the
+	 *	offload thread, with the mutex held.
+	 */
+	pthread_mutex_lock(&offload->mutex);
+	rad_assert(job->state == EAP_OFFLOAD_DONE);
+	*ret = job->ret;
+	pthread_mutex_unlock(&offload->mutex);
+
+	/*
+	 *	Remove the event before the pipe is closed
+	 */
+	unlang_event_fd_delete(request, job, job->fd[0]);
+
+	uctx = talloc_steal(ctx, job->uctx);
+	talloc_free(job);
+
+	return uctx;
+}
+
+/** Cancel a job
+ *
+ * If the job is still queued it's removed.  If it's running, it's freed by
+ * the offload thread when the function returns.  Either way, the job must
+ * not be used after this function returns.
+ *
+ * @param[in] request	the job was submitted for.  May be NULL if the request
+ *			is being freed, in which case its events are freed with it.
+ * @param[in] job	to cancel.
+ */
+void eap_offload_cancel(REQUEST *request, eap_offload_job_t *job)
+{
+	eap_offload_t		*offload = job->offload;
+	eap_offload_job_t	**p;
+
+	if (request) unlang_event_fd_delete(request, job, job->fd[0]);
+
+	pthread_mutex_lock(&offload->mutex);
+	switch (job->state) {
+	case EAP_OFFLOAD_QUEUED:
+		for (p = &offload->head; *p; p = &(*p)->next) {
+			if (*p != job) continue;
+
+			*p = job->next;
+			if (offload->tail == job) {
+				eap_offload_job_t *prev;
+
+				for (prev = offload->head; prev && prev->next; prev = prev->next);
+				offload->tail = prev;
+			}
+			offload->num_queued--;
+			break;
+		}
+		break;
+
+	case EAP_OFFLOAD_RUNNING:
+		job->state = EAP_OFFLOAD_CANCELLED;
+		pthread_mutex_unlock(&offload->mutex);
+		return;
+
+	case EAP_OFFLOAD_DONE:
+	case EAP_OFFLOAD_CANCELLED:
+		break;
+	}
+	pthread_mutex_unlock(&offload->mutex);
+
+	talloc_free(job);
+}
+
+static int _eap_offload_free(eap_offload_t *offload)
+{
+	eap_offload_job_t	*job, *next;
+	uint32_t		i;
+
+	pthread_mutex_lock(&offload->mutex);
+	offload->stop = true;
+	pthread_cond_broadcast(&offload->cond);
+	pthread_mutex_unlock(&offload->mutex);
+
+	for (i = 0; i < offload->num_threads; i++) pthread_join(offload->threads[i], NULL);
+
+	for (job = offload->head; job; job = next) {
+		next = job->next;
+		talloc_free(job);
+	}
+
+	pthread_cond_destroy(&offload->cond);
+	pthread_mutex_destroy(&offload->mutex);
+
+	return 0;
+}
+
+/** Create a pool of offload threads
+ *
+ * @param[in] ctx		to allocate the pool in.
+ * @param[in] num_threads	to start.
+ * @param[in] max_queued	Maximum number of jobs waiting for a thread.  Once
+ *				the queue is this long, #eap_offload_submit returns
+ *				NULL, and the caller should do the work inline.
+ * @return
+ *	- A new offload pool.
+ *	- NULL on error.
+ */
+eap_offload_t *eap_offload_alloc(TALLOC_CTX *ctx, uint32_t num_threads, uint32_t max_queued)
+{
+	eap_offload_t	*offload;
+	int		ret;
+
+	rad_assert(num_threads > 0);
+
+	MEM(offload = talloc_zero(ctx, eap_offload_t));
+	MEM(offload->threads = talloc_array(offload, pthread_t, num_threads));
+	offload->max_queued = max_queued;
+
+	pthread_mutex_init(&offload->mutex, NULL);
+	pthread_cond_init(&offload->cond, NULL);
+	talloc_set_destructor(offload, _eap_offload_free);
+
+	for (offload->num_threads = 0; offload->num_threads < num_threads; offload->num_threads++) {
+		ret = pthread_create(&offload->threads[offload->num_threads], NULL, eap_offload_thread, offload);
+		if (ret != 0) {
+			ERROR("Failed starting EAP offload thread: %s", fr_syserror(ret));
+			talloc_free(offload);
+			return NULL;
+		}
+	}
+
+	return offload;
+}
@@ -0,0 +1,57 @@
+/*
+ * eap_offload.h
+ *
+ * Version:     $Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+#ifndef _EAP_OFFLOAD_H
+#define _EAP_OFFLOAD_H
+
+RCSIDH(eap_offload_h, "$Id$")
+
+#include <freeradius-devel/radiusd.h>
+
+/** A pool of threads which EAP methods can hand CPU heavy operations to
+ *
+ */
+typedef struct eap_offload eap_offload_t;
+
+/** An operation submitted to an #eap_offload_t
+ *
+ */
+typedef struct eap_offload_job eap_offload_job_t;
+
+/** Function run by one of the offload threads
+ *
+ * @param[in] uctx	passed to #eap_offload_submit.  Nothing else may access
+ *			it until the job has completed.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+typedef int (*eap_offload_func_t)(void *uctx);
+
+eap_offload_t		*eap_offload_alloc(TALLOC_CTX *ctx, uint32_t num_threads, uint32_t max_queued);
+
+eap_offload_job_t	*eap_offload_submit(eap_offload_t *offload, REQUEST *request,
+					    eap_offload_func_t func, void *uctx);
+
+void			*eap_offload_result(TALLOC_CTX *ctx, int *ret, REQUEST *request, eap_offload_job_t *job);
+
+void			eap_offload_cancel(REQUEST *request, eap_offload_job_t *job);
+#endif /* _EAP_OFFLOAD_H */
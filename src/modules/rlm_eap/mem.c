@@ -54,6 +54,15 @@ static int _eap_session_free(eap_session_t *eap_session)
 {
 	REQUEST *request = eap_session->request;
 
+	/*
+	 *	The request is being freed whilst an offload
+	 *	job is outstanding.  Its events go with it.
+	 */
+	if (eap_session->job) {
+		eap_offload_cancel(NULL, eap_session->job);
+		eap_session->job = NULL;
+	}
+
 	if (eap_session->identity) {
 		talloc_free(eap_session->identity);
 		eap_session->identity = NULL;
@@ -109,6 +118,7 @@ eap_session_t *eap_session_alloc(rlm_eap_t const *inst, REQUEST *request)
 		return NULL;
 	}
 	eap_session->inst = inst;
+	eap_session->offload = inst->offload;
 	eap_session->request = request;
 	eap_session->updated = request->packet->timestamp.tv_sec;
 
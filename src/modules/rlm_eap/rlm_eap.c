@@ -42,6 +42,8 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("cisco_accounting_username_bug", PW_TYPE_BOOLEAN, rlm_eap_config_t,
 			 cisco_accounting_username_bug), .dflt = "no" },
 	{ FR_CONF_DEPRECATED("max_sessions", PW_TYPE_INTEGER, rlm_eap_config_t, max_sessions), .dflt = "2048" },
+	{ FR_CONF_OFFSET("offload_threads", PW_TYPE_INTEGER, rlm_eap_config_t, offload_threads), .dflt = "0" },
+	{ FR_CONF_OFFSET("offload_max_queued", PW_TYPE_INTEGER, rlm_eap_config_t, offload_max_queued), .dflt = "1024" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -231,6 +233,28 @@ static int mod_bootstrap(CONF_SECTION *cs, void *instance)
 	return 0;
 }
 
+static int mod_instantiate(CONF_SECTION *cs, void *instance)
+{
+	rlm_eap_t	*inst = instance;
+
+	if (!inst->config.offload_threads) return 0;
+
+	FR_INTEGER_BOUND_CHECK("offload_threads", inst->config.offload_threads, <=, 256);
+	FR_INTEGER_BOUND_CHECK("offload_max_queued", inst->config.offload_max_queued, >=, 1);
+
+	/*
+	 *	Started here, not in bootstrap, so the
+	 *	threads survive the server daemonizing.
+	 */
+	inst->offload = eap_offload_alloc(inst, inst->config.offload_threads, inst->config.offload_max_queued);
+	if (!inst->offload) {
+		cf_log_err_cs(cs, "Failed starting EAP offload threads");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Process NAK data from EAP peer
  *
  */
@@ -337,6 +361,48 @@ static eap_type_t eap_process_nak(rlm_eap_t *inst, REQUEST *request,
 	return method;
 }
 
+/** Call the process function of the EAP method for the current round
+ *
+ * @param inst Configuration data for this instance of rlm_eap.
+ * @param eap_session State data that persists over multiple rounds of EAP.
+ * @return a status code.
+ */
+static rlm_rcode_t eap_method_call(rlm_eap_t *inst, eap_session_t *eap_session)
+{
+	rlm_rcode_t		rcode;
+	char const		*caller;
+	rlm_eap_method_t	*method = inst->methods[eap_session->type];
+	REQUEST			*request = eap_session->request;
+
+	RDEBUG2("Calling submodule %s", method->submodule->name);
+
+	caller = request->module;
+	request->module = method->submodule->name;
+	rcode = eap_session->process(method->submodule_inst, eap_session);
+	request->module = caller;
+
+	switch (rcode) {
+	default:
+		REDEBUG2("Failed in EAP %s (%d) session.  EAP sub-module failed",
+			 eap_type2name(eap_session->type), eap_session->type);
+		break;
+
+	case RLM_MODULE_YIELD:
+		rad_assert(eap_session->job);
+		RDEBUG2("EAP %s (%d) session offloaded work, yielding",
+			eap_type2name(eap_session->type), eap_session->type);
+		break;
+
+	case RLM_MODULE_OK:
+	case RLM_MODULE_NOOP:
+	case RLM_MODULE_UPDATED:
+	case RLM_MODULE_HANDLED:
+		break;
+	}
+
+	return rcode;
+}
+
 /** Select the correct callback based on a response
  *
  * Based on the EAP response from the supplicant, call the appropriate
@@ -351,8 +417,6 @@ static eap_type_t eap_process_nak(rlm_eap_t *inst, REQUEST *request,
 static rlm_rcode_t eap_method_select(rlm_eap_t *inst, eap_session_t *eap_session)
 {
 	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	char const		*caller;
-	rlm_eap_method_t	*method;
 	eap_type_data_t		*type = &eap_session->this_round->response->type;
 	REQUEST			*request = eap_session->request;
 
@@ -459,75 +523,23 @@ static rlm_rcode_t eap_method_select(rlm_eap_t *inst, eap_session_t *eap_session
 		eap_session->type = type->num;
 
 	module_call:
-		method = inst->methods[eap_session->type];
-
-		RDEBUG2("Calling submodule %s", method->submodule->name);
-
-		caller = request->module;
-		request->module = method->submodule->name;
-		rcode = eap_session->process(method->submodule_inst, eap_session);
-		request->module = caller;
-
-		switch (rcode) {
-		default:
-			REDEBUG2("Failed in EAP %s (%d) session.  EAP sub-module failed",
-				 eap_type2name(eap_session->type), eap_session->type);
-			break;
-
-		case RLM_MODULE_OK:
-		case RLM_MODULE_NOOP:
-		case RLM_MODULE_UPDATED:
-		case RLM_MODULE_HANDLED:
-			break;
-		}
+		rcode = eap_method_call(inst, eap_session);
 		break;
 	}
 
 	return rcode;
 }
 
-static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+/** Finish processing an EAP round, and freeze the eap_session
+ *
+ * @param inst Configuration data for this instance of rlm_eap.
+ * @param request The current request.
+ * @param eap_session State data that persists over multiple rounds of EAP.
+ * @param rcode returned by the EAP method.
+ * @return a status code.
+ */
+static rlm_rcode_t eap_round_finish(rlm_eap_t *inst, REQUEST *request, eap_session_t *eap_session, rlm_rcode_t rcode)
 {
-	rlm_eap_t		*inst = talloc_get_type_abort(instance, rlm_eap_t);
-	eap_session_t		*eap_session;
-	eap_packet_raw_t	*eap_packet;
-	rlm_rcode_t		rcode;
-
-	if (!fr_pair_find_by_num(request->packet->vps, 0, PW_EAP_MESSAGE, TAG_ANY)) {
-		REDEBUG("You set 'Auth-Type = EAP' for a request that does not contain an EAP-Message attribute!");
-		return RLM_MODULE_INVALID;
-	}
-
-	/*
-	 *	Reconstruct the EAP packet from the EAP-Message
-	 *	attribute.  The relevant decoder should have already
-	 *	concatenated the fragments into a single buffer.
-	 */
-	eap_packet = eap_vp2packet(request, request->packet->vps);
-	if (!eap_packet) {
-		RPERROR("Malformed EAP Message");
-		return RLM_MODULE_FAIL;
-	}
-
-	/*
-	 *	Allocate a new eap_session, or if this request
-	 *	is part of an ongoing authentication session,
-	 *	retrieve the existing eap_session from the request
-	 *	data.
-	 */
-	eap_session = eap_session_continue(&eap_packet, inst, request);
-	if (!eap_session) {
-		REDEBUG("Failed allocating or retrieving EAP session");
-		return RLM_MODULE_INVALID;
-	}
-
-	/*
-	 *	Call an EAP submodule to process the request,
-	 *	or with simple types like Identity and NAK,
-	 *	process it ourselves.
-	 */
-	rcode = eap_method_select(inst, eap_session);
-
 	/*
 	 *	The submodule failed.  Die.
 	 */
@@ -611,6 +623,106 @@ finish:
 	return rcode;
 }
 
+/** Cancel outstanding offload jobs if the request is abandoned
+ *
+ */
+static void mod_authenticate_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				    fr_state_action_t action)
+{
+	eap_session_t *eap_session = talloc_get_type_abort(ctx, eap_session_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	if (eap_session->job) {
+		eap_offload_cancel(request, eap_session->job);
+		eap_session->job = NULL;
+	}
+
+	eap_session_destroy(&eap_session);
+}
+
+/** Continue an EAP round once the method's offload job has completed
+ *
+ * eap_offload_submit() adds the job's pipe with unlang_event_fd_readable_add(),
+ * which needs a module call frame, and we're in a resume frame here.  So the
+ * method doesn't get the offload pool for the rest of the round, and anything
+ * it would offload is run inline.
+ */
+static rlm_rcode_t mod_authenticate_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_eap_t	*inst = talloc_get_type_abort(instance, rlm_eap_t);
+	eap_session_t	*eap_session = talloc_get_type_abort(ctx, eap_session_t);
+	eap_offload_t	*offload = eap_session->offload;
+	rlm_rcode_t	rcode;
+
+	rad_assert(eap_session->request == request);
+
+	eap_session->offload = NULL;
+	rcode = eap_method_call(inst, eap_session);
+	eap_session->offload = offload;
+
+	/*
+	 *	Keeps the resume and action callbacks we
+	 *	were yielded with.
+	 */
+	if (rcode == RLM_MODULE_YIELD) return RLM_MODULE_YIELD;
+
+	return eap_round_finish(inst, request, eap_session, rcode);
+}
+
+static rlm_rcode_t mod_authenticate(void *instance, UNUSED void *thread, REQUEST *request)
+{
+	rlm_eap_t		*inst = talloc_get_type_abort(instance, rlm_eap_t);
+	eap_session_t		*eap_session;
+	eap_packet_raw_t	*eap_packet;
+	rlm_rcode_t		rcode;
+
+	if (!fr_pair_find_by_num(request->packet->vps, 0, PW_EAP_MESSAGE, TAG_ANY)) {
+		REDEBUG("You set 'Auth-Type = EAP' for a request that does not contain an EAP-Message attribute!");
+		return RLM_MODULE_INVALID;
+	}
+
+	/*
+	 *	Reconstruct the EAP packet from the EAP-Message
+	 *	attribute.  The relevant decoder should have already
+	 *	concatenated the fragments into a single buffer.
+	 */
+	eap_packet = eap_vp2packet(request, request->packet->vps);
+	if (!eap_packet) {
+		RPERROR("Malformed EAP Message");
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Allocate a new eap_session, or if this request
+	 *	is part of an ongoing authentication session,
+	 *	retrieve the existing eap_session from the request
+	 *	data.
+	 */
+	eap_session = eap_session_continue(&eap_packet, inst, request);
+	if (!eap_session) {
+		REDEBUG("Failed allocating or retrieving EAP session");
+		return RLM_MODULE_INVALID;
+	}
+
+	/*
+	 *	Call an EAP submodule to process the request,
+	 *	or with simple types like Identity and NAK,
+	 *	process it ourselves.
+	 */
+	rcode = eap_method_select(inst, eap_session);
+
+	/*
+	 *	The submodule handed work off to the offload
+	 *	threads.  We're resumed when it completes.
+	 */
+	if (rcode == RLM_MODULE_YIELD) {
+		return unlang_yield(request, mod_authenticate_resume, mod_authenticate_action, eap_session);
+	}
+
+	return eap_round_finish(inst, request, eap_session, rcode);
+}
+
 /*
  * EAP authorization DEPENDS on other rlm authorizations,
  * to check for user existence & get their configured values.
@@ -935,6 +1047,7 @@ rad_module_t rlm_eap = {
 	.inst_size	= sizeof(rlm_eap_t),
 	.config		= module_config,
 	.bootstrap	= mod_bootstrap,
+	.instantiate	= mod_instantiate,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
@@ -54,6 +54,9 @@ typedef struct rlm_eap {
 
 	rlm_eap_method_t 		*methods[PW_EAP_MAX_TYPES];	//!< Array of loaded (or not), submodules.
 	fr_randctx			rand_pool;			//!< Pool of random data.
+
+	eap_offload_t			*offload;			//!< Threads CPU heavy EAP operations are
+									//!< handed to.  NULL if offloading is disabled.
 } rlm_eap_t;
 
 /*
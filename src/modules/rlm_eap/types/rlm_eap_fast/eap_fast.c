@@ -942,10 +942,10 @@ PW_CODE eap_fast_process(eap_session_t *eap_session, tls_session_t *tls_session)
 
 	/*
 	 * Just look at the buffer directly, without doing
-	 * record_to_buff.
+	 * record_to_buff.  The record is released once the
+	 * data has been decoded.
 	 */
 	data_len = tls_session->clean_out.used;
-	tls_session->clean_out.used = 0;
 	data = tls_session->clean_out.data;
 
 	t = talloc_get_type_abort(tls_session->opaque, eap_fast_tunnel_t);
@@ -953,7 +953,10 @@ PW_CODE eap_fast_process(eap_session_t *eap_session, tls_session_t *tls_session)
 	/*
 	 * See if the tunneled data is well formed.
 	 */
-	if (!eap_fast_verify(request, tls_session, data, data_len)) return PW_CODE_ACCESS_REJECT;
+	if (!eap_fast_verify(request, tls_session, data, data_len)) {
+		tls_session->record_init(&tls_session->clean_out);
+		return PW_CODE_ACCESS_REJECT;
+	}
 
 	if (t->stage == EAP_FAST_TLS_SESSION_HANDSHAKE) {
 		rad_assert(t->mode == EAP_FAST_UNKNOWN);
@@ -983,10 +986,12 @@ PW_CODE eap_fast_process(eap_session_t *eap_session, tls_session_t *tls_session)
 		eap_fast_send_identity_request(request, tls_session, eap_session);
 
 		t->stage = EAP_FAST_AUTHENTICATION;
+		tls_session->record_init(&tls_session->clean_out);
 		return PW_CODE_ACCESS_CHALLENGE;
 	}
 
 	fast_vps = eap_fast_fast2vp(request, tls_session->ssl, data, data_len, NULL, NULL);
+	tls_session->record_init(&tls_session->clean_out);
 
 	RDEBUG("Got Tunneled FAST TLVs");
 	rdebug_pair_list(L_DBG_LVL_1, request, fast_vps, NULL);
@@ -628,9 +628,9 @@ rlm_rcode_t eap_peap_process(eap_session_t *eap_session, tls_session_t *tls_sess
 	/*
 	 *	Just look at the buffer directly, without doing
 	 *	record_to_buff.  This lets us avoid another data copy.
+	 *	The record is released when we're done with the data.
 	 */
 	data_len = tls_session->clean_out.used;
-	tls_session->clean_out.used = 0;
 	data = tls_session->clean_out.data;
 
 	RDEBUG2("PEAP state %s", peap_state(t));
@@ -638,6 +638,7 @@ rlm_rcode_t eap_peap_process(eap_session_t *eap_session, tls_session_t *tls_sess
 	if ((t->status != PEAP_STATUS_TUNNEL_ESTABLISHED) &&
 	    !eap_peap_verify(request, data, data_len)) {
 		REDEBUG("Tunneled data is invalid");
+		tls_session->record_init(&tls_session->clean_out);
 		return RLM_MODULE_REJECT;
 	}
 
@@ -784,6 +785,7 @@ rlm_rcode_t eap_peap_process(eap_session_t *eap_session, tls_session_t *tls_sess
 		RIDEBUG("what went wrong, and how to fix the problem");
 		REXDENT();
 
+		tls_session->record_init(&tls_session->clean_out);
 		return RLM_MODULE_REJECT;
 
 		case PEAP_STATUS_PHASE2_INIT:
@@ -1050,6 +1052,7 @@ rlm_rcode_t eap_peap_process(eap_session_t *eap_session, tls_session_t *tls_sess
 
 finish:
 	talloc_free(fake);
+	tls_session->record_init(&tls_session->clean_out);
 
 	return rcode;
 }
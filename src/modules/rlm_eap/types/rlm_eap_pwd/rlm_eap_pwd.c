@@ -119,7 +119,125 @@ static int send_pwd_request(pwd_session_t *session, eap_round_t *eap_round)
 	return 0;
 }
 
+/** Inputs and outputs of an offloaded password element computation
+ *
+ */
+typedef struct {
+	pwd_session_t	*session;		//!< Scratch session the password element is written to.
+	char		*password;		//!< Copy of the user's password.
+	char		*server_id;		//!< Copy of our identity.
+	char		*peer_id;		//!< Copy of the peer's identity.
+	uint16_t	group_num;		//!< Group we agreed with the peer.
+	uint32_t	token;			//!< Token we sent in the ID request.
+} pwd_pwe_job_t;
+
+static int _free_pwd_session(pwd_session_t *session);
+
+static int _free_pwd_pwe_job(pwd_pwe_job_t *job)
+{
+	memset(job->password, 0, talloc_array_length(job->password));
+
+	return 0;
+}
+
+/** Copy everything compute_password_element needs, so it can run in another thread
+ *
+ * Must not be parented by anything the worker may free, as the job may be
+ * freed by an offload thread.
+ */
+static pwd_pwe_job_t *pwd_pwe_job_alloc(pwd_session_t *session, char const *password, size_t password_len,
+					char const *server_id)
+{
+	pwd_pwe_job_t *job;
+
+	MEM(job = talloc_zero(NULL, pwd_pwe_job_t));
+	MEM(job->session = talloc_zero(job, pwd_session_t));
+	talloc_set_destructor(job->session, _free_pwd_session);
+
+	MEM(job->password = talloc_bstrndup(job, password, password_len));
+	talloc_set_destructor(job, _free_pwd_pwe_job);
+	MEM(job->server_id = talloc_typed_strdup(job, server_id));
+	MEM(job->peer_id = talloc_typed_strdup(job, session->peer_id));
+	job->group_num = session->group_num;
+	job->token = session->token;
+
+	return job;
+}
+
+/** Run by an offload thread
+ *
+ */
+static int pwd_pwe_job_run(void *uctx)
+{
+	pwd_pwe_job_t *job = talloc_get_type_abort(uctx, pwd_pwe_job_t);
+
+	return compute_password_element(job->session, job->group_num,
+					job->password, talloc_array_length(job->password) - 1,
+					job->server_id, talloc_array_length(job->server_id) - 1,
+					job->peer_id, talloc_array_length(job->peer_id) - 1,
+					&job->token);
+}
+
+/** Compute our scalar and element, and send them to the peer in a commit request
+ *
+ */
+static rlm_rcode_t send_pwd_commit(rlm_eap_pwd_t *inst, REQUEST *request, pwd_session_t *session,
+				   eap_round_t *eap_round)
+{
+	BIGNUM		*x = NULL, *y = NULL;
+	uint8_t		*ptr;
+	uint16_t	offset;
+
+	/*
+	 *	Compute our scalar and element
+	 */
+	if (compute_scalar_element(session, inst->bnctx)) {
+		REDEBUG("Failed to compute server's scalar and element");
+		return RLM_MODULE_FAIL;
+	}
+
+	if (((x = BN_new()) == NULL) || ((y = BN_new()) == NULL)) {
+		REDEBUG("Server point allocation failed");
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Element is a point, get both coordinates: x and y
+	 */
+	if (!EC_POINT_get_affine_coordinates_GFp(session->group, session->my_element, x, y, inst->bnctx)) {
+		REDEBUG("Server point assignment failed");
+		BN_clear_free(x);
+		BN_clear_free(y);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Construct request
+	 */
+	session->out_len = BN_num_bytes(session->order) + (2 * BN_num_bytes(session->prime));
+	MEM(session->out = talloc_zero_array(session, uint8_t, session->out_len));
+
+	ptr = session->out;
+	offset = BN_num_bytes(session->prime) - BN_num_bytes(x);
+	BN_bn2bin(x, ptr + offset);
+
+	ptr += BN_num_bytes(session->prime);
+	offset = BN_num_bytes(session->prime) - BN_num_bytes(y);
+	BN_bn2bin(y, ptr + offset);
+
+	ptr += BN_num_bytes(session->prime);
+	offset = BN_num_bytes(session->order) - BN_num_bytes(session->my_scalar);
+	BN_bn2bin(session->my_scalar, ptr + offset);
+
+	BN_clear_free(x);
+	BN_clear_free(y);
+
+	session->state = PWD_STATE_COMMIT;
+	return send_pwd_request(session, eap_round) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+}
+
 static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, eap_session_t *eap_session);
+static rlm_rcode_t CC_HINT(nonnull) mod_process_pwe(void *instance, eap_session_t *eap_session);
 static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 {
 	rlm_eap_pwd_t	*inst = talloc_get_type_abort(instance, rlm_eap_pwd_t);
@@ -135,10 +253,8 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 	eap_round_t	*eap_round;
 	size_t		in_len;
 	rlm_rcode_t	rcode = RLM_MODULE_OK;
-	uint16_t	offset;
 	uint8_t		exch, *in, *ptr, msk[MSK_EMSK_LEN], emsk[MSK_EMSK_LEN];
 	uint8_t		peer_confirm[SHA256_DIGEST_LENGTH];
-	BIGNUM		*x = NULL, *y = NULL;
 
 	if (((eap_round = eap_session->this_round) == NULL) || !inst) return 0;
 
@@ -283,6 +399,25 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 			return RLM_MODULE_REJECT;
 		}
 
+		/*
+		 *	Hunting and pecking is expensive, hand it to
+		 *	the offload threads if we have them.  We're
+		 *	called again (via mod_process_pwe) when it's
+		 *	done.
+		 */
+		if (eap_session->offload) {
+			pwd_pwe_job_t *job;
+
+			job = pwd_pwe_job_alloc(session, vp->vp_strvalue, vp->vp_length, inst->server_id);
+			eap_session->job = eap_offload_submit(eap_session->offload, request, pwd_pwe_job_run, job);
+			if (eap_session->job) {
+				RDEBUG2("Offloading password element computation");
+				eap_session->process = mod_process_pwe;
+				return RLM_MODULE_YIELD;
+			}
+			talloc_free(job);
+		}
+
 		if (compute_password_element(session, session->group_num,
 					     vp->vp_strvalue, vp->vp_length,
 					     inst->server_id, strlen(inst->server_id),
@@ -292,49 +427,7 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 			return RLM_MODULE_FAIL;
 		}
 
-		/*
-		 *	Compute our scalar and element
-		 */
-		if (compute_scalar_element(session, inst->bnctx)) {
-			REDEBUG("Failed to compute server's scalar and element");
-			return RLM_MODULE_FAIL;
-		}
-
-		if (((x = BN_new()) == NULL) || ((y = BN_new()) == NULL)) {
-			REDEBUG("Server point allocation failed");
-			return RLM_MODULE_FAIL;
-		}
-
-		/*
-		 *	Element is a point, get both coordinates: x and y
-		 */
-		if (!EC_POINT_get_affine_coordinates_GFp(session->group, session->my_element, x, y, inst->bnctx)) {
-			REDEBUG("Server point assignment failed");
-			BN_clear_free(x);
-			BN_clear_free(y);
-			return RLM_MODULE_FAIL;
-		}
-
-		/*
-		 *	Construct request
-		 */
-		session->out_len = BN_num_bytes(session->order) + (2 * BN_num_bytes(session->prime));
-		MEM(session->out = talloc_zero_array(session, uint8_t, session->out_len));
-
-		ptr = session->out;
-		offset = BN_num_bytes(session->prime) - BN_num_bytes(x);
-		BN_bn2bin(x, ptr + offset);
-
-		ptr += BN_num_bytes(session->prime);
-		offset = BN_num_bytes(session->prime) - BN_num_bytes(y);
-		BN_bn2bin(y, ptr + offset);
-
-		ptr += BN_num_bytes(session->prime);
-		offset = BN_num_bytes(session->order) - BN_num_bytes(session->my_scalar);
-		BN_bn2bin(session->my_scalar, ptr + offset);
-
-		session->state = PWD_STATE_COMMIT;
-		rcode = send_pwd_request(session, eap_round) < 0 ? RLM_MODULE_FAIL : RLM_MODULE_OK;
+		rcode = send_pwd_commit(inst, request, session, eap_round);
 		break;
 
 	case PWD_STATE_COMMIT:
@@ -421,6 +514,51 @@ static rlm_rcode_t mod_process(void *instance, eap_session_t *eap_session)
 	return rcode;
 }
 
+/** Continue processing the ID response once the password element has been computed
+ *
+ */
+static rlm_rcode_t mod_process_pwe(void *instance, eap_session_t *eap_session)
+{
+	rlm_eap_pwd_t	*inst = talloc_get_type_abort(instance, rlm_eap_pwd_t);
+	REQUEST		*request = eap_session->request;
+	pwd_session_t	*session = talloc_get_type_abort(eap_session->opaque, pwd_session_t);
+	pwd_pwe_job_t	*job;
+	rlm_rcode_t	rcode;
+	int		ret;
+
+	job = eap_offload_result(NULL, &ret, request, eap_session->job);
+	eap_session->job = NULL;
+	eap_session->process = mod_process;
+
+	if (ret < 0) {
+		REDEBUG("Failed to obtain password element");
+		talloc_free(job);
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Move the results into the real session
+	 */
+	session->group = job->session->group;
+	session->pwe = job->session->pwe;
+	session->order = job->session->order;
+	session->prime = job->session->prime;
+	job->session->group = NULL;
+	job->session->pwe = NULL;
+	job->session->order = NULL;
+	job->session->prime = NULL;
+	talloc_free(job);
+
+	rcode = send_pwd_commit(inst, request, session, eap_session->this_round);
+
+	/*
+	 *	We processed the buffered fragments, get rid of them.
+	 */
+	TALLOC_FREE(session->in);
+
+	return rcode;
+}
+
 static int _free_pwd_session(pwd_session_t *session)
 {
 	BN_clear_free(session->private_value);
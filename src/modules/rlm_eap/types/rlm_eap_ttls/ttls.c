@@ -752,10 +752,10 @@ PW_CODE eap_ttls_process(eap_session_t *eap_session, tls_session_t *tls_session)
 
 	/*
 	 *	Just look at the buffer directly, without doing
-	 *	record_to_buff.
+	 *	record_to_buff.  The record is released when we're
+	 *	done with the data.
 	 */
 	data_len = tls_session->clean_out.used;
-	tls_session->clean_out.used = 0;
 	data = tls_session->clean_out.data;
 
 	t = (ttls_tunnel_t *) tls_session->opaque;
@@ -1006,6 +1006,7 @@ PW_CODE eap_ttls_process(eap_session_t *eap_session, tls_session_t *tls_session)
 
 finish:
 	talloc_free(fake);
+	tls_session->record_init(&tls_session->clean_out);
 
 	return code;
 }
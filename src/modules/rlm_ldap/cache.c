@@ -0,0 +1,431 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file cache.c
+ * @brief Cache of group membership results and group DN/name mappings.
+ *
+ * Entries are shared between all worker threads.  The cache is split into
+ * shards, each with its own mutex, so threads looking up different users
+ * rarely contend on the same lock.  All entries for a given user DN live
+ * in the same shard, so they can be flushed together.
+ *
+ * @copyright 2017 The FreeRADIUS Server Project.
+ */
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/heap.h>
+
+#include "rlm_ldap.h"
+
+#define LDAP_CACHE_SHARDS 16		//!< Number of separately locked shards.
+
+typedef struct ldap_cache_entry {
+	rlm_ldap_cache_type_t	type;		//!< What kind of mapping this is.
+	char const		*key;		//!< User DN, group DN or group name.
+	char const		*group;		//!< Group checked, for membership entries.
+	bool			group_is_dn;	//!< Whether group is a DN rather than a name.
+	char const		*value;		//!< Group name or DN, for mapping entries.
+	bool			member;		//!< Whether the user is a member, for membership entries.
+	time_t			expires;	//!< When the entry should be removed.
+	int32_t			heap_id;
+} ldap_cache_entry_t;
+
+typedef struct ldap_cache_shard {
+	pthread_mutex_t		mutex;
+	rbtree_t		*tree;		//!< Entries, ordered by type and key.
+	fr_heap_t		*heap;		//!< Entries, ordered by expiry time.
+
+	uint64_t		hits[LDAP_CACHE_TYPE_MAX];
+	uint64_t		misses[LDAP_CACHE_TYPE_MAX];
+	uint64_t		evictions;	//!< Entries removed before they expired.
+} ldap_cache_shard_t;
+
+struct rlm_ldap_cache {
+	ldap_cache_shard_t	shards[LDAP_CACHE_SHARDS];
+	uint32_t		max_entries;	//!< Maximum number of entries in each shard.
+	uint32_t		ttl;		//!< Lifetime of positive results and mappings.
+	uint32_t		negative_ttl;	//!< Lifetime of "not a member" results.
+};
+
+static char const *ldap_cache_type_names[LDAP_CACHE_TYPE_MAX] = {
+	[LDAP_CACHE_MEMBERSHIP]	= "membership",
+	[LDAP_CACHE_DN2NAME]	= "dn2name",
+	[LDAP_CACHE_NAME2DN]	= "name2dn"
+};
+
+/*
+ *	DNs are compared case insensitively, group names case
+ *	sensitively, the same as rlm_ldap_check_userobj_dynamic() does.
+ */
+static int ldap_cache_entry_cmp(void const *one, void const *two)
+{
+	ldap_cache_entry_t const *a = one;
+	ldap_cache_entry_t const *b = two;
+	int ret;
+
+	if (a->type < b->type) return -1;
+	if (a->type > b->type) return +1;
+
+	ret = (a->type == LDAP_CACHE_NAME2DN) ? strcmp(a->key, b->key) : strcasecmp(a->key, b->key);
+	if (ret != 0) return ret;
+
+	if (a->type != LDAP_CACHE_MEMBERSHIP) return 0;
+
+	if (a->group_is_dn != b->group_is_dn) return a->group_is_dn - b->group_is_dn;
+
+	return a->group_is_dn ? strcasecmp(a->group, b->group) : strcmp(a->group, b->group);
+}
+
+static int ldap_cache_heap_cmp(void const *one, void const *two)
+{
+	ldap_cache_entry_t const *a = one;
+	ldap_cache_entry_t const *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+static int _ldap_cache_free(rlm_ldap_cache_t *cache)
+{
+	int i;
+
+	for (i = 0; i < LDAP_CACHE_SHARDS; i++) {
+		pthread_mutex_destroy(&cache->shards[i].mutex);
+		fr_heap_delete(cache->shards[i].heap);
+	}
+
+	return 0;
+}
+
+/** Allocate a new cache
+ *
+ * @param[in] ctx		to allocate the cache in.
+ * @param[in] max_entries	Maximum number of entries to keep.
+ * @param[in] ttl		How long to keep positive results and mappings.
+ * @param[in] negative_ttl	How long to keep "not a member" results.
+ * @return
+ *	- A new cache.
+ *	- NULL on error.
+ */
+rlm_ldap_cache_t *rlm_ldap_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t ttl, uint32_t negative_ttl)
+{
+	rlm_ldap_cache_t	*cache;
+	int			i;
+
+	cache = talloc_zero(ctx, rlm_ldap_cache_t);
+	if (!cache) return NULL;
+
+	cache->max_entries = (max_entries + LDAP_CACHE_SHARDS - 1) / LDAP_CACHE_SHARDS;
+	cache->ttl = ttl;
+	cache->negative_ttl = negative_ttl;
+
+	for (i = 0; i < LDAP_CACHE_SHARDS; i++) {
+		ldap_cache_shard_t *shard = &cache->shards[i];
+
+		shard->tree = rbtree_create(cache, ldap_cache_entry_cmp, rbtree_node_talloc_free, 0);
+		shard->heap = fr_heap_create(ldap_cache_heap_cmp, offsetof(ldap_cache_entry_t, heap_id));
+		if (!shard->tree || !shard->heap) {
+			fr_heap_delete(shard->heap);
+			while (--i >= 0) {
+				pthread_mutex_destroy(&cache->shards[i].mutex);
+				fr_heap_delete(cache->shards[i].heap);
+			}
+			talloc_free(cache);
+			return NULL;
+		}
+		pthread_mutex_init(&shard->mutex, NULL);
+	}
+	talloc_set_destructor(cache, _ldap_cache_free);
+
+	return cache;
+}
+
+/*
+ *	Keys which are DNs are hashed as lowercase, so that DNs
+ *	which only differ in case end up in the same shard.
+ */
+static inline ldap_cache_shard_t *ldap_cache_shard(rlm_ldap_cache_t *cache, rlm_ldap_cache_type_t type,
+						   char const *key)
+{
+	uint32_t	hash;
+	char const	*p;
+
+	if (type == LDAP_CACHE_NAME2DN) return &cache->shards[fr_hash_string(key) % LDAP_CACHE_SHARDS];
+
+	hash = fr_hash("", 0);
+	for (p = key; *p; p++) {
+		char c = tolower((uint8_t) *p);
+
+		hash = fr_hash_update(&c, 1, hash);
+	}
+
+	return &cache->shards[hash % LDAP_CACHE_SHARDS];
+}
+
+static inline bool ldap_cache_group_is_dn(char const *group)
+{
+	return group && fr_ldap_util_is_dn(group, strlen(group));
+}
+
+/*
+ *	Remove an entry.  Must be called with the shard mutex held.
+ */
+static void ldap_cache_remove(ldap_cache_shard_t *shard, ldap_cache_entry_t *c)
+{
+	fr_heap_extract(shard->heap, c);
+	rbtree_deletebydata(shard->tree, c);	/* Frees c */
+}
+
+/*
+ *	Find an entry which hasn't yet expired, and update the
+ *	hit/miss counters.  Must be called with the shard mutex held.
+ */
+static ldap_cache_entry_t *ldap_cache_find(ldap_cache_shard_t *shard, rlm_ldap_cache_type_t type,
+					   char const *key, char const *group)
+{
+	ldap_cache_entry_t	my_c, *c;
+	time_t			now = time(NULL);
+
+	while ((c = fr_heap_peek(shard->heap)) && (c->expires <= now)) ldap_cache_remove(shard, c);
+
+	my_c.type = type;
+	my_c.key = key;
+	my_c.group = group;
+	my_c.group_is_dn = ldap_cache_group_is_dn(group);
+
+	c = rbtree_finddata(shard->tree, &my_c);
+	if (c) {
+		shard->hits[type]++;
+	} else {
+		shard->misses[type]++;
+	}
+
+	return c;
+}
+
+/*
+ *	Insert an entry, replacing any existing one, and evicting the
+ *	entry closest to expiry if the shard is full.
+ */
+static void ldap_cache_insert(rlm_ldap_cache_t *cache, rlm_ldap_cache_type_t type, char const *key,
+			      char const *group, char const *value, bool member)
+{
+	ldap_cache_shard_t	*shard = ldap_cache_shard(cache, type, key);
+	ldap_cache_entry_t	my_c, *c;
+	uint32_t		ttl;
+
+	ttl = ((type == LDAP_CACHE_MEMBERSHIP) && !member) ? cache->negative_ttl : cache->ttl;
+	if (!ttl) return;
+
+	MEM(c = talloc_zero(NULL, ldap_cache_entry_t));
+	c->type = type;
+	c->key = talloc_typed_strdup(c, key);
+	if (group) c->group = talloc_typed_strdup(c, group);
+	c->group_is_dn = ldap_cache_group_is_dn(group);
+	if (value) c->value = talloc_typed_strdup(c, value);
+	c->member = member;
+	c->expires = time(NULL) + ttl;
+
+	my_c.type = type;
+	my_c.key = key;
+	my_c.group = group;
+	my_c.group_is_dn = c->group_is_dn;
+
+	pthread_mutex_lock(&shard->mutex);
+	{
+		ldap_cache_entry_t *old;
+
+		old = rbtree_finddata(shard->tree, &my_c);
+		if (old) {
+			ldap_cache_remove(shard, old);
+
+		} else if (rbtree_num_elements(shard->tree) >= cache->max_entries) {
+			old = fr_heap_peek(shard->heap);
+			if (old) {
+				if (old->expires > time(NULL)) shard->evictions++;
+				ldap_cache_remove(shard, old);
+			}
+		}
+	}
+
+	if (!rbtree_insert(shard->tree, c)) {
+		talloc_free(c);
+	} else {
+		fr_heap_insert(shard->heap, c);
+	}
+	pthread_mutex_unlock(&shard->mutex);
+}
+
+/** Look up the result of a previous membership check
+ *
+ * @param[in] cache	to search.
+ * @param[in] user_dn	of the user.
+ * @param[in] group	name or DN the user was checked against.
+ * @return
+ *	- 1 if the user is a member of the group.
+ *	- 0 if the user is not a member of the group.
+ *	- -1 if there's no cached result.
+ */
+int rlm_ldap_cache_membership_find(rlm_ldap_cache_t *cache, char const *user_dn, char const *group)
+{
+	ldap_cache_shard_t	*shard = ldap_cache_shard(cache, LDAP_CACHE_MEMBERSHIP, user_dn);
+	ldap_cache_entry_t	*c;
+	int			ret = -1;
+
+	pthread_mutex_lock(&shard->mutex);
+	c = ldap_cache_find(shard, LDAP_CACHE_MEMBERSHIP, user_dn, group);
+	if (c) ret = c->member ? 1 : 0;
+	pthread_mutex_unlock(&shard->mutex);
+
+	return ret;
+}
+
+/** Record the result of a membership check
+ *
+ * @param[in] cache	to add the result to.
+ * @param[in] user_dn	of the user.
+ * @param[in] group	name or DN the user was checked against.
+ * @param[in] member	Whether the user is a member of the group.
+ */
+void rlm_ldap_cache_membership_add(rlm_ldap_cache_t *cache, char const *user_dn, char const *group, bool member)
+{
+	ldap_cache_insert(cache, LDAP_CACHE_MEMBERSHIP, user_dn, group, NULL, member);
+}
+
+/** Look up a group name from its DN, or a group DN from its name
+ *
+ * @param[in] ctx	to allocate the result in.
+ * @param[in] cache	to search.
+ * @param[in] type	LDAP_CACHE_DN2NAME or LDAP_CACHE_NAME2DN.
+ * @param[in] key	group DN or name to look up.
+ * @return
+ *	- A copy of the group name or DN.
+ *	- NULL if there's no cached mapping.
+ */
+char *rlm_ldap_cache_group_find(TALLOC_CTX *ctx, rlm_ldap_cache_t *cache, rlm_ldap_cache_type_t type,
+				char const *key)
+{
+	ldap_cache_shard_t	*shard = ldap_cache_shard(cache, type, key);
+	ldap_cache_entry_t	*c;
+	char			*out = NULL;
+
+	rad_assert(type != LDAP_CACHE_MEMBERSHIP);
+
+	pthread_mutex_lock(&shard->mutex);
+	c = ldap_cache_find(shard, type, key, NULL);
+	if (c) MEM(out = talloc_typed_strdup(ctx, c->value));
+	pthread_mutex_unlock(&shard->mutex);
+
+	return out;
+}
+
+/** Record the name of a group, and the DN of the group
+ *
+ * Both directions of the mapping are added.
+ *
+ * @param[in] cache	to add the mapping to.
+ * @param[in] dn	of the group.
+ * @param[in] name	of the group.
+ */
+void rlm_ldap_cache_group_add(rlm_ldap_cache_t *cache, char const *dn, char const *name)
+{
+	ldap_cache_insert(cache, LDAP_CACHE_DN2NAME, dn, NULL, name, true);
+	ldap_cache_insert(cache, LDAP_CACHE_NAME2DN, name, NULL, dn, true);
+}
+
+typedef struct {
+	ldap_cache_shard_t	*shard;
+	char const		*user_dn;
+	uint32_t		count;
+} ldap_cache_flush_t;
+
+static int _ldap_cache_flush_walk(void *ctx, void *data)
+{
+	ldap_cache_flush_t	*flush = ctx;
+	ldap_cache_entry_t	*c = data;
+
+	if (flush->user_dn &&
+	    ((c->type != LDAP_CACHE_MEMBERSHIP) || (strcasecmp(c->key, flush->user_dn) != 0))) return 0;
+
+	fr_heap_extract(flush->shard->heap, c);
+	flush->count++;
+
+	return 2;	/* Delete and continue */
+}
+
+/** Remove entries from the cache
+ *
+ * @param[in] cache	to flush.
+ * @param[in] user_dn	Only remove membership results for this user.
+ *			If NULL, all entries are removed.
+ * @return the number of entries removed.
+ */
+uint32_t rlm_ldap_cache_flush(rlm_ldap_cache_t *cache, char const *user_dn)
+{
+	ldap_cache_flush_t	flush = { .user_dn = user_dn };
+	int			i;
+
+	for (i = 0; i < LDAP_CACHE_SHARDS; i++) {
+		if (user_dn && (&cache->shards[i] != ldap_cache_shard(cache, LDAP_CACHE_MEMBERSHIP, user_dn))) continue;
+
+		flush.shard = &cache->shards[i];
+
+		pthread_mutex_lock(&flush.shard->mutex);
+		rbtree_walk(flush.shard->tree, RBTREE_DELETE_ORDER, _ldap_cache_flush_walk, &flush);
+		pthread_mutex_unlock(&flush.shard->mutex);
+	}
+
+	return flush.count;
+}
+
+/** Print cache statistics
+ *
+ * @param[in] ctx	to allocate the output in.
+ * @param[in] cache	to print statistics for.
+ * @return a string containing one "name value" pair per line.
+ */
+char *rlm_ldap_cache_stats(TALLOC_CTX *ctx, rlm_ldap_cache_t *cache)
+{
+	uint64_t	hits[LDAP_CACHE_TYPE_MAX] = { 0 }, misses[LDAP_CACHE_TYPE_MAX] = { 0 };
+	uint64_t	evictions = 0, entries = 0;
+	char		*out;
+	int		i, j;
+
+	for (i = 0; i < LDAP_CACHE_SHARDS; i++) {
+		ldap_cache_shard_t *shard = &cache->shards[i];
+
+		pthread_mutex_lock(&shard->mutex);
+		for (j = 0; j < LDAP_CACHE_TYPE_MAX; j++) {
+			hits[j] += shard->hits[j];
+			misses[j] += shard->misses[j];
+		}
+		evictions += shard->evictions;
+		entries += rbtree_num_elements(shard->tree);
+		pthread_mutex_unlock(&shard->mutex);
+	}
+
+	out = talloc_asprintf(ctx, "entries\t%" PRIu64 "\nevictions\t%" PRIu64 "\n", entries, evictions);
+	for (j = 0; j < LDAP_CACHE_TYPE_MAX; j++) {
+		out = talloc_asprintf_append_buffer(out, "%s_hits\t%" PRIu64 "\n%s_misses\t%" PRIu64 "\n",
+						    ldap_cache_type_names[j], hits[j],
+						    ldap_cache_type_names[j], misses[j]);
+	}
+
+	return out;
+}
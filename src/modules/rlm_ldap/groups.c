@@ -37,12 +37,15 @@
  * Given an array of group names, builds a filter matching all names, then retrieves all group objects
  * and stores the DN associated with each group object.
  *
+ * Names found in the group cache are not included in the filter.
+ *
  * @param[in] inst rlm_ldap configuration.
  * @param[in] request Current request.
  * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
  * @param[in] names to convert to DNs (NULL terminated).
- * @param[out] out Where to write the DNs. DNs must be freed with ldap_memfree(). Will be NULL terminated.
- * @param[in] outlen Size of out.
+ * @param[out] out Where to write the DNs. DNs are allocated in the request, and should be freed with
+ *	talloc_free(). Will be NULL terminated.
+ * @param[in] outlen Number of elements in out.
  * @return One of the RLM_MODULE_* values.
  */
 static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
@@ -54,7 +57,7 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 
 	unsigned int name_cnt = 0;
 	unsigned int entry_cnt;
-	char const *attrs[] = { NULL };
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
 	LDAPMessage *result = NULL, *entry;
 
@@ -64,7 +67,7 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 	char buffer[LDAP_MAX_GROUP_NAME_LEN + 1];
 
-	char *filter;
+	char *filter = NULL, *names_filter;
 
 	*dn = NULL;
 
@@ -82,25 +85,39 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	 *	It'll probably only save a few ms in network latency, but it means we can send a query
 	 *	for the entire group list at once.
 	 */
-	filter = talloc_typed_asprintf(request, "%s%s%s",
-				 inst->groupobj_filter ? "(&" : "",
-				 inst->groupobj_filter ? inst->groupobj_filter : "",
-				 names[0] && names[1] ? "(|" : "");
+	names_filter = talloc_typed_strdup(request, "");
 	while (*name) {
+		if (inst->group_cache && ((size_t)(dn - out) < (outlen - 1))) {
+			*dn = rlm_ldap_cache_group_find(request, inst->group_cache, LDAP_CACHE_NAME2DN, *name);
+			if (*dn) {
+				RDEBUG("Group name \"%s\" resolves to DN \"%s\" (cached)", *name, *dn);
+				*++dn = NULL;
+				name++;
+				continue;
+			}
+		}
+
 		fr_ldap_escape_func(request, buffer, sizeof(buffer), *name++, NULL);
-		filter = talloc_asprintf_append_buffer(filter, "(%s=%s)", inst->groupobj_name_attr, buffer);
+		names_filter = talloc_asprintf_append_buffer(names_filter, "(%s=%s)", inst->groupobj_name_attr, buffer);
 
 		name_cnt++;
 	}
-	filter = talloc_asprintf_append_buffer(filter, "%s%s",
-					       inst->groupobj_filter ? ")" : "",
-					       names[0] && names[1] ? ")" : "");
+	if (!name_cnt) goto finish;
+
+	filter = talloc_typed_asprintf(request, "%s%s%s%s%s%s",
+				       inst->groupobj_filter ? "(&" : "",
+				       inst->groupobj_filter ? inst->groupobj_filter : "",
+				       name_cnt > 1 ? "(|" : "",
+				       names_filter,
+				       name_cnt > 1 ? ")" : "",
+				       inst->groupobj_filter ? ")" : "");
 
 	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
 			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
 		REDEBUG("Failed creating base_dn");
 
-		return RLM_MODULE_INVALID;
+		rcode = RLM_MODULE_INVALID;
+		goto finish;
 	}
 
 	status = fr_ldap_search(&result, request, pconn, base_dn, inst->groupobj_scope,
@@ -126,7 +143,7 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 		goto finish;
 	}
 
-	if (entry_cnt > (outlen - 1)) {
+	if (entry_cnt > (outlen - 1 - (dn - out))) {
 		REDEBUG("Number of DNs exceeds limit (%zu)", outlen - 1);
 		rcode = RLM_MODULE_INVALID;
 
@@ -148,23 +165,41 @@ static rlm_rcode_t rlm_ldap_group_name2dn(rlm_ldap_t const *inst, REQUEST *reque
 	}
 
 	do {
-		*dn = ldap_get_dn((*pconn)->handle, entry);
-		if (!*dn) {
+		char *entry_dn;
+
+		entry_dn = ldap_get_dn((*pconn)->handle, entry);
+		if (!entry_dn) {
 			ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 			REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
-		fr_ldap_util_normalise_dn(*dn, *dn);
+		fr_ldap_util_normalise_dn(entry_dn, entry_dn);
+		MEM(*dn = talloc_typed_strdup(request, entry_dn));
+		ldap_memfree(entry_dn);
 
 		RDEBUG("Got group DN \"%s\"", *dn);
-		dn++;
-	} while((entry = ldap_next_entry((*pconn)->handle, entry)));
 
-	*dn = NULL;
+		if (inst->group_cache) {
+			struct berval **values;
+
+			values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+			if (values) {
+				char *entry_name;
+
+				entry_name = fr_ldap_berval_to_string(request, values[0]);
+				rlm_ldap_cache_group_add(inst->group_cache, *dn, entry_name);
+				talloc_free(entry_name);
+				ldap_value_free_len(values);
+			}
+		}
+
+		*++dn = NULL;
+	} while((entry = ldap_next_entry((*pconn)->handle, entry)));
 
 finish:
+	talloc_free(names_filter);
 	talloc_free(filter);
 	if (result) ldap_msgfree(result);
 
@@ -172,9 +207,8 @@ finish:
 	 *	Be nice and cleanup the output array if we error out.
 	 */
 	if (rcode != RLM_MODULE_OK) {
-		dn = out;
-		while(*dn) ldap_memfree(*dn++);
-		*dn = NULL;
+		for (dn = out; *dn; dn++) TALLOC_FREE(*dn);
+		*out = NULL;
 	}
 
 	return rcode;
@@ -211,6 +245,14 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 		return RLM_MODULE_INVALID;
 	}
 
+	if (inst->group_cache) {
+		*out = rlm_ldap_cache_group_find(request, inst->group_cache, LDAP_CACHE_DN2NAME, dn);
+		if (*out) {
+			RDEBUG("Group DN \"%s\" resolves to name \"%s\" (cached)", dn, *out);
+			return RLM_MODULE_OK;
+		}
+	}
+
 	RDEBUG("Resolving group DN \"%s\" to group name", dn);
 
 	status = fr_ldap_search(&result, request, pconn, dn, LDAP_SCOPE_BASE, NULL, attrs, NULL, NULL);
@@ -247,6 +289,8 @@ static rlm_rcode_t rlm_ldap_group_dn2name(rlm_ldap_t const *inst, REQUEST *reque
 	*out = fr_ldap_berval_to_string(request, values[0]);
 	RDEBUG("Group DN \"%s\" resolves to name \"%s\"", dn, *out);
 
+	if (inst->group_cache) rlm_ldap_cache_group_add(inst->group_cache, dn, *out);
+
 finish:
 	if (result) ldap_msgfree(result);
 	if (values) ldap_value_free_len(values);
@@ -370,7 +414,8 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 	}
 	*name_p = NULL;
 
-	rcode = rlm_ldap_group_name2dn(inst, request, pconn, group_name, group_dn, sizeof(group_dn));
+	rcode = rlm_ldap_group_name2dn(inst, request, pconn, group_name, group_dn,
+				       sizeof(group_dn) / sizeof(*group_dn));
 
 	ldap_value_free_len(values);
 	talloc_free(value_ctx);
@@ -397,13 +442,45 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 		fr_pair_cursor_append(&list_cursor, vp);
 
 		RDEBUG("&control:%s += \"%s\"", inst->cache_da->name, vp->vp_strvalue);
-		ldap_memfree(*dn_p);
+		talloc_free(*dn_p);
 	}
 	REXDENT();
 
 	return rcode;
 }
 
+/** Expand the filter and base DN used to search for group objects the user is a member of
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] filter Buffer of LDAP_MAX_FILTER_STR_LEN + 1 bytes to write the filter to.
+ * @param[out] base_dn Where to write the expanded base DN.
+ * @param[in] base_dn_buff Buffer of LDAP_MAX_DN_STR_LEN bytes to expand the base DN in.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_groupobj_expand(rlm_ldap_t const *inst, REQUEST *request, char *filter,
+				    char const **base_dn, char *base_dn_buff)
+{
+	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
+
+	if (fr_ldap_xlat_filter(request,
+				 filters, sizeof(filters) / sizeof(*filters),
+				 filter, LDAP_MAX_FILTER_STR_LEN + 1) < 0) {
+		return -1;
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Failed creating base_dn");
+
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Convert group membership information into attributes
  *
  * @param[in] inst rlm_ldap configuration.
@@ -413,24 +490,18 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
  */
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn)
 {
-	rlm_rcode_t rcode = RLM_MODULE_OK;
+	rlm_rcode_t rcode;
 	fr_ldap_rcode_t status;
-	int ldap_errno;
 
 	LDAPMessage *result = NULL;
-	LDAPMessage *entry;
 
 	char const *base_dn;
 	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
 
-	char const *filters[] = { inst->groupobj_filter, inst->groupobj_membership_filter };
 	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
 
 	char const *attrs[] = { inst->groupobj_name_attr, NULL };
 
-	VALUE_PAIR *vp;
-	char *dn;
-
 	rad_assert(inst->groupobj_base_dn);
 
 	if (!inst->groupobj_membership_filter) {
@@ -439,51 +510,108 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		return RLM_MODULE_OK;
 	}
 
-	if (fr_ldap_xlat_filter(request,
-				 filters, sizeof(filters) / sizeof(*filters),
-				 filter, sizeof(filter)) < 0) {
-		return RLM_MODULE_INVALID;
-	}
+	if (rlm_ldap_groupobj_expand(inst, request, filter, &base_dn, base_dn_buff) < 0) return RLM_MODULE_INVALID;
 
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->groupobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Failed creating base_dn");
+	status = fr_ldap_search(&result, request, pconn, base_dn,
+				inst->groupobj_scope, filter, attrs, NULL, NULL);
 
-		return RLM_MODULE_INVALID;
+	rcode = rlm_ldap_cacheable_groupobj_result(inst, request, *pconn, status, result);
+	if (result) ldap_msgfree(result);
+
+	return rcode;
+}
+
+/** Send the search for group objects the user is a member of, without waiting for the result
+ *
+ * When the result arrives, it should be passed to #rlm_ldap_cacheable_groupobj_result.
+ *
+ * @param[out] out Where to write the query.  Will be NULL if there's nothing to search for.
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] async connection to send the search on.
+ * @param[in] callback to run when the result arrives.
+ * @param[in] uctx passed to callback.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj_async(fr_ldap_query_t **out, TALLOC_CTX *ctx,
+					      rlm_ldap_t const *inst, REQUEST *request, fr_ldap_async_t *async,
+					      fr_ldap_query_cb_t callback, void *uctx)
+{
+	char const *base_dn;
+	char base_dn_buff[LDAP_MAX_DN_STR_LEN];
+
+	char filter[LDAP_MAX_FILTER_STR_LEN + 1];
+
+	char const *attrs[] = { inst->groupobj_name_attr, NULL };
+
+	rad_assert(inst->groupobj_base_dn);
+
+	*out = NULL;
+
+	if (!inst->groupobj_membership_filter) {
+		RDEBUG2("Skipping caching group objects as directive 'group.membership_filter' is not set");
+
+		return RLM_MODULE_OK;
 	}
 
-	status = fr_ldap_search(&result, request, pconn, base_dn,
-				inst->groupobj_scope, filter, attrs, NULL, NULL);
+	if (rlm_ldap_groupobj_expand(inst, request, filter, &base_dn, base_dn_buff) < 0) return RLM_MODULE_INVALID;
+
+	if (fr_ldap_async_search(out, ctx, request, async, base_dn, inst->groupobj_scope, filter, attrs,
+				 NULL, NULL, callback, uctx) != LDAP_PROC_SUCCESS) return RLM_MODULE_FAIL;
+
+	return RLM_MODULE_OK;
+}
+
+/** Add attributes for the group objects returned by a search
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.  Only used to parse the result.
+ * @param[in] status of the search.
+ * @param[in] result of the search.  Not freed.
+ * @return One of the RLM_MODULE_* values.
+ */
+rlm_rcode_t rlm_ldap_cacheable_groupobj_result(rlm_ldap_t const *inst, REQUEST *request,
+					       fr_ldap_conn_t const *conn,
+					       fr_ldap_rcode_t status, LDAPMessage *result)
+{
+	int ldap_errno;
+
+	LDAPMessage *entry;
+
+	VALUE_PAIR *vp;
+	char *dn;
+
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
 		break;
 
 	case LDAP_PROC_NO_RESULT:
 		RDEBUG2("No cacheable group memberships found in group objects");
-		goto finish;
+		return RLM_MODULE_OK;
 
 	default:
-		rcode = RLM_MODULE_FAIL;
-		goto finish;
+		return RLM_MODULE_FAIL;
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, result);
+	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
 
-		goto finish;
+		return RLM_MODULE_OK;
 	}
 
 	RDEBUG("Adding cacheable group object memberships");
 	do {
 		if (inst->cacheable_group_dn) {
-			dn = ldap_get_dn((*pconn)->handle, entry);
+			dn = ldap_get_dn(conn->handle, entry);
 			if (!dn) {
-				ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+				ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 				REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
-				goto finish;
+				return RLM_MODULE_OK;
 			}
 			fr_ldap_util_normalise_dn(dn, dn);
 
@@ -499,7 +627,7 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 		if (inst->cacheable_group_name) {
 			struct berval **values;
 
-			values = ldap_get_values_len((*pconn)->handle, entry, inst->groupobj_name_attr);
+			values = ldap_get_values_len(conn->handle, entry, inst->groupobj_name_attr);
 			if (!values) continue;
 
 			MEM(vp = pair_make_config(inst->cache_da->name, NULL, T_OP_ADD));
@@ -512,12 +640,9 @@ rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request
 
 			ldap_value_free_len(values);
 		}
-	} while ((entry = ldap_next_entry((*pconn)->handle, entry)));
+	} while ((entry = ldap_next_entry(conn->handle, entry)));
 
-finish:
-	if (result) ldap_msgfree(result);
-
-	return rcode;
+	return RLM_MODULE_OK;
 }
 
 /** Query the LDAP directory to check if a group object includes a user object as a member
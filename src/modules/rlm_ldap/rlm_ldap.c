@@ -102,6 +102,13 @@ static CONF_PARSER user_config[] = {
 /*
  *	Group configuration
  */
+static CONF_PARSER group_cache_config[] = {
+	{ FR_CONF_OFFSET("size", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("ttl", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_ttl), .dflt = "300" },
+	{ FR_CONF_OFFSET("negative_ttl", PW_TYPE_INTEGER, rlm_ldap_t, group_cache_negative_ttl), .dflt = "60" },
+	CONF_PARSER_TERMINATOR
+};
+
 static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("filter", PW_TYPE_STRING, rlm_ldap_t, groupobj_filter) },
 	{ FR_CONF_OFFSET("scope", PW_TYPE_STRING, rlm_ldap_t, groupobj_scope_str), .dflt = "sub" },
@@ -114,6 +121,7 @@ static CONF_PARSER group_config[] = {
 	{ FR_CONF_OFFSET("cacheable_dn", PW_TYPE_BOOLEAN, rlm_ldap_t, cacheable_group_dn), .dflt = "no" },
 	{ FR_CONF_OFFSET("cache_attribute", PW_TYPE_STRING, rlm_ldap_t, cache_attribute) },
 	{ FR_CONF_OFFSET("group_attribute", PW_TYPE_STRING, rlm_ldap_t, group_attribute) },
+	{ FR_CONF_POINTER("cache", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) group_cache_config },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -173,6 +181,9 @@ static CONF_PARSER option_config[] = {
 	/* timeout for search results */
 	{ FR_CONF_OFFSET("res_timeout", PW_TYPE_TIMEVAL, rlm_ldap_t, handle_config.res_timeout), .dflt = "20" },
 
+	/* yield while waiting for search results in authorize */
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_ldap_t, async), .dflt = "no" },
+
 	CONF_PARSER_TERMINATOR
 };
 
@@ -531,6 +542,36 @@ free_urlstr:
 	return rcode;
 }
 
+/** Look for the result of a previous membership check in the group cache
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] user_dn of the user.
+ * @param[in] check vp containing the group value (name or dn).
+ * @param[out] found Whether the user is a member of the group.
+ * @return
+ *	- true if a result was found.
+ *	- false if there's no cached result.
+ */
+static bool rlm_ldap_groupcmp_cached(rlm_ldap_t const *inst, REQUEST *request, char const *user_dn,
+				     VALUE_PAIR *check, bool *found)
+{
+	switch (rlm_ldap_cache_membership_find(inst->group_cache, user_dn, check->vp_strvalue)) {
+	case 1:
+		RDEBUG("User is a member of \"%s\" (cached)", check->vp_strvalue);
+		*found = true;
+		return true;
+
+	case 0:
+		RDEBUG("User is not a member of \"%s\" (cached)", check->vp_strvalue);
+		*found = false;
+		return true;
+
+	default:
+		return false;
+	}
+}
+
 /** Perform LDAP-Group comparison checking
  *
  * Attempts to match users to groups using a variety of methods.
@@ -556,6 +597,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	fr_ldap_conn_t		*conn = NULL;
 	char const		*user_dn;
+	VALUE_PAIR		*vp;
 
 	rad_assert(inst->groupobj_base_dn);
 
@@ -596,6 +638,15 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 		}
 	}
 
+	/*
+	 *	If we already know the user's DN, we may not need a
+	 *	connection at all.
+	 */
+	if (inst->group_cache) {
+		vp = fr_pair_find_by_num(request->control, 0, PW_LDAP_USERDN, TAG_ANY);
+		if (vp && rlm_ldap_groupcmp_cached(inst, request, vp->vp_strvalue, check, &found)) goto finish;
+	}
+
 	conn = mod_conn_get(inst, request);
 	if (!conn) return 1;
 
@@ -610,6 +661,8 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	rad_assert(conn);
 
+	if (inst->group_cache && rlm_ldap_groupcmp_cached(inst, request, user_dn, check, &found)) goto finish;
+
 	/*
 	 *	Check groupobj user membership
 	 */
@@ -620,6 +673,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			goto cache;
 
 		default:
 			goto finish;
@@ -638,6 +692,7 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 		case RLM_MODULE_OK:
 			found = true;
+			break;
 
 		default:
 			goto finish;
@@ -646,6 +701,13 @@ static int rlm_ldap_groupcmp(void *instance, REQUEST *request, UNUSED VALUE_PAIR
 
 	rad_assert(conn);
 
+cache:
+	/*
+	 *	Only definitive answers are cached, failures
+	 *	always result in the directory being asked again.
+	 */
+	if (inst->group_cache) rlm_ldap_cache_membership_add(inst->group_cache, user_dn, check->vp_strvalue, found);
+
 finish:
 	if (conn) mod_conn_release(inst, request, conn);
 
@@ -862,93 +924,89 @@ free_result:
 	return rcode;
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+/** Add the attributes we need for checking access, memberships and profiles to the list we retrieve
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in,out] expanded attributes from the user map.
+ */
+static void authorize_attrs(rlm_ldap_t const *inst, fr_ldap_map_exp_t *expanded)
 {
-	rlm_rcode_t		rcode = RLM_MODULE_OK;
-	fr_ldap_rcode_t		status;
-	int			ldap_errno;
-	int			i;
-	rlm_ldap_t const	*inst = instance;
-	struct berval		**values;
-	VALUE_PAIR		*vp;
-	fr_ldap_conn_t		*conn;
-	LDAPMessage		*result, *entry;
-	char const 		*dn = NULL;
-	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
-
-	/*
-	 *	Don't be tempted to add a check for request->username
-	 *	or request->password here. rlm_ldap.authorize can be used for
-	 *	many things besides searching for users.
-	 */
-
-	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
-
-	conn = mod_conn_get(inst, request);
-	if (!conn) return RLM_MODULE_FAIL;
-
-	/*
-	 *	Add any additional attributes we need for checking access, memberships, and profiles
-	 */
 	if (inst->userobj_access_attr) {
-		expanded.attrs[expanded.count++] = inst->userobj_access_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_access_attr;
 	}
 
 	if (inst->userobj_membership_attr && (inst->cacheable_group_dn || inst->cacheable_group_name)) {
-		expanded.attrs[expanded.count++] = inst->userobj_membership_attr;
+		expanded->attrs[expanded->count++] = inst->userobj_membership_attr;
 	}
 
 	if (inst->profile_attr) {
-		expanded.attrs[expanded.count++] = inst->profile_attr;
+		expanded->attrs[expanded->count++] = inst->profile_attr;
 	}
 
 	if (inst->valuepair_attr) {
-		expanded.attrs[expanded.count++] = inst->valuepair_attr;
-	}
-
-	expanded.attrs[expanded.count] = NULL;
-
-	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
-	if (!dn) {
-		goto finish;
+		expanded->attrs[expanded->count++] = inst->valuepair_attr;
 	}
 
-	entry = ldap_first_entry(conn->handle, result);
-	if (!entry) {
-		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
-		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+	expanded->attrs[expanded->count] = NULL;
+}
 
-		goto finish;
-	}
+/** Check for access, and cache the group memberships held in the user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] entry the user object.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t authorize_userobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
+				     LDAPMessage *entry)
+{
+	rlm_rcode_t rcode;
 
 	/*
 	 *	Check for access.
 	 */
 	if (inst->userobj_access_attr) {
-		rcode = rlm_ldap_check_access(inst, request, conn, entry);
-		if (rcode != RLM_MODULE_OK) {
-			goto finish;
-		}
+		rcode = rlm_ldap_check_access(inst, request, *pconn, entry);
+		if (rcode != RLM_MODULE_OK) return rcode;
 	}
 
 	/*
 	 *	Check if we need to cache group memberships
 	 */
-	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
-		if (inst->userobj_membership_attr) {
-			rcode = rlm_ldap_cacheable_userobj(inst, request, &conn, entry, inst->userobj_membership_attr);
-			if (rcode != RLM_MODULE_OK) {
-				goto finish;
-			}
-		}
-
-		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
-		if (rcode != RLM_MODULE_OK) {
-			goto finish;
-		}
+	if ((inst->cacheable_group_dn || inst->cacheable_group_name) && inst->userobj_membership_attr) {
+		return rlm_ldap_cacheable_userobj(inst, request, pconn, entry, inst->userobj_membership_attr);
 	}
 
+	return RLM_MODULE_OK;
+}
+
+/** Retrieve the eDirectory password, apply profiles, and map attributes from the user object
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in,out] pconn to use. May change as this function calls functions which auto re-connect.
+ * @param[in] dn of the user object.
+ * @param[in] entry the user object.
+ * @param[in] expanded attributes from the user map.
+ * @return One of the RLM_MODULE_* values.
+ */
+static rlm_rcode_t authorize_finish(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
+#ifdef WITH_EDIR
+				    char const *dn,
+#else
+				    UNUSED char const *dn,
+#endif
+				    LDAPMessage *entry, fr_ldap_map_exp_t *expanded)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+#ifdef WITH_EDIR
+	fr_ldap_rcode_t		status;
+	VALUE_PAIR		*vp;
+#endif
+	int			i;
+	struct berval		**values;
+
 #ifdef WITH_EDIR
 	/*
 	 *	We already have a Cleartext-Password.  Skip edir.
@@ -968,12 +1026,10 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 		/*
 		 *	Retrive universal password
 		 */
-		res = fr_ldap_edir_get_password(conn->handle, dn, password, &pass_size);
+		res = fr_ldap_edir_get_password((*pconn)->handle, dn, password, &pass_size);
 		if (res != 0) {
 			REDEBUG("Failed to retrieve eDirectory password: (%i) %s", res, fr_ldap_edir_errstr(res));
-			rcode = RLM_MODULE_FAIL;
-
-			goto finish;
+			return RLM_MODULE_FAIL;
 		}
 
 		/*
@@ -994,8 +1050,8 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 			/*
 			 *	Bind as the user
 			 */
-			conn->rebound = true;
-			status = fr_ldap_bind(request, &conn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
+			(*pconn)->rebound = true;
+			status = fr_ldap_bind(request, pconn, dn, vp->vp_strvalue, NULL, NULL, NULL, NULL);
 			switch (status) {
 			case LDAP_PROC_SUCCESS:
 				rcode = RLM_MODULE_OK;
@@ -1003,24 +1059,19 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 				break;
 
 			case LDAP_PROC_NOT_PERMITTED:
-				rcode = RLM_MODULE_USERLOCK;
-				goto finish;
+				return RLM_MODULE_USERLOCK;
 
 			case LDAP_PROC_REJECT:
-				rcode = RLM_MODULE_REJECT;
-				goto finish;
+				return RLM_MODULE_REJECT;
 
 			case LDAP_PROC_BAD_DN:
-				rcode = RLM_MODULE_INVALID;
-				goto finish;
+				return RLM_MODULE_INVALID;
 
 			case LDAP_PROC_NO_RESULT:
-				rcode = RLM_MODULE_NOTFOUND;
-				goto finish;
+				return RLM_MODULE_NOTFOUND;
 
 			default:
-				rcode = RLM_MODULE_FAIL;
-				goto finish;
+				return RLM_MODULE_FAIL;
 			};
 		}
 	}
@@ -1039,18 +1090,15 @@ skip_edir:
 				request, inst->default_profile, NULL, NULL) < 0) {
 			REDEBUG("Failed creating default profile string");
 
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 		}
 
-		switch (rlm_ldap_map_profile(inst, request, &conn, profile, &expanded)) {
+		switch (rlm_ldap_map_profile(inst, request, pconn, profile, expanded)) {
 		case RLM_MODULE_INVALID:
-			rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return RLM_MODULE_INVALID;
 
 		case RLM_MODULE_FAIL:
-			rcode = RLM_MODULE_FAIL;
-			goto finish;
+			return RLM_MODULE_FAIL;
 
 		case RLM_MODULE_UPDATED:
 			rcode = RLM_MODULE_UPDATED;
@@ -1064,19 +1112,18 @@ skip_edir:
 	 *	Apply a SET of user profiles.
 	 */
 	if (inst->profile_attr) {
-		values = ldap_get_values_len(conn->handle, entry, inst->profile_attr);
+		values = ldap_get_values_len((*pconn)->handle, entry, inst->profile_attr);
 		if (values != NULL) {
 			for (i = 0; values[i] != NULL; i++) {
 				rlm_rcode_t ret;
 				char *value;
 
 				value = fr_ldap_berval_to_string(request, values[i]);
-				ret = rlm_ldap_map_profile(inst, request, &conn, value, &expanded);
+				ret = rlm_ldap_map_profile(inst, request, pconn, value, expanded);
 				talloc_free(value);
 				if (ret == RLM_MODULE_FAIL) {
 					ldap_value_free_len(values);
-					rcode = ret;
-					goto finish;
+					return ret;
 				}
 
 			}
@@ -1087,12 +1134,268 @@ skip_edir:
 	if (inst->user_map || inst->valuepair_attr) {
 		RDEBUG("Processing user attributes");
 		RINDENT();
-		if (fr_ldap_map_do(request, conn, inst->valuepair_attr,
-				   &expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
+		if (fr_ldap_map_do(request, *pconn, inst->valuepair_attr,
+				   expanded, entry) > 0) rcode = RLM_MODULE_UPDATED;
 		REXDENT();
-		rlm_ldap_check_reply(inst, request, conn);
+		rlm_ldap_check_reply(inst, request, *pconn);
+	}
+
+
+	return rcode;
+}
+
+/** State of an authorize call, which is waiting for search results
+ *
+ */
+typedef enum {
+	LDAP_AUTZ_FIND_USER = 0,			//!< Waiting for the user object.
+	LDAP_AUTZ_GROUPOBJ				//!< Waiting for the group objects the user is a member of.
+} ldap_autz_stage_t;
+
+typedef struct {
+	ldap_autz_stage_t	stage;			//!< What we're waiting for.
+	fr_ldap_query_t		*query;			//!< The search we're waiting for.  NULL if it timed out.
+	fr_ldap_query_t		*user;			//!< Completed search for the user object.
+	char const		*dn;			//!< Of the user object.
+	fr_ldap_map_exp_t	expanded;		//!< Attributes to retrieve from the user object.
+	bool			done;			//!< The search completed, and we're waiting to be resumed.
+	bool			timed_out;		//!< The timer fired, so it must not be deleted.
+} ldap_autz_ctx_t;
+
+static int _autz_ctx_free(ldap_autz_ctx_t *autz)
+{
+	talloc_free(autz->expanded.ctx);
+
+	return 0;
+}
+
+static void _autz_query_done(fr_ldap_query_t *query, void *uctx)
+{
+	ldap_autz_ctx_t *autz = talloc_get_type_abort(uctx, ldap_autz_ctx_t);
+
+	autz->done = true;
+	unlang_resumable(query->request);
+}
+
+/*
+ *	One timer covers all of the searches for a request.  It can't
+ *	be re-armed from mod_authorize_resume(), as
+ *	unlang_event_timeout_add() needs a module call frame.
+ */
+static void mod_authorize_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				  UNUSED struct timeval *fired)
+{
+	ldap_autz_ctx_t *autz = talloc_get_type_abort(ctx, ldap_autz_ctx_t);
+
+	autz->timed_out = true;
+
+	/*
+	 *	The search has completed, and the request is already
+	 *	resumable.  Don't resume it twice.  mod_authorize_resume()
+	 *	checks timed_out before starting another search.
+	 */
+	if (autz->done) return;
+
+	REDEBUG("Timeout waiting for search result");
+
+	/*
+	 *	Freeing the query abandons the search.
+	 */
+	TALLOC_FREE(autz->query);
+
+	unlang_resumable(request);
+}
+
+static int mod_authorize_timeout_add(rlm_ldap_t const *inst, REQUEST *request, ldap_autz_ctx_t *autz)
+{
+	struct timeval now, when;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_add(&when, &now, &inst->handle_config.res_timeout);
+
+	return unlang_event_timeout_add(request, mod_authorize_timeout, autz, &when);
+}
+
+static void mod_authorize_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+				 fr_state_action_t action)
+{
+	ldap_autz_ctx_t *autz = talloc_get_type_abort(ctx, ldap_autz_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	if (!autz->timed_out) unlang_event_timeout_delete(request, autz);
+	talloc_free(autz);
+}
+
+/*
+ *	Called when the result of a search has arrived, or we've given up waiting.
+ */
+static rlm_rcode_t mod_authorize_resume(REQUEST *request, void *instance, void *thread, void *ctx)
+{
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	ldap_autz_ctx_t		*autz = talloc_get_type_abort(ctx, ldap_autz_ctx_t);
+	rlm_rcode_t		rcode = RLM_MODULE_FAIL;
+	fr_ldap_conn_t		*conn;
+	LDAPMessage		*entry;
+
+	autz->done = false;
+	if (!autz->query) goto finish;
+
+	/*
+	 *	The rest of the work is done synchronously, on a
+	 *	connection from the pool.  LDAPMessages aren't tied
+	 *	to the connection they arrived on.
+	 */
+	conn = mod_conn_get(inst, request);
+	if (!conn) goto finish;
+
+	switch (autz->stage) {
+	case LDAP_AUTZ_FIND_USER:
+		autz->dn = rlm_ldap_find_user_result(inst, request, conn,
+						     autz->query->status, autz->query->result, &rcode);
+		if (!autz->dn) goto release;
+
+		autz->user = autz->query;
+		autz->query = NULL;
+		entry = ldap_first_entry(conn->handle, autz->user->result);
+
+		rcode = authorize_userobj(inst, request, &conn, entry);
+		if (rcode != RLM_MODULE_OK) goto release;
+
+		if (!inst->cacheable_group_dn && !inst->cacheable_group_name) break;
+
+		if (autz->timed_out) {
+			REDEBUG("Timeout waiting for search result");
+			rcode = RLM_MODULE_FAIL;
+			goto release;
+		}
+
+		rcode = rlm_ldap_cacheable_groupobj_async(&autz->query, autz, inst, request, t->async,
+							  _autz_query_done, autz);
+		if (rcode != RLM_MODULE_OK) goto release;
+		if (!autz->query) break;
+
+		mod_conn_release(inst, request, conn);
+
+		autz->stage = LDAP_AUTZ_GROUPOBJ;
+
+		return RLM_MODULE_YIELD;
+
+	case LDAP_AUTZ_GROUPOBJ:
+		rcode = rlm_ldap_cacheable_groupobj_result(inst, request, conn,
+							   autz->query->status, autz->query->result);
+		if (rcode != RLM_MODULE_OK) goto release;
+
+		entry = ldap_first_entry(conn->handle, autz->user->result);
+		break;
+
+	default:
+		rad_assert(0);
+		goto release;
 	}
 
+	rcode = authorize_finish(inst, request, &conn, autz->dn, entry, &autz->expanded);
+
+release:
+	mod_conn_release(inst, request, conn);
+
+finish:
+	if (!autz->timed_out) unlang_event_timeout_delete(request, autz);
+	talloc_free(autz);
+
+	return rcode;
+}
+
+/** Send the search for the user object, and yield until the result arrives
+ *
+ */
+static rlm_rcode_t mod_authorize_async(rlm_ldap_t const *inst, rlm_ldap_thread_t *t, REQUEST *request)
+{
+	rlm_rcode_t		rcode;
+	ldap_autz_ctx_t		*autz;
+
+	MEM(autz = talloc_zero(request, ldap_autz_ctx_t));
+	talloc_set_destructor(autz, _autz_ctx_free);
+
+	if (fr_ldap_map_expand(&autz->expanded, request, inst->user_map) < 0) {
+		talloc_free(autz);
+		return RLM_MODULE_FAIL;
+	}
+	authorize_attrs(inst, &autz->expanded);
+
+	rcode = rlm_ldap_find_user_async(&autz->query, autz, inst, request, t->async,
+					 autz->expanded.attrs, _autz_query_done, autz);
+	if (rcode != RLM_MODULE_OK) {
+		talloc_free(autz);
+		return rcode;
+	}
+
+	if (mod_authorize_timeout_add(inst, request, autz) < 0) {
+		talloc_free(autz);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_yield(request, mod_authorize_resume, mod_authorize_action, autz);
+}
+
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
+{
+	rlm_rcode_t		rcode = RLM_MODULE_OK;
+	rlm_ldap_t const	*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+	int			ldap_errno;
+	fr_ldap_conn_t		*conn;
+	LDAPMessage		*result, *entry;
+	char const 		*dn = NULL;
+	fr_ldap_map_exp_t	expanded; /* faster than allocing every time */
+
+	/*
+	 *	Don't be tempted to add a check for request->username
+	 *	or request->password here. rlm_ldap.authorize can be used for
+	 *	many things besides searching for users.
+	 */
+
+	if (t->async) return mod_authorize_async(inst, t, request);
+
+	if (fr_ldap_map_expand(&expanded, request, inst->user_map) < 0) return RLM_MODULE_FAIL;
+
+	conn = mod_conn_get(inst, request);
+	if (!conn) return RLM_MODULE_FAIL;
+
+	/*
+	 *	Add any additional attributes we need for checking access, memberships, and profiles
+	 */
+	authorize_attrs(inst, &expanded);
+
+	dn = rlm_ldap_find_user(inst, request, &conn, expanded.attrs, true, &result, &rcode);
+	if (!dn) {
+		goto finish;
+	}
+
+	entry = ldap_first_entry(conn->handle, result);
+	if (!entry) {
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		REDEBUG("Failed retrieving entry: %s", ldap_err2string(ldap_errno));
+
+		goto finish;
+	}
+
+	rcode = authorize_userobj(inst, request, &conn, entry);
+	if (rcode != RLM_MODULE_OK) {
+		goto finish;
+	}
+
+	if (inst->cacheable_group_dn || inst->cacheable_group_name) {
+		rcode = rlm_ldap_cacheable_groupobj(inst, request, &conn);
+		if (rcode != RLM_MODULE_OK) {
+			goto finish;
+		}
+	}
+
+	rcode = authorize_finish(inst, request, &conn, dn, entry, &expanded);
+
 finish:
 	talloc_free(expanded.ctx);
 	if (result) ldap_msgfree(result);
@@ -1367,6 +1670,7 @@ static int mod_detach(void *instance)
 
 	fr_connection_pool_free(inst->pool);
 	talloc_free(inst->user_map);
+	talloc_free(inst->group_cache);
 
 	return 0;
 }
@@ -1921,6 +2225,19 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	 */
 	if (fr_ldap_global_init() < 0) goto error;
 
+	/*
+	 *	Shared between all threads, so the cost of resolving
+	 *	a membership is paid once per TTL, not once per thread.
+	 */
+	if (inst->group_cache_size) {
+		inst->group_cache = rlm_ldap_cache_alloc(inst, inst->group_cache_size,
+							 inst->group_cache_ttl, inst->group_cache_negative_ttl);
+		if (!inst->group_cache) {
+			cf_log_err_cs(conf, "Failed allocating group cache");
+			goto error;
+		}
+	}
+
 	/*
 	 *	Initialize the socket pool.
 	 */
@@ -1963,6 +2280,50 @@ error:
 	return -1;
 }
 
+/** Allocate the connection used for asynchronous searches from this thread
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_ldap_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_ldap_t		*inst = instance;
+	rlm_ldap_thread_t	*t = thread;
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->async) return 0;
+
+	/*
+	 *	The connection is opened when the first search is
+	 *	sent, so the server can start without the directory.
+	 */
+	t->async = fr_ldap_async_alloc(NULL, inst->handle_config.name, el, mod_conn_create, &inst->handle_config,
+				       &inst->handle_config.net_timeout);
+	if (!t->async) {
+		ERROR("rlm_ldap (%s) - Failed allocating async connection", inst->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_ldap_thread_t *t = thread;
+
+	talloc_free(t->async);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_ldap_global_init();
@@ -1975,6 +2336,59 @@ static void mod_unload(void)
 	fr_ldap_global_free();;
 }
 
+/** Print group cache statistics
+ *
+ */
+static int mod_command_cache_stats(TALLOC_CTX *ctx, char **out, void *instance,
+				   UNUSED int argc, UNUSED char *argv[])
+{
+	rlm_ldap_t *inst = instance;
+
+	if (!inst->group_cache) {
+		*out = talloc_typed_strdup(ctx, "Group cache is disabled");
+		return -1;
+	}
+
+	*out = rlm_ldap_cache_stats(ctx, inst->group_cache);
+
+	return 0;
+}
+
+/** Remove all entries from the group cache, or the memberships of a single user
+ *
+ */
+static int mod_command_cache_flush(TALLOC_CTX *ctx, char **out, void *instance, int argc, char *argv[])
+{
+	rlm_ldap_t	*inst = instance;
+	uint32_t	count;
+
+	if (!inst->group_cache) {
+		*out = talloc_typed_strdup(ctx, "Group cache is disabled");
+		return -1;
+	}
+
+	if (argc > 1) {
+		*out = talloc_typed_strdup(ctx, "Too many arguments, DNs containing spaces must be quoted");
+		return -1;
+	}
+
+	count = rlm_ldap_cache_flush(inst->group_cache, (argc == 1) ? argv[0] : NULL);
+	*out = talloc_typed_asprintf(ctx, "Removed %u entries", count);
+
+	return 0;
+}
+
+static module_command_t const mod_commands[] = {
+	{ .command = "cache_stats", .write = false,
+	  .help = "cache_stats - show group cache hits, misses and size",
+	  .func = mod_command_cache_stats },
+	{ .command = "cache_flush", .write = true,
+	  .help = "cache_flush [<user dn>] - remove all entries from the group cache, or the memberships of one user",
+	  .func = mod_command_cache_flush },
+
+	{ .command = NULL }
+};
+
 /* globally exported name */
 extern rad_module_t rlm_ldap;
 rad_module_t rlm_ldap = {
@@ -1988,10 +2402,14 @@ rad_module_t rlm_ldap = {
 	.bootstrap	= mod_bootstrap,
 	.instantiate	= mod_instantiate,
 	.detach		= mod_detach,
+	.thread_inst_size	= sizeof(rlm_ldap_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_authenticate,
 		[MOD_AUTHORIZE]		= mod_authorize,
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_POST_AUTH]		= mod_post_auth
 	},
+	.commands	= mod_commands
 };
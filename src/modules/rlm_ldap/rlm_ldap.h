@@ -21,6 +21,18 @@
 
 typedef struct ldap_inst_s rlm_ldap_t;
 
+typedef struct rlm_ldap_cache rlm_ldap_cache_t;
+
+/** Kinds of entry held in the group cache
+ *
+ */
+typedef enum {
+	LDAP_CACHE_MEMBERSHIP = 0,			//!< Whether a user is a member of a group.
+	LDAP_CACHE_DN2NAME,				//!< Group DN to group name.
+	LDAP_CACHE_NAME2DN,				//!< Group name to group DN.
+	LDAP_CACHE_TYPE_MAX
+} rlm_ldap_cache_type_t;
+
 typedef struct {
 	vp_tmpl_t	*mech;				//!< SASL mech(s) to try.
 	vp_tmpl_t	*proxy;				//!< Identity to proxy.
@@ -111,6 +123,14 @@ struct ldap_inst_s {
 	fr_dict_attr_t const	*group_da;		//!< The DA associated with this specific instance of the
 							//!< rlm_ldap module.
 
+	uint32_t	group_cache_size;		//!< Maximum number of entries in the group cache.
+							//!< 0 disables the cache.
+	uint32_t	group_cache_ttl;		//!< How long to cache memberships and group DN/name mappings.
+	uint32_t	group_cache_negative_ttl;	//!< How long to cache the user not being a member of a group.
+
+	rlm_ldap_cache_t *group_cache;			//!< Membership results and group DN/name mappings, shared
+							//!< between all threads.
+
 	/*
 	 *	Dynamic clients
 	 */
@@ -158,14 +178,34 @@ struct ldap_inst_s {
 							//!< are unavailable.
 
 	uint32_t	ldap_debug;			//!< Debug flag for the SDK.
+
+	bool		async;				//!< Send searches for authorize on a connection owned by
+							//!< the worker thread, and yield until the results arrive.
 };
 
+/** Per-thread instance data
+ *
+ */
+typedef struct {
+	rlm_ldap_t const	*inst;			//!< Instance of rlm_ldap.
+	fr_event_list_t		*el;			//!< The event list serviced by this thread.
+	fr_ldap_async_t		*async;			//!< Searches from this thread are multiplexed over
+							//!< this connection, if async is enabled.
+} rlm_ldap_thread_t;
+
 /*
  *	user.c - User lookup functions
  */
 char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
 			       char const *attrs[], bool force, LDAPMessage **result, rlm_rcode_t *rcode);
 
+rlm_rcode_t rlm_ldap_find_user_async(fr_ldap_query_t **out, TALLOC_CTX *ctx,
+				     rlm_ldap_t const *inst, REQUEST *request, fr_ldap_async_t *async,
+				     char const *attrs[], fr_ldap_query_cb_t callback, void *uctx);
+
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t const *conn,
+				      fr_ldap_rcode_t status, LDAPMessage *result, rlm_rcode_t *rcode);
+
 rlm_rcode_t rlm_ldap_check_access(rlm_ldap_t const *inst, REQUEST *request,
 				  fr_ldap_conn_t const *conn, LDAPMessage *entry);
 
@@ -179,6 +219,14 @@ rlm_rcode_t rlm_ldap_cacheable_userobj(rlm_ldap_t const *inst, REQUEST *request,
 
 rlm_rcode_t rlm_ldap_cacheable_groupobj(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn);
 
+rlm_rcode_t rlm_ldap_cacheable_groupobj_async(fr_ldap_query_t **out, TALLOC_CTX *ctx,
+					      rlm_ldap_t const *inst, REQUEST *request, fr_ldap_async_t *async,
+					      fr_ldap_query_cb_t callback, void *uctx);
+
+rlm_rcode_t rlm_ldap_cacheable_groupobj_result(rlm_ldap_t const *inst, REQUEST *request,
+					       fr_ldap_conn_t const *conn,
+					       fr_ldap_rcode_t status, LDAPMessage *result);
+
 rlm_rcode_t rlm_ldap_check_groupobj_dynamic(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t **pconn,
 					    VALUE_PAIR *check);
 
@@ -187,6 +235,24 @@ rlm_rcode_t rlm_ldap_check_userobj_dynamic(rlm_ldap_t const *inst, REQUEST *requ
 
 rlm_rcode_t rlm_ldap_check_cached(rlm_ldap_t const *inst, REQUEST *request, VALUE_PAIR *check);
 
+/*
+ *	cache.c - Group cache.
+ */
+rlm_ldap_cache_t *rlm_ldap_cache_alloc(TALLOC_CTX *ctx, uint32_t max_entries, uint32_t ttl, uint32_t negative_ttl);
+
+int rlm_ldap_cache_membership_find(rlm_ldap_cache_t *cache, char const *user_dn, char const *group);
+
+void rlm_ldap_cache_membership_add(rlm_ldap_cache_t *cache, char const *user_dn, char const *group, bool member);
+
+char *rlm_ldap_cache_group_find(TALLOC_CTX *ctx, rlm_ldap_cache_t *cache, rlm_ldap_cache_type_t type,
+				char const *key);
+
+void rlm_ldap_cache_group_add(rlm_ldap_cache_t *cache, char const *dn, char const *name);
+
+uint32_t rlm_ldap_cache_flush(rlm_ldap_cache_t *cache, char const *user_dn);
+
+char *rlm_ldap_cache_stats(TALLOC_CTX *ctx, rlm_ldap_cache_t *cache);
+
 /*
  *	conn.c - Connection wrappers.
  */
@@ -32,6 +32,41 @@
 
 #include "rlm_ldap.h"
 
+/** Expand the filter and base DN used to search for user objects
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[out] filter Where to write the expanded filter, NULL if no filter is configured.
+ * @param[in] filter_buff Buffer of LDAP_MAX_FILTER_STR_LEN bytes to expand the filter in.
+ * @param[out] base_dn Where to write the expanded base DN.
+ * @param[in] base_dn_buff Buffer of LDAP_MAX_DN_STR_LEN bytes to expand the base DN in.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int rlm_ldap_userobj_expand(rlm_ldap_t const *inst, REQUEST *request,
+				   char const **filter, char *filter_buff,
+				   char const **base_dn, char *base_dn_buff)
+{
+	*filter = NULL;
+
+	if (inst->userobj_filter) {
+		if (tmpl_expand(filter, filter_buff, LDAP_MAX_FILTER_STR_LEN, request, inst->userobj_filter,
+				fr_ldap_escape_func, NULL) < 0) {
+			REDEBUG("Unable to create filter");
+			return -1;
+		}
+	}
+
+	if (tmpl_expand(base_dn, base_dn_buff, LDAP_MAX_DN_STR_LEN, request,
+			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
+		REDEBUG("Unable to create base_dn");
+		return -1;
+	}
+
+	return 0;
+}
+
 /** Retrieve the DN of a user object
  *
  * Retrieves the DN of a user and adds it to the control list as LDAP-UserDN. Will also retrieve any
@@ -57,11 +92,9 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 
 	fr_ldap_rcode_t	status;
 	VALUE_PAIR	*vp = NULL;
-	LDAPMessage	*tmp_msg = NULL, *entry = NULL;
-	int		ldap_errno;
-	int		cnt;
-	char		*dn = NULL;
-	char const	*filter = NULL;
+	LDAPMessage	*tmp_msg = NULL;
+	char const	*dn;
+	char const	*filter;
 	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
 	char const	*base_dn;
 	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
@@ -111,26 +144,83 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		(*pconn)->rebound = false;
 	}
 
-	if (inst->userobj_filter) {
-		if (tmpl_expand(&filter, filter_buff, sizeof(filter_buff), request, inst->userobj_filter,
-				fr_ldap_escape_func, NULL) < 0) {
-			REDEBUG("Unable to create filter");
-			*rcode = RLM_MODULE_INVALID;
-
-			return NULL;
-		}
-	}
-
-	if (tmpl_expand(&base_dn, base_dn_buff, sizeof(base_dn_buff), request,
-			inst->userobj_base_dn, fr_ldap_escape_func, NULL) < 0) {
-		REDEBUG("Unable to create base_dn");
+	if (rlm_ldap_userobj_expand(inst, request, &filter, filter_buff, &base_dn, base_dn_buff) < 0) {
 		*rcode = RLM_MODULE_INVALID;
-
 		return NULL;
 	}
 
 	status = fr_ldap_search(result, request, pconn, base_dn,
 				inst->userobj_scope, filter, attrs, serverctrls, NULL);
+
+	dn = rlm_ldap_find_user_result(inst, request, *pconn, status, *result, rcode);
+
+	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
+		ldap_msgfree(*result);
+		*result = NULL;
+	}
+
+	return dn;
+}
+
+/** Send the search for a user object, without waiting for the result
+ *
+ * When the result arrives, it should be passed to #rlm_ldap_find_user_result.
+ *
+ * @param[out] out Where to write the query.
+ * @param[in] ctx to allocate the query in.
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] async connection to send the search on.
+ * @param[in] attrs Additional attributes to retrieve, may be NULL.
+ * @param[in] callback to run when the result arrives.
+ * @param[in] uctx passed to callback.
+ * @return
+ *	- #RLM_MODULE_OK if the search was sent.
+ *	- #RLM_MODULE_INVALID if the filter or base DN could not be expanded.
+ *	- #RLM_MODULE_FAIL if the search could not be sent.
+ */
+rlm_rcode_t rlm_ldap_find_user_async(fr_ldap_query_t **out, TALLOC_CTX *ctx,
+				     rlm_ldap_t const *inst, REQUEST *request, fr_ldap_async_t *async,
+				     char const *attrs[], fr_ldap_query_cb_t callback, void *uctx)
+{
+	char const	*filter;
+	char	    	filter_buff[LDAP_MAX_FILTER_STR_LEN];
+	char const	*base_dn;
+	char	    	base_dn_buff[LDAP_MAX_DN_STR_LEN];
+	LDAPControl	*serverctrls[] = { inst->userobj_sort_ctrl, NULL };
+
+	if (rlm_ldap_userobj_expand(inst, request, &filter, filter_buff, &base_dn, base_dn_buff) < 0) {
+		return RLM_MODULE_INVALID;
+	}
+
+	if (fr_ldap_async_search(out, ctx, request, async, base_dn, inst->userobj_scope, filter, attrs,
+				 serverctrls, NULL, callback, uctx) != LDAP_PROC_SUCCESS) return RLM_MODULE_FAIL;
+
+	return RLM_MODULE_OK;
+}
+
+/** Process the result of a search for a user object
+ *
+ * Checks the result contains exactly one user object, and adds its DN to the
+ * control list as LDAP-UserDN.
+ *
+ * @param[in] inst rlm_ldap configuration.
+ * @param[in] request Current request.
+ * @param[in] conn the search was performed on.  Only used to parse the result.
+ * @param[in] status of the search.
+ * @param[in] result of the search.  Not freed.
+ * @param[out] rcode The status of the operation, one of the RLM_MODULE_* codes.
+ * @return The user's DN or NULL on error.
+ */
+char const *rlm_ldap_find_user_result(rlm_ldap_t const *inst, REQUEST *request, fr_ldap_conn_t const *conn,
+				      fr_ldap_rcode_t status, LDAPMessage *result, rlm_rcode_t *rcode)
+{
+	VALUE_PAIR	*vp = NULL;
+	LDAPMessage	*entry = NULL;
+	int		ldap_errno;
+	int		cnt;
+	char		*dn = NULL;
+
 	switch (status) {
 	case LDAP_PROC_SUCCESS:
 		break;
@@ -145,7 +235,7 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 		return NULL;
 	}
 
-	rad_assert(*pconn);
+	*rcode = RLM_MODULE_FAIL;
 
 	/*
 	 *	Forbid the use of unsorted search results that
@@ -153,40 +243,40 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 	 *	security issue, and likely non deterministic.
 	 */
 	if (!inst->userobj_sort_ctrl) {
-		cnt = ldap_count_entries((*pconn)->handle, *result);
+		cnt = ldap_count_entries(conn->handle, result);
 		if (cnt > 1) {
 			REDEBUG("Ambiguous search result, returned %i unsorted entries (should return 1 or 0).  "
 				"Enable sorting, or specify a more restrictive base_dn, filter or scope", cnt);
 			REDEBUG("The following entries were returned:");
 			RINDENT();
-			for (entry = ldap_first_entry((*pconn)->handle, *result);
+			for (entry = ldap_first_entry(conn->handle, result);
 			     entry;
-			     entry = ldap_next_entry((*pconn)->handle, entry)) {
-				dn = ldap_get_dn((*pconn)->handle, entry);
+			     entry = ldap_next_entry(conn->handle, entry)) {
+				dn = ldap_get_dn(conn->handle, entry);
 				REDEBUG("%s", dn);
 				ldap_memfree(dn);
 			}
 			REXDENT();
 			*rcode = RLM_MODULE_INVALID;
-			goto finish;
+			return NULL;
 		}
 	}
 
-	entry = ldap_first_entry((*pconn)->handle, *result);
+	entry = ldap_first_entry(conn->handle, result);
 	if (!entry) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Failed retrieving entry: %s",
 			ldap_err2string(ldap_errno));
 
-		goto finish;
+		return NULL;
 	}
 
-	dn = ldap_get_dn((*pconn)->handle, entry);
+	dn = ldap_get_dn(conn->handle, entry);
 	if (!dn) {
-		ldap_get_option((*pconn)->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
+		ldap_get_option(conn->handle, LDAP_OPT_RESULT_CODE, &ldap_errno);
 		REDEBUG("Retrieving object DN from entry failed: %s", ldap_err2string(ldap_errno));
 
-		goto finish;
+		return NULL;
 	}
 	fr_ldap_util_normalise_dn(dn, dn);
 
@@ -206,12 +296,6 @@ char const *rlm_ldap_find_user(rlm_ldap_t const *inst, REQUEST *request, fr_ldap
 	}
 	ldap_memfree(dn);
 
-finish:
-	if ((freeit || (*rcode != RLM_MODULE_OK)) && *result) {
-		ldap_msgfree(*result);
-		*result = NULL;
-	}
-
 	return vp ? vp->vp_strvalue : NULL;
 }
 
@@ -106,6 +106,9 @@ typedef struct linelog_instance_t {
 		exfile_t		*ef;			//!< Exclusive file access handle.
 		bool			escape;			//!< Do filename escaping, yes / no.
 		xlat_escape_t		escape_func;		//!< Escape function.
+		size_t			buffer_size;		//!< Size of the per-file write buffer.
+		struct timeval		flush_interval;		//!< Maximum time a line may sit in the buffer.
+		bool			fsync;			//!< Sync the file after every line.
 	} file;
 
 	struct {
@@ -123,12 +126,23 @@ typedef struct linelog_conn {
 	int			sockfd;			//!< File descriptor associated with socket
 } linelog_conn_t;
 
+/** linelog thread specific data
+ */
+typedef struct linelog_thread_t {
+	linelog_instance_t const *inst;			//!< Instance of rlm_linelog.
+	fr_event_list_t		*el;			//!< The event list serviced by this thread.
+	fr_event_timer_t	*flush_ev;		//!< Timer for flushing buffered lines.
+} linelog_thread_t;
+
 
 static const CONF_PARSER file_config[] = {
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_OUTPUT | PW_TYPE_XLAT, linelog_instance_t, file.name) },
 	{ FR_CONF_OFFSET("permissions", PW_TYPE_INTEGER, linelog_instance_t, file.permissions), .dflt = "0600" },
 	{ FR_CONF_OFFSET("group", PW_TYPE_STRING, linelog_instance_t, file.group_str) },
 	{ FR_CONF_OFFSET("escape_filenames", PW_TYPE_BOOLEAN, linelog_instance_t, file.escape), .dflt = "no" },
+	{ FR_CONF_OFFSET("buffer_size", PW_TYPE_SIZE, linelog_instance_t, file.buffer_size), .dflt = "0" },
+	{ FR_CONF_OFFSET("flush_interval", PW_TYPE_TIMEVAL, linelog_instance_t, file.flush_interval), .dflt = "1.0" },
+	{ FR_CONF_OFFSET("fsync", PW_TYPE_BOOLEAN, linelog_instance_t, file.fsync), .dflt = "no" },
 	CONF_PARSER_TERMINATOR
 };
 
@@ -342,6 +356,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 			return -1;
 		}
 
+		if (inst->file.buffer_size) {
+			if (!fr_timeval_isset(&inst->file.flush_interval)) {
+				cf_log_err_cs(conf, "'flush_interval' must be greater than zero when buffering");
+				return -1;
+			}
+			exfile_enable_buffering(inst->file.ef, inst->file.buffer_size, &inst->file.flush_interval);
+		}
+		exfile_enable_sync(inst->file.ef, inst->file.fsync);
+
 		if (inst->file.group_str) {
 			char *endptr;
 
@@ -418,6 +441,70 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Write out lines which have been sitting in the file buffers for too long
+ *
+ */
+static void linelog_flush_timer(fr_event_list_t *el, struct timeval *now, void *ctx)
+{
+	linelog_thread_t	*t = ctx;
+	struct timeval		when;
+
+	t->flush_ev = NULL;
+
+	(void) exfile_flush(t->inst->file.ef, NULL, false);
+
+	fr_timeval_add(&when, now, &t->inst->file.flush_interval);
+	if (fr_event_timer_insert(el, linelog_flush_timer, t, &when, &t->flush_ev) < 0) {
+		PERROR("Failed inserting flush timer");
+	}
+}
+
+/** Start flushing buffered lines from this thread's event loop
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_linelog.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance, fr_event_list_t *el, void *thread)
+{
+	linelog_instance_t const	*inst = instance;
+	linelog_thread_t		*t = thread;
+	struct timeval			when;
+
+	t->inst = inst;
+	t->el = el;
+
+	if ((inst->log_dst != LINELOG_DST_FILE) || !inst->file.buffer_size || inst->file.fsync) return 0;
+
+	gettimeofday(&when, NULL);
+	fr_timeval_add(&when, &when, &inst->file.flush_interval);
+
+	if (fr_event_timer_insert(el, linelog_flush_timer, t, &when, &t->flush_ev) < 0) {
+		PERROR("Failed inserting flush timer");
+		return -1;
+	}
+
+	return 0;
+}
+
+/** Stop flushing buffered lines from this thread
+ *
+ * @param[in] thread	specific data to destroy.
+ * @return 0
+ */
+static int mod_thread_detach(void *thread)
+{
+	linelog_thread_t	*t = thread;
+
+	if (t->flush_ev) (void) fr_event_timer_delete(t->el, &t->flush_ev);
+
+	return 0;
+}
+
 /** Escape unprintable characters
  *
  * - Newline is escaped as ``\\n``.
@@ -463,7 +550,6 @@ static size_t linelog_escape_func(UNUSED REQUEST *request,
 static rlm_rcode_t mod_do_linelog(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
 static rlm_rcode_t mod_do_linelog(void *instance, UNUSED void *thread, REQUEST *request)
 {
-	int			fd = -1;
 	linelog_conn_t		*conn;
 	struct timeval		*timeout = NULL;
 
@@ -667,28 +753,15 @@ build_vector:
 			*p = '/';
 		}
 
-		fd = exfile_open(inst->file.ef, request, path, inst->file.permissions, true);
-		if (fd < 0) {
-			RERROR("Failed to open %s: %s", path, fr_syserror(errno));
+		if (exfile_writev(inst->file.ef, request, path, inst->file.permissions, vector_p, vector_len) < 0) {
+			RERROR("Failed writing to \"%s\": %s", path, fr_strerror());
 			rcode = RLM_MODULE_FAIL;
 			goto finish;
 		}
 
 		if (inst->file.group_str && (chown(path, -1, inst->file.group) == -1)) {
-			RWARN("Unable to change system group of \"%s\": %s", path, fr_strerror());
+			RWARN("Unable to change system group of \"%s\": %s", path, fr_syserror(errno));
 		}
-
-		if (writev(fd, vector_p, vector_len) < 0) {
-			RERROR("Failed writing to \"%s\": %s", path, fr_syserror(errno));
-			exfile_close(inst->file.ef, request, fd);
-
-			/* Assert on the extra fatal errors */
-			rad_assert((errno != EINVAL) && (errno != EFAULT));
-
-			return RLM_MODULE_FAIL;
-		}
-
-		exfile_close(inst->file.ef, request, fd);
 	}
 		break;
 
@@ -796,6 +869,9 @@ rad_module_t rlm_linelog = {
 	.inst_size	= sizeof(linelog_instance_t),
 	.config		= module_config,
 	.instantiate	= mod_instantiate,
+	.thread_inst_size	= sizeof(linelog_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach	= mod_thread_detach,
 	.detach		= mod_detach,
 	.methods = {
 		[MOD_AUTHENTICATE]	= mod_do_linelog,
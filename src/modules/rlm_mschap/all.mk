@@ -1,4 +1,4 @@
-SUBMAKEFILES := rlm_mschap.mk smbencrypt.mk
+SUBMAKEFILES := rlm_mschap.mk smbencrypt.mk ntlm_auth_mock.mk
 
 src/modules/rlm_mschap/rlm_mschap.mk: src/modules/rlm_mschap/rlm_mschap.mk.in src/modules/rlm_mschap/configure
 	${Q}echo CONFIGURE $(dir $<)
@@ -0,0 +1,217 @@
+/*
+ * ntlm_auth_mock.c	Stands in for "ntlm_auth --helper-protocol=ntlm-server-1"
+ *			when testing the ntlm_auth helper pool.
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include	<freeradius-devel/libradius.h>
+#include	<freeradius-devel/md4.h>
+#include	<freeradius-devel/base64.h>
+
+#include	"smbdes.h"
+
+#define MAX_USERS 32
+
+typedef struct mock_user {
+	char const	*name;
+	char const	*password;	//!< NULL if the user is always rejected.
+	char const	*error;		//!< Sent when the user is rejected.
+} mock_user_t;
+
+static char const *progname = "ntlm_auth_mock";
+static mock_user_t users[MAX_USERS];
+static int num_users;
+
+static void NEVER_RETURNS usage(int status)
+{
+	FILE *output = status ? stderr : stdout;
+
+	fprintf(output, "Usage: %s [options]\n", progname);
+	fprintf(output, "Answer ntlm-server-1 helper requests on stdin, for testing.\n");
+	fprintf(output, "  -d <delay>             Wait <delay> milliseconds before each response.\n");
+	fprintf(output, "  -h                     Print usage help information.\n");
+	fprintf(output, "  -n <count>             Exit after answering <count> requests.\n");
+	fprintf(output, "  -u <user>:<password>   Accept <user> with <password>.\n");
+	fprintf(output, "  -x <user>:<error>      Reject <user> with <error>.\n");
+
+	exit(status);
+}
+
+static void add_user(char *arg, bool reject)
+{
+	char *p;
+
+	p = strchr(arg, ':');
+	if (!p || (num_users == MAX_USERS)) usage(1);
+	*p++ = '\0';
+
+	users[num_users].name = arg;
+	if (reject) {
+		users[num_users].error = p;
+	} else {
+		users[num_users].password = p;
+		users[num_users].error = "NT_STATUS_WRONG_PASSWORD";
+	}
+	num_users++;
+}
+
+/*
+ *	Decode the value of a "key: value" or "key:: base64" line.
+ */
+static ssize_t get_value(uint8_t *out, size_t outlen, char const *value, bool base64)
+{
+	size_t len = strlen(value);
+
+	if (base64) return fr_base64_decode(out, outlen, value, len);
+
+	if (len >= outlen) return -1;
+	memcpy(out, value, len);
+
+	return len;
+}
+
+static void respond(char const *username, bool have_challenge, uint8_t const *challenge,
+		    bool have_response, uint8_t const *response)
+{
+	int		i;
+	mock_user_t	*user = NULL;
+	uint8_t		ucs2_password[512];
+	uint8_t		nthash[MD4_DIGEST_LENGTH], nthashhash[MD4_DIGEST_LENGTH];
+	uint8_t		calculated[24];
+	char		hex[(MD4_DIGEST_LENGTH * 2) + 1];
+	ssize_t		len;
+
+	if (!*username || !have_challenge || !have_response) {
+		printf("Error: Incomplete request\n.\n");
+		return;
+	}
+
+	for (i = 0; i < num_users; i++) {
+		if (strcmp(users[i].name, username) == 0) {
+			user = &users[i];
+			break;
+		}
+	}
+
+	if (!user) {
+		printf("Authenticated: No\nAuthentication-Error: NT_STATUS_NO_SUCH_USER\n.\n");
+		return;
+	}
+
+	if (!user->password) goto reject;
+
+	len = fr_utf8_to_ucs2(ucs2_password, sizeof(ucs2_password), user->password, strlen(user->password));
+	if (len < 0) goto reject;
+
+	fr_md4_calc(nthash, ucs2_password, len);
+	smbdes_mschap(nthash, challenge, calculated);
+	if (memcmp(calculated, response, sizeof(calculated)) != 0) {
+	reject:
+		printf("Authenticated: No\nAuthentication-Error: %s\n.\n", user->error);
+		return;
+	}
+
+	fr_md4_calc(nthashhash, nthash, sizeof(nthash));
+	fr_bin2hex(hex, nthashhash, sizeof(nthashhash));
+	printf("Authenticated: Yes\nUser-Session-Key: %s\n.\n", hex);
+}
+
+int main(int argc, char **argv)
+{
+	int		c;
+	int		delay = 0, count = 0, answered = 0;
+	char		line[1024];
+	char		username[256] = "";
+	uint8_t		challenge[8], response[24];
+	bool		have_challenge = false, have_response = false;
+
+	while ((c = getopt(argc, argv, "d:hn:u:x:")) != EOF) switch (c) {
+		case 'd':
+			delay = atoi(optarg);
+			break;
+
+		case 'h':
+			usage(0);	/* never returns */
+
+		case 'n':
+			count = atoi(optarg);
+			break;
+
+		case 'u':
+			add_user(optarg, false);
+			break;
+
+		case 'x':
+			add_user(optarg, true);
+			break;
+
+		default:
+			usage(1);
+	}
+
+	while (fgets(line, sizeof(line), stdin)) {
+		char	*p, *value;
+		bool	base64 = false;
+		ssize_t	len;
+
+		p = strchr(line, '\n');
+		if (p) *p = '\0';
+
+		/*
+		 *	End of a request.
+		 */
+		if (strcmp(line, ".") == 0) {
+			if (delay) usleep(delay * 1000);
+
+			respond(username, have_challenge, challenge, have_response, response);
+			fflush(stdout);
+
+			username[0] = '\0';
+			have_challenge = have_response = false;
+
+			if (count && (++answered >= count)) break;
+			continue;
+		}
+
+		value = strchr(line, ':');
+		if (!value) continue;
+		*value++ = '\0';
+		if (*value == ':') {
+			base64 = true;
+			value++;
+		}
+		while (*value == ' ') value++;
+
+		if (strcasecmp(line, "Username") == 0) {
+			len = get_value((uint8_t *) username, sizeof(username) - 1, value, base64);
+			username[(len < 0) ? 0 : len] = '\0';
+
+		} else if (strcasecmp(line, "LANMAN-Challenge") == 0) {
+			have_challenge = (fr_hex2bin(challenge, sizeof(challenge),
+						     value, strlen(value)) == sizeof(challenge));
+
+		} else if (strcasecmp(line, "NT-Response") == 0) {
+			have_response = (fr_hex2bin(response, sizeof(response),
+						    value, strlen(value)) == sizeof(response));
+		}
+	}
+
+	return 0;
+}
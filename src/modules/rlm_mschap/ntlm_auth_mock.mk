@@ -0,0 +1,7 @@
+TARGET		:= ntlm_auth_mock
+SOURCES		:= ntlm_auth_mock.c smbdes.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+
+SRC_CFLAGS	:=
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,662 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file ntlm_helper.c
+ * @brief NTLM authentication using a pool of persistent ntlm_auth helpers
+ *
+ * Rather than running ntlm_auth once for every request, a small number of
+ * helpers are started with "--helper-protocol=ntlm-server-1", and requests
+ * are written to them over a pipe.  Many requests may be outstanding on one
+ * helper.  The helper answers them in the order they were written, so the
+ * thread which sent the Nth request reads the Nth response.
+ *
+ * @copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/radiusd.h>
+#include <freeradius-devel/rad_assert.h>
+#include <freeradius-devel/base64.h>
+
+#include <poll.h>
+
+#include "rlm_mschap.h"
+#include "mschap.h"
+#include "ntlm_helper.h"
+
+typedef struct ntlm_helper {
+	ntlm_helper_pool_t	*pool;
+	int			id;		//!< Index of the helper, for log messages.
+
+	pid_t			pid;		//!< Of the helper, or -1 if it isn't running.
+	pid_t			exited;		//!< Helper which has been stopped, but not yet reaped.
+	int			to_child;	//!< Requests are written here.
+	int			from_child;	//!< Responses are read from here.
+	uint32_t		generation;	//!< Incremented every time the helper is started.
+
+	uint64_t		sent;		//!< Requests written to the helper since it was started.
+	uint64_t		received;	//!< Responses read from the helper since it was started.
+
+	bool			accepting;	//!< Whether new requests may be written to the helper.
+	bool			failed;		//!< The helper died, or stopped responding.
+	bool			reading;	//!< A thread is reading a response, without holding the mutex.
+	time_t			next_start;	//!< Don't start the helper again before this time.
+
+	char			buffer[1024];	//!< Data read from the helper, but not yet parsed.
+	size_t			used;		//!< How much of the buffer is in use.
+} ntlm_helper_t;
+
+struct ntlm_helper_pool {
+	char const		*name;		//!< Of the module instance, for log messages.
+	char const		*program;	//!< Command line used to start the helpers.
+	uint32_t		num;		//!< Number of helpers.
+	uint32_t		max_pending;	//!< Requests which may be outstanding on one helper.
+	uint32_t		max_uses;	//!< Requests before a helper is replaced.  0 means no limit.
+	uint32_t		retry_delay;	//!< Seconds to wait before starting a helper which failed.
+	uint32_t		timeout;	//!< Seconds to wait for a response.
+
+	pthread_mutex_t		mutex;
+	pthread_cond_t		cond;		//!< Signalled when a response is read, or a helper stops.
+
+	ntlm_helper_t		*helpers;
+};
+
+typedef struct ntlm_helper_reply {
+	bool			authenticated;
+	bool			have_key;
+	uint8_t			key[NT_DIGEST_LENGTH];
+	char			error[256];
+} ntlm_helper_reply_t;
+
+/*
+ *	Start a helper.  Called with the mutex held.
+ */
+static int helper_start(ntlm_helper_t *helper)
+{
+	ntlm_helper_pool_t	*pool = helper->pool;
+	int			to_child = -1, from_child = -1;
+	pid_t			pid;
+
+	pid = radius_start_program(pool->program, NULL, true, &to_child, &from_child, NULL, false);
+	if (pid < 0) {
+		ERROR("%s: Failed starting ntlm_auth helper %i", pool->name, helper->id);
+		helper->next_start = time(NULL) + pool->retry_delay;
+		return -1;
+	}
+
+	helper->pid = pid;
+	helper->to_child = to_child;
+	helper->from_child = from_child;
+	helper->generation++;
+	helper->sent = helper->received = 0;
+	helper->used = 0;
+	helper->accepting = true;
+	helper->failed = false;
+
+	DEBUG2("%s: Started ntlm_auth helper %i (pid %u)", pool->name, helper->id, (unsigned int) pid);
+
+	return 0;
+}
+
+/*
+ *	Stop a helper.  Called with the mutex held, and when no thread
+ *	is reading from the helper.
+ *
+ *	Closing the pipe to the helper is enough to make it exit.  If
+ *	it has stopped responding, it is killed as well.
+ */
+static void helper_stop(ntlm_helper_t *helper)
+{
+	if (helper->pid < 0) return;
+
+	rad_assert(!helper->reading);
+
+	close(helper->to_child);
+	close(helper->from_child);
+	if (helper->failed) kill(helper->pid, SIGTERM);
+
+	DEBUG2("%s: Stopped ntlm_auth helper %i (pid %u)", helper->pool->name, helper->id,
+	       (unsigned int) helper->pid);
+
+	helper->exited = helper->pid;
+	helper->pid = -1;
+	helper->to_child = helper->from_child = -1;
+	helper->accepting = false;
+
+	pthread_cond_broadcast(&helper->pool->cond);
+}
+
+/*
+ *	Mark a helper as failed.  Called with the mutex held.
+ *
+ *	Threads waiting for a response from the helper give up.  If a
+ *	thread is reading from the helper, it stops the helper once it
+ *	is done.
+ */
+static void helper_fail(ntlm_helper_t *helper)
+{
+	if (!helper->failed) {
+		helper->failed = true;
+		helper->accepting = false;
+		helper->next_start = time(NULL) + helper->pool->retry_delay;
+		pthread_cond_broadcast(&helper->pool->cond);
+	}
+
+	if (helper->reading) return;
+
+	helper_stop(helper);
+}
+
+/*
+ *	Release the mutex, and reap any helpers which have been stopped.
+ *
+ *	Reaping may block for a short time, so it's not done with the
+ *	mutex held.
+ */
+static void helper_unlock(ntlm_helper_pool_t *pool)
+{
+	pid_t		pids[NTLM_HELPER_MAX_NUM];
+	uint32_t	i, num = 0;
+	int		status;
+
+	for (i = 0; i < pool->num; i++) {
+		if (pool->helpers[i].exited < 0) continue;
+
+		pids[num++] = pool->helpers[i].exited;
+		pool->helpers[i].exited = -1;
+	}
+	pthread_mutex_unlock(&pool->mutex);
+
+	for (i = 0; i < num; i++) (void) rad_waitpid(pids[i], &status);
+}
+
+/*
+ *	Check an idle helper is still alive.  It should have nothing
+ *	to say, so if the pipe is readable, the helper has either
+ *	exited, or is confused.
+ */
+static bool helper_alive(ntlm_helper_t *helper)
+{
+	struct pollfd pfd;
+
+	if (helper->used > 0) return false;
+
+	pfd.fd = helper->from_child;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+
+	return (poll(&pfd, 1, 0) == 0);
+}
+
+/*
+ *	Find the helper with the fewest outstanding requests, starting
+ *	new helpers as needed.  Called with the mutex held.
+ *
+ *	Waits if every helper has max_pending requests outstanding.
+ *	Returns NULL if no helper can be used.
+ */
+static ntlm_helper_t *helper_pick(ntlm_helper_pool_t *pool)
+{
+	for (;;) {
+		ntlm_helper_t	*best = NULL, *stopped = NULL;
+		uint64_t	best_pending = 0;
+		bool		running = false;
+		time_t		now = time(NULL);
+		uint32_t	i;
+
+		for (i = 0; i < pool->num; i++) {
+			ntlm_helper_t	*helper = &pool->helpers[i];
+			uint64_t	pending;
+
+			if (helper->pid < 0) {
+				if (!stopped && (helper->exited < 0) && (now >= helper->next_start)) stopped = helper;
+				continue;
+			}
+
+			running = true;
+			if (!helper->accepting) continue;
+
+			pending = helper->sent - helper->received;
+			if (!pending && !helper_alive(helper)) {
+				WARN("%s: ntlm_auth helper %i (pid %u) exited unexpectedly", pool->name, helper->id,
+				     (unsigned int) helper->pid);
+				helper_fail(helper);
+				continue;
+			}
+
+			if (pending >= pool->max_pending) continue;
+
+			if (!best || (pending < best_pending)) {
+				best = helper;
+				best_pending = pending;
+			}
+		}
+
+		/*
+		 *	Prefer an idle helper, then starting a new one,
+		 *	then queueing behind other requests.
+		 */
+		if (best && !best_pending) return best;
+		if (stopped && (helper_start(stopped) == 0)) return stopped;
+		if (best) return best;
+
+		/*
+		 *	Nothing is running, and nothing can be started.
+		 */
+		if (!running) return NULL;
+
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+}
+
+/*
+ *	Write all of a request to the helper.
+ */
+static int helper_write(ntlm_helper_t *helper, char const *buffer, size_t len)
+{
+	while (len > 0) {
+		ssize_t slen;
+
+		slen = write(helper->to_child, buffer, len);
+		if (slen < 0) {
+			if (errno == EINTR) continue;
+			return -1;
+		}
+
+		buffer += slen;
+		len -= slen;
+	}
+
+	return 0;
+}
+
+/*
+ *	Parse one response from the start of the buffer.
+ *
+ *	The response is a series of "key: value" or "key:: base64"
+ *	lines, terminated by a line containing a single '.'.
+ *
+ *	Returns the length of the response, or 0 if it's incomplete.
+ */
+static size_t helper_reply_parse(ntlm_helper_reply_t *reply, char const *buffer, size_t len)
+{
+	char const *p = buffer, *end = buffer + len;
+
+	memset(reply, 0, sizeof(*reply));
+
+	for (;;) {
+		char const	*eol, *colon, *value;
+		size_t		key_len, value_len;
+		bool		base64 = false;
+
+		eol = memchr(p, '\n', end - p);
+		if (!eol) return 0;
+
+		if (((eol - p) == 1) && (*p == '.')) return (eol + 1) - buffer;
+
+		colon = memchr(p, ':', eol - p);
+		if (!colon) goto next;
+
+		key_len = colon - p;
+		value = colon + 1;
+		if ((value < eol) && (*value == ':')) {
+			base64 = true;
+			value++;
+		}
+		while ((value < eol) && (*value == ' ')) value++;
+		value_len = eol - value;
+
+#define KEY_IS(_x) ((key_len == (sizeof(_x) - 1)) && (strncasecmp(p, _x, key_len) == 0))
+
+		if (KEY_IS("Authenticated")) {
+			reply->authenticated = ((value_len == 3) && (strncasecmp(value, "Yes", 3) == 0));
+
+		} else if (KEY_IS("User-Session-Key")) {
+			reply->have_key = (fr_hex2bin(reply->key, sizeof(reply->key),
+						      value, value_len) == sizeof(reply->key));
+
+		} else if (KEY_IS("Authentication-Error") || KEY_IS("Error")) {
+			if (base64) {
+				ssize_t slen;
+
+				slen = fr_base64_decode((uint8_t *) reply->error, sizeof(reply->error) - 1,
+							value, value_len);
+				reply->error[(slen < 0) ? 0 : slen] = '\0';
+			} else {
+				if (value_len >= sizeof(reply->error)) value_len = sizeof(reply->error) - 1;
+				memcpy(reply->error, value, value_len);
+				reply->error[value_len] = '\0';
+			}
+		}
+
+	next:
+		p = eol + 1;
+	}
+}
+
+/*
+ *	Read one response from the helper.  Called without the mutex
+ *	held, by the only thread allowed to read from the helper.
+ */
+static int helper_read(ntlm_helper_t *helper, REQUEST *request, ntlm_helper_reply_t *reply)
+{
+	struct timeval	when, now;
+
+	gettimeofday(&when, NULL);
+	when.tv_sec += helper->pool->timeout;
+
+	for (;;) {
+		size_t		len;
+		ssize_t		slen;
+		struct pollfd	pfd;
+		int		timeout;
+
+		len = helper_reply_parse(reply, helper->buffer, helper->used);
+		if (len > 0) {
+			/*
+			 *	Keep the start of any following responses.
+			 */
+			helper->used -= len;
+			if (helper->used > 0) memmove(helper->buffer, helper->buffer + len, helper->used);
+			return 0;
+		}
+
+		if (helper->used == sizeof(helper->buffer)) {
+			REDEBUG("Response from ntlm_auth helper %i is too long", helper->id);
+			return -1;
+		}
+
+		gettimeofday(&now, NULL);
+		timeout = ((when.tv_sec - now.tv_sec) * 1000) + ((when.tv_usec - now.tv_usec) / 1000);
+		if (timeout <= 0) {
+		timed_out:
+			REDEBUG("Timed out waiting for ntlm_auth helper %i", helper->id);
+			return -1;
+		}
+
+		pfd.fd = helper->from_child;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		switch (poll(&pfd, 1, timeout)) {
+		case -1:
+			if (errno == EINTR) continue;
+			REDEBUG("Failed waiting for ntlm_auth helper %i: %s", helper->id, fr_syserror(errno));
+			return -1;
+
+		case 0:
+			goto timed_out;
+
+		default:
+			break;
+		}
+
+		slen = read(helper->from_child, helper->buffer + helper->used, sizeof(helper->buffer) - helper->used);
+		if (slen < 0) {
+			if ((errno == EINTR) || (errno == EAGAIN)) continue;
+			REDEBUG("Failed reading from ntlm_auth helper %i: %s", helper->id, fr_syserror(errno));
+			return -1;
+		}
+
+		if (slen == 0) {
+			REDEBUG("ntlm_auth helper %i exited unexpectedly", helper->id);
+			return -1;
+		}
+
+		helper->used += slen;
+	}
+}
+
+/*
+ *	Format a request for the helper.
+ */
+static ssize_t helper_request(char *out, size_t outlen,
+			      char const *username, char const *domain,
+			      uint8_t const *challenge, uint8_t const *response)
+{
+	char	username64[FR_BASE64_ENC_LENGTH(FR_MAX_STRING_LEN) + 1];
+	char	domain64[FR_BASE64_ENC_LENGTH(FR_MAX_STRING_LEN) + 1];
+	char	challenge_hex[(8 * 2) + 1];
+	char	response_hex[(24 * 2) + 1];
+	size_t	len;
+
+	if ((strlen(username) > FR_MAX_STRING_LEN) || (strlen(domain) > FR_MAX_STRING_LEN)) return -1;
+
+	fr_base64_encode(username64, sizeof(username64), (uint8_t const *) username, strlen(username));
+	fr_base64_encode(domain64, sizeof(domain64), (uint8_t const *) domain, strlen(domain));
+	fr_bin2hex(challenge_hex, challenge, 8);
+	fr_bin2hex(response_hex, response, 24);
+
+	len = snprintf(out, outlen,
+		       "Username:: %s\n"
+		       "%s%s%s"
+		       "LANMAN-Challenge: %s\n"
+		       "NT-Response: %s\n"
+		       "Request-User-Session-Key: Yes\n"
+		       ".\n",
+		       username64,
+		       *domain ? "NT-Domain:: " : "", domain64, *domain ? "\n" : "",
+		       challenge_hex, response_hex);
+	if (len >= outlen) return -1;
+
+	return len;
+}
+
+/** Authenticate an MS-CHAP response using one of the helpers
+ *
+ * @param[in] pool		of helpers.
+ * @param[in] request		being authenticated.
+ * @param[in] username		to pass to ntlm_auth.
+ * @param[in] domain		to pass to ntlm_auth.  May be empty.
+ * @param[in] challenge		8 byte challenge.
+ * @param[in] response		24 byte NT-Response.
+ * @param[out] nthashhash	the NT hash hash, from the User-Session-Key.
+ * @param[out] error		from ntlm_auth, if the user was rejected.
+ * @param[in] error_len		length of the error buffer.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the user was rejected.
+ *	- -2 if no helper could be used.
+ */
+int ntlm_helper_auth(ntlm_helper_pool_t *pool, REQUEST *request,
+		     char const *username, char const *domain,
+		     uint8_t const *challenge, uint8_t const *response,
+		     uint8_t nthashhash[NT_DIGEST_LENGTH], char *error, size_t error_len)
+{
+	ntlm_helper_t		*helper;
+	ntlm_helper_reply_t	reply;
+	char			buffer[1024];
+	ssize_t			len;
+	uint64_t		seq;
+	uint32_t		generation;
+	int			i, rcode;
+
+	*error = '\0';
+
+	len = helper_request(buffer, sizeof(buffer), username, domain, challenge, response);
+	if (len < 0) {
+		REDEBUG("Username or domain is too long");
+		return -2;
+	}
+
+	pthread_mutex_lock(&pool->mutex);
+
+	/*
+	 *	If the helper has gone away, the write fails, and
+	 *	the request can safely be sent to another helper.
+	 */
+	for (i = 0; i < 2; i++) {
+		helper = helper_pick(pool);
+		if (!helper) break;
+
+		if (helper_write(helper, buffer, len) == 0) break;
+
+		RWDEBUG("Failed writing to ntlm_auth helper %i: %s", helper->id, fr_syserror(errno));
+		helper_fail(helper);
+		helper = NULL;
+	}
+
+	if (!helper) {
+		helper_unlock(pool);
+		REDEBUG("No ntlm_auth helpers are available");
+		return -2;
+	}
+
+	RDEBUG3("Sent request to ntlm_auth helper %i", helper->id);
+
+	seq = helper->sent++;
+	generation = helper->generation;
+	if (pool->max_uses && (helper->sent >= pool->max_uses)) helper->accepting = false;
+
+	/*
+	 *	Wait until the responses to earlier requests have
+	 *	been read.
+	 */
+	while ((helper->generation == generation) && !helper->failed && (helper->received < seq)) {
+		pthread_cond_wait(&pool->cond, &pool->mutex);
+	}
+
+	if ((helper->generation != generation) || helper->failed) {
+		helper_unlock(pool);
+		REDEBUG("ntlm_auth helper %i failed before responding", helper->id);
+		return -2;
+	}
+
+	helper->reading = true;
+	pthread_mutex_unlock(&pool->mutex);
+
+	rcode = helper_read(helper, request, &reply);
+
+	pthread_mutex_lock(&pool->mutex);
+	helper->reading = false;
+
+	if (rcode < 0) {
+		helper_fail(helper);
+	} else {
+		helper->received++;
+
+		/*
+		 *	Stop the helper if it failed while we were
+		 *	reading, or if it has been used enough.
+		 */
+		if (helper->failed || (!helper->accepting && (helper->received == helper->sent))) {
+			helper_stop(helper);
+		}
+	}
+	pthread_cond_broadcast(&pool->cond);
+	helper_unlock(pool);
+
+	if (rcode < 0) return -2;
+
+	if (!reply.authenticated) {
+		strlcpy(error, reply.error, error_len);
+		return -1;
+	}
+
+	if (!reply.have_key) {
+		REDEBUG("Invalid response from ntlm_auth helper: No User-Session-Key");
+		return -1;
+	}
+
+	memcpy(nthashhash, reply.key, NT_DIGEST_LENGTH);
+
+	return 0;
+}
+
+static int _helper_pool_free(ntlm_helper_pool_t *pool)
+{
+	uint32_t i;
+
+	pthread_mutex_lock(&pool->mutex);
+	for (i = 0; i < pool->num; i++) {
+		pool->helpers[i].failed = true;
+		helper_stop(&pool->helpers[i]);
+	}
+	helper_unlock(pool);
+
+	pthread_mutex_destroy(&pool->mutex);
+	pthread_cond_destroy(&pool->cond);
+
+	return 0;
+}
+
+/** Create a pool of ntlm_auth helpers
+ *
+ * Helpers are started as they're needed, so nothing is run here.
+ *
+ * @param[in] ctx		to allocate the pool in.
+ * @param[in] name		of the module instance, for log messages.
+ * @param[in] program		command line to run.
+ * @param[in] num		maximum number of helpers to run.
+ * @param[in] max_pending	requests which may be outstanding on one helper.
+ * @param[in] max_uses		requests before a helper is replaced.  0 means no limit.
+ * @param[in] retry_delay	seconds to wait before starting a helper which failed.
+ * @param[in] timeout		seconds to wait for a response.
+ * @return
+ *	- The new pool.
+ *	- NULL on error.
+ */
+ntlm_helper_pool_t *ntlm_helper_pool_create(TALLOC_CTX *ctx, char const *name, char const *program,
+					    uint32_t num, uint32_t max_pending, uint32_t max_uses,
+					    uint32_t retry_delay, uint32_t timeout)
+{
+	ntlm_helper_pool_t	*pool;
+	uint32_t		i;
+	int			ret;
+
+	rad_assert((num > 0) && (num <= NTLM_HELPER_MAX_NUM));
+	rad_assert(max_pending > 0);
+
+	MEM(pool = talloc_zero(ctx, ntlm_helper_pool_t));
+	pool->name = name;
+	pool->program = program;
+	pool->num = num;
+	pool->max_pending = max_pending;
+	pool->max_uses = max_uses;
+	pool->retry_delay = retry_delay;
+	pool->timeout = timeout;
+
+	MEM(pool->helpers = talloc_zero_array(pool, ntlm_helper_t, num));
+	for (i = 0; i < num; i++) {
+		ntlm_helper_t *helper = &pool->helpers[i];
+
+		helper->pool = pool;
+		helper->id = i;
+		helper->pid = helper->exited = -1;
+		helper->to_child = helper->from_child = -1;
+	}
+
+	ret = pthread_mutex_init(&pool->mutex, NULL);
+	if (ret != 0) {
+		ERROR("%s: Failed initializing helper mutex: %s", name, fr_syserror(ret));
+		talloc_free(pool);
+		return NULL;
+	}
+
+	ret = pthread_cond_init(&pool->cond, NULL);
+	if (ret != 0) {
+		ERROR("%s: Failed initializing helper condition: %s", name, fr_syserror(ret));
+		pthread_mutex_destroy(&pool->mutex);
+		talloc_free(pool);
+		return NULL;
+	}
+	talloc_set_destructor(pool, _helper_pool_free);
+
+	return pool;
+}
@@ -0,0 +1,22 @@
+/* Copyright 2017 The FreeRADIUS server project */
+
+#ifndef _NTLM_HELPER_H
+#define _NTLM_HELPER_H
+
+RCSIDH(ntlm_helper_h, "$Id$")
+
+#define NTLM_HELPER_MAX_NUM	64
+#define NTLM_HELPER_MAX_PENDING	64
+
+typedef struct ntlm_helper_pool ntlm_helper_pool_t;
+
+ntlm_helper_pool_t *ntlm_helper_pool_create(TALLOC_CTX *ctx, char const *name, char const *program,
+					    uint32_t num, uint32_t max_pending, uint32_t max_uses,
+					    uint32_t retry_delay, uint32_t timeout);
+
+int ntlm_helper_auth(ntlm_helper_pool_t *pool, REQUEST *request,
+		     char const *username, char const *domain,
+		     uint8_t const *challenge, uint8_t const *response,
+		     uint8_t nthashhash[NT_DIGEST_LENGTH], char *error, size_t error_len);
+
+#endif /*_NTLM_HELPER_H*/
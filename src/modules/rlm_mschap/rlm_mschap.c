@@ -36,6 +36,7 @@ RCSID("$Id$")
 #include "rlm_mschap.h"
 #include "mschap.h"
 #include "smbdes.h"
+#include "ntlm_helper.h"
 
 #ifdef WITH_AUTH_WINBIND
 #include "auth_wbclient.h"
@@ -548,6 +549,17 @@ static const CONF_PARSER passchange_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER helper_config[] = {
+	{ FR_CONF_OFFSET("program", PW_TYPE_STRING, rlm_mschap_t, helper_program) },
+	{ FR_CONF_OFFSET("username", PW_TYPE_TMPL, rlm_mschap_t, helper_username) },
+	{ FR_CONF_OFFSET("domain", PW_TYPE_TMPL, rlm_mschap_t, helper_domain) },
+	{ FR_CONF_OFFSET("num_helpers", PW_TYPE_INTEGER, rlm_mschap_t, helper_num), .dflt = "4" },
+	{ FR_CONF_OFFSET("max_pending", PW_TYPE_INTEGER, rlm_mschap_t, helper_max_pending), .dflt = "8" },
+	{ FR_CONF_OFFSET("max_uses", PW_TYPE_INTEGER, rlm_mschap_t, helper_max_uses), .dflt = "0" },
+	{ FR_CONF_OFFSET("retry_delay", PW_TYPE_INTEGER, rlm_mschap_t, helper_retry_delay), .dflt = "1" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	/*
 	 *	Cache the password by default.
@@ -558,6 +570,7 @@ static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("with_ntdomain_hack", PW_TYPE_BOOLEAN, rlm_mschap_t, with_ntdomain_hack), .dflt = "yes" },
 	{ FR_CONF_OFFSET("ntlm_auth", PW_TYPE_STRING | PW_TYPE_XLAT, rlm_mschap_t, ntlm_auth) },
 	{ FR_CONF_OFFSET("ntlm_auth_timeout", PW_TYPE_INTEGER, rlm_mschap_t, ntlm_auth_timeout) },
+	{ FR_CONF_POINTER("ntlm_auth_helper", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) helper_config },
 	{ FR_CONF_POINTER("passchange", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) passchange_config },
 	{ FR_CONF_OFFSET("allow_retry", PW_TYPE_BOOLEAN, rlm_mschap_t, allow_retry), .dflt = "yes" },
 	{ FR_CONF_OFFSET("retry_msg", PW_TYPE_STRING, rlm_mschap_t, retry_msg) },
@@ -631,6 +644,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		inst->method = AUTH_NTLMAUTH_EXEC;
 	}
 
+	/*
+	 *	Unless persistent helpers have been configured, in
+	 *	which case they're used instead of running ntlm_auth
+	 *	for every request.
+	 */
+	if (inst->helper_program) {
+		inst->method = AUTH_NTLMAUTH_HELPER;
+	}
+
 	switch (inst->method) {
 	case AUTH_INTERNAL:
 		DEBUG("%s: using internal authentication", inst->xlat_name);
@@ -638,6 +660,9 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	case AUTH_NTLMAUTH_EXEC:
 		DEBUG("%s : authenticating by calling 'ntlm_auth'", inst->xlat_name);
 		break;
+	case AUTH_NTLMAUTH_HELPER:
+		DEBUG("%s : authenticating with persistent 'ntlm_auth' helpers", inst->xlat_name);
+		break;
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 		DEBUG("%s : authenticating directly to winbind", inst->xlat_name);
@@ -662,19 +687,42 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	if (inst->method == AUTH_NTLMAUTH_HELPER) {
+		if (!inst->helper_username) {
+			cf_log_err_cs(conf, "'ntlm_auth_helper.username' must be set");
+			return -1;
+		}
+
+		FR_INTEGER_BOUND_CHECK("num_helpers", inst->helper_num, >=, 1);
+		FR_INTEGER_BOUND_CHECK("num_helpers", inst->helper_num, <=, NTLM_HELPER_MAX_NUM);
+		FR_INTEGER_BOUND_CHECK("max_pending", inst->helper_max_pending, >=, 1);
+		FR_INTEGER_BOUND_CHECK("max_pending", inst->helper_max_pending, <=, NTLM_HELPER_MAX_PENDING);
+		FR_INTEGER_BOUND_CHECK("retry_delay", inst->helper_retry_delay, <=, 60);
+
+		inst->helper_pool = ntlm_helper_pool_create(inst, inst->xlat_name, inst->helper_program,
+							    inst->helper_num, inst->helper_max_pending,
+							    inst->helper_max_uses, inst->helper_retry_delay,
+							    inst->ntlm_auth_timeout);
+		if (!inst->helper_pool) {
+			cf_log_err_cs(conf, "Failed creating ntlm_auth helper pool");
+			return -1;
+		}
+	}
+
 	return 0;
 }
 
 /*
  *	Tidy up instance
  */
-static int mod_detach(UNUSED void *instance)
+static int mod_detach(void *instance)
 {
-#ifdef WITH_AUTH_WINBIND
 	rlm_mschap_t *inst = instance;
 
+#ifdef WITH_AUTH_WINBIND
 	fr_connection_pool_free(inst->wb_pool);
 #endif
+	talloc_free(inst->helper_pool);
 
 	return 0;
 }
@@ -1100,6 +1148,36 @@ ntlm_auth_err:
 	return -1;
 }
 
+/*
+ *	Map the errors printed by ntlm_auth to MS-CHAP error codes.
+ */
+static int ntlm_auth_error(char const *msg)
+{
+	/*
+	 *	look for "Password expired", or "Must change password".
+	 */
+	if (strcasestr(msg, "Password expired") ||
+	    strcasestr(msg, "Must change password") ||
+	    strcasestr(msg, "NT_STATUS_PASSWORD_EXPIRED") ||
+	    strcasestr(msg, "NT_STATUS_PASSWORD_MUST_CHANGE")) {
+		return -648;
+	}
+
+	if (strcasestr(msg, "Account locked out") ||
+	    strcasestr(msg, "NT_STATUS_ACCOUNT_LOCKED_OUT") ||
+	    strcasestr(msg, "0xC0000234")) {
+		return -647;
+	}
+
+	if (strcasestr(msg, "Account disabled") ||
+	    strcasestr(msg, "NT_STATUS_ACCOUNT_DISABLED") ||
+	    strcasestr(msg, "0xC0000072")) {
+		return -691;
+	}
+
+	return -1;
+}
+
 /*
  *	Do the MS-CHAP stuff.
  *
@@ -1163,25 +1241,10 @@ static int CC_HINT(nonnull (1, 2, 4, 5 ,6)) do_mschap(rlm_mschap_t const *inst,
 		if (result != 0) {
 			char *p;
 
-			/*
-			 *	look for "Password expired", or "Must change password".
-			 */
-			if (strcasestr(buffer, "Password expired") ||
-			    strcasestr(buffer, "Must change password")) {
-				REDEBUG2("%s", buffer);
-				return -648;
-			}
-
-			if (strcasestr(buffer, "Account locked out") ||
-			    strcasestr(buffer, "0xC0000234")) {
+			result = ntlm_auth_error(buffer);
+			if (result != -1) {
 				REDEBUG2("%s", buffer);
-				return -647;
-			}
-
-			if (strcasestr(buffer, "Account disabled") ||
-			    strcasestr(buffer, "0xC0000072")) {
-				REDEBUG2("%s", buffer);
-				return -691;
+				return result;
 			}
 
 			RDEBUG2("External script failed");
@@ -1224,6 +1287,49 @@ static int CC_HINT(nonnull (1, 2, 4, 5 ,6)) do_mschap(rlm_mschap_t const *inst,
 
 		break;
 		}
+	case AUTH_NTLMAUTH_HELPER:
+	/*
+	 *	Pass the request to a persistent ntlm_auth helper
+	 */
+		{
+		int		result;
+		char		error[256];
+		char		user_buff[FR_MAX_STRING_LEN + 1], domain_buff[FR_MAX_STRING_LEN + 1];
+		char const	*username, *domain = "";
+
+		if (tmpl_expand(&username, user_buff, sizeof(user_buff), request,
+				inst->helper_username, NULL, NULL) < 0) {
+			REDEBUG2("Unable to expand ntlm_auth_helper.username");
+			return -1;
+		}
+
+		if (inst->helper_domain &&
+		    (tmpl_expand(&domain, domain_buff, sizeof(domain_buff), request,
+				 inst->helper_domain, NULL, NULL) < 0)) {
+			REDEBUG2("Unable to expand ntlm_auth_helper.domain");
+			return -1;
+		}
+
+		result = ntlm_helper_auth(inst->helper_pool, request, username, domain,
+					  challenge, response, nthashhash, error, sizeof(error));
+		if (result == -1) {
+			if (!*error) return -1;
+
+			result = ntlm_auth_error(error);
+			if (result != -1) {
+				REDEBUG2("%s", error);
+				return result;
+			}
+
+			REDEBUG("ntlm_auth helper says: %s", error);
+			return -1;
+		}
+
+		if (result < 0) return -1;
+
+		break;
+		}
+
 #ifdef WITH_AUTH_WINBIND
 	case AUTH_WBCLIENT:
 	/*
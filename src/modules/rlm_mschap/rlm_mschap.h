@@ -16,9 +16,10 @@ RCSIDH(rlm_mschap_h, "$Id$")
 /* Method of authentication we are going to use */
 typedef enum {
 	AUTH_INTERNAL		= 0,
-	AUTH_NTLMAUTH_EXEC	= 1
+	AUTH_NTLMAUTH_EXEC	= 1,
+	AUTH_NTLMAUTH_HELPER	= 2
 #ifdef WITH_AUTH_WINBIND
-	,AUTH_WBCLIENT       	= 2
+	,AUTH_WBCLIENT       	= 3
 #endif
 } MSCHAP_AUTH_METHOD;
 
@@ -40,6 +41,14 @@ typedef struct rlm_mschap_t {
 	MSCHAP_AUTH_METHOD	method;
 	vp_tmpl_t		*wb_username;
 	vp_tmpl_t		*wb_domain;
+	char const		*helper_program;
+	vp_tmpl_t		*helper_username;
+	vp_tmpl_t		*helper_domain;
+	uint32_t		helper_num;
+	uint32_t		helper_max_pending;
+	uint32_t		helper_max_uses;
+	uint32_t		helper_retry_delay;
+	struct ntlm_helper_pool	*helper_pool;
 #ifdef WITH_AUTH_WINBIND
 	fr_connection_pool_t	*wb_pool;
 	bool			wb_retry_with_normalised_username;
@@ -75,6 +75,8 @@ typedef struct rlm_perl_t {
 #endif
 	char const	*xlat_name;
 	char const	*perl_flags;
+	bool		lazy_attributes;	//!< Tie the %RAD_* hashes to the attribute lists,
+						//!< instead of copying the lists in and out.
 	PerlInterpreter	*perl;
 	bool		perl_parsed;
 	pthread_key_t	*thread_key;
@@ -113,6 +115,7 @@ static const CONF_PARSER module_config[] = {
 	RLM_PERL_CONF(send_coa),
 #endif
 	{ FR_CONF_OFFSET("perl_flags", PW_TYPE_STRING, rlm_perl_t, perl_flags) },
+	{ FR_CONF_OFFSET("lazy_attributes", PW_TYPE_BOOLEAN, rlm_perl_t, lazy_attributes), .dflt = "no" },
 
 	{ FR_CONF_OFFSET("func_start_accounting", PW_TYPE_STRING, rlm_perl_t, func_start_accounting) },
 
@@ -330,6 +333,503 @@ static XS(XS_radiusd_xlat)
 	XSRETURN(1);
 }
 
+/*
+ *	Convert a VALUE_PAIR to a perl scalar.  Index is the position
+ *	of the value in an array ref, or -1 if it's stored directly.
+ */
+static SV *perl_vp_to_sv(REQUEST *request, VALUE_PAIR const *vp, int i,
+			 char const *hash_name, char const *list_name)
+{
+	size_t	len;
+	char	buffer[1024];
+	char	index[16] = "";
+
+	if (i >= 0) snprintf(index, sizeof(index), "[%i]", i);
+
+	switch (vp->vp_type) {
+	case PW_TYPE_STRING:
+		RDEBUG("$%s{'%s'}%s = &%s:%s -> '%s'", hash_name, vp->da->name, index,
+		       list_name, vp->da->name, vp->vp_strvalue);
+		return newSVpvn(vp->vp_strvalue, vp->vp_length);
+
+	case PW_TYPE_OCTETS:
+		if (RDEBUG_ENABLED) {
+			char *hex;
+
+			hex = fr_abin2hex(request, vp->vp_octets, vp->vp_length);
+			RDEBUG("$%s{'%s'}%s = &%s:%s -> 0x%s", hash_name, vp->da->name, index,
+			       list_name, vp->da->name, hex);
+			talloc_free(hex);
+		}
+		return newSVpvn((char const *)vp->vp_octets, vp->vp_length);
+
+	default:
+		len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, 0);
+		RDEBUG("$%s{'%s'}%s = &%s:%s -> '%s'", hash_name, vp->da->name, index,
+		       list_name, vp->da->name, buffer);
+		return newSVpvn(buffer, truncate_len(len, sizeof(buffer)));
+	}
+}
+
+/*
+ *
+ *     Verify that a Perl SV is a string and save it in FreeRadius
+ *     Value Pair Format
+ *
+ */
+static int pairadd_sv(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **vps, char *key, SV *sv, FR_TOKEN op,
+		      const char *hash_name, const char *list_name)
+{
+	char		*val;
+	VALUE_PAIR      *vp;
+	STRLEN		len;
+
+	if (!SvOK(sv)) return -1;
+
+	val = SvPV(sv, len);
+	vp = fr_pair_make(ctx, vps, key, NULL, op);
+	if (!vp) {
+	fail:
+		REDEBUG("Failed to create pair %s:%s %s %s", list_name, key,
+			fr_int2str(fr_tokens_table, op, "<INVALID>"), val);
+		return -1;
+	}
+
+	switch (vp->vp_type) {
+	case PW_TYPE_STRING:
+		fr_pair_value_bstrncpy(vp, val, len);
+		break;
+
+	case PW_TYPE_OCTETS:
+		fr_pair_value_memcpy(vp, (uint8_t const *)val, len);
+		break;
+
+	default:
+		if (fr_pair_value_from_str(vp, val, len) < 0) goto fail;
+	}
+
+	VERIFY_VP(vp);
+
+	RDEBUG("&%s:%s %s $%s{'%s'} -> '%s'", list_name, key, fr_int2str(fr_tokens_table, op, "<INVALID>"),
+	       hash_name, key, val);
+	return 0;
+}
+
+/*
+ *	Update the cached copies of User-Name and User-Password
+ */
+static void perl_request_fixup(REQUEST *request)
+{
+	request->username = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_NAME, TAG_ANY);
+	request->password = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY);
+	if (!request->password)
+		request->password = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD,
+							TAG_ANY);
+}
+
+/** An attribute list tied to one of the %RAD_* hashes
+ *
+ * Used when lazy_attributes is enabled.  Attributes are only converted
+ * when the script reads them, and changes are made directly to the list.
+ *
+ * Attributes with more than one instance are the exception.  Their values
+ * are an array, which the script may change in place, so they're handled
+ * as they are without lazy_attributes.  The array is kept, and written back
+ * to the list when the call returns.
+ */
+typedef struct rlm_perl_list {
+	REQUEST		*request;	//!< The current request.
+	TALLOC_CTX	*ctx;		//!< To allocate new attributes in.
+	VALUE_PAIR	**vps;		//!< The attribute list.
+	char const	*hash_name;	//!< Name of the perl hash, for debug messages.
+	char const	*list_name;	//!< Name of the list, for debug messages.
+	VALUE_PAIR	*iter;		//!< The next attribute to return from NEXTKEY.
+	HV		*arrays;	//!< Arrays given to the script, by key.
+} rlm_perl_list_t;
+
+#define PERL_LIST_CLASS "radiusd::list"
+
+/*
+ *	Tagged attributes use <attribute>:<tag> as the key,
+ *	so tagged and untagged instances are different keys.
+ */
+#define PERL_LIST_TAG(_vp) (((_vp)->da->flags.has_tag && ((_vp)->tag != TAG_ANY)) ? (_vp)->tag : TAG_ANY)
+
+static rlm_perl_list_t *perl_list_from_sv(SV *sv)
+{
+	rlm_perl_list_t *list;
+
+	if (!sv_isobject(sv) || !sv_derived_from(sv, PERL_LIST_CLASS)) croak("Not a " PERL_LIST_CLASS " object");
+
+	/*
+	 *	The pointer is cleared when the call returns.
+	 */
+	list = INT2PTR(rlm_perl_list_t *, SvIV(SvRV(sv)));
+	if (!list) croak("Attribute list used after the call it was passed to returned");
+
+	return list;
+}
+
+/*
+ *	Resolve a hash key to an attribute and a tag.
+ */
+static int perl_list_key(SV *key_sv, fr_dict_attr_t const **da, int8_t *tag)
+{
+	char const	*key, *p;
+	char		buffer[256];
+	STRLEN		len;
+
+	key = SvPV(key_sv, len);
+	*tag = TAG_ANY;
+
+	p = memchr(key, ':', len);
+	if (p) {
+		char		*q;
+		unsigned long	num;
+
+		num = strtoul(p + 1, &q, 10);
+		if ((q == p + 1) || (q != key + len) || !TAG_VALID_ZERO(num)) return -1;
+
+		*tag = num;
+		len = p - key;
+	}
+
+	if (len >= sizeof(buffer)) return -1;
+	memcpy(buffer, key, len);
+	buffer[len] = '\0';
+
+	*da = fr_dict_attr_by_name(NULL, buffer);
+	if (!*da) return -1;
+	if ((*tag != TAG_ANY) && !(*da)->flags.has_tag) return -1;
+
+	return 0;
+}
+
+/*
+ *	Key for the arrays hash, so that every spelling of
+ *	an attribute name finds the same array.
+ */
+static size_t perl_list_array_key(char *buffer, size_t len, fr_dict_attr_t const *da, int8_t tag)
+{
+	if (tag != TAG_ANY) return snprintf(buffer, len, "%s:%d", da->name, tag);
+
+	return snprintf(buffer, len, "%s", da->name);
+}
+
+/*
+ *	Add every value in an array to the list, as
+ *	get_hv_content does.
+ */
+static void perl_list_add_av(rlm_perl_list_t *list, char *key, AV *av)
+{
+	I32 i, len;
+
+	len = av_len(av);
+	for (i = 0; i <= len; i++) {
+		SV **av_sv;
+
+		av_sv = av_fetch(av, i, 0);
+		if (!av_sv) continue;
+
+		(void)pairadd_sv(list->ctx, list->request, list->vps, key, *av_sv, T_OP_ADD,
+				 list->hash_name, list->list_name);
+	}
+}
+
+/*
+ *	Build the value for a key, as perl_store_vps would have.
+ */
+static SV *perl_list_fetch(rlm_perl_list_t *list, fr_dict_attr_t const *da, int8_t tag)
+{
+	REQUEST		*request = list->request;
+	VALUE_PAIR	*vp, *found = NULL;
+	AV		*av = NULL;
+	int		i = 0;
+
+	for (vp = *list->vps; vp; vp = vp->next) {
+		if ((vp->da != da) || (PERL_LIST_TAG(vp) != tag)) continue;
+
+		if (!found) {
+			found = vp;
+			continue;
+		}
+
+		if (!av) {
+			av = newAV();
+			av_push(av, perl_vp_to_sv(request, found, i++, list->hash_name, list->list_name));
+		}
+		av_push(av, perl_vp_to_sv(request, vp, i++, list->hash_name, list->list_name));
+	}
+
+	if (av) return newRV_noinc((SV *)av);
+	if (found) return perl_vp_to_sv(request, found, -1, list->hash_name, list->list_name);
+
+	return NULL;
+}
+
+static void perl_list_delete(rlm_perl_list_t *list, fr_dict_attr_t const *da, int8_t tag)
+{
+	VALUE_PAIR	*vp, *next;
+	VALUE_PAIR	**last = list->vps;
+
+	for (vp = *list->vps; vp; vp = next) {
+		next = vp->next;
+
+		if ((vp->da != da) || (PERL_LIST_TAG(vp) != tag)) {
+			last = &vp->next;
+			continue;
+		}
+
+		if (vp == list->iter) list->iter = next;
+		*last = next;
+		talloc_free(vp);
+	}
+
+	if (list->vps == &list->request->packet->vps) perl_request_fixup(list->request);
+}
+
+/*
+ *	Return the key for list->iter, and move it to the next key.
+ */
+static SV *perl_list_next_key(rlm_perl_list_t *list)
+{
+	VALUE_PAIR	*vp = list->iter;
+	int8_t		tag;
+
+	if (!vp) return NULL;
+
+	tag = PERL_LIST_TAG(vp);
+	while (list->iter && (list->iter->da == vp->da) && (PERL_LIST_TAG(list->iter) == tag)) {
+		list->iter = list->iter->next;
+	}
+
+	if (tag != TAG_ANY) return newSVpvf("%s:%d", vp->da->name, tag);
+
+	return newSVpv(vp->da->name, 0);
+}
+
+static XS(XS_radiusd_list_FETCH)
+{
+	dXSARGS;
+	rlm_perl_list_t		*list;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	SV			*sv, **array;
+	char			key[256];
+	size_t			key_len;
+
+	if (items != 2) croak("Usage: " PERL_LIST_CLASS "::FETCH(this, key)");
+
+	list = perl_list_from_sv(ST(0));
+	if (perl_list_key(ST(1), &da, &tag) < 0) XSRETURN_UNDEF;
+
+	/*
+	 *	Return the same array every time, so changes
+	 *	made to it are seen, and written back.
+	 */
+	key_len = perl_list_array_key(key, sizeof(key), da, tag);
+	array = hv_fetch(list->arrays, key, key_len, 0);
+	if (array) {
+		ST(0) = sv_2mortal(newSVsv(*array));
+		XSRETURN(1);
+	}
+
+	sv = perl_list_fetch(list, da, tag);
+	if (!sv) XSRETURN_UNDEF;
+
+	if (SvROK(sv)) (void)hv_store(list->arrays, key, key_len, newSVsv(sv), 0);
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_list_STORE)
+{
+	dXSARGS;
+	rlm_perl_list_t		*list;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	REQUEST			*request;
+	char			*key, array_key[256];
+	size_t			array_key_len;
+	SV			*value;
+
+	if (items != 3) croak("Usage: " PERL_LIST_CLASS "::STORE(this, key, value)");
+
+	list = perl_list_from_sv(ST(0));
+	request = list->request;
+	key = SvPV_nolen(ST(1));
+	value = ST(2);
+
+	if (perl_list_key(ST(1), &da, &tag) < 0) {
+		REDEBUG("Failed to create pair %s:%s, unknown attribute", list->list_name, key);
+		XSRETURN_EMPTY;
+	}
+
+	/*
+	 *	Assigning to a key replaces every instance
+	 *	of the attribute.
+	 */
+	perl_list_delete(list, da, tag);
+
+	array_key_len = perl_list_array_key(array_key, sizeof(array_key), da, tag);
+	(void)hv_delete(list->arrays, array_key, array_key_len, G_DISCARD);
+
+	if (SvROK(value) && (SvTYPE(SvRV(value)) == SVt_PVAV)) {
+		perl_list_add_av(list, key, (AV *)SvRV(value));
+
+		/*
+		 *	push @{$RAD_REPLY{...}} stores an empty
+		 *	array, then adds to it, so it has to be
+		 *	written back again later.
+		 */
+		(void)hv_store(list->arrays, array_key, array_key_len, newSVsv(value), 0);
+	} else {
+		(void)pairadd_sv(list->ctx, request, list->vps, key, value, T_OP_EQ,
+				 list->hash_name, list->list_name);
+	}
+
+	if (list->vps == &request->packet->vps) perl_request_fixup(request);
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_radiusd_list_EXISTS)
+{
+	dXSARGS;
+	rlm_perl_list_t		*list;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	VALUE_PAIR		*vp;
+
+	if (items != 2) croak("Usage: " PERL_LIST_CLASS "::EXISTS(this, key)");
+
+	list = perl_list_from_sv(ST(0));
+	if (perl_list_key(ST(1), &da, &tag) < 0) XSRETURN_NO;
+
+	{
+		char	key[256];
+		size_t	key_len;
+
+		key_len = perl_list_array_key(key, sizeof(key), da, tag);
+		if (hv_exists(list->arrays, key, key_len)) XSRETURN_YES;
+	}
+
+	for (vp = *list->vps; vp; vp = vp->next) {
+		if ((vp->da == da) && (PERL_LIST_TAG(vp) == tag)) XSRETURN_YES;
+	}
+
+	XSRETURN_NO;
+}
+
+static XS(XS_radiusd_list_DELETE)
+{
+	dXSARGS;
+	rlm_perl_list_t		*list;
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	SV			*sv;
+	char			key[256];
+	size_t			key_len;
+
+	if (items != 2) croak("Usage: " PERL_LIST_CLASS "::DELETE(this, key)");
+
+	list = perl_list_from_sv(ST(0));
+	if (perl_list_key(ST(1), &da, &tag) < 0) XSRETURN_UNDEF;
+
+	/*
+	 *	The array may have been changed, so return
+	 *	that rather than what's in the list.
+	 */
+	key_len = perl_list_array_key(key, sizeof(key), da, tag);
+	sv = hv_delete(list->arrays, key, key_len, 0);
+	if (sv) {
+		sv = newSVsv(sv);
+	} else {
+		sv = perl_list_fetch(list, da, tag);
+	}
+	if (!sv) XSRETURN_UNDEF;
+
+	perl_list_delete(list, da, tag);
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_list_CLEAR)
+{
+	dXSARGS;
+	rlm_perl_list_t	*list;
+
+	if (items != 1) croak("Usage: " PERL_LIST_CLASS "::CLEAR(this)");
+
+	list = perl_list_from_sv(ST(0));
+
+	fr_pair_list_free(list->vps);
+	hv_clear(list->arrays);
+	list->iter = NULL;
+	if (list->vps == &list->request->packet->vps) perl_request_fixup(list->request);
+
+	XSRETURN_EMPTY;
+}
+
+static XS(XS_radiusd_list_FIRSTKEY)
+{
+	dXSARGS;
+	rlm_perl_list_t	*list;
+	SV		*sv;
+
+	if (items != 1) croak("Usage: " PERL_LIST_CLASS "::FIRSTKEY(this)");
+
+	list = perl_list_from_sv(ST(0));
+
+	/*
+	 *	Sorting puts all instances of an attribute
+	 *	next to each other, so each key is only
+	 *	returned once.
+	 */
+	fr_pair_list_sort(list->vps, fr_pair_cmp_by_da_tag);
+	list->iter = *list->vps;
+
+	sv = perl_list_next_key(list);
+	if (!sv) XSRETURN_UNDEF;
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_list_NEXTKEY)
+{
+	dXSARGS;
+	rlm_perl_list_t	*list;
+	SV		*sv;
+
+	if (items != 2) croak("Usage: " PERL_LIST_CLASS "::NEXTKEY(this, lastkey)");
+
+	list = perl_list_from_sv(ST(0));
+
+	sv = perl_list_next_key(list);
+	if (!sv) XSRETURN_UNDEF;
+
+	ST(0) = sv_2mortal(sv);
+	XSRETURN(1);
+}
+
+static XS(XS_radiusd_list_SCALAR)
+{
+	dXSARGS;
+	rlm_perl_list_t	*list;
+	VALUE_PAIR	*vp;
+	IV		count = 0;
+
+	if (items != 1) croak("Usage: " PERL_LIST_CLASS "::SCALAR(this)");
+
+	list = perl_list_from_sv(ST(0));
+	for (vp = *list->vps; vp; vp = vp->next) count++;
+
+	XSRETURN_IV(count);
+}
+
 static void xs_init(pTHX)
 {
 	char const *file = __FILE__;
@@ -339,6 +839,15 @@ static void xs_init(pTHX)
 
 	newXS("radiusd::radlog",XS_radiusd_radlog, "rlm_perl");
 	newXS("radiusd::xlat",XS_radiusd_xlat, "rlm_perl");
+
+	newXS(PERL_LIST_CLASS "::FETCH", XS_radiusd_list_FETCH, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::STORE", XS_radiusd_list_STORE, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::EXISTS", XS_radiusd_list_EXISTS, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::DELETE", XS_radiusd_list_DELETE, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::CLEAR", XS_radiusd_list_CLEAR, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::FIRSTKEY", XS_radiusd_list_FIRSTKEY, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::NEXTKEY", XS_radiusd_list_NEXTKEY, "rlm_perl");
+	newXS(PERL_LIST_CLASS "::SCALAR", XS_radiusd_list_SCALAR, "rlm_perl");
 }
 
 /*
@@ -361,13 +870,16 @@ static ssize_t perl_xlat(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 #ifdef USE_ITHREADS
 	PerlInterpreter *interp;
 
-	pthread_mutex_lock(&inst->clone_mutex);
-	interp = rlm_perl_clone(inst->perl, inst->thread_key);
+	interp = pthread_getspecific(*inst->thread_key);
+	if (!interp) {
+		pthread_mutex_lock(&inst->clone_mutex);
+		interp = rlm_perl_clone(inst->perl, inst->thread_key);
+		pthread_mutex_unlock(&inst->clone_mutex);
+	}
 	{
 		dTHXa(interp);
 		PERL_SET_CONTEXT(interp);
 	}
-	pthread_mutex_unlock(&inst->clone_mutex);
 #else
 	PERL_SET_CONTEXT(inst->perl);
 #endif
@@ -617,42 +1129,6 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
-static void perl_vp_to_svpvn_element(REQUEST *request, AV *av, VALUE_PAIR const *vp,
-				     int *i, const char *hash_name, const char *list_name)
-{
-	size_t len;
-
-	char buffer[1024];
-
-	switch (vp->vp_type) {
-	case PW_TYPE_STRING:
-		RDEBUG("$%s{'%s'}[%i] = &%s:%s -> '%s'", hash_name, vp->da->name, *i,
-		       list_name, vp->da->name, vp->vp_strvalue);
-		av_push(av, newSVpvn(vp->vp_strvalue, vp->vp_length));
-		break;
-
-	case PW_TYPE_OCTETS:
-		if (RDEBUG_ENABLED) {
-			char *hex;
-
-			hex = fr_abin2hex(request, vp->vp_octets, vp->vp_length);
-			RDEBUG("$%s{'%s'}[%i] = &%s:%s -> 0x%s", hash_name, vp->da->name, *i,
-			       list_name, vp->da->name, hex);
-			talloc_free(hex);
-		}
-		av_push(av, newSVpvn((char const *)vp->vp_octets, vp->vp_length));
-		break;
-
-	default:
-		len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, 0);
-		RDEBUG("$%s{'%s'}[%i] = &%s:%s -> '%s'", hash_name, vp->da->name, *i,
-		       list_name, vp->da->name, buffer);
-		av_push(av, newSVpvn(buffer, truncate_len(len, sizeof(buffer))));
-		break;
-	}
-	(*i)++;
-}
-
 /*
  *  	get the vps and put them in perl hash
  *  	If one VP have multiple values it is added as array_ref
@@ -677,9 +1153,6 @@ static void perl_store_vps(UNUSED TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR
 
 		char const *name;
 		char namebuf[256];
-		char buffer[1024];
-
-		size_t len;
 
 		/*
 		 *	Tagged attributes are added to the hash with name
@@ -702,9 +1175,9 @@ static void perl_store_vps(UNUSED TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR
 			AV *av;
 
 			av = newAV();
-			perl_vp_to_svpvn_element(request, av, vp, &i, hash_name, list_name);
+			av_push(av, perl_vp_to_sv(request, vp, i++, hash_name, list_name));
 			do {
-				perl_vp_to_svpvn_element(request, av, next, &i, hash_name, list_name);
+				av_push(av, perl_vp_to_sv(request, next, i++, hash_name, list_name));
 				fr_pair_cursor_next(&cursor);
 			} while ((next = fr_pair_cursor_next_peek(&cursor)) && ATTRIBUTE_EQ(vp, next));
 			(void)hv_store(rad_hv, name, strlen(name), newRV_noinc((SV *)av), 0);
@@ -715,80 +1188,74 @@ static void perl_store_vps(UNUSED TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR
 		/*
 		 *	It's a normal single valued attribute
 		 */
-		switch (vp->vp_type) {
-		case PW_TYPE_STRING:
-			RDEBUG("$%s{'%s'} = &%s:%s -> '%s'", hash_name, vp->da->name, list_name,
-			       vp->da->name, vp->vp_strvalue);
-			(void)hv_store(rad_hv, name, strlen(name), newSVpvn(vp->vp_strvalue, vp->vp_length), 0);
-			break;
-
-		case PW_TYPE_OCTETS:
-			if (RDEBUG_ENABLED) {
-				char *hex;
-
-				hex = fr_abin2hex(request, vp->vp_octets, vp->vp_length);
-				RDEBUG("$%s{'%s'} = &%s:%s -> 0x%s", hash_name, vp->da->name,
-				       list_name, vp->da->name, hex);
-				talloc_free(hex);
-			}
-			(void)hv_store(rad_hv, name, strlen(name),
-				       newSVpvn((char const *)vp->vp_octets, vp->vp_length), 0);
-			break;
-
-		default:
-			len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, 0);
-			RDEBUG("$%s{'%s'} = &%s:%s -> '%s'", hash_name, vp->da->name,
-			       list_name, vp->da->name, buffer);
-			(void)hv_store(rad_hv, name, strlen(name),
-				       newSVpvn(buffer, truncate_len(len, sizeof(buffer))), 0);
-			break;
-		}
+		(void)hv_store(rad_hv, name, strlen(name), perl_vp_to_sv(request, vp, -1, hash_name, list_name), 0);
 	}
 	REXDENT();
 }
 
 /*
- *
- *     Verify that a Perl SV is a string and save it in FreeRadius
- *     Value Pair Format
- *
+ *	Tie a perl hash to an attribute list.  Nothing is converted
+ *	until the script reads it.
  */
-static int pairadd_sv(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **vps, char *key, SV *sv, FR_TOKEN op,
-		      const char *hash_name, const char *list_name)
+static void perl_tie_vps(rlm_perl_list_t *list, TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **vps, HV *rad_hv,
+			 const char *hash_name, const char *list_name)
 {
-	char		*val;
-	VALUE_PAIR      *vp;
-	STRLEN		len;
+	SV *obj;
 
-	if (!SvOK(sv)) return -1;
+	list->request = request;
+	list->ctx = ctx;
+	list->vps = vps;
+	list->hash_name = hash_name;
+	list->list_name = list_name;
+	list->iter = NULL;
+	list->arrays = newHV();
 
-	val = SvPV(sv, len);
-	vp = fr_pair_make(ctx, vps, key, NULL, op);
-	if (!vp) {
-	fail:
-		REDEBUG("Failed to create pair %s:%s %s %s", list_name, key,
-			fr_int2str(fr_tokens_table, op, "<INVALID>"), val);
-		return -1;
-	}
+	hv_undef(rad_hv);
 
-	switch (vp->vp_type) {
-	case PW_TYPE_STRING:
-		fr_pair_value_bstrncpy(vp, val, len);
-		break;
+	obj = sv_setref_pv(newSV(0), PERL_LIST_CLASS, list);
+	sv_magic((SV *)rad_hv, obj, PERL_MAGIC_tied, NULL, 0);
+	SvREFCNT_dec(obj);
+}
 
-	case PW_TYPE_OCTETS:
-		fr_pair_value_memcpy(vp, (uint8_t const *)val, len);
-		break;
+static void perl_untie_vps(HV *rad_hv)
+{
+	MAGIC		*mg;
+	rlm_perl_list_t	*list;
+	HE		*he;
 
-	default:
-		if (fr_pair_value_from_str(vp, val, len) < 0) goto fail;
+	mg = mg_find((SV *)rad_hv, PERL_MAGIC_tied);
+	if (!mg) return;
+
+	/*
+	 *	Write back the arrays, which the script may
+	 *	have changed in place.
+	 */
+	list = perl_list_from_sv(mg->mg_obj);
+	hv_iterinit(list->arrays);
+	while ((he = hv_iternext(list->arrays))) {
+		fr_dict_attr_t const	*da;
+		int8_t			tag;
+		SV			*key = hv_iterkeysv(he);
+		SV			*value = hv_iterval(list->arrays, he);
+
+		if (perl_list_key(key, &da, &tag) < 0) continue;
+
+		perl_list_delete(list, da, tag);
+		if (SvROK(value) && (SvTYPE(SvRV(value)) == SVt_PVAV)) {
+			perl_list_add_av(list, SvPV_nolen(key), (AV *)SvRV(value));
+		}
 	}
+	if (list->vps == &list->request->packet->vps) perl_request_fixup(list->request);
+	SvREFCNT_dec((SV *)list->arrays);
+	list->arrays = NULL;
 
-	VERIFY_VP(vp);
+	/*
+	 *	The script may have kept a reference to the object
+	 *	with tied(), and the list is about to go away.
+	 */
+	if (mg->mg_obj && SvROK(mg->mg_obj)) sv_setiv(SvRV(mg->mg_obj), 0);
 
-	RDEBUG("&%s:%s %s $%s{'%s'} -> '%s'", list_name, key, fr_int2str(fr_tokens_table, op, "<INVALID>"),
-	       hash_name, key, val);
-	return 0;
+	sv_unmagic((SV *)rad_hv, PERL_MAGIC_tied);
 }
 
 /*
@@ -842,6 +1309,7 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 	HV		*rad_request_proxy_hv;
 	HV		*rad_request_proxy_reply_hv;
 #endif
+	rlm_perl_list_t	lists[6];
 
 	/*
 	 *	Radius has told us to call this function, but none
@@ -850,17 +1318,22 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 	if (!function_name) return RLM_MODULE_FAIL;
 
 #ifdef USE_ITHREADS
-	pthread_mutex_lock(&inst->clone_mutex);
-
 	PerlInterpreter *interp;
 
-	interp = rlm_perl_clone(inst->perl,inst->thread_key);
+	/*
+	 *	Only take the mutex the first time this thread
+	 *	calls the instance, to clone the interpreter.
+	 */
+	interp = pthread_getspecific(*inst->thread_key);
+	if (!interp) {
+		pthread_mutex_lock(&inst->clone_mutex);
+		interp = rlm_perl_clone(inst->perl, inst->thread_key);
+		pthread_mutex_unlock(&inst->clone_mutex);
+	}
 	{
 		dTHXa(interp);
 		PERL_SET_CONTEXT(interp);
 	}
-
-	pthread_mutex_unlock(&inst->clone_mutex);
 #else
 	PERL_SET_CONTEXT(inst->perl);
 #endif
@@ -876,23 +1349,40 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 		rad_request_hv = get_hv("RAD_REQUEST", 1);
 		rad_state_hv = get_hv("RAD_STATE", 1);
 
-		perl_store_vps(request->packet, request, &request->packet->vps, rad_request_hv, "RAD_REQUEST", "request");
-		perl_store_vps(request->reply, request, &request->reply->vps, rad_reply_hv, "RAD_REPLY", "reply");
-		perl_store_vps(request, request, &request->control, rad_config_hv, "RAD_CONFIG", "control");
-		perl_store_vps(request->state_ctx, request, &request->state, rad_state_hv, "RAD_STATE", "session-state");
+		if (inst->lazy_attributes) {
+			perl_tie_vps(&lists[0], request->packet, request, &request->packet->vps, rad_request_hv,
+				     "RAD_REQUEST", "request");
+			perl_tie_vps(&lists[1], request->reply, request, &request->reply->vps, rad_reply_hv,
+				     "RAD_REPLY", "reply");
+			perl_tie_vps(&lists[2], request, request, &request->control, rad_config_hv,
+				     "RAD_CONFIG", "control");
+			perl_tie_vps(&lists[3], request->state_ctx, request, &request->state, rad_state_hv,
+				     "RAD_STATE", "session-state");
+		} else {
+			perl_store_vps(request->packet, request, &request->packet->vps, rad_request_hv, "RAD_REQUEST", "request");
+			perl_store_vps(request->reply, request, &request->reply->vps, rad_reply_hv, "RAD_REPLY", "reply");
+			perl_store_vps(request, request, &request->control, rad_config_hv, "RAD_CONFIG", "control");
+			perl_store_vps(request->state_ctx, request, &request->state, rad_state_hv, "RAD_STATE", "session-state");
+		}
 
 #ifdef WITH_PROXY
 		rad_request_proxy_hv = get_hv("RAD_REQUEST_PROXY",1);
 		rad_request_proxy_reply_hv = get_hv("RAD_REQUEST_PROXY_REPLY",1);
 
-		if (request->proxy) {
+		if (request->proxy && inst->lazy_attributes) {
+			perl_tie_vps(&lists[4], request->proxy->packet, request, &request->proxy->packet->vps,
+				     rad_request_proxy_hv, "RAD_REQUEST_PROXY", "proxy-request");
+		} else if (request->proxy) {
 			perl_store_vps(request->proxy->packet, request, &request->proxy->packet->vps, rad_request_proxy_hv,
 				       "RAD_REQUEST_PROXY", "proxy-request");
 		} else {
 			hv_undef(rad_request_proxy_hv);
 		}
 
-		if (request->proxy && request->proxy->reply != NULL) {
+		if (request->proxy && request->proxy->reply && inst->lazy_attributes) {
+			perl_tie_vps(&lists[5], request->proxy->reply, request, &request->proxy->reply->vps,
+				     rad_request_proxy_reply_hv, "RAD_REQUEST_PROXY_REPLY", "proxy-reply");
+		} else if (request->proxy && request->proxy->reply != NULL) {
 			perl_store_vps(request->proxy->reply, request, &request->proxy->reply->vps,
 				       rad_request_proxy_reply_hv, "RAD_REQUEST_PROXY_REPLY", "proxy-reply");
 		} else {
@@ -936,6 +1426,22 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 		FREETMPS;
 		LEAVE;
 
+		/*
+		 *	The script has already made its changes
+		 *	to the lists through the tied hashes.
+		 */
+		if (inst->lazy_attributes) {
+			perl_untie_vps(rad_request_hv);
+			perl_untie_vps(rad_reply_hv);
+			perl_untie_vps(rad_config_hv);
+			perl_untie_vps(rad_state_hv);
+#ifdef WITH_PROXY
+			perl_untie_vps(rad_request_proxy_hv);
+			perl_untie_vps(rad_request_proxy_reply_hv);
+#endif
+			return exitstatus;
+		}
+
 		vp = NULL;
 		if ((get_hv_content(request->packet, request, rad_request_hv, &vp, "RAD_REQUEST", "request")) == 0) {
 			fr_pair_list_free(&request->packet->vps);
@@ -945,11 +1451,7 @@ static int do_perl(void *instance, REQUEST *request, char const *function_name)
 			/*
 			 *	Update cached copies
 			 */
-			request->username = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_NAME, TAG_ANY);
-			request->password = fr_pair_find_by_num(request->packet->vps, 0, PW_USER_PASSWORD, TAG_ANY);
-			if (!request->password)
-				request->password = fr_pair_find_by_num(request->packet->vps, 0, PW_CHAP_PASSWORD,
-									TAG_ANY);
+			perl_request_fixup(request);
 		}
 
 		if ((get_hv_content(request->reply, request, rad_reply_hv, &vp, "RAD_REPLY", "reply")) == 0) {
@@ -64,6 +64,8 @@ typedef struct rlm_python_t {
 						//!< FreeRADIUS functions.
 	bool		cext_compat;		//!< Whether or not to create sub-interpreters per module
 						//!< instance.
+	bool		lazy_attributes;	//!< Pass the request as a radiusd.PairList, which only
+						//!< converts the attributes the function looks at.
 
 	python_func_def_t
 	instantiate,
@@ -122,6 +124,7 @@ static CONF_PARSER module_config[] = {
 
 	{ FR_CONF_OFFSET("python_path", PW_TYPE_STRING, rlm_python_t, python_path) },
 	{ FR_CONF_OFFSET("cext_compat", PW_TYPE_BOOLEAN, rlm_python_t, cext_compat), .dflt = false },
+	{ FR_CONF_OFFSET("lazy_attributes", PW_TYPE_BOOLEAN, rlm_python_t, lazy_attributes), .dflt = false },
 
 	CONF_PARSER_TERMINATOR
 };
@@ -333,69 +336,40 @@ static void mod_vptuple(TALLOC_CTX *ctx, REQUEST *request, VALUE_PAIR **vps, PyO
 
 
 /*
- *	This is the core Python function that the others wrap around.
- *	Pass the value-pair print strings in a tuple.
- *
- *	FIXME: We're not checking the errors. If we have errors, what
- *	do we do?
+ *	Convert the value of a VALUE_PAIR to a Python object.
  */
-static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
+static PyObject *mod_vp_value(VALUE_PAIR const *vp)
 {
-	PyObject *attribute = NULL;
-	PyObject *value = NULL;
-
-	/* Look at the fr_pair_fprint_name? */
-
-	if (vp->da->flags.has_tag) {
-		attribute = PyString_FromFormat("%s:%d", vp->da->name, vp->tag);
-	} else {
-		attribute = PyString_FromString(vp->da->name);
-	}
-
-	if (!attribute) return -1;
-
-	PyTuple_SET_ITEM(pp, 0, attribute);
-
 	switch (vp->vp_type) {
 	case PW_TYPE_STRING:
-		value = PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
-		break;
+		return PyUnicode_FromStringAndSize(vp->vp_strvalue, vp->vp_length);
 
 	case PW_TYPE_OCTETS:
-		value = PyString_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
-		break;
+		return PyString_FromStringAndSize((char const *)vp->vp_octets, vp->vp_length);
 
 	case PW_TYPE_INTEGER:
-		value = PyLong_FromUnsignedLong(vp->vp_integer);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_integer);
 
 	case PW_TYPE_BYTE:
-		value = PyLong_FromUnsignedLong(vp->vp_byte);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_byte);
 
 	case PW_TYPE_SHORT:
-		value =  PyLong_FromUnsignedLong(vp->vp_short);
-		break;
+		return PyLong_FromUnsignedLong(vp->vp_short);
 
 	case PW_TYPE_SIGNED:
-		value = PyLong_FromLong(vp->vp_signed);
-		break;
+		return PyLong_FromLong(vp->vp_signed);
 
 	case PW_TYPE_INTEGER64:
-		value = PyLong_FromUnsignedLongLong(vp->vp_integer64);
-		break;
+		return PyLong_FromUnsignedLongLong(vp->vp_integer64);
 
 	case PW_TYPE_SIZE:
-		value = PyLong_FromUnsignedLongLong((unsigned long long)vp->vp_size);
-		break;
+		return PyLong_FromUnsignedLongLong((unsigned long long)vp->vp_size);
 
 	case PW_TYPE_DECIMAL:
-		value = PyFloat_FromDouble(vp->vp_decimal);
-		break;
+		return PyFloat_FromDouble(vp->vp_decimal);
 
 	case PW_TYPE_BOOLEAN:
-		value = PyBool_FromLong(vp->vp_bool);
-		break;
+		return PyBool_FromLong(vp->vp_bool);
 
 	case PW_TYPE_TIMEVAL:
 	case PW_TYPE_IPV4_ADDR:
@@ -413,16 +387,43 @@ static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
 		char buffer[256];
 
 		len = fr_pair_value_snprint(buffer, sizeof(buffer), vp, '\0');
-		value = PyString_FromStringAndSize(buffer, len);
+		return PyString_FromStringAndSize(buffer, len);
 	}
-		break;
 
 	case PW_TYPE_STRUCTURAL:
 	case PW_TYPE_BAD:
-		rad_assert(0);
-		return -1;
+		break;
 	}
 
+	rad_assert(0);
+	return NULL;
+}
+
+/*
+ *	This is the core Python function that the others wrap around.
+ *	Pass the value-pair print strings in a tuple.
+ *
+ *	FIXME: We're not checking the errors. If we have errors, what
+ *	do we do?
+ */
+static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
+{
+	PyObject *attribute = NULL;
+	PyObject *value = NULL;
+
+	/* Look at the fr_pair_fprint_name? */
+
+	if (vp->da->flags.has_tag) {
+		attribute = PyString_FromFormat("%s:%d", vp->da->name, vp->tag);
+	} else {
+		attribute = PyString_FromString(vp->da->name);
+	}
+
+	if (!attribute) return -1;
+
+	PyTuple_SET_ITEM(pp, 0, attribute);
+
+	value = mod_vp_value(vp);
 	if (value == NULL) return -1;
 
 	PyTuple_SET_ITEM(pp, 1, value);
@@ -430,7 +431,333 @@ static int mod_populate_vptuple(PyObject *pp, VALUE_PAIR *vp)
 	return 0;
 }
 
-static rlm_rcode_t do_python_single(REQUEST *request, PyObject *pFunc, char const *funcname)
+/** A read only view of an attribute list
+ *
+ * Passed to functions in place of the request tuple when lazy_attributes
+ * is enabled, so that only the attributes the function looks at are
+ * converted.  Iterating over it gives the same (name, value) tuples as
+ * the request tuple.
+ */
+typedef struct python_list {
+	PyObject_HEAD
+	REQUEST		*request;		//!< NULL once the function has returned.
+	VALUE_PAIR	**vps;			//!< The attribute list.
+} python_list_t;
+
+/*
+ *	Tagged attributes are looked up with <attribute>:<tag>,
+ *	matching the names in the request tuple.
+ */
+#define PYTHON_LIST_TAG(_vp) ((_vp)->da->flags.has_tag ? (_vp)->tag : TAG_ANY)
+
+/*
+ *	Attribute names are 'str', which is unicode in Python 3.
+ */
+#if PY_MAJOR_VERSION >= 3
+#  define PYTHON_LIST_NAME_CHECK(_o)		PyUnicode_Check(_o)
+#  define PYTHON_LIST_NAME_AS_STRING(_o)	PyUnicode_AsUTF8(_o)
+#  define PYTHON_LIST_NAME_FROM_STRING(_s)	PyUnicode_FromString(_s)
+#  define PYTHON_LIST_NAME_FROM_FORMAT		PyUnicode_FromFormat
+#else
+#  define PYTHON_LIST_NAME_CHECK(_o)		PyString_Check(_o)
+#  define PYTHON_LIST_NAME_AS_STRING(_o)	PyString_AsString(_o)
+#  define PYTHON_LIST_NAME_FROM_STRING(_s)	PyString_FromString(_s)
+#  define PYTHON_LIST_NAME_FROM_FORMAT		PyString_FromFormat
+#endif
+
+static int python_list_check(python_list_t *self)
+{
+	if (self->request) return 0;
+
+	PyErr_SetString(PyExc_RuntimeError, "Attribute list used after the function it was passed to returned");
+	return -1;
+}
+
+/*
+ *	Resolve a key to an attribute and a tag.
+ */
+static int python_list_key(PyObject *key, fr_dict_attr_t const **da, int8_t *tag)
+{
+	char const	*name, *p;
+	char		buffer[256];
+	size_t		len;
+
+	if (!PYTHON_LIST_NAME_CHECK(key)) return -1;
+
+	name = PYTHON_LIST_NAME_AS_STRING(key);
+	if (!name) {
+		PyErr_Clear();
+		return -1;
+	}
+	len = strlen(name);
+	*tag = TAG_ANY;
+
+	p = strchr(name, ':');
+	if (p) {
+		char		*q;
+		unsigned long	num;
+
+		num = strtoul(p + 1, &q, 10);
+		if ((q == p + 1) || *q || !TAG_VALID_ZERO(num)) return -1;
+
+		*tag = num;
+		len = p - name;
+	}
+
+	if (len >= sizeof(buffer)) return -1;
+	memcpy(buffer, name, len);
+	buffer[len] = '\0';
+
+	*da = fr_dict_attr_by_name(NULL, buffer);
+	if (!*da) return -1;
+
+	/*
+	 *	The request tuple always names tagged attributes
+	 *	with their tag.
+	 */
+	if ((*da)->flags.has_tag != (*tag != TAG_ANY)) return -1;
+
+	return 0;
+}
+
+/*
+ *	Convert a value, making sure there's an exception
+ *	for the function if it fails.
+ */
+static PyObject *python_list_value(VALUE_PAIR *vp)
+{
+	PyObject *value;
+
+	value = mod_vp_value(vp);
+	if (!value && !PyErr_Occurred()) PyErr_Format(PyExc_ValueError, "Failed converting %s", vp->da->name);
+
+	return value;
+}
+
+static Py_ssize_t python_list_length(python_list_t *self)
+{
+	VALUE_PAIR	*vp;
+	Py_ssize_t	count = 0;
+
+	if (python_list_check(self) < 0) return -1;
+
+	for (vp = *self->vps; vp; vp = vp->next) count++;
+
+	return count;
+}
+
+/*
+ *	Returns the value for a single instance of an attribute,
+ *	or a tuple of values if there's more than one.
+ */
+static PyObject *python_list_subscript(python_list_t *self, PyObject *key)
+{
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	VALUE_PAIR		*vp, *found = NULL;
+	PyObject		*values = NULL, *value;
+	Py_ssize_t		count = 0;
+
+	if (python_list_check(self) < 0) return NULL;
+
+	if (python_list_key(key, &da, &tag) < 0) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+
+	for (vp = *self->vps; vp; vp = vp->next) {
+		if ((vp->da != da) || (PYTHON_LIST_TAG(vp) != tag)) continue;
+
+		if (!found) found = vp;
+		count++;
+	}
+
+	if (!found) {
+		PyErr_SetObject(PyExc_KeyError, key);
+		return NULL;
+	}
+
+	if (count == 1) return python_list_value(found);
+
+	values = PyTuple_New(count);
+	if (!values) return NULL;
+
+	count = 0;
+	for (vp = found; vp; vp = vp->next) {
+		if ((vp->da != da) || (PYTHON_LIST_TAG(vp) != tag)) continue;
+
+		value = python_list_value(vp);
+		if (!value) {
+			Py_DECREF(values);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(values, count++, value);
+	}
+
+	return values;
+}
+
+static int python_list_contains(python_list_t *self, PyObject *key)
+{
+	fr_dict_attr_t const	*da;
+	int8_t			tag;
+	VALUE_PAIR		*vp;
+
+	if (python_list_check(self) < 0) return -1;
+
+	if (python_list_key(key, &da, &tag) < 0) return 0;
+
+	for (vp = *self->vps; vp; vp = vp->next) {
+		if ((vp->da == da) && (PYTHON_LIST_TAG(vp) == tag)) return 1;
+	}
+
+	return 0;
+}
+
+/*
+ *	Iterating converts the whole list, as the request tuple does.
+ */
+static PyObject *python_list_iter(python_list_t *self)
+{
+	VALUE_PAIR	*vp;
+	PyObject	*pairs, *iter;
+	Py_ssize_t	len, i = 0;
+
+	len = python_list_length(self);
+	if (len < 0) return NULL;
+
+	pairs = PyTuple_New(len);
+	if (!pairs) return NULL;
+
+	for (vp = *self->vps; vp; vp = vp->next, i++) {
+		PyObject *pp;
+
+		pp = PyTuple_New(2);
+		if (!pp) {
+			Py_DECREF(pairs);
+			return NULL;
+		}
+
+		/*
+		 *	Raise the error, rather than handing the
+		 *	function a None it doesn't expect.
+		 */
+		if (mod_populate_vptuple(pp, vp) < 0) {
+			if (!PyErr_Occurred()) {
+				PyErr_Format(PyExc_ValueError, "Failed converting %s", vp->da->name);
+			}
+			Py_DECREF(pp);
+			Py_DECREF(pairs);
+			return NULL;
+		}
+		PyTuple_SET_ITEM(pairs, i, pp);
+	}
+
+	iter = PyObject_GetIter(pairs);
+	Py_DECREF(pairs);
+
+	return iter;
+}
+
+static PyObject *python_list_get(python_list_t *self, PyObject *args)
+{
+	PyObject *key, *dflt = Py_None, *value;
+
+	if (!PyArg_ParseTuple(args, "O|O", &key, &dflt)) return NULL;
+
+	value = python_list_subscript(self, key);
+	if (value || !PyErr_ExceptionMatches(PyExc_KeyError)) return value;
+
+	PyErr_Clear();
+	Py_INCREF(dflt);
+
+	return dflt;
+}
+
+static PyObject *python_list_keys(python_list_t *self, UNUSED PyObject *args)
+{
+	VALUE_PAIR	*vp, *prev;
+	PyObject	*keys;
+
+	if (python_list_check(self) < 0) return NULL;
+
+	keys = PyList_New(0);
+	if (!keys) return NULL;
+
+	for (vp = *self->vps; vp; vp = vp->next) {
+		PyObject	*key;
+		int		ret;
+
+		/*
+		 *	Only add each name once.
+		 */
+		for (prev = *self->vps; prev != vp; prev = prev->next) {
+			if ((prev->da == vp->da) && (PYTHON_LIST_TAG(prev) == PYTHON_LIST_TAG(vp))) break;
+		}
+		if (prev != vp) continue;
+
+		if (vp->da->flags.has_tag) {
+			key = PYTHON_LIST_NAME_FROM_FORMAT("%s:%d", vp->da->name, vp->tag);
+		} else {
+			key = PYTHON_LIST_NAME_FROM_STRING(vp->da->name);
+		}
+		if (!key) {
+			Py_DECREF(keys);
+			return NULL;
+		}
+
+		ret = PyList_Append(keys, key);
+		Py_DECREF(key);
+		if (ret < 0) {
+			Py_DECREF(keys);
+			return NULL;
+		}
+	}
+
+	return keys;
+}
+
+static void python_list_free(python_list_t *self)
+{
+	PyObject_Del(self);
+}
+
+static PyMappingMethods python_list_as_mapping = {
+	.mp_length = (lenfunc)python_list_length,
+	.mp_subscript = (binaryfunc)python_list_subscript,
+};
+
+static PySequenceMethods python_list_as_sequence = {
+	.sq_contains = (objobjproc)python_list_contains,
+};
+
+static PyMethodDef python_list_methods[] = {
+	{ "get", (PyCFunction)python_list_get, METH_VARARGS,
+	  "get(name[, default])\n\n" \
+	  "Return the value of an attribute, or default if it's not in the list.\n"
+	},
+	{ "keys", (PyCFunction)python_list_keys, METH_NOARGS,
+	  "keys()\n\n" \
+	  "Return the names of the attributes in the list.\n"
+	},
+	{ NULL, NULL, 0, NULL },
+};
+
+static PyTypeObject python_list_type = {
+	PyVarObject_HEAD_INIT(NULL, 0)
+	.tp_name = "radiusd.PairList",
+	.tp_basicsize = sizeof(python_list_t),
+	.tp_dealloc = (destructor)python_list_free,
+	.tp_as_sequence = &python_list_as_sequence,
+	.tp_as_mapping = &python_list_as_mapping,
+	.tp_flags = Py_TPFLAGS_DEFAULT,
+	.tp_doc = "A read only view of a FreeRADIUS attribute list",
+	.tp_iter = (getiterfunc)python_list_iter,
+	.tp_methods = python_list_methods,
+};
+
+static rlm_rcode_t do_python_single(rlm_python_t const *inst, REQUEST *request,
+				    PyObject *pFunc, char const *funcname)
 {
 	vp_cursor_t	cursor;
 	VALUE_PAIR      *vp;
@@ -450,6 +777,21 @@ static rlm_rcode_t do_python_single(REQUEST *request, PyObject *pFunc, char cons
 	 *	Determine the size of our tuple by walking through the packet.
 	 *	If request is NULL, pass None.
 	 */
+	if ((request != NULL) && inst->lazy_attributes) {
+		python_list_t *list;
+
+		list = PyObject_New(python_list_t, &python_list_type);
+		if (!list) {
+			ret = RLM_MODULE_FAIL;
+			goto finish;
+		}
+		list->request = request;
+		list->vps = &request->packet->vps;
+
+		pArgs = (PyObject *)list;
+		goto call;
+	}
+
 	tuplelen = 0;
 	if (request != NULL) {
 		for (vp = fr_pair_cursor_init(&cursor, &request->packet->vps);
@@ -489,8 +831,15 @@ static rlm_rcode_t do_python_single(REQUEST *request, PyObject *pFunc, char cons
 		}
 	}
 
+call:
 	/* Call Python function. */
 	pRet = PyObject_CallFunctionObjArgs(pFunc, pArgs, NULL);
+
+	/*
+	 *	The function may have kept a reference to the list.
+	 */
+	if (pArgs && (Py_TYPE(pArgs) == &python_list_type)) ((python_list_t *)pArgs)->request = NULL;
+
 	if (!pRet) {
 		ret = RLM_MODULE_FAIL;
 		goto finish;
@@ -681,7 +1030,7 @@ static rlm_rcode_t do_python(rlm_python_t const *inst, REQUEST *request, PyObjec
 	RDEBUG3("Using thread state %p", this_thread->state);
 
 	PyEval_RestoreThread(this_thread->state);	/* Swap in our local thread state */
-	ret = do_python_single(request, pFunc, funcname);
+	ret = do_python_single(inst, request, pFunc, funcname);
 	PyEval_SaveThread();
 
 	return ret;
@@ -850,7 +1199,7 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 		{
 			wchar_t *name;
 
-			wide_name = Py_DecodeLocale(main_config.name, strlen(main_config.name));
+			name = Py_DecodeLocale(main_config.name, NULL);
 			Py_SetProgramName(name);		/* The value of argv[0] as a wide char string */
 			PyMem_RawFree(name);
 		}
@@ -900,9 +1249,9 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 		if (inst->python_path) {
 #if PY_VERSION_HEX > 0x03050000
 			{
-				wchar_t *name;
+				wchar_t *path;
 
-				path = Py_DecodeLocale(inst->python_path, strlen(inst->python_path));
+				path = Py_DecodeLocale(inst->python_path, NULL);
 				PySys_SetPath(path);
 				PyMem_RawFree(path);
 			}
@@ -937,6 +1286,11 @@ static int python_interpreter_init(rlm_python_t *inst, CONF_SECTION *conf)
 
 		if (inst->cext_compat) main_module = inst->module;
 
+		if (PyType_Ready(&python_list_type) < 0) goto error;
+
+		Py_INCREF(&python_list_type);
+		if (PyModule_AddObject(inst->module, "PairList", (PyObject *)&python_list_type) < 0) goto error;
+
 		for (i = 0; radiusd_constants[i].name; i++) {
 			if ((PyModule_AddIntConstant(inst->module, radiusd_constants[i].name,
 						     radiusd_constants[i].value)) < 0)
@@ -1024,7 +1378,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	/*
 	 *	Call the instantiate function.
 	 */
-	code = do_python_single(NULL, inst->instantiate.function, "instantiate");
+	code = do_python_single(inst, NULL, inst->instantiate.function, "instantiate");
 	if (code < 0) {
 	error:
 		python_error_log();	/* Needs valid thread with GIL */
@@ -1046,7 +1400,7 @@ static int mod_detach(void *instance)
 	 */
 	PyEval_RestoreThread(inst->sub_interpreter);
 
-	ret = do_python_single(NULL, inst->detach.function, "detach");
+	ret = do_python_single(inst, NULL, inst->detach.function, "detach");
 
 #define PYTHON_FUNC_DESTROY(_x) python_function_destroy(&inst->_x)
 	PYTHON_FUNC_DESTROY(instantiate);
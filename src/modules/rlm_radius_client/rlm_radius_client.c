@@ -19,6 +19,17 @@
  * @file rlm_radius_client.c
  * @brief A RADIUS client library.
  *
+ * Each worker thread has its own sockets, and its own view of the home
+ * servers.  A packet is sent to the home server with the lowest product
+ * of packets outstanding and smoothed round trip time, so slow or busy
+ * servers get less of the load.
+ *
+ * UDP sockets are shared by all the home servers, and more are opened as
+ * the IDs on the existing ones run out.  TCP connections are opened to
+ * each home server as needed, and carry up to 256 outstanding packets
+ * each.  UDP packets are retransmitted from a timer on the worker's event
+ * list, with exponential backoff (RFC 5080 section 2.2.1).
+ *
  * @copyright 2016  The FreeRADIUS server project
  * @copyright 2016  Network RADIUS SARL
  */
@@ -29,6 +40,22 @@ RCSID("$Id$")
 #include <freeradius-devel/udp.h>
 #include <freeradius-devel/rad_assert.h>
 
+#ifdef MSG_NOSIGNAL
+#  define SEND_FLAGS MSG_NOSIGNAL
+#else
+#  define SEND_FLAGS 0
+#endif
+
+/** How long to wait before opening another TCP connection to a home server, after one failed
+ */
+#define RADIUS_CLIENT_RECONNECT_DELAY	1
+
+/** Most replies read from a UDP socket each time it becomes readable
+ */
+#define RADIUS_CLIENT_READ_BATCH	32
+
+#define USEC				(1000000)
+
 typedef struct radius_client_instance {
 	char const		*name;			//!< Module instance name.
 
@@ -37,8 +64,15 @@ typedef struct radius_client_instance {
 
 	fr_ipaddr_t		src_ipaddr;		// Src IP for outgoing packets
 
-	home_server_t		*home_server;		// home servers to send packets to
-	pthread_key_t		key;
+	home_server_t		**home_servers;		//!< Home servers to send packets to.
+	int			num_home_servers;	//!< Number of home servers.
+
+	uint32_t		max_sockets;		//!< Most UDP sockets each thread may open.
+
+	struct timeval		irt;			//!< Initial retransmission time.
+	struct timeval		mrt;			//!< Maximum retransmission time.
+	uint32_t		mrc;			//!< Maximum retransmission count.  0 means we
+							//!< only retransmit when the client does.
 } rlm_radius_client_instance_t;
 
 static const CONF_PARSER listen_config[] = {
@@ -46,43 +80,212 @@ static const CONF_PARSER listen_config[] = {
 	CONF_PARSER_TERMINATOR
 };
 
+static const CONF_PARSER retransmit_config[] = {
+	{ FR_CONF_OFFSET("initial_rtx_time", PW_TYPE_TIMEVAL, rlm_radius_client_instance_t, irt), .dflt = "2" },
+	{ FR_CONF_OFFSET("max_rtx_time", PW_TYPE_TIMEVAL, rlm_radius_client_instance_t, mrt), .dflt = "16" },
+	{ FR_CONF_OFFSET("max_rtx_count", PW_TYPE_INTEGER, rlm_radius_client_instance_t, mrc), .dflt = "5" },
+	CONF_PARSER_TERMINATOR
+};
+
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_POINTER("listen", PW_TYPE_SUBSECTION, NULL), .dflt = (void const *) listen_config },
+	{ FR_CONF_POINTER("retransmit", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) retransmit_config },
 
 	{ FR_CONF_OFFSET("virtual_server", PW_TYPE_STRING, rlm_radius_client_instance_t, virtual_server) },
+	{ FR_CONF_OFFSET("max_sockets", PW_TYPE_INTEGER, rlm_radius_client_instance_t, max_sockets), .dflt = "64" },
 	CONF_PARSER_TERMINATOR
 };
 
-typedef struct radius_client_conn {
-	rlm_radius_client_instance_t const	*inst;
-	int					num_fds;
-	int					sockfd;
-	fr_packet_list_t			*pl;
-	fr_event_list_t				*el;
-} rlm_radius_client_conn_t;
+typedef struct radius_client_thread rlm_radius_client_thread_t;
+typedef struct radius_client_conn rlm_radius_client_conn_t;
+
+/** A home server, as seen by one worker thread
+ *
+ */
+typedef struct radius_client_home {
+	home_server_t const			*server;	//!< Configuration of the home server.
+	rlm_radius_client_thread_t		*thread;	//!< Thread this belongs to.
+
+	fr_ipaddr_t				src_ipaddr;	//!< Packets to the home server are sent from.
+
+	uint32_t				outstanding;	//!< Packets waiting for replies.
+	uint64_t				srtt;		//!< Smoothed round trip time, in microseconds.
+							//!< 0 if we haven't had a reply yet.
+	uint32_t				timeouts;	//!< Packets which timed out since the last reply.
+	time_t					dead_until;	//!< Don't prefer this home server until then.
+
+	uint32_t				num_conns;	//!< TCP connections to the home server.
+	time_t					retry_after;	//!< Don't open TCP connections before then.
+} rlm_radius_client_home_t;
+
+/** Per-thread sockets and home servers
+ *
+ */
+struct radius_client_thread {
+	rlm_radius_client_instance_t const	*inst;		//!< Instance of the module.
+	fr_event_list_t				*el;		//!< Event list of the worker.
+
+	fr_packet_list_t			*pl;		//!< Outstanding packets, and the sockets they were
+								//!< sent on.
+	rlm_radius_client_conn_t		*conns;		//!< All sockets and connections.
+	uint32_t				num_udp;	//!< UDP sockets open.
+
+	rlm_radius_client_home_t		*homes;		//!< One per home server.
+	int					next_home;	//!< Where to start looking for a home server, so
+								//!< that ties are broken round robin.
+};
+
+/** A UDP socket, or a TCP connection to a home server
+ *
+ */
+struct radius_client_conn {
+	rlm_radius_client_thread_t		*thread;	//!< Thread the socket belongs to.
+	rlm_radius_client_home_t		*home;		//!< Home server of a TCP connection.  NULL for UDP.
+	int					fd;		//!< File descriptor.
+	int					proto;		//!< IPPROTO_UDP or IPPROTO_TCP.
+
+	bool					connecting;	//!< TCP connect() hasn't completed.
+	RADIUS_PACKET				*partial;	//!< TCP reply being read.
+	uint8_t					*out;		//!< TCP data waiting to be written.
+	size_t					out_len;	//!< Length of data in out.
+	size_t					out_sent;	//!< How much of out has been written.
+
+	rlm_radius_client_conn_t		*prev;
+	rlm_radius_client_conn_t		*next;
+};
 
 typedef struct rlm_radius_client_request {
 	rlm_radius_client_instance_t const	*inst;
 	REQUEST					*request;
 	rlm_rcode_t				rcode;
 
-	rlm_radius_client_conn_t		*conn;
+	rlm_radius_client_thread_t		*thread;	//!< Thread the packet is being sent from.
+	rlm_radius_client_home_t		*home;		//!< Home server the packet is sent to.
+	rlm_radius_client_conn_t		*conn;		//!< Socket the packet is sent on.
 
 	RADIUS_PACKET				*packet;	/* the packet we sent */
 	RADIUS_PACKET				*reply;		/* the reply from the home server */
 
 	REQUEST					*child;		/* the child request */
+
+	bool					in_flight;	//!< Has an ID, and is counted as outstanding.
+	bool					retransmitted;	//!< Don't use the reply to measure the RTT.
+	struct timeval				sent;		//!< When the packet was first sent.
+	struct timeval				deadline;	//!< When we give up waiting for a reply.
+	uint64_t				rt;		//!< Current retransmission time, in microseconds.
+	uint32_t				rtx;		//!< Retransmissions so far.
+	fr_event_timer_t			*ev;		//!< Retransmission or timeout event.
 } rlm_radius_client_request_t;
 
+static inline uint64_t tv_to_usec(struct timeval const *tv)
+{
+	return ((uint64_t) tv->tv_sec * USEC) + tv->tv_usec;
+}
+
+static inline void usec_to_tv(struct timeval *tv, uint64_t usec)
+{
+	tv->tv_sec = usec / USEC;
+	tv->tv_usec = usec % USEC;
+}
+
+/** Add the RFC 5080 random factor to a retransmission time
+ *
+ * @return rt, +/- 10%.
+ */
+static inline uint64_t rt_jitter(uint64_t rt)
+{
+	return rt - (rt / 10) + (fr_rand() % ((rt / 5) + 1));
+}
+
+/** Stop waiting for a reply
+ *
+ * Releases the ID, and stops the retransmission timer.
+ *
+ * @param[in] ccr	to stop waiting for.
+ * @param[in] yank	Whether the packet needs to be removed from the packet list.
+ *			False if the caller is walking the list, and removes it.
+ */
+static void ccr_finish(rlm_radius_client_request_t *ccr, bool yank)
+{
+	rlm_radius_client_thread_t *t = ccr->thread;
+
+	if (!ccr->in_flight) return;
+
+	if (ccr->ev) fr_event_timer_delete(t->el, &ccr->ev);
+
+	fr_packet_list_id_free(t->pl, ccr->packet, yank);
+	ccr->child->in_request_hash = false;
+	ccr->home->outstanding--;
+	ccr->in_flight = false;
+}
+
+/** Record that a home server didn't answer
+ *
+ */
+static void home_timeout(rlm_radius_client_home_t *h, time_t now)
+{
+	h->timeouts++;
+	if ((h->timeouts < h->server->max_response_timeouts) || (h->dead_until > now)) return;
+
+	WARN("%s: Home server %s has not responded to %u packets, marking it dead for %u seconds",
+	     h->thread->inst->name, h->server->name, h->timeouts, h->server->revive_interval);
+
+	h->dead_until = now + h->server->revive_interval;
+}
+
+/** Pick a home server
+ *
+ * Home servers which are alive are preferred.  Of those, we use the one
+ * with the lowest (outstanding + 1) * srtt.  Home servers we haven't had a
+ * reply from yet are assumed to be as fast as the fastest one, so that
+ * they get enough packets to measure them.
+ *
+ * @return
+ *	- The home server.
+ *	- NULL if all home servers have max_outstanding packets outstanding.
+ */
+static rlm_radius_client_home_t *home_select(rlm_radius_client_thread_t *t, time_t now)
+{
+	rlm_radius_client_home_t	*h, *best = NULL;
+	uint64_t			min_srtt = 0, score, best_score = 0;
+	bool				best_alive = false;
+	int				i, num = t->inst->num_home_servers;
+
+	for (i = 0; i < num; i++) {
+		h = &t->homes[i];
+		if (h->srtt && (!min_srtt || (h->srtt < min_srtt))) min_srtt = h->srtt;
+	}
+	if (!min_srtt) min_srtt = 1;
+
+	for (i = 0; i < num; i++) {
+		bool alive;
+
+		h = &t->homes[(t->next_home + i) % num];
+
+		if (h->outstanding >= h->server->max_outstanding) continue;
+
+		alive = (h->dead_until <= now);
+		if (best_alive && !alive) continue;
+
+		score = (h->outstanding + 1) * (h->srtt ? h->srtt : min_srtt);
+		if (!best || (alive && !best_alive) || (score < best_score)) {
+			best = h;
+			best_score = score;
+			best_alive = alive;
+		}
+	}
+
+	t->next_home = (t->next_home + 1) % num;
+
+	return best;
+}
+
 /** Clean up whatever intermediate state we're in.
  *
  */
 static void mod_cleanup(REQUEST *request, rlm_radius_client_request_t *ccr)
 {
-	if (ccr->child->in_request_hash) {
-		(void) fr_packet_list_yank(ccr->conn->pl, ccr->packet);
-		ccr->child->in_request_hash = false;
-	}
+	ccr_finish(ccr, true);
 
 	/*
 	 *	Set Failed-Home-Server-IP if we didn't get an answer.
@@ -103,26 +306,19 @@ static void mod_cleanup(REQUEST *request, rlm_radius_client_request_t *ccr)
 	TALLOC_FREE(ccr);
 }
 
-static void mod_event_fd(UNUSED fr_event_list_t *el, int fd, void *ctx)
+/** Process a reply from a home server
+ *
+ */
+static void mod_reply(rlm_radius_client_thread_t *t, RADIUS_PACKET *reply)
 {
-	rlm_radius_client_conn_t *conn = ctx;
 	rlm_radius_client_request_t *ccr;
-	RADIUS_PACKET *reply, **packet_p;
+	rlm_radius_client_home_t *h;
+	RADIUS_PACKET **packet_p;
 	REQUEST *request;
+	struct timeval now, rtt;
 	char buffer[INET6_ADDRSTRLEN];
 
-	/*
-	 *	Look for the packet.
-	 *
-	 *	@fixme: if there's an error in the socket, remove the
-	 *	socket from the packet list.
-	 */
-	reply = fr_radius_packet_recv(conn, fd, 0, false);
-	if (!reply) {
-		return;
-	}
-
-	packet_p = fr_packet_list_find_byreply(conn->pl, reply);
+	packet_p = fr_packet_list_find_byreply(t->pl, reply);
 	if (!packet_p) {
 		DEBUG("Received unknown reply %s packet from home server %s port %d - ID %u - ignoring",
 		       fr_packet_codes[reply->code],
@@ -139,6 +335,7 @@ static void mod_event_fd(UNUSED fr_event_list_t *el, int fd, void *ctx)
 	 */
 	ccr = fr_packet2myptr(rlm_radius_client_request_t, packet, packet_p);
 	request = ccr->request;
+	h = ccr->home;
 
 	RDEBUG("Received reply %s packet from home server %s port %d - ID %u",
 	       fr_packet_codes[reply->code],
@@ -150,40 +347,471 @@ static void mod_event_fd(UNUSED fr_event_list_t *el, int fd, void *ctx)
 	/*
 	 *	If the reply fails the signature validation, it's not a real reply.
 	 */
-	if (fr_radius_packet_verify(reply, ccr->packet, ccr->inst->home_server->secret) < 0) {
-		REDEBUG("Reply verification failed for home server %s", ccr->inst->home_server->name);
+	if (fr_radius_packet_verify(reply, ccr->packet, h->server->secret) < 0) {
+		REDEBUG("Reply verification failed for home server %s", h->server->name);
+		fr_radius_free(&reply);
+		return;
+	}
+
+	if (fr_radius_packet_decode(reply, ccr->packet, h->server->secret) < 0) {
+		RPEDEBUG("Failed decoding reply from home server %s", h->server->name);
 		fr_radius_free(&reply);
 		return;
 	}
 
 	RDEBUG("Received response from home server");
 
+	/*
+	 *	Only replies to packets we sent once tell us the
+	 *	RTT, we don't know which copy the others answer.
+	 */
+	gettimeofday(&now, NULL);
+	if (!ccr->retransmitted) {
+		int64_t sample;
+
+		fr_timeval_subtract(&rtt, &now, &ccr->sent);
+		sample = tv_to_usec(&rtt);
+
+		if (!h->srtt) {
+			h->srtt = sample;
+		} else {
+			h->srtt += (sample - (int64_t) h->srtt) / 8;
+		}
+		if (!h->srtt) h->srtt = 1;
+	}
+	h->timeouts = 0;
+	h->dead_until = 0;
+
 	/*
 	 *	Reply is valid, run the packet through the "recv FOO" stage.
 	 */
-	fr_packet_list_id_free(conn->pl, ccr->packet, true);
-	ccr->child->in_request_hash = false;
+	ccr_finish(ccr, true);
 	ccr->child->reply = talloc_steal(ccr->child, reply);
 	ccr->reply = reply;
 
+	ccr->rcode = RLM_MODULE_OK;
+	unlang_resumable(request);
+}
+
+/** Stop waiting for a packet which was sent on a connection which has failed
+ *
+ */
+static int _conn_fail_walk(void *ctx, void *data)
+{
+	rlm_radius_client_conn_t *conn = ctx;
+	RADIUS_PACKET **packet_p = data;
+	rlm_radius_client_request_t *ccr;
+
+	if ((*packet_p)->sockfd != conn->fd) return 0;
+
+	ccr = fr_packet2myptr(rlm_radius_client_request_t, packet, packet_p);
+
+	ccr_finish(ccr, false);
+	unlang_resumable(ccr->request);
+
+	return 2;	/* Delete it from the list, and continue */
+}
+
+static int _conn_free(rlm_radius_client_conn_t *conn)
+{
+	rlm_radius_client_thread_t *t = conn->thread;
+
+	fr_event_fd_delete(t->el, conn->fd);
+	fr_packet_list_socket_del(t->pl, conn->fd);
+	if (close(conn->fd) < 0) DEBUG3("Closing socket failed: %s", fr_syserror(errno));
+
+	if (conn->prev) {
+		conn->prev->next = conn->next;
+	} else {
+		t->conns = conn->next;
+	}
+	if (conn->next) conn->next->prev = conn->prev;
+
+	if (conn->home) {
+		conn->home->num_conns--;
+	} else {
+		t->num_udp--;
+	}
+
+	return 0;
+}
+
+/** Close a TCP connection, and give up on the packets sent on it
+ *
+ */
+static void conn_fail(rlm_radius_client_conn_t *conn)
+{
+	rlm_radius_client_home_t *h = conn->home;
+	time_t now = time(NULL);
+
+	PERROR("%s: Connection to home server %s failed", conn->thread->inst->name, h->server->name);
+
+	if (conn->connecting) {
+		h->retry_after = now + RADIUS_CLIENT_RECONNECT_DELAY;
+		home_timeout(h, now);
+	}
+
+	fr_packet_list_walk(conn->thread->pl, conn, _conn_fail_walk);
+
+	talloc_free(conn);
+}
+
+/** Write as much buffered data as the connection will take
+ *
+ * @return
+ *	- 0 on success, including if the data couldn't all be written.
+ *	- -1 on error.
+ */
+static int conn_flush(rlm_radius_client_conn_t *conn)
+{
+	ssize_t len;
+
+	while (conn->out_sent < conn->out_len) {
+		len = send(conn->fd, conn->out + conn->out_sent, conn->out_len - conn->out_sent, SEND_FLAGS);
+		if (len < 0) {
+			if ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)) break;
+
+			fr_strerror_printf("Failed writing to socket: %s", fr_syserror(errno));
+			return -1;
+		}
+		conn->out_sent += len;
+	}
+
+	if (conn->out_sent == conn->out_len) conn->out_sent = conn->out_len = 0;
+
+	return 0;
+}
+
+static void conn_read(fr_event_list_t *el, int fd, void *ctx);
+static void conn_write(fr_event_list_t *el, int fd, void *ctx);
+static void conn_error(fr_event_list_t *el, int fd, void *ctx);
+
+/** Tell the event loop whether we want to write to the connection
+ *
+ */
+static int conn_fd_update(rlm_radius_client_conn_t *conn)
+{
+	bool writing = conn->connecting || (conn->out_len > 0);
+
 	/*
-	 *	We've received the response.  Remove the timeout
-	 *	handler, and resume.
+	 *	UDP errors are of no interest, we'll time
+	 *	out the packets.
 	 */
-	unlang_event_timeout_delete(ccr->request, ccr);
+	if (fr_event_fd_insert(conn->thread->el, conn->fd, conn_read, writing ? conn_write : NULL,
+			       (conn->proto == IPPROTO_TCP) ? conn_error : NULL, conn) < 0) {
+		PERROR("%s: Failed adding event for socket", conn->thread->inst->name);
+		return -1;
+	}
 
-	ccr->rcode = RLM_MODULE_OK;
-	unlang_resumable(ccr->request);
+	return 0;
+}
+
+static void conn_read(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	rlm_radius_client_conn_t *conn = talloc_get_type_abort(ctx, rlm_radius_client_conn_t);
+	RADIUS_PACKET *reply;
+	int i, rcode;
+
+	if (conn->proto == IPPROTO_UDP) {
+		for (i = 0; i < RADIUS_CLIENT_READ_BATCH; i++) {
+			reply = fr_radius_packet_recv(conn, fd, 0, false);
+			if (!reply) return;
+
+#ifdef WITH_TCP
+			reply->proto = IPPROTO_UDP;
+#endif
+			mod_reply(conn->thread, reply);
+		}
+		return;
+	}
+
+	/*
+	 *	TCP replies may arrive a piece at a time.
+	 */
+	if (!conn->partial) {
+		conn->partial = fr_radius_alloc(conn, false);
+		if (!conn->partial) return;
+		conn->partial->sockfd = fd;
+	}
+
+#ifdef WITH_TCP
+	rcode = fr_tcp_read_packet(conn->partial, false);
+#else
+	rcode = -1;
+#endif
+	if (rcode == 0) return;
+
+	if (rcode < 0) {
+		if ((rcode == -1) && ((errno == EAGAIN) || (errno == EWOULDBLOCK))) return;
+		if (rcode == -2) fr_strerror_printf("Connection closed by home server");
+
+		conn_fail(conn);
+		return;
+	}
+
+	reply = conn->partial;
+	conn->partial = NULL;
+#ifdef WITH_TCP
+	reply->proto = IPPROTO_TCP;
+#endif
+
+	mod_reply(conn->thread, reply);
+}
+
+static void conn_write(UNUSED fr_event_list_t *el, int fd, void *ctx)
+{
+	rlm_radius_client_conn_t *conn = talloc_get_type_abort(ctx, rlm_radius_client_conn_t);
+
+	if (conn->connecting) {
+		int		error = 0;
+		socklen_t	len = sizeof(error);
+
+		if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0) error = errno;
+		if (error) {
+			fr_strerror_printf("Failed connecting: %s", fr_syserror(error));
+			conn_fail(conn);
+			return;
+		}
+
+		DEBUG2("%s: Connected to home server %s", conn->thread->inst->name, conn->home->server->name);
+		conn->connecting = false;
+	}
+
+	if (conn_flush(conn) < 0) {
+		conn_fail(conn);
+		return;
+	}
+
+	if (conn->out_len == 0) conn_fd_update(conn);
+}
+
+static void conn_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	rlm_radius_client_conn_t *conn = talloc_get_type_abort(ctx, rlm_radius_client_conn_t);
+
+	fr_strerror_printf("Socket error");
+	conn_fail(conn);
+}
+
+static rlm_radius_client_conn_t *conn_alloc(rlm_radius_client_thread_t *t, int fd, int proto,
+					    fr_ipaddr_t *dst_ipaddr, uint16_t dst_port)
+{
+	rlm_radius_client_conn_t *conn;
+
+	conn = talloc_zero(t->homes, rlm_radius_client_conn_t);
+	if (!conn) {
+		close(fd);
+		return NULL;
+	}
+	conn->thread = t;
+	conn->fd = fd;
+	conn->proto = proto;
+
+	if (!fr_packet_list_socket_add(t->pl, fd, proto, dst_ipaddr, dst_port, conn)) {
+		PERROR("%s: Failed adding socket", t->inst->name);
+		close(fd);
+		talloc_free(conn);
+		return NULL;
+	}
+
+	conn->next = t->conns;
+	if (t->conns) t->conns->prev = conn;
+	t->conns = conn;
+	talloc_set_destructor(conn, _conn_free);
+
+	return conn;
+}
+
+/** Open another UDP socket, which gives us 256 more IDs
+ *
+ */
+static rlm_radius_client_conn_t *conn_udp_open(rlm_radius_client_thread_t *t, rlm_radius_client_home_t *h)
+{
+	int			sockfd;
+	fr_ipaddr_t		ipaddr;
+	rlm_radius_client_conn_t *conn;
+
+	/*
+	 *	Too many outbound sockets is probably a bad idea.
+	 */
+	if (t->num_udp >= t->inst->max_sockets) {
+		fr_strerror_printf("Too many open sockets (%u)", t->num_udp);
+		return NULL;
+	}
+
+	sockfd = fr_socket(&h->src_ipaddr, 0);
+	if (sockfd < 0) return NULL;
+
+	/*
+	 *	Always set the socket as non-blocking.
+	 */
+	fr_nonblock(sockfd);
+
+	/*
+	 *	The default destination is anywhere.
+	 */
+	memset(&ipaddr, 0, sizeof(ipaddr));
+	ipaddr.af = h->src_ipaddr.af;
+
+	conn = conn_alloc(t, sockfd, IPPROTO_UDP, &ipaddr, 0);
+	if (!conn) return NULL;
+	t->num_udp++;
+
+	if (conn_fd_update(conn) < 0) {
+		talloc_free(conn);
+		return NULL;
+	}
+
+	DEBUG2("%s: Opened UDP socket %d, %u sockets open", t->inst->name, sockfd, t->num_udp);
+
+	return conn;
+}
+
+/** Open another TCP connection to a home server
+ *
+ * The connection completes asynchronously, packets are buffered until it does.
+ */
+static rlm_radius_client_conn_t *conn_tcp_open(rlm_radius_client_thread_t *t, rlm_radius_client_home_t *h)
+{
+	int			sockfd;
+	fr_ipaddr_t		ipaddr;
+	rlm_radius_client_conn_t *conn;
+
+	/*
+	 *	As with listeners, 0 means there's no limit.
+	 */
+	if (h->server->limit.max_connections &&
+	    (h->num_conns >= h->server->limit.max_connections)) {
+		fr_strerror_printf("Too many open connections to home server %s (%u)", h->server->name, h->num_conns);
+		return NULL;
+	}
+
+	if (time(NULL) < h->retry_after) {
+		fr_strerror_printf("Connection to home server %s failed recently, not reconnecting yet",
+				   h->server->name);
+		return NULL;
+	}
+
+	sockfd = fr_socket_client_tcp(&h->src_ipaddr, &h->server->ipaddr, h->server->port, true);
+	if (sockfd < 0) {
+		h->retry_after = time(NULL) + RADIUS_CLIENT_RECONNECT_DELAY;
+		return NULL;
+	}
+
+	ipaddr = h->server->ipaddr;
+	conn = conn_alloc(t, sockfd, IPPROTO_TCP, &ipaddr, h->server->port);
+	if (!conn) return NULL;
+
+	conn->home = h;
+	conn->connecting = true;
+	h->num_conns++;
+
+	if (conn_fd_update(conn) < 0) {
+		talloc_free(conn);
+		return NULL;
+	}
+
+	DEBUG2("%s: Connecting to home server %s, %u connections open", t->inst->name, h->server->name,
+	       h->num_conns);
+
+	return conn;
+}
+
+/** Send, or resend, a packet
+ *
+ */
+static int conn_send(rlm_radius_client_conn_t *conn, RADIUS_PACKET *packet, char const *secret)
+{
+	size_t needed;
+
+	if (conn->proto == IPPROTO_UDP) return fr_radius_packet_send(packet, NULL, secret);
+
+	if (!packet->data) {
+		if (fr_radius_packet_encode(packet, NULL, secret) < 0) return -1;
+		if (fr_radius_packet_sign(packet, NULL, secret) < 0) return -1;
+	}
+
+	/*
+	 *	Append the packet to anything which hasn't
+	 *	been written yet, so packets aren't interleaved.
+	 */
+	needed = conn->out_len + packet->data_len;
+	if (needed > talloc_array_length(conn->out)) {
+		uint8_t *out;
+
+		out = talloc_realloc(conn, conn->out, uint8_t, needed * 2);
+		if (!out) {
+			fr_strerror_printf("Out of memory");
+			return -1;
+		}
+		conn->out = out;
+	}
+	memcpy(conn->out + conn->out_len, packet->data, packet->data_len);
+	conn->out_len += packet->data_len;
+
+	if (conn->connecting) return 0;
+
+	/*
+	 *	Errors are noticed by conn_write(), so that
+	 *	the connection isn't closed under the caller.
+	 */
+	if ((conn_flush(conn) < 0) || (conn->out_len > 0)) return conn_fd_update(conn);
+
+	return 0;
 }
 
-static void mod_proxy_no_reply(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
-			       UNUSED struct timeval *now)
+/** Retransmit a packet, or give up waiting for a reply
+ *
+ */
+static void mod_retransmit(UNUSED fr_event_list_t *el, struct timeval *now, void *ctx)
 {
 	rlm_radius_client_request_t *ccr = ctx;
+	rlm_radius_client_instance_t const *inst = ccr->inst;
+	REQUEST *request = ccr->request;
+	RADIUS_PACKET *packet = ccr->packet;
+	struct timeval when;
+	char buffer[INET6_ADDRSTRLEN];
 
-	mod_cleanup(request, ccr);
+	if (fr_timeval_cmp(now, &ccr->deadline) >= 0) {
+		RDEBUG("No reply from home server %s after %u retransmissions", ccr->home->server->name,
+		       ccr->rtx);
+		home_timeout(ccr->home, now->tv_sec);
+		ccr_finish(ccr, true);
+		unlang_resumable(request);
+		return;
+	}
 
-	unlang_resumable(request);
+	ccr->rtx++;
+	ccr->retransmitted = true;
+
+	RDEBUG("Retransmitting %s packet to home server %s %s port %d - ID %u",
+	       fr_packet_codes[packet->code],
+	       ccr->home->server->name,
+	       inet_ntop(packet->dst_ipaddr.af,
+			 &packet->dst_ipaddr.ipaddr,
+			 buffer, sizeof(buffer)),
+	       packet->dst_port, packet->id);
+
+	(void) conn_send(ccr->conn, packet, ccr->home->server->secret);
+	packet->count++;
+
+	/*
+	 *	RT = 2*RTprev + RAND*RTprev, capped at MRT + RAND*MRT.
+	 *	Once we've sent MRC copies, wait out the deadline.
+	 */
+	if (ccr->rtx >= inst->mrc) {
+		when = ccr->deadline;
+	} else {
+		ccr->rt = rt_jitter(ccr->rt * 2);
+		if (ccr->rt > tv_to_usec(&inst->mrt)) ccr->rt = rt_jitter(tv_to_usec(&inst->mrt));
+
+		usec_to_tv(&when, tv_to_usec(now) + ccr->rt);
+		if (fr_timeval_cmp(&when, &ccr->deadline) > 0) when = ccr->deadline;
+	}
+
+	if (fr_event_timer_insert(ccr->thread->el, mod_retransmit, ccr, &when, &ccr->ev) < 0) {
+		RPERROR("Failed inserting retransmission timer");
+	}
 }
 
 
@@ -263,6 +891,12 @@ static void mod_action_dup(REQUEST *request, void *instance, UNUSED void *thread
 
 	if (action != FR_ACTION_DUP) return;
 
+	/*
+	 *	We've given up, or we're retransmitting on our
+	 *	own timers, or the transport is reliable.
+	 */
+	if (!ccr->in_flight || inst->mrc || (ccr->conn->proto != IPPROTO_UDP)) return;
+
 	/*
 	 *	We retransmit only a few kinds of packets.
 	 */
@@ -274,40 +908,18 @@ static void mod_action_dup(REQUEST *request, void *instance, UNUSED void *thread
 
 	RDEBUG("Sending duplicate %s packet to home server %s %s port %d - ID %u",
 	       fr_packet_codes[packet->code],
-	       ccr->inst->home_server->name,
+	       ccr->home->server->name,
 	       inet_ntop(packet->dst_ipaddr.af,
 			 &packet->dst_ipaddr.ipaddr,
 			 buffer, sizeof(buffer)),
 	       packet->dst_port, packet->id);
 
-	fr_radius_packet_send(packet, NULL, inst->home_server->secret);
+	fr_radius_packet_send(packet, NULL, ccr->home->server->secret);
 	packet->count++;
+	ccr->retransmitted = true;
 }
 
 
-/** Cleanup socket when deleting connection
- *
- */
-static void mod_conn_free(void *ctx)
-{
-	int i, max_fd;
-	fd_set fds;
-	rlm_radius_client_conn_t *conn = ctx;
-
-	DEBUG("Cleaning up sockets for module %s", conn->inst->name);
-
-	max_fd = fr_packet_list_fd_set(conn->pl, &fds);
-	for (i = 0; i < max_fd; i++) {
-		if (!FD_ISSET(i, &fds)) continue;
-
-		if (close(i) < 0) DEBUG3("Closing socket failed: %s", fr_syserror(errno));
-		fr_event_fd_delete(conn->el, i);
-	}
-	fr_packet_list_free(conn->pl);
-
-	talloc_free(conn);
-}
-
 /** Clean up an association between a child and parent request.
  *
  */
@@ -317,114 +929,94 @@ static int mod_ccr_free(rlm_radius_client_request_t *ccr)
 
 	if (!ccr->child) return 0;
 
-	if (ccr->child->in_request_hash) {
-		(void) fr_packet_list_yank(ccr->conn->pl, ccr->packet);
-		ccr->child->in_request_hash = false;
-	}
-
-	unlang_event_timeout_delete(ccr->request, ccr);
+	ccr_finish(ccr, true);
 
 	return 0;
 }
 
-/** Create and add a new socket to the connecton handle.
+/** Allocate an ID, opening another socket or connection if needed
  *
  */
-static int mod_fd_add(fr_event_list_t *el, rlm_radius_client_conn_t *conn, rlm_radius_client_instance_t const *inst)
+static int mod_id_alloc(rlm_radius_client_thread_t *t, rlm_radius_client_request_t *ccr)
 {
-	int			sockfd;
-	fr_ipaddr_t const	*server_ipaddr = &inst->src_ipaddr;
-	uint16_t		server_port = 0;
-	fr_ipaddr_t		ipaddr;
-
-	/*
-	 *	Too many outbound sockets is probably a bad idea.
-	 */
-	if (conn->num_fds > 16) {
-		PERROR("Too many open sockets (%d)", conn->num_fds);
-		return -1;
-	}
-
-	sockfd = fr_socket(server_ipaddr, server_port);
-	if (sockfd < 0) {
-		ERROR("Error opening socket");
-		return 0;
-	}
-
-	/*
-	 *	Always set the socket as non-blocking.
-	 */
-	fr_nonblock(sockfd);
-
-	/*
-	 *	The default destination is anywhere.
-	 */
-	memset(&ipaddr, 0, sizeof(ipaddr));
-	ipaddr.af = AF_INET;
-
-	if (!fr_packet_list_socket_add(conn->pl, sockfd, IPPROTO_UDP, &ipaddr, 0, NULL)) {
-		DEBUG("Failed adding socket: %s", fr_strerror());
-		close(sockfd);
-		return -1;
-	}
-
-	if (fr_event_fd_insert(el, sockfd, mod_event_fd, NULL, NULL, conn) < 0) {
-		DEBUG("Failed adding event for socket: %s", fr_strerror());
-		close(sockfd);
-		return -1;
+	rlm_radius_client_home_t	*h = ccr->home;
+	rlm_radius_client_conn_t	*conn;
+	void				*ctx = NULL;
+	bool				opened = false;
+
+	while (!fr_packet_list_id_alloc(t->pl, h->server->proto, &ccr->packet, &ctx)) {
+		if (opened) return -1;
+
+		if (h->server->proto == IPPROTO_TCP) {
+			conn = conn_tcp_open(t, h);
+		} else {
+			conn = conn_udp_open(t, h);
+		}
+		if (!conn) return -1;
+		opened = true;
 	}
 
-	conn->num_fds++;
-
-	return sockfd;
-}
-
-/*
- *	Create a new connection handle.
- */
-static void *mod_conn_create(fr_event_list_t *el, rlm_radius_client_instance_t  const *inst)
-{
-	rlm_radius_client_conn_t *conn;
-
-	conn = talloc(NULL, rlm_radius_client_conn_t);
-	conn->inst = inst;
-	conn->pl = fr_packet_list_create(1);
-	conn->num_fds = 0;
-	conn->el = el;
+	ccr->conn = talloc_get_type_abort(ctx, rlm_radius_client_conn_t);
+	ccr->in_flight = true;
+	ccr->child->in_request_hash = true;
+	h->outstanding++;
 
-	if (mod_fd_add(el, conn, inst) < 0) {
-		fr_packet_list_free(conn->pl);
-		talloc_free(conn);
-		return NULL;
-	}
-
-	return conn;
+	return 0;
 }
 
-
 static rlm_rcode_t mod_wait_for_reply(REQUEST *request, rlm_radius_client_instance_t const *inst,
 				      rlm_radius_client_request_t *ccr)
 {
-	struct timeval now, timeout;
+	struct timeval when;
 	RADIUS_PACKET *packet = ccr->child->packet;
+	rlm_radius_client_home_t *h = ccr->home;
 	char buffer[INET6_ADDRSTRLEN];
 
+	/*
+	 *	Grab an ID.  If we can't, try to create
+	 *	another socket, which will give us more IDs.
+	 */
+	if (mod_id_alloc(ccr->thread, ccr) < 0) {
+		RPEDEBUG("Failed allocating ID");
+		mod_cleanup(request, ccr);
+		return RLM_MODULE_FAIL;
+	}
+
 	RDEBUG("Sending %s packet to home server %s %s port %d - ID %u",
 	       fr_packet_codes[packet->code],
-	       ccr->inst->home_server->name,
+	       h->server->name,
 	       inet_ntop(packet->dst_ipaddr.af,
 			 &packet->dst_ipaddr.ipaddr,
 			 buffer, sizeof(buffer)),
 	       packet->dst_port, packet->id);
 
-	(void) fr_radius_packet_send(packet, NULL, inst->home_server->secret);
+	if (conn_send(ccr->conn, packet, h->server->secret) < 0) {
+		RPEDEBUG("Failed sending packet");
+		mod_cleanup(request, ccr);
+		return RLM_MODULE_FAIL;
+	}
 	packet->count++;
 
-	timeout = ccr->inst->home_server->response_window;
-	gettimeofday(&now, NULL);
-	fr_timeval_add(&timeout, &now, &timeout);
+	gettimeofday(&ccr->sent, NULL);
+	fr_timeval_add(&ccr->deadline, &ccr->sent, &h->server->response_window);
 
-	unlang_event_timeout_add(request, mod_proxy_no_reply, ccr, &timeout);
+	/*
+	 *	TCP is reliable, so we only need to know
+	 *	when to give up.
+	 */
+	if ((ccr->conn->proto != IPPROTO_UDP) || !inst->mrc) {
+		when = ccr->deadline;
+	} else {
+		ccr->rt = rt_jitter(tv_to_usec(&inst->irt));
+		usec_to_tv(&when, tv_to_usec(&ccr->sent) + ccr->rt);
+		if (fr_timeval_cmp(&when, &ccr->deadline) > 0) when = ccr->deadline;
+	}
+
+	if (fr_event_timer_insert(ccr->thread->el, mod_retransmit, ccr, &when, &ccr->ev) < 0) {
+		RPEDEBUG("Failed inserting retransmission timer");
+		mod_cleanup(request, ccr);
+		return RLM_MODULE_FAIL;
+	}
 
 	return unlang_yield(request, mod_resume_continue, mod_action_dup, ccr);
 }
@@ -458,7 +1050,8 @@ static rlm_rcode_t mod_resume_send(REQUEST *request, void *instance, UNUSED void
 static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, void *thread, REQUEST *request)
 {
 	rlm_radius_client_instance_t const *inst = instance;
-	rlm_radius_client_conn_t *conn;
+	rlm_radius_client_thread_t *t = thread;
+	rlm_radius_client_home_t *h;
 	rlm_radius_client_request_t *ccr;
 	RADIUS_PACKET *packet;
 	VALUE_PAIR *vp;
@@ -470,35 +1063,34 @@ static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, void *thread, RE
 		return RLM_MODULE_FAIL;
 	}
 
-	conn = pthread_getspecific(inst->key);
-	if (!conn) {
-		conn = mod_conn_create(request->el, inst);
-		if (!conn) return RLM_MODULE_FAIL;
-
-		if (pthread_setspecific(inst->key, conn) != 0) {
-			rad_assert(0 == 1);
-		}
+	h = home_select(t, time(NULL));
+	if (!h) {
+		REDEBUG("All home servers have the maximum number of packets outstanding");
+		return RLM_MODULE_FAIL;
 	}
 
 	/*
 	 *	We need to tie the child to both the parent, to the
-	 *	module instance, and to the connection it's using.
+	 *	module instance, and to the home server it's using.
 	 */
-	MEM(ccr = talloc(request, rlm_radius_client_request_t));
+	MEM(ccr = talloc_zero(request, rlm_radius_client_request_t));
 
 	ccr->inst = inst;
 	ccr->request = request;
 	ccr->rcode = RLM_MODULE_FAIL;
-	ccr->conn = conn;
+	ccr->thread = t;
+	ccr->home = h;
 
 	talloc_set_destructor(ccr, mod_ccr_free);
 
 	request_data_add(request, inst, 0, ccr, false, false, false);
 
 	/*
-	 *	Create the child request and packet.
+	 *	Create the child request and packet.  The child is
+	 *	parented by ccr, so that it's freed after mod_ccr_free()
+	 *	has removed its packet from the packet list.
 	 */
-	MEM(ccr->child = child = request_alloc(request));
+	MEM(ccr->child = child = request_alloc(ccr));
 
 	MEM(ccr->packet = packet = fr_radius_alloc(child, false));
 
@@ -512,12 +1104,12 @@ static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, void *thread, RE
 	 */
 	packet->code = request->packet->code;
 #ifdef WITH_TCP
-	packet->proto = IPPROTO_UDP;
+	packet->proto = h->server->proto;
 #endif
-	packet->dst_ipaddr = inst->home_server->ipaddr;
-	packet->dst_port = inst->home_server->port;
+	packet->dst_ipaddr = h->server->ipaddr;
+	packet->dst_port = h->server->port;
 
-	packet->src_ipaddr = inst->home_server->src_ipaddr;
+	packet->src_ipaddr = h->src_ipaddr;
 	packet->src_port = 0;
 
 #ifndef NDEBUG
@@ -565,27 +1157,10 @@ static rlm_rcode_t CC_HINT(nonnull) mod_process(void *instance, void *thread, RE
 		fr_pair_make(packet, &packet->vps, "Message-Authenticator", "0x00", T_OP_SET);
 	}
 
-	/*
-	 *	Grab an ID.  If we can't, try to create
-	 *	another socket, which will give us more IDs.
-	 */
-	if (!fr_packet_list_id_alloc(conn->pl, IPPROTO_UDP, &ccr->packet, NULL)) {
-		if (mod_fd_add(request->el, conn, inst) < 0) {
-			talloc_free(ccr);
-			RPEDEBUG("Failed adding more sockets");
-			return RLM_MODULE_FAIL;
-		}
-
-		if (!fr_packet_list_id_alloc(conn->pl, IPPROTO_UDP, &ccr->packet, NULL)) {
-			talloc_free(ccr);
-			RPEDEBUG("Failed allocating ID");
-			return RLM_MODULE_FAIL;
-		}
-	}
-	child->in_request_hash = true;
-
 	/*
 	 *	If we have a virtual server here, then run it.
+	 *	The ID is allocated after "send", so that the
+	 *	packet isn't outstanding until it's been sent.
 	 */
 	if (!inst->server_cs) return mod_wait_for_reply(request, inst, ccr);
 
@@ -654,38 +1229,51 @@ static int mod_bootstrap(CONF_SECTION *config, void *instance)
 	inst->name = cf_section_name2(config);
 	if (!inst->name) inst->name = cf_section_name1(config);
 
-	cs = cf_subsection_find_next(config, NULL, "home_server");
-	if (!cs) {
-		cf_log_err_cs(config, "You must specify at least one home server");
-		return -1;
+	for (cs = cf_subsection_find_next(config, NULL, "home_server");
+	     cs != NULL;
+	     cs = cf_subsection_find_next(config, cs, "home_server")) {
+		inst->num_home_servers++;
 	}
 
-	if (cf_subsection_find_next(config, cs, "home_server") != NULL) {
-		cf_log_err_cs(config, "Too many home servers were given.");
+	if (!inst->num_home_servers) {
+		cf_log_err_cs(config, "You must specify at least one home server");
 		return -1;
 	}
 
-	home = home_server_afrom_cs(config, NULL, cs);
-	if (!home) {
-		cf_log_err_cs(config, "Failed parsing home server");
-		return -1;
-	}
+	inst->home_servers = talloc_zero_array(inst, home_server_t *, inst->num_home_servers);
+	if (!inst->home_servers) return -1;
+
+	for (cs = cf_subsection_find_next(config, NULL, "home_server"), i = 0;
+	     cs != NULL;
+	     cs = cf_subsection_find_next(config, cs, "home_server"), i++) {
+		home = home_server_afrom_cs(config, NULL, cs);
+		if (!home) {
+			cf_log_err_cs(config, "Failed parsing home server");
+			return -1;
+		}
 
 #ifdef WITH_TCP
-	if (home->proto != IPPROTO_UDP) {
-		cf_log_err_cs(config, "Only home servers of 'proto = udp' are allowed.");
-		return -1;
-	}
+		if ((home->proto != IPPROTO_UDP) && (home->proto != IPPROTO_TCP)) {
+			cf_log_err_cs(cs, "Only home servers of 'proto = udp' or 'proto = tcp' are allowed.");
+			return -1;
+		}
 #endif
 
-	if (home->ping_check != HOME_PING_CHECK_NONE) {
-		cf_log_err_cs(config, "Only home servers of 'status_check = none' is allowed.");
-		return -1;
-	}
+		if (home->ping_check != HOME_PING_CHECK_NONE) {
+			cf_log_err_cs(cs, "Only home servers of 'status_check = none' is allowed.");
+			return -1;
+		}
+
+		if (i && (home->type != inst->home_servers[0]->type)) {
+			cf_log_err_cs(cs, "All home servers must have the same type.");
+			return -1;
+		}
 
-	DEBUG("%s: Adding home server %s", inst->name, home->name);
+		DEBUG("%s: Adding home server %s", inst->name, home->name);
 
-	inst->home_server = home;
+		inst->home_servers[i] = home;
+	}
+	home = inst->home_servers[0];
 
 	if (!inst->virtual_server) return RLM_MODULE_OK;
 
@@ -711,7 +1299,7 @@ static int mod_bootstrap(CONF_SECTION *config, void *instance)
 
 	case HOME_TYPE_ACCT:
 		for (i = 0; acct_names[i][0] != NULL; i++) {
-			if (mod_compile_section(cs, auth_names[i][0], auth_names[i][1]) < 0) {
+			if (mod_compile_section(cs, acct_names[i][0], acct_names[i][1]) < 0) {
 				return -1;
 			}
 		}
@@ -720,7 +1308,7 @@ static int mod_bootstrap(CONF_SECTION *config, void *instance)
 
 	case HOME_TYPE_COA:
 		for (i = 0; coa_names[i][0] != NULL; i++) {
-			if (mod_compile_section(cs, auth_names[i][0], auth_names[i][1]) < 0) {
+			if (mod_compile_section(cs, coa_names[i][0], coa_names[i][1]) < 0) {
 				return -1;
 			}
 		}
@@ -744,15 +1332,88 @@ static int mod_bootstrap(CONF_SECTION *config, void *instance)
 
 static int mod_instantiate(UNUSED CONF_SECTION *config, void *instance)
 {
-	int				rcode;
 	rlm_radius_client_instance_t	*inst = instance;
 
-	rcode = pthread_key_create(&inst->key, mod_conn_free);
-	if (rcode != 0) {
-		ERROR("Failed creating pthread key: %s", strerror(rcode));
+	FR_INTEGER_BOUND_CHECK("max_sockets", inst->max_sockets, >=, 1);
+	FR_INTEGER_BOUND_CHECK("max_sockets", inst->max_sockets, <=, 1024);
+
+	FR_TIMEVAL_BOUND_CHECK("initial_rtx_time", &inst->irt, >=, 0, 100000);
+	FR_TIMEVAL_BOUND_CHECK("initial_rtx_time", &inst->irt, <=, 60, 0);
+	FR_TIMEVAL_BOUND_CHECK("max_rtx_time", &inst->mrt, >=, inst->irt.tv_sec, inst->irt.tv_usec);
+	FR_TIMEVAL_BOUND_CHECK("max_rtx_time", &inst->mrt, <=, 60, 0);
+	FR_INTEGER_BOUND_CHECK("max_rtx_count", inst->mrc, <=, 20);
+
+	return 0;
+}
+
+/** Set up the sockets and home servers for a worker thread
+ *
+ * Sockets and connections are opened when the first packet which needs
+ * them is sent.
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_radius_client_instance_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_radius_client_instance_t	*inst = instance;
+	rlm_radius_client_thread_t	*t = thread;
+	int				i;
+
+	t->inst = inst;
+	t->el = el;
+
+	t->pl = fr_packet_list_create(1);
+	if (!t->pl) {
+		ERROR("%s: Failed creating packet list", inst->name);
+		return -1;
+	}
+
+	t->homes = talloc_zero_array(NULL, rlm_radius_client_home_t, inst->num_home_servers);
+	if (!t->homes) {
+		fr_packet_list_free(t->pl);
 		return -1;
 	}
 
+	for (i = 0; i < inst->num_home_servers; i++) {
+		rlm_radius_client_home_t	*h = &t->homes[i];
+		home_server_t const		*home = inst->home_servers[i];
+
+		h->server = home;
+		h->thread = t;
+
+		/*
+		 *	The home server's src_ipaddr, then ours, then
+		 *	any address in the right family.
+		 */
+		if (home->src_ipaddr.af == home->ipaddr.af) {
+			h->src_ipaddr = home->src_ipaddr;
+		} else if (inst->src_ipaddr.af == home->ipaddr.af) {
+			h->src_ipaddr = inst->src_ipaddr;
+		} else {
+			h->src_ipaddr.af = home->ipaddr.af;
+		}
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_radius_client_thread_t *t = thread;
+
+	DEBUG("Cleaning up sockets for module %s", t->inst->name);
+
+	while (t->conns) talloc_free(t->conns);
+	talloc_free(t->homes);
+	fr_packet_list_free(t->pl);
+
 	return 0;
 }
 
@@ -767,13 +1428,16 @@ static int mod_instantiate(UNUSED CONF_SECTION *config, void *instance)
  */
 extern rad_module_t rlm_radius_client;
 rad_module_t rlm_radius_client = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "radius_client",
-	.type		= RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE,
-	.inst_size	= sizeof(rlm_radius_client_instance_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "radius_client",
+	.type			= RLM_TYPE_THREAD_SAFE | RLM_TYPE_RESUMABLE,
+	.inst_size		= sizeof(rlm_radius_client_instance_t),
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_radius_client_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_PREACCT]		= mod_process,
 		[MOD_AUTHENTICATE]     	= mod_process,
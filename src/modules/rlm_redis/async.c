@@ -0,0 +1,863 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file async.c
+ * @brief Asynchronous Redis commands, multiplexed over one connection per cluster node
+ *
+ * Each worker thread gets its own #fr_redis_async_t, which holds at most one
+ * hiredis async connection to each cluster node.  Commands from all the requests
+ * the worker is processing are written to the same connection, and Redis
+ * returns the replies in the order the commands were sent, so many requests
+ * share the cost of each read and write.
+ *
+ * A group of commands (a pipeline) is built with #fr_redis_async_cmd_alloc and
+ * #fr_redis_async_cmd_append, and sent with #fr_redis_async_cmd_send.  Once
+ * every reply in the pipeline has been received the callback is run, usually
+ * to mark the request as resumable.
+ *
+ * -MOVED and -ASK redirects, and -TRYAGAIN responses, are handled here, in the
+ * same way as #fr_redis_cluster_state_next handles them for synchronous commands.
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+#include "async.h"
+#include <freeradius-devel/rad_assert.h>
+
+/** How long to wait before attempting to reconnect to a node after a connection failed
+ */
+#define REDIS_ASYNC_RECONNECT_DELAY	1
+
+typedef struct redis_async_conn {
+	fr_redis_async_t	*async;		//!< This connection belongs to.
+	fr_socket_addr_t	addr;		//!< Of the node.
+	char			name[INET6_ADDRSTRLEN];	//!< Printable IP address of the node.
+
+	redisAsyncContext	*ac;		//!< hiredis async context.  NULL if not connected.
+	int			fd;		//!< File descriptor of the current connection.
+	bool			registered;	//!< Whether the fd is in the event list.
+	bool			writing;	//!< Whether hiredis has data waiting to be written.
+	fr_event_timer_t	*connect_ev;	//!< Fires if the connection isn't up within connect_timeout.
+
+	time_t			retry_after;	//!< Don't attempt to reconnect before this time.
+} redis_async_conn_t;
+
+struct fr_redis_async {
+	char const		*log_prefix;	//!< What to prepend to log messages.
+	fr_event_list_t		*el;		//!< Event list of the worker thread.
+	fr_redis_cluster_t	*cluster;	//!< Used to find the node responsible for a key.
+	fr_redis_conf_t const	*conf;		//!< Redis connection configuration.
+	struct timeval		connect_timeout;	//!< How long to wait for a connection to be established.
+
+	rbtree_t		*conns;		//!< Connections to cluster nodes, by address.
+	uint32_t		outstanding;	//!< Number of pipelines which haven't completed.
+	bool			freeing;	//!< Don't call user callbacks, we're being freed.
+};
+
+struct fr_redis_async_cmd {
+	fr_redis_async_t	*async;		//!< Command belongs to.
+	REQUEST			*request;	//!< Command was issued for.  NULL if cancelled.
+
+	uint8_t			*key;		//!< Used to determine which node to send the commands to.
+	size_t			key_len;	//!< Length of key.
+	bool			read_only;	//!< Commands may be sent to a slave.
+
+	char			**cmds;		//!< Commands in RESP format.  Lengths are given
+						//!< by talloc_array_length.
+	redisReply		**replies;	//!< One reply per command.
+	size_t			sent;		//!< Number of commands written to the connection.
+	size_t			received;	//!< Number of replies received.
+	fr_redis_rcode_t	status;		//!< Lowest status of any reply.
+	redisReply		*status_reply;	//!< Reply which set the status.
+
+	fr_socket_addr_t	redirect;	//!< Node we were redirected to.
+	bool			redirected;	//!< Use redirect instead of the node responsible for key.
+	bool			asking;		//!< Send ASKING before the commands.
+	uint32_t		redirects;	//!< Number of redirects we've followed.
+	uint32_t		retries;	//!< Number of -TRYAGAIN responses we've received.
+	fr_event_timer_t	*retry_ev;	//!< Waiting to resend after -TRYAGAIN.
+
+	bool			in_flight;	//!< Waiting for replies.
+
+	fr_redis_async_cb_t	callback;	//!< To call when all replies have been received.
+	void			*uctx;		//!< Passed to callback.
+};
+
+static int redis_async_cmd_write(fr_redis_async_cmd_t *cmd);
+
+/** Compare two connections by node address
+ *
+ */
+static int redis_async_conn_cmp(void const *one, void const *two)
+{
+	redis_async_conn_t const *a = one, *b = two;
+	int ret;
+
+	ret = fr_ipaddr_cmp(&a->addr.ipaddr, &b->addr.ipaddr);
+	if (ret != 0) return ret;
+
+	return a->addr.port - b->addr.port;
+}
+
+/** Copy a reply
+ *
+ * hiredis frees replies once the reply callback returns, so we need our own copy.
+ * Memory is allocated the same way hiredis allocates it, so the copy can be freed
+ * with freeReplyObject.
+ */
+static redisReply *redis_reply_dup(redisReply const *in)
+{
+	redisReply	*out;
+	size_t		i;
+
+	out = calloc(1, sizeof(*out));
+	if (!out) return NULL;
+
+	out->type = in->type;
+	out->integer = in->integer;
+
+	if (in->str) {
+		out->str = malloc(in->len + 1);
+		if (!out->str) {
+		error:
+			freeReplyObject(out);
+			return NULL;
+		}
+		memcpy(out->str, in->str, in->len);
+		out->str[in->len] = '\0';
+		out->len = in->len;
+	}
+
+	if (in->element) {
+		out->element = calloc(in->elements, sizeof(out->element[0]));
+		if (!out->element) goto error;
+		out->elements = in->elements;
+
+		for (i = 0; i < in->elements; i++) {
+			if (!in->element[i]) continue;
+
+			out->element[i] = redis_reply_dup(in->element[i]);
+			if (!out->element[i]) goto error;
+		}
+	}
+
+	return out;
+}
+
+/*
+ *	Event loop adapter.  hiredis calls these to tell us which
+ *	events it's interested in.  The read filter stays registered
+ *	for as long as the connection is open, the write filter is only
+ *	registered when hiredis has data waiting to be written.
+ */
+static void _redis_async_read(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(ctx, redis_async_conn_t);
+
+	if (conn->ac) redisAsyncHandleRead(conn->ac);
+}
+
+static void _redis_async_write(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(ctx, redis_async_conn_t);
+
+	if (conn->ac) redisAsyncHandleWrite(conn->ac);
+}
+
+static void _redis_async_error(UNUSED fr_event_list_t *el, UNUSED int fd, void *ctx)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(ctx, redis_async_conn_t);
+
+	/*
+	 *	hiredis notices the error when it
+	 *	tries to read, and disconnects.
+	 */
+	if (conn->ac) redisAsyncHandleRead(conn->ac);
+}
+
+static void redis_async_fd_update(redis_async_conn_t *conn)
+{
+	fr_redis_async_t *async = conn->async;
+
+	if (fr_event_fd_insert(async->el, conn->fd, _redis_async_read,
+			       conn->writing ? _redis_async_write : NULL,
+			       _redis_async_error, conn) < 0) {
+		PERROR("%s - Failed adding connection to %s:%u to event loop",
+		       async->log_prefix, conn->name, conn->addr.port);
+		return;
+	}
+	conn->registered = true;
+}
+
+static void _redis_async_add_read(void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	if (!conn->registered) redis_async_fd_update(conn);
+}
+
+static void _redis_async_del_read(UNUSED void *ctx)
+{
+	/*
+	 *	The read filter is removed when hiredis calls cleanup.
+	 */
+}
+
+static void _redis_async_add_write(void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	if (conn->writing && conn->registered) return;
+	conn->writing = true;
+	redis_async_fd_update(conn);
+}
+
+static void _redis_async_del_write(void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	if (!conn->writing) return;
+	conn->writing = false;
+	if (conn->registered) redis_async_fd_update(conn);
+}
+
+static void _redis_async_cleanup(void *ctx)
+{
+	redis_async_conn_t *conn = ctx;
+
+	if (conn->registered) fr_event_fd_delete(conn->async->el, conn->fd);
+	conn->registered = false;
+	conn->writing = false;
+	conn->fd = -1;
+}
+
+/** Record that a connection has gone away
+ *
+ * hiredis frees the context itself, and calls the reply callback of every
+ * command still waiting for a reply with a NULL reply.
+ */
+static void redis_async_conn_lost(redis_async_conn_t *conn)
+{
+	conn->ac = NULL;
+	conn->retry_after = time(NULL) + REDIS_ASYNC_RECONNECT_DELAY;
+}
+
+static void _redis_async_connected(redisAsyncContext const *ac, int status)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(ac->data, redis_async_conn_t);
+
+	if (conn->connect_ev) fr_event_timer_delete(conn->async->el, &conn->connect_ev);
+
+	if (status != REDIS_OK) {
+		ERROR("%s - Failed connecting to %s:%u: %s", conn->async->log_prefix,
+		      conn->name, conn->addr.port, ac->errstr);
+		redis_async_conn_lost(conn);
+		return;
+	}
+
+	DEBUG2("%s - Connected to %s:%u", conn->async->log_prefix, conn->name, conn->addr.port);
+}
+
+static void _redis_async_disconnected(redisAsyncContext const *ac, int status)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(ac->data, redis_async_conn_t);
+
+	if (status != REDIS_OK) {
+		ERROR("%s - Connection to %s:%u failed: %s", conn->async->log_prefix,
+		      conn->name, conn->addr.port, ac->errstr);
+	} else {
+		DEBUG2("%s - Disconnected from %s:%u", conn->async->log_prefix, conn->name, conn->addr.port);
+	}
+	redis_async_conn_lost(conn);
+}
+
+/** Give up on a connection which hasn't been established within connect_timeout
+ *
+ * hiredis doesn't have a timeout for asynchronous connections, so without
+ * this, commands would queue on a connection to an unreachable node until
+ * the kernel gives up.  Freeing the context calls the reply callback of every
+ * command queued on it with a NULL reply.
+ */
+static void _redis_async_connect_timeout(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *ctx)
+{
+	redis_async_conn_t	*conn = talloc_get_type_abort(ctx, redis_async_conn_t);
+	redisAsyncContext	*ac = conn->ac;
+
+	conn->connect_ev = NULL;
+	if (!ac) return;
+
+	ERROR("%s - Timed out connecting to %s:%u", conn->async->log_prefix, conn->name, conn->addr.port);
+
+	redis_async_conn_lost(conn);
+	redisAsyncFree(ac);
+}
+
+/** Log errors from the AUTH and SELECT commands sent when a connection is opened
+ *
+ */
+static void _redis_async_setup_reply(UNUSED redisAsyncContext *ac, void *r, void *privdata)
+{
+	redis_async_conn_t	*conn = talloc_get_type_abort(privdata, redis_async_conn_t);
+	redisReply		*reply = r;
+
+	if (!reply || (reply->type != REDIS_REPLY_ERROR)) return;
+
+	ERROR("%s - Failed setting up connection to %s:%u: %.*s", conn->async->log_prefix,
+	      conn->name, conn->addr.port, (int)reply->len, reply->str);
+}
+
+/** Start connecting to a node
+ *
+ * The connection completes asynchronously, commands may be queued immediately.
+ */
+static int redis_async_conn_open(redis_async_conn_t *conn)
+{
+	fr_redis_async_t	*async = conn->async;
+	redisAsyncContext	*ac;
+
+	DEBUG2("%s - Connecting to %s:%u", async->log_prefix, conn->name, conn->addr.port);
+
+	ac = redisAsyncConnect(conn->name, conn->addr.port);
+	if (!ac) {
+		ERROR("%s - Failed allocating connection to %s:%u", async->log_prefix, conn->name, conn->addr.port);
+		return -1;
+	}
+	if (ac->err) {
+		ERROR("%s - Failed connecting to %s:%u: %s", async->log_prefix, conn->name, conn->addr.port, ac->errstr);
+		redisAsyncFree(ac);
+		conn->retry_after = time(NULL) + REDIS_ASYNC_RECONNECT_DELAY;
+		return -1;
+	}
+
+	ac->data = conn;
+	ac->ev.data = conn;
+	ac->ev.addRead = _redis_async_add_read;
+	ac->ev.delRead = _redis_async_del_read;
+	ac->ev.addWrite = _redis_async_add_write;
+	ac->ev.delWrite = _redis_async_del_write;
+	ac->ev.cleanup = _redis_async_cleanup;
+	redisAsyncSetConnectCallback(ac, _redis_async_connected);
+	redisAsyncSetDisconnectCallback(ac, _redis_async_disconnected);
+
+	conn->ac = ac;
+	conn->fd = ac->c.fd;
+	conn->writing = false;
+	conn->registered = false;
+	redis_async_fd_update(conn);
+
+	if (timerisset(&async->connect_timeout)) {
+		struct timeval when;
+
+		gettimeofday(&when, NULL);
+		fr_timeval_add(&when, &when, &async->connect_timeout);
+		if (fr_event_timer_insert(async->el, _redis_async_connect_timeout, conn,
+					  &when, &conn->connect_ev) < 0) {
+			PERROR("%s - Failed inserting connect timer", async->log_prefix);
+		}
+	}
+
+	/*
+	 *	Queued ahead of any other command, so
+	 *	will be processed first by the server.
+	 */
+	if (async->conf->password) {
+		redisAsyncCommand(ac, _redis_async_setup_reply, conn, "AUTH %s", async->conf->password);
+	}
+	if (async->conf->database) {
+		redisAsyncCommand(ac, _redis_async_setup_reply, conn, "SELECT %i", async->conf->database);
+	}
+
+	return 0;
+}
+
+/** Find or create the connection to a node
+ *
+ */
+static redis_async_conn_t *redis_async_conn_get(fr_redis_async_t *async, REQUEST *request,
+						fr_socket_addr_t const *addr)
+{
+	redis_async_conn_t	find, *conn;
+
+	find.addr = *addr;
+	conn = rbtree_finddata(async->conns, &find);
+	if (!conn) {
+		conn = talloc_zero(async, redis_async_conn_t);
+		if (!conn) return NULL;
+
+		conn->async = async;
+		conn->addr = *addr;
+		conn->fd = -1;
+		inet_ntop(addr->ipaddr.af, &addr->ipaddr.ipaddr, conn->name, sizeof(conn->name));
+
+		if (!rbtree_insert(async->conns, conn)) {
+			talloc_free(conn);
+			return NULL;
+		}
+	}
+
+	if (conn->ac) return conn;
+
+	if (time(NULL) < conn->retry_after) {
+		REDEBUG("Connection to %s:%u failed recently, not reconnecting yet", conn->name, conn->addr.port);
+		return NULL;
+	}
+
+	if (redis_async_conn_open(conn) < 0) {
+		REDEBUG("Failed connecting to %s:%u", conn->name, conn->addr.port);
+		return NULL;
+	}
+
+	return conn;
+}
+
+/** Close all connections
+ *
+ * Called before the commands are freed, so that hiredis doesn't
+ * call reply callbacks with freed privdata.
+ */
+static int _redis_async_conn_close(UNUSED void *ctx, void *data)
+{
+	redis_async_conn_t *conn = talloc_get_type_abort(data, redis_async_conn_t);
+
+	if (conn->connect_ev) fr_event_timer_delete(conn->async->el, &conn->connect_ev);
+	if (conn->ac) redisAsyncFree(conn->ac);	/* Calls _redis_async_disconnected */
+
+	return 0;
+}
+
+static int _redis_async_free(fr_redis_async_t *async)
+{
+	async->freeing = true;
+
+	rbtree_walk(async->conns, RBTREE_IN_ORDER, _redis_async_conn_close, NULL);
+
+	return 0;
+}
+
+/** Allocate a new asynchronous command engine
+ *
+ * Should be called once per worker thread.  Connections to the cluster nodes
+ * are opened when the first command for that node is sent.
+ *
+ * @param[in] ctx		to allocate the engine in.
+ * @param[in] el		Event list of the worker thread.
+ * @param[in] cluster		to use to determine which node to send commands to.
+ * @param[in] conf		Connection configuration.  Must remain valid for the lifetime of the engine.
+ * @param[in] connect_timeout	How long to wait for a connection to a node to be established.
+ *				NULL or zero to wait as long as the kernel does.
+ * @param[in] log_prefix	to prepend to log messages.
+ * @return
+ *	- New engine.
+ *	- NULL on error.
+ */
+fr_redis_async_t *fr_redis_async_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+				       fr_redis_conf_t const *conf, struct timeval const *connect_timeout,
+				       char const *log_prefix)
+{
+	fr_redis_async_t *async;
+
+	async = talloc_zero(ctx, fr_redis_async_t);
+	if (!async) return NULL;
+
+	async->el = el;
+	async->cluster = cluster;
+	async->conf = conf;
+	if (connect_timeout) async->connect_timeout = *connect_timeout;
+	async->log_prefix = talloc_typed_strdup(async, log_prefix);
+
+	async->conns = rbtree_create(async, redis_async_conn_cmp, NULL, RBTREE_FLAG_NONE);
+	if (!async->conns) {
+		talloc_free(async);
+		return NULL;
+	}
+	talloc_set_destructor(async, _redis_async_free);
+
+	return async;
+}
+
+/** Return the number of pipelines which are waiting for replies
+ *
+ */
+uint32_t fr_redis_async_outstanding(fr_redis_async_t *async)
+{
+	return async->outstanding;
+}
+
+/** Free any replies we've received so the pipeline can be sent again
+ *
+ */
+static void redis_async_cmd_reset(fr_redis_async_cmd_t *cmd)
+{
+	size_t i;
+
+	for (i = 0; i < cmd->received; i++) {
+		if (cmd->replies[i]) freeReplyObject(cmd->replies[i]);
+		cmd->replies[i] = NULL;
+	}
+	cmd->sent = 0;
+	cmd->received = 0;
+	cmd->status = REDIS_RCODE_SUCCESS;
+	cmd->status_reply = NULL;
+}
+
+static int _redis_async_cmd_free(fr_redis_async_cmd_t *cmd)
+{
+	if (cmd->retry_ev) fr_event_timer_delete(cmd->async->el, &cmd->retry_ev);
+	redis_async_cmd_reset(cmd);
+	cmd->async->outstanding--;
+
+	return 0;
+}
+
+/** Allocate a new pipeline of commands
+ *
+ * @param[in] async	engine to send the commands with.
+ * @param[in] request	commands are being sent for.
+ * @param[in] key	used to determine which node the commands are sent to.
+ * @param[in] key_len	Length of key.
+ * @param[in] read_only	If true, commands may be sent to a slave.
+ * @param[in] callback	to call when all replies have been received.
+ * @param[in] uctx	to pass to callback.
+ * @return
+ *	- New command.
+ *	- NULL on error.
+ */
+fr_redis_async_cmd_t *fr_redis_async_cmd_alloc(fr_redis_async_t *async, REQUEST *request,
+					       uint8_t const *key, size_t key_len, bool read_only,
+					       fr_redis_async_cb_t callback, void *uctx)
+{
+	fr_redis_async_cmd_t *cmd;
+
+	cmd = talloc_zero(async, fr_redis_async_cmd_t);
+	if (!cmd) return NULL;
+
+	cmd->async = async;
+	cmd->request = request;
+	cmd->key = talloc_memdup(cmd, key, key_len);
+	cmd->key_len = key_len;
+	cmd->read_only = read_only;
+	cmd->callback = callback;
+	cmd->uctx = uctx;
+	cmd->cmds = talloc_array(cmd, char *, 0);
+
+	async->outstanding++;
+	talloc_set_destructor(cmd, _redis_async_cmd_free);
+
+	return cmd;
+}
+
+/** Add a command to a pipeline
+ *
+ * @param[in] cmd	to add command to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ap	Arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_async_cmd_vappend(fr_redis_async_cmd_t *cmd, char const *fmt, va_list ap)
+{
+	char	*buff;
+	int	len, ret;
+
+	len = redisvFormatCommand(&buff, fmt, ap);
+	if (len < 0) {
+		fr_strerror_printf("Failed formatting command");
+		return -1;
+	}
+
+	ret = fr_redis_async_cmd_append_formatted(cmd, buff, (size_t)len);
+	free(buff);
+
+	return ret;
+}
+
+/** Add a command to a pipeline
+ *
+ * @param[in] cmd	to add command to.
+ * @param[in] fmt	hiredis format string.
+ * @param[in] ...	Arguments for the format string.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_async_cmd_append(fr_redis_async_cmd_t *cmd, char const *fmt, ...)
+{
+	va_list	ap;
+	int	ret;
+
+	va_start(ap, fmt);
+	ret = fr_redis_async_cmd_vappend(cmd, fmt, ap);
+	va_end(ap);
+
+	return ret;
+}
+
+/** Add a command which has already been formatted to a pipeline
+ *
+ * Useful where the same command may need to be sent in more than one pipeline.
+ *
+ * @param[in] cmd	to add command to.
+ * @param[in] resp	Command in RESP format, as produced by redisFormatCommand.
+ * @param[in] len	Length of resp.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.
+ */
+int fr_redis_async_cmd_append_formatted(fr_redis_async_cmd_t *cmd, char const *resp, size_t len)
+{
+	char	**cmds;
+	size_t	num;
+
+	rad_assert(!cmd->in_flight);
+
+	num = talloc_array_length(cmd->cmds);
+	cmds = talloc_realloc(cmd, cmd->cmds, char *, num + 1);
+	if (!cmds) {
+	oom:
+		fr_strerror_printf("Out of memory");
+		return -1;
+	}
+	cmd->cmds = cmds;
+
+	cmds[num] = talloc_memdup(cmds, resp, len);
+	if (!cmds[num]) goto oom;
+
+	return 0;
+}
+
+/** Run the user callback and free the command
+ *
+ */
+static void redis_async_cmd_complete(fr_redis_async_cmd_t *cmd)
+{
+	if (cmd->request && !cmd->async->freeing) {
+		cmd->callback(cmd->request, cmd->status, cmd->replies, cmd->received, cmd->uctx);
+	}
+	talloc_free(cmd);
+}
+
+static void _redis_async_retry(UNUSED fr_event_list_t *el, UNUSED struct timeval *now, void *ctx)
+{
+	fr_redis_async_cmd_t	*cmd = talloc_get_type_abort(ctx, fr_redis_async_cmd_t);
+
+	cmd->retry_ev = NULL;
+
+	if (redis_async_cmd_write(cmd) < 0) redis_async_cmd_complete(cmd);
+}
+
+/** Deal with redirects and -TRYAGAIN once all replies have been received
+ *
+ */
+static void redis_async_cmd_done(fr_redis_async_cmd_t *cmd)
+{
+	fr_redis_async_t	*async = cmd->async;
+	REQUEST			*request = cmd->request;
+	struct timeval		when;
+
+	if (!request || async->freeing) {
+		talloc_free(cmd);
+		return;
+	}
+
+	switch (cmd->status) {
+	case REDIS_RCODE_MOVE:
+	case REDIS_RCODE_ASK:
+		if (cmd->redirects >= async->conf->max_redirects) {
+			REDEBUG("Reached max_redirects (%u)", cmd->redirects);
+			break;
+		}
+		cmd->redirects++;
+
+		if (fr_redis_cluster_node_addr_by_redirect(&cmd->redirect, async->cluster,
+							   request, cmd->status_reply) < 0) {
+			RPEDEBUG("Failed following redirect");
+			break;
+		}
+		cmd->redirected = true;
+		cmd->asking = (cmd->status == REDIS_RCODE_ASK);
+
+		redis_async_cmd_reset(cmd);
+		if (redis_async_cmd_write(cmd) < 0) break;
+		return;
+
+	case REDIS_RCODE_TRY_AGAIN:
+		if (cmd->retries >= async->conf->max_retries) {
+			REDEBUG("Reached max_retries (%u)", cmd->retries);
+			break;
+		}
+		cmd->retries++;
+
+		RDEBUG2("Cluster busy, retrying in %u.%06us",
+			(unsigned int)async->conf->retry_delay.tv_sec,
+			(unsigned int)async->conf->retry_delay.tv_usec);
+
+		gettimeofday(&when, NULL);
+		fr_timeval_add(&when, &when, &async->conf->retry_delay);
+		if (fr_event_timer_insert(async->el, _redis_async_retry, cmd, &when, &cmd->retry_ev) < 0) {
+			RPEDEBUG("Failed inserting retry timer");
+			break;
+		}
+		redis_async_cmd_reset(cmd);
+		return;
+
+	default:
+		break;
+	}
+
+	redis_async_cmd_complete(cmd);
+}
+
+/** Receive a reply for one of the commands in a pipeline
+ *
+ */
+static void _redis_async_reply(redisAsyncContext *ac, void *r, void *privdata)
+{
+	fr_redis_async_cmd_t	*cmd = talloc_get_type_abort(privdata, fr_redis_async_cmd_t);
+	redisReply		*reply = r, *copy = NULL;
+	fr_redis_rcode_t	status;
+
+	if (!reply) {
+		fr_strerror_printf("Connection error: %s", ac->errstr);
+		status = REDIS_RCODE_RECONNECT;
+	} else {
+		status = fr_redis_command_status(NULL, reply);
+		copy = redis_reply_dup(reply);
+		if (!copy) {
+			fr_strerror_printf("Out of memory copying reply");
+			status = REDIS_RCODE_ERROR;
+		}
+	}
+
+	cmd->replies[cmd->received++] = copy;
+	if (status < cmd->status) {
+		cmd->status = status;
+		cmd->status_reply = copy;
+	}
+
+	if (cmd->received < cmd->sent) return;
+
+	cmd->in_flight = false;
+	redis_async_cmd_done(cmd);
+}
+
+/** Write the commands in a pipeline to the connection for the appropriate node
+ *
+ */
+static int redis_async_cmd_write(fr_redis_async_cmd_t *cmd)
+{
+	fr_redis_async_t	*async = cmd->async;
+	REQUEST			*request = cmd->request;
+	redis_async_conn_t	*conn;
+	fr_socket_addr_t	addr;
+	size_t			i, num = talloc_array_length(cmd->cmds);
+
+	if (cmd->redirected) {
+		addr = cmd->redirect;
+	} else if (fr_redis_cluster_node_addr_by_key(&addr, async->cluster, request,
+						     cmd->key, cmd->key_len, cmd->read_only) < 0) {
+		RPEDEBUG("Failed determining node for key");
+		cmd->status = REDIS_RCODE_RECONNECT;
+		return -1;
+	}
+
+	conn = redis_async_conn_get(async, request, &addr);
+	if (!conn) {
+		cmd->status = REDIS_RCODE_RECONNECT;
+		return -1;
+	}
+
+	if (!cmd->replies) {
+		cmd->replies = talloc_zero_array(cmd, redisReply *, num);
+		if (!cmd->replies) {
+			cmd->status = REDIS_RCODE_ERROR;
+			return -1;
+		}
+	}
+
+	if (cmd->asking) {
+		RDEBUG2(">>> Sending command(s) to %s:%u", conn->name, conn->addr.port);
+		RDEBUG2("ASKING");
+		redisAsyncCommand(conn->ac, NULL, NULL, "ASKING");
+		cmd->asking = false;
+	} else {
+		RDEBUG2(">>> Sending %zu command(s) to %s:%u", num, conn->name, conn->addr.port);
+	}
+
+	for (i = 0; i < num; i++) {
+		if (redisAsyncFormattedCommand(conn->ac, _redis_async_reply, cmd,
+					       cmd->cmds[i], talloc_array_length(cmd->cmds[i])) != REDIS_OK) break;
+		cmd->sent++;
+	}
+
+	/*
+	 *	Context was being torn down, the replies to any
+	 *	commands we did write will be NULL.
+	 */
+	if (cmd->sent == 0) {
+		REDEBUG("Connection to %s:%u is closing", conn->name, conn->addr.port);
+		cmd->status = REDIS_RCODE_RECONNECT;
+		return -1;
+	}
+	cmd->in_flight = true;
+
+	return 0;
+}
+
+/** Send a pipeline of commands
+ *
+ * On success the callback will be called exactly once, when all replies have been
+ * received, and the command will be freed after the callback returns.
+ *
+ * @param[in] cmd	to send.
+ * @return
+ *	- 0 on success.
+ *	- -1 on error.  The command should be freed with #fr_redis_async_cmd_cancel.
+ */
+int fr_redis_async_cmd_send(fr_redis_async_cmd_t *cmd)
+{
+	REQUEST *request = cmd->request;
+
+	if (talloc_array_length(cmd->cmds) == 0) {
+		REDEBUG("No commands to send");
+		return -1;
+	}
+
+	return redis_async_cmd_write(cmd);
+}
+
+/** Cancel a pipeline of commands
+ *
+ * If commands have already been written, they can't be recalled, so the replies
+ * are discarded as they arrive.  The callback will not be called.
+ *
+ * Callers should cancel commands which have taken too long, as there's no
+ * timeout here.  Replies keep arriving in order, so a slow reply doesn't
+ * hold up commands sent by other requests any longer than it would anyway.
+ *
+ * @param[in] cmd	to cancel.
+ */
+void fr_redis_async_cmd_cancel(fr_redis_async_cmd_t *cmd)
+{
+	if (!cmd->in_flight) {
+		talloc_free(cmd);
+		return;
+	}
+
+	cmd->request = NULL;
+	cmd->callback = NULL;
+}
@@ -0,0 +1,71 @@
+/*
+ *   This program is is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or (at
+ *   your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ */
+
+/**
+ * $Id$
+ * @file async.h
+ * @brief Asynchronous Redis commands, multiplexed over one connection per cluster node
+ *
+ * @copyright 2017 The FreeRADIUS server project
+ */
+
+#ifndef LIBFREERADIUS_REDIS_ASYNC_H
+#define	LIBFREERADIUS_REDIS_ASYNC_H
+
+RCSIDH(redis_async_h, "$Id$")
+
+#include "redis.h"
+#include "cluster.h"
+
+#include <freeradius-devel/event.h>
+#include <hiredis/async.h>
+
+typedef struct fr_redis_async fr_redis_async_t;
+typedef struct fr_redis_async_cmd fr_redis_async_cmd_t;
+
+/** Called when all the replies to a pipeline of commands have been received
+ *
+ * @param[in] request	the commands were sent for.
+ * @param[in] status	of the pipeline.  The lowest status of any of the replies.
+ * @param[in] replies	one for each command sent.  Freed when the callback returns,
+ *			so callers wanting to keep a reply should set its slot to NULL.
+ *			May contain NULL entries if the connection failed.
+ * @param[in] num	Number of replies.
+ * @param[in] uctx	passed to #fr_redis_async_cmd_alloc.
+ */
+typedef void (*fr_redis_async_cb_t)(REQUEST *request, fr_redis_rcode_t status,
+				    redisReply **replies, size_t num, void *uctx);
+
+fr_redis_async_t	*fr_redis_async_alloc(TALLOC_CTX *ctx, fr_event_list_t *el, fr_redis_cluster_t *cluster,
+					      fr_redis_conf_t const *conf, struct timeval const *connect_timeout,
+					      char const *log_prefix);
+
+uint32_t		fr_redis_async_outstanding(fr_redis_async_t *async);
+
+fr_redis_async_cmd_t	*fr_redis_async_cmd_alloc(fr_redis_async_t *async, REQUEST *request,
+						  uint8_t const *key, size_t key_len, bool read_only,
+						  fr_redis_async_cb_t callback, void *uctx);
+
+int			fr_redis_async_cmd_vappend(fr_redis_async_cmd_t *cmd, char const *fmt, va_list ap);
+
+int			fr_redis_async_cmd_append(fr_redis_async_cmd_t *cmd, char const *fmt, ...);
+
+int			fr_redis_async_cmd_append_formatted(fr_redis_async_cmd_t *cmd, char const *resp, size_t len);
+
+int			fr_redis_async_cmd_send(fr_redis_async_cmd_t *cmd);
+
+void			fr_redis_async_cmd_cancel(fr_redis_async_cmd_t *cmd);
+#endif /* LIBFREERADIUS_REDIS_ASYNC_H */
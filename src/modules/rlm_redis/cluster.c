@@ -1942,6 +1942,84 @@ try_again:
 	return REDIS_RCODE_TRY_AGAIN;
 }
 
+/** Resolve a key to the address of the cluster node which should handle it
+ *
+ * For callers which manage their own connections to cluster nodes.  Unlike
+ * #fr_redis_cluster_state_init no connection is reserved, so the liveness of
+ * the node isn't checked.
+ *
+ * @param[out] out Where to write the address of the node.
+ * @param[in] cluster to resolve the key in.
+ * @param[in] request The current request.
+ * @param[in] key to resolve.  If key is NULL or key_len is 0 a random slot will be chosen.
+ * @param[in] key_len Length of the key.
+ * @param[in] read_only If true, will use a random slave in preference to the master.
+ * @return
+ *	- 0 on success.
+ *	- -1 if there are no nodes in the cluster.
+ */
+int fr_redis_cluster_node_addr_by_key(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+				      uint8_t const *key, size_t key_len, bool read_only)
+{
+	cluster_key_slot_t	*key_slot;
+	cluster_node_t		*node;
+
+	if (rbtree_num_elements(cluster->used_nodes) == 0) {
+		fr_strerror_printf("No nodes in cluster");
+		return -1;
+	}
+
+	key_slot = cluster_slot_by_key(cluster, request, key, key_len);
+	if (read_only && key_slot->slave_num) {
+		node = &cluster->node[key_slot->slave[fr_rand() % key_slot->slave_num]];
+	} else {
+		node = &cluster->node[key_slot->master];
+	}
+
+	*out = node->addr;
+
+	return 0;
+}
+
+/** Resolve a -MOVED or -ASK redirect to the address of a cluster node
+ *
+ * If the redirect is a -MOVED, the key slot map is out of date, and is
+ * refreshed using a pooled connection to the node we were redirected to.
+ *
+ * @note Errors may be retrieved with fr_strerror().
+ * @note Blocks whilst the cluster is remapped.
+ *
+ * @param[out] out Where to write the address of the node.
+ * @param[in] cluster the redirect came from.
+ * @param[in] request The current request.
+ * @param[in] reply containing the redirect.
+ * @return
+ *	- 0 on success.
+ *	- -1 if the redirect was invalid.
+ */
+int fr_redis_cluster_node_addr_by_redirect(fr_socket_addr_t *out, fr_redis_cluster_t *cluster, REQUEST *request,
+					   redisReply *reply)
+{
+	cluster_node_t	*node;
+	fr_redis_conn_t	*conn;
+
+	if (cluster_node_conf_from_redirect(NULL, out, reply) < 0) return -1;
+
+	if (strncmp(REDIS_ERROR_MOVED_STR, reply->str, sizeof(REDIS_ERROR_MOVED_STR) - 1) != 0) return 0;
+
+	cluster->remap_needed = true;
+
+	if (cluster_redirect(&node, cluster, reply) < 0) return 0;
+
+	conn = fr_connection_get(node->pool, request);
+	if (!conn) return 0;
+
+	if (cluster_remap(request, cluster, conn) == CLUSTER_OP_FAILED) RDEBUG2("%s", fr_strerror());
+	fr_connection_release(node->pool, request, conn);
+
+	return 0;
+}
+
 /** Get the pool associated with a node in the cluster
  *
  * @note This is used for testing only.  It's not ifdef'd out because
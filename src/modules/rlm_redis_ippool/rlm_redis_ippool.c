@@ -48,6 +48,7 @@ RCSID("$Id$")
 
 #include "redis.h"
 #include "cluster.h"
+#include "async.h"
 #include "redis_ippool.h"
 
 /** rlm_redis module instance
@@ -93,9 +94,49 @@ typedef struct rlm_redis_ippool {
 	bool			copy_on_update; //!< Copy the address provided by ip_address to the
 						//!< allocated_address_attr if updates are successful.
 
+	bool			async;		//!< Send scripts on a shared connection per worker,
+						//!< and yield until the reply arrives.
+	struct timeval		async_timeout;	//!< How long to wait for the result of a script.
+	struct timeval		async_connect_timeout;	//!< How long to wait for a connection to a node.
+
 	fr_redis_cluster_t	*cluster;	//!< Redis cluster.
 } rlm_redis_ippool_t;
 
+/** rlm_redis_ippool thread specific data
+ *
+ */
+typedef struct rlm_redis_ippool_thread {
+	rlm_redis_ippool_t const	*inst;		//!< Instance of the module.
+	fr_event_list_t			*el;		//!< Event list of the worker.
+	fr_redis_async_t		*async;		//!< Connections to the cluster nodes.
+} rlm_redis_ippool_thread_t;
+
+/** State of an asynchronous script call
+ *
+ */
+typedef struct ippool_async_ctx {
+	rlm_redis_ippool_t const	*inst;		//!< Instance of the module.
+	fr_redis_async_t		*async;		//!< Engine the command was sent with.
+	fr_redis_async_cmd_t		*cmd;		//!< Pipeline waiting for replies.
+
+	ippool_action_t			action;		//!< Being performed.
+	uint8_t				*key_prefix;	//!< The pool name.
+	char const			*digest;	//!< Of the script.
+	char const			*script;	//!< To load if the node doesn't have it cached.
+	char				*evalsha;	//!< Pre-formatted EVALSHA command.
+	bool				loading;	//!< Whether the script is being loaded.
+
+	char				*ip_str;	//!< Requested IP address, for updates and releases.
+	uint32_t			expires;	//!< Lease time, for updates.
+
+	fr_redis_rcode_t		status;		//!< Of the pipeline.
+	redisReply			*reply;		//!< Result of the EVALSHA.
+
+	bool				done;		//!< All replies have been received.
+	bool				timed_out;	//!< Gave up waiting for the replies.
+	bool				timer_fired;	//!< The timeout event has run, and must not be deleted.
+} ippool_async_ctx_t;
+
 static CONF_PARSER redis_config[] = {
 	REDIS_COMMON_CONFIG,
 	CONF_PARSER_TERMINATOR
@@ -125,6 +166,10 @@ static CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("ipv4_integer", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, ipv4_integer) },
 	{ FR_CONF_OFFSET("copy_on_update", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, copy_on_update), .dflt = "yes", .quote = T_BARE_WORD },
 
+	{ FR_CONF_OFFSET("async", PW_TYPE_BOOLEAN, rlm_redis_ippool_t, async), .dflt = "no" },
+	{ FR_CONF_OFFSET("async_timeout", PW_TYPE_TIMEVAL, rlm_redis_ippool_t, async_timeout), .dflt = "5.0" },
+	{ FR_CONF_OFFSET("async_connect_timeout", PW_TYPE_TIMEVAL, rlm_redis_ippool_t, async_connect_timeout), .dflt = "3.0" },
+
 	/*
 	 *	Split out to allow conversion to universal ippool module with
 	 *	minimum of config changes.
@@ -402,6 +447,92 @@ static void ippool_action_print(REQUEST *request, ippool_action_t action,
 	talloc_free(gateway_str);
 }
 
+/** Check the replies to a script pipeline, and extract the result of the EVALSHA
+ *
+ * Used for both synchronous and asynchronous pipelines.
+ *
+ * @note All replies will be freed, and their slots in the replies array set to NULL.
+ *
+ * @param[out] out		Where to write the result of the EVALSHA.
+ * @param[in] request		The current request.
+ * @param[in] wait_num		Number of slaves required to acknowledge the write.
+ * @param[in] digest		of the script.
+ * @param[in] replies		to the pipeline.
+ * @param[in] reply_cnt		Number of replies.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int ippool_script_result(redisReply **out, REQUEST *request, uint32_t wait_num, char const digest[],
+				redisReply **replies, size_t reply_cnt)
+{
+	size_t	i;
+	int	ret = -1;
+
+	*out = NULL;
+
+	if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) {
+		if (replies[i]) fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
+	}
+
+	switch (reply_cnt) {
+	case 2:	/* EVALSHA with wait */
+		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto finish;
+		/* FALL-THROUGH */
+
+	case 1:	/* EVALSHA */
+		*out = replies[0];
+		replies[0] = NULL;
+		break;
+
+	case 5: /* LOADSCRIPT + EVALSHA + WAIT */
+		if (ippool_wait_check(request, wait_num, replies[4]) < 0) goto finish;
+		/* FALL-THROUGH */
+
+	case 4: /* LOADSCRIPT + EVALSHA */
+		if (replies[3]->type != REDIS_REPLY_ARRAY) {
+			REDEBUG("Bad response to EXEC, expected array got %s",
+				fr_int2str(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
+			goto finish;
+		}
+		if (replies[3]->elements != 2) {
+			REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
+				replies[3]->elements);
+			goto finish;
+		}
+		if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
+			REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
+				fr_int2str(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
+			goto finish;
+		}
+		if (strcmp(replies[3]->element[0]->str, digest) != 0) {
+			RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
+				digest, replies[3]->element[0]->str);
+			goto finish;
+		}
+		*out = replies[3]->element[1];
+		replies[3]->element[1] = NULL;		/* Prevent double free */
+		break;
+
+	default:
+		REDEBUG("Unexpected number of replies (%zu)", reply_cnt);
+		goto finish;
+	}
+	ret = 0;
+
+finish:
+	/*
+	 *	This works for the EXEC response because
+	 *	hiredis checks for NULL elements.
+	 */
+	for (i = 0; i < reply_cnt; i++) {
+		fr_redis_reply_free(replies[i]);
+		replies[i] = NULL;
+	}
+
+	return ret;
+}
+
 /** Execute a script against Redis cluster
  *
  * Handles uploading the script to the server if required.
@@ -418,39 +549,30 @@ static void ippool_action_print(REQUEST *request, ippool_action_t action,
  * @param[in] wait_timeout How long to wait for slaves.
  * @param[in] digest of script.
  * @param[in] script to upload.
- * @param[in] cmd EVALSHA command to execute.
- * @param[in] ... Arguments for the eval command.
+ * @param[in] evalsha EVALSHA command to execute, as produced by #ippool_evalsha.
  * @return status of the command.
  */
 static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_redis_cluster_t *cluster,
 				      uint8_t const *key, size_t key_len,
 				      uint32_t wait_num, uint32_t wait_timeout,
 				      char const digest[], char const *script,
-				      char const *cmd, ...)
+				      char const *evalsha)
 {
 	fr_redis_conn_t			*conn;
 	redisReply			*replies[5];	/* Must be equal to the maximum number of pipelined commands */
-	size_t				reply_cnt = 0, i;
+	size_t				reply_cnt = 0;
 
 	fr_redis_cluster_state_t	state;
 	fr_redis_rcode_t		s_ret, status;
 	unsigned int			pipelined = 0;
 
-	va_list				ap;
-
 	*out = NULL;
 
-	va_start(ap, cmd);
-
 	for (s_ret = fr_redis_cluster_state_init(&state, &conn, cluster, request, key, key_len, false);
 	     s_ret == REDIS_RCODE_TRY_AGAIN;	/* Continue */
 	     s_ret = fr_redis_cluster_state_next(&state, &conn, cluster, request, status, &replies[0])) {
-	     	va_list	copy;
-
 	     	RDEBUG3("Calling script 0x%s", digest);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, evalsha, talloc_array_length(evalsha));
 		pipelined = 1;
 		if (wait_num) {
 			redisAppendCommand(conn->handle, "WAIT %i %i", wait_num, wait_timeout);
@@ -469,9 +591,7 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 	     	RDEBUG3("Loading script 0x%s", digest);
 		redisAppendCommand(conn->handle, "MULTI");
 		redisAppendCommand(conn->handle, "SCRIPT LOAD %s", script);
-	     	va_copy(copy, ap);	/* copy or segv */
-		redisvAppendCommand(conn->handle, cmd, copy);
-		va_end(copy);
+		redisAppendFormattedCommand(conn->handle, evalsha, talloc_array_length(evalsha));
 		redisAppendCommand(conn->handle, "EXEC");
 		pipelined = 4;
 		if (wait_num) {
@@ -482,111 +602,136 @@ static fr_redis_rcode_t ippool_script(redisReply **out, REQUEST *request, fr_red
 		reply_cnt = fr_redis_pipeline_result(&pipelined, &status,
 						     replies, sizeof(replies) / sizeof(*replies),
 						     conn);
-		if (status == REDIS_RCODE_SUCCESS) {
-			if (RDEBUG_ENABLED3) for (i = 0; i < reply_cnt; i++) {
-				fr_redis_reply_print(L_DBG_LVL_3, replies[i], request, i);
-			}
-
-			if (replies[3]->type != REDIS_REPLY_ARRAY) {
-				REDEBUG("Bad response to EXEC, expected array got %s",
-					fr_int2str(redis_reply_types, replies[3]->type, "<UNKNOWN>"));
-			error:
-				fr_redis_pipeline_free(replies, reply_cnt);
-				status = REDIS_RCODE_ERROR;
-				goto finish;
-			}
-			if (replies[3]->elements != 2) {
-				REDEBUG("Bad response to EXEC, expected 2 result elements, got %zu",
-					replies[3]->elements);
-				goto error;
-			}
-			if (replies[3]->element[0]->type != REDIS_REPLY_STRING) {
-				REDEBUG("Bad response to SCRIPT LOAD, expected string got %s",
-					fr_int2str(redis_reply_types, replies[3]->element[0]->type, "<UNKNOWN>"));
-				goto error;
-			}
-			if (strcmp(replies[3]->element[0]->str, digest) != 0) {
-				RWDEBUG("Incorrect SHA1 from SCRIPT LOAD, expected %s, got %s",
-					digest, replies[3]->element[0]->str);
-				goto error;
-			}
-		}
 	}
-	if (s_ret != REDIS_RCODE_SUCCESS) goto error;
-
-	switch (reply_cnt) {
-	case 2:	/* EVALSHA with wait */
-		if (ippool_wait_check(request, wait_num, replies[1]) < 0) goto error;
-		fr_redis_reply_free(replies[1]);	/* Free the wait response */
-		break;
-
-	case 1:	/* EVALSHA */
-		*out = replies[0];
-		break;
-
-	case 5: /* LOADSCRIPT + EVALSHA + WAIT */
-		if (ippool_wait_check(request, wait_num, replies[4]) < 0) goto error;
-		fr_redis_reply_free(replies[4]);	/* Free the wait response */
-		/* FALL-THROUGH */
-
-	case 4: /* LOADSCRIPT + EVALSHA */
-		fr_redis_reply_free(replies[2]);	/* Free the queued cmd response*/
-		fr_redis_reply_free(replies[1]);	/* Free the queued script load response */
-		fr_redis_reply_free(replies[0]);	/* Free the queued multi response */
-		*out = replies[3]->element[1];
-		replies[3]->element[1] = NULL;		/* Prevent double free */
-		fr_redis_reply_free(replies[3]);	/* This works because hiredis checks for NULL elements */
-		break;
-
-	case 0:
-		break;
+	if (s_ret != REDIS_RCODE_SUCCESS) {
+		fr_redis_pipeline_free(replies, reply_cnt);
+		return s_ret;
 	}
 
-finish:
-	va_end(ap);
+	if (ippool_script_result(out, request, wait_num, digest, replies, reply_cnt) < 0) return REDIS_RCODE_ERROR;
+
 	return s_ret;
 }
 
-/** Allocate a new IP address from a pool
+/** Format the EVALSHA command for an action
  *
+ * The command is formatted once, so that it can be re-sent if the script needs
+ * to be loaded, or if the command is redirected.
+ *
+ * @param[out] digest	of the script the command calls.
+ * @param[out] script	the command calls.
+ * @param[in] ctx	to allocate the command in.
+ * @param[in] inst	This instance of the rlm_redis_ippool module.
+ * @param[in] action	to format the command for.
+ * @param[in] key_prefix	The pool name.
+ * @param[in] key_prefix_len	Length of the pool name.
+ * @param[in] ip	to update or release.  May be NULL for allocations.
+ * @param[in] device_id	Unique device identifier.
+ * @param[in] device_id_len	Length of the device identifier.
+ * @param[in] gateway_id	Gateway identifier.
+ * @param[in] gateway_id_len	Length of the gateway identifier.
+ * @param[in] expires	Lease time.
+ * @return
+ *	- The command in RESP format.  Length is given by talloc_array_length.
+ *	- NULL on error.
  */
-static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request,
-					    uint8_t const *key_prefix, size_t key_prefix_len,
-					    uint8_t const *device_id, size_t device_id_len,
-					    uint8_t const *gateway_id, size_t gateway_id_len,
-					    uint32_t expires)
+static char *ippool_evalsha(char const **digest, char const **script,
+			    TALLOC_CTX *ctx, rlm_redis_ippool_t const *inst, ippool_action_t action,
+			    uint8_t const *key_prefix, size_t key_prefix_len, fr_ipaddr_t *ip,
+			    uint8_t const *device_id, size_t device_id_len,
+			    uint8_t const *gateway_id, size_t gateway_id_len,
+			    uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
-	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
-
-	rad_assert(key_prefix);
-	rad_assert(device_id);
+	struct timeval	now;
+	char		ip_buff[FR_IPADDR_PREFIX_STRLEN];
+	char		*buff, *out;
+	int		len = -1;
+	bool		ip_integer = ip && (ip->af == AF_INET) && inst->ipv4_integer;
 
 	gettimeofday(&now, NULL);
 
 	/*
 	 *	hiredis doesn't deal well with NULL string pointers
 	 */
+	if (!device_id) device_id = (uint8_t const *)"";
 	if (!gateway_id) gateway_id = (uint8_t const *)"";
 
-	status = ippool_script(&reply, request, inst->cluster,
-			       key_prefix, key_prefix_len,
-			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-			       lua_alloc_digest, lua_alloc_cmd,
-	 		       "EVALSHA %s 1 %b %u %u %b %b",
-	 		       lua_alloc_digest,
-			       key_prefix, key_prefix_len,
-			       (unsigned int)now.tv_sec, expires,
-			       device_id, device_id_len,
-			       gateway_id, gateway_id_len);
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
+	if (ip && !ip_integer) {
+		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
 	}
 
+	switch (action) {
+	case POOL_ACTION_ALLOCATE:
+		*digest = lua_alloc_digest;
+		*script = lua_alloc_cmd;
+		len = redisFormatCommand(&buff, "EVALSHA %s 1 %b %u %u %b %b",
+					 lua_alloc_digest,
+					 key_prefix, key_prefix_len,
+					 (unsigned int)now.tv_sec, expires,
+					 device_id, device_id_len,
+					 gateway_id, gateway_id_len);
+		break;
+
+	case POOL_ACTION_UPDATE:
+		*digest = lua_update_digest;
+		*script = lua_update_cmd;
+		if (ip_integer) {
+			len = redisFormatCommand(&buff, "EVALSHA %s 1 %b %u %u %u %b %b",
+						 lua_update_digest,
+						 key_prefix, key_prefix_len,
+						 (unsigned int)now.tv_sec, expires,
+						 htonl(ip->ipaddr.ip4addr.s_addr),
+						 device_id, device_id_len,
+						 gateway_id, gateway_id_len);
+		} else {
+			len = redisFormatCommand(&buff, "EVALSHA %s 1 %b %u %u %s %b %b",
+						 lua_update_digest,
+						 key_prefix, key_prefix_len,
+						 (unsigned int)now.tv_sec, expires,
+						 ip_buff,
+						 device_id, device_id_len,
+						 gateway_id, gateway_id_len);
+		}
+		break;
+
+	case POOL_ACTION_RELEASE:
+		*digest = lua_release_digest;
+		*script = lua_release_cmd;
+		if (ip_integer) {
+			len = redisFormatCommand(&buff, "EVALSHA %s 1 %b %u %u %b",
+						 lua_release_digest,
+						 key_prefix, key_prefix_len,
+						 (unsigned int)now.tv_sec,
+						 htonl(ip->ipaddr.ip4addr.s_addr),
+						 device_id, device_id_len);
+		} else {
+			len = redisFormatCommand(&buff, "EVALSHA %s 1 %b %u %s %b",
+						 lua_release_digest,
+						 key_prefix, key_prefix_len,
+						 (unsigned int)now.tv_sec,
+						 ip_buff,
+						 device_id, device_id_len);
+		}
+		break;
+
+	default:
+		break;
+	}
+	if (len < 0) return NULL;
+
+	out = talloc_memdup(ctx, buff, (size_t)len);
+	free(buff);
+
+	return out;
+}
+
+/** Process the result of allocating a new IP address from a pool
+ *
+ */
+static ippool_rcode_t redis_ippool_allocate(rlm_redis_ippool_t const *inst, REQUEST *request, redisReply *reply)
+{
+	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
+
 	rad_assert(reply);
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
@@ -758,66 +903,17 @@ finish:
 	return ret;
 }
 
-/** Update an existing IP address in a pool
+/** Process the result of updating an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUEST *request,
-					  uint8_t const *key_prefix, size_t key_prefix_len,
-					  fr_ipaddr_t *ip,
-					  uint8_t const *device_id, size_t device_id_len,
-					  uint8_t const *gateway_id, size_t gateway_id_len,
+static ippool_rcode_t redis_ippool_update(rlm_redis_ippool_t const *inst, REQUEST *request, redisReply *reply,
 					  uint32_t expires)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
 	vp_tmpl_t		range_rhs = { .name = "", .type = TMPL_TYPE_DATA, .tmpl_value_box_type = PW_TYPE_STRING, .quote = T_DOUBLE_QUOTED_STRING };
 	vp_map_t		range_map = { .lhs = inst->range_attr, .op = T_OP_SET, .rhs = &range_rhs };
 
-	gettimeofday(&now, NULL);
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!device_id) device_id = (uint8_t const *)"";
-	if (!gateway_id) gateway_id = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %u %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       htonl(ip->ipaddr.ip4addr.s_addr),
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_update_digest, lua_update_cmd,
-				       "EVALSHA %s 1 %b %u %u %s %b %b",
-				       lua_update_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec, expires,
-				       ip_buff,
-				       device_id, device_id_len,
-				       gateway_id, gateway_id_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -903,58 +999,13 @@ finish:
 	return ret;
 }
 
-/** Release an existing IP address in a pool
+/** Process the result of releasing an existing IP address in a pool
  *
  */
-static ippool_rcode_t redis_ippool_release(rlm_redis_ippool_t const *inst, REQUEST *request,
-					   uint8_t const *key_prefix, size_t key_prefix_len,
-					   fr_ipaddr_t *ip,
-					   uint8_t const *device_id, size_t device_id_len)
+static ippool_rcode_t redis_ippool_release(REQUEST *request, redisReply *reply)
 {
-	struct			timeval now;
-	redisReply		*reply = NULL;
-
-	fr_redis_rcode_t	status;
 	ippool_rcode_t		ret = IPPOOL_RCODE_SUCCESS;
 
-	gettimeofday(&now, NULL);
-
-	/*
-	 *	hiredis doesn't deal well with NULL string pointers
-	 */
-	if (!device_id) device_id = (uint8_t const *)"";
-
-	if ((ip->af == AF_INET) && inst->ipv4_integer) {
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %u %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       htonl(ip->ipaddr.ip4addr.s_addr),
-				       device_id, device_id_len);
-	} else {
-		char ip_buff[FR_IPADDR_PREFIX_STRLEN];
-
-		IPPOOL_SPRINT_IP(ip_buff, ip, ip->prefix);
-		status = ippool_script(&reply, request, inst->cluster,
-				       key_prefix, key_prefix_len,
-				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
-				       lua_release_digest, lua_release_cmd,
-				       "EVALSHA %s 1 %b %u %s %b",
-				       lua_release_digest,
-				       key_prefix, key_prefix_len,
-				       (unsigned int)now.tv_sec,
-				       ip_buff,
-				       device_id, device_id_len);
-	}
-	if (status != REDIS_RCODE_SUCCESS) {
-		ret = IPPOOL_RCODE_FAIL;
-		goto finish;
-	}
-
 	if (reply->type != REDIS_REPLY_ARRAY) {
 		REDEBUG("Expected result to be array got \"%s\"",
 			fr_int2str(redis_reply_types, reply->type, "<UNKNOWN>"));
@@ -1025,65 +1076,29 @@ static inline ssize_t ippool_pool_name(uint8_t const **out, uint8_t buff[], size
 	return slen;
 }
 
-static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action)
+/** Convert the result of a script into a module return code
+ *
+ * @param[in] inst	This instance of the rlm_redis_ippool module.
+ * @param[in] request	The current request.
+ * @param[in] action	which was performed.
+ * @param[in] status	of the script.
+ * @param[in] reply	Result of the script.  Will be freed.
+ * @param[in] ip_str	Requested IP address, for updates and releases.
+ * @param[in] expires	Lease time, for updates.
+ * @return the module return code.
+ */
+static rlm_rcode_t ippool_action_result(rlm_redis_ippool_t const *inst, REQUEST *request, ippool_action_t action,
+					fr_redis_rcode_t status, redisReply *reply,
+					char const *ip_str, uint32_t expires)
 {
-	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
-	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
-	size_t		key_prefix_len, device_id_len = 0, gateway_id_len = 0;
-	ssize_t		slen;
-	fr_ipaddr_t	ip;
-	char		expires_buff[20];
-	char const	*expires_str;
-	unsigned long	expires = 0;
-	char		*q;
-
-	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
-	if (slen < 0) return RLM_MODULE_FAIL;
-	if (slen == 0) return RLM_MODULE_NOOP;
-
-	key_prefix_len = (size_t)slen;
-
-	if (inst->device_id) {
-		slen = tmpl_expand((char const **)&device_id,
-				   (char *)&device_id_buff, sizeof(device_id_buff),
-				   request, inst->device_id, NULL, NULL);
-		if (slen < 0) {
-			REDEBUG("Failed expanding device (%s)", inst->device_id->name);
-			return RLM_MODULE_FAIL;
-		}
-		device_id_len = (size_t)slen;
-	}
-
-	if (inst->gateway_id) {
-		slen = tmpl_expand((char const **)&gateway_id,
-				   (char *)&gateway_id_buff, sizeof(gateway_id_buff),
-				   request, inst->gateway_id, NULL, NULL);
-		if (slen < 0) {
-			REDEBUG("Failed expanding gateway (%s)", inst->gateway_id->name);
-			return RLM_MODULE_FAIL;
-		}
-		gateway_id_len = (size_t)slen;
+	if (status != REDIS_RCODE_SUCCESS) {
+		fr_redis_reply_free(reply);
+		return RLM_MODULE_FAIL;
 	}
 
 	switch (action) {
 	case POOL_ACTION_ALLOCATE:
-		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
-				request, inst->offer_time, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
-			return RLM_MODULE_FAIL;
-		}
-
-		expires = strtoul(expires_str, &q, 10);
-		if (q != (expires_str + strlen(expires_str))) {
-			REDEBUG("Invalid offer_time.  Must be an integer value");
-			return RLM_MODULE_FAIL;
-		}
-
-		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, NULL,
-				    device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_allocate(inst, request, key_prefix, key_prefix_len,
-					      device_id, device_id_len,
-					      gateway_id, gateway_id_len, (uint32_t)expires)) {
+		switch (redis_ippool_allocate(inst, request, reply)) {
 		case IPPOOL_RCODE_SUCCESS:
 			RDEBUG2("IP address lease allocated");
 			return RLM_MODULE_UPDATED;
@@ -1097,37 +1112,7 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		}
 
 	case POOL_ACTION_UPDATE:
-	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
-
-		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
-				request, inst->lease_time, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
-			return RLM_MODULE_FAIL;
-		}
-
-		expires = strtoul(expires_str, &q, 10);
-		if (q != (expires_str + strlen(expires_str))) {
-			REDEBUG("Invalid expires.  Must be an integer value");
-			return RLM_MODULE_FAIL;
-		}
-
-		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
-		}
-
-		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
-			REDEBUG("%s", fr_strerror());
-			return RLM_MODULE_FAIL;
-		}
-
-		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
-				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, expires);
-		switch (redis_ippool_update(inst, request, key_prefix, key_prefix_len,
-					    &ip, device_id, device_id_len,
-					    gateway_id, gateway_id_len, (uint32_t)expires)) {
+		switch (redis_ippool_update(inst, request, reply, expires)) {
 		case IPPOOL_RCODE_SUCCESS:
 			RDEBUG2("Requested IP address' \"%s\" lease updated", ip_str);
 
@@ -1174,27 +1159,9 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		default:
 			return RLM_MODULE_FAIL;
 		}
-	}
 
 	case POOL_ACTION_RELEASE:
-	{
-		char		ip_buff[INET6_ADDRSTRLEN + 4];
-		char const	*ip_str;
-
-		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
-			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
-			return RLM_MODULE_FAIL;
-		}
-
-		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
-			REDEBUG("%s", fr_strerror());
-			return RLM_MODULE_FAIL;
-		}
-
-		ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len,
-				    ip_str, device_id, device_id_len, gateway_id, gateway_id_len, 0);
-		switch (redis_ippool_release(inst, request, key_prefix, key_prefix_len,
-					     &ip, device_id, device_id_len)) {
+		switch (redis_ippool_release(request, reply)) {
 		case IPPOOL_RCODE_SUCCESS:
 			RDEBUG2("IP address \"%s\" released", ip_str);
 			return RLM_MODULE_UPDATED;
@@ -1215,7 +1182,242 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		default:
 			return RLM_MODULE_FAIL;
 		}
+
+	default:
+		fr_redis_reply_free(reply);
+		rad_assert(0);
+		return RLM_MODULE_FAIL;
+	}
+}
+
+static int ippool_async_send(REQUEST *request, ippool_async_ctx_t *actx);
+
+static int _ippool_async_ctx_free(ippool_async_ctx_t *actx)
+{
+	if (actx->cmd) fr_redis_async_cmd_cancel(actx->cmd);
+	fr_redis_reply_free(actx->reply);
+
+	return 0;
+}
+
+/** Called when all the replies to a script pipeline have been received
+ *
+ */
+static void _ippool_async_reply(REQUEST *request, fr_redis_rcode_t status,
+				redisReply **replies, size_t num, void *uctx)
+{
+	ippool_async_ctx_t *actx = talloc_get_type_abort(uctx, ippool_async_ctx_t);
+
+	actx->cmd = NULL;	/* Freed when we return */
+
+	/*
+	 *	Same as the synchronous code, if the script
+	 *	isn't cached on the node, send it up in a
+	 *	transaction with the EVALSHA.
+	 */
+	if ((status == REDIS_RCODE_NO_SCRIPT) && !actx->loading) {
+		RDEBUG3("Loading script 0x%s", actx->digest);
+		actx->loading = true;
+		if (ippool_async_send(request, actx) == 0) return;
+		status = REDIS_RCODE_ERROR;
+	}
+
+	actx->status = status;
+	if ((status == REDIS_RCODE_SUCCESS) &&
+	    (ippool_script_result(&actx->reply, request, actx->inst->wait_num, actx->digest, replies, num) < 0)) {
+		actx->status = REDIS_RCODE_ERROR;
+	}
+	actx->done = true;
+
+	unlang_resumable(request);
+}
+
+/** Send the script pipeline for an action
+ *
+ */
+static int ippool_async_send(REQUEST *request, ippool_async_ctx_t *actx)
+{
+	rlm_redis_ippool_t const	*inst = actx->inst;
+	fr_redis_async_cmd_t		*cmd;
+
+	cmd = fr_redis_async_cmd_alloc(actx->async, request, actx->key_prefix, talloc_array_length(actx->key_prefix),
+				       false, _ippool_async_reply, actx);
+	if (!cmd) return -1;
+
+	if (actx->loading) {
+		if ((fr_redis_async_cmd_append(cmd, "MULTI") < 0) ||
+		    (fr_redis_async_cmd_append(cmd, "SCRIPT LOAD %s", actx->script) < 0)) {
+		error:
+			RPEDEBUG("Failed building pipeline");
+			fr_redis_async_cmd_cancel(cmd);
+			return -1;
+		}
 	}
+	if (fr_redis_async_cmd_append_formatted(cmd, actx->evalsha, talloc_array_length(actx->evalsha)) < 0) goto error;
+	if (actx->loading && (fr_redis_async_cmd_append(cmd, "EXEC") < 0)) goto error;
+	if (inst->wait_num &&
+	    (fr_redis_async_cmd_append(cmd, "WAIT %i %i",
+				       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout)) < 0)) goto error;
+
+	if (fr_redis_async_cmd_send(cmd) < 0) {
+		fr_redis_async_cmd_cancel(cmd);
+		return -1;
+	}
+	actx->cmd = cmd;
+
+	return 0;
+}
+
+/** Called if the result of the script doesn't arrive in time
+ *
+ * The commands can't be recalled, so their replies are discarded when they
+ * arrive.
+ */
+static void mod_action_timeout(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			       UNUSED struct timeval *fired)
+{
+	ippool_async_ctx_t *actx = talloc_get_type_abort(ctx, ippool_async_ctx_t);
+
+	actx->timer_fired = true;
+
+	/*
+	 *	The result arrived, and the request is already
+	 *	resumable.  Don't resume it twice.
+	 */
+	if (actx->done) return;
+
+	REDEBUG("Timed out waiting for script result");
+
+	if (actx->cmd) fr_redis_async_cmd_cancel(actx->cmd);
+	actx->cmd = NULL;
+	actx->timed_out = true;
+
+	unlang_resumable(request);
+}
+
+static void mod_action_signal(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			      fr_state_action_t action)
+{
+	ippool_async_ctx_t *actx = talloc_get_type_abort(ctx, ippool_async_ctx_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	if (!actx->timer_fired) unlang_event_timeout_delete(request, actx);
+	talloc_free(actx);
+}
+
+/*
+ *	Called when the result of the script has arrived.
+ */
+static rlm_rcode_t mod_action_resume(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx)
+{
+	ippool_async_ctx_t	*actx = talloc_get_type_abort(ctx, ippool_async_ctx_t);
+	rlm_rcode_t		rcode;
+
+	if (!actx->timer_fired) unlang_event_timeout_delete(request, actx);
+
+	if (actx->timed_out) {
+		talloc_free(actx);
+		return RLM_MODULE_FAIL;
+	}
+
+	rcode = ippool_action_result(actx->inst, request, actx->action, actx->status, actx->reply,
+				     actx->ip_str, actx->expires);
+	actx->reply = NULL;
+	talloc_free(actx);
+
+	return rcode;
+}
+
+static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, rlm_redis_ippool_thread_t *t,
+			      REQUEST *request, ippool_action_t action)
+{
+	uint8_t		key_prefix_buff[IPPOOL_MAX_KEY_PREFIX_SIZE], device_id_buff[256], gateway_id_buff[256];
+	uint8_t const	*key_prefix, *device_id = NULL, *gateway_id = NULL;
+	size_t		key_prefix_len, device_id_len = 0, gateway_id_len = 0;
+	ssize_t		slen;
+	fr_ipaddr_t	ip;
+	char		expires_buff[20];
+	char const	*expires_str;
+	unsigned long	expires = 0;
+	char		*q;
+	char		ip_buff[INET6_ADDRSTRLEN + 4];
+	char const	*ip_str = NULL;
+	char const	*digest, *script;
+	char		*evalsha;
+	redisReply	*reply;
+	fr_redis_rcode_t status;
+
+	slen = ippool_pool_name(&key_prefix, (uint8_t *)&key_prefix_buff, sizeof(key_prefix_len), inst, request);
+	if (slen < 0) return RLM_MODULE_FAIL;
+	if (slen == 0) return RLM_MODULE_NOOP;
+
+	key_prefix_len = (size_t)slen;
+
+	if (inst->device_id) {
+		slen = tmpl_expand((char const **)&device_id,
+				   (char *)&device_id_buff, sizeof(device_id_buff),
+				   request, inst->device_id, NULL, NULL);
+		if (slen < 0) {
+			REDEBUG("Failed expanding device (%s)", inst->device_id->name);
+			return RLM_MODULE_FAIL;
+		}
+		device_id_len = (size_t)slen;
+	}
+
+	if (inst->gateway_id) {
+		slen = tmpl_expand((char const **)&gateway_id,
+				   (char *)&gateway_id_buff, sizeof(gateway_id_buff),
+				   request, inst->gateway_id, NULL, NULL);
+		if (slen < 0) {
+			REDEBUG("Failed expanding gateway (%s)", inst->gateway_id->name);
+			return RLM_MODULE_FAIL;
+		}
+		gateway_id_len = (size_t)slen;
+	}
+
+	switch (action) {
+	case POOL_ACTION_ALLOCATE:
+		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
+				request, inst->offer_time, NULL, NULL) < 0) {
+			REDEBUG("Failed expanding offer_time (%s)", inst->offer_time->name);
+			return RLM_MODULE_FAIL;
+		}
+
+		expires = strtoul(expires_str, &q, 10);
+		if (q != (expires_str + strlen(expires_str))) {
+			REDEBUG("Invalid offer_time.  Must be an integer value");
+			return RLM_MODULE_FAIL;
+		}
+
+		rad_assert(device_id);
+		break;
+
+	case POOL_ACTION_UPDATE:
+		if (tmpl_expand(&expires_str, expires_buff, sizeof(expires_buff),
+				request, inst->lease_time, NULL, NULL) < 0) {
+			REDEBUG("Failed expanding lease_time (%s)", inst->lease_time->name);
+			return RLM_MODULE_FAIL;
+		}
+
+		expires = strtoul(expires_str, &q, 10);
+		if (q != (expires_str + strlen(expires_str))) {
+			REDEBUG("Invalid expires.  Must be an integer value");
+			return RLM_MODULE_FAIL;
+		}
+		/* FALL-THROUGH */
+
+	case POOL_ACTION_RELEASE:
+		if (tmpl_expand(&ip_str, ip_buff, sizeof(ip_buff), request, inst->requested_address, NULL, NULL) < 0) {
+			REDEBUG("Failed expanding requested_address (%s)", inst->requested_address->name);
+			return RLM_MODULE_FAIL;
+		}
+
+		if (fr_inet_pton(&ip, ip_str, -1, AF_UNSPEC, false, true) < 0) {
+			REDEBUG("%s", fr_strerror());
+			return RLM_MODULE_FAIL;
+		}
+		break;
 
 	case POOL_ACTION_BULK_RELEASE:
 		RDEBUG2("Bulk release not yet implemented");
@@ -1225,10 +1427,66 @@ static rlm_rcode_t mod_action(rlm_redis_ippool_t const *inst, REQUEST *request,
 		rad_assert(0);
 		return RLM_MODULE_FAIL;
 	}
+
+	ippool_action_print(request, action, L_DBG_LVL_2, key_prefix, key_prefix_len, ip_str,
+			    device_id, device_id_len, gateway_id, gateway_id_len, expires);
+
+	evalsha = ippool_evalsha(&digest, &script, request, inst, action, key_prefix, key_prefix_len,
+				 ip_str ? &ip : NULL, device_id, device_id_len,
+				 gateway_id, gateway_id_len, (uint32_t)expires);
+	if (!evalsha) {
+		REDEBUG("Failed formatting script command");
+		return RLM_MODULE_FAIL;
+	}
+
+	/*
+	 *	Send the script on the worker's shared connection
+	 *	and yield until the reply arrives.
+	 */
+	if (t && t->async) {
+		ippool_async_ctx_t	*actx;
+		struct timeval		when;
+
+		MEM(actx = talloc_zero(request, ippool_async_ctx_t));
+		actx->inst = inst;
+		actx->async = t->async;
+		actx->action = action;
+		actx->key_prefix = talloc_memdup(actx, key_prefix, key_prefix_len);
+		actx->digest = digest;
+		actx->script = script;
+		actx->evalsha = talloc_steal(actx, evalsha);
+		if (ip_str) actx->ip_str = talloc_typed_strdup(actx, ip_str);
+		actx->expires = (uint32_t)expires;
+		talloc_set_destructor(actx, _ippool_async_ctx_free);
+
+		RDEBUG3("Calling script 0x%s", digest);
+		if (ippool_async_send(request, actx) < 0) {
+			talloc_free(actx);
+			return RLM_MODULE_FAIL;
+		}
+
+		gettimeofday(&when, NULL);
+		fr_timeval_add(&when, &when, &inst->async_timeout);
+		if (unlang_event_timeout_add(request, mod_action_timeout, actx, &when) < 0) {
+			REDEBUG("Failed adding timeout");
+			talloc_free(actx);
+			return RLM_MODULE_FAIL;
+		}
+
+		return unlang_yield(request, mod_action_resume, mod_action_signal, actx);
+	}
+
+	status = ippool_script(&reply, request, inst->cluster,
+			       key_prefix, key_prefix_len,
+			       inst->wait_num, FR_TIMEVAL_TO_MS(&inst->wait_timeout),
+			       digest, script, evalsha);
+	talloc_free(evalsha);
+
+	return ippool_action_result(inst, request, action, status, reply, ip_str, (uint32_t)expires);
 }
 
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_accounting(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1237,7 +1495,7 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	 *	Pool-Action override
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	if (vp) return mod_action(inst, request, vp->vp_integer);
+	if (vp) return mod_action(inst, thread, request, vp->vp_integer);
 
 	/*
 	 *	Otherwise, guess the action by Acct-Status-Type
@@ -1251,22 +1509,22 @@ static rlm_rcode_t mod_accounting(void *instance, UNUSED void *thread, REQUEST *
 	switch (vp->vp_integer) {
 	case PW_STATUS_START:
 	case PW_STATUS_ALIVE:
-		return mod_action(inst, request, POOL_ACTION_UPDATE);
+		return mod_action(inst, thread, request, POOL_ACTION_UPDATE);
 
 	case PW_STATUS_STOP:
-		return mod_action(inst, request, POOL_ACTION_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_RELEASE);
 
 	case PW_STATUS_ACCOUNTING_OFF:
 	case PW_STATUS_ACCOUNTING_ON:
-		return mod_action(inst, request, POOL_ACTION_BULK_RELEASE);
+		return mod_action(inst, thread, request, POOL_ACTION_BULK_RELEASE);
 
 	default:
 		return RLM_MODULE_NOOP;
 	}
 }
 
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_authorize(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1276,11 +1534,11 @@ static rlm_rcode_t mod_authorize(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
 }
 
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request) CC_HINT(nonnull);
-static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *request)
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request) CC_HINT(nonnull);
+static rlm_rcode_t mod_post_auth(void *instance, void *thread, REQUEST *request)
 {
 	rlm_redis_ippool_t const	*inst = instance;
 	VALUE_PAIR			*vp;
@@ -1290,7 +1548,7 @@ static rlm_rcode_t mod_post_auth(void *instance, UNUSED void *thread, REQUEST *r
 	 *	when called in Post-Auth.
 	 */
 	vp = fr_pair_find_by_num(request->control, 0, PW_POOL_ACTION, TAG_ANY);
-	return mod_action(inst, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
+	return mod_action(inst, thread, request, vp ? vp->vp_integer : POOL_ACTION_ALLOCATE);
 }
 
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
@@ -1303,6 +1561,11 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	rad_assert(inst->allocated_address_attr->type == TMPL_TYPE_ATTR);
 	rad_assert(subcs);
 
+	inst->name = cf_section_name2(conf);
+	if (!inst->name) inst->name = cf_section_name1(conf);
+
+	FR_TIMEVAL_BOUND_CHECK("async_timeout", &inst->async_timeout, >=, 0, 100000);
+
 	inst->cluster = fr_redis_cluster_alloc(inst, subcs, &inst->conf, true, NULL, NULL, NULL);
 	if (!inst->cluster) return -1;
 
@@ -1343,6 +1606,51 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/** Create the per-worker connections to the cluster nodes
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_redis_ippool_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_redis_ippool_t		*inst = instance;
+	rlm_redis_ippool_thread_t	*t = thread;
+	char				buffer[256];
+
+	t->inst = inst;
+	t->el = el;
+
+	if (!inst->async) return 0;
+
+	/*
+	 *	Connections are opened when the first command
+	 *	for a node is sent.
+	 */
+	snprintf(buffer, sizeof(buffer), "rlm_redis_ippool (%s)", inst->name);
+	t->async = fr_redis_async_alloc(NULL, el, inst->cluster, &inst->conf, &inst->async_connect_timeout, buffer);
+	if (!t->async) {
+		ERROR("rlm_redis_ippool (%s) - Failed allocating async connections", inst->name);
+		return -1;
+	}
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_redis_ippool_thread_t *t = thread;
+
+	talloc_free(t->async);
+
+	return 0;
+}
+
 static int mod_load(void)
 {
 	fr_redis_version_print();
@@ -1352,13 +1660,16 @@ static int mod_load(void)
 
 extern rad_module_t rlm_redis_ippool;
 rad_module_t rlm_redis_ippool = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "redis",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_redis_ippool_t),
-	.config		= module_config,
-	.load		= mod_load,
-	.instantiate	= mod_instantiate,
+	.magic			= RLM_MODULE_INIT,
+	.name			= "redis",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_redis_ippool_t),
+	.config			= module_config,
+	.load			= mod_load,
+	.instantiate		= mod_instantiate,
+	.thread_inst_size	= sizeof(rlm_redis_ippool_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
 	.methods = {
 		[MOD_ACCOUNTING]	= mod_accounting,
 		[MOD_AUTHORIZE]		= mod_authorize,
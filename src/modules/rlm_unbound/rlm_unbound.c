@@ -29,7 +29,9 @@ RCSID("$Id$")
 #include <freeradius-devel/radiusd.h>
 #include <freeradius-devel/modules.h>
 #include <freeradius-devel/log.h>
+#include <freeradius-devel/heap.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unbound.h>
 
 typedef struct rlm_unbound_t {
@@ -45,31 +47,105 @@ typedef struct rlm_unbound_t {
 
 	char const	*filename;
 
+	uint32_t	cache_size;		//!< Maximum number of answers to cache.  0 disables the cache.
+	uint32_t	cache_max_ttl;		//!< Answers are never cached for longer than this.
+
+	char const	*lookup_type;		//!< "A", "AAAA" or "PTR".
+	int		lookup_rrtype;
+	vp_tmpl_t	*lookup_name;		//!< What to look up when called as a module.
+	vp_tmpl_t	*lookup_attr;		//!< Where to write the answer.
+
+	int		log_level;		//!< Settings for the per-thread contexts.
+	log_dst_t	log_dst;
+	bool		log_file;		//!< Whether the main log file was passed to libunbound.
+	bool		syslog_override;
+
 	int		log_fd;
 	FILE		*log_stream;
 
 	int		log_pipe[2];
 	FILE		*log_pipe_stream[2];
 	bool		log_pipe_in_use;
+
+	pthread_mutex_t	cache_mutex;
+	rbtree_t	*cache;			//!< Answers, by name and type.
+	fr_heap_t	*cache_heap;		//!< Answers, by expiry time.
 } rlm_unbound_t;
 
+/** Per-thread libunbound context
+ *
+ * Each worker thread has its own context, so that callbacks from
+ * ub_process() always run in the thread which owns the request.
+ */
+typedef struct rlm_unbound_thread {
+	rlm_unbound_t			*inst;
+	fr_event_list_t			*el;
+	struct ub_ctx			*ub;
+	int				fd;
+
+	struct rlm_unbound_thread	*next;	//!< Other instances of the module, in this thread.
+} rlm_unbound_thread_t;
+
+/** An outstanding query
+ *
+ */
+typedef struct unbound_query {
+	REQUEST			*request;	//!< To resume.  NULL for queries from xlats.
+	struct ub_ctx		*ub;		//!< Which the query was sent to.
+	int			async_id;
+	int			rrtype;
+	char const		*name;
+
+	bool			done;
+	bool			timed_out;
+	bool			timer_fired;	//!< The timeout event has run, and must not be deleted.
+	int			err;
+	struct ub_result	*result;
+} unbound_query_t;
+
+/** A cached answer
+ *
+ */
+typedef struct unbound_cache_entry {
+	int			rrtype;
+	char const		*name;
+	char const		*answer;
+	time_t			expires;
+	int32_t			heap_id;
+} unbound_cache_entry_t;
+
+/*
+ *	The contexts for the current thread.  xlats aren't passed
+ *	their thread instance, so they look here.
+ */
+static _Thread_local rlm_unbound_thread_t *unbound_threads;
+
+static const CONF_PARSER lookup_config[] = {
+	{ FR_CONF_OFFSET("type", PW_TYPE_STRING, rlm_unbound_t, lookup_type), .dflt = "A" },
+	{ FR_CONF_OFFSET("name", PW_TYPE_TMPL, rlm_unbound_t, lookup_name) },
+	{ FR_CONF_OFFSET("attribute", PW_TYPE_TMPL | PW_TYPE_ATTRIBUTE, rlm_unbound_t, lookup_attr) },
+	CONF_PARSER_TERMINATOR
+};
+
 /*
  *	A mapping of configuration file names to internal variables.
  */
 static const CONF_PARSER module_config[] = {
 	{ FR_CONF_OFFSET("filename", PW_TYPE_FILE_INPUT | PW_TYPE_REQUIRED, rlm_unbound_t, filename), .dflt = "${modconfdir}/unbound/default.conf" },
 	{ FR_CONF_OFFSET("timeout", PW_TYPE_INTEGER, rlm_unbound_t, timeout), .dflt = "3000" },
+	{ FR_CONF_OFFSET("cache_size", PW_TYPE_INTEGER, rlm_unbound_t, cache_size), .dflt = "1024" },
+	{ FR_CONF_OFFSET("cache_max_ttl", PW_TYPE_INTEGER, rlm_unbound_t, cache_max_ttl), .dflt = "3600" },
+	{ FR_CONF_POINTER("lookup", PW_TYPE_SUBSECTION, NULL), .subcs = (void const *) lookup_config },
 	CONF_PARSER_TERMINATOR
 };
 
 /*
- *	Callback sent to libunbound for xlat functions.  Simply links the
- *	new ub_result via a pointer that has been allocated from the heap.
- *	This pointer has been pre-initialized to a magic value.
+ *	Callback sent to libunbound.  Records the result, and if the
+ *	query came from a yielded request, marks it as resumable.
  */
-static void link_ubres(void *my_arg, int err, struct ub_result *result)
+static void query_done(void *my_arg, int err, struct ub_result *result)
 {
-	struct ub_result **ubres = (struct ub_result **)my_arg;
+	unbound_query_t *query = my_arg;
 
 	/*
 	 *	Note that while result will be NULL on error, we are explicit
@@ -78,10 +154,14 @@ static void link_ubres(void *my_arg, int err, struct ub_result *result)
 	 */
 	if (err) {
 		ERROR("%s", ub_strerror(err));
-		*ubres = NULL;
+		query->result = NULL;
 	} else {
-		*ubres = result;
+		query->result = result;
 	}
+	query->err = err;
+	query->done = true;
+
+	if (query->request) unlang_resumable(query->request);
 }
 
 /*
@@ -150,204 +230,467 @@ static int rrlabels_tostr(char *out, char *rr, size_t left)
 	return offset;
 }
 
-static int ub_common_wait(rlm_unbound_t const *inst, REQUEST *request,
-			  char const *name, struct ub_result **ub, int async_id)
+static int ub_common_fail(REQUEST *request, char const *name, struct ub_result *ub)
 {
-	useconds_t iv, waited;
+	if (ub->bogus) {
+		RWDEBUG("%s - Bogus DNS response", name);
+		return -1;
+	}
 
-	iv = inst->timeout > 64 ? 64000 : inst->timeout * 1000;
-	ub_process(inst->ub);
+	if (ub->nxdomain) {
+		RDEBUG("%s - NXDOMAIN", name);
+		return -1;
+	}
 
-	for (waited = 0; (void const *)*ub == (void const *)inst; waited += iv, iv *= 2) {
+	if (!ub->havedata) {
+		RDEBUG("%s - Empty result", name);
+		return -1;
+	}
 
-		if (waited + iv > (useconds_t)inst->timeout * 1000) {
-			usleep(inst->timeout * 1000 - waited);
-			ub_process(inst->ub);
-			break;
-		}
+	return 0;
+}
 
-		usleep(iv);
+/*
+ *	Compare two cached answers by type, then by name.
+ */
+static int cache_entry_cmp(void const *one, void const *two)
+{
+	unbound_cache_entry_t const *a = one;
+	unbound_cache_entry_t const *b = two;
 
-		/* Check if already handled by event loop */
-		if ((void const *)*ub != (void const *)inst) {
-			break;
-		}
+	if (a->rrtype < b->rrtype) return -1;
+	if (a->rrtype > b->rrtype) return +1;
 
-		/* In case we are running single threaded */
-		ub_process(inst->ub);
+	return strcasecmp(a->name, b->name);
+}
+
+/*
+ *	Compare two cached answers by expiry time.
+ */
+static int cache_heap_cmp(void const *one, void const *two)
+{
+	unbound_cache_entry_t const *a = one;
+	unbound_cache_entry_t const *b = two;
+
+	if (a->expires < b->expires) return -1;
+	if (a->expires > b->expires) return +1;
+
+	return 0;
+}
+
+/*
+ *	Remove an answer from the cache.  Must be called with the
+ *	cache mutex held.
+ */
+static void cache_remove(rlm_unbound_t *inst, unbound_cache_entry_t *c)
+{
+	fr_heap_extract(inst->cache_heap, c);
+	rbtree_deletebydata(inst->cache, c);	/* Frees c */
+}
+
+/*
+ *	Look up a previous answer.  Returns true, and writes the answer
+ *	to "out", if an answer was found which hasn't yet expired.
+ */
+static bool cache_find(rlm_unbound_t *inst, REQUEST *request, char *out, size_t outlen,
+		       char const *label, int rrtype, char const *name)
+{
+	unbound_cache_entry_t	my_c, *c;
+	time_t			now;
+	bool			found = false;
+
+	if (!inst->cache) return false;
+
+	my_c.rrtype = rrtype;
+	my_c.name = name;
+
+	now = time(NULL);
+
+	pthread_mutex_lock(&inst->cache_mutex);
+	while ((c = fr_heap_peek(inst->cache_heap)) && (c->expires <= now)) cache_remove(inst, c);
+
+	c = rbtree_finddata(inst->cache, &my_c);
+	if (c && (strlen(c->answer) < outlen)) {
+		strcpy(out, c->answer);
+		found = true;
 	}
+	pthread_mutex_unlock(&inst->cache_mutex);
 
-	if ((void const *)*ub == (void const *)inst) {
-		int res;
+	if (found) RDEBUG2("%s - Using cached answer for %s", label, name);
 
-		RDEBUG("%s - DNS took too long", name);
+	return found;
+}
 
-		res = ub_cancel(inst->ub, async_id);
-		if (res) {
-			REDEBUG("%s - ub_cancel: %s", name, ub_strerror(res));
-		}
-		return -1;
+/*
+ *	Remember an answer until its TTL (capped at cache_max_ttl)
+ *	expires.  When the cache is full, the answer closest to
+ *	expiring is evicted.
+ */
+static void cache_insert(rlm_unbound_t *inst, int rrtype, char const *name, char const *answer, uint32_t ttl)
+{
+	unbound_cache_entry_t	my_c, *c;
+
+	if (!inst->cache) return;
+
+	if (ttl > inst->cache_max_ttl) ttl = inst->cache_max_ttl;
+	if (!ttl) return;
+
+	my_c.rrtype = rrtype;
+	my_c.name = name;
+
+	pthread_mutex_lock(&inst->cache_mutex);
+	c = rbtree_finddata(inst->cache, &my_c);
+	if (c) {
+		cache_remove(inst, c);
+
+	} else if (rbtree_num_elements(inst->cache) >= inst->cache_size) {
+		c = fr_heap_peek(inst->cache_heap);
+		if (c) cache_remove(inst, c);
+	}
+
+	MEM(c = talloc_zero(NULL, unbound_cache_entry_t));
+	c->rrtype = rrtype;
+	c->name = talloc_typed_strdup(c, name);
+	c->answer = talloc_typed_strdup(c, answer);
+	c->expires = time(NULL) + ttl;
+
+	if (!rbtree_insert(inst->cache, c)) {
+		talloc_free(c);
+	} else {
+		fr_heap_insert(inst->cache_heap, c);
 	}
+	pthread_mutex_unlock(&inst->cache_mutex);
+}
+
+/*
+ *	Cancel the query if libunbound still has it, so that the callback
+ *	isn't run after the query has been freed.
+ */
+static int _query_free(unbound_query_t *query)
+{
+	if (!query->done && !query->timed_out) ub_cancel(query->ub, query->async_id);
+	if (query->result) ub_resolve_free(query->result);
 
 	return 0;
 }
 
-static int ub_common_fail(REQUEST *request, char const *name, struct ub_result *ub)
+static unbound_query_t *query_alloc(TALLOC_CTX *ctx, REQUEST *request, struct ub_ctx *ub,
+				    char const *label, char const *name, int rrtype)
 {
-	if (ub->bogus) {
-		RWDEBUG("%s - Bogus DNS response", name);
-		return -1;
+	unbound_query_t	*query;
+	char		*qname; /* For const warnings.  Keep till new libunbound ships. */
+	int		res;
+
+	MEM(query = talloc_zero(ctx, unbound_query_t));
+	query->ub = ub;
+	query->rrtype = rrtype;
+	query->name = qname = talloc_typed_strdup(query, name);
+
+	res = ub_resolve_async(ub, qname, rrtype, 1, query, query_done, &query->async_id);
+	if (res) {
+		REDEBUG("%s - %s", label, ub_strerror(res));
+		query->done = true;	/* Nothing to cancel */
+		talloc_free(query);
+		return NULL;
 	}
+	talloc_set_destructor(query, _query_free);
 
-	if (ub->nxdomain) {
-		RDEBUG("%s - NXDOMAIN", name);
+	return query;
+}
+
+/*
+ *	Wait for an answer without returning to the event loop.  Used
+ *	by the xlats, which can't yield.  We sleep in poll() on the
+ *	libunbound fd, and only for as long as is needed.
+ */
+static int query_wait(rlm_unbound_t const *inst, REQUEST *request, char const *label, unbound_query_t *query)
+{
+	struct timeval	now, end, left;
+	int		fd;
+
+	fd = ub_fd(query->ub);
+	if (fd < 0) {
+		REDEBUG("%s - No libunbound fd", label);
 		return -1;
 	}
 
-	if (!ub->havedata) {
-		RDEBUG("%s - Empty result", name);
+	gettimeofday(&now, NULL);
+	fr_timeval_from_ms(&left, inst->timeout);
+	fr_timeval_add(&end, &now, &left);
+
+	while (!query->done) {
+		struct pollfd	pfd;
+		int		ms = 0, rcode, err;
+
+		if (fr_timeval_cmp(&end, &now) > 0) {
+			fr_timeval_subtract(&left, &end, &now);
+			ms = (left.tv_sec * 1000) + ((left.tv_usec + 999) / 1000);
+		}
+
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+
+		rcode = poll(&pfd, 1, ms);
+		if (rcode < 0) {
+			if (errno == EINTR) goto next;
+
+			REDEBUG("%s - Failed waiting for answer: %s", label, fr_syserror(errno));
+			return -1;
+		}
+		if (rcode == 0) break;
+
+		/*
+		 *	This may also run callbacks for other queries,
+		 *	and mark their requests as resumable.
+		 */
+		err = ub_process(query->ub);
+		if (err) {
+			REDEBUG("%s - ub_process: %s", label, ub_strerror(err));
+			return -1;
+		}
+
+	next:
+		gettimeofday(&now, NULL);
+	}
+
+	if (!query->done) {
+		RDEBUG("%s - DNS took too long", label);
 		return -1;
 	}
 
 	return 0;
 }
 
-static ssize_t xlat_a(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-		      void const *mod_inst, UNUSED void const *xlat_inst,
-		      REQUEST *request, char const *fmt)
+/*
+ *	Print the first record of an answer, and cache it.
+ *	Returns -1 if there was no usable answer.
+ */
+static int query_result(rlm_unbound_t *inst, REQUEST *request, char *out, size_t outlen,
+			char const *label, unbound_query_t *query)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	struct ub_result *ub = query->result;
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
+	if (!ub) {
+		RWDEBUG("%s - No result", label);
+		return -1;
+	}
 
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	if (ub_common_fail(request, label, ub)) return -1;
 
-	fmt2 = talloc_typed_strdup(inst, fmt);
-	ub_resolve_async(inst->ub, fmt2, 1, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+	switch (query->rrtype) {
+	case 1:		/* A */
+		if (!inet_ntop(AF_INET, ub->data[0], out, outlen)) return -1;
+		break;
+
+	case 28:	/* AAAA */
+		if (!inet_ntop(AF_INET6, ub->data[0], out, outlen)) return -1;
+		break;
+
+	case 12:	/* PTR */
+		if (rrlabels_tostr(out, ub->data[0], outlen) < 0) return -1;
+		break;
 
-	if (ub_common_wait(inst, request, inst->xlat_a_name, ubres, async_id)) {
-		goto error0;
+	default:
+		return -1;
 	}
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_a_name, *ubres)) {
-			goto error1;
-		}
+	cache_insert(inst, query->rrtype, query->name, out, ub->ttl);
 
-		if (!inet_ntop(AF_INET, (*ubres)->data[0], *out, outlen)) {
-			goto error1;
-		};
+	return 0;
+}
+
+/*
+ *	Find the context for this thread.  If we're not running in a
+ *	worker, fall back to the global one.
+ */
+static struct ub_ctx *unbound_ctx_find(rlm_unbound_t const *inst)
+{
+	rlm_unbound_thread_t *t;
 
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
+	for (t = unbound_threads; t; t = t->next) {
+		if (t->inst == inst) return t->ub;
 	}
 
-	RWDEBUG("%s - No result", inst->xlat_a_name);
+	return inst->ub;
+}
 
- error1:
-	ub_resolve_free(*ubres); /* Handles NULL gracefully */
+static ssize_t xlat_common(rlm_unbound_t *inst, REQUEST *request, char *out, size_t outlen,
+			   char const *label, int rrtype, char const *fmt)
+{
+	unbound_query_t	*query;
+	int		ret;
 
- error0:
-	talloc_free(ubres);
-	return -1;
+	if (cache_find(inst, request, out, outlen, label, rrtype, fmt)) return strlen(out);
+
+	query = query_alloc(request, request, unbound_ctx_find(inst), label, fmt, rrtype);
+	if (!query) return -1;
+
+	ret = query_wait(inst, request, label, query);
+	if (ret == 0) ret = query_result(inst, request, out, outlen, label, query);
+
+	talloc_free(query);
+	if (ret < 0) return -1;
+
+	return strlen(out);
+}
+
+static ssize_t xlat_a(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+		      void const *mod_inst, UNUSED void const *xlat_inst,
+		      REQUEST *request, char const *fmt)
+{
+	rlm_unbound_t *inst;
+
+	memcpy(&inst, &mod_inst, sizeof(inst));	/* The cache is mutable */
+
+	return xlat_common(inst, request, *out, outlen, inst->xlat_a_name, 1, fmt);
 }
 
 static ssize_t xlat_aaaa(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
 			 void const *mod_inst, UNUSED void const *xlat_inst,
 			 REQUEST *request, char const *fmt)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	rlm_unbound_t *inst;
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
+	memcpy(&inst, &mod_inst, sizeof(inst));	/* The cache is mutable */
 
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	return xlat_common(inst, request, *out, outlen, inst->xlat_aaaa_name, 28, fmt);
+}
 
-	fmt2 = talloc_typed_strdup(inst, fmt);
-	ub_resolve_async(inst->ub, fmt2, 28, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+static ssize_t xlat_ptr(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
+			void const *mod_inst, UNUSED void const *xlat_inst,
+			REQUEST *request, char const *fmt)
+{
+	rlm_unbound_t *inst;
+
+	memcpy(&inst, &mod_inst, sizeof(inst));	/* The cache is mutable */
 
-	if (ub_common_wait(inst, request, inst->xlat_aaaa_name, ubres, async_id)) {
-		goto error0;
+	return xlat_common(inst, request, *out, outlen, inst->xlat_ptr_name, 12, fmt);
+}
+
+/*
+ *	Write the answer to the configured attribute.
+ */
+static rlm_rcode_t lookup_set(rlm_unbound_t const *inst, REQUEST *request, char const *answer)
+{
+	VALUE_PAIR *vp;
+
+	if (tmpl_find_or_add_vp(&vp, request, inst->lookup_attr) < 0) {
+		REDEBUG("Failed creating %s", inst->lookup_attr->name);
+		return RLM_MODULE_FAIL;
 	}
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_aaaa_name, *ubres)) {
-			goto error1;
-		}
-		if (!inet_ntop(AF_INET6, (*ubres)->data[0], *out, outlen)) {
-			goto error1;
-		};
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
+	if (fr_pair_value_from_str(vp, answer, strlen(answer)) < 0) {
+		RPEDEBUG("Failed parsing answer \"%s\"", answer);
+		return RLM_MODULE_FAIL;
 	}
 
-	RWDEBUG("%s - No result", inst->xlat_aaaa_name);
+	RDEBUG2("%s - %s", inst->name, answer);
 
-error1:
-	ub_resolve_free(*ubres); /* Handles NULL gracefully */
+	return RLM_MODULE_OK;
+}
 
-error0:
-	talloc_free(ubres);
-	return -1;
+/*
+ *	Called when the answer has arrived, or we've given up waiting.
+ */
+static rlm_rcode_t mod_lookup_resume(REQUEST *request, void *instance, UNUSED void *thread, void *ctx)
+{
+	rlm_unbound_t	*inst = instance;
+	unbound_query_t	*query = talloc_get_type_abort(ctx, unbound_query_t);
+	char		answer[256];
+	rlm_rcode_t	rcode;
+
+	if (query->timed_out || query->err) {
+		rcode = RLM_MODULE_FAIL;
+
+	} else if (query_result(inst, request, answer, sizeof(answer), inst->name, query) < 0) {
+		rcode = query->result ? RLM_MODULE_NOTFOUND : RLM_MODULE_FAIL;
+
+	} else {
+		rcode = lookup_set(inst, request, answer);
+	}
+
+	if (!query->timer_fired) unlang_event_timeout_delete(request, query);
+	talloc_free(query);
+
+	return rcode;
 }
 
-static ssize_t xlat_ptr(UNUSED TALLOC_CTX *ctx, char **out, size_t outlen,
-			void const *mod_inst, UNUSED void const *xlat_inst,
-			REQUEST *request, char const *fmt)
+static void mod_lookup_timeout(REQUEST *request, void *instance, UNUSED void *thread, void *ctx,
+			       UNUSED struct timeval *fired)
 {
-	rlm_unbound_t const *inst = mod_inst;
-	struct ub_result **ubres;
-	int async_id;
-	char *fmt2; /* For const warnings.  Keep till new libunbound ships. */
+	rlm_unbound_t const	*inst = instance;
+	unbound_query_t		*query = talloc_get_type_abort(ctx, unbound_query_t);
+	int			res;
+
+	query->timer_fired = true;
 
-	/* This has to be on the heap, because threads. */
-	ubres = talloc(inst, struct ub_result *);
+	/*
+	 *	The answer arrived, and the request is already
+	 *	resumable.  Don't resume it twice.
+	 */
+	if (query->done) return;
 
-	/* Used and thus impossible value from heap to designate incomplete */
-	memcpy(ubres, &mod_inst, sizeof(*ubres));
+	RDEBUG("%s - DNS took too long", inst->name);
 
-	fmt2 = talloc_typed_strdup(inst, fmt);
-	ub_resolve_async(inst->ub, fmt2, 12, 1, ubres, link_ubres, &async_id);
-	talloc_free(fmt2);
+	res = ub_cancel(query->ub, query->async_id);
+	if (res) REDEBUG("%s - ub_cancel: %s", inst->name, ub_strerror(res));
+	query->timed_out = true;
 
-	if (ub_common_wait(inst, request, inst->xlat_ptr_name,
-			   ubres, async_id)) {
-		goto error0;
+	unlang_resumable(request);
+}
+
+static void mod_lookup_action(REQUEST *request, UNUSED void *instance, UNUSED void *thread, void *ctx,
+			      fr_state_action_t action)
+{
+	unbound_query_t *query = talloc_get_type_abort(ctx, unbound_query_t);
+
+	if (action != FR_ACTION_DONE) return;
+
+	if (!query->timer_fired) unlang_event_timeout_delete(request, query);
+	talloc_free(query);
+}
+
+static rlm_rcode_t CC_HINT(nonnull) mod_lookup(void *instance, void *thread, REQUEST *request)
+{
+	rlm_unbound_t		*inst = instance;
+	rlm_unbound_thread_t	*t = thread;
+	unbound_query_t		*query;
+	char			buffer[256], answer[256];
+	char const		*name;
+	struct timeval		now, when, timeout;
+
+	if (!inst->lookup_name) return RLM_MODULE_NOOP;
+
+	if (tmpl_expand(&name, buffer, sizeof(buffer), request, inst->lookup_name, NULL, NULL) < 0) {
+		REDEBUG("Failed expanding name to look up");
+		return RLM_MODULE_FAIL;
 	}
 
-	if (*ubres) {
-		if (ub_common_fail(request, inst->xlat_ptr_name, *ubres)) {
-			goto error1;
-		}
-		if (rrlabels_tostr(*out, (*ubres)->data[0], outlen) < 0) {
-			goto error1;
-		}
-		ub_resolve_free(*ubres);
-		talloc_free(ubres);
-		return strlen(*out);
+	if (cache_find(inst, request, answer, sizeof(answer), inst->name, inst->lookup_rrtype, name)) {
+		return lookup_set(inst, request, answer);
 	}
 
-	RWDEBUG("%s - No result", inst->xlat_ptr_name);
+	query = query_alloc(request, request, t->ub, inst->name, name, inst->lookup_rrtype);
+	if (!query) return RLM_MODULE_FAIL;
 
-error1:
-	ub_resolve_free(*ubres);  /* Handles NULL gracefully */
+	/*
+	 *	Answered already, so there's no need to yield.
+	 */
+	if (query->done) return mod_lookup_resume(request, instance, thread, query);
 
-error0:
-	talloc_free(ubres);
-	return -1;
+	query->request = request;
+
+	gettimeofday(&now, NULL);
+	fr_timeval_from_ms(&timeout, inst->timeout);
+	fr_timeval_add(&when, &now, &timeout);
+
+	if (unlang_event_timeout_add(request, mod_lookup_timeout, query, &when) < 0) {
+		talloc_free(query);
+		return RLM_MODULE_FAIL;
+	}
+
+	return unlang_yield(request, mod_lookup_resume, mod_lookup_action, query);
 }
 
 /*
@@ -355,19 +698,26 @@ error0:
  *	must be run in an application-side thread (via ub_process.)  This is
  *	probably to keep the API usage consistent across threaded and forked
  *	embedded client modes.  This callback function lets an event loop call
- *	ub_process when the instance's file descriptor becomes ready.
+ *	ub_process when the thread's file descriptor becomes ready.
  */
 static void ub_fd_handler(UNUSED fr_event_list_t *el, UNUSED int sock, void *ctx)
 {
-	rlm_unbound_t *inst = ctx;
+	rlm_unbound_thread_t *t = ctx;
 	int err;
 
-	err = ub_process(inst->ub);
+	err = ub_process(t->ub);
 	if (err) {
-		ERROR("Async ub_process: %s", ub_strerror(err));
+		ERROR("%s - Async ub_process: %s", t->inst->name, ub_strerror(err));
 	}
 }
 
+static const FR_NAME_NUMBER lookup_types[] = {
+	{ "A",		1 },
+	{ "AAAA",	28 },
+	{ "PTR",	12 },
+	{ NULL,		-1 }
+};
+
 static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 {
 	rlm_unbound_t *inst = instance;
@@ -380,6 +730,18 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 		return -1;
 	}
 
+	inst->lookup_rrtype = fr_str2int(lookup_types, inst->lookup_type, -1);
+	if (inst->lookup_rrtype < 0) {
+		cf_log_err_cs(conf, "Invalid lookup type \"%s\", must be one of A, AAAA or PTR",
+			      inst->lookup_type);
+		return -1;
+	}
+
+	if (inst->lookup_name && !inst->lookup_attr) {
+		cf_log_err_cs(conf, "'attribute' must be set in the 'lookup' section");
+		return -1;
+	}
+
 	MEM(inst->xlat_a_name = talloc_typed_asprintf(inst, "%s-a", inst->name));
 	MEM(inst->xlat_aaaa_name = talloc_typed_asprintf(inst, "%s-aaaa", inst->name));
 	MEM(inst->xlat_ptr_name = talloc_typed_asprintf(inst, "%s-ptr", inst->name));
@@ -394,6 +756,84 @@ static int mod_bootstrap(CONF_SECTION *conf, void *instance)
 	return 0;
 }
 
+/*
+ *	Create a context with the same settings as the one created
+ *	in mod_instantiate().
+ */
+static struct ub_ctx *unbound_ctx_alloc(rlm_unbound_t const *inst)
+{
+	struct ub_ctx	*ub;
+	char		*value;
+	int		res;
+
+	char k[64]; /* To silence const warns until newer unbound in distros */
+
+	ub = ub_ctx_create();
+	if (!ub) {
+		ERROR("%s - ub_ctx_create failed", inst->name);
+		return NULL;
+	}
+
+	res = ub_ctx_async(ub, 1);
+	if (res) goto error;
+
+	res = ub_ctx_debuglevel(ub, inst->log_level);
+	if (res) goto error;
+
+	if (inst->log_file) {
+		strcpy(k, "logfile:");
+		memcpy(&value, &main_config.log_file, sizeof(value));
+		res = ub_ctx_set_option(ub, k, value);
+		if (res) goto error;
+	}
+
+	memcpy(&value, &inst->filename, sizeof(value));
+	res = ub_ctx_config(ub, value);
+	if (res) goto error;
+
+	if (inst->syslog_override) {
+		char v[3];
+
+		strcpy(k, "use-syslog:");
+		strcpy(v, "no");
+		res = ub_ctx_set_option(ub, k, v);
+		if (res) goto error;
+
+		if (inst->log_file) {
+			strcpy(k, "logfile:");
+			memcpy(&value, &main_config.log_file, sizeof(value));
+			res = ub_ctx_set_option(ub, k, value);
+			if (res) goto error;
+		}
+	}
+
+	switch (inst->log_dst) {
+	case L_DST_STDOUT:
+		res = ub_ctx_debugout(ub, inst->log_stream);
+		break;
+
+	case L_DST_FILES:
+		break;
+
+	default:
+		res = ub_ctx_debugout(ub, NULL);
+		break;
+	}
+	if (res) goto error;
+
+	/* See mod_instantiate() */
+	strcpy(k, "notar33lsite.foo123.nottld A 127.0.0.1");
+	ub_ctx_data_remove(ub, k);
+
+	return ub;
+
+error:
+	ERROR("%s - %s", inst->name, ub_strerror(res));
+	ub_ctx_delete(ub);
+
+	return NULL;
+}
+
 static int mod_instantiate(CONF_SECTION *conf, void *instance)
 {
 	rlm_unbound_t *inst = instance;
@@ -412,6 +852,11 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	inst->log_fd = -1;
 	inst->log_pipe_in_use = false;
 
+	/*
+	 *	Each worker thread gets its own context in
+	 *	mod_thread_instantiate().  This one is only used
+	 *	by xlats called from outside of a worker.
+	 */
 	inst->ub = ub_ctx_create();
 	if (!inst->ub) {
 		cf_log_err_cs(conf, "ub_ctx_create failed");
@@ -467,6 +912,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 
 	res = ub_ctx_debuglevel(inst->ub, log_level);
 	if (res) goto error;
+	inst->log_level = log_level;
 
 	switch (default_log.dst) {
 	case L_DST_STDOUT:
@@ -499,6 +945,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 				goto error;
 			}
 			log_dst = L_DST_FILES;
+			inst->log_file = true;
 			break;
 		}
 		/* FALL-THROUGH */
@@ -539,6 +986,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 		strcpy(v, "no");
 		res = ub_ctx_set_option(inst->ub, k, v);
 		if (res) goto error;
+		inst->syslog_override = true;
 
 		if (log_dst == L_DST_FILES) {
 			char *log_file;
@@ -611,6 +1059,7 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	default:
 		break;
 	}
+	inst->log_dst = log_dst;
 
 	/*
 	 *  Now we need to finalize the context.
@@ -623,14 +1072,15 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	strcpy(k, "notar33lsite.foo123.nottld A 127.0.0.1");
 	ub_ctx_data_remove(inst->ub, k);
 
-	inst->log_fd = ub_fd(inst->ub);
-	if (inst->log_fd >= 0) {
-		if (fr_event_fd_insert(inst->el, inst->log_fd, ub_fd_handler, NULL, NULL, inst) < 0) {
-			cf_log_err_cs(conf, "could not insert async fd");
-			inst->log_fd = -1;
+	if (inst->cache_size > 0) {
+		pthread_mutex_init(&inst->cache_mutex, NULL);
+
+		inst->cache = rbtree_create(NULL, cache_entry_cmp, rbtree_node_talloc_free, 0);
+		inst->cache_heap = fr_heap_create(cache_heap_cmp, offsetof(unbound_cache_entry_t, heap_id));
+		if (!inst->cache || !inst->cache_heap) {
+			cf_log_err_cs(conf, "Failed creating answer cache");
 			goto error_nores;
 		}
-
 	}
 
 	return 0;
@@ -644,22 +1094,88 @@ static int mod_instantiate(CONF_SECTION *conf, void *instance)
 	return -1;
 }
 
+/** Create a libunbound context for this thread, and add its fd to the thread's event loop
+ *
+ * @param[in] conf	section containing the configuration of this module instance.
+ * @param[in] instance	of rlm_unbound_t.
+ * @param[in] el	The event list serviced by this thread.
+ * @param[in] thread	specific data.
+ * @return
+ *	- 0 on success.
+ *	- -1 on failure.
+ */
+static int mod_thread_instantiate(UNUSED CONF_SECTION const *conf, void *instance,
+				  fr_event_list_t *el, void *thread)
+{
+	rlm_unbound_t		*inst = instance;
+	rlm_unbound_thread_t	*t = thread;
+
+	t->inst = inst;
+	t->el = el;
+	t->fd = -1;
+
+	t->ub = unbound_ctx_alloc(inst);
+	if (!t->ub) return -1;
+
+	t->fd = ub_fd(t->ub);
+	if (t->fd < 0) {
+		ERROR("%s - Failed getting libunbound fd", inst->name);
+		return -1;
+	}
+
+	if (fr_event_fd_insert(el, t->fd, ub_fd_handler, NULL, NULL, t) < 0) {
+		ERROR("%s - Could not insert async fd", inst->name);
+		t->fd = -1;
+		return -1;
+	}
+
+	t->next = unbound_threads;
+	unbound_threads = t;
+
+	return 0;
+}
+
+static int mod_thread_detach(void *thread)
+{
+	rlm_unbound_thread_t	*t = thread;
+	rlm_unbound_thread_t	**last;
+
+	for (last = &unbound_threads; *last; last = &(*last)->next) {
+		if (*last == t) {
+			*last = t->next;
+			break;
+		}
+	}
+
+	if (t->fd >= 0) fr_event_fd_delete(t->el, t->fd);
+
+	/*
+	 *	The context isn't deleted, for the same
+	 *	reason as in mod_detach().
+	 */
+
+	return 0;
+}
+
 static int mod_detach(void *instance)
 {
 	rlm_unbound_t *inst = instance;
 
-	if (inst->log_fd >= 0) {
-		fr_event_fd_delete(inst->el, inst->log_fd);
-		if (inst->ub) {
-			ub_process(inst->ub);
-			/* This can hang/leave zombies currently
-			 * see upstream bug #519
-			 * ...so expect valgrind to complain with -m
-			 */
+	if (inst->ub) {
+		ub_process(inst->ub);
+		/* This can hang/leave zombies currently
+		 * see upstream bug #519
+		 * ...so expect valgrind to complain with -m
+		 */
 #if 0
-			ub_ctx_delete(inst->ub);
+		ub_ctx_delete(inst->ub);
 #endif
-		}
+	}
+
+	if (inst->cache_heap) fr_heap_delete(inst->cache_heap);
+	if (inst->cache) {
+		talloc_free(inst->cache);
+		pthread_mutex_destroy(&inst->cache_mutex);
 	}
 
 	if (inst->log_pipe_stream[1]) {
@@ -682,12 +1198,23 @@ static int mod_detach(void *instance)
 
 extern rad_module_t rlm_unbound;
 rad_module_t rlm_unbound = {
-	.magic		= RLM_MODULE_INIT,
-	.name		= "unbound",
-	.type		= RLM_TYPE_THREAD_SAFE,
-	.inst_size	= sizeof(rlm_unbound_t),
-	.config		= module_config,
-	.bootstrap	= mod_bootstrap,
-	.instantiate	= mod_instantiate,
-	.detach		= mod_detach
+	.magic			= RLM_MODULE_INIT,
+	.name			= "unbound",
+	.type			= RLM_TYPE_THREAD_SAFE,
+	.inst_size		= sizeof(rlm_unbound_t),
+	.config			= module_config,
+	.bootstrap		= mod_bootstrap,
+	.instantiate		= mod_instantiate,
+	.detach			= mod_detach,
+
+	.thread_inst_size	= sizeof(rlm_unbound_thread_t),
+	.thread_instantiate	= mod_thread_instantiate,
+	.thread_detach		= mod_thread_detach,
+
+	.methods = {
+		[MOD_AUTHORIZE]		= mod_lookup,
+		[MOD_PREACCT]		= mod_lookup,
+		[MOD_ACCOUNTING]	= mod_lookup,
+		[MOD_POST_AUTH]		= mod_lookup,
+	},
 };
@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+#  Compare proto_bfd running a thread per session, with sessions
+#  multiplexed onto a small number of threads.
+#
+#  bfd_peer simulates many BFD peers on loopback, each with its own
+#  address.  The same set of peers is run against the server twice,
+#  first with threads = 0 (a thread per session), then with the
+#  sessions shared between <threads> event loops.
+#
+#  For each run we print how long it took for every session to come
+#  up, how many packets the peers received, how many sessions
+#  flapped, and the CPU time, thread count and RSS of radiusd.
+#
+#  Usage: bench.sh [<peers> [<threads> [<seconds>]]]
+#
+#  Run it from the top of a built source tree.  <peers> is the
+#  number of simulated peers (default 10000), <threads> is the
+#  number of threads for the multiplexed run (default 4), and
+#  <seconds> is how long each run lasts (default 30).
+#
+#  Linux only, bfd_peer needs IP_PKTINFO to send from many
+#  addresses.  The peers use 127.1.0.1 upwards.
+#
+#  $Id$
+#
+PEERS=${1:-10000}
+THREADS=${2:-4}
+DURATION=${3:-30}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_DIR=${TOP}/src/tests/bench/bfd
+BENCH_PORT=${BENCH_PORT:-12380}
+PEER_PORT=$((BENCH_PORT + 1))
+
+export BENCH_DIR BENCH_PORT
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radiusd" ] || [ ! -x "${BIN}/bfd_peer" ]; then
+	echo "$0: radiusd and bfd_peer must be built first" >&2
+	exit 1
+fi
+
+#
+#  One peer section per simulated peer.
+#
+awk -v n="${PEERS}" -v p="${PEER_PORT}" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		a = i + 1
+		printf "peer {\n\tipaddr = 127.1.%d.%d\n\tport = %d\n}\n", int(a / 256), a % 256, p
+	}
+}' > "${BENCH_DIR}/peers"
+
+#
+#  run <threads>
+#
+#  Start radiusd, run the peers against it, and print the results.
+#
+run() {
+	BENCH_BFD_THREADS=$1
+	export BENCH_BFD_THREADS
+
+	rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/radius.log"
+	if ! "${BIN}/radiusd" -Pl "${BENCH_DIR}/radius.log" -d "${BENCH_DIR}" -n bfd -D "${TOP}/share"; then
+		echo "$0: Failed starting radiusd, see ${BENCH_DIR}/radius.log" >&2
+		return 1
+	fi
+	pid=$(cat "${BENCH_DIR}/radiusd.pid")
+
+	echo "threads = $1"
+	"${BIN}/bfd_peer" -n "${PEERS}" -p "${PEER_PORT}" -d "${DURATION}" 127.0.0.1 "${BENCH_PORT}"
+
+	awk -v hz="$(getconf CLK_TCK)" -v d="${DURATION}" '
+		FILENAME ~ /stat$/ { cpu = ($14 + $15) / hz }
+		/^Threads:/ { threads = $2 }
+		/^VmRSS:/ { rss = $2 }
+		END {
+			printf "radiusd      %.2fs cpu (%.1f%%), %d threads, %d kB rss\n", cpu, cpu * 100 / d, threads, rss
+		}' "/proc/${pid}/stat" "/proc/${pid}/status"
+	echo
+
+	kill "${pid}"
+	sleep 1
+}
+
+run 0
+run "${THREADS}"
+
+rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/peers"
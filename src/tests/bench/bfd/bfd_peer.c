@@ -0,0 +1,346 @@
+/*
+ * bfd_peer.c	Simulate many BFD peers, for benchmarking proto_bfd.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	proto_bfd finds sessions by the source IP of the packet, so
+ *	each simulated peer needs its own address.  The peers share
+ *	one socket, and use IP_PKTINFO to send from (and see which of)
+ *	a block of consecutive loopback addresses.
+ *
+ *	Each peer runs just enough of the RFC 5880 state machine to
+ *	bring the session up, and to notice if it goes down.
+ */
+RCSID("$Id$")
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <freeradius-devel/libradius.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC (1000000)
+
+#define BFD_STATE_ADMIN_DOWN	(0)
+#define BFD_STATE_DOWN		(1)
+#define BFD_STATE_INIT		(2)
+#define BFD_STATE_UP		(3)
+
+/*
+ *	A control packet, without authentication.  The intervals are
+ *	in host byte order, as proto_bfd sends them.
+ */
+typedef struct bfd_peer_packet_t {
+	uint8_t		version_diag;
+	uint8_t		state_flags;
+	uint8_t		detect_multi;
+	uint8_t		length;
+	uint32_t	my_disc;
+	uint32_t	your_disc;
+	uint32_t	desired_min_tx_interval;
+	uint32_t	required_min_rx_interval;
+	uint32_t	min_echo_rx_interval;
+} __attribute__ ((packed)) bfd_peer_packet_t;
+
+typedef struct bfd_peer_t {
+	int		state;
+	uint32_t	remote_disc;
+	uint64_t	last_recv;
+	uint64_t	next_send;
+} bfd_peer_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: bfd_peer [OPTS] <server ip> <server port>\n");
+	fprintf(stderr, "  -a <ipaddr>            First peer address (default 127.1.0.1).\n");
+	fprintf(stderr, "  -d <seconds>           How long to run for (default 30).\n");
+	fprintf(stderr, "  -i <msec>              Transmit interval (default 1000).\n");
+	fprintf(stderr, "  -m <num>               Detection multiplier (default 3).\n");
+	fprintf(stderr, "  -n <num>               Number of peers (default 10000).\n");
+	fprintf(stderr, "  -p <port>              Port the peers use (default 10001).\n");
+
+	exit(1);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * USEC) + (ts.tv_nsec / 1000);
+}
+
+static void peer_send(int fd, struct sockaddr_in *server, struct in_addr src,
+		      bfd_peer_t *peer, uint32_t number, uint32_t interval, int detect_multi)
+{
+	bfd_peer_packet_t	bfd;
+	struct iovec		iov;
+	struct msghdr		msg;
+	struct cmsghdr		*cmsg;
+	struct in_pktinfo	*pkt;
+	uint8_t			cbuf[CMSG_SPACE(sizeof(*pkt))];
+
+	memset(&bfd, 0, sizeof(bfd));
+	bfd.version_diag = 1 << 5;
+	bfd.state_flags = peer->state << 6;
+	bfd.detect_multi = detect_multi;
+	bfd.length = sizeof(bfd);
+	bfd.my_disc = number + 1;
+	bfd.your_disc = peer->remote_disc;
+	bfd.desired_min_tx_interval = interval;
+	bfd.required_min_rx_interval = interval;
+
+	iov.iov_base = &bfd;
+	iov.iov_len = sizeof(bfd);
+
+	memset(&msg, 0, sizeof(msg));
+	memset(cbuf, 0, sizeof(cbuf));
+	msg.msg_name = server;
+	msg.msg_namelen = sizeof(*server);
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = cbuf;
+	msg.msg_controllen = sizeof(cbuf);
+
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = IPPROTO_IP;
+	cmsg->cmsg_type = IP_PKTINFO;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(*pkt));
+	pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+	pkt->ipi_spec_dst = src;
+
+	(void) sendmsg(fd, &msg, 0);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, fd, on = 1, bufsize = 8 * 1024 * 1024;
+	uint32_t		i, num = 10000, num_up = 0, cursor = 0;
+	uint32_t		interval = 1000, duration = 30, base;
+	int			detect_multi = 3;
+	uint16_t		port = 10001;
+	struct in_addr		first;
+	struct sockaddr_in	server, local;
+	bfd_peer_t		*peers;
+	uint64_t		start, now, end, all_up = 0, received = 0, flaps = 0;
+
+	inet_aton("127.1.0.1", &first);
+
+	while ((c = getopt(argc, argv, "a:d:hi:m:n:p:")) != EOF) switch (c) {
+		case 'a':
+			if (!inet_aton(optarg, &first)) usage();
+			break;
+
+		case 'd':
+			duration = atoi(optarg);
+			break;
+
+		case 'i':
+			interval = atoi(optarg);
+			break;
+
+		case 'm':
+			detect_multi = atoi(optarg);
+			break;
+
+		case 'n':
+			num = atoi(optarg);
+			break;
+
+		case 'p':
+			port = atoi(optarg);
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if ((argc < 2) || !num || !interval || (detect_multi < 1) || (detect_multi > 255)) usage();
+
+	memset(&server, 0, sizeof(server));
+	server.sin_family = AF_INET;
+	server.sin_port = htons(atoi(argv[1]));
+	if (!inet_aton(argv[0], &server.sin_addr)) usage();
+
+	interval *= 1000;
+	base = ntohl(first.s_addr);
+
+	peers = calloc(num, sizeof(*peers));
+	if (!peers) {
+		fprintf(stderr, "bfd_peer: Out of memory\n");
+		exit(1);
+	}
+
+	fd = socket(AF_INET, SOCK_DGRAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "bfd_peer: Failed creating socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	setsockopt(fd, IPPROTO_IP, IP_PKTINFO, &on, sizeof(on));
+	setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &bufsize, sizeof(bufsize));
+	setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &bufsize, sizeof(bufsize));
+
+	/*
+	 *	The server replies to each peer's own address.
+	 */
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(port);
+	local.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0) {
+		fprintf(stderr, "bfd_peer: Failed binding to port %u: %s\n", port, fr_syserror(errno));
+		exit(1);
+	}
+	fr_nonblock(fd);
+
+	/*
+	 *	Spread the peers evenly over the interval.  They all
+	 *	use the same interval, so they stay in order.
+	 */
+	start = now_usec();
+	end = start + ((uint64_t) duration * USEC);
+	for (i = 0; i < num; i++) {
+		peers[i].state = BFD_STATE_DOWN;
+		peers[i].last_recv = start;
+		peers[i].next_send = start + (((uint64_t) interval * i) / num);
+	}
+
+	while ((now = now_usec()) < end) {
+		struct pollfd	pfd;
+		int		timeout;
+
+		while (peers[cursor].next_send <= now) {
+			bfd_peer_t *peer = &peers[cursor];
+
+			if ((peer->state != BFD_STATE_DOWN) &&
+			    ((now - peer->last_recv) > ((uint64_t) interval * detect_multi))) {
+				if (peer->state == BFD_STATE_UP) {
+					num_up--;
+					flaps++;
+				}
+				peer->state = BFD_STATE_DOWN;
+				peer->remote_disc = 0;
+			}
+
+			peer_send(fd, &server, (struct in_addr) { .s_addr = htonl(base + cursor) },
+				  peer, cursor, interval, detect_multi);
+
+			peer->next_send += interval;
+			if (++cursor == num) cursor = 0;
+		}
+
+		timeout = (peers[cursor].next_send - now + 999) / 1000;
+		pfd.fd = fd;
+		pfd.events = POLLIN;
+		if (poll(&pfd, 1, timeout) <= 0) continue;
+
+		for (;;) {
+			bfd_peer_packet_t	bfd;
+			struct iovec		iov;
+			struct msghdr		msg;
+			struct cmsghdr		*cmsg;
+			uint8_t			cbuf[CMSG_SPACE(sizeof(struct in_pktinfo))];
+			bfd_peer_t		*peer = NULL;
+			int			state;
+
+			iov.iov_base = &bfd;
+			iov.iov_len = sizeof(bfd);
+
+			memset(&msg, 0, sizeof(msg));
+			msg.msg_iov = &iov;
+			msg.msg_iovlen = 1;
+			msg.msg_control = cbuf;
+			msg.msg_controllen = sizeof(cbuf);
+
+			if (recvmsg(fd, &msg, 0) < 24) break;
+			received++;
+
+			for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+				struct in_pktinfo *pkt;
+
+				if ((cmsg->cmsg_level != IPPROTO_IP) || (cmsg->cmsg_type != IP_PKTINFO)) continue;
+
+				pkt = (struct in_pktinfo *) CMSG_DATA(cmsg);
+				i = ntohl(pkt->ipi_addr.s_addr) - base;
+				if (i < num) peer = &peers[i];
+			}
+			if (!peer) continue;
+
+			peer->remote_disc = bfd.my_disc;
+			peer->last_recv = now_usec();
+			state = bfd.state_flags >> 6;
+
+			switch (peer->state) {
+			case BFD_STATE_DOWN:
+				if (state == BFD_STATE_DOWN) {
+					peer->state = BFD_STATE_INIT;
+				} else if (state == BFD_STATE_INIT) {
+					peer->state = BFD_STATE_UP;
+					num_up++;
+				}
+				break;
+
+			case BFD_STATE_INIT:
+				if ((state == BFD_STATE_INIT) || (state == BFD_STATE_UP)) {
+					peer->state = BFD_STATE_UP;
+					num_up++;
+				}
+				break;
+
+			case BFD_STATE_UP:
+				if ((state == BFD_STATE_DOWN) || (state == BFD_STATE_ADMIN_DOWN)) {
+					peer->state = BFD_STATE_DOWN;
+					num_up--;
+					flaps++;
+				}
+				break;
+			}
+
+			if (!all_up && (num_up == num)) all_up = peer->last_recv;
+		}
+	}
+
+	now = now_usec();
+	printf("peers        %u\n", num);
+	printf("up           %u\n", num_up);
+	if (all_up) {
+		printf("all up after %.3fs\n", (double) (all_up - start) / USEC);
+	} else {
+		printf("all up after never\n");
+	}
+	printf("received     %" PRIu64 " (%.1f pps)\n", received, (double) received * USEC / (now - start));
+	printf("flaps        %" PRIu64 "\n", flaps);
+
+	free(peers);
+	close(fd);
+
+	return 0;
+}
@@ -0,0 +1,7 @@
+TARGET := bfd_peer
+
+SOURCES := bfd_peer.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
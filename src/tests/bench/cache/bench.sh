@@ -0,0 +1,90 @@
+#!/bin/sh
+#
+#  Compare the rbtree and htable rlm_cache drivers with many
+#  worker threads.
+#
+#  Requests for a set of distinct users are sent to two virtual
+#  servers.  Both cache the same attributes, keyed by User-Name,
+#  but one uses rlm_cache_rbtree (one mutex for the whole cache)
+#  and the other uses rlm_cache_htable (lock stripes).  After the
+#  first pass, almost every request is a cache hit.
+#
+#  Usage: bench.sh [<count> [<threads> [<keys>]]]
+#
+#  Run it from the top of a built source tree.  <count> is the
+#  number of requests sent to each server (default 200000),
+#  <threads> is the number of worker threads (default 32), and
+#  <keys> is the number of distinct users (default 10000).
+#
+#  Set BENCH_MAX_SIZE to give the htable cache a memory budget,
+#  smaller than the working set, to exercise eviction.
+#
+#  $Id$
+#
+COUNT=${1:-200000}
+BENCH_THREADS=${2:-32}
+KEYS=${3:-10000}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_DIR=${TOP}/src/tests/bench/cache
+BENCH_PORT=${BENCH_PORT:-12370}
+BENCH_PORT_HTABLE=$((BENCH_PORT + 1))
+BENCH_MAX_SIZE=${BENCH_MAX_SIZE:-0}
+PARALLEL=${PARALLEL:-256}
+
+export BENCH_DIR BENCH_PORT BENCH_PORT_HTABLE BENCH_THREADS BENCH_MAX_SIZE
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radiusd" ] || [ ! -x "${BIN}/radclient" ]; then
+	echo "$0: radiusd and radclient must be built first" >&2
+	exit 1
+fi
+
+#
+#  One request per user, radclient sends each of them in turn.
+#
+REQUESTS=${BENCH_DIR}/requests
+awk -v n="${KEYS}" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		printf "User-Name = \"user%d@example.com\"\nUser-Password = \"hello\"\nNAS-IP-Address = 192.0.2.1\n\n", i
+	}
+}' > "${REQUESTS}"
+
+#
+#  run <count> <driver> <port>
+#
+#  Send <count> requests to a port, and print how long it took.
+#
+run() {
+	per=$(( ($1 + KEYS - 1) / KEYS ))
+	start=$(date +%s.%N)
+	if ! "${BIN}/radclient" -q -c "${per}" -p "${PARALLEL}" -f "${REQUESTS}" \
+	     -D "${TOP}/share" "127.0.0.1:$3" auth testing123; then
+		echo "$0: $2 - radclient failed" >&2
+		return 1
+	fi
+	end=$(date +%s.%N)
+
+	awk -v s="$start" -v e="$end" -v c="$((per * KEYS))" -v d="$2" -v t="${BENCH_THREADS}" 'BEGIN {
+		printf "%-8s %3d threads %8d requests %8.3fs %10.0f requests/s\n", d, t, c, e - s, c / (e - s)
+	}'
+}
+
+rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/radius.log"
+if ! "${BIN}/radiusd" -Pl "${BENCH_DIR}/radius.log" -d "${BENCH_DIR}" -n cache -D "${TOP}/share"; then
+	echo "$0: Failed starting radiusd, see ${BENCH_DIR}/radius.log" >&2
+	exit 1
+fi
+
+#
+#  Populate both caches before timing anything.
+#
+run "${KEYS}" rbtree "${BENCH_PORT}" > /dev/null
+run "${KEYS}" htable "${BENCH_PORT_HTABLE}" > /dev/null
+
+run "${COUNT}" rbtree "${BENCH_PORT}"
+run "${COUNT}" htable "${BENCH_PORT_HTABLE}"
+
+kill "$(cat "${BENCH_DIR}/radiusd.pid")"
+rm -f "${BENCH_DIR}/radiusd.pid" "${REQUESTS}"
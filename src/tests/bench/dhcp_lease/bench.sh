@@ -0,0 +1,41 @@
+#!/bin/sh
+#
+#  DORA storm against the rlm_dhcp_lease pools.
+#
+#  A pool is filled by one DISCOVER and REQUEST per device, then
+#  every device renews, releases, and comes back with a DISCOVER.
+#  Each phase prints how many operations per second were done.
+#  This is run for each pool size, first with the pool held only in
+#  memory, then with every change written to the log, and a timed
+#  snapshot of the whole pool.
+#
+#  The functional tests in dhcp_lease_test are run first.
+#
+#  Usage: bench.sh [<dir> [<sizes>]]
+#
+#  Run it from the top of a built source tree.  <dir> is where the
+#  log and snapshot are written (default /tmp), <sizes> is a quoted
+#  list of pool sizes (default "4096 65536 1048576").
+#
+#  $Id$
+#
+DIR=${1:-/tmp}
+SIZES=${2:-4096 65536 1048576}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/dhcp_lease_test" ]; then
+	echo "$0: dhcp_lease_test must be built first" >&2
+	exit 1
+fi
+
+for size in ${SIZES}; do
+	echo "=== ${size} addresses, in memory"
+	"${BIN}/dhcp_lease_test" -d "${DIR}" -n "${size}" || exit 1
+
+	echo "=== ${size} addresses, logged"
+	"${BIN}/dhcp_lease_test" -d "${DIR}" -n "${size}" -p || exit 1
+done
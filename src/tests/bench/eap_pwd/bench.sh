@@ -0,0 +1,118 @@
+#!/bin/sh
+#
+#  Compare EAP-pwd session throughput with the password element
+#  computed inline by the worker, and by rlm_eap's offload threads.
+#
+#  The same EAP-pwd sessions are run against two virtual servers.
+#  Both use the same EAP-pwd configuration, but one sets
+#  offload_threads.  Many sessions are run in parallel, so the
+#  workers have other requests to process whilst hunting and
+#  pecking is in progress.
+#
+#  Usage: bench.sh [<count> [<threads>]]
+#
+#  Run it from the top of a built source tree.  <count> is the
+#  number of sessions run against each server (default 2000), and
+#  <threads> is the number of offload threads (default 4).
+#
+#  eapol_test must be in the PATH, or given by the EAPOL_TEST
+#  environment variable.  scripts/travis/eapol_test-build.sh
+#  will build it.
+#
+#  $Id$
+#
+COUNT=${1:-2000}
+BENCH_OFFLOAD_THREADS=${2:-4}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_DIR=${TOP}/src/tests/bench/eap_pwd
+BENCH_PORT=${BENCH_PORT:-12360}
+BENCH_PORT_OFFLOAD=$((BENCH_PORT + 1))
+PARALLEL=${PARALLEL:-32}
+EAPOL_TEST=${EAPOL_TEST:-eapol_test}
+
+export BENCH_DIR BENCH_PORT BENCH_PORT_OFFLOAD BENCH_OFFLOAD_THREADS
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radiusd" ]; then
+	echo "$0: radiusd must be built first" >&2
+	exit 1
+fi
+
+if [ ! -e "${TOP}/build/lib/local/.libs/rlm_eap_pwd.so" ] && \
+   [ ! -e "${TOP}/build/lib/local/.libs/rlm_eap_pwd.dylib" ]; then
+	echo "$0: rlm_eap_pwd was not built" >&2
+	exit 1
+fi
+
+if ! command -v "${EAPOL_TEST}" > /dev/null; then
+	echo "$0: eapol_test not found, set EAPOL_TEST" >&2
+	exit 1
+fi
+
+#
+#  sessions <count> <port>
+#
+#  Run <count> EAP-pwd sessions one after another.
+#
+sessions() {
+	i=0
+	while [ $i -lt "$1" ]; do
+		if ! "${EAPOL_TEST}" -c "${BENCH_DIR}/eapol_test.conf" -a 127.0.0.1 -p "$2" \
+		     -s testing123 -t 10 > /dev/null 2>&1; then
+			echo "$0: EAP-pwd session to port $2 failed" >&2
+			return 1
+		fi
+		i=$((i + 1))
+	done
+}
+
+#
+#  run <count> <mode> <port>
+#
+#  Run <count> sessions against a port, split across ${PARALLEL}
+#  supplicants, and print how long it took.
+#
+run() {
+	per=$(( ($1 + PARALLEL - 1) / PARALLEL ))
+	start=$(date +%s.%N)
+
+	failed=0
+	pids=
+	p=0
+	while [ $p -lt "${PARALLEL}" ]; do
+		sessions "${per}" "$3" &
+		pids="${pids} $!"
+		p=$((p + 1))
+	done
+	for pid in ${pids}; do
+		wait "${pid}" || failed=1
+	done
+
+	end=$(date +%s.%N)
+
+	if [ "${failed}" -ne 0 ]; then
+		echo "$0: $2 - some sessions failed" >&2
+		return 1
+	fi
+
+	awk -v s="$start" -v e="$end" -v c="$((per * PARALLEL))" -v m="$2" 'BEGIN {
+		printf "%-8s %8d sessions %8.3fs %10.1f sessions/s\n", m, c, e - s, c / (e - s)
+	}'
+}
+
+rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/radius.log"
+if ! "${BIN}/radiusd" -Pl "${BENCH_DIR}/radius.log" -d "${BENCH_DIR}" -n pwd -D "${TOP}/share"; then
+	echo "$0: Failed starting radiusd, see ${BENCH_DIR}/radius.log" >&2
+	exit 1
+fi
+
+run "${PARALLEL}" inline "${BENCH_PORT}" > /dev/null
+run "${PARALLEL}" offload "${BENCH_PORT_OFFLOAD}" > /dev/null
+
+run "${COUNT}" inline "${BENCH_PORT}"
+run "${COUNT}" offload "${BENCH_PORT_OFFLOAD}"
+
+kill "$(cat "${BENCH_DIR}/radiusd.pid")"
+rm -f "${BENCH_DIR}/radiusd.pid"
@@ -0,0 +1,39 @@
+#
+#  A typical authorize function, for comparing eager and lazy
+#  attribute marshalling in rlm_perl.  See bench.sh
+#
+#  $Id$
+#
+use strict;
+use warnings;
+
+use vars qw(%RAD_REQUEST %RAD_REPLY %RAD_CONFIG);
+
+use constant {
+	RLM_MODULE_REJECT	=> 0,
+	RLM_MODULE_OK		=> 2,
+	RLM_MODULE_NOTFOUND	=> 7,
+};
+
+my %users = (
+	'bob'	=> { 'Session-Timeout' => 3600, 'Framed-IP-Address' => '192.0.2.10' },
+	'alice'	=> { 'Session-Timeout' => 7200, 'Framed-IP-Address' => '192.0.2.11' },
+);
+
+sub authorize {
+	my $user = $users{$RAD_REQUEST{'User-Name'}};
+
+	return RLM_MODULE_NOTFOUND unless $user;
+
+	if (($RAD_REQUEST{'NAS-Port-Type'} || '') eq 'Virtual') {
+		$RAD_REPLY{'Reply-Message'} = 'VPN access is not allowed';
+		return RLM_MODULE_REJECT;
+	}
+
+	$RAD_REPLY{'Session-Timeout'} = $user->{'Session-Timeout'};
+	$RAD_REPLY{'Framed-IP-Address'} = $user->{'Framed-IP-Address'};
+	$RAD_REPLY{'Reply-Message'} = "Hello $RAD_REQUEST{'User-Name'} on $RAD_REQUEST{'Called-Station-Id'}";
+	$RAD_CONFIG{'Auth-Type'} = 'Accept';
+
+	return RLM_MODULE_OK;
+}
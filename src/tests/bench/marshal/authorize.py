@@ -0,0 +1,31 @@
+#
+#  A typical authorize function, for comparing eager and lazy
+#  attribute marshalling in rlm_python.  See bench.sh
+#
+#  $Id$
+#
+import radiusd
+
+users = {
+	'bob':		('3600', '192.0.2.10'),
+	'alice':	('7200', '192.0.2.11'),
+}
+
+def authorize(p):
+	# Works with both the request tuple, and a radiusd.PairList
+	if isinstance(p, tuple):
+		p = dict(p)
+
+	user = users.get(p.get('User-Name'))
+	if user is None:
+		return radiusd.RLM_MODULE_NOTFOUND
+
+	if p.get('NAS-Port-Type') == 'Virtual':
+		return (radiusd.RLM_MODULE_REJECT,
+			(('Reply-Message', 'VPN access is not allowed'),), ())
+
+	return (radiusd.RLM_MODULE_OK,
+		(('Session-Timeout', user[0]),
+		 ('Framed-IP-Address', user[1]),
+		 ('Reply-Message', 'Hello %s on %s' % (p['User-Name'], p['Called-Station-Id']))),
+		(('Auth-Type', 'Accept'),))
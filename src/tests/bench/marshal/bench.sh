@@ -0,0 +1,85 @@
+#!/bin/sh
+#
+#  Compare eager and lazy attribute marshalling in rlm_perl and
+#  rlm_python.
+#
+#  The same Access-Request (23 attributes, a typical NAS request)
+#  is sent to two virtual servers.  Both call the same authorize
+#  function, which reads four attributes and sets four.  One uses
+#  the default (eager) marshalling, and the other sets
+#  lazy_attributes.
+#
+#  Usage: bench.sh [<count> [<language> ...]]
+#
+#  Run it from the top of a built source tree.  <count> is the
+#  number of requests sent to each server (default 20000), and
+#  the languages default to "perl python".  Languages whose module
+#  wasn't built are skipped.
+#
+#  $Id$
+#
+COUNT=${1:-20000}
+[ $# -gt 0 ] && shift
+LANGS=${*:-perl python}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_DIR=${TOP}/src/tests/bench/marshal
+BENCH_PORT=${BENCH_PORT:-12350}
+BENCH_PORT_LAZY=$((BENCH_PORT + 1))
+PARALLEL=${PARALLEL:-32}
+
+export BENCH_DIR BENCH_PORT BENCH_PORT_LAZY
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radiusd" ] || [ ! -x "${BIN}/radclient" ]; then
+	echo "$0: radiusd and radclient must be built first" >&2
+	exit 1
+fi
+
+#
+#  run <count> <language> <mode> <port>
+#
+#  Send <count> copies of the request to a port, and print
+#  how long it took.
+#
+run() {
+	start=$(date +%s.%N)
+	if ! "${BIN}/radclient" -q -c "$1" -p "${PARALLEL}" -f "${BENCH_DIR}/request" \
+	     -D "${TOP}/share" "127.0.0.1:$4" auth testing123; then
+		echo "$0: $2 $3 - radclient failed" >&2
+		return 1
+	fi
+	end=$(date +%s.%N)
+
+	awk -v s="$start" -v e="$end" -v c="$1" -v l="$2" -v m="$3" 'BEGIN {
+		printf "%-8s %-6s %8d requests %8.3fs %10.0f requests/s\n", l, m, c, e - s, c / (e - s)
+	}'
+}
+
+for lang in ${LANGS}; do
+	if [ ! -e "${TOP}/build/lib/local/.libs/rlm_${lang}.so" ] && \
+	   [ ! -e "${TOP}/build/lib/local/.libs/rlm_${lang}.dylib" ]; then
+		echo "$0: rlm_${lang} was not built, skipping" >&2
+		continue
+	fi
+
+	rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/radius.log"
+	if ! "${BIN}/radiusd" -Pl "${BENCH_DIR}/radius.log" -d "${BENCH_DIR}" -n "${lang}" -D "${TOP}/share"; then
+		echo "$0: Failed starting radiusd, see ${BENCH_DIR}/radius.log" >&2
+		exit 1
+	fi
+
+	#
+	#  Warm up both servers (interpreter cloning etc.) before
+	#  timing anything.
+	#
+	run 100 "${lang}" eager "${BENCH_PORT}" > /dev/null
+	run 100 "${lang}" lazy "${BENCH_PORT_LAZY}" > /dev/null
+
+	run "${COUNT}" "${lang}" eager "${BENCH_PORT}"
+	run "${COUNT}" "${lang}" lazy "${BENCH_PORT_LAZY}"
+
+	kill "$(cat "${BENCH_DIR}/radiusd.pid")"
+	rm -f "${BENCH_DIR}/radiusd.pid"
+done
@@ -0,0 +1,38 @@
+#!/bin/sh
+#
+#  Compare reading frames from a memory mapped TPACKET_V3 ring with
+#  reading them one at a time with recvfrom().
+#
+#  A veth pair is created, and frames are sent through one end as
+#  fast as a thread can send them, while they're read from the
+#  other.  The functional tests in packet_ring_test are run over the
+#  pair first.
+#
+#  Usage: bench.sh [<frames>]
+#
+#  Run it as root, from the top of a built source tree.  <frames>
+#  is the number of frames sent to each reader (default 1000000).
+#  Set BENCH_IF to change the name of the veth pair (default
+#  frbench, the ends are frbench0 and frbench1).
+#
+#  $Id$
+#
+FRAMES=${1:-1000000}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_IF=${BENCH_IF:-frbench}
+
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/packet_ring_test" ]; then
+	echo "$0: packet_ring_test must be built first" >&2
+	exit 1
+fi
+
+ip link add "${BENCH_IF}0" type veth peer name "${BENCH_IF}1" || exit 1
+trap 'ip link del "${BENCH_IF}0"' EXIT
+ip link set "${BENCH_IF}0" up
+ip link set "${BENCH_IF}1" up
+
+"${BIN}/packet_ring_test" -o "${BENCH_IF}0" -i "${BENCH_IF}1" -n "${FRAMES}"
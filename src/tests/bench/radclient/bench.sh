@@ -0,0 +1,67 @@
+#!/bin/sh
+#
+#  Find the request rate at which radiusd stops keeping up, using
+#  radclient's load generation mode.
+#
+#  radclient sends requests at each rate in turn, for <seconds>,
+#  whether or not radiusd replies.  When radiusd can't keep up, the
+#  latency percentiles climb, and retransmits and timeouts appear.
+#
+#  Usage: bench.sh [<seconds> [<rate> ...]]
+#
+#  Run it from the top of a built source tree.  <seconds> defaults
+#  to 10, and the rates default to 10000 50000 100000 200000.
+#
+#  Set RADCLIENT_THREADS and RADCLIENT_SOCKETS to change how many
+#  threads radclient uses, and how many sockets each thread sends
+#  from.  Set BENCH_THREADS to change the number of radiusd worker
+#  threads.
+#
+#  $Id$
+#
+SECONDS_PER_RATE=${1:-10}
+[ $# -gt 0 ] && shift
+RATES=${*:-10000 50000 100000 200000}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_DIR=${TOP}/src/tests/bench/radclient
+BENCH_PORT=${BENCH_PORT:-12380}
+BENCH_THREADS=${BENCH_THREADS:-8}
+RADCLIENT_THREADS=${RADCLIENT_THREADS:-2}
+RADCLIENT_SOCKETS=${RADCLIENT_SOCKETS:-8}
+
+export BENCH_DIR BENCH_PORT BENCH_THREADS
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radiusd" ] || [ ! -x "${BIN}/radclient" ]; then
+	echo "$0: radiusd and radclient must be built first" >&2
+	exit 1
+fi
+
+#
+#  Every request has a different User-Name, and Acct-Session-Id.
+#
+REQUESTS=${BENCH_DIR}/requests
+cat > "${REQUESTS}" <<REQ
+User-Name = "user%n@example.com"
+User-Password = "hello"
+NAS-IP-Address = 192.0.2.1
+Acct-Session-Id = "%t-%r"
+REQ
+
+rm -f "${BENCH_DIR}/radiusd.pid" "${BENCH_DIR}/radius.log"
+if ! "${BIN}/radiusd" -Pl "${BENCH_DIR}/radius.log" -d "${BENCH_DIR}" -n load -D "${TOP}/share"; then
+	echo "$0: Failed starting radiusd, see ${BENCH_DIR}/radius.log" >&2
+	exit 1
+fi
+
+for rate in ${RATES}; do
+	echo "=== ${rate} requests/s"
+	"${BIN}/radclient" -q -L "${rate}" -l "${SECONDS_PER_RATE}" \
+		-T "${RADCLIENT_THREADS}" -N "${RADCLIENT_SOCKETS}" -t 1 -r 3 \
+		-f "${REQUESTS}" -D "${TOP}/share" "127.0.0.1:${BENCH_PORT}" auth testing123
+done
+
+kill "$(cat "${BENCH_DIR}/radiusd.pid")"
+rm -f "${BENCH_DIR}/radiusd.pid" "${REQUESTS}"
@@ -0,0 +1,66 @@
+#!/bin/sh
+#
+#  Compare how fast radsniff gets through a capture file with packets
+#  decoded and linked by the capture thread, and by shards.
+#
+#  The file is read as fast as radsniff can process it, so the run
+#  time is how long the pipeline takes to decode and link every
+#  exchange in the capture.  Nothing is printed, but attributes
+#  are still decoded, as they would be for printing.
+#
+#  Usage: bench.sh <pcap file> [<shards> ...]
+#
+#  Run it from the top of a built source tree.  The shard counts
+#  default to 1 2 4 8.  Set BENCH_PORT if the capture isn't on the
+#  default RADIUS ports.
+#
+#  $Id$
+#
+if [ $# -lt 1 ]; then
+	echo "Usage: $0 <pcap file> [<shards> ...]" >&2
+	exit 1
+fi
+PCAP=$1
+shift
+SHARDS=${*:-1 2 4 8}
+
+TOP=$(pwd)
+BIN=${TOP}/build/bin/local
+BENCH_PORT=${BENCH_PORT:-1812}
+
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+if [ ! -x "${BIN}/radsniff" ]; then
+	echo "$0: radsniff must be built first" >&2
+	exit 1
+fi
+
+if command -v capinfos > /dev/null 2>&1; then
+	PACKETS=$(capinfos -Mc "${PCAP}" | awk '/Number of packets/ { print $NF }')
+fi
+
+#
+#  run [<shards>]
+#
+run() {
+	if [ -n "$1" ]; then
+		echo "=== $1 shards"
+		set -- -t "$1"
+	else
+		echo "=== capture thread"
+	fi
+
+	start=$(date +%s.%N)
+	"${BIN}/radsniff" -q -p "${BENCH_PORT}" -D "${TOP}/share" -d "${TOP}/raddb" "$@" -I "${PCAP}" || return 1
+	end=$(date +%s.%N)
+
+	awk -v s="${start}" -v e="${end}" -v n="${PACKETS}" 'BEGIN {
+		printf "elapsed      %.3fs\n", e - s
+		if (n > 0) printf "rate         %.0f packets/s\n", n / (e - s)
+	}'
+}
+
+run
+for shards in ${SHARDS}; do
+	run "${shards}"
+done
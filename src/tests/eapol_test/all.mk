@@ -82,6 +82,7 @@ radiusd.kill: | $(OUTPUT_DIR)
 
 clean.tests.eap:
 	${Q}rm -f $(OUTPUT_DIR)/*.ok $(OUTPUT_DIR)/*.log $(OUTPUT_DIR)/eapol_test.skip
+	${Q}rm -rf $(OUTPUT_DIR)/ocsp $(OUTPUT_DIR)/resume
 	${Q}rm -f "$(CONFIG_PATH)/test.conf"
 	${Q}rm -f "$(CONFIG_PATH)/dictionary"
 	${Q}rm -rf "$(CONFIG_PATH)/methods-enabled"
@@ -166,6 +167,33 @@ $(OUTPUT_DIR)/%.ok: $(DIR)/%.conf | radiusd.kill $(CONFIG_PATH)/radiusd.pid
 
 tests.eap: $(EAPOL_OK_FILES)
 	${Q}$(MAKE) radiusd.kill
+
+#
+#  The OCSP and session resumption tests need several runs of
+#  eapol_test, and their own server.  See ocsp.sh and resume.sh.
+#
+ifneq "$(filter tls,$(EAP_TYPES))" ""
+OCSP_PORT := 12352
+RESUME_PORT := 12354
+
+$(OUTPUT_DIR)/ocsp.ok: $(DIR)/ocsp.sh $(CONFIG_PATH)/ocsp.conf $(CONFIG_PATH)/dictionary $(RADDB_PATH)/certs/server.pem $(RADDB_PATH)/certs/client.crt $(RADDB_PATH)/certs/ocsp.pem $(BUILD_DIR)/lib/rlm_eap_tls.la | $(OUTPUT_DIR)
+	${Q}echo EAPOL_TEST ocsp
+	${Q}if $(JLIBTOOL) --mode=execute sh $< $(EAPOL_TEST) $(BIN_PATH) $(RADDB_PATH) $(CONFIG_PATH) $(OUTPUT_DIR) $(OCSP_PORT); then \
+		touch $@; \
+	else \
+		exit 1; \
+	fi
+
+$(OUTPUT_DIR)/resume.ok: $(DIR)/resume.sh $(CONFIG_PATH)/resume.conf $(CONFIG_PATH)/dictionary $(RADDB_PATH)/certs/server.pem $(RADDB_PATH)/certs/client.crt $(BUILD_DIR)/lib/rlm_eap_tls.la | $(OUTPUT_DIR)
+	${Q}echo EAPOL_TEST resume
+	${Q}if $(JLIBTOOL) --mode=execute sh $< $(EAPOL_TEST) $(BIN_PATH) $(RADDB_PATH) $(CONFIG_PATH) $(OUTPUT_DIR) $(RESUME_PORT); then \
+		touch $@; \
+	else \
+		exit 1; \
+	fi
+
+tests.eap: $(OUTPUT_DIR)/ocsp.ok $(OUTPUT_DIR)/resume.ok
+endif
 else
 tests.eap: $(OUTPUT_DIR)
 	${Q}echo "Skipping EAP tests due to previous build error"
@@ -0,0 +1,174 @@
+#!/bin/sh
+#
+#  Test the OCSP response cache, with EAP-TLS.
+#
+#  Starts "openssl ocsp" as a responder for the test CA, and a
+#  server which uses it to check client certificates, with
+#  ocsp { cache { ... } } configured.  Then:
+#
+#	hit	 - the second authentication with the same certificate
+#		   is answered from the cache.
+#	refresh	 - the cached response is fetched again before it
+#		   expires, and authentications keep being answered
+#		   from the cache.
+#	revoked	 - a revoked certificate is rejected, and the
+#		   revoked response is cached too.
+#
+#  Usage: ocsp.sh <eapol_test> <bin dir> <raddb> <config dir> <output dir> <port>
+#
+#  The server listens on <port>, and the responder on <port> + 1.
+#  The server certificates must already have been built.
+#
+#  $Id$
+#
+EAPOL_TEST=$1
+BIN=$2
+RADDB=$(cd "$3" && pwd)
+TEST_DIR=$(cd "$4" && pwd)
+mkdir -p "$5/ocsp"
+OUT=$(cd "$5/ocsp" && pwd)
+TEST_PORT=$6
+OCSP_PORT=$((TEST_PORT + 1))
+SECRET=testing123
+
+#
+#  The CA key and the client key use the same password.
+#
+PASSWORD=$(grep output_password "${RADDB}/certs/client.cnf" | sed 's/.*=//;s/^ *//')
+
+export RADDB TEST_PORT OCSP_PORT
+TEST_OUTPUT=${OUT}
+export TEST_OUTPUT
+
+RCODE=0
+RADIUSD_PID=
+RESPONDER_PID=
+
+cleanup() {
+	[ -n "${RADIUSD_PID}" ] && kill -TERM "${RADIUSD_PID}" 2>/dev/null
+	[ -n "${RESPONDER_PID}" ] && kill -TERM "${RESPONDER_PID}" 2>/dev/null
+}
+trap cleanup EXIT
+
+rm -rf "${OUT:?}"/*
+
+#
+#  Issue a certificate from a copy of the test CA, and revoke it.
+#  The copy of the CA database has the other test certificates, so
+#  the responder says they're good.
+#
+mkdir "${OUT}/ca"
+cp "${RADDB}/certs/ca.pem" "${RADDB}/certs/ca.key" "${RADDB}/certs/index.txt" \
+   "${RADDB}/certs/serial" "${RADDB}/certs/ocsp.pem" "${RADDB}/certs/ocsp.key" "${OUT}/ca/"
+[ -f "${RADDB}/certs/index.txt.attr" ] && cp "${RADDB}/certs/index.txt.attr" "${OUT}/ca/"
+sed 's/= Example user$/= Revoked user/;s/= user.example@example.org$/= revoked@example.org/' \
+	"${RADDB}/certs/client.cnf" > "${OUT}/ca/revoked.cnf"
+
+if ! (cd "${OUT}/ca" && \
+      openssl req -new -out revoked.csr -keyout revoked.key -config ./revoked.cnf && \
+      openssl ca -batch -keyfile ca.key -cert ca.pem -in revoked.csr -key "${PASSWORD}" \
+		 -out revoked.crt -config ./revoked.cnf && \
+      openssl ca -keyfile ca.key -cert ca.pem -key "${PASSWORD}" -revoke revoked.crt -config ./revoked.cnf && \
+      openssl pkey -in ocsp.key -passin "pass:${PASSWORD}" -out responder.key) > "${OUT}/ca.log" 2>&1; then
+	echo "Failed creating the revoked certificate"
+	cat "${OUT}/ca.log"
+	exit 1
+fi
+
+#
+#  Responses are valid for a minute, the cache has a shorter max_ttl.
+#
+openssl ocsp -index "${OUT}/ca/index.txt" -port "${OCSP_PORT}" -CA "${OUT}/ca/ca.pem" \
+	-rsigner "${OUT}/ca/ocsp.pem" -rkey "${OUT}/ca/responder.key" -nmin 1 > "${OUT}/responder.log" 2>&1 &
+RESPONDER_PID=$!
+
+if ! "${BIN}/radiusd" -Pxxxl "${OUT}/radius.log" -d "${TEST_DIR}" -n ocsp -D "${TEST_DIR}"; then
+	echo "Failed starting radiusd"
+	tail -n 40 "${OUT}/radius.log"
+	exit 1
+fi
+RADIUSD_PID=$(cat "${OUT}/radiusd.pid")
+
+#
+#  eapol_test configuration for a certificate.
+#
+supplicant() {
+	cat > "${OUT}/$1.conf" <<EOF
+network={
+	key_mgmt=WPA-EAP
+	eap=TLS
+	identity="user@example.org"
+	ca_cert="${RADDB}/certs/ca.pem"
+	client_cert="$2"
+	private_key="$3"
+	private_key_passwd="${PASSWORD}"
+}
+EOF
+}
+
+supplicant good "${RADDB}/certs/client.crt" "${RADDB}/certs/client.key"
+supplicant revoked "${OUT}/ca/revoked.crt" "${OUT}/ca/revoked.key"
+
+#
+#  eap <name> <conf>
+#
+#  Sets OK to 1 if eapol_test succeeded, and 0 if it didn't.
+#
+eap() {
+	if "${EAPOL_TEST}" -t 5 -c "${OUT}/$2.conf" -p "${TEST_PORT}" -s "${SECRET}" > "${OUT}/$1.log" 2>&1; then
+		OK=1
+	else
+		OK=0
+	fi
+}
+
+#
+#  count <message>
+#
+count() {
+	grep -c "$1" "${OUT}/radius.log"
+}
+
+#
+#  check <name> <condition>
+#
+check() {
+	if [ "$2" = "0" ]; then
+		echo "ocsp $1 : FAILED"
+		RCODE=1
+	else
+		echo "ocsp $1 : Success"
+	fi
+}
+
+#
+#  Wait for the responder to start listening.
+#
+sleep 1
+
+eap first good
+check first $(( OK && $(count "Found cached OCSP response") == 0 ))
+
+eap hit good
+check hit $(( OK && $(count "Found cached OCSP response") == 1 ))
+
+#
+#  max_ttl = 10 and refresh = 6, so the response which was used is
+#  fetched again 4s after the first one.
+#
+sleep 6
+eap refresh good
+check refresh $(( OK && $(count "Refreshing response from") == 1 && \
+		  $(count "Found cached OCSP response") == 2 ))
+
+eap revoked revoked
+check revoked $(( !OK && $(count "Cert status: revoked") == 1 ))
+
+eap revoked_hit revoked
+check revoked_hit $(( !OK && $(count "Found cached OCSP response") == 3 ))
+
+if [ "$RCODE" != "0" ]; then
+	echo "See ${OUT} for the eapol_test, responder and radiusd logs"
+fi
+
+exit $RCODE
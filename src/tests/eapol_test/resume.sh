@@ -0,0 +1,111 @@
+#!/bin/sh
+#
+#  Test TLS session resumption from the in-memory session cache,
+#  with EAP-TLS.
+#
+#  Starts a server with cache { size = ... } configured, and no
+#  cache virtual server.  Then:
+#
+#	resume	 - eapol_test authenticates, and re-authenticates
+#		   (-r 1) by resuming the TLS session.  The session
+#		   is found in the in-memory cache.
+#	full	 - a new eapol_test has no session to resume, so does
+#		   a full handshake.
+#
+#  Usage: resume.sh <eapol_test> <bin dir> <raddb> <config dir> <output dir> <port>
+#
+#  The server certificates must already have been built.
+#
+#  $Id$
+#
+EAPOL_TEST=$1
+BIN=$2
+RADDB=$(cd "$3" && pwd)
+TEST_DIR=$(cd "$4" && pwd)
+mkdir -p "$5/resume"
+OUT=$(cd "$5/resume" && pwd)
+TEST_PORT=$6
+SECRET=testing123
+
+PASSWORD=$(grep output_password "${RADDB}/certs/client.cnf" | sed 's/.*=//;s/^ *//')
+
+export RADDB TEST_PORT
+TEST_OUTPUT=${OUT}
+export TEST_OUTPUT
+
+RCODE=0
+RADIUSD_PID=
+
+cleanup() {
+	[ -n "${RADIUSD_PID}" ] && kill -TERM "${RADIUSD_PID}" 2>/dev/null
+}
+trap cleanup EXIT
+
+rm -rf "${OUT:?}"/*
+
+if ! "${BIN}/radiusd" -Pxxxl "${OUT}/radius.log" -d "${TEST_DIR}" -n resume -D "${TEST_DIR}"; then
+	echo "Failed starting radiusd"
+	tail -n 40 "${OUT}/radius.log"
+	exit 1
+fi
+RADIUSD_PID=$(cat "${OUT}/radiusd.pid")
+
+cat > "${OUT}/tls.conf" <<EOF
+network={
+	key_mgmt=WPA-EAP
+	eap=TLS
+	identity="user@example.org"
+	ca_cert="${RADDB}/certs/ca.pem"
+	client_cert="${RADDB}/certs/client.crt"
+	private_key="${RADDB}/certs/client.key"
+	private_key_passwd="${PASSWORD}"
+}
+EOF
+
+#
+#  eap <name> [<options>]
+#
+#  Sets OK to 1 if eapol_test succeeded, and 0 if it didn't.
+#
+eap() {
+	name=$1
+	shift
+
+	if "${EAPOL_TEST}" -t 5 -c "${OUT}/tls.conf" -p "${TEST_PORT}" -s "${SECRET}" "$@" > "${OUT}/${name}.log" 2>&1; then
+		OK=1
+	else
+		OK=0
+	fi
+}
+
+#
+#  count <message>
+#
+count() {
+	grep -c "$1" "${OUT}/radius.log"
+}
+
+#
+#  check <name> <condition>
+#
+check() {
+	if [ "$2" = "0" ]; then
+		echo "resume $1 : FAILED"
+		RCODE=1
+	else
+		echo "resume $1 : Success"
+	fi
+}
+
+eap resume -r 1
+check resume $(( OK && $(count "Storing session in memory cache") >= 1 && \
+		 $(count "Found session in memory cache") == 1 ))
+
+eap full
+check full $(( OK && $(count "Found session in memory cache") == 1 ))
+
+if [ "$RCODE" != "0" ]; then
+	echo "See ${OUT} for the eapol_test and radiusd logs"
+fi
+
+exit $RCODE
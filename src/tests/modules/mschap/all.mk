@@ -0,0 +1,9 @@
+#
+#  Test the "mschap" module
+#
+
+#  The tests use a mock ntlm_auth helper, instead of Samba.
+$(BUILD_DIR)/tests/modules/mschap/helper $(BUILD_DIR)/tests/modules/mschap/helper-reject: $(TESTBINDIR)/ntlm_auth_mock
+
+#  MODULE.test is the main target for this module.
+mschap.test:
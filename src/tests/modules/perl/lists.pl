@@ -0,0 +1,37 @@
+use strict;
+use warnings;
+
+use vars qw(%RAD_REQUEST %RAD_REPLY %RAD_CONFIG);
+
+use constant {
+	RLM_MODULE_FAIL	=> 1,
+	RLM_MODULE_OK	=> 2,
+};
+
+sub authorize {
+	return RLM_MODULE_FAIL unless $RAD_REQUEST{'User-Name'} eq 'bob';
+	return RLM_MODULE_FAIL if exists $RAD_REQUEST{'Filter-Id'};
+
+	#
+	#  More than one value gives an array.
+	#
+	my $messages = $RAD_REPLY{'Reply-Message'};
+	return RLM_MODULE_FAIL unless ref($messages) eq 'ARRAY';
+	return RLM_MODULE_FAIL unless (@$messages == 2) && ($messages->[1] eq 'b');
+
+	#
+	#  Changes made to arrays in place.
+	#
+	push @{$RAD_REPLY{'Reply-Message'}}, 'c';
+	$RAD_REPLY{'Reply-Message'}[0] = 'z';
+	push @{$RAD_REPLY{'Filter-Id'}}, 'x', 'y';
+
+	#
+	#  Changes made through the hash.
+	#
+	$RAD_CONFIG{'Tmp-String-0'} = 'set';
+	$RAD_CONFIG{'Tmp-String-1'} .= 'appended';
+	delete $RAD_CONFIG{'Tmp-String-2'};
+
+	return RLM_MODULE_OK;
+}
@@ -0,0 +1,47 @@
+import radiusd
+
+def authorize(p):
+    if p['User-Name'] != 'bob':
+        return radiusd.RLM_MODULE_FAIL
+
+    if 'User-Password' not in p or 'Reply-Message' in p:
+        return radiusd.RLM_MODULE_FAIL
+
+    if p.get('Reply-Message', 'none') != 'none':
+        return radiusd.RLM_MODULE_FAIL
+
+    try:
+        p['Reply-Message']
+        return radiusd.RLM_MODULE_FAIL
+    except KeyError:
+        pass
+
+    # More than one value gives a tuple
+    if p['Filter-Id'] != ('a', 'b'):
+        return radiusd.RLM_MODULE_FAIL
+
+    # The list is live, so it has what unlang added before the call
+    if p['Called-Station-Id'] != 'lazy':
+        return radiusd.RLM_MODULE_FAIL
+
+    # Iterating gives the same tuples as the request tuple
+    if ('User-Name', 'bob') not in list(p):
+        return radiusd.RLM_MODULE_FAIL
+
+    if len(p) != len(list(p)):
+        return radiusd.RLM_MODULE_FAIL
+
+    if sorted(p.keys()) != ['Called-Station-Id', 'Filter-Id', 'User-Name', 'User-Password']:
+        return radiusd.RLM_MODULE_FAIL
+
+    # The list is read only, changes are returned
+    try:
+        p['Reply-Message'] = 'hello'
+        return radiusd.RLM_MODULE_FAIL
+    except TypeError:
+        pass
+
+    return (radiusd.RLM_MODULE_UPDATED,
+            (('Reply-Message', 'Hello ' + p['User-Name']),
+             ('Filter-Id', p['Filter-Id'][1])),
+            (('Cleartext-Password', p['User-Password']),))
@@ -0,0 +1,6 @@
+#
+#  Test the "unbound" module
+#
+
+#  MODULE.test is the main target for this module.
+unbound.test:
@@ -0,0 +1,23 @@
+#
+#  Test rlm_radius_client against local home servers.
+#
+#  See runtests.sh for the cases.
+#
+SUBMAKEFILES := home_server.mk
+
+RADIUS_CLIENT_TEST_DIR := $(BUILD_DIR)/tests/radius_client
+
+.PHONY: tests.radius_client clean.tests.radius_client
+clean: clean.tests.radius_client
+
+ifneq "$(findstring rlm_radius_client.la,$(ALL_TGTS))" ""
+tests.radius_client: $(TESTBINDIR)/radiusd $(TESTBINDIR)/radclient $(TESTBINDIR)/home_server rlm_radius_client.la
+	${Q}echo RADIUS_CLIENT
+	${Q}sh $(top_srcdir)/src/tests/radius_client/runtests.sh $(TESTBINDIR) $(RADIUS_CLIENT_TEST_DIR)
+else
+tests.radius_client:
+	${Q}echo "Skipping rlm_radius_client tests, the module wasn't built"
+endif
+
+clean.tests.radius_client:
+	${Q}rm -rf $(RADIUS_CLIENT_TEST_DIR)
@@ -0,0 +1,479 @@
+/*
+ * home_server.c	A minimal home server, for testing rlm_radius_client.
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	Answers every request with an empty reply (Access-Accept,
+ *	Accounting-Response or CoA-ACK), over UDP or TCP.  It can
+ *	drop the first copies of each request, delay replies, and
+ *	close TCP connections, so that the retransmission, socket
+ *	allocation and connection failure logic of the client get
+ *	exercised.
+ *
+ *	When it's told to exit, it prints what it saw, so that the
+ *	test can check the client behaved.
+ */
+RCSID("$Id$")
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <signal.h>
+#include <poll.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/md5.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define USEC		(1000000)
+#define MAX_CONNS	(64)
+#define SEEN_SIZE	(65536)
+#define HDR_LEN		(20)
+
+/*
+ *	A reply waiting for its delay to expire.  The delay is the
+ *	same for every reply, so the queue is always in order.
+ */
+typedef struct home_reply_t {
+	int			fd;
+	struct sockaddr_storage	dst;
+	socklen_t		dst_len;
+	uint8_t			data[HDR_LEN];
+	uint64_t		when;
+	struct home_reply_t	*next;
+} home_reply_t;
+
+typedef struct home_conn_t {
+	int			fd;
+	uint32_t		requests;
+	uint8_t			buffer[MAX_PACKET_LEN];
+	size_t			used;
+} home_conn_t;
+
+static char const		*secret = "testing123";
+static uint32_t			drop = 0;
+static uint32_t			close_after = 0;
+static uint64_t			delay = 0;
+
+static home_reply_t		*queue_head = NULL;
+static home_reply_t		*queue_tail = NULL;
+
+/*
+ *	Requests we've seen, by Request Authenticator.  The client
+ *	sends the same data when it retransmits.
+ */
+static uint8_t			seen[SEEN_SIZE][AUTH_VECTOR_LEN];
+static uint32_t			seen_count[SEEN_SIZE];
+static uint8_t			port_used[65536 / 8];
+
+static uint64_t			received, retransmissions, dropped, replies, ports, connections, closed;
+
+static volatile sig_atomic_t	done = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: home_server [OPTS] <port>\n");
+	fprintf(stderr, "  -c <num>               Close each TCP connection when it sends the num'th request,\n");
+	fprintf(stderr, "                         without answering it.\n");
+	fprintf(stderr, "  -d <msec>              Delay each reply (default 0).\n");
+	fprintf(stderr, "  -D <num>               Drop the first num copies of each request.  UDP only.\n");
+	fprintf(stderr, "  -l <seconds>           How long to run for (default until SIGTERM).\n");
+	fprintf(stderr, "  -P <proto>             Use proto (tcp or udp) for transport (default udp).\n");
+	fprintf(stderr, "  -s <secret>            Shared secret (default testing123).\n");
+
+	exit(1);
+}
+
+static uint64_t now_usec(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ((uint64_t) ts.tv_sec * USEC) + (ts.tv_nsec / 1000);
+}
+
+static void sig_done(UNUSED int sig)
+{
+	done = 1;
+}
+
+/** Record a request
+ *
+ * @return how many copies of it we'd already seen.
+ */
+static uint32_t request_seen(uint8_t const *data)
+{
+	uint8_t const	*vector = data + 4;
+	uint32_t	hash, i;
+
+	memcpy(&hash, vector, sizeof(hash));
+	hash %= SEEN_SIZE;
+
+	for (i = 0; i < SEEN_SIZE; i++, hash = (hash + 1) % SEEN_SIZE) {
+		if (!seen_count[hash]) {
+			memcpy(seen[hash], vector, AUTH_VECTOR_LEN);
+			seen_count[hash] = 1;
+			return 0;
+		}
+		if (memcmp(seen[hash], vector, AUTH_VECTOR_LEN) == 0) return seen_count[hash]++;
+	}
+
+	/*
+	 *	Full.  Treat it as new.
+	 */
+	return 0;
+}
+
+/** Send a reply, now or later
+ *
+ */
+static void reply_queue(int fd, uint8_t const *request, struct sockaddr_storage *dst, socklen_t dst_len)
+{
+	home_reply_t	*reply;
+	FR_MD5_CTX	ctx;
+
+	reply = calloc(1, sizeof(*reply));
+	if (!reply) return;
+
+	reply->fd = fd;
+	if (dst) memcpy(&reply->dst, dst, dst_len);
+	reply->dst_len = dst_len;
+
+	switch (request[0]) {
+	case PW_CODE_ACCESS_REQUEST:
+		reply->data[0] = PW_CODE_ACCESS_ACCEPT;
+		break;
+
+	case PW_CODE_ACCOUNTING_REQUEST:
+		reply->data[0] = PW_CODE_ACCOUNTING_RESPONSE;
+		break;
+
+	case PW_CODE_COA_REQUEST:
+		reply->data[0] = PW_CODE_COA_ACK;
+		break;
+
+	case PW_CODE_DISCONNECT_REQUEST:
+		reply->data[0] = PW_CODE_DISCONNECT_ACK;
+		break;
+
+	default:
+		free(reply);
+		return;
+	}
+	reply->data[1] = request[1];
+	reply->data[2] = 0;
+	reply->data[3] = HDR_LEN;
+
+	/*
+	 *	Response Authenticator = MD5(Code+ID+Length+RequestAuth+Secret)
+	 */
+	memcpy(reply->data + 4, request + 4, AUTH_VECTOR_LEN);
+	fr_md5_init(&ctx);
+	fr_md5_update(&ctx, reply->data, HDR_LEN);
+	fr_md5_update(&ctx, (uint8_t const *) secret, strlen(secret));
+	fr_md5_final(reply->data + 4, &ctx);
+
+	reply->when = now_usec() + delay;
+	if (queue_tail) {
+		queue_tail->next = reply;
+	} else {
+		queue_head = reply;
+	}
+	queue_tail = reply;
+}
+
+/** Send the replies whose delay has expired
+ *
+ * @return how long until the next one is due, in msec, or -1 if there
+ *	are none.
+ */
+static int reply_flush(void)
+{
+	uint64_t now = now_usec();
+
+	while (queue_head && (queue_head->when <= now)) {
+		home_reply_t *reply = queue_head;
+
+		queue_head = reply->next;
+		if (!queue_head) queue_tail = NULL;
+
+		if (reply->fd < 0) {
+			free(reply);
+			continue;
+		}
+
+		if (reply->dst_len) {
+			(void) sendto(reply->fd, reply->data, sizeof(reply->data), 0,
+				      (struct sockaddr *) &reply->dst, reply->dst_len);
+		} else {
+			(void) write(reply->fd, reply->data, sizeof(reply->data));
+		}
+		replies++;
+		free(reply);
+	}
+
+	if (!queue_head) return -1;
+
+	return (queue_head->when - now + 999) / 1000;
+}
+
+static void request_process(int fd, uint8_t const *data, size_t len,
+			    struct sockaddr_storage *src, socklen_t src_len)
+{
+	uint32_t copies;
+
+	if ((len < HDR_LEN) || ((size_t) ((data[2] << 8) | data[3]) > len)) return;
+
+	received++;
+	copies = request_seen(data);
+	if (copies) retransmissions++;
+
+	if (src && (copies < drop)) {
+		dropped++;
+		return;
+	}
+
+	reply_queue(fd, data, src, src_len);
+}
+
+static void udp_read(int fd)
+{
+	uint8_t			data[MAX_PACKET_LEN];
+	struct sockaddr_storage	src;
+	socklen_t		src_len;
+	ssize_t			len;
+	uint16_t		port;
+
+	for (;;) {
+		src_len = sizeof(src);
+		len = recvfrom(fd, data, sizeof(data), 0, (struct sockaddr *) &src, &src_len);
+		if (len < 0) return;
+
+		if (src.ss_family == AF_INET) {
+			port = ntohs(((struct sockaddr_in *) &src)->sin_port);
+		} else {
+			port = ntohs(((struct sockaddr_in6 *) &src)->sin6_port);
+		}
+		if (!(port_used[port / 8] & (1 << (port % 8)))) {
+			port_used[port / 8] |= (1 << (port % 8));
+			ports++;
+		}
+
+		request_process(fd, data, len, &src, src_len);
+	}
+}
+
+/** Read from a TCP connection, and answer any complete packets
+ *
+ * @return
+ *	- 0 on success.
+ *	- -1 if the connection should be closed.
+ */
+static int tcp_read(home_conn_t *conn)
+{
+	ssize_t len;
+	size_t	packet_len;
+
+	len = read(conn->fd, conn->buffer + conn->used, sizeof(conn->buffer) - conn->used);
+	if (len <= 0) return -1;
+	conn->used += len;
+
+	while (conn->used >= 4) {
+		packet_len = (conn->buffer[2] << 8) | conn->buffer[3];
+		if ((packet_len < HDR_LEN) || (packet_len > MAX_PACKET_LEN)) return -1;
+		if (conn->used < packet_len) break;
+
+		if (close_after && (++conn->requests == close_after)) {
+			received++;
+			closed++;
+			return -1;
+		}
+
+		request_process(conn->fd, conn->buffer, packet_len, NULL, 0);
+
+		memmove(conn->buffer, conn->buffer + packet_len, conn->used - packet_len);
+		conn->used -= packet_len;
+	}
+
+	return 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, fd, i, timeout, num_conns = 0;
+	bool			tcp = false;
+	uint32_t		duration = 0;
+	uint64_t		end = 0;
+	struct sockaddr_in	local;
+	struct pollfd		pfd[MAX_CONNS + 1];
+	home_conn_t		*conns[MAX_CONNS];
+
+	while ((c = getopt(argc, argv, "c:d:D:hl:P:s:")) != EOF) switch (c) {
+		case 'c':
+			close_after = atoi(optarg);
+			break;
+
+		case 'd':
+			delay = (uint64_t) atoi(optarg) * 1000;
+			break;
+
+		case 'D':
+			drop = atoi(optarg);
+			break;
+
+		case 'l':
+			duration = atoi(optarg);
+			break;
+
+		case 'P':
+			if (strcmp(optarg, "tcp") == 0) {
+				tcp = true;
+			} else if (strcmp(optarg, "udp") != 0) {
+				usage();
+			}
+			break;
+
+		case 's':
+			secret = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	argc -= optind;
+	argv += optind;
+
+	if (argc < 1) usage();
+
+	signal(SIGTERM, sig_done);
+	signal(SIGINT, sig_done);
+	signal(SIGPIPE, SIG_IGN);
+
+	fd = socket(AF_INET, tcp ? SOCK_STREAM : SOCK_DGRAM, 0);
+	if (fd < 0) {
+		fprintf(stderr, "home_server: Failed creating socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	c = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &c, sizeof(c));
+
+	memset(&local, 0, sizeof(local));
+	local.sin_family = AF_INET;
+	local.sin_port = htons(atoi(argv[0]));
+	local.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(fd, (struct sockaddr *) &local, sizeof(local)) < 0) {
+		fprintf(stderr, "home_server: Failed binding to port %s: %s\n", argv[0], fr_syserror(errno));
+		exit(1);
+	}
+	if (tcp && (listen(fd, 8) < 0)) {
+		fprintf(stderr, "home_server: Failed listening: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	fr_nonblock(fd);
+
+	if (duration) end = now_usec() + ((uint64_t) duration * USEC);
+
+	while (!done && (!end || (now_usec() < end))) {
+		timeout = reply_flush();
+		if ((timeout < 0) || (timeout > 100)) timeout = 100;
+
+		pfd[0].fd = fd;
+		pfd[0].events = POLLIN;
+		for (i = 0; i < num_conns; i++) {
+			pfd[i + 1].fd = conns[i]->fd;
+			pfd[i + 1].events = POLLIN;
+		}
+
+		if (poll(pfd, num_conns + 1, timeout) <= 0) continue;
+
+		/*
+		 *	Check the connections first, so that closing one
+		 *	doesn't shuffle a connection we haven't looked at
+		 *	into a slot we have.
+		 */
+		for (i = num_conns - 1; i >= 0; i--) {
+			home_reply_t *reply;
+
+			if (!pfd[i + 1].revents) continue;
+			if (tcp_read(conns[i]) == 0) continue;
+
+			/*
+			 *	Forget any replies which were due on it.
+			 */
+			for (reply = queue_head; reply; reply = reply->next) {
+				if (reply->fd == conns[i]->fd) reply->fd = -1;
+			}
+
+			close(conns[i]->fd);
+			free(conns[i]);
+			conns[i] = conns[--num_conns];
+		}
+
+		if (!(pfd[0].revents & POLLIN)) continue;
+
+		if (!tcp) {
+			udp_read(fd);
+			continue;
+		}
+
+		for (;;) {
+			int client;
+
+			client = accept(fd, NULL, NULL);
+			if (client < 0) break;
+
+			if (num_conns == MAX_CONNS) {
+				close(client);
+				continue;
+			}
+
+			conns[num_conns] = calloc(1, sizeof(*conns[num_conns]));
+			if (!conns[num_conns]) {
+				close(client);
+				continue;
+			}
+			conns[num_conns++]->fd = client;
+			connections++;
+		}
+	}
+
+	printf("received        %" PRIu64 "\n", received);
+	printf("retransmissions %" PRIu64 "\n", retransmissions);
+	printf("dropped         %" PRIu64 "\n", dropped);
+	printf("replies         %" PRIu64 "\n", replies);
+	printf("ports           %" PRIu64 "\n", ports);
+	printf("connections     %" PRIu64 "\n", connections);
+	printf("closed          %" PRIu64 "\n", closed);
+
+	for (i = 0; i < num_conns; i++) {
+		close(conns[i]->fd);
+		free(conns[i]);
+	}
+	close(fd);
+
+	return 0;
+}
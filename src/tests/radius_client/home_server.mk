@@ -0,0 +1,7 @@
+TARGET := home_server
+
+SOURCES := home_server.c
+
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
+TGT_INSTALLDIR	:=
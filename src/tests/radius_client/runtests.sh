@@ -0,0 +1,173 @@
+#!/bin/sh
+#
+#  Test rlm_radius_client, by proxying radclient's requests through
+#  radiusd to instances of home_server, and checking what each side
+#  saw.
+#
+#	backoff	 - the home server drops the first copy of each request.
+#		   Every request should be accepted, after RFC 5080
+#		   retransmissions.
+#	timeout	 - the home server drops everything.  Every request
+#		   should be sent exactly 1 + max_rtx_count times, then
+#		   rejected when response_window is reached.
+#	sockets	 - the home server delays its replies, so that more
+#		   than 256 packets are outstanding, and the module has
+#		   to open more UDP sockets.
+#	tcp	 - the home server uses TCP, with max_connections = 0
+#		   (unlimited).
+#	tcp_fail - the home server closes the connection on every 10th
+#		   request.  That request fails, the others succeed
+#		   on new connections.
+#	balance	 - two home servers, one much slower than the other.
+#		   Most packets should go to the fast one.
+#
+#  Usage: runtests.sh <bin dir> <output dir>
+#
+#  Run it from the top of a built source tree.  radiusd listens on
+#  port 12360, and the home servers on 12361 to 12367.
+#
+#  $Id$
+#
+BIN=$1
+mkdir -p "$2"
+OUT=$(cd "$2" && pwd)
+
+TOP=$(pwd)
+TEST_DIR=${TOP}/src/tests/radius_client/config
+TEST_OUTPUT=${OUT}
+TEST_PORT=12360
+SECRET=testing123
+
+export TEST_OUTPUT TEST_PORT
+export FR_LIBRARY_PATH=${TOP}/build/lib/local/.libs/
+
+RCODE=0
+HOME_PIDS=
+
+rm -f "${OUT}"/*.log "${OUT}"/*.out "${OUT}/radiusd.pid"
+
+#
+#  home <name> <port> [<options>]
+#
+home() {
+	name=$1
+	port=$2
+	shift 2
+
+	"${BIN}/home_server" "$@" "${port}" > "${OUT}/${name}.out" 2>&1 &
+	HOME_PIDS="${HOME_PIDS} $!"
+}
+
+#
+#  radclient_run <user> <count> <parallel>
+#
+#  Sends <count> Access-Requests for <user>.  radclient doesn't
+#  retransmit, radiusd does.
+#
+radclient_run() {
+	i=0
+	rm -f "${OUT}/$1.request"
+	while [ $i -lt $2 ]; do
+		printf 'User-Name = "%s"\nUser-Password = "%s"\n\n' "$1" "$1" >> "${OUT}/$1.request"
+		i=$((i + 1))
+	done
+
+	"${BIN}/radclient" -xs -t 15 -r 1 -p "$3" -D "${TOP}/share" -d "${TOP}/raddb" \
+		-f "${OUT}/$1.request" "127.0.0.1:${TEST_PORT}" auth "${SECRET}" > "${OUT}/$1.log" 2>&1
+}
+
+#
+#  summary <user> <field>
+#
+summary() {
+	awk -v f="$2" '$1 == f && $2 == ":" { v = $3 } END { print v + 0 }' "${OUT}/$1.log"
+}
+
+#
+#  home_stat <home> <field>
+#
+home_stat() {
+	awk -v f="$2" '$1 == f { v = $2 } END { print v + 0 }' "${OUT}/$1.out"
+}
+
+#
+#  check <name> <condition>
+#
+check() {
+	if [ "$2" = "0" ]; then
+		echo "radius_client $1 : FAILED"
+		RCODE=1
+	else
+		echo "radius_client $1 : Success"
+	fi
+}
+
+home backoff 12361 -D 1
+home timeout 12362 -D 1000
+home sockets 12363 -d 1000
+home tcp 12364 -P tcp
+home tcp_fail 12367 -P tcp -c 10
+home fast 12365
+home slow 12366 -d 100
+
+if ! "${BIN}/radiusd" -Pxxl "${OUT}/radius.log" -d "${TEST_DIR}" -n radius_client -D "${TOP}/share"; then
+	echo "radius_client : FAILED STARTING RADIUSD"
+	tail -n 40 "${OUT}/radius.log"
+	kill ${HOME_PIDS}
+	exit 1
+fi
+
+radclient_run backoff 50 50
+radclient_run timeout 10 10
+radclient_run sockets 300 300
+radclient_run tcp 100 20
+radclient_run tcp_fail 50 1
+radclient_run balance 200 10
+
+kill -TERM "$(cat "${OUT}/radiusd.pid")"
+kill -TERM ${HOME_PIDS}
+wait
+
+#
+#  Every request got through, but only after the dropped copy was
+#  retransmitted.
+#
+check backoff.accepted $(( $(summary backoff Accepted) == 50 ))
+check backoff.retransmitted $(( $(home_stat backoff dropped) == 50 && $(home_stat backoff retransmissions) >= 50 ))
+
+#
+#  max_rtx_count limits the copies, and response_window ends it.
+#
+check timeout.rejected $(( $(summary timeout Rejected) == 10 ))
+check timeout.max_rtx_count $(( $(home_stat timeout received) == 40 ))
+
+#
+#  300 outstanding packets need at least two sockets.
+#
+check sockets.accepted $(( $(summary sockets Accepted) == 300 ))
+check sockets.ports $(( $(home_stat sockets ports) >= 2 ))
+
+#
+#  TCP is reliable, so nothing is retransmitted.
+#
+check tcp.accepted $(( $(summary tcp Accepted) == 100 ))
+check tcp.connected $(( $(home_stat tcp connections) >= 1 && $(home_stat tcp retransmissions) == 0 ))
+
+#
+#  Requests on a closed connection fail, and aren't resent on the
+#  next one.
+#
+check tcp_fail.accepted $(( $(summary tcp_fail Accepted) == 45 && $(summary tcp_fail Rejected) == 5 ))
+check tcp_fail.reconnected $(( $(home_stat tcp_fail connections) >= 5 && $(home_stat tcp_fail received) == 50 ))
+
+#
+#  The fast home server gets most of the packets.
+#
+check balance.accepted $(( $(summary balance Accepted) == 200 ))
+check balance.fast $(( $(home_stat fast received) > 3 * $(home_stat slow received) ))
+
+if [ "$RCODE" != "0" ]; then
+	echo "See ${OUT} for the radclient, home server and radiusd logs"
+fi
+
+exit $RCODE
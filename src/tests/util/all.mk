@@ -1,4 +1,4 @@
-SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk 
+SUBMAKEFILES := ring_buffer_test.mk message_set_test.mk atomic_queue_test.mk control_test.mk cache_serialize_test.mk tacacs_reader_test.mk packet_list_test.mk packet_ring_test.mk dhcp_lease_test.mk network_limit_test.mk
 
 #
 #  These require pthread.
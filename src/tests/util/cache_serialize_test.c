@@ -0,0 +1,241 @@
+/*
+ * cache_serialize_test.c	Tests and benchmarks for rlm_cache entry serialization
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "rlm_cache.h"
+#include "serialize.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define NSEC (1000000000)
+
+/*
+ *	A typical entry, as produced by the text serializer.
+ */
+static char const entry_text[] =
+	"&Cache-Expires = 1500000600\n"
+	"&Cache-Created = 1500000000\n"
+	"&reply:Reply-Message := 'Hello from the cache'\n"
+	"&reply:Class := 'abcdefghijklmnopqrstuvwxyz012345'\n"
+	"&reply:Session-Timeout := 3600\n"
+	"&reply:Idle-Timeout := 600\n"
+	"&reply:Framed-IP-Address := 192.0.2.1\n"
+	"&reply:Framed-IPv6-Prefix := 2001:db8::/64\n"
+	"&reply:Service-Type := Framed-User\n"
+	"&reply:Framed-Protocol := PPP\n"
+	"&reply:Filter-Id += 'std.ingress'\n"
+	"&reply:Filter-Id += 'std.egress'\n"
+	"&control:Cache-TTL := 600\n"
+	"&request:Event-Timestamp := 1500000000\n";
+
+static int		debug_lvl = 0;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: cache_serialize_test [OPTS]\n");
+	fprintf(stderr, "  -D <dictdir>           Set main dictionary directory (defaults to " DICTDIR ").\n");
+	fprintf(stderr, "  -n <num>               Number of iterations for each format.\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+/** Check two entries contain the same maps
+ *
+ */
+static void entry_cmp(rlm_cache_entry_t const *a, rlm_cache_entry_t const *b)
+{
+	vp_map_t const *x, *y;
+
+	rad_assert(a->created == b->created);
+	rad_assert(a->expires == b->expires);
+
+	for (x = a->maps, y = b->maps; x && y; x = x->next, y = y->next) {
+		rad_assert(x->lhs->tmpl_da == y->lhs->tmpl_da);
+		rad_assert(x->lhs->tmpl_list == y->lhs->tmpl_list);
+		rad_assert(x->lhs->tmpl_request == y->lhs->tmpl_request);
+		rad_assert(x->op == y->op);
+		rad_assert(value_box_cmp(&x->rhs->tmpl_value_box, &y->rhs->tmpl_value_box) == 0);
+	}
+	rad_assert(!x && !y);
+}
+
+static void print_rate(char const *name, uint64_t num, fr_time_t start, fr_time_t end, size_t len)
+{
+	uint64_t delta = end - start;
+
+	if (!delta) delta = 1;
+
+	printf("%-24s %10" PRIu64 " ops/s  (%zu bytes)\n", name,
+	       (num * NSEC) / delta, len);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c;
+	char const		*dict_dir = DICTDIR;
+	fr_dict_t		*dict = NULL;
+	uint32_t		fingerprint;
+	uint64_t		i, num = 100000;
+
+	TALLOC_CTX		*autofree = talloc_init("main");
+	TALLOC_CTX		*pool;
+	rlm_cache_entry_t	*entry, *copy;
+	char			*text, *buff;
+	uint8_t			*bin;
+	size_t			text_len, bin_len;
+	fr_time_t		start;
+
+	while ((c = getopt(argc, argv, "D:hn:x")) != EOF) switch (c) {
+		case 'D':
+			dict_dir = optarg;
+			break;
+
+		case 'n':
+			num = strtoull(optarg, NULL, 10);
+			if (!num) usage();
+			break;
+
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	if (fr_dict_from_file(autofree, &dict, dict_dir, FR_DICTIONARY_FILE, "radius") < 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+	fingerprint = fr_dict_fingerprint(dict);
+
+	/*
+	 *	Build the reference entry from the text format.
+	 */
+	entry = talloc_zero(autofree, rlm_cache_entry_t);
+	buff = talloc_strdup(autofree, entry_text);
+	if (cache_deserialize(entry, buff, talloc_array_length(buff) - 1) < 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+
+	if (cache_serialize(autofree, &text, entry) < 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+	text_len = talloc_array_length(text) - 1;
+
+	if (cache_serialize_binary(autofree, &bin, entry, fingerprint) != 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+	bin_len = talloc_array_length(bin);
+
+	if (debug_lvl) printf("%s\n", text);
+
+	/*
+	 *	Check both formats round trip.
+	 */
+	copy = talloc_zero(autofree, rlm_cache_entry_t);
+	buff = talloc_memdup(autofree, text, text_len + 1);
+	if (cache_deserialize(copy, buff, text_len) < 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+	entry_cmp(entry, copy);
+
+	copy = talloc_zero(autofree, rlm_cache_entry_t);
+	if (cache_deserialize_binary(copy, bin, bin_len, fingerprint) != 0) {
+		fr_perror("cache_serialize_test");
+		exit(1);
+	}
+	entry_cmp(entry, copy);
+
+	/*
+	 *	Entries from different dictionaries are misses, not errors.
+	 */
+	copy = talloc_zero(autofree, rlm_cache_entry_t);
+	rad_assert(cache_deserialize_binary(copy, bin, bin_len, fingerprint + 1) == 1);
+
+	/*
+	 *	Truncated entries are errors.
+	 */
+	copy = talloc_zero(autofree, rlm_cache_entry_t);
+	rad_assert(cache_deserialize_binary(copy, bin, bin_len - 1, fingerprint) < 0);
+
+	/*
+	 *	Time both formats, using a pool per iteration as the
+	 *	drivers do.
+	 */
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		char *out;
+
+		pool = talloc_pool(NULL, 1024);
+		if (cache_serialize(pool, &out, entry) < 0) exit(1);
+		talloc_free(pool);
+	}
+	print_rate("text serialize", num, start, fr_time(), text_len);
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		uint8_t *out;
+
+		pool = talloc_pool(NULL, 1024);
+		if (cache_serialize_binary(pool, &out, entry, fingerprint) != 0) exit(1);
+		talloc_free(pool);
+	}
+	print_rate("binary serialize", num, start, fr_time(), bin_len);
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		pool = talloc_pool(NULL, 2048);
+		copy = talloc_zero(pool, rlm_cache_entry_t);
+		buff = talloc_memdup(pool, text, text_len + 1);
+		if (cache_deserialize(copy, buff, text_len) < 0) exit(1);
+		talloc_free(pool);
+	}
+	print_rate("text deserialize", num, start, fr_time(), text_len);
+
+	start = fr_time();
+	for (i = 0; i < num; i++) {
+		pool = talloc_pool(NULL, 2048);
+		copy = talloc_zero(pool, rlm_cache_entry_t);
+		if (cache_deserialize_binary(copy, bin, bin_len, fingerprint) != 0) exit(1);
+		talloc_free(pool);
+	}
+	print_rate("binary deserialize", num, start, fr_time(), bin_len);
+
+	talloc_free(autofree);
+
+	return 0;
+}
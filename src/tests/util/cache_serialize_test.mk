@@ -0,0 +1,7 @@
+TARGET := cache_serialize_test
+
+SOURCES		:= cache_serialize_test.c ../../modules/rlm_cache/serialize.c
+
+SRC_CFLAGS	+= -I$(top_builddir)/src/modules/rlm_cache
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,485 @@
+/*
+ * dhcp_lease_test.c	Tests and benchmarks for the rlm_dhcp_lease pools
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "lease.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define NSEC (1000000000)
+
+#define OFFER_TIME	(30)
+#define LEASE_TIME	(3600)
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: dhcp_lease_test [OPTS]\n");
+	fprintf(stderr, "  -d <dir>               Directory to write the pool files to (default /tmp).\n");
+	fprintf(stderr, "  -n <num>               Number of addresses in the benchmark pool.\n");
+	fprintf(stderr, "  -p                     Log changes to disk during the benchmark.\n");
+
+	exit(1);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "dhcp_lease_test: %s: %s\n", msg, fr_strerror());
+	exit(1);
+}
+
+/** Make up a device
+ *
+ * Odd numbered devices send a client identifier.
+ */
+static void device_init(lease_device_t *device, uint32_t num)
+{
+	memset(device, 0, sizeof(*device));
+
+	device->mac[0] = 0x02;
+	device->mac[2] = num >> 24;
+	device->mac[3] = num >> 16;
+	device->mac[4] = num >> 8;
+	device->mac[5] = num;
+
+	if (num & 1) {
+		device->client_id_len = 7;
+		device->client_id[0] = 0xff;
+		memcpy(device->client_id + 1, device->mac, sizeof(device->mac));
+	}
+}
+
+static lease_pool_t *pool_alloc(TALLOC_CTX *ctx)
+{
+	uint32_t	start[2] = { 0xc0000264, 0xc0000200 };	/* 192.0.2.100, 192.0.2.0 */
+	uint32_t	end[2] = { 0xc0000267, 0xc0000201 };	/* 192.0.2.103, 192.0.2.1 */
+	lease_pool_t	*pool;
+
+	pool = lease_pool_alloc(ctx, start, end, 2);
+	if (!pool) fail("Failed allocating pool");
+
+	return pool;
+}
+
+/** Discover, offer, request, ack
+ *
+ */
+static uint32_t dora(lease_pool_t *pool, time_t now, lease_device_t const *device)
+{
+	uint32_t address, expires;
+
+	if (lease_allocate(&address, &expires, pool, now, device, 0, OFFER_TIME) != LEASE_RCODE_SUCCESS) {
+		fail("Failed allocating");
+	}
+	if (lease_update(&expires, pool, now, device, address, LEASE_TIME) != LEASE_RCODE_SUCCESS) {
+		fail("Failed binding");
+	}
+	rad_assert(expires == LEASE_TIME);
+
+	return address;
+}
+
+static void test_pool(TALLOC_CTX *ctx)
+{
+	lease_pool_t	*pool = pool_alloc(ctx);
+	lease_device_t	device[8], other;
+	uint32_t	address[8], a, expires;
+	time_t		now = 1500000000;
+	int		i, j;
+
+	rad_assert(lease_pool_num_slots(pool) == 6);
+	rad_assert(lease_pool_num_free(pool) == 6);
+
+	/*
+	 *	Overlapping ranges are rejected.
+	 */
+	{
+		uint32_t start[2] = { 10, 20 }, end[2] = { 20, 30 };
+
+		rad_assert(lease_pool_alloc(ctx, start, end, 2) == NULL);
+	}
+
+	/*
+	 *	Every address can be allocated once.
+	 */
+	for (i = 0; i < 6; i++) {
+		device_init(&device[i], i);
+		address[i] = dora(pool, now, &device[i]);
+		rad_assert(lease_state(pool, now, address[i]) == LEASE_STATE_BOUND);
+
+		for (j = 0; j < i; j++) rad_assert(address[i] != address[j]);
+	}
+	rad_assert(lease_pool_num_free(pool) == 0);
+
+	device_init(&device[6], 6);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[6], 0, OFFER_TIME) == LEASE_RCODE_POOL_EMPTY);
+
+	/*
+	 *	Devices get their existing lease back, and it's not
+	 *	shortened by the offer.
+	 */
+	rad_assert(lease_allocate(&a, &expires, pool, now + 10, &device[3], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[3]);
+	rad_assert(expires == LEASE_TIME - 10);
+
+	/*
+	 *	Another device can't bind or release it.
+	 */
+	rad_assert(lease_update(&expires, pool, now, &device[6], address[3], LEASE_TIME) ==
+		   LEASE_RCODE_DEVICE_MISMATCH);
+	rad_assert(lease_release(pool, now, &device[6], address[3]) == LEASE_RCODE_DEVICE_MISMATCH);
+	rad_assert(lease_update(&expires, pool, now, &device[3], 0x0a000001, LEASE_TIME) == LEASE_RCODE_NOT_FOUND);
+
+	/*
+	 *	A device with the same MAC address, but a client
+	 *	identifier, is a different device.
+	 */
+	other = device[2];
+	other.client_id_len = 1;
+	rad_assert(lease_release(pool, now, &other, address[2]) == LEASE_RCODE_DEVICE_MISMATCH);
+
+	/*
+	 *	Released addresses are reused last, so devices which
+	 *	come back get the same address.
+	 */
+	rad_assert(lease_release(pool, now, &device[1], address[1]) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_release(pool, now, &device[4], address[4]) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_pool_num_free(pool) == 2);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[4], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[4]);
+	rad_assert(expires == OFFER_TIME);
+
+	/*
+	 *	A new device gets the address free the longest, and
+	 *	the device which had it gets a different one.
+	 */
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[6], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[1]);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[1], 0, OFFER_TIME) == LEASE_RCODE_POOL_EMPTY);
+
+	/*
+	 *	Offers expire, bound leases don't.
+	 */
+	rad_assert(lease_state(pool, now + OFFER_TIME - 1, address[4]) == LEASE_STATE_OFFERED);
+	rad_assert(lease_state(pool, now + OFFER_TIME, address[4]) == LEASE_STATE_FREE);
+	rad_assert(lease_state(pool, now + OFFER_TIME, address[1]) == LEASE_STATE_FREE);
+	rad_assert(lease_state(pool, now + OFFER_TIME, address[0]) == LEASE_STATE_BOUND);
+	rad_assert(lease_pool_num_free(pool) == 2);
+	now += OFFER_TIME;
+
+	/*
+	 *	A device can take any free address, and gives up the
+	 *	one it had.
+	 */
+	rad_assert(lease_update(&expires, pool, now, &device[0], address[1], LEASE_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_state(pool, now, address[0]) == LEASE_STATE_FREE);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[0], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[1]);
+
+	/*
+	 *	Only the device which was offered an address can
+	 *	decline it, and it isn't used again until the decline
+	 *	expires.
+	 */
+	device_init(&device[7], 7);
+	rad_assert(lease_decline(pool, now, &device[7], address[1], LEASE_TIME) == LEASE_RCODE_DEVICE_MISMATCH);
+	rad_assert(lease_decline(pool, now, &device[0], address[1], LEASE_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_state(pool, now, address[1]) == LEASE_STATE_DECLINED);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[7], address[1], OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a != address[1]);
+
+	/*
+	 *	Bound leases expire, even when more than one turn of
+	 *	the wheel has passed.
+	 */
+	now += LEASE_TIME * 2;
+	rad_assert(lease_pool_num_free(pool) == 1);
+	rad_assert(lease_state(pool, now, address[2]) == LEASE_STATE_FREE);
+	rad_assert(lease_pool_num_free(pool) == 6);
+
+	/*
+	 *	Requested addresses are honoured if they're free.
+	 */
+	device_init(&other, 1000);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &other, address[5], OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[5]);
+
+	talloc_free(pool);
+}
+
+static void test_persist(TALLOC_CTX *ctx, char const *dir)
+{
+	lease_pool_t	*pool;
+	lease_device_t	device[4];
+	uint32_t	address[4], a, expires;
+	time_t		now = 1500000000;
+	char		*filename, *path;
+	int		i;
+	FILE		*fp;
+
+	filename = talloc_typed_asprintf(ctx, "%s/dhcp_lease_test.%u", dir, (unsigned int) getpid());
+
+	pool = pool_alloc(ctx);
+	if (lease_pool_persist(pool, filename, false, now) < 0) fail("Failed persisting pool");
+
+	for (i = 0; i < 4; i++) {
+		device_init(&device[i], i);
+		address[i] = dora(pool, now, &device[i]);
+	}
+	rad_assert(lease_release(pool, now, &device[1], address[1]) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_decline(pool, now, &device[2], address[2], 60) == LEASE_RCODE_SUCCESS);
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[3], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	if (lease_pool_flush(pool) < 0) fail("Failed flushing pool");
+	talloc_free(pool);
+
+	/*
+	 *	Add a partial record to the log, as if we crashed
+	 *	while writing it.
+	 */
+	path = talloc_typed_asprintf(ctx, "%s.log", filename);
+	fp = fopen(path, "a");
+	if (!fp) fail("Failed opening log");
+	fwrite("\x01\x02\x03", 3, 1, fp);
+	fclose(fp);
+
+	/*
+	 *	Everything comes back from the log.
+	 */
+	pool = pool_alloc(ctx);
+	if (lease_pool_persist(pool, filename, false, now) < 0) fail("Failed loading pool");
+	rad_assert(lease_state(pool, now, address[0]) == LEASE_STATE_BOUND);
+	rad_assert(lease_state(pool, now, address[1]) == LEASE_STATE_FREE);
+	rad_assert(lease_state(pool, now, address[2]) == LEASE_STATE_DECLINED);
+	rad_assert(lease_state(pool, now, address[3]) == LEASE_STATE_BOUND);
+
+	/*
+	 *	Including who had the released lease.
+	 */
+	rad_assert(lease_allocate(&a, &expires, pool, now, &device[1], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+	rad_assert(a == address[1]);
+	talloc_free(pool);
+
+	/*
+	 *	And from the snapshot, with the expired leases freed.
+	 */
+	pool = pool_alloc(ctx);
+	if (lease_pool_persist(pool, filename, false, now + 60) < 0) fail("Failed loading pool");
+	rad_assert(lease_state(pool, now + 60, address[1]) == LEASE_STATE_FREE);
+	rad_assert(lease_state(pool, now + 60, address[2]) == LEASE_STATE_FREE);
+	rad_assert(lease_state(pool, now + 60, address[3]) == LEASE_STATE_BOUND);
+
+	/*
+	 *	Changes made while a snapshot is being written go to
+	 *	the new log, and changes before it are kept in the old
+	 *	one, until the snapshot is written.
+	 */
+	{
+		lease_snapshot_t *snap;
+
+		rad_assert(lease_release(pool, now + 60, &device[0], address[0]) == LEASE_RCODE_SUCCESS);
+		snap = lease_pool_snapshot_copy(ctx, pool);
+		if (!snap) fail("Failed copying pool");
+		rad_assert(lease_release(pool, now + 60, &device[3], address[3]) == LEASE_RCODE_SUCCESS);
+		talloc_free(snap);
+		talloc_free(pool);
+
+		/*
+		 *	As if we crashed before writing it.
+		 */
+		pool = pool_alloc(ctx);
+		if (lease_pool_persist(pool, filename, false, now + 60) < 0) fail("Failed loading pool");
+		rad_assert(lease_state(pool, now + 60, address[0]) == LEASE_STATE_FREE);
+		rad_assert(lease_state(pool, now + 60, address[3]) == LEASE_STATE_FREE);
+
+		rad_assert(lease_allocate(&a, &expires, pool, now + 60, &device[0], 0, OFFER_TIME) == LEASE_RCODE_SUCCESS);
+		snap = lease_pool_snapshot_copy(ctx, pool);
+		if (!snap) fail("Failed copying pool");
+		rad_assert(lease_update(&expires, pool, now + 60, &device[0], a, LEASE_TIME) == LEASE_RCODE_SUCCESS);
+		if (lease_snapshot_write(snap) < 0) fail("Failed writing snapshot");
+		talloc_free(snap);
+		talloc_free(pool);
+
+		pool = pool_alloc(ctx);
+		if (lease_pool_persist(pool, filename, false, now + 60) < 0) fail("Failed loading pool");
+		rad_assert(lease_state(pool, now + 60, a) == LEASE_STATE_BOUND);
+	}
+	talloc_free(pool);
+
+	/*
+	 *	Files for other ranges are rejected.
+	 */
+	{
+		uint32_t start = 0x0a000000, end = 0x0a0000ff;
+
+		pool = lease_pool_alloc(ctx, &start, &end, 1);
+		if (!pool) fail("Failed allocating pool");
+		rad_assert(lease_pool_persist(pool, filename, false, now) < 0);
+		talloc_free(pool);
+	}
+
+	unlink(path);
+	talloc_free(path);
+	path = talloc_typed_asprintf(ctx, "%s.snapshot", filename);
+	unlink(path);
+	talloc_free(path);
+	talloc_free(filename);
+}
+
+/** DORA for every device, then renewals, then releases
+ *
+ */
+static void bench(TALLOC_CTX *ctx, uint32_t num, char const *dir, bool persist)
+{
+	lease_pool_t	*pool;
+	lease_device_t	*devices;
+	uint32_t	*addresses, start = 0x0a000000, end, i, expires;
+	char		*filename = NULL;
+	time_t		now = time(NULL);
+	fr_time_t	when, delta;
+
+	end = start + num - 1;
+	pool = lease_pool_alloc(ctx, &start, &end, 1);
+	if (!pool) fail("Failed allocating pool");
+
+	if (persist) {
+		filename = talloc_typed_asprintf(ctx, "%s/dhcp_lease_bench.%u", dir, (unsigned int) getpid());
+		if (lease_pool_persist(pool, filename, false, now) < 0) fail("Failed persisting pool");
+	}
+
+	devices = talloc_array(ctx, lease_device_t, num);
+	addresses = talloc_array(ctx, uint32_t, num);
+	for (i = 0; i < num; i++) device_init(&devices[i], (i * 7919) + 1000);
+
+	when = fr_time();
+	for (i = 0; i < num; i++) {
+		if (lease_allocate(&addresses[i], &expires, pool, now, &devices[i], 0, OFFER_TIME) != LEASE_RCODE_SUCCESS) {
+			fail("Failed allocating");
+		}
+		if (lease_update(&expires, pool, now, &devices[i], addresses[i], LEASE_TIME) != LEASE_RCODE_SUCCESS) {
+			fail("Failed binding");
+		}
+	}
+	delta = fr_time() - when;
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " DORA/s  (%u addresses%s)\n", "discover+request",
+	       ((uint64_t) num * NSEC) / delta, num, persist ? ", logged" : "");
+
+	when = fr_time();
+	for (i = 0; i < num; i++) {
+		uint32_t j = (i * 7919) % num;
+
+		if (lease_update(&expires, pool, now, &devices[j], addresses[j], LEASE_TIME) != LEASE_RCODE_SUCCESS) {
+			fail("Failed renewing");
+		}
+	}
+	delta = fr_time() - when;
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " ops/s\n", "renew", ((uint64_t) num * NSEC) / delta);
+
+	when = fr_time();
+	for (i = 0; i < num; i++) {
+		if (lease_release(pool, now, &devices[i], addresses[i]) != LEASE_RCODE_SUCCESS) fail("Failed releasing");
+	}
+	delta = fr_time() - when;
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " ops/s\n", "release", ((uint64_t) num * NSEC) / delta);
+
+	/*
+	 *	Everyone comes back, and gets the same address.
+	 */
+	when = fr_time();
+	for (i = 0; i < num; i++) {
+		uint32_t address;
+
+		if (lease_allocate(&address, &expires, pool, now, &devices[i], 0, OFFER_TIME) != LEASE_RCODE_SUCCESS) {
+			fail("Failed allocating");
+		}
+		rad_assert(address == addresses[i]);
+	}
+	delta = fr_time() - when;
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " ops/s\n", "discover (returning)", ((uint64_t) num * NSEC) / delta);
+
+	if (persist) {
+		when = fr_time();
+		if (lease_pool_snapshot(pool) < 0) fail("Failed writing snapshot");
+		delta = fr_time() - when;
+		printf("%-24s %10" PRIu64 " ms\n", "snapshot", delta / 1000000);
+	}
+
+	talloc_free(pool);
+
+	if (filename) {
+		char *path;
+
+		path = talloc_typed_asprintf(ctx, "%s.log", filename);
+		unlink(path);
+		talloc_free(path);
+		path = talloc_typed_asprintf(ctx, "%s.snapshot", filename);
+		unlink(path);
+		talloc_free(path);
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	int		c;
+	uint32_t	num = 1 << 16;
+	bool		persist = false;
+	char const	*dir = "/tmp";
+	TALLOC_CTX	*autofree = talloc_init("main");
+
+	while ((c = getopt(argc, argv, "d:hn:p")) != EOF) switch (c) {
+		case 'd':
+			dir = optarg;
+			break;
+
+		case 'n':
+			num = strtoul(optarg, NULL, 10);
+			if (!num || (num > LEASE_SLOTS_MAX)) usage();
+			break;
+
+		case 'p':
+			persist = true;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	test_pool(autofree);
+	test_persist(autofree, dir);
+	bench(autofree, num, dir, persist);
+
+	talloc_free(autofree);
+
+	return 0;
+}
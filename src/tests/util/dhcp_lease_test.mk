@@ -0,0 +1,7 @@
+TARGET := dhcp_lease_test
+
+SOURCES		:= dhcp_lease_test.c ../../modules/rlm_dhcp_lease/lease.c
+
+SRC_CFLAGS	+= -I$(top_builddir)/src/modules/rlm_dhcp_lease
+TGT_PREREQS	:= libfreeradius-util.a
+TGT_LDLIBS	:= $(LIBS)
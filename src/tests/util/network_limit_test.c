@@ -0,0 +1,197 @@
+/*
+ * network_limit_test.c	Tests for the network admission control
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/io/worker.h>
+#include <freeradius-devel/io/network.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#define TEST(_x) do { if (!rad_cond_assert(_x)) exit(1); } while (0)
+
+static int		debug_lvl = 0;
+
+/** Send packets at a fixed rate, and count how many get through
+ *
+ * @param rate of the bucket.
+ * @param burst of the bucket.
+ * @param send_rate packets per second to send.
+ * @param seconds to send for.
+ * @return the number of packets which were allowed.
+ */
+static uint32_t send_packets(uint32_t rate, uint32_t burst, uint32_t send_rate, uint32_t seconds)
+{
+	fr_network_bucket_t	bucket;
+	fr_time_t		now;
+	uint32_t		i, allowed = 0;
+
+	memset(&bucket, 0, sizeof(bucket));
+
+	for (i = 0; i < send_rate * seconds; i++) {
+		now = NANOSEC + (((fr_time_t) i * NANOSEC) / send_rate);
+
+		if (fr_network_bucket_take(&bucket, rate, burst, now)) allowed++;
+	}
+
+	if (debug_lvl) printf("rate %u burst %u, sent %u at %u/s, allowed %u\n",
+			      rate, burst, send_rate * seconds, send_rate, allowed);
+
+	return allowed;
+}
+
+static void test_bucket(void)
+{
+	fr_network_bucket_t	bucket;
+	fr_time_t		now = NANOSEC;
+	int			i;
+
+	/*
+	 *	No limit.
+	 */
+	TEST(send_packets(0, 0, 1000, 10) == 10000);
+
+	/*
+	 *	An idle bucket is full, so "burst" packets get
+	 *	through at once, and no more.
+	 */
+	memset(&bucket, 0, sizeof(bucket));
+	for (i = 0; i < 10; i++) TEST(fr_network_bucket_take(&bucket, 100, 10, now));
+	TEST(!fr_network_bucket_take(&bucket, 100, 10, now));
+
+	/*
+	 *	One packet's worth of credit later, one more gets
+	 *	through.
+	 */
+	now += NANOSEC / 100;
+	TEST(fr_network_bucket_take(&bucket, 100, 10, now));
+	TEST(!fr_network_bucket_take(&bucket, 100, 10, now));
+
+	/*
+	 *	A long idle period only refills "burst" packets.
+	 */
+	now += (fr_time_t) 60 * NANOSEC;
+	for (i = 0; i < 10; i++) TEST(fr_network_bucket_take(&bucket, 100, 10, now));
+	TEST(!fr_network_bucket_take(&bucket, 100, 10, now));
+
+	/*
+	 *	Sending slower than the rate, everything gets through.
+	 */
+	TEST(send_packets(100, 10, 50, 10) == 500);
+
+	/*
+	 *	Sending 10 times faster than the rate.  The initial
+	 *	burst, then one packet every 10ms.  Dropped packets
+	 *	don't cost anything.
+	 */
+	TEST(send_packets(100, 10, 1000, 10) == (10 + 999));
+
+	/*
+	 *	A burst of 0 means "rate".
+	 */
+	TEST(send_packets(100, 0, 1000, 10) == (100 + 999));
+}
+
+static void test_shed(void)
+{
+	fr_network_limit_t	limit;
+	uint32_t		backlog, priority;
+
+	memset(&limit, 0, sizeof(limit));
+
+	/*
+	 *	No max_backlog, nothing is shed.
+	 */
+	TEST(!fr_network_shed(&limit, 1000000, 65535));
+
+	limit.max_backlog = 100;
+
+	/*
+	 *	Priority 0 is never shed.
+	 */
+	TEST(!fr_network_shed(&limit, 100, 0));
+	TEST(!fr_network_shed(&limit, 1000, 0));
+
+	/*
+	 *	Nothing is shed below half of max_backlog.
+	 */
+	TEST(!fr_network_shed(&limit, 49, 65535));
+
+	/*
+	 *	Everything else is shed at max_backlog.
+	 */
+	TEST(fr_network_shed(&limit, 100, 1));
+	TEST(fr_network_shed(&limit, 1000, 1));
+
+	/*
+	 *	Half way between the two, the lower priority half
+	 *	is shed.
+	 */
+	TEST(fr_network_shed(&limit, 75, 32768));
+	TEST(!fr_network_shed(&limit, 75, 32767));
+
+	/*
+	 *	Anything shed at one backlog is shed at all higher
+	 *	ones, and lower priority packets are shed first.
+	 */
+	for (backlog = 0; backlog < 110; backlog++) {
+		for (priority = 0; priority < 65536; priority += 257) {
+			if (!fr_network_shed(&limit, backlog, priority)) continue;
+
+			TEST(fr_network_shed(&limit, backlog + 1, priority));
+			if (priority < 65535) TEST(fr_network_shed(&limit, backlog, priority + 1));
+		}
+	}
+}
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: network_limit_test [OPTS]\n");
+	fprintf(stderr, "  -x                     Debugging mode.\n");
+
+	exit(1);
+}
+
+int main(int argc, char *argv[])
+{
+	int c;
+
+	while ((c = getopt(argc, argv, "hx")) != EOF) switch (c) {
+		case 'x':
+			debug_lvl++;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	test_bucket();
+	test_shed();
+
+	if (debug_lvl) printf("OK\n");
+
+	return 0;
+}
@@ -0,0 +1,6 @@
+TARGET := network_limit_test
+
+SOURCES		:= network_limit_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
@@ -0,0 +1,238 @@
+/*
+ * packet_list_test.c	Tests and benchmarks for fr_packet_list_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/resource.h>
+
+#define NSEC (1000000000)
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: packet_list_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of alloc/free cycles for the benchmark.\n");
+	fprintf(stderr, "  -s <num>               Number of sockets to add to the list.\n");
+
+	exit(1);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "packet_list_test: %s: %s\n", msg, fr_strerror());
+	exit(1);
+}
+
+/** Allocate an ID for a packet to the test server
+ *
+ */
+static bool alloc(fr_packet_list_t *pl, RADIUS_PACKET *packet, fr_ipaddr_t *server)
+{
+	packet->dst_ipaddr = *server;
+	packet->dst_port = 1812;
+	packet->src_ipaddr.af = AF_UNSPEC;
+	packet->src_port = 0;
+
+	return fr_packet_list_id_alloc(pl, IPPROTO_UDP, &packet, NULL);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, i, *fds, num_sockets = 300;
+	uint64_t		j, num = 1000000;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_packet_list_t	*pl;
+	fr_ipaddr_t		server;
+	RADIUS_PACKET		**packets, *reply;
+	uint32_t		num_packets;
+	uint8_t			*seen;
+	struct rlimit		limit;
+	struct timeval		tv;
+	fr_time_t		start, delta;
+
+	while ((c = getopt(argc, argv, "hn:s:")) != EOF) switch (c) {
+		case 'n':
+			num = strtoull(optarg, NULL, 10);
+			if (!num) usage();
+			break;
+
+		case 's':
+			num_sockets = atoi(optarg);
+			if (num_sockets < 2) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	/*
+	 *	Make sure we can open the sockets, and some, but
+	 *	don't complain if we're not allowed to.
+	 */
+	if (getrlimit(RLIMIT_NOFILE, &limit) == 0) {
+		if (limit.rlim_cur < (rlim_t) num_sockets + 64) {
+			limit.rlim_cur = num_sockets + 64;
+			if (limit.rlim_cur > limit.rlim_max) limit.rlim_cur = limit.rlim_max;
+			(void) setrlimit(RLIMIT_NOFILE, &limit);
+		}
+		if (limit.rlim_cur < (rlim_t) num_sockets + 64) num_sockets = limit.rlim_cur - 64;
+	}
+
+	memset(&server, 0, sizeof(server));
+	server.af = AF_INET;
+	server.prefix = 32;
+	server.ipaddr.ip4addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	pl = fr_packet_list_create(1);
+	rad_assert(pl != NULL);
+
+	fds = talloc_array(autofree, int, num_sockets);
+	for (i = 0; i < num_sockets; i++) {
+		fds[i] = fr_socket(&server, 0);
+		if (fds[i] < 0) fail("Failed opening socket");
+		fr_nonblock(fds[i]);
+
+		if (!fr_packet_list_socket_add(pl, fds[i], IPPROTO_UDP, &server, 0, NULL)) fail("Failed adding socket");
+	}
+
+	/*
+	 *	Every ID on every socket can be allocated, and no
+	 *	(socket, ID) is allocated twice.
+	 */
+	num_packets = num_sockets * 256;
+	packets = talloc_array(autofree, RADIUS_PACKET *, num_packets);
+	seen = talloc_zero_array(autofree, uint8_t, (fds[num_sockets - 1] + 1) * 256);
+
+	for (j = 0; j < num_packets; j++) {
+		packets[j] = fr_radius_alloc(autofree, false);
+		if (!alloc(pl, packets[j], &server)) fail("Failed allocating ID");
+
+		rad_assert(packets[j]->id >= 0);
+		rad_assert(packets[j]->id < 256);
+		rad_assert(!seen[(packets[j]->sockfd * 256) + packets[j]->id]);
+		seen[(packets[j]->sockfd * 256) + packets[j]->id] = 1;
+	}
+	rad_assert(fr_packet_list_num_outgoing(pl) == num_packets);
+
+	/*
+	 *	All full, until one is freed, then that's the one we
+	 *	get back.
+	 */
+	reply = fr_radius_alloc(autofree, false);
+	if (alloc(pl, reply, &server)) fail("Allocated ID from full list");
+
+	i = packets[1234 % num_packets]->sockfd;
+	c = packets[1234 % num_packets]->id;
+	if (!fr_packet_list_id_free(pl, packets[1234 % num_packets], true)) fail("Failed freeing ID");
+	if (!alloc(pl, reply, &server)) fail("Failed allocating ID");
+	rad_assert(reply->sockfd == i);
+	rad_assert(reply->id == c);
+
+	/*
+	 *	Frozen sockets aren't used for new packets.
+	 */
+	if (!fr_packet_list_id_free(pl, reply, true)) fail("Failed freeing ID");
+	if (!fr_packet_list_socket_freeze(pl, i)) fail("Failed freezing socket");
+	if (alloc(pl, reply, &server)) fail("Allocated ID from frozen socket");
+	if (!fr_packet_list_socket_thaw(pl, i)) fail("Failed thawing socket");
+	if (!alloc(pl, reply, &server)) fail("Failed allocating ID");
+	packets[1234 % num_packets] = reply;
+
+	/*
+	 *	Sockets with outstanding packets can't be deleted.
+	 */
+	if (fr_packet_list_socket_del(pl, fds[0])) fail("Deleted socket with outstanding packets");
+
+	/*
+	 *	Send a reply to the last socket, and make sure we see
+	 *	it.  It's beyond the first 256 entries in the table.
+	 */
+	{
+		uint8_t			data[AUTH_VECTOR_LEN + 4];
+		struct sockaddr_storage	ss;
+		socklen_t		ss_len = sizeof(ss);
+		int			rcode;
+
+		memset(data, 0, sizeof(data));
+		data[0] = PW_CODE_ACCESS_ACCEPT;
+		data[1] = 42;
+		data[3] = sizeof(data);
+
+		if (getsockname(fds[num_sockets - 1], (struct sockaddr *) &ss, &ss_len) < 0) fail("getsockname");
+		if (sendto(fds[0], data, sizeof(data), 0, (struct sockaddr *) &ss, ss_len) != sizeof(data)) {
+			fail("sendto");
+		}
+
+		tv.tv_sec = 1;
+		tv.tv_usec = 0;
+		rcode = fr_packet_list_poll(pl, &reply, &tv);
+		if (rcode != 1) fail("Didn't receive packet");
+		rad_assert(reply->sockfd == fds[num_sockets - 1]);
+		rad_assert(reply->id == 42);
+		fr_radius_free(&reply);
+
+		tv.tv_sec = 0;
+		if (fr_packet_list_poll(pl, &reply, &tv) != 0) fail("Received unexpected packet");
+	}
+
+	/*
+	 *	Time alloc/free with the list mostly full, which is
+	 *	the worst case for the old probing allocator.
+	 */
+	start = fr_time();
+	for (j = 0; j < num; j++) {
+		RADIUS_PACKET *packet = packets[(j * 7919) % num_packets];
+
+		if (!fr_packet_list_id_free(pl, packet, true)) fail("Failed freeing ID");
+		if (!alloc(pl, packet, &server)) fail("Failed allocating ID");
+	}
+	delta = fr_time() - start;
+	if (!delta) delta = 1;
+
+	printf("%-24s %10" PRIu64 " ops/s  (%u outstanding, %i sockets)\n", "id alloc/free",
+	       (j * NSEC) / delta, num_packets, num_sockets);
+
+	for (j = 0; j < num_packets; j++) {
+		if (!fr_packet_list_id_free(pl, packets[j], true)) fail("Failed freeing ID");
+	}
+	rad_assert(fr_packet_list_num_outgoing(pl) == 0);
+
+	for (i = 0; i < num_sockets; i++) {
+		if (!fr_packet_list_socket_del(pl, fds[i])) fail("Failed deleting socket");
+		close(fds[i]);
+	}
+
+	fr_packet_list_free(pl);
+	talloc_free(autofree);
+
+	return 0;
+}
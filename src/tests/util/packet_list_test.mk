@@ -0,0 +1,6 @@
+TARGET := packet_list_test
+
+SOURCES		:= packet_list_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
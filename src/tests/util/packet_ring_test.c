@@ -0,0 +1,375 @@
+/*
+ * packet_ring_test.c	Tests and benchmarks for fr_packet_ring_t
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+/*
+ *	Frames are sent with a private ethertype through one interface,
+ *	and read back from another.  By default both are "lo".  To test
+ *	with real Ethernet framing, create a veth pair, and send through
+ *	one end while capturing on the other:
+ *
+ *	  ip link add rt0 type veth peer name rt1
+ *	  ip link set rt0 up; ip link set rt1 up
+ *	  packet_ring_test -o rt0 -i rt1
+ */
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/packet_ring.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/rad_assert.h>
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#ifdef HAVE_PACKET_RING
+#include <poll.h>
+#include <pthread.h>
+#include <net/if.h>
+
+#define NSEC (1000000000)
+
+#define TEST_ETHERTYPE	(0x88b5)	/* IEEE 802 local experimental */
+#define TEST_FRAMES	(500)		/* Per round, small enough not to overflow the interface backlog */
+#define TEST_ROUNDS	(20)
+#define FRAME_MAX	(128)
+
+typedef struct {
+	int			fd;
+	struct sockaddr_ll	ll;
+	uint64_t		num;
+} sender_t;
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: packet_ring_test [OPTS]\n");
+	fprintf(stderr, "  -i <interface>         Interface to capture on (default lo).\n");
+	fprintf(stderr, "  -n <num>               Number of frames to send for the benchmark.\n");
+	fprintf(stderr, "  -o <interface>         Interface to send through (default is the capture interface).\n");
+
+	exit(1);
+}
+
+static void NEVER_RETURNS fail(char const *msg)
+{
+	fprintf(stderr, "packet_ring_test: %s: %s\n", msg, fr_strerror());
+	exit(1);
+}
+
+/** Build a test frame.  The length and contents depend on the sequence number
+ *
+ */
+static size_t frame_build(uint8_t *out, uint32_t seq)
+{
+	size_t len = 60 + (seq % (FRAME_MAX - 60)), i;
+
+	memset(out, 0xff, 6);
+	memcpy(out + 6, (uint8_t const[]){ 0x02, 0x00, 0x00, 0x00, 0x00, 0x01 }, 6);
+	out[12] = TEST_ETHERTYPE >> 8;
+	out[13] = TEST_ETHERTYPE & 0xff;
+	out[14] = seq >> 24;
+	out[15] = seq >> 16;
+	out[16] = seq >> 8;
+	out[17] = seq;
+	for (i = 18; i < len; i++) out[i] = (seq + i) & 0xff;
+
+	return len;
+}
+
+static void frame_send(sender_t *sender, uint32_t seq)
+{
+	uint8_t	frame[FRAME_MAX];
+	size_t	len;
+
+	len = frame_build(frame, seq);
+
+	/*
+	 *	Wait for space in the socket buffer, rather than
+	 *	losing frames before they get anywhere near the ring.
+	 */
+	while (sendto(sender->fd, frame, len, 0, (struct sockaddr *)&sender->ll, sizeof(sender->ll)) < 0) {
+		if ((errno != ENOBUFS) && (errno != EAGAIN)) {
+			fprintf(stderr, "packet_ring_test: sendto failed: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+		sched_yield();
+	}
+}
+
+/** Read the next frame from the ring, waiting for up to a second for one
+ *
+ */
+static void frame_next(fr_packet_ring_t *ring, fr_packet_ring_frame_t *frame)
+{
+	while (fr_packet_ring_next(ring, frame) == 0) {
+		struct pollfd pfd = { .fd = fr_packet_ring_fd(ring), .events = POLLIN };
+
+		if (poll(&pfd, 1, 1000) <= 0) fail("Timed out waiting for frame");
+	}
+}
+
+/** Check a frame from the ring matches the one we sent
+ *
+ */
+static void frame_check(fr_packet_ring_frame_t const *frame, uint32_t seq)
+{
+	uint8_t	expect[FRAME_MAX];
+	size_t	len;
+
+	len = frame_build(expect, seq);
+	if ((frame->len != len) || (memcmp(frame->data, expect, len) != 0)) {
+		fprintf(stderr, "packet_ring_test: frame %u doesn't match what was sent\n", seq);
+		exit(1);
+	}
+	rad_assert(frame->wire_len == len);
+	rad_assert(frame->timestamp.tv_sec != 0);
+}
+
+static void *sender_run(void *arg)
+{
+	sender_t	*sender = arg;
+	uint64_t	i;
+
+	for (i = 0; i < sender->num; i++) frame_send(sender, i);
+
+	return NULL;
+}
+
+/** Count frames until the sender is done, and we stop seeing any
+ *
+ */
+static uint64_t bench_ring(fr_packet_ring_t *ring, sender_t *sender, fr_time_t *delta)
+{
+	pthread_t		thread;
+	fr_packet_ring_frame_t	frame;
+	uint64_t		received = 0;
+	fr_time_t		start;
+	struct pollfd		pfd = { .fd = fr_packet_ring_fd(ring), .events = POLLIN };
+
+	start = fr_time();
+	if (pthread_create(&thread, NULL, sender_run, sender) != 0) fail("Failed creating sender");
+
+	while (received < sender->num) {
+		if (fr_packet_ring_next(ring, &frame) == 1) {
+			received++;
+			continue;
+		}
+		if (poll(&pfd, 1, 100) <= 0) break;
+	}
+	*delta = fr_time() - start;
+	pthread_join(thread, NULL);
+
+	return received;
+}
+
+static uint64_t bench_socket(int fd, sender_t *sender, fr_time_t *delta)
+{
+	pthread_t	thread;
+	uint8_t		buffer[2048];
+	uint64_t	received = 0;
+	fr_time_t	start;
+	struct pollfd	pfd = { .fd = fd, .events = POLLIN };
+
+	start = fr_time();
+	if (pthread_create(&thread, NULL, sender_run, sender) != 0) fail("Failed creating sender");
+
+	while (received < sender->num) {
+		struct sockaddr_ll	ll;
+		socklen_t		ll_len = sizeof(ll);
+
+		if (recvfrom(fd, buffer, sizeof(buffer), MSG_DONTWAIT, (struct sockaddr *)&ll, &ll_len) > 0) {
+			if (ll.sll_pkttype != PACKET_OUTGOING) received++;
+			continue;
+		}
+		if (poll(&pfd, 1, 100) <= 0) break;
+	}
+	*delta = fr_time() - start;
+	pthread_join(thread, NULL);
+
+	return received;
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, fd;
+	uint32_t		i, j;
+	uint64_t		num = 1000000, received, ring_received, ring_dropped;
+	char const		*in = "lo", *out = NULL;
+	int			in_index;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	fr_packet_ring_t	*ring;
+	fr_packet_ring_frame_t	frame;
+	sender_t		sender;
+	fr_time_t		delta;
+
+	/*
+	 *	Only let frames with odd sequence numbers through.
+	 *	The last byte of the sequence number is at offset 17.
+	 */
+	struct sock_filter	odd[] = {
+		BPF_STMT(BPF_LD | BPF_B | BPF_ABS, 17),
+		BPF_JUMP(BPF_JMP | BPF_JSET | BPF_K, 1, 0, 1),
+		BPF_STMT(BPF_RET | BPF_K, 0xffff),
+		BPF_STMT(BPF_RET | BPF_K, 0),
+	};
+
+	while ((c = getopt(argc, argv, "hi:n:o:")) != EOF) switch (c) {
+		case 'i':
+			in = optarg;
+			break;
+
+		case 'n':
+			num = strtoull(optarg, NULL, 10);
+			if (!num) usage();
+			break;
+
+		case 'o':
+			out = optarg;
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+	if (!out) out = in;
+
+	fr_time_start();
+
+	in_index = if_nametoindex(in);
+	if (!in_index) {
+		fprintf(stderr, "packet_ring_test: Unknown interface \"%s\"\n", in);
+		exit(1);
+	}
+
+	memset(&sender, 0, sizeof(sender));
+	sender.ll.sll_family = AF_PACKET;
+	sender.ll.sll_protocol = htons(TEST_ETHERTYPE);
+	sender.ll.sll_ifindex = if_nametoindex(out);
+	sender.ll.sll_halen = 6;
+	memset(sender.ll.sll_addr, 0xff, 6);
+	if (!sender.ll.sll_ifindex) {
+		fprintf(stderr, "packet_ring_test: Unknown interface \"%s\"\n", out);
+		exit(1);
+	}
+
+	/*
+	 *	Packet sockets need CAP_NET_RAW, which we don't have
+	 *	when the tests are run as a normal user.
+	 */
+	sender.fd = socket(AF_PACKET, SOCK_RAW, 0);
+	if (sender.fd < 0) {
+		if ((errno == EPERM) || (errno == EACCES)) {
+			printf("packet_ring_test: Skipping, opening packet sockets requires CAP_NET_RAW\n");
+			return 0;
+		}
+		fprintf(stderr, "packet_ring_test: Failed opening packet socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	ring = fr_packet_ring_alloc(autofree, in_index, TEST_ETHERTYPE, 0, false);
+	if (!ring) fail("Failed allocating ring");
+
+	/*
+	 *	Frames come back in order, and intact.  Between them,
+	 *	the rounds fill more than one block.
+	 */
+	for (j = 0; j < TEST_ROUNDS; j++) {
+		uint32_t base = j * TEST_FRAMES;
+
+		for (i = 0; i < TEST_FRAMES; i++) frame_send(&sender, base + i);
+		for (i = 0; i < TEST_FRAMES; i++) {
+			frame_next(ring, &frame);
+			frame_check(&frame, base + i);
+		}
+	}
+	if (fr_packet_ring_next(ring, &frame) != 0) fail("Received unexpected frame");
+
+	/*
+	 *	Only frames which pass the filter are seen.
+	 */
+	if (fr_packet_ring_filter(ring, odd, sizeof(odd) / sizeof(*odd)) < 0) fail("Failed attaching filter");
+	for (i = 0; i < 10; i++) frame_send(&sender, i);
+	for (i = 1; i < 10; i += 2) {
+		frame_next(ring, &frame);
+		frame_check(&frame, i);
+	}
+	usleep((PACKET_RING_TIMEOUT * 2) * 1000);
+	if (fr_packet_ring_next(ring, &frame) != 0) fail("Received frame which should have been filtered");
+
+	if (fr_packet_ring_stats(ring, &ring_received, &ring_dropped) < 0) fail("Failed getting stats");
+	rad_assert(ring_received >= (TEST_FRAMES * TEST_ROUNDS) + 5);
+	rad_assert(ring_dropped == 0);
+
+	talloc_free(ring);
+
+	/*
+	 *	Time how many frames each method gets through, with
+	 *	another thread sending as fast as it can.
+	 */
+	sender.num = num;
+
+	ring = fr_packet_ring_alloc(autofree, in_index, TEST_ETHERTYPE, 0, false);
+	if (!ring) fail("Failed allocating ring");
+
+	received = bench_ring(ring, &sender, &delta);
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " frames/s  (%" PRIu64 " of %" PRIu64 " received)\n", "ring",
+	       (received * NSEC) / delta, received, num);
+	talloc_free(ring);
+
+	fd = socket(AF_PACKET, SOCK_RAW, htons(TEST_ETHERTYPE));
+	if (fd < 0) {
+		fprintf(stderr, "packet_ring_test: Failed opening packet socket: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+	{
+		struct sockaddr_ll ll;
+
+		memset(&ll, 0, sizeof(ll));
+		ll.sll_family = AF_PACKET;
+		ll.sll_protocol = htons(TEST_ETHERTYPE);
+		ll.sll_ifindex = in_index;
+		if (bind(fd, (struct sockaddr *)&ll, sizeof(ll)) < 0) {
+			fprintf(stderr, "packet_ring_test: Failed binding packet socket: %s\n", fr_syserror(errno));
+			exit(1);
+		}
+	}
+
+	received = bench_socket(fd, &sender, &delta);
+	if (!delta) delta = 1;
+	printf("%-24s %10" PRIu64 " frames/s  (%" PRIu64 " of %" PRIu64 " received)\n", "recvfrom",
+	       (received * NSEC) / delta, received, num);
+
+	close(fd);
+	close(sender.fd);
+	talloc_free(autofree);
+
+	return 0;
+}
+#else
+int main(UNUSED int argc, UNUSED char *argv[])
+{
+	printf("packet_ring_test: Skipping, memory mapped packet rings aren't supported on this system\n");
+
+	return 0;
+}
+#endif
@@ -0,0 +1,6 @@
+TARGET := packet_ring_test
+
+SOURCES		:= packet_ring_test.c
+
+TGT_PREREQS	:= libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)
@@ -57,6 +57,7 @@ static fr_ipaddr_t	my_ipaddr;
 static int		my_port;
 static char const	*secret = "testing123";
 static fr_packet_ctx_t  packet_ctx = { 0 };
+static fr_network_limit_t limit = { 0 };
 
 /*
  *	@todo fix this...
@@ -150,6 +151,35 @@ static ssize_t test_write(int sockfd, void *ctx, uint8_t *buffer, size_t buffer_
 	return data_size;
 }
 
+/*
+ *	Identify the client by its source IP address, and shed
+ *	accounting before authentication.
+ */
+static size_t test_classify(void const *ctx, uint8_t const *data, size_t data_len,
+			    uint8_t *client, size_t client_len, uint32_t *priority)
+{
+	fr_packet_ctx_t const *pc = ctx;
+
+	*priority = 0;
+	if ((data_len >= 1) && (data[0] == PW_CODE_ACCOUNTING_REQUEST)) *priority = 32768;
+
+	switch (pc->src.ss_family) {
+	case AF_INET:
+		if (client_len < sizeof(struct in_addr)) return 0;
+
+		memcpy(client, &((struct sockaddr_in const *) &pc->src)->sin_addr, sizeof(struct in_addr));
+		return sizeof(struct in_addr);
+
+	case AF_INET6:
+		if (client_len < sizeof(struct in6_addr)) return 0;
+
+		memcpy(client, &((struct sockaddr_in6 const *) &pc->src)->sin6_addr, sizeof(struct in6_addr));
+		return sizeof(struct in6_addr);
+
+	default:
+		return 0;
+	}
+}
 
 static fr_transport_t transport = {
 	.name = "schedule-test",
@@ -161,6 +191,7 @@ static fr_transport_t transport = {
 	.encode = test_encode,
 	.nak = test_nak,
 	.process = test_process,
+	.classify = test_classify,
 };
 
 static fr_transport_t *transports = &transport;
@@ -170,6 +201,9 @@ static void NEVER_RETURNS usage(void)
 	fprintf(stderr, "usage: schedule_test [OPTS]\n");
 	fprintf(stderr, "  -n <num>               Start num network threads\n");
 	fprintf(stderr, "  -i <address>[:port]    Set IP address and optional port.\n");
+	fprintf(stderr, "  -c <pps>               Limit each client to pps packets per second.\n");
+	fprintf(stderr, "  -l <pps>               Limit the socket to pps packets per second.\n");
+	fprintf(stderr, "  -q <depth>             Shed low priority packets when workers have depth queued.\n");
 	fprintf(stderr, "  -s <secret>            Set shared secret.\n");
 	fprintf(stderr, "  -x                     Debugging mode.\n");
 
@@ -196,7 +230,11 @@ int main(int argc, char *argv[])
 	my_ipaddr.ipaddr.ip4addr.s_addr = htonl(INADDR_LOOPBACK);
 	my_port = 1812;
 
-	while ((c = getopt(argc, argv, "i:n:s:w:x")) != EOF) switch (c) {
+	while ((c = getopt(argc, argv, "c:i:l:n:q:s:w:x")) != EOF) switch (c) {
+		case 'c':
+			limit.client_rate = atoi(optarg);
+			break;
+
 		case 'i':
 			if (fr_inet_pton_port(&my_ipaddr, &port16, optarg, -1, AF_INET, true, false) < 0) {
 				fprintf(stderr, "Failed parsing ipaddr: %s\n", fr_strerror());
@@ -205,11 +243,19 @@ int main(int argc, char *argv[])
 			my_port = port16;
 			break;
 
+		case 'l':
+			limit.listener_rate = atoi(optarg);
+			break;
+
 		case 'n':
 			num_networks = atoi(optarg);
 			if ((num_networks <= 0) || (num_networks > 16)) usage();
 			break;
 
+		case 'q':
+			limit.max_backlog = atoi(optarg);
+			break;
+
 		case 's':
 			secret = optarg;
 			break;
@@ -266,7 +312,7 @@ int main(int argc, char *argv[])
 
 	packet_ctx.sockfd = sockfd;
 
-	(void) fr_schedule_socket_add(sched, sockfd, &packet_ctx, &transport);
+	(void) fr_schedule_socket_add(sched, sockfd, &packet_ctx, &transport, &limit);
 
 	sleep(10);
 
@@ -0,0 +1,272 @@
+/*
+ * tacacs_reader_test.c	Tests and benchmarks for the TACACS+ buffered reader
+ *
+ * Version:	$Id$
+ *
+ *   This program is free software; you can redistribute it and/or modify
+ *   it under the terms of the GNU General Public License as published by
+ *   the Free Software Foundation; either version 2 of the License, or
+ *   (at your option) any later version.
+ *
+ *   This program is distributed in the hope that it will be useful,
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ *   GNU General Public License for more details.
+ *
+ *   You should have received a copy of the GNU General Public License
+ *   along with this program; if not, write to the Free Software
+ *   Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA 02110-1301, USA
+ *
+ * Copyright 2017  The FreeRADIUS server project
+ */
+
+RCSID("$Id$")
+
+#include <freeradius-devel/libradius.h>
+#include <freeradius-devel/io/time.h>
+#include <freeradius-devel/md5.h>
+#include <freeradius-devel/rad_assert.h>
+
+#include "tacacs.h"
+
+#ifdef HAVE_GETOPT_H
+#	include <getopt.h>
+#endif
+
+#include <sys/socket.h>
+
+#define NSEC (1000000000)
+
+static char const	*secret = "testing123";
+
+static void NEVER_RETURNS usage(void)
+{
+	fprintf(stderr, "usage: tacacs_reader_test [OPTS]\n");
+	fprintf(stderr, "  -n <num>               Number of packets to decode for the benchmark.\n");
+
+	exit(1);
+}
+
+/** Obfuscate a packet body, the slow way, as described in the draft
+ *
+ */
+static void obfuscate(uint8_t *data, size_t data_len)
+{
+	tacacs_packet_hdr_t	*hdr = (tacacs_packet_hdr_t *)data;
+	uint8_t			buf[256 + MD5_DIGEST_LENGTH];
+	uint8_t			pad[MD5_DIGEST_LENGTH];
+	size_t			secret_len = strlen(secret);
+	size_t			prefix_len, pos, i;
+
+	memcpy(buf, &hdr->session_id, 4);
+	memcpy(buf + 4, secret, secret_len);
+	buf[4 + secret_len] = data[0];		/* version */
+	buf[5 + secret_len] = hdr->seq_no;
+	prefix_len = 6 + secret_len;
+
+	fr_md5_calc(pad, buf, prefix_len);
+	for (pos = sizeof(*hdr), i = 0; pos < data_len; pos++, i++) {
+		if (i == MD5_DIGEST_LENGTH) {
+			memcpy(buf + prefix_len, pad, MD5_DIGEST_LENGTH);
+			fr_md5_calc(pad, buf, prefix_len + MD5_DIGEST_LENGTH);
+			i = 0;
+		}
+		data[pos] ^= pad[i];
+	}
+}
+
+/** Build an Authentication START packet, with a data field of data_len bytes
+ *
+ */
+static size_t authen_start(uint8_t *out, uint32_t session_id, uint8_t data_len, bool encrypt)
+{
+	static char const	user[] = "bob";
+	static char const	port[] = "tty0";
+	static char const	rem_addr[] = "192.0.2.1";
+	tacacs_packet_hdr_t	*hdr = (tacacs_packet_hdr_t *)out;
+	uint8_t			*p;
+	size_t			body_len;
+
+	memset(out, 0, sizeof(*hdr) + 8);
+	out[0] = (TAC_PLUS_MAJOR_VER << 4);
+	hdr->type = TAC_PLUS_AUTHEN;
+	hdr->seq_no = 1;
+	hdr->flags = encrypt ? 0 : TAC_PLUS_UNENCRYPTED_FLAG;
+	hdr->session_id = htonl(session_id);
+
+	p = out + sizeof(*hdr);
+	p[0] = 1;			/* action = login */
+	p[1] = 1;			/* priv_lvl */
+	p[2] = 2;			/* authen_type = PAP */
+	p[3] = 1;			/* service = login */
+	p[4] = sizeof(user) - 1;
+	p[5] = sizeof(port) - 1;
+	p[6] = sizeof(rem_addr) - 1;
+	p[7] = data_len;
+	p += 8;
+
+	memcpy(p, user, sizeof(user) - 1);
+	p += sizeof(user) - 1;
+	memcpy(p, port, sizeof(port) - 1);
+	p += sizeof(port) - 1;
+	memcpy(p, rem_addr, sizeof(rem_addr) - 1);
+	p += sizeof(rem_addr) - 1;
+	memset(p, 'x', data_len);
+	p += data_len;
+
+	body_len = p - (out + sizeof(*hdr));
+	hdr->length = htonl(body_len);
+
+	if (encrypt) obfuscate(out, sizeof(*hdr) + body_len);
+
+	return sizeof(*hdr) + body_len;
+}
+
+/** Write data to the client end of the connection
+ *
+ */
+static void send_data(int fd, void const *data, size_t len)
+{
+	if (write(fd, data, len) != (ssize_t)len) {
+		fprintf(stderr, "tacacs_reader_test: write failed: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+}
+
+/** Read the next packet, and check it matches the plaintext
+ *
+ * @param[in] ctx	to allocate the packet in.
+ * @param[in] reader	to read from.
+ * @param[in] plain	what the packet should decrypt to.
+ * @param[in] len	of the packet.
+ * @param[in] expect	what tacacs_reader_next should return.
+ */
+static void next(TALLOC_CTX *ctx, tacacs_reader_t *reader, uint8_t const *plain, size_t len, int expect)
+{
+	RADIUS_PACKET	*packet;
+	int		rcode;
+
+	packet = fr_radius_alloc(ctx, false);
+	rcode = tacacs_reader_next(packet, reader, secret);
+	if (rcode != expect) {
+		fprintf(stderr, "tacacs_reader_test: expected %i, got %i: %s\n", expect, rcode, fr_strerror());
+		exit(1);
+	}
+
+	if (rcode == 1) {
+		rad_assert(packet->data_len == len);
+		rad_assert(memcmp(packet->data + sizeof(tacacs_packet_hdr_t),
+				  plain + sizeof(tacacs_packet_hdr_t), len - sizeof(tacacs_packet_hdr_t)) == 0);
+	}
+	talloc_free(packet);
+}
+
+int main(int argc, char *argv[])
+{
+	int			c, fd[2];
+	uint64_t		i, num = 100000;
+	TALLOC_CTX		*autofree = talloc_init("main");
+	tacacs_reader_t		*reader;
+	uint8_t			plain[3][TACACS_MAX_PACKET_SIZE], enc[3][TACACS_MAX_PACKET_SIZE];
+	uint8_t			batch[TACACS_READ_BUFFER_SIZE];
+	size_t			len[3], batch_len, per_batch;
+	ssize_t			len_read;
+	fr_time_t		start, delta;
+
+	while ((c = getopt(argc, argv, "hn:")) != EOF) switch (c) {
+		case 'n':
+			num = strtoull(optarg, NULL, 10);
+			if (!num) usage();
+			break;
+
+		case 'h':
+		default:
+			usage();
+	}
+
+	fr_time_start();
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fd) < 0) {
+		fprintf(stderr, "tacacs_reader_test: socketpair failed: %s\n", fr_syserror(errno));
+		exit(1);
+	}
+
+	/*
+	 *	Bodies which do, and don't, end on a pad block
+	 *	boundary.
+	 */
+	len[0] = authen_start(plain[0], 1, 0, false);
+	len[1] = authen_start(plain[1], 2, 8, false);
+	len[2] = authen_start(plain[2], 3, 201, false);
+	rad_assert(((len[1] - sizeof(tacacs_packet_hdr_t)) % MD5_DIGEST_LENGTH) == 0);
+
+	for (i = 0; i < 3; i++) {
+		authen_start(enc[i], i + 1, plain[i][sizeof(tacacs_packet_hdr_t) + 7], true);
+	}
+
+	reader = tacacs_reader_alloc(autofree);
+	rad_assert(reader != NULL);
+
+	/*
+	 *	Several packets in one read, the last one split.
+	 */
+	send_data(fd[1], enc[0], len[0]);
+	send_data(fd[1], enc[1], len[1]);
+	send_data(fd[1], enc[2], 5);
+	len_read = tacacs_reader_fill(reader, fd[0]);
+	rad_assert(len_read == (ssize_t)(len[0] + len[1] + 5));
+
+	next(autofree, reader, plain[0], len[0], 1);
+	next(autofree, reader, plain[1], len[1], 1);
+	next(autofree, reader, plain[2], len[2], 0);
+
+	send_data(fd[1], enc[2] + 5, len[2] - 5);
+	len_read = tacacs_reader_fill(reader, fd[0]);
+	rad_assert(len_read == (ssize_t)(len[2] - 5));
+	next(autofree, reader, plain[2], len[2], 1);
+	next(autofree, reader, plain[2], len[2], 0);
+	rad_assert(reader->start == 0);
+	rad_assert(reader->end == 0);
+
+	/*
+	 *	A bad packet is an error.
+	 */
+	memcpy(batch, enc[2], len[2]);
+	batch[sizeof(tacacs_packet_hdr_t) + 7] ^= 0xff;
+	send_data(fd[1], batch, len[2]);
+	len_read = tacacs_reader_fill(reader, fd[0]);
+	rad_assert(len_read == (ssize_t)len[2]);
+	next(autofree, reader, plain[2], len[2], -1);
+
+	/*
+	 *	Time decoding batches of pipelined packets.
+	 */
+	reader = tacacs_reader_alloc(autofree);
+	per_batch = sizeof(batch) / len[2];
+	for (batch_len = 0, i = 0; i < per_batch; i++, batch_len += len[2]) {
+		memcpy(batch + batch_len, enc[2], len[2]);
+	}
+
+	start = fr_time();
+	for (i = 0; i < num; i += per_batch) {
+		size_t j;
+
+		send_data(fd[1], batch, batch_len);
+		len_read = tacacs_reader_fill(reader, fd[0]);
+		rad_assert(len_read == (ssize_t)batch_len);
+		for (j = 0; j < per_batch; j++) {
+			next(autofree, reader, plain[2], len[2], 1);
+		}
+	}
+	delta = fr_time() - start;
+	if (!delta) delta = 1;
+
+	printf("%-24s %10" PRIu64 " packets/s  (%zu bytes)\n", "pipelined decode",
+	       (i * NSEC) / delta, len[2]);
+
+	close(fd[0]);
+	close(fd[1]);
+	talloc_free(autofree);
+
+	return 0;
+}
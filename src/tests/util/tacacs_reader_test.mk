@@ -0,0 +1,7 @@
+TARGET := tacacs_reader_test
+
+SOURCES		:= tacacs_reader_test.c
+
+SRC_CFLAGS	+= -I$(top_builddir)/src/modules/proto_tacacs
+TGT_PREREQS	:= libfreeradius-tacacs.a libfreeradius-util.a libfreeradius-server.a libfreeradius-io.a
+TGT_LDLIBS	:= $(LIBS)